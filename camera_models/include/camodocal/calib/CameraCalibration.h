@@ -51,6 +51,8 @@ public:
     bool readChessboardData(const std::string& filename);
 
     void setVerbose(bool verbose);
+    // threads for the per-view extrinsics and the Ceres residual and jacobian evaluation
+    void setThreads(int threads);
 
 private:
     bool calibrateHelper(CameraPtr& camera,
@@ -77,6 +79,7 @@ private:
     Eigen::Matrix2d m_measurementCovariance;
 
     bool m_verbose;
+    int m_threads;
 };
 
 }
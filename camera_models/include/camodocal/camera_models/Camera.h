@@ -85,6 +85,15 @@ class Camera
     virtual void spaceToPlane( const Eigen::Vector3d& P, Eigen::Vector2d& p ) const = 0;
     //%output p
 
+    // The three functions above on n points. The models override them with loops calling their
+    // own implementation directly, so there is one virtual call and one model setup per batch
+    // instead of per point. PinholeCamera and EquidistantCamera lift a batch with Newton
+    // iterations that stop at a tolerance, the fast path of the undistortion, which agrees with
+    // the single point lift to its convergence error.
+    virtual void liftSphereBatch( const Eigen::Vector2d* p, Eigen::Vector3d* P, int n ) const;
+    virtual void liftProjectiveBatch( const Eigen::Vector2d* p, Eigen::Vector3d* P, int n ) const;
+    virtual void spaceToPlaneBatch( const Eigen::Vector3d* P, Eigen::Vector2d* p, int n ) const;
+
     // Projects 3D points to the image plane (Pi function)
     // and calculates jacobian
     // virtual void spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
@@ -141,6 +150,11 @@ class Camera
                         std::vector< cv::Point2f >& imagePoints ) const;
 
     protected:
+    // mapX / mapY of initUndistortRectifyMap: the pixel of this camera seen by every pixel of
+    // the rectified camera, back projected through ray_transform = R_inv * K_rect_inv. One
+    // spaceToPlaneBatch per row, the rows spread over the OpenCV threads.
+    void fillRectifyMap( const Eigen::Matrix3f& ray_transform, cv::Mat& mapX, cv::Mat& mapY ) const;
+
     cv::Mat m_mask;
 };
 
@@ -101,6 +101,11 @@ public:
     void spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p) const;
     //%output p
 
+    // batches of the three functions above, see Camera
+    void liftSphereBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, int n) const;
+    void liftProjectiveBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, int n) const;
+    void spaceToPlaneBatch(const Eigen::Vector3d* P, Eigen::Vector2d* p, int n) const;
+
     // Projects 3D points to the image plane (Pi function)
     // and calculates jacobian
     void spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
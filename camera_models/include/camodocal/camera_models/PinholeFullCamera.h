@@ -158,6 +158,11 @@ class PinholeFullCamera : public Camera
     void spaceToPlane( const Eigen::Vector3d& P, Eigen::Vector2d& p ) const;
     //%output p
 
+    // batches of the three functions above, see Camera
+    void liftSphereBatch( const Eigen::Vector2d* p, Eigen::Vector3d* P, int n ) const;
+    void liftProjectiveBatch( const Eigen::Vector2d* p, Eigen::Vector3d* P, int n ) const;
+    void spaceToPlaneBatch( const Eigen::Vector3d* P, Eigen::Vector2d* p, int n ) const;
+
     void spaceToPlane( const Eigen::Vector3d& P, Eigen::Vector2d& p, float image_scalse ) const;
 
     // Projects 3D points to the image plane (Pi function)
@@ -0,0 +1,60 @@
+#ifndef RECTIFYMAP_H
+#define RECTIFYMAP_H
+
+#include <memory>
+#include <string>
+#include <opencv2/core/core.hpp>
+
+#include "camodocal/camera_models/Camera.h"
+
+namespace camodocal
+{
+
+// Dense undistort and rectify maps of one camera (Camera::initUndistortRectifyMap), built once,
+// kept in a binary cache file and applied to whole images. With the library built against the
+// OpenCV cuda modules and setUseGpu, the maps are uploaded once and applied with cv::cuda::remap.
+class RectifyMap
+{
+public:
+    RectifyMap();
+
+    // same arguments as Camera::initUndistortRectifyMap, -1 picks the camera focal length and
+    // the image center
+    void build(const CameraConstPtr& camera, const cv::Mat& rmat,
+               float fx = -1.0f, float fy = -1.0f, cv::Size imageSize = cv::Size(0, 0),
+               float cx = -1.0f, float cy = -1.0f);
+
+    // the cache is only accepted if it was written for the same intrinsics and arguments
+    bool readFromFile(const std::string& filename, const CameraConstPtr& camera, const cv::Mat& rmat,
+                      float fx = -1.0f, float fy = -1.0f, cv::Size imageSize = cv::Size(0, 0),
+                      float cx = -1.0f, float cy = -1.0f);
+    bool writeToFile(const std::string& filename) const;
+
+    // false when the gpu is asked for and the library has no cuda support or there is no device,
+    // remap then stays on the cpu
+    bool setUseGpu(bool useGpu);
+
+    // linear interpolation, pixels mapped outside the image are black. Safe to call from
+    // several threads.
+    void remap(const cv::Mat& src, cv::Mat& dst) const;
+
+    // camera matrix of the rectified image, CV_32F
+    const cv::Mat& cameraMatrix(void) const;
+
+    bool empty(void) const;
+
+private:
+    static std::string key(const CameraConstPtr& camera, const cv::Mat& rmat,
+                           float fx, float fy, cv::Size imageSize, float cx, float cy);
+
+    std::string m_key;
+    cv::Mat m_mapX, m_mapY; // CV_32FC1, pixel of the camera per rectified pixel
+    cv::Mat m_K;
+
+    struct GpuMaps;
+    std::shared_ptr<GpuMaps> m_gpu;
+};
+
+}
+
+#endif
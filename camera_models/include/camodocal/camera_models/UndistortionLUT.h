@@ -0,0 +1,42 @@
+#ifndef UNDISTORTIONLUT_H
+#define UNDISTORTIONLUT_H
+
+#include <string>
+#include <eigen3/Eigen/Dense>
+#include <opencv2/core/core.hpp>
+
+#include "camodocal/camera_models/Camera.h"
+
+namespace camodocal
+{
+
+// Dense grid of liftProjective results, one node every `step` pixels, looked up with bilinear
+// interpolation instead of running the iterative distortion inversion per point.
+// With step <= 0 or for points outside the image it forwards to the camera itself.
+class UndistortionLUT
+{
+public:
+    UndistortionLUT();
+
+    void build(const CameraConstPtr& camera, int step);
+
+    // the cache is only accepted if it was written for the same intrinsics and step
+    bool readFromFile(const std::string& filename, const CameraConstPtr& camera, int step);
+    bool writeToFile(const std::string& filename) const;
+
+    // same contract as Camera::liftProjective, P is returned with z = 1
+    void liftProjective(const Eigen::Vector2d& p, Eigen::Vector3d& P) const;
+    // n points at once, an empty table forwards the whole batch to the camera
+    void liftProjectiveBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, int n) const;
+
+    bool empty(void) const;
+
+private:
+    CameraConstPtr m_camera;
+    int m_step;
+    cv::Mat m_map; // CV_32FC2, x/z and y/z per grid node
+};
+
+}
+
+#endif
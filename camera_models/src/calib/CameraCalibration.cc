@@ -6,6 +6,7 @@
 #include <iostream>
 #include <algorithm>
 #include <fstream>
+#include <thread>
 #include <opencv2/core/core.hpp>
 #include <opencv2/core/eigen.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -28,6 +29,7 @@ CameraCalibration::CameraCalibration()
  : m_boardSize(cv::Size(0,0))
  , m_squareSize(0.0f)
  , m_verbose(false)
+ , m_threads(1)
 {
 
 }
@@ -40,6 +42,7 @@ CameraCalibration::CameraCalibration(const Camera::ModelType modelType,
  : m_boardSize(boardSize)
  , m_squareSize(squareSize)
  , m_verbose(false)
+ , m_threads(1)
 {
     m_camera = CameraFactory::instance()->generateCamera(modelType, cameraName, imageSize);
 }
@@ -424,6 +427,12 @@ CameraCalibration::setVerbose(bool verbose)
     m_verbose = verbose;
 }
 
+void
+CameraCalibration::setThreads(int threads)
+{
+    m_threads = std::max(threads, 1);
+}
+
 bool
 CameraCalibration::calibrateHelper(CameraPtr& camera,
                                    std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs) const
@@ -434,10 +443,21 @@ CameraCalibration::calibrateHelper(CameraPtr& camera,
     // STEP 1: Estimate intrinsics
     camera->estimateIntrinsics(m_boardSize, m_scenePoints, m_imagePoints);
 
-    // STEP 2: Estimate extrinsics
-    for (size_t i = 0; i < m_scenePoints.size(); ++i)
+    // STEP 2: Estimate extrinsics, the views are independent and the camera is only read
+    std::vector<std::thread> workers;
+    for (int t = 0; t < m_threads; ++t)
+    {
+        workers.push_back(std::thread([&, t]()
+        {
+            for (size_t i = t; i < m_scenePoints.size(); i += m_threads)
+            {
+                camera->estimateExtrinsics(m_scenePoints.at(i), m_imagePoints.at(i), rvecs.at(i), tvecs.at(i));
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); ++t)
     {
-        camera->estimateExtrinsics(m_scenePoints.at(i), m_imagePoints.at(i), rvecs.at(i), tvecs.at(i));
+        workers.at(t).join();
     }
 
     if (m_verbose)
@@ -517,7 +537,9 @@ CameraCalibration::optimize(CameraPtr& camera,
     std::cout << "begin ceres" << std::endl;
     ceres::Solver::Options options;
     options.max_num_iterations = 1000;
-    options.num_threads = 1;
+    // the poses are eliminated and leave a dense system of the few intrinsics
+    options.linear_solver_type = ceres::DENSE_SCHUR;
+    options.num_threads = m_threads;
 
     if (m_verbose)
     {
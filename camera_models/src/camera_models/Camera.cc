@@ -2,6 +2,7 @@
 #include "camodocal/camera_models/ScaramuzzaCamera.h"
 
 #include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/core/utility.hpp>
 
 namespace camodocal
 {
@@ -119,6 +120,62 @@ Camera::mask(void) const
     return m_mask;
 }
 
+void
+Camera::liftSphereBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, int n) const
+{
+    for (int i = 0; i < n; ++i)
+    {
+        liftSphere(p[i], P[i]);
+    }
+}
+
+void
+Camera::liftProjectiveBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, int n) const
+{
+    for (int i = 0; i < n; ++i)
+    {
+        liftProjective(p[i], P[i]);
+    }
+}
+
+void
+Camera::spaceToPlaneBatch(const Eigen::Vector3d* P, Eigen::Vector2d* p, int n) const
+{
+    for (int i = 0; i < n; ++i)
+    {
+        spaceToPlane(P[i], p[i]);
+    }
+}
+
+void
+Camera::fillRectifyMap(const Eigen::Matrix3f& ray_transform, cv::Mat& mapX, cv::Mat& mapY) const
+{
+    const Eigen::Matrix3d M = ray_transform.cast<double>();
+    cv::parallel_for_(cv::Range(0, mapX.rows), [&](const cv::Range& range)
+    {
+        std::vector<Eigen::Vector3d> rays(mapX.cols);
+        std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d> > pixels(mapX.cols);
+        for (int v = range.start; v < range.end; ++v)
+        {
+            Eigen::Vector3d ray = M.col(1) * v + M.col(2);
+            for (int u = 0; u < mapX.cols; ++u)
+            {
+                rays[u] = ray;
+                ray += M.col(0);
+            }
+            spaceToPlaneBatch(rays.data(), pixels.data(), mapX.cols);
+
+            float* x = mapX.ptr<float>(v);
+            float* y = mapY.ptr<float>(v);
+            for (int u = 0; u < mapX.cols; ++u)
+            {
+                x[u] = pixels[u](0);
+                y[u] = pixels[u](1);
+            }
+        }
+    });
+}
+
 void
 Camera::estimateExtrinsics(const std::vector<cv::Point3f>& objectPoints,
                            const std::vector<cv::Point2f>& imagePoints,
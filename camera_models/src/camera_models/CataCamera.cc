@@ -658,6 +658,34 @@ CataCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p) const
          mParameters.gamma2() * p_d(1) + mParameters.v0();
 }
 
+void
+CataCamera::liftSphereBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, int n) const
+{
+    // qualified calls, direct and inlined
+    for (int i = 0; i < n; ++i)
+    {
+        CataCamera::liftSphere(p[i], P[i]);
+    }
+}
+
+void
+CataCamera::liftProjectiveBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, int n) const
+{
+    for (int i = 0; i < n; ++i)
+    {
+        CataCamera::liftProjective(p[i], P[i]);
+    }
+}
+
+void
+CataCamera::spaceToPlaneBatch(const Eigen::Vector3d* P, Eigen::Vector2d* p, int n) const
+{
+    for (int i = 0; i < n; ++i)
+    {
+        CataCamera::spaceToPlane(P[i], p[i]);
+    }
+}
+
 #if 0
 /** 
  * \brief Project a 3D point to the image plane and calculate Jacobian
@@ -890,22 +918,7 @@ CataCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
     cv::cv2eigen(rmat, R);
     R_inv = R.inverse();
 
-    for (int v = 0; v < imageSize.height; ++v)
-    {
-        for (int u = 0; u < imageSize.width; ++u)
-        {
-            Eigen::Vector3f xo;
-            xo << u, v, 1;
-
-            Eigen::Vector3f uo = R_inv * K_rect_inv * xo;
-
-            Eigen::Vector2d p;
-            spaceToPlane(uo.cast<double>(), p);
-
-            mapX.at<float>(v,u) = p(0);
-            mapY.at<float>(v,u) = p(1);
-        }
-    }
+    fillRectifyMap(R_inv * K_rect_inv, mapX, mapY);
 
     cv::convertMaps(mapX, mapY, map1, map2, CV_32FC1, false);
 
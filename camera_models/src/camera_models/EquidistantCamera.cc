@@ -460,6 +460,82 @@ EquidistantCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p) co
          mParameters.mv() * p_u(1) + mParameters.v0();
 }
 
+void
+EquidistantCamera::liftSphereBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, int n) const
+{
+    // the projective rays are already of unit length
+    EquidistantCamera::liftProjectiveBatch(p, P, n);
+}
+
+/**
+ * \brief liftProjective on n points
+ *
+ * theta is solved with Newton iterations on r(theta) = |p_u| started at |p_u|, which ends in
+ * two or three steps inside the field of view instead of an eigen decomposition of the
+ * companion matrix per point. A point that does not converge, or lands past the maximum of
+ * r(theta), goes through backprojectSymmetric.
+ */
+void
+EquidistantCamera::liftProjectiveBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, int n) const
+{
+    const double k2 = mParameters.k2();
+    const double k3 = mParameters.k3();
+    const double k4 = mParameters.k4();
+    const double k5 = mParameters.k5();
+    const double tol = 1e-12;
+    const int max_iterations = 10;
+    for (int i = 0; i < n; ++i)
+    {
+        Eigen::Vector2d p_u;
+        p_u << m_inv_K11 * p[i](0) + m_inv_K13,
+               m_inv_K22 * p[i](1) + m_inv_K23;
+
+        double p_u_norm = p_u.norm();
+        double theta = p_u_norm;
+        bool converged = false;
+        for (int k = 0; k < max_iterations; ++k)
+        {
+            double theta2 = theta * theta;
+            double f = theta * (1.0 + theta2 * (k2 + theta2 * (k3 + theta2 * (k4 + theta2 * k5)))) - p_u_norm;
+            double df = 1.0 + theta2 * (3.0 * k2 + theta2 * (5.0 * k3 + theta2 * (7.0 * k4 + theta2 * 9.0 * k5)));
+            if (df <= 0.0)
+            {
+                break;
+            }
+            double step = f / df;
+            theta -= step;
+            if (fabs(step) < tol)
+            {
+                converged = theta >= 0.0;
+                break;
+            }
+        }
+
+        double phi;
+        if (converged)
+        {
+            phi = p_u_norm < 1e-10 ? 0.0 : atan2(p_u(1), p_u(0));
+        }
+        else
+        {
+            backprojectSymmetric(p_u, theta, phi);
+        }
+
+        P[i](0) = sin(theta) * cos(phi);
+        P[i](1) = sin(theta) * sin(phi);
+        P[i](2) = cos(theta);
+    }
+}
+
+void
+EquidistantCamera::spaceToPlaneBatch(const Eigen::Vector3d* P, Eigen::Vector2d* p, int n) const
+{
+    for (int i = 0; i < n; ++i)
+    {
+        EquidistantCamera::spaceToPlane(P[i], p[i]);
+    }
+}
+
 
 /** 
  * \brief Project a 3D point to the image plane and calculate Jacobian
@@ -583,22 +659,7 @@ EquidistantCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
     cv::cv2eigen(rmat, R);
     R_inv = R.inverse();
 
-    for (int v = 0; v < imageSize.height; ++v)
-    {
-        for (int u = 0; u < imageSize.width; ++u)
-        {
-            Eigen::Vector3f xo;
-            xo << u, v, 1;
-
-            Eigen::Vector3f uo = R_inv * K_rect_inv * xo;
-
-            Eigen::Vector2d p;
-            spaceToPlane(uo.cast<double>(), p);
-
-            mapX.at<float>(v,u) = p(0);
-            mapY.at<float>(v,u) = p(1);
-        }
-    }
+    fillRectifyMap(R_inv * K_rect_inv, mapX, mapY);
 
     cv::convertMaps(mapX, mapY, map1, map2, CV_32FC1, false);
 
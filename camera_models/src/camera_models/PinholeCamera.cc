@@ -541,6 +541,104 @@ PinholeCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p) const
          mParameters.fy() * p_d(1) + mParameters.cy();
 }
 
+void
+PinholeCamera::liftSphereBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, int n) const
+{
+    liftProjectiveBatch(p, P, n);
+    for (int i = 0; i < n; ++i)
+    {
+        P[i].normalize();
+    }
+}
+
+/**
+ * \brief liftProjective on n points, the parameters read once
+ *
+ * The distortion is removed with Newton iterations on p_d = p_u + d(p_u), started at p_d and
+ * stopped once the step is below 1e-12 on the normalised plane, three or four iterations at
+ * typical radii. This converges to the exact inverse where the recursive model of
+ * liftProjective stops eight fixed point iterations short of it near the image corners.
+ */
+void
+PinholeCamera::liftProjectiveBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, int n) const
+{
+    const double inv_K11 = m_inv_K11, inv_K13 = m_inv_K13;
+    const double inv_K22 = m_inv_K22, inv_K23 = m_inv_K23;
+    if (m_noDistortion)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            P[i] << inv_K11 * p[i](0) + inv_K13, inv_K22 * p[i](1) + inv_K23, 1.0;
+        }
+        return;
+    }
+
+    const double k1 = mParameters.k1();
+    const double k2 = mParameters.k2();
+    const double p1 = mParameters.p1();
+    const double p2 = mParameters.p2();
+    const double tol2 = 1e-24;
+    const int max_iterations = 10;
+    for (int i = 0; i < n; ++i)
+    {
+        double mx_d = inv_K11 * p[i](0) + inv_K13;
+        double my_d = inv_K22 * p[i](1) + inv_K23;
+        double mx_u = mx_d, my_u = my_d;
+        for (int k = 0; k < max_iterations; ++k)
+        {
+            double mx2_u = mx_u * mx_u;
+            double my2_u = my_u * my_u;
+            double mxy_u = mx_u * my_u;
+            double rho2_u = mx2_u + my2_u;
+            double rad_dist_u = k1 * rho2_u + k2 * rho2_u * rho2_u;
+            double drad = 2.0 * (k1 + 2.0 * k2 * rho2_u);
+
+            // residual and jacobian of p_u + d(p_u) - p_d, the jacobian is symmetric
+            double ex = mx_u + mx_u * rad_dist_u + 2.0 * p1 * mxy_u + p2 * (rho2_u + 2.0 * mx2_u) - mx_d;
+            double ey = my_u + my_u * rad_dist_u + 2.0 * p2 * mxy_u + p1 * (rho2_u + 2.0 * my2_u) - my_d;
+            double j11 = 1.0 + rad_dist_u + drad * mx2_u + 2.0 * p1 * my_u + 6.0 * p2 * mx_u;
+            double j12 = drad * mxy_u + 2.0 * p1 * mx_u + 2.0 * p2 * my_u;
+            double j22 = 1.0 + rad_dist_u + drad * my2_u + 2.0 * p2 * mx_u + 6.0 * p1 * my_u;
+
+            double inv_det = 1.0 / (j11 * j22 - j12 * j12);
+            double sx = inv_det * (j22 * ex - j12 * ey);
+            double sy = inv_det * (j11 * ey - j12 * ex);
+            mx_u -= sx;
+            my_u -= sy;
+            if (sx * sx + sy * sy < tol2)
+            {
+                break;
+            }
+        }
+        P[i] << mx_u, my_u, 1.0;
+    }
+}
+
+void
+PinholeCamera::spaceToPlaneBatch(const Eigen::Vector3d* P, Eigen::Vector2d* p, int n) const
+{
+    const double fx = mParameters.fx(), fy = mParameters.fy();
+    const double cx = mParameters.cx(), cy = mParameters.cy();
+    const double k1 = m_noDistortion ? 0.0 : mParameters.k1();
+    const double k2 = m_noDistortion ? 0.0 : mParameters.k2();
+    const double p1 = m_noDistortion ? 0.0 : mParameters.p1();
+    const double p2 = m_noDistortion ? 0.0 : mParameters.p2();
+    for (int i = 0; i < n; ++i)
+    {
+        double inv_z = 1.0 / P[i](2);
+        double mx_u = P[i](0) * inv_z;
+        double my_u = P[i](1) * inv_z;
+        double mx2_u = mx_u * mx_u;
+        double my2_u = my_u * my_u;
+        double mxy_u = mx_u * my_u;
+        double rho2_u = mx2_u + my2_u;
+        double rad_dist_u = k1 * rho2_u + k2 * rho2_u * rho2_u;
+        double mx_d = mx_u + mx_u * rad_dist_u + 2.0 * p1 * mxy_u + p2 * (rho2_u + 2.0 * mx2_u);
+        double my_d = my_u + my_u * rad_dist_u + 2.0 * p2 * mxy_u + p1 * (rho2_u + 2.0 * my2_u);
+        p[i] << fx * mx_d + cx, fy * my_d + cy;
+    }
+}
+
 #if 0
 /**
  * \brief Project a 3D point to the image plane and calculate Jacobian
@@ -768,22 +866,7 @@ PinholeCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
 
     Eigen::Matrix3f K_rect_inv = K_rect.inverse();
 
-    for (int v = 0; v < imageSize.height; ++v)
-    {
-        for (int u = 0; u < imageSize.width; ++u)
-        {
-            Eigen::Vector3f xo;
-            xo << u, v, 1;
-
-            Eigen::Vector3f uo = R_inv * K_rect_inv * xo;
-
-            Eigen::Vector2d p;
-            spaceToPlane(uo.cast<double>(), p);
-
-            mapX.at<float>(v,u) = p(0);
-            mapY.at<float>(v,u) = p(1);
-        }
-    }
+    fillRectifyMap(R_inv * K_rect_inv, mapX, mapY);
 
     cv::convertMaps(mapX, mapY, map1, map2, CV_32FC1, false);
 
@@ -644,6 +644,28 @@ PinholeFullCamera::spaceToPlane( const Eigen::Vector3d& P, Eigen::Vector2d& p )
     mParameters.fy( ) * p_d( 1 ) + mParameters.cy( );
 }
 
+void
+PinholeFullCamera::liftSphereBatch( const Eigen::Vector2d* p, Eigen::Vector3d* P, int n ) const
+{
+    // qualified calls, direct and inlined
+    for ( int i = 0; i < n; ++i )
+        PinholeFullCamera::liftSphere( p[i], P[i] );
+}
+
+void
+PinholeFullCamera::liftProjectiveBatch( const Eigen::Vector2d* p, Eigen::Vector3d* P, int n ) const
+{
+    for ( int i = 0; i < n; ++i )
+        PinholeFullCamera::liftProjective( p[i], P[i] );
+}
+
+void
+PinholeFullCamera::spaceToPlaneBatch( const Eigen::Vector3d* P, Eigen::Vector2d* p, int n ) const
+{
+    for ( int i = 0; i < n; ++i )
+        PinholeFullCamera::spaceToPlane( P[i], p[i] );
+}
+
 void
 PinholeFullCamera::spaceToPlane( const Eigen::Vector3d& P, Eigen::Vector2d& p, float image_scalse ) const
 {
@@ -882,22 +904,7 @@ cv::Mat& map1, cv::Mat& map2, float fx, float fy, cv::Size imageSize, float cx,
 
     Eigen::Matrix3f K_rect_inv = K_rect.inverse( );
 
-    for ( int v = 0; v < imageSize.height; ++v )
-    {
-        for ( int u = 0; u < imageSize.width; ++u )
-        {
-            Eigen::Vector3f xo;
-            xo << u, v, 1;
-
-            Eigen::Vector3f uo = R_inv * K_rect_inv * xo;
-
-            Eigen::Vector2d p;
-            spaceToPlane( uo.cast< double >( ), p );
-
-            mapX.at< float >( v, u ) = p( 0 );
-            mapY.at< float >( v, u ) = p( 1 );
-        }
-    }
+    fillRectifyMap( R_inv * K_rect_inv, mapX, mapY );
 
     cv::convertMaps( mapX, mapY, map1, map2, CV_32FC1, false );
 
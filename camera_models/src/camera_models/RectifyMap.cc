@@ -0,0 +1,200 @@
+#include "camodocal/camera_models/RectifyMap.h"
+
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#ifdef CAMERA_MODELS_CUDA
+#include <opencv2/core/cuda.hpp>
+#include <opencv2/cudawarping.hpp>
+#endif
+
+namespace camodocal
+{
+
+// file layout: magic, key length and key, rows, cols, the 3x3 camera matrix, mapX, mapY
+static const char RECTIFY_MAP_MAGIC[8] = {'R', 'M', 'A', 'P', '0', '0', '0', '1'};
+
+struct RectifyMap::GpuMaps
+{
+#ifdef CAMERA_MODELS_CUDA
+    cv::cuda::GpuMat mapX, mapY;
+    std::mutex mutex;
+    cv::cuda::GpuMat src, dst;
+    cv::cuda::Stream stream;
+#endif
+};
+
+RectifyMap::RectifyMap()
+{
+}
+
+std::string
+RectifyMap::key(const CameraConstPtr& camera, const cv::Mat& rmat,
+                float fx, float fy, cv::Size imageSize, float cx, float cy)
+{
+    cv::Mat R;
+    rmat.convertTo(R, CV_32F);
+
+    std::ostringstream oss;
+    oss.precision(9);
+    oss << camera->parametersToString() << " rect";
+    for (int i = 0; i < 9; ++i)
+    {
+        oss << " " << R.at<float>(i / 3, i % 3);
+    }
+    oss << " " << fx << " " << fy << " " << cx << " " << cy
+        << " " << imageSize.width << " " << imageSize.height;
+    return oss.str();
+}
+
+void
+RectifyMap::build(const CameraConstPtr& camera, const cv::Mat& rmat,
+                  float fx, float fy, cv::Size imageSize, float cx, float cy)
+{
+    cv::Mat R;
+    rmat.convertTo(R, CV_32F);
+
+    m_K = camera->initUndistortRectifyMap(m_mapX, m_mapY, fx, fy, imageSize, cx, cy, R);
+    m_key = key(camera, rmat, fx, fy, imageSize, cx, cy);
+    setUseGpu(static_cast<bool>(m_gpu));
+}
+
+bool
+RectifyMap::readFromFile(const std::string& filename, const CameraConstPtr& camera, const cv::Mat& rmat,
+                         float fx, float fy, cv::Size imageSize, float cx, float cy)
+{
+    std::ifstream ifs(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!ifs.is_open())
+    {
+        return false;
+    }
+
+    char magic[8];
+    ifs.read(magic, sizeof(magic));
+    if (!ifs || memcmp(magic, RECTIFY_MAP_MAGIC, sizeof(magic)) != 0)
+    {
+        return false;
+    }
+
+    std::string expected = key(camera, rmat, fx, fy, imageSize, cx, cy);
+    int keyLength = 0;
+    ifs.read(reinterpret_cast<char*>(&keyLength), sizeof(keyLength));
+    if (!ifs || keyLength != static_cast<int>(expected.size()))
+    {
+        return false;
+    }
+    std::string fileKey(keyLength, '\0');
+    ifs.read(&fileKey[0], keyLength);
+    if (!ifs || fileKey != expected)
+    {
+        return false;
+    }
+
+    int rows = 0, cols = 0;
+    ifs.read(reinterpret_cast<char*>(&rows), sizeof(rows));
+    ifs.read(reinterpret_cast<char*>(&cols), sizeof(cols));
+    if (!ifs || rows <= 0 || cols <= 0)
+    {
+        return false;
+    }
+
+    cv::Mat K(3, 3, CV_32F);
+    cv::Mat mapX(rows, cols, CV_32FC1);
+    cv::Mat mapY(rows, cols, CV_32FC1);
+    ifs.read(reinterpret_cast<char*>(K.data), 9 * sizeof(float));
+    ifs.read(reinterpret_cast<char*>(mapX.data), mapX.total() * sizeof(float));
+    ifs.read(reinterpret_cast<char*>(mapY.data), mapY.total() * sizeof(float));
+    if (!ifs)
+    {
+        return false;
+    }
+
+    m_key = expected;
+    m_K = K;
+    m_mapX = mapX;
+    m_mapY = mapY;
+    setUseGpu(static_cast<bool>(m_gpu));
+    return true;
+}
+
+bool
+RectifyMap::writeToFile(const std::string& filename) const
+{
+    if (empty() || m_K.type() != CV_32F)
+    {
+        return false;
+    }
+
+    std::ofstream ofs(filename.c_str(), std::ios::out | std::ios::binary);
+    if (!ofs.is_open())
+    {
+        return false;
+    }
+
+    int keyLength = m_key.size();
+    int rows = m_mapX.rows;
+    int cols = m_mapX.cols;
+    cv::Mat K = m_K.clone();
+    ofs.write(RECTIFY_MAP_MAGIC, sizeof(RECTIFY_MAP_MAGIC));
+    ofs.write(reinterpret_cast<const char*>(&keyLength), sizeof(keyLength));
+    ofs.write(m_key.data(), keyLength);
+    ofs.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+    ofs.write(reinterpret_cast<const char*>(&cols), sizeof(cols));
+    ofs.write(reinterpret_cast<const char*>(K.data), 9 * sizeof(float));
+    ofs.write(reinterpret_cast<const char*>(m_mapX.data), m_mapX.total() * sizeof(float));
+    ofs.write(reinterpret_cast<const char*>(m_mapY.data), m_mapY.total() * sizeof(float));
+    return static_cast<bool>(ofs);
+}
+
+bool
+RectifyMap::setUseGpu(bool useGpu)
+{
+    m_gpu.reset();
+#ifdef CAMERA_MODELS_CUDA
+    if (useGpu && cv::cuda::getCudaEnabledDeviceCount() > 0)
+    {
+        m_gpu = std::make_shared<GpuMaps>();
+        if (!empty())
+        {
+            m_gpu->mapX.upload(m_mapX);
+            m_gpu->mapY.upload(m_mapY);
+        }
+    }
+#endif
+    return useGpu == static_cast<bool>(m_gpu);
+}
+
+void
+RectifyMap::remap(const cv::Mat& src, cv::Mat& dst) const
+{
+#ifdef CAMERA_MODELS_CUDA
+    if (m_gpu && !m_gpu->mapX.empty())
+    {
+        std::lock_guard<std::mutex> lock(m_gpu->mutex);
+        m_gpu->src.upload(src, m_gpu->stream);
+        cv::cuda::remap(m_gpu->src, m_gpu->dst, m_gpu->mapX, m_gpu->mapY,
+                        cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(), m_gpu->stream);
+        m_gpu->dst.download(dst, m_gpu->stream);
+        m_gpu->stream.waitForCompletion();
+        return;
+    }
+#endif
+    cv::remap(src, dst, m_mapX, m_mapY, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+}
+
+const cv::Mat&
+RectifyMap::cameraMatrix(void) const
+{
+    return m_K;
+}
+
+bool
+RectifyMap::empty(void) const
+{
+    return m_mapX.empty();
+}
+
+}
@@ -652,6 +652,34 @@ OCAMCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p) const
          xn[0] * mParameters.E() + xn[1]                   + mParameters.center_y();
 }
 
+void
+OCAMCamera::liftSphereBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, int n) const
+{
+    // qualified calls, direct and inlined
+    for (int i = 0; i < n; ++i)
+    {
+        OCAMCamera::liftSphere(p[i], P[i]);
+    }
+}
+
+void
+OCAMCamera::liftProjectiveBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, int n) const
+{
+    for (int i = 0; i < n; ++i)
+    {
+        OCAMCamera::liftProjective(p[i], P[i]);
+    }
+}
+
+void
+OCAMCamera::spaceToPlaneBatch(const Eigen::Vector3d* P, Eigen::Vector2d* p, int n) const
+{
+    for (int i = 0; i < n; ++i)
+    {
+        OCAMCamera::spaceToPlane(P[i], p[i]);
+    }
+}
+
 
 /** 
  * \brief Projects an undistorted 2D point p_u to the image plane
@@ -733,22 +761,7 @@ OCAMCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
     cv::cv2eigen(rmat, R);
     R_inv = R.inverse();
 
-    for (int v = 0; v < imageSize.height; ++v)
-    {
-        for (int u = 0; u < imageSize.width; ++u)
-        {
-            Eigen::Vector3f xo;
-            xo << u, v, 1;
-
-            Eigen::Vector3f uo = R_inv * K_rect_inv * xo;
-
-            Eigen::Vector2d p;
-            spaceToPlane(uo.cast<double>(), p);
-
-            mapX.at<float>(v,u) = p(0);
-            mapY.at<float>(v,u) = p(1);
-        }
-    }
+    fillRectifyMap(R_inv * K_rect_inv, mapX, mapY);
 
     cv::convertMaps(mapX, mapY, map1, map2, CV_32FC1, false);
 
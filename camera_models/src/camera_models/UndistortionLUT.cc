@@ -0,0 +1,149 @@
+#include "camodocal/camera_models/UndistortionLUT.h"
+
+#include <vector>
+#include <opencv2/core/persistence.hpp>
+
+namespace camodocal
+{
+
+UndistortionLUT::UndistortionLUT()
+ : m_step(0)
+{
+}
+
+void
+UndistortionLUT::build(const CameraConstPtr& camera, int step)
+{
+    m_camera = camera;
+    m_step = step;
+    m_map.release();
+    if (m_step <= 0)
+    {
+        return;
+    }
+
+    // one extra node past the last pixel so every in-image point has four neighbours
+    int cols = (m_camera->imageWidth() - 1) / m_step + 2;
+    int rows = (m_camera->imageHeight() - 1) / m_step + 2;
+    m_map.create(rows, cols, CV_32FC2);
+    std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d> > pixels(cols);
+    std::vector<Eigen::Vector3d> rays(cols);
+    for (int r = 0; r < rows; ++r)
+    {
+        for (int c = 0; c < cols; ++c)
+        {
+            pixels[c] = Eigen::Vector2d(c * m_step, r * m_step);
+        }
+        m_camera->liftProjectiveBatch(pixels.data(), rays.data(), cols);
+
+        cv::Vec2f* row = m_map.ptr<cv::Vec2f>(r);
+        for (int c = 0; c < cols; ++c)
+        {
+            row[c] = cv::Vec2f(rays[c](0) / rays[c](2), rays[c](1) / rays[c](2));
+        }
+    }
+}
+
+bool
+UndistortionLUT::readFromFile(const std::string& filename, const CameraConstPtr& camera, int step)
+{
+    cv::FileStorage fs(filename, cv::FileStorage::READ);
+    if (!fs.isOpened())
+    {
+        return false;
+    }
+
+    std::string parameters;
+    int fileStep = fs["step"];
+    fs["parameters"] >> parameters;
+    if (fileStep != step || step <= 0 || parameters != camera->parametersToString())
+    {
+        return false;
+    }
+
+    cv::Mat map;
+    fs["map"] >> map;
+    if (map.type() != CV_32FC2 ||
+        map.cols != (camera->imageWidth() - 1) / step + 2 ||
+        map.rows != (camera->imageHeight() - 1) / step + 2)
+    {
+        return false;
+    }
+
+    m_camera = camera;
+    m_step = step;
+    m_map = map;
+    return true;
+}
+
+bool
+UndistortionLUT::writeToFile(const std::string& filename) const
+{
+    if (empty())
+    {
+        return false;
+    }
+
+    cv::FileStorage fs(filename, cv::FileStorage::WRITE);
+    if (!fs.isOpened())
+    {
+        return false;
+    }
+
+    fs << "step" << m_step;
+    fs << "parameters" << m_camera->parametersToString();
+    fs << "map" << m_map;
+    return true;
+}
+
+void
+UndistortionLUT::liftProjective(const Eigen::Vector2d& p, Eigen::Vector3d& P) const
+{
+    if (empty() ||
+        p(0) < 0.0 || p(0) > m_camera->imageWidth() - 1 ||
+        p(1) < 0.0 || p(1) > m_camera->imageHeight() - 1)
+    {
+        m_camera->liftProjective(p, P);
+        return;
+    }
+
+    double gx = p(0) / m_step;
+    double gy = p(1) / m_step;
+    int x0 = static_cast<int>(gx);
+    int y0 = static_cast<int>(gy);
+    double ax = gx - x0;
+    double ay = gy - y0;
+
+    const cv::Vec2f* r0 = m_map.ptr<cv::Vec2f>(y0);
+    const cv::Vec2f* r1 = m_map.ptr<cv::Vec2f>(y0 + 1);
+    for (int i = 0; i < 2; ++i)
+    {
+        double top = (1.0 - ax) * r0[x0][i] + ax * r0[x0 + 1][i];
+        double bottom = (1.0 - ax) * r1[x0][i] + ax * r1[x0 + 1][i];
+        P(i) = (1.0 - ay) * top + ay * bottom;
+    }
+    P(2) = 1.0;
+}
+
+void
+UndistortionLUT::liftProjectiveBatch(const Eigen::Vector2d* p, Eigen::Vector3d* P, int n) const
+{
+    if (empty())
+    {
+        m_camera->liftProjectiveBatch(p, P, n);
+        return;
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        liftProjective(p[i], P[i]);
+    }
+}
+
+bool
+UndistortionLUT::empty(void) const
+{
+    return m_map.empty();
+}
+
+}
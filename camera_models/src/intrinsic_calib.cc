@@ -1,9 +1,13 @@
 #include <algorithm>
+#include <atomic>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
 #include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -25,6 +29,7 @@ main( int argc, char** argv )
     bool useOpenCV;
     bool viewResults;
     bool verbose;
+    int threads;
 
     //========= Handling Program options =========
     boost::program_options::options_description desc( "Allowed options" );
@@ -55,7 +60,9 @@ main( int argc, char** argv )
                         "Use OpenCV to detect corners" )(
     "view-results",
     boost::program_options::bool_switch( &viewResults )->default_value( false ),
-    "View results" )( "verbose,v",
+    "View results" )( "threads,j",
+                      boost::program_options::value< int >( &threads )->default_value( 0 ),
+                      "Threads for the chessboard detection and the calibration, 0 for all cores" )( "verbose,v",
                       boost::program_options::bool_switch( &verbose )->default_value( true ),
                       "Verbose output" );
 
@@ -182,18 +189,70 @@ main( int argc, char** argv )
     cv::Mat image            = cv::imread( imageFilenames.front( ), -1 );
     const cv::Size frameSize = image.size( );
 
+    if ( threads <= 0 )
+    {
+        threads = std::max( static_cast< int >( std::thread::hardware_concurrency( ) ), 1 );
+    }
+
     camodocal::CameraCalibration calibration( modelType, cameraName, frameSize, boardSize, squareSize );
     calibration.setVerbose( verbose );
+    calibration.setThreads( threads );
+
+    // the workers load the images and detect the chessboards in any order, the results are
+    // taken and shown in file order here since the calibration data and the window are not shared
+    struct Detection
+    {
+        bool done;
+        bool found;
+        std::vector< cv::Point2f > corners;
+        cv::Mat sketch;
+    };
+    std::vector< Detection > detections( imageFilenames.size( ) );
+    for ( size_t i = 0; i < detections.size( ); ++i )
+    {
+        detections.at( i ).done  = false;
+        detections.at( i ).found = false;
+    }
+    std::mutex detectionMutex;
+    std::condition_variable detectionCondition;
+    std::atomic< size_t > nextImage( 0 );
+
+    std::vector< std::thread > workers;
+    for ( int t = 0; t < threads; ++t )
+    {
+        workers.push_back( std::thread( [&]( ) {
+            for ( size_t i = nextImage++; i < imageFilenames.size( ); i = nextImage++ )
+            {
+                cv::Mat workerImage = cv::imread( imageFilenames.at( i ), -1 );
+
+                camodocal::Chessboard chessboard( boardSize, workerImage );
+                chessboard.findCorners( useOpenCV );
+
+                std::lock_guard< std::mutex > lock( detectionMutex );
+                Detection& detection = detections.at( i );
+                detection.found      = chessboard.cornersFound( );
+                if ( detection.found )
+                {
+                    detection.corners = chessboard.getCorners( );
+                    chessboard.getSketch( ).copyTo( detection.sketch );
+                }
+                detection.done = true;
+                detectionCondition.notify_one( );
+            }
+        } ) );
+    }
 
     std::vector< bool > chessboardFound( imageFilenames.size( ), false );
     for ( size_t i = 0; i < imageFilenames.size( ); ++i )
     {
-        image = cv::imread( imageFilenames.at( i ), -1 );
-
-        camodocal::Chessboard chessboard( boardSize, image );
+        Detection detection;
+        {
+            std::unique_lock< std::mutex > lock( detectionMutex );
+            detectionCondition.wait( lock, [&]( ) { return detections.at( i ).done; } );
+            std::swap( detection, detections.at( i ) );
+        }
 
-        chessboard.findCorners( useOpenCV );
-        if ( chessboard.cornersFound( ) )
+        if ( detection.found )
         {
             if ( verbose )
             {
@@ -201,19 +260,20 @@ main( int argc, char** argv )
                           << imageFilenames.at( i ) << std::endl;
             }
 
-            calibration.addChessboardData( chessboard.getCorners( ) );
-
-            cv::Mat sketch;
-            chessboard.getSketch( ).copyTo( sketch );
+            calibration.addChessboardData( detection.corners );
 
-            cv::imshow( "Image", sketch );
+            cv::imshow( "Image", detection.sketch );
             cv::waitKey( 50 );
         }
         else if ( verbose )
         {
             std::cerr << "# INFO: Did not detect chessboard in image " << i + 1 << std::endl;
         }
-        chessboardFound.at( i ) = chessboard.cornersFound( );
+        chessboardFound.at( i ) = detection.found;
+    }
+    for ( size_t t = 0; t < workers.size( ); ++t )
+    {
+        workers.at( t ).join( );
     }
     cv::destroyWindow( "Image" );
 
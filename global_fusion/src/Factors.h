@@ -12,6 +12,7 @@
 #pragma once
 #include <ceres/ceres.h>
 #include <ceres/rotation.h>
+#include <eigen3/Eigen/Dense>
 
 template <typename T> inline
 void QuaternionInverse(const T q[4], T q_inverse[4])
@@ -38,7 +39,9 @@ struct TError
 		return true;
 	}
 
-	static ceres::CostFunction* Create(const double t_x, const double t_y, const double t_z, const double var) 
+	static ceres::CostFunction* Create(const double t_x, const double t_y, const double t_z, const double var);
+
+	static ceres::CostFunction* CreateAutoDiff(const double t_x, const double t_y, const double t_z, const double var)
 	{
 	  return (new ceres::AutoDiffCostFunction<
 	          TError, 3, 3>(
@@ -49,6 +52,74 @@ struct TError
 
 };
 
+// TError of a fix between two nodes, on the position interpolated ratio of the way from ti to tj
+struct TInterpolationError
+{
+	TInterpolationError(double t_x, double t_y, double t_z, double var, double ratio)
+				  :t_x(t_x), t_y(t_y), t_z(t_z), var(var), ratio(ratio){}
+
+	template <typename T>
+	bool operator()(const T* ti, const T* tj, T* residuals) const
+	{
+		residuals[0] = (ti[0] + T(ratio) * (tj[0] - ti[0]) - T(t_x)) / T(var);
+		residuals[1] = (ti[1] + T(ratio) * (tj[1] - ti[1]) - T(t_y)) / T(var);
+		residuals[2] = (ti[2] + T(ratio) * (tj[2] - ti[2]) - T(t_z)) / T(var);
+
+		return true;
+	}
+
+	static ceres::CostFunction* Create(const double t_x, const double t_y, const double t_z, const double var,
+									   const double ratio);
+
+	static ceres::CostFunction* CreateAutoDiff(const double t_x, const double t_y, const double t_z, const double var,
+									   const double ratio)
+	{
+	  return (new ceres::AutoDiffCostFunction<
+	          TInterpolationError, 3, 3, 3>(
+	          	new TInterpolationError(t_x, t_y, t_z, var, ratio)));
+	}
+
+	double t_x, t_y, t_z, var, ratio;
+
+};
+
+// TError of a fix at a time after node i, tj + R(w_q_i) * offset: offset is the vio motion from
+// the node to the fix time in the node's body frame
+struct TOffsetError
+{
+	TOffsetError(double t_x, double t_y, double t_z, double var, double o_x, double o_y, double o_z)
+				  :t_x(t_x), t_y(t_y), t_z(t_z), var(var), o_x(o_x), o_y(o_y), o_z(o_z){}
+
+	template <typename T>
+	bool operator()(const T* const w_q_i, const T* ti, T* residuals) const
+	{
+		T offset[3] = {T(o_x), T(o_y), T(o_z)};
+		T w_offset[3];
+		ceres::QuaternionRotatePoint(w_q_i, offset, w_offset);
+
+		residuals[0] = (ti[0] + w_offset[0] - T(t_x)) / T(var);
+		residuals[1] = (ti[1] + w_offset[1] - T(t_y)) / T(var);
+		residuals[2] = (ti[2] + w_offset[2] - T(t_z)) / T(var);
+
+		return true;
+	}
+
+	static ceres::CostFunction* Create(const double t_x, const double t_y, const double t_z, const double var,
+									   const double o_x, const double o_y, const double o_z);
+
+	static ceres::CostFunction* CreateAutoDiff(const double t_x, const double t_y, const double t_z, const double var,
+									   const double o_x, const double o_y, const double o_z)
+	{
+	  return (new ceres::AutoDiffCostFunction<
+	          TOffsetError, 3, 4, 3>(
+	          	new TOffsetError(t_x, t_y, t_z, var, o_x, o_y, o_z)));
+	}
+
+	double t_x, t_y, t_z, var;
+	double o_x, o_y, o_z;
+
+};
+
 struct RelativeRTError
 {
 	RelativeRTError(double t_x, double t_y, double t_z, 
@@ -100,7 +171,11 @@ struct RelativeRTError
 
 	static ceres::CostFunction* Create(const double t_x, const double t_y, const double t_z,
 									   const double q_w, const double q_x, const double q_y, const double q_z,
-									   const double t_var, const double q_var) 
+									   const double t_var, const double q_var);
+
+	static ceres::CostFunction* CreateAutoDiff(const double t_x, const double t_y, const double t_z,
+									   const double q_w, const double q_x, const double q_y, const double q_z,
+									   const double t_var, const double q_var)
 	{
 	  return (new ceres::AutoDiffCostFunction<
 	          RelativeRTError, 6, 4, 3, 4, 3>(
@@ -111,4 +186,241 @@ struct RelativeRTError
 	double q_w, q_x, q_y, q_z;
 	double t_var, q_var;
 
-};
\ No newline at end of file
+};
+
+// Hand derived jacobians of the factors above, the autodiff jets cost most of a solve. Rotations
+// are perturbed on the right, q * [1, dtheta / 2] as QuaternionRightParameterization does: a
+// factor writes its jacobian in dtheta into the x, y, z columns of a quaternion block and leaves
+// the w column zero, the parameterization's jacobian then only picks those columns. Create builds
+// them, CreateAutoDiff still differentiates the functor, to check them against.
+class QuaternionRightParameterization : public ceres::LocalParameterization
+{
+  public:
+	virtual bool Plus(const double *x, const double *delta, double *x_plus_delta) const
+	{
+		Eigen::Quaterniond q(x[0], x[1], x[2], x[3]);
+		Eigen::Quaterniond dq(1, delta[0] / 2, delta[1] / 2, delta[2] / 2);
+		Eigen::Quaterniond r = (q * dq).normalized();
+		x_plus_delta[0] = r.w();
+		x_plus_delta[1] = r.x();
+		x_plus_delta[2] = r.y();
+		x_plus_delta[3] = r.z();
+		return true;
+	}
+	virtual bool ComputeJacobian(const double *x, double *jacobian) const
+	{
+		Eigen::Map<Eigen::Matrix<double, 4, 3, Eigen::RowMajor>> j(jacobian);
+		j.topRows<1>().setZero();
+		j.bottomRows<3>().setIdentity();
+		return true;
+	}
+	virtual int GlobalSize() const { return 4; }
+	virtual int LocalSize() const { return 3; }
+};
+
+inline Eigen::Matrix3d skewSymmetric(const Eigen::Vector3d &v)
+{
+	Eigen::Matrix3d m;
+	m << 0, -v(2), v(1),
+		 v(2), 0, -v(0),
+		 -v(1), v(0), 0;
+	return m;
+}
+
+// q * p = quaternionLeft(q) p = quaternionRight(p) q, w first
+inline Eigen::Matrix4d quaternionLeft(const Eigen::Quaterniond &q)
+{
+	Eigen::Matrix4d m;
+	m(0, 0) = q.w();
+	m.block<1, 3>(0, 1) = -q.vec().transpose();
+	m.block<3, 1>(1, 0) = q.vec();
+	m.block<3, 3>(1, 1) = q.w() * Eigen::Matrix3d::Identity() + skewSymmetric(q.vec());
+	return m;
+}
+
+inline Eigen::Matrix4d quaternionRight(const Eigen::Quaterniond &p)
+{
+	Eigen::Matrix4d m;
+	m(0, 0) = p.w();
+	m.block<1, 3>(0, 1) = -p.vec().transpose();
+	m.block<3, 1>(1, 0) = p.vec();
+	m.block<3, 3>(1, 1) = p.w() * Eigen::Matrix3d::Identity() - skewSymmetric(p.vec());
+	return m;
+}
+
+class TFactor : public ceres::SizedCostFunction<3, 3>
+{
+  public:
+	TFactor(double t_x, double t_y, double t_z, double var) :t(t_x, t_y, t_z), var(var){}
+
+	virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
+	{
+		Eigen::Map<const Eigen::Vector3d> tj(parameters[0]);
+		Eigen::Map<Eigen::Vector3d> residual(residuals);
+		residual = (tj - t) / var;
+		if (jacobians && jacobians[0])
+		{
+			Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>> j(jacobians[0]);
+			j = Eigen::Matrix3d::Identity() / var;
+		}
+		return true;
+	}
+
+	Eigen::Vector3d t;
+	double var;
+};
+
+class TInterpolationFactor : public ceres::SizedCostFunction<3, 3, 3>
+{
+  public:
+	TInterpolationFactor(double t_x, double t_y, double t_z, double var, double ratio)
+				  :t(t_x, t_y, t_z), var(var), ratio(ratio){}
+
+	virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
+	{
+		Eigen::Map<const Eigen::Vector3d> ti(parameters[0]);
+		Eigen::Map<const Eigen::Vector3d> tj(parameters[1]);
+		Eigen::Map<Eigen::Vector3d> residual(residuals);
+		residual = (ti + ratio * (tj - ti) - t) / var;
+		if (jacobians)
+		{
+			if (jacobians[0])
+			{
+				Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>> j(jacobians[0]);
+				j = Eigen::Matrix3d::Identity() * ((1 - ratio) / var);
+			}
+			if (jacobians[1])
+			{
+				Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>> j(jacobians[1]);
+				j = Eigen::Matrix3d::Identity() * (ratio / var);
+			}
+		}
+		return true;
+	}
+
+	Eigen::Vector3d t;
+	double var, ratio;
+};
+
+class TOffsetFactor : public ceres::SizedCostFunction<3, 4, 3>
+{
+  public:
+	TOffsetFactor(double t_x, double t_y, double t_z, double var, double o_x, double o_y, double o_z)
+				  :t(t_x, t_y, t_z), var(var), offset(o_x, o_y, o_z){}
+
+	virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
+	{
+		Eigen::Quaterniond w_q_i(parameters[0][0], parameters[0][1], parameters[0][2], parameters[0][3]);
+		Eigen::Map<const Eigen::Vector3d> ti(parameters[1]);
+		Eigen::Matrix3d w_R_i = w_q_i.normalized().toRotationMatrix();
+		Eigen::Map<Eigen::Vector3d> residual(residuals);
+		residual = (ti + w_R_i * offset - t) / var;
+		if (jacobians)
+		{
+			if (jacobians[0])
+			{
+				// R * exp(dtheta) * offset = R * offset - R * [offset]x * dtheta
+				Eigen::Map<Eigen::Matrix<double, 3, 4, Eigen::RowMajor>> j(jacobians[0]);
+				j.col(0).setZero();
+				j.rightCols<3>() = -w_R_i * skewSymmetric(offset) / var;
+			}
+			if (jacobians[1])
+			{
+				Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>> j(jacobians[1]);
+				j = Eigen::Matrix3d::Identity() / var;
+			}
+		}
+		return true;
+	}
+
+	Eigen::Vector3d t;
+	double var;
+	Eigen::Vector3d offset;
+};
+
+class RelativeRTFactor : public ceres::SizedCostFunction<6, 4, 3, 4, 3>
+{
+  public:
+	RelativeRTFactor(double t_x, double t_y, double t_z,
+					 double q_w, double q_x, double q_y, double q_z,
+					 double t_var, double q_var)
+				  :t(t_x, t_y, t_z), q(q_w, q_x, q_y, q_z), t_var(t_var), q_var(q_var){}
+
+	virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
+	{
+		Eigen::Quaterniond w_q_i(parameters[0][0], parameters[0][1], parameters[0][2], parameters[0][3]);
+		Eigen::Map<const Eigen::Vector3d> ti(parameters[1]);
+		Eigen::Quaterniond w_q_j(parameters[2][0], parameters[2][1], parameters[2][2], parameters[2][3]);
+		Eigen::Map<const Eigen::Vector3d> tj(parameters[3]);
+		w_q_i.normalize();
+		w_q_j.normalize();
+
+		Eigen::Matrix3d i_R_w = w_q_i.toRotationMatrix().transpose();
+		Eigen::Vector3d t_i_ij = i_R_w * (tj - ti);
+		Eigen::Quaterniond q_i_j = w_q_i.conjugate() * w_q_j;
+		Eigen::Quaterniond error_q = q.conjugate() * q_i_j;
+
+		Eigen::Map<Eigen::Matrix<double, 6, 1>> residual(residuals);
+		residual.head<3>() = (t_i_ij - t) / t_var;
+		residual.tail<3>() = 2 * error_q.vec() / q_var;
+
+		if (jacobians)
+		{
+			if (jacobians[0])
+			{
+				Eigen::Map<Eigen::Matrix<double, 6, 4, Eigen::RowMajor>> j(jacobians[0]);
+				j.setZero();
+				j.block<3, 3>(0, 1) = skewSymmetric(t_i_ij) / t_var;
+				j.block<3, 3>(3, 1) = -(quaternionLeft(q.conjugate()) * quaternionRight(q_i_j)).bottomRightCorner<3, 3>() / q_var;
+			}
+			if (jacobians[1])
+			{
+				Eigen::Map<Eigen::Matrix<double, 6, 3, Eigen::RowMajor>> j(jacobians[1]);
+				j.topRows<3>() = -i_R_w / t_var;
+				j.bottomRows<3>().setZero();
+			}
+			if (jacobians[2])
+			{
+				Eigen::Map<Eigen::Matrix<double, 6, 4, Eigen::RowMajor>> j(jacobians[2]);
+				j.setZero();
+				j.block<3, 3>(3, 1) = quaternionLeft(error_q).bottomRightCorner<3, 3>() / q_var;
+			}
+			if (jacobians[3])
+			{
+				Eigen::Map<Eigen::Matrix<double, 6, 3, Eigen::RowMajor>> j(jacobians[3]);
+				j.topRows<3>() = i_R_w / t_var;
+				j.bottomRows<3>().setZero();
+			}
+		}
+		return true;
+	}
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	Eigen::Vector3d t;
+	Eigen::Quaterniond q;
+	double t_var, q_var;
+};
+
+inline ceres::CostFunction* TError::Create(const double t_x, const double t_y, const double t_z, const double var)
+{
+	return new TFactor(t_x, t_y, t_z, var);
+}
+
+inline ceres::CostFunction* TInterpolationError::Create(const double t_x, const double t_y, const double t_z, const double var,
+									   const double ratio)
+{
+	return new TInterpolationFactor(t_x, t_y, t_z, var, ratio);
+}
+
+inline ceres::CostFunction* TOffsetError::Create(const double t_x, const double t_y, const double t_z, const double var,
+									   const double o_x, const double o_y, const double o_z)
+{
+	return new TOffsetFactor(t_x, t_y, t_z, var, o_x, o_y, o_z);
+}
+
+inline ceres::CostFunction* RelativeRTError::Create(const double t_x, const double t_y, const double t_z,
+									   const double q_w, const double q_x, const double q_y, const double q_z,
+									   const double t_var, const double q_var)
+{
+	return new RelativeRTFactor(t_x, t_y, t_z, q_w, q_x, q_y, q_z, t_var, q_var);
+}
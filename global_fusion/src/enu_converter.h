@@ -0,0 +1,79 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cmath>
+#include <eigen3/Eigen/Dense>
+#include "LocalCartesian.hpp"
+
+// Latitude, longitude and altitude to the ENU frame of the first fix. GeographicLib converts a
+// linearization point exactly, the fixes around it are its ENU position plus the jacobian times
+// their offset in degrees and meters. Over LINEARIZATION_RADIUS the curvature left out is well
+// below a millimeter. A fix farther away, or every EXACT_INTERVAL fixes, is converted exactly and
+// becomes the new linearization point, so the error can not build up along the track.
+class EnuConverter
+{
+  public:
+    EnuConverter() : initialized(false), since_exact(0) {}
+
+    void forward(double latitude, double longitude, double altitude, double *xyz)
+    {
+        if (!initialized)
+        {
+            geoConverter.Reset(latitude, longitude, altitude);
+            initialized = true;
+            linearize(latitude, longitude, altitude);
+        }
+        Eigen::Vector3d d(latitude - point.x(), longitude - point.y(), altitude - point.z());
+        if (d.y() > 180)
+            d.y() -= 360;
+        else if (d.y() < -180)
+            d.y() += 360;
+        Eigen::Vector3d enu = point_enu + jacobian * d;
+        if (++since_exact >= EXACT_INTERVAL || (enu - point_enu).norm() > LINEARIZATION_RADIUS)
+        {
+            linearize(latitude, longitude, altitude);
+            enu = point_enu;
+        }
+        xyz[0] = enu.x();
+        xyz[1] = enu.y();
+        xyz[2] = enu.z();
+    }
+
+  private:
+    static constexpr double LINEARIZATION_RADIUS = 100.0;
+    static const int EXACT_INTERVAL = 100;
+
+    void linearize(double latitude, double longitude, double altitude)
+    {
+        point = Eigen::Vector3d(latitude, longitude, altitude);
+        geoConverter.Forward(latitude, longitude, altitude, point_enu.x(), point_enu.y(), point_enu.z());
+        // central differences, 1e-5 degrees is about a meter
+        const double step[3] = {1e-5, 1e-5, 1.0};
+        for (int k = 0; k < 3; k++)
+        {
+            Eigen::Vector3d plus = point, minus = point, enu_plus, enu_minus;
+            plus(k) += step[k];
+            minus(k) -= step[k];
+            geoConverter.Forward(plus.x(), plus.y(), plus.z(), enu_plus.x(), enu_plus.y(), enu_plus.z());
+            geoConverter.Forward(minus.x(), minus.y(), minus.z(), enu_minus.x(), enu_minus.y(), enu_minus.z());
+            jacobian.col(k) = (enu_plus - enu_minus) / (2 * step[k]);
+        }
+        since_exact = 0;
+    }
+
+    GeographicLib::LocalCartesian geoConverter;
+    bool initialized;
+    int since_exact;
+    // latitude, longitude, altitude of the linearization point, its ENU position and d ENU / d point
+    Eigen::Vector3d point;
+    Eigen::Vector3d point_enu;
+    Eigen::Matrix3d jacobian;
+};
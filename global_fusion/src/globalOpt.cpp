@@ -12,48 +12,92 @@
 #include "globalOpt.h"
 #include "Factors.h"
 
+// poses kept in global_path, older ones decimated
+static const size_t GLOBAL_PATH_MAX_POSES = 10000;
+// odometry kept to place gps fixes that arrive after the poses around them
+static const double ODOM_HISTORY_TIME = 2.0;
+
 GlobalOptimization::GlobalOptimization()
 {
-	initGPS = false;
     newGPS = false;
+    quit = false;
+    window_time = 60;
+    node_distance = 1.0;
+    node_interval = 1.0;
+    optimizedUntil = -1;
 	WGPS_T_WVIO = Eigen::Matrix4d::Identity();
+    correctionSolves = 0;
     threadOpt = std::thread(&GlobalOptimization::optimize, this);
 }
 
 GlobalOptimization::~GlobalOptimization()
 {
-    threadOpt.detach();
+    mPoseMap.lock();
+    quit = true;
+    mPoseMap.unlock();
+    gpsCondition.notify_one();
+    threadOpt.join();
 }
 
-void GlobalOptimization::GPS2XYZ(double latitude, double longitude, double altitude, double* xyz)
+void GlobalOptimization::placeOptimizer(const ThreadPlacement &placement)
 {
-    if(!initGPS)
-    {
-        geoConverter.Reset(latitude, longitude, altitude);
-        initGPS = true;
-    }
-    geoConverter.Forward(latitude, longitude, altitude, xyz[0], xyz[1], xyz[2]);
-    //printf("la: %f lo: %f al: %f\n", latitude, longitude, altitude);
-    //printf("gps x: %f y: %f z: %f\n", xyz[0], xyz[1], xyz[2]);
+    placeThread(threadOpt.native_handle(), "global_opt", placement);
 }
 
 void GlobalOptimization::inputOdom(double t, Eigen::Vector3d OdomP, Eigen::Quaterniond OdomQ)
 {
+    VINS_TRACE_FRAME("GlobalOptimization::inputOdom", t);
 	mPoseMap.lock();
-    vector<double> localPose{OdomP.x(), OdomP.y(), OdomP.z(), 
-    					     OdomQ.w(), OdomQ.x(), OdomQ.y(), OdomQ.z()};
-    localPoseMap[t] = localPose;
-
+    // the latest node becomes permanent once it is far enough from the one before it,
+    // otherwise this pose takes its place
+    bool keep = poseNodes.size() < 2 || (node_distance <= 0 && node_interval <= 0);
+    if (!keep)
+    {
+        const PoseNode &last = poseNodes[poseNodes.size() - 1];
+        const PoseNode &prev = poseNodes[poseNodes.size() - 2];
+        keep = (node_interval > 0 && last.t - prev.t >= node_interval) ||
+               (node_distance > 0 && (Eigen::Vector3d(last.local_p) - Eigen::Vector3d(prev.local_p)).norm() >= node_distance);
+    }
+    if (keep || poseNodes.back().t <= optimizedUntil)
+        poseNodes.emplace_back();
+    PoseNode &node = poseNodes.back();
+    node.t = t;
+    node.local_p[0] = OdomP.x();
+    node.local_p[1] = OdomP.y();
+    node.local_p[2] = OdomP.z();
+    node.local_q[0] = OdomQ.w();
+    node.local_q[1] = OdomQ.x();
+    node.local_q[2] = OdomQ.y();
+    node.local_q[3] = OdomQ.z();
 
     Eigen::Quaterniond globalQ;
     globalQ = WGPS_T_WVIO.block<3, 3>(0, 0) * OdomQ;
     Eigen::Vector3d globalP = WGPS_T_WVIO.block<3, 3>(0, 0) * OdomP + WGPS_T_WVIO.block<3, 1>(0, 3);
-    vector<double> globalPose{globalP.x(), globalP.y(), globalP.z(),
-                              globalQ.w(), globalQ.x(), globalQ.y(), globalQ.z()};
-    globalPoseMap[t] = globalPose;
+    node.global_p[0] = globalP.x();
+    node.global_p[1] = globalP.y();
+    node.global_p[2] = globalP.z();
+    node.global_q[0] = globalQ.w();
+    node.global_q[1] = globalQ.x();
+    node.global_q[2] = globalQ.y();
+    node.global_q[3] = globalQ.z();
     lastP = globalP;
     lastQ = globalQ;
 
+    // fixes waiting for this odometry, they lie after the previous sample
+    double prevT = recentOdom.empty() ? -1 : recentOdom.back().t;
+    OdomSample sample;
+    sample.t = t;
+    sample.p[0] = OdomP.x();
+    sample.p[1] = OdomP.y();
+    sample.p[2] = OdomP.z();
+    recentOdom.push_back(sample);
+    while (recentOdom.front().t < t - ODOM_HISTORY_TIME)
+        recentOdom.pop_front();
+    map<double, GPSFix>::iterator iterGPS;
+    for (iterGPS = GPSPositionMap.upper_bound(prevT); iterGPS != GPSPositionMap.end() && iterGPS->first <= t; iterGPS++)
+        if (!iterGPS->second.located)
+            locateFix(iterGPS->first, iterGPS->second);
+
     geometry_msgs::PoseStamped pose_stamped;
     pose_stamped.header.stamp = ros::Time(t);
     pose_stamped.header.frame_id = "world";
@@ -65,162 +109,309 @@ void GlobalOptimization::inputOdom(double t, Eigen::Vector3d OdomP, Eigen::Quate
     pose_stamped.pose.orientation.z = lastQ.z();
     pose_stamped.pose.orientation.w = lastQ.w();
     global_path.header = pose_stamped.header;
-    global_path.poses.push_back(pose_stamped);
+    appendDecimated(global_path, pose_stamped, GLOBAL_PATH_MAX_POSES);
 
     mPoseMap.unlock();
 }
 
+bool GlobalOptimization::locateFix(double t, GPSFix &fix) const
+{
+    if (recentOdom.empty() || t < recentOdom.front().t || t > recentOdom.back().t)
+        return false;
+    deque<OdomSample>::const_iterator j = std::lower_bound(recentOdom.begin(), recentOdom.end(), t,
+                                                           [](const OdomSample &sample, double time) { return sample.t < time; });
+    if (j->t == t)
+    {
+        for (int k = 0; k < 3; k++)
+            fix.local_p[k] = j->p[k];
+    }
+    else
+    {
+        deque<OdomSample>::const_iterator i = j - 1;
+        double ratio = (t - i->t) / (j->t - i->t);
+        for (int k = 0; k < 3; k++)
+            fix.local_p[k] = i->p[k] + ratio * (j->p[k] - i->p[k]);
+    }
+    fix.located = true;
+    return true;
+}
+
+// first of nodes at or after t
+static size_t lowerBoundNode(const vector<PoseNode> &nodes, double t)
+{
+    return std::lower_bound(nodes.begin(), nodes.end(), t,
+                            [](const PoseNode &node, double time) { return node.t < time; }) - nodes.begin();
+}
+
+size_t GlobalOptimization::lowerBound(double t) const
+{
+    return lowerBoundNode(poseNodes, t);
+}
+
 void GlobalOptimization::getGlobalOdom(Eigen::Vector3d &odomP, Eigen::Quaterniond &odomQ)
 {
     odomP = lastP;
     odomQ = lastQ;
 }
 
+void GlobalOptimization::getCorrection(Eigen::Matrix4d &T, int &solves)
+{
+    mPoseMap.lock();
+    T = WGPS_T_WVIO;
+    solves = correctionSolves;
+    mPoseMap.unlock();
+}
+
+void GlobalOptimization::getMemory(size_t &node_bytes, size_t &nodes, size_t &fix_bytes, size_t &fixes,
+                                   size_t &path_bytes)
+{
+    using memory_stats::vectorBytes;
+    // a map node is the pair and four words of links and color, a deque is counted by its elements.
+    // The copies the optimizer thread solves on are left out, they are not guarded by mPoseMap
+    mPoseMap.lock();
+    nodes = poseNodes.size();
+    node_bytes = vectorBytes(poseNodes) + recentOdom.size() * sizeof(OdomSample);
+    fixes = GPSPositionMap.size();
+    fix_bytes = fixes * (sizeof(pair<double, GPSFix>) + 4 * sizeof(void *)) + vectorBytes(rawFixes);
+    path_bytes = vectorBytes(global_path.poses);
+    mPoseMap.unlock();
+}
+
 void GlobalOptimization::inputGPS(double t, double latitude, double longitude, double altitude, double posAccuracy)
 {
-	double xyz[3];
-	GPS2XYZ(latitude, longitude, altitude, xyz);
-	vector<double> tmp{xyz[0], xyz[1], xyz[2], posAccuracy};
-	GPSPositionMap[t] = tmp;
+	RawGPSFix raw;
+	raw.t = t;
+	raw.latitude = latitude;
+	raw.longitude = longitude;
+	raw.altitude = altitude;
+	raw.accuracy = posAccuracy;
+	// converted on the optimizer thread, all fixes since it last woke up in one go
+	mPoseMap.lock();
+	rawFixes.push_back(raw);
     newGPS = true;
+	mPoseMap.unlock();
+    gpsCondition.notify_one();
+
+}
 
+// global pose of a node from its vio pose, in the frame of WGPS_T_WVIO
+static void alignNode(const Eigen::Matrix4d &WGPS_T_WVIO, PoseNode &node)
+{
+    Eigen::Quaterniond globalQ(WGPS_T_WVIO.block<3, 3>(0, 0) *
+                               Eigen::Quaterniond(node.local_q[0], node.local_q[1], node.local_q[2], node.local_q[3]));
+    Eigen::Vector3d globalP = WGPS_T_WVIO.block<3, 3>(0, 0) * Eigen::Vector3d(node.local_p) +
+                              WGPS_T_WVIO.block<3, 1>(0, 3);
+    node.global_p[0] = globalP.x();
+    node.global_p[1] = globalP.y();
+    node.global_p[2] = globalP.z();
+    node.global_q[0] = globalQ.w();
+    node.global_q[1] = globalQ.x();
+    node.global_q[2] = globalQ.y();
+    node.global_q[3] = globalQ.z();
 }
 
 void GlobalOptimization::optimize()
 {
     while(true)
     {
-        if(newGPS)
+        // a copy of the window is solved, inputOdom only waits for the copy and the update
+        std::unique_lock<std::mutex> lock(mPoseMap);
+        gpsCondition.wait(lock, [&] { return newGPS || quit; });
+        if (quit)
+            break;
+        newGPS = false;
+
+        // the new fixes to ENU outside of the lock, then located like inputOdom does
+        rawBatch.swap(rawFixes);
+        rawFixes.clear();
+        lock.unlock();
+        batchFixes.resize(rawBatch.size());
+        for (size_t i = 0; i < rawBatch.size(); i++)
         {
-            newGPS = false;
-            printf("global optimization\n");
-            TicToc globalOptimizationTime;
-
-            ceres::Problem problem;
-            ceres::Solver::Options options;
-            options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
-            //options.minimizer_progress_to_stdout = true;
-            //options.max_solver_time_in_seconds = SOLVER_TIME * 3;
-            options.max_num_iterations = 5;
-            ceres::Solver::Summary summary;
-            ceres::LossFunction *loss_function;
-            loss_function = new ceres::HuberLoss(1.0);
-            ceres::LocalParameterization* local_parameterization = new ceres::QuaternionParameterization();
-
-            //add param
-            mPoseMap.lock();
-            int length = localPoseMap.size();
-            // w^t_i   w^q_i
-            double t_array[length][3];
-            double q_array[length][4];
-            map<double, vector<double>>::iterator iter;
-            iter = globalPoseMap.begin();
-            for (int i = 0; i < length; i++, iter++)
-            {
-                t_array[i][0] = iter->second[0];
-                t_array[i][1] = iter->second[1];
-                t_array[i][2] = iter->second[2];
-                q_array[i][0] = iter->second[3];
-                q_array[i][1] = iter->second[4];
-                q_array[i][2] = iter->second[5];
-                q_array[i][3] = iter->second[6];
-                problem.AddParameterBlock(q_array[i], 4, local_parameterization);
-                problem.AddParameterBlock(t_array[i], 3);
-            }
+            const RawGPSFix &raw = rawBatch[i];
+            enuConverter.forward(raw.latitude, raw.longitude, raw.altitude, batchFixes[i].p);
+            batchFixes[i].accuracy = raw.accuracy;
+            batchFixes[i].located = false;
+        }
+        lock.lock();
+        // a fix ahead of the odometry is located by inputOdom
+        for (size_t i = 0; i < rawBatch.size(); i++)
+        {
+            locateFix(rawBatch[i].t, batchFixes[i]);
+            GPSPositionMap[rawBatch[i].t] = batchFixes[i];
+        }
+        if (quit)
+            break;
+        if (poseNodes.empty())
+            continue;
+        VINS_DEBUG("global optimization\n");
+        // the frame of the newest odometry in the window
+        VINS_TRACE_FRAME("GlobalOptimization::optimize", poseNodes.back().t);
+        TicToc globalOptimizationTime;
 
-            map<double, vector<double>>::iterator iterVIO, iterVIONext, iterGPS;
-            int i = 0;
-            for (iterVIO = localPoseMap.begin(); iterVIO != localPoseMap.end(); iterVIO++, i++)
-            {
-                //vio factor
-                iterVIONext = iterVIO;
-                iterVIONext++;
-                if(iterVIONext != localPoseMap.end())
-                {
-                    Eigen::Matrix4d wTi = Eigen::Matrix4d::Identity();
-                    Eigen::Matrix4d wTj = Eigen::Matrix4d::Identity();
-                    wTi.block<3, 3>(0, 0) = Eigen::Quaterniond(iterVIO->second[3], iterVIO->second[4], 
-                                                               iterVIO->second[5], iterVIO->second[6]).toRotationMatrix();
-                    wTi.block<3, 1>(0, 3) = Eigen::Vector3d(iterVIO->second[0], iterVIO->second[1], iterVIO->second[2]);
-                    wTj.block<3, 3>(0, 0) = Eigen::Quaterniond(iterVIONext->second[3], iterVIONext->second[4], 
-                                                               iterVIONext->second[5], iterVIONext->second[6]).toRotationMatrix();
-                    wTj.block<3, 1>(0, 3) = Eigen::Vector3d(iterVIONext->second[0], iterVIONext->second[1], iterVIONext->second[2]);
-                    Eigen::Matrix4d iTj = wTi.inverse() * wTj;
-                    Eigen::Quaterniond iQj;
-                    iQj = iTj.block<3, 3>(0, 0);
-                    Eigen::Vector3d iPj = iTj.block<3, 1>(0, 3);
-
-                    ceres::CostFunction* vio_function = RelativeRTError::Create(iPj.x(), iPj.y(), iPj.z(),
-                                                                                iQj.w(), iQj.x(), iQj.y(), iQj.z(),
-                                                                                0.1, 0.01);
-                    problem.AddResidualBlock(vio_function, NULL, q_array[i], t_array[i], q_array[i+1], t_array[i+1]);
-                }
-                //gps factor
-                double t = iterVIO->first;
-                iterGPS = GPSPositionMap.find(t);
-                if (iterGPS != GPSPositionMap.end())
-                {
-                    ceres::CostFunction* gps_function = TError::Create(iterGPS->second[0], iterGPS->second[1], 
-                                                                       iterGPS->second[2], iterGPS->second[3]);
-                    //printf("inverse weight %f \n", iterGPS->second[3]);
-                    problem.AddResidualBlock(gps_function, loss_function, t_array[i]);
-
-                }
+        // the last window_time seconds of odometry are solved. The pose before them is held
+        // fixed once a solve has placed it, older ones keep what their last solve gave them.
+        size_t windowBegin = 0;
+        if (window_time > 0)
+            windowBegin = lowerBound(poseNodes.back().t - window_time);
+        bool anchored = windowBegin > 0 && poseNodes[windowBegin - 1].t <= optimizedUntil;
+        size_t first = anchored ? windowBegin - 1 : windowBegin;
+        solveNodes.assign(poseNodes.begin() + first, poseNodes.end());
+        solveFixes.clear();
+        map<double, GPSFix>::iterator iterGPS;
+        for (iterGPS = GPSPositionMap.lower_bound(poseNodes[first].t);
+             iterGPS != GPSPositionMap.end() && iterGPS->first <= poseNodes.back().t; iterGPS++)
+            solveFixes.push_back(*iterGPS);
+        // fixes before the window have no pose left to constrain
+        GPSPositionMap.erase(GPSPositionMap.begin(), GPSPositionMap.lower_bound(poseNodes[windowBegin].t));
+        // the nodes being solved are not replaced by newer odometry meanwhile
+        double placedUntil = optimizedUntil;
+        optimizedUntil = poseNodes.back().t;
+        lock.unlock();
+
+        ceres::Problem problem;
+        ceres::Solver::Options options;
+        options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+        //options.minimizer_progress_to_stdout = true;
+        //options.max_solver_time_in_seconds = SOLVER_TIME * 3;
+        options.max_num_iterations = 5;
+        ceres::Solver::Summary summary;
+        ceres::LossFunction *loss_function;
+        loss_function = new ceres::HuberLoss(1.0);
+        ceres::LocalParameterization* local_parameterization = new QuaternionRightParameterization();
+
+        //add param
+        size_t length = solveNodes.size();
+        // w^t_i   w^q_i are the copied nodes' global poses, solved in place
+        for (size_t i = 0; i < length; i++)
+        {
+            problem.AddParameterBlock(solveNodes[i].global_q, 4, local_parameterization);
+            problem.AddParameterBlock(solveNodes[i].global_p, 3);
+        }
+        if (anchored)
+        {
+            problem.SetParameterBlockConstant(solveNodes[0].global_q);
+            problem.SetParameterBlockConstant(solveNodes[0].global_p);
+        }
+
+        for (size_t i = 0; i + 1 < length; i++)
+        {
+            //vio factor
+            const PoseNode &nodeI = solveNodes[i];
+            const PoseNode &nodeJ = solveNodes[i + 1];
+            Eigen::Matrix4d wTi = Eigen::Matrix4d::Identity();
+            Eigen::Matrix4d wTj = Eigen::Matrix4d::Identity();
+            wTi.block<3, 3>(0, 0) = Eigen::Quaterniond(nodeI.local_q[0], nodeI.local_q[1], 
+                                                       nodeI.local_q[2], nodeI.local_q[3]).toRotationMatrix();
+            wTi.block<3, 1>(0, 3) = Eigen::Vector3d(nodeI.local_p);
+            wTj.block<3, 3>(0, 0) = Eigen::Quaterniond(nodeJ.local_q[0], nodeJ.local_q[1], 
+                                                       nodeJ.local_q[2], nodeJ.local_q[3]).toRotationMatrix();
+            wTj.block<3, 1>(0, 3) = Eigen::Vector3d(nodeJ.local_p);
+            Eigen::Matrix4d iTj = wTi.inverse() * wTj;
+            Eigen::Quaterniond iQj;
+            iQj = iTj.block<3, 3>(0, 0);
+            Eigen::Vector3d iPj = iTj.block<3, 1>(0, 3);
+
+            ceres::CostFunction* vio_function = RelativeRTError::Create(iPj.x(), iPj.y(), iPj.z(),
+                                                                        iQj.w(), iQj.x(), iQj.y(), iQj.z(),
+                                                                        0.1, 0.01);
+            problem.AddResidualBlock(vio_function, NULL, solveNodes[i].global_q, solveNodes[i].global_p,
+                                     solveNodes[i + 1].global_q, solveNodes[i + 1].global_p);
+        }
 
+        //gps factor, on the node before the fix through the vio motion since it, or between
+        //the two nodes around it when the odometry at the fix time is no longer known
+        for (size_t k = 0; k < solveFixes.size(); k++)
+        {
+            double t = solveFixes[k].first;
+            const GPSFix &fix = solveFixes[k].second;
+            size_t j = lowerBoundNode(solveNodes, t);
+            ceres::CostFunction* gps_function;
+            if (fix.located || solveNodes[j].t == t)
+            {
+                size_t i = solveNodes[j].t == t ? j : j - 1;
+                if (anchored && i == 0)
+                    continue;
+                const PoseNode &node = solveNodes[i];
+                Eigen::Vector3d offset = Eigen::Vector3d::Zero();
+                if (fix.located)
+                    offset = Eigen::Quaterniond(node.local_q[0], node.local_q[1], node.local_q[2], node.local_q[3]).inverse() *
+                             (Eigen::Vector3d(fix.local_p) - Eigen::Vector3d(node.local_p));
+                gps_function = TOffsetError::Create(fix.p[0], fix.p[1], fix.p[2], fix.accuracy,
+                                                    offset.x(), offset.y(), offset.z());
+                //printf("inverse weight %f \n", fix.accuracy);
+                problem.AddResidualBlock(gps_function, loss_function, solveNodes[i].global_q, solveNodes[i].global_p);
             }
-            //mPoseMap.unlock();
-            ceres::Solve(options, &problem, &summary);
-            //std::cout << summary.BriefReport() << "\n";
-
-            // update global pose
-            //mPoseMap.lock();
-            iter = globalPoseMap.begin();
-            for (int i = 0; i < length; i++, iter++)
+            else
             {
-            	vector<double> globalPose{t_array[i][0], t_array[i][1], t_array[i][2],
-            							  q_array[i][0], q_array[i][1], q_array[i][2], q_array[i][3]};
-            	iter->second = globalPose;
-            	if(i == length - 1)
-            	{
-            	    Eigen::Matrix4d WVIO_T_body = Eigen::Matrix4d::Identity(); 
-            	    Eigen::Matrix4d WGPS_T_body = Eigen::Matrix4d::Identity();
-            	    double t = iter->first;
-            	    WVIO_T_body.block<3, 3>(0, 0) = Eigen::Quaterniond(localPoseMap[t][3], localPoseMap[t][4], 
-            	                                                       localPoseMap[t][5], localPoseMap[t][6]).toRotationMatrix();
-            	    WVIO_T_body.block<3, 1>(0, 3) = Eigen::Vector3d(localPoseMap[t][0], localPoseMap[t][1], localPoseMap[t][2]);
-            	    WGPS_T_body.block<3, 3>(0, 0) = Eigen::Quaterniond(globalPose[3], globalPose[4], 
-            	                                                        globalPose[5], globalPose[6]).toRotationMatrix();
-            	    WGPS_T_body.block<3, 1>(0, 3) = Eigen::Vector3d(globalPose[0], globalPose[1], globalPose[2]);
-            	    WGPS_T_WVIO = WGPS_T_body * WVIO_T_body.inverse();
-            	}
+                double ratio = (t - solveNodes[j - 1].t) / (solveNodes[j].t - solveNodes[j - 1].t);
+                gps_function = TInterpolationError::Create(fix.p[0], fix.p[1], fix.p[2], fix.accuracy, ratio);
+                problem.AddResidualBlock(gps_function, loss_function, solveNodes[j - 1].global_p, solveNodes[j].global_p);
             }
-            updateGlobalPath();
-            //printf("global time %f \n", globalOptimizationTime.toc());
-            mPoseMap.unlock();
         }
-        std::chrono::milliseconds dura(2000);
-        std::this_thread::sleep_for(dura);
+        ceres::Solve(options, &problem, &summary);
+        //std::cout << summary.BriefReport() << "\n";
+
+        // update global pose
+        const PoseNode &last = solveNodes.back();
+        Eigen::Matrix4d WVIO_T_body = Eigen::Matrix4d::Identity(); 
+        Eigen::Matrix4d WGPS_T_body = Eigen::Matrix4d::Identity();
+        WVIO_T_body.block<3, 3>(0, 0) = Eigen::Quaterniond(last.local_q[0], last.local_q[1], 
+                                                           last.local_q[2], last.local_q[3]).toRotationMatrix();
+        WVIO_T_body.block<3, 1>(0, 3) = Eigen::Vector3d(last.local_p);
+        WGPS_T_body.block<3, 3>(0, 0) = Eigen::Quaterniond(last.global_q[0], last.global_q[1], 
+                                                            last.global_q[2], last.global_q[3]).toRotationMatrix();
+        WGPS_T_body.block<3, 1>(0, 3) = Eigen::Vector3d(last.global_p);
+        Eigen::Matrix4d solvedT = WGPS_T_body * WVIO_T_body.inverse();
+
+        lock.lock();
+        // the nodes only grew since the copy, the solved ones are at the same place
+        for (size_t i = 0; i < length; i++)
+            poseNodes[first + i] = solveNodes[i];
+        WGPS_T_WVIO = solvedT;
+        correctionSolves++;
+        // odometry that came in during the solve
+        for (size_t i = first + length; i < poseNodes.size(); i++)
+            alignNode(WGPS_T_WVIO, poseNodes[i]);
+
+        // poses that left the window before any solve placed them (odometry without gps fixes)
+        // follow the new alignment, once
+        double pathFrom = poseNodes[first].t;
+        if (!anchored && windowBegin > 0)
+        {
+            size_t old = std::upper_bound(poseNodes.begin(), poseNodes.end(), placedUntil,
+                                          [](double time, const PoseNode &node) { return time < node.t; }) - poseNodes.begin();
+            if (old < windowBegin)
+                pathFrom = poseNodes[old].t;
+            for (; old < windowBegin; old++)
+                alignNode(WGPS_T_WVIO, poseNodes[old]);
+        }
+        updateGlobalPath(pathFrom);
+        //printf("global time %f \n", globalOptimizationTime.toc());
     }
 	return;
 }
 
 
-void GlobalOptimization::updateGlobalPath()
+void GlobalOptimization::updateGlobalPath(double from)
 {
-    global_path.poses.clear();
-    map<double, vector<double>>::iterator iter;
-    for (iter = globalPoseMap.begin(); iter != globalPoseMap.end(); iter++)
+    // the path before from has not moved, only its end is replaced
+    std::vector<geometry_msgs::PoseStamped> &poses = global_path.poses;
+    while (!poses.empty() && poses.back().header.stamp >= ros::Time(from))
+        poses.pop_back();
+    for (size_t i = lowerBound(from); i < poseNodes.size(); i++)
     {
+        const PoseNode &node = poseNodes[i];
         geometry_msgs::PoseStamped pose_stamped;
-        pose_stamped.header.stamp = ros::Time(iter->first);
+        pose_stamped.header.stamp = ros::Time(node.t);
         pose_stamped.header.frame_id = "world";
-        pose_stamped.pose.position.x = iter->second[0];
-        pose_stamped.pose.position.y = iter->second[1];
-        pose_stamped.pose.position.z = iter->second[2];
-        pose_stamped.pose.orientation.w = iter->second[3];
-        pose_stamped.pose.orientation.x = iter->second[4];
-        pose_stamped.pose.orientation.y = iter->second[5];
-        pose_stamped.pose.orientation.z = iter->second[6];
-        global_path.poses.push_back(pose_stamped);
+        pose_stamped.pose.position.x = node.global_p[0];
+        pose_stamped.pose.position.y = node.global_p[1];
+        pose_stamped.pose.position.z = node.global_p[2];
+        pose_stamped.pose.orientation.w = node.global_q[0];
+        pose_stamped.pose.orientation.x = node.global_q[1];
+        pose_stamped.pose.orientation.y = node.global_q[2];
+        pose_stamped.pose.orientation.z = node.global_q[3];
+        appendDecimated(global_path, pose_stamped, GLOBAL_PATH_MAX_POSES);
     }
 }
\ No newline at end of file
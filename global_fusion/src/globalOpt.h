@@ -11,20 +11,66 @@
 
 #pragma once
 #include <vector>
+#include <algorithm>
 #include <map>
+#include <deque>
 #include <iostream>
 #include <mutex>
+#include <condition_variable>
 #include <thread>
 #include <eigen3/Eigen/Dense>
 #include <eigen3/Eigen/Geometry>
 #include <ceres/ceres.h>
 #include <nav_msgs/Odometry.h>
 #include <nav_msgs/Path.h>
-#include "LocalCartesian.hpp"
+#include "enu_converter.h"
 #include "tic_toc.h"
+#include "path_buffer.h"
+#include "vins_log.h"
+#include "thread_placement.h"
+#include "trace.h"
+#include "memory_stats.h"
 
 using namespace std;
 
+// One node of the fused trajectory: the vio pose and its global estimate. Quaternions w, x, y, z,
+// the global pose is what the solver optimizes in place.
+struct PoseNode
+{
+	double t;
+	double local_p[3];
+	double local_q[4];
+	double global_p[3];
+	double global_q[4];
+};
+
+// A gps fix in the local ENU frame. Once the odometry around its time has been seen, located is
+// set and local_p is the vio position interpolated to the fix time, which ties the fix to the
+// node before it through the vio motion since that node.
+struct GPSFix
+{
+	double p[3];
+	double accuracy;
+	bool located;
+	double local_p[3];
+};
+
+// a fix as it arrived, converted to ENU by the optimizer thread
+struct RawGPSFix
+{
+	double t;
+	double latitude;
+	double longitude;
+	double altitude;
+	double accuracy;
+};
+
+struct OdomSample
+{
+	double t;
+	double p[3];
+};
+
 class GlobalOptimization
 {
 public:
@@ -33,24 +79,59 @@ public:
 	void inputGPS(double t, double latitude, double longitude, double altitude, double posAccuracy);
 	void inputOdom(double t, Eigen::Vector3d OdomP, Eigen::Quaterniond OdomQ);
 	void getGlobalOdom(Eigen::Vector3d &odomP, Eigen::Quaterniond &odomQ);
+	// WGPS_T_WVIO and the number of solves that have set it
+	void getCorrection(Eigen::Matrix4d &T, int &solves);
+	// cores and priority of the optimizer thread
+	void placeOptimizer(const ThreadPlacement &placement);
+	// heap bytes of the pose nodes and odometry history, of the fixes and of global_path, with the
+	// node and fix counts
+	void getMemory(size_t &node_bytes, size_t &nodes, size_t &fix_bytes, size_t &fixes, size_t &path_bytes);
 	nav_msgs::Path global_path;
+	// seconds of odometry re-solved on a gps fix, older poses stay where the solves left them
+	// (0: the whole history)
+	double window_time;
+	// a new node once the odometry moved node_distance meters or node_interval seconds from the
+	// last one, the poses in between are not kept and gps fixes among them are interpolated
+	// (both 0: every pose)
+	double node_distance;
+	double node_interval;
 
 private:
-	void GPS2XYZ(double latitude, double longitude, double altitude, double* xyz);
 	void optimize();
-	void updateGlobalPath();
+	void updateGlobalPath(double from);
+	// first node at or after t
+	size_t lowerBound(double t) const;
+	// the vio position at the fix time from recentOdom, false when t is outside of it
+	bool locateFix(double t, GPSFix &fix) const;
 
-	// format t, tx,ty,tz,qw,qx,qy,qz
-	map<double, vector<double>> localPoseMap;
-	map<double, vector<double>> globalPoseMap;
-	map<double, vector<double>> GPSPositionMap;
-	bool initGPS;
-	bool newGPS;
-	GeographicLib::LocalCartesian geoConverter;
+	// in time order, the last node is always the latest odometry and is replaced by the next
+	// one until it has moved far enough from the node before it
+	vector<PoseNode> poseNodes;
+	map<double, GPSFix> GPSPositionMap;
+	// every odometry position of the last ODOM_HISTORY_TIME seconds, nodes or not
+	deque<OdomSample> recentOdom;
+	// only used by the optimizer thread
+	EnuConverter enuConverter;
+	// guards everything below, the solve itself runs on solveNodes without it
 	std::mutex mPoseMap;
+	// signalled by a new fix, and by the destructor with quit
+	std::condition_variable gpsCondition;
+	// fixes received since the optimizer thread last woke up
+	vector<RawGPSFix> rawFixes;
+	bool newGPS;
+	bool quit;
 	Eigen::Matrix4d WGPS_T_WVIO;
+	int correctionSolves;
 	Eigen::Vector3d lastP;
 	Eigen::Quaterniond lastQ;
 	std::thread threadOpt;
+	// time of the last pose a solve has placed, or is placing
+	double optimizedUntil;
+	// the window and its fixes as the optimizer thread copied them, reused between solves
+	vector<PoseNode> solveNodes;
+	vector<pair<double, GPSFix>> solveFixes;
+	// rawFixes taken over by the optimizer thread and their ENU positions
+	vector<RawGPSFix> rawBatch;
+	vector<GPSFix> batchFixes;
 
 };
\ No newline at end of file
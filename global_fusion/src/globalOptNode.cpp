@@ -20,9 +20,13 @@
 #include <stdio.h>
 #include <visualization_msgs/Marker.h>
 #include <visualization_msgs/MarkerArray.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
 
 GlobalOptimization globalEstimator;
-ros::Publisher pub_global_odometry, pub_global_path, pub_car;
+ros::Subscriber sub_GPS, sub_vio;
+ros::Publisher pub_global_odometry, pub_global_path, pub_car, pub_correction, pub_memory;
+int published_solves = 0;
+double last_memory_t = -1;
 nav_msgs::Path *global_path;
 
 void publish_car_model(double t, Eigen::Vector3d t_w_car, Eigen::Quaterniond q_w_car)
@@ -78,6 +82,42 @@ void GPS_callback(const sensor_msgs::NavSatFixConstPtr &GPS_msg)
     globalEstimator.inputGPS(t, latitude, longitude, altitude, pos_accuracy);
 }
 
+// memory: bytes of the pose nodes, the gps fixes and the path, and of the process, once a second
+void publish_memory(double t)
+{
+    if (!pub_memory.getNumSubscribers() || (last_memory_t >= 0 && t >= last_memory_t && t - last_memory_t < 1.0))
+        return;
+    last_memory_t = t;
+    size_t node_bytes, nodes, fix_bytes, fixes, path_bytes;
+    globalEstimator.getMemory(node_bytes, nodes, fix_bytes, fixes, path_bytes);
+    const char *names[] = {"global/pose_nodes", "global/gps_fixes", "global/path", "global/process"};
+    const char *count_keys[] = {"nodes", "fixes", NULL, NULL};
+    size_t bytes[] = {node_bytes, fix_bytes, path_bytes, memory_stats::residentBytes()};
+    size_t counts[] = {nodes, fixes, 0, 0};
+
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = ros::Time(t);
+    for (int i = 0; i < 4; i++)
+    {
+        diagnostic_msgs::DiagnosticStatus status;
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.name = names[i];
+        status.hardware_id = "global_fusion";
+        diagnostic_msgs::KeyValue kv;
+        kv.key = i == 3 ? "resident_bytes" : "bytes";
+        kv.value = std::to_string(bytes[i]);
+        status.values.push_back(kv);
+        if (count_keys[i])
+        {
+            kv.key = count_keys[i];
+            kv.value = std::to_string(counts[i]);
+            status.values.push_back(kv);
+        }
+        msg.status.push_back(status);
+    }
+    pub_memory.publish(msg);
+}
+
 void vio_callback(const nav_msgs::Odometry::ConstPtr &pose_msg)
 {
     //printf("vio_callback! \n");
@@ -94,7 +134,9 @@ void vio_callback(const nav_msgs::Odometry::ConstPtr &pose_msg)
     Eigen:: Quaterniond global_q;
     globalEstimator.getGlobalOdom(global_t, global_q);
 
-    nav_msgs::Odometry odometry;
+    // published as shared pointers, passed on without a copy inside a nodelet manager
+    nav_msgs::OdometryPtr odometry_msg(new nav_msgs::Odometry);
+    nav_msgs::Odometry &odometry = *odometry_msg;
     odometry.header = pose_msg->header;
     odometry.header.frame_id = "world";
     odometry.child_frame_id = "world";
@@ -105,23 +147,72 @@ void vio_callback(const nav_msgs::Odometry::ConstPtr &pose_msg)
     odometry.pose.pose.orientation.y = global_q.y();
     odometry.pose.pose.orientation.z = global_q.z();
     odometry.pose.pose.orientation.w = global_q.w();
-    pub_global_odometry.publish(odometry);
-    pub_global_path.publish(*global_path);
+    pub_global_odometry.publish(odometry_msg);
+
+    // WGPS_T_WVIO for the estimator's imu_propagate, once per solve
+    Eigen::Matrix4d WGPS_T_WVIO;
+    int solves;
+    globalEstimator.getCorrection(WGPS_T_WVIO, solves);
+    if (solves != published_solves)
+    {
+        published_solves = solves;
+        Eigen::Quaterniond correction_q(WGPS_T_WVIO.block<3, 3>(0, 0));
+        nav_msgs::OdometryPtr correction_msg(new nav_msgs::Odometry);
+        nav_msgs::Odometry &correction = *correction_msg;
+        correction.header = pose_msg->header;
+        correction.header.frame_id = "world";
+        correction.pose.pose.position.x = WGPS_T_WVIO(0, 3);
+        correction.pose.pose.position.y = WGPS_T_WVIO(1, 3);
+        correction.pose.pose.position.z = WGPS_T_WVIO(2, 3);
+        correction.pose.pose.orientation.x = correction_q.x();
+        correction.pose.pose.orientation.y = correction_q.y();
+        correction.pose.pose.orientation.z = correction_q.z();
+        correction.pose.pose.orientation.w = correction_q.w();
+        pub_correction.publish(correction_msg);
+    }
+    if (pub_global_path.getNumSubscribers())
+        pub_global_path.publish(*global_path);
     publish_car_model(t, global_t, global_q);
+    publish_memory(t);
 }
 
-int main(int argc, char **argv)
+// everything main does besides ros::init and spinning, shared with the nodelet
+void startGlobalFusion(ros::NodeHandle &n)
 {
-    ros::init(argc, argv, "globalEstimator");
-    ros::NodeHandle n("~");
-
     global_path = &globalEstimator.global_path;
+    n.param("optimization_window", globalEstimator.window_time, 60.0);
+    n.param("node_distance", globalEstimator.node_distance, 1.0);
+    n.param("node_interval", globalEstimator.node_interval, 1.0);
+    ThreadPlacement opt_placement;
+    std::string opt_cpus;
+    n.param<std::string>("thread_opt_cpus", opt_cpus, "");
+    if (!parseCpuList(opt_cpus, opt_placement.cpus))
+        ROS_WARN("thread_opt_cpus \"%s\" is not a cpu list like 2,3 or 4-7, not pinned", opt_cpus.c_str());
+    n.param("thread_opt_priority", opt_placement.priority, 0);
+    globalEstimator.placeOptimizer(opt_placement);
+    int trace_events;
+    std::string trace_file;
+    n.param("trace_events", trace_events, 0);
+    n.param<std::string>("trace_file", trace_file, "trace_global.json");
+    if (trace_events > 0)
+        vins_trace::start(trace_events, trace_file, "global_fusion");
 
-    ros::Subscriber sub_GPS = n.subscribe("/gps", 100, GPS_callback);
-    ros::Subscriber sub_vio = n.subscribe("/vins_estimator/odometry", 100, vio_callback);
     pub_global_path = n.advertise<nav_msgs::Path>("global_path", 100);
     pub_global_odometry = n.advertise<nav_msgs::Odometry>("global_odometry", 100);
+    pub_correction = n.advertise<nav_msgs::Odometry>("vio_correction", 10, true);
     pub_car = n.advertise<visualization_msgs::MarkerArray>("car_model", 1000);
+    pub_memory = n.advertise<diagnostic_msgs::DiagnosticArray>("memory", 10);
+    sub_GPS = n.subscribe("/gps", 100, GPS_callback);
+    sub_vio = n.subscribe("/vins_estimator/odometry", 100, vio_callback);
+}
+
+#ifndef GLOBAL_FUSION_NODELET
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "globalEstimator");
+    ros::NodeHandle n("~");
+    startGlobalFusion(n);
     ros::spin();
     return 0;
 }
+#endif
@@ -0,0 +1,34 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ * 
+ * This file is part of VINS.
+ * 
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <ros/ros.h>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+// globalOptNode.cpp, built without its main()
+void startGlobalFusion(ros::NodeHandle &n);
+
+namespace global_fusion
+{
+
+// global_fusion_node as a nodelet. Loaded into the manager of vins/VinsNodelet, the odometry
+// arrives as a shared pointer and the correction goes back the same way.
+// Takes its settings from the same private parameters as the node.
+class GlobalFusionNodelet : public nodelet::Nodelet
+{
+  private:
+    virtual void onInit()
+    {
+        startGlobalFusion(getPrivateNodeHandle());
+    }
+};
+
+}
+
+PLUGINLIB_EXPORT_CLASS(global_fusion::GlobalFusionNodelet, nodelet::Nodelet)
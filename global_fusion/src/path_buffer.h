@@ -0,0 +1,30 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <utility>
+#include <nav_msgs/Path.h>
+#include <geometry_msgs/PoseStamped.h>
+
+// Appends a pose to path keeping at most max_poses of them, 0 keeps all. Once full every second
+// pose of the older half is dropped: the recent track stays at full rate, the history thins out
+// the older it gets, and the cost stays constant per pose on average.
+inline void appendDecimated(nav_msgs::Path &path, const geometry_msgs::PoseStamped &pose, size_t max_poses)
+{
+    std::vector<geometry_msgs::PoseStamped> &poses = path.poses;
+    poses.push_back(pose);
+    if (max_poses == 0 || poses.size() <= max_poses)
+        return;
+    size_t half = poses.size() / 2, j = 0;
+    for (size_t i = 0; i < poses.size(); i++)
+        if (i >= half || i % 2 == 0)
+            poses[j++] = std::move(poses[i]);
+    poses.resize(j);
+}
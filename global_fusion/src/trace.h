@@ -0,0 +1,284 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Timeline of the pipeline stages in Chrome trace JSON, for chrome://tracing or ui.perfetto.dev.
+// VINS_TRACE(name) records the scope it is in as one event of the calling thread,
+// VINS_TRACE_FRAME(name, t) also makes the image of time t the frame of that scope and of the
+// scopes nested in it on the thread. An event is a few stores into a buffer of its thread, no
+// lock and no allocation; nothing is recorded before vins_trace::start, and VINS_TRACING 0
+// (cmake) compiles the macros out. name must be a string literal.
+//
+// A frame is its image stamp in us, the same number in every node, and the events of a frame are
+// joined by flow arrows. Timestamps are CLOCK_MONOTONIC, so the files of the nodes of one
+// machine make one trace with
+//     { cat trace_vins.json; tail -q -n +2 trace_loop.json trace_global.json; } > trace.json
+#ifndef VINS_TRACING
+#define VINS_TRACING 1
+#endif
+
+namespace vins_trace
+{
+struct Event
+{
+    const char *name;
+    int64_t begin, end;  // ns
+    int64_t frame;       // -1 for none
+    long tid;
+};
+
+// written by one thread at a time, read by write() up to count. The buffer of a thread that
+// ended goes to the next new thread, the many short std::async threads share a few buffers.
+struct ThreadBuffer
+{
+    std::unique_ptr<Event[]> events;
+    size_t capacity;
+    std::atomic<size_t> count;
+    std::atomic<size_t> dropped;
+};
+
+struct Registry
+{
+    Registry() : enabled(false), capacity(0) {}
+    std::atomic<bool> enabled;
+    size_t capacity;
+    std::mutex m;
+    std::vector<ThreadBuffer *> buffers, free_buffers;
+    std::vector<std::pair<long, std::string>> threads;         // tid, name
+    std::vector<std::pair<std::string, std::string>> outputs;  // path, process name
+};
+
+// the buffer of the calling thread, given back when the thread ends
+struct ThreadSlot
+{
+    ThreadSlot() : buffer(NULL), tid(0) {}
+    ~ThreadSlot();
+    ThreadBuffer *buffer;
+    long tid;
+};
+
+// never destroyed, threads still running at exit may go on recording
+inline Registry &registry()
+{
+    static Registry *r = new Registry();
+    return *r;
+}
+
+inline bool enabled()
+{
+    return registry().enabled.load(std::memory_order_relaxed);
+}
+
+inline int64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline int64_t frameId(double t)
+{
+    return std::llround(t * 1e6);
+}
+
+inline int64_t &currentFrame()
+{
+    static thread_local int64_t frame = -1;
+    return frame;
+}
+
+inline ThreadSlot::~ThreadSlot()
+{
+    if (buffer == NULL)
+        return;
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lk(r.m);
+    r.free_buffers.push_back(buffer);
+}
+
+inline ThreadSlot &threadSlot()
+{
+    static thread_local ThreadSlot slot;
+    if (slot.buffer == NULL)
+    {
+        Registry &r = registry();
+        char name[16];
+        if (pthread_getname_np(pthread_self(), name, sizeof(name)) != 0)
+            name[0] = 0;
+        slot.tid = syscall(SYS_gettid);
+        std::lock_guard<std::mutex> lk(r.m);
+        r.threads.push_back(std::make_pair(slot.tid, std::string(name)));
+        if (!r.free_buffers.empty())
+        {
+            slot.buffer = r.free_buffers.back();
+            r.free_buffers.pop_back();
+        }
+        else
+        {
+            slot.buffer = new ThreadBuffer();
+            slot.buffer->capacity = r.capacity;
+            slot.buffer->events.reset(new Event[r.capacity]);
+            slot.buffer->count = 0;
+            slot.buffer->dropped = 0;
+            r.buffers.push_back(slot.buffer);
+        }
+    }
+    return slot;
+}
+
+inline void record(const char *name, int64_t begin, int64_t end, int64_t frame)
+{
+    ThreadSlot &slot = threadSlot();
+    ThreadBuffer *b = slot.buffer;
+    size_t n = b->count.load(std::memory_order_relaxed);
+    if (n >= b->capacity)
+    {
+        b->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Event &e = b->events[n];
+    e.name = name;
+    e.begin = begin;
+    e.end = end;
+    e.frame = frame;
+    e.tid = slot.tid;
+    b->count.store(n + 1, std::memory_order_release);
+}
+
+// the events recorded so far, false when path cannot be written
+inline bool write(const std::string &path, const std::string &process)
+{
+    FILE *f = fopen(path.c_str(), "w");
+    if (f == NULL)
+        return false;
+    Registry &r = registry();
+    int pid = getpid();
+    fprintf(f, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"%s\"}},\n", pid,
+            process.c_str());
+    std::lock_guard<std::mutex> lk(r.m);
+    for (const auto &t : r.threads)
+        fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%ld,\"args\":{\"name\":\"%s\"}},\n", pid,
+                t.first, t.second.c_str());
+    size_t dropped = 0;
+    for (ThreadBuffer *b : r.buffers)
+    {
+        size_t n = b->count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < n; i++)
+        {
+            const Event &e = b->events[i];
+            fprintf(f, "{\"name\":\"%s\",\"cat\":\"vins\",\"ph\":\"X\",\"pid\":%d,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f", e.name,
+                    pid, e.tid, e.begin * 1e-3, (e.end - e.begin) * 1e-3);
+            if (e.frame >= 0)
+                fprintf(f, ",\"args\":{\"frame\":%lld},\"bind_id\":\"%lld\",\"flow_in\":true,\"flow_out\":true",
+                        (long long)e.frame, (long long)e.frame);
+            fprintf(f, "},\n");
+        }
+        dropped += b->dropped.load(std::memory_order_relaxed);
+    }
+    fclose(f);
+    if (dropped > 0)
+        printf("trace: %zu events dropped, %zu fit in the buffer of a thread\n", dropped, r.capacity);
+    return true;
+}
+
+inline void writeAll()
+{
+    Registry &r = registry();
+    std::vector<std::pair<std::string, std::string>> outputs;
+    {
+        std::lock_guard<std::mutex> lk(r.m);
+        outputs = r.outputs;
+    }
+    for (const auto &o : outputs)
+    {
+        if (write(o.first, o.second))
+            printf("trace written to %s\n", o.first.c_str());
+        else
+            printf("trace: cannot write %s\n", o.first.c_str());
+    }
+}
+
+// records up to capacity events per thread from now on, written to path at exit. Nodes sharing a
+// process (nodelets) each get the whole trace in their file; the first capacity is kept.
+inline void start(size_t capacity, const std::string &path, const std::string &process)
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lk(r.m);
+    if (r.outputs.empty())
+    {
+        r.capacity = capacity;
+        atexit(writeAll);
+    }
+    for (const auto &o : r.outputs)
+        if (o.first == path)
+            return;
+    r.outputs.push_back(std::make_pair(path, process));
+    r.enabled.store(true, std::memory_order_relaxed);
+}
+
+class Scope
+{
+  public:
+    explicit Scope(const char *_name) : name(enabled() ? _name : NULL), begin(name ? now() : 0), frame_set(false),
+                                        prev_frame(-1)
+    {
+    }
+    Scope(const char *_name, double t) : name(enabled() ? _name : NULL), begin(name ? now() : 0), frame_set(name != NULL),
+                                         prev_frame(-1)
+    {
+        if (frame_set)
+        {
+            prev_frame = currentFrame();
+            currentFrame() = frameId(t);
+        }
+    }
+    ~Scope()
+    {
+        if (name == NULL)
+            return;
+        record(name, begin, now(), currentFrame());
+        if (frame_set)
+            currentFrame() = prev_frame;
+    }
+
+  private:
+    const char *name;
+    int64_t begin;
+    bool frame_set;
+    int64_t prev_frame;
+};
+}
+
+#define VINS_TRACE_CONCAT_(a, b) a##b
+#define VINS_TRACE_CONCAT(a, b) VINS_TRACE_CONCAT_(a, b)
+
+#if VINS_TRACING
+#define VINS_TRACE(name) vins_trace::Scope VINS_TRACE_CONCAT(vins_trace_scope_, __LINE__)(name)
+#define VINS_TRACE_FRAME(name, t) vins_trace::Scope VINS_TRACE_CONCAT(vins_trace_scope_, __LINE__)(name, t)
+#else
+#define VINS_TRACE(name) \
+    do                   \
+    {                    \
+    } while (0)
+#define VINS_TRACE_FRAME(name, t) (void)(t)
+#endif
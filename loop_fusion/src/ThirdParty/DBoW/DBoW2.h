@@ -19,8 +19,7 @@
  * Check my website to obtain updates: http://doriangalvez.com
  *
  * \section requirements Requirements
- * This library requires the DUtils, DUtilsCV, DVision and OpenCV libraries,
- * as well as the boost::dynamic_bitset class.
+ * This library requires the DUtils, DUtilsCV, DVision and OpenCV libraries.
  *
  * \section citation Citation
  * If you use this software in academic works, please cite:
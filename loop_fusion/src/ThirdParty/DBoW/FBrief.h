@@ -1,73 +1,89 @@
-/**
- * File: FBrief.h
- * Date: November 2011
- * Author: Dorian Galvez-Lopez
- * Description: functions for BRIEF descriptors
- * License: see the LICENSE.txt file
- *
- */
-
-#ifndef __D_T_F_BRIEF__
-#define __D_T_F_BRIEF__
-
-#include <opencv2/opencv.hpp>
-#include <vector>
-#include <string>
-
-#include "FClass.h"
-#include "../DVision/DVision.h"
-
-namespace DBoW2 {
-
-/// Functions to manipulate BRIEF descriptors
-class FBrief: protected FClass
-{
-public:
-
-  typedef DVision::BRIEF::bitset TDescriptor;
-  typedef const TDescriptor *pDescriptor;
-
-  /**
-   * Calculates the mean value of a set of descriptors
-   * @param descriptors
-   * @param mean mean descriptor
-   */
-  static void meanValue(const std::vector<pDescriptor> &descriptors, 
-    TDescriptor &mean);
-  
-  /**
-   * Calculates the distance between two descriptors
-   * @param a
-   * @param b
-   * @return distance
-   */
-  static double distance(const TDescriptor &a, const TDescriptor &b);
-  
-  /**
-   * Returns a string version of the descriptor
-   * @param a descriptor
-   * @return string version
-   */
-  static std::string toString(const TDescriptor &a);
-  
-  /**
-   * Returns a descriptor from a string
-   * @param a descriptor
-   * @param s string version
-   */
-  static void fromString(TDescriptor &a, const std::string &s);
-  
-  /**
-   * Returns a mat with the descriptors in float format
-   * @param descriptors
-   * @param mat (out) NxL 32F matrix
-   */
-  static void toMat32F(const std::vector<TDescriptor> &descriptors, 
-    cv::Mat &mat);
-
-};
-
-} // namespace DBoW2
-
-#endif
-
+/**
+ * File: FBrief.h
+ * Date: November 2011
+ * Author: Dorian Galvez-Lopez
+ * Description: functions for BRIEF descriptors
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_F_BRIEF__
+#define __D_T_F_BRIEF__
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <string>
+
+#include "FClass.h"
+#include "../DVision/DVision.h"
+
+namespace DBoW2 {
+
+/// Functions to manipulate BRIEF descriptors
+class FBrief: protected FClass
+{
+public:
+
+  typedef DVision::BRIEF::bitset TDescriptor;
+  typedef const TDescriptor *pDescriptor;
+
+  /**
+   * Calculates the mean value of a set of descriptors
+   * @param descriptors
+   * @param mean mean descriptor
+   */
+  static void meanValue(const std::vector<pDescriptor> &descriptors, 
+    TDescriptor &mean);
+  
+  /**
+   * Calculates the distance between two descriptors
+   * @param a
+   * @param b
+   * @return distance
+   */
+  inline static double distance(const TDescriptor &a, const TDescriptor &b)
+  {
+    return (double)DVision::BRIEF::distance(a, b);
+  }
+
+  /**
+   * Returns the position of the descriptor of b[0 .. n) closest to a
+   * @param a
+   * @param b contiguous descriptors
+   * @param n number of descriptors in b, at least 1
+   * @return position in b, the first one on ties
+   */
+  inline static unsigned int nearest(const TDescriptor &a,
+    const TDescriptor *b, unsigned int n)
+  {
+    return TDescriptor::nearest(a, b, n);
+  }
+  
+  /**
+   * Returns a string version of the descriptor
+   * @param a descriptor
+   * @return string version
+   */
+  static std::string toString(const TDescriptor &a);
+  
+  /**
+   * Returns a descriptor from a string
+   * @param a descriptor
+   * @param s string version
+   */
+  static void fromString(TDescriptor &a, const std::string &s);
+  
+  /**
+   * Returns a mat with the descriptors in float format
+   * @param descriptors
+   * @param mat (out) NxL 32F matrix
+   */
+  static void toMat32F(const std::vector<TDescriptor> &descriptors, 
+    cv::Mat &mat);
+
+};
+
+} // namespace DBoW2
+
+#endif
+
@@ -42,6 +42,16 @@ class FClass
    * @return distance
    */
   static double distance(const TDescriptor &a, const TDescriptor &b);
+
+  /**
+   * Returns the position of the descriptor of b[0 .. n) closest to a
+   * @param a
+   * @param b contiguous descriptors
+   * @param n number of descriptors in b, at least 1
+   * @return position in b, the first one on ties
+   */
+  static unsigned int nearest(const TDescriptor &a, const TDescriptor *b,
+    unsigned int n);
   
   /**
    * Returns a string version of the descriptor
@@ -10,6 +10,7 @@
 #ifndef __D_T_TEMPLATED_DATABASE__
 #define __D_T_TEMPLATED_DATABASE__
 
+#include <algorithm>
 #include <vector>
 #include <numeric>
 #include <fstream>
@@ -107,6 +108,13 @@ public:
    */
   template<class T>
   void setVocabulary(const T& voc, bool use_di, int di_levels = 0);
+
+  /**
+   * Uses the given vocabulary without copying it and clears the content of
+   * the database, for several databases on one vocabulary
+   * @param voc vocabulary, must outlive the database
+   */
+  inline void shareVocabulary(const TemplatedVocabulary<TDescriptor,F> *voc);
   
   /**
    * Returns a pointer to the vocabulary used
@@ -122,6 +130,14 @@ public:
    */
   void allocate(int nd = 0, int ni = 0);
 
+  /**
+   * Reserves the inverted file rows for a batch of entries about to be
+   * added, so every row grows once instead of once per entry
+   * @param word_entries word_entries[w] is the number of new entries with
+   *   word w
+   */
+  void reserve(const std::vector<unsigned int> &word_entries);
+
   /**
    * Adds an entry to the database and returns its index
    * @param features features of the new entry
@@ -154,6 +170,27 @@ public:
    * @return number of entries in the database
    */
   inline unsigned int size() const;
+
+  /**
+   * Returns the bow vectors of all the entries, read back from the inverted file
+   * @param vecs vecs[i] is the bow vector of entry i
+   */
+  void getBowVectors(std::vector<BowVector> &vecs) const;
+
+  /**
+   * Returns the heap bytes of the inverted and direct files, estimated from
+   * their sizes and capacities; the vocabulary is not included
+   * @return bytes
+   */
+  size_t memoryBytes() const;
+
+  /**
+   * Words with more entries than this are left out of the L1 query, they
+   * are in too many images to tell them apart and their rows would make the
+   * query cost grow with the database
+   * @param max_entries 0 keeps all the words
+   */
+  inline void setMaxPostings(unsigned int max_entries);
   
   /**
    * Checks if the direct index is being used
@@ -189,6 +226,21 @@ public:
   void query(const BowVector &vec, QueryResults &ret, 
     int max_results = 1, int max_id = -1) const;
 
+  /**
+   * Queries the database with some features and then adds them as a new
+   * entry, the features are transformed only once
+   * @param features query features
+   * @param ret results of the query, without the new entry
+   * @param max_results as in query
+   * @param max_id as in query
+   * @param bowvec if given, the bow vector of these features is returned
+   * @param fvec if given, the vector of nodes and feature indexes is returned
+   * @return id of the new entry
+   */
+  EntryId queryAndAdd(const std::vector<TDescriptor> &features,
+    QueryResults &ret, int max_results = 1, int max_id = -1,
+    BowVector *bowvec = NULL, FeatureVector *fvec = NULL);
+
   /**
    * Returns the a feature vector associated with a database entry
    * @param id entry id (must be < size())
@@ -282,10 +334,17 @@ protected:
      * @return true iff this entry id is the same as eid
      */
     inline bool operator==(EntryId eid) const { return entry_id == eid; }
+
+    /**
+     * Compares the entry ids, rows can be searched with lower_bound
+     * @param eid
+     * @return true iff this entry id is lower than eid
+     */
+    inline bool operator<(EntryId eid) const { return entry_id < eid; }
   };
   
   /// Row of InvertedFile
-  typedef std::list<IFPair> IFRow;
+  typedef std::vector<IFPair> IFRow;
   // IFRows are sorted in ascending entry_id order
   
   /// Inverted index
@@ -302,6 +361,9 @@ protected:
 
   /// Associated vocabulary
   TemplatedVocabulary<TDescriptor, F> *m_voc;
+
+  /// False when m_voc is shared, set by shareVocabulary
+  bool m_owns_voc;
   
   /// Flag to use direct index
   bool m_use_di;
@@ -321,6 +383,9 @@ protected:
 
   /// Number of valid entries in m_dfile
   int m_nentries;
+
+  /// Longest row queryL1 reads, 0 for all
+  unsigned int m_max_postings;
   
 };
 
@@ -329,7 +394,8 @@ protected:
 template<class TDescriptor, class F>
 TemplatedDatabase<TDescriptor, F>::TemplatedDatabase
   (bool use_di, int di_levels)
-  : m_voc(NULL), m_use_di(use_di), m_dilevels(di_levels), m_nentries(0)
+  : m_voc(NULL), m_owns_voc(true), m_use_di(use_di), m_dilevels(di_levels),
+  m_nentries(0), m_max_postings(0)
 {
 }
 
@@ -339,7 +405,8 @@ template<class TDescriptor, class F>
 template<class T>
 TemplatedDatabase<TDescriptor, F>::TemplatedDatabase
   (const T &voc, bool use_di, int di_levels)
-  : m_voc(NULL), m_use_di(use_di), m_dilevels(di_levels)
+  : m_voc(NULL), m_owns_voc(true), m_use_di(use_di), m_dilevels(di_levels),
+  m_max_postings(0)
 {
   setVocabulary(voc);
   clear();
@@ -350,7 +417,7 @@ TemplatedDatabase<TDescriptor, F>::TemplatedDatabase
 template<class TDescriptor, class F>
 TemplatedDatabase<TDescriptor,F>::TemplatedDatabase
   (const TemplatedDatabase<TDescriptor,F> &db)
-  : m_voc(NULL)
+  : m_voc(NULL), m_owns_voc(true), m_max_postings(0)
 {
   *this = db;
 }
@@ -360,7 +427,7 @@ TemplatedDatabase<TDescriptor,F>::TemplatedDatabase
 template<class TDescriptor, class F>
 TemplatedDatabase<TDescriptor, F>::TemplatedDatabase
   (const std::string &filename)
-  : m_voc(NULL)
+  : m_voc(NULL), m_owns_voc(true), m_max_postings(0)
 {
   load(filename);
 }
@@ -370,7 +437,7 @@ TemplatedDatabase<TDescriptor, F>::TemplatedDatabase
 template<class TDescriptor, class F>
 TemplatedDatabase<TDescriptor, F>::TemplatedDatabase
   (const char *filename)
-  : m_voc(NULL)
+  : m_voc(NULL), m_owns_voc(true), m_max_postings(0)
 {
   load(filename);
 }
@@ -380,7 +447,7 @@ TemplatedDatabase<TDescriptor, F>::TemplatedDatabase
 template<class TDescriptor, class F>
 TemplatedDatabase<TDescriptor, F>::~TemplatedDatabase(void)
 {
-  delete m_voc;
+  if(m_owns_voc) delete m_voc;
 }
 
 // --------------------------------------------------------------------------
@@ -396,6 +463,7 @@ TemplatedDatabase<TDescriptor,F>& TemplatedDatabase<TDescriptor,F>::operator=
     m_dilevels = db.m_dilevels;
     m_ifile = db.m_ifile;
     m_nentries = db.m_nentries;
+    m_max_postings = db.m_max_postings;
     m_use_di = db.m_use_di;
     setVocabulary(*db.m_voc);
   }
@@ -476,6 +544,49 @@ EntryId TemplatedDatabase<TDescriptor, F>::add(const BowVector &v,
 
 // ---------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+void TemplatedDatabase<TDescriptor, F>::getBowVectors
+  (std::vector<BowVector> &vecs) const
+{
+  vecs.clear();
+  vecs.resize(m_nentries);
+
+  // rows are walked in word order, so every vector is filled in key order
+  for(WordId word_id = 0; word_id < m_ifile.size(); ++word_id)
+  {
+    typename IFRow::const_iterator rit;
+    for(rit = m_ifile[word_id].begin(); rit != m_ifile[word_id].end(); ++rit)
+    {
+      vecs[rit->entry_id].insert(vecs[rit->entry_id].end(),
+        std::make_pair(word_id, rit->word_weight));
+    }
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+size_t TemplatedDatabase<TDescriptor, F>::memoryBytes() const
+{
+  // a map node is the pair plus four words of links and color
+  const size_t node = 4 * sizeof(void*);
+  size_t bytes = m_ifile.capacity() * sizeof(IFRow);
+  for(typename InvertedFile::const_iterator rit = m_ifile.begin(); rit != m_ifile.end(); ++rit)
+    bytes += rit->capacity() * sizeof(IFPair);
+
+  bytes += m_dfile.capacity() * sizeof(FeatureVector);
+  for(typename DirectFile::const_iterator dit = m_dfile.begin(); dit != m_dfile.end(); ++dit)
+    for(FeatureVector::const_iterator fit = dit->begin(); fit != dit->end(); ++fit)
+      bytes += sizeof(*fit) + node + fit->second.capacity() * sizeof(unsigned int);
+
+  bytes += m_dBowfile.capacity() * sizeof(BowVector);
+  for(typename std::vector<BowVector>::const_iterator bit = m_dBowfile.begin(); bit != m_dBowfile.end(); ++bit)
+    bytes += bit->size() * (sizeof(BowVector::value_type) + node);
+  return bytes;
+}
+
+// ---------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 void TemplatedDatabase<TDescriptor, F>::delete_entry(const EntryId entry_id)
 {
@@ -509,8 +620,9 @@ template<class T>
 inline void TemplatedDatabase<TDescriptor, F>::setVocabulary
   (const T& voc)
 {
-  delete m_voc;
+  if(m_owns_voc) delete m_voc;
   m_voc = new T(voc);
+  m_owns_voc = true;
   clear();
 }
 
@@ -523,8 +635,22 @@ inline void TemplatedDatabase<TDescriptor, F>::setVocabulary
 {
   m_use_di = use_di;
   m_dilevels = di_levels;
-  delete m_voc;
+  if(m_owns_voc) delete m_voc;
   m_voc = new T(voc);
+  m_owns_voc = true;
+  clear();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+inline void TemplatedDatabase<TDescriptor, F>::shareVocabulary
+  (const TemplatedVocabulary<TDescriptor,F> *voc)
+{
+  if(m_owns_voc) delete m_voc;
+  // only read through m_voc, the const is the caller's
+  m_voc = const_cast<TemplatedVocabulary<TDescriptor,F> *>(voc);
+  m_owns_voc = false;
   clear();
 }
 
@@ -579,6 +705,29 @@ void TemplatedDatabase<TDescriptor, F>::allocate(int nd, int ni)
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+void TemplatedDatabase<TDescriptor, F>::reserve
+  (const std::vector<unsigned int> &word_entries)
+{
+  const size_t n = std::min(word_entries.size(), m_ifile.size());
+  for(size_t w = 0; w < n; ++w)
+  {
+    if(word_entries[w] > 0)
+      m_ifile[w].reserve(m_ifile[w].size() + word_entries[w]);
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+inline void TemplatedDatabase<TDescriptor, F>::setMaxPostings
+  (unsigned int max_entries)
+{
+  m_max_postings = max_entries;
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 inline unsigned int TemplatedDatabase<TDescriptor, F>::size() const
 {
@@ -615,6 +764,28 @@ void TemplatedDatabase<TDescriptor, F>::query(
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+EntryId TemplatedDatabase<TDescriptor, F>::queryAndAdd(
+  const std::vector<TDescriptor> &features,
+  QueryResults &ret, int max_results, int max_id,
+  BowVector *bowvec, FeatureVector *fvec)
+{
+  BowVector aux;
+  BowVector& v = (bowvec ? *bowvec : aux);
+  FeatureVector fv_aux;
+  FeatureVector& fv = (fvec ? *fvec : fv_aux);
+
+  if(m_use_di || fvec != NULL)
+    m_voc->transform(features, v, fv, m_dilevels);
+  else
+    m_voc->transform(features, v);
+
+  query(v, ret, max_results, max_id);
+  return m_use_di ? add(v, fv) : add(v);
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 void TemplatedDatabase<TDescriptor, F>::query(
   const BowVector &vec, 
@@ -658,9 +829,21 @@ void TemplatedDatabase<TDescriptor, F>::queryL1(const BowVector &vec,
 {
   BowVector::const_iterator vit;
   typename IFRow::const_iterator rit;
-    
-  std::map<EntryId, double> pairs;
-  std::map<EntryId, double>::iterator pit;
+
+  // dense scores by entry id, touched lists the entries that got any
+  std::vector<double> scores(m_nentries, 0.0);
+  std::vector<char> seen(m_nentries, 0);
+  std::vector<EntryId> touched;
+  auto accumulate = [&](const IFPair &pair, WordValue qvalue)
+  {
+    const WordValue dvalue = pair.word_weight;
+    if(!seen[pair.entry_id])
+    {
+      seen[pair.entry_id] = 1;
+      touched.push_back(pair.entry_id);
+    }
+    scores[pair.entry_id] += fabs(qvalue - dvalue) - fabs(qvalue) - fabs(dvalue);
+  };
   
   for(vit = vec.begin(); vit != vec.end(); ++vit)
   {
@@ -668,49 +851,45 @@ void TemplatedDatabase<TDescriptor, F>::queryL1(const BowVector &vec,
     const WordValue& qvalue = vit->second;
         
     const IFRow& row = m_ifile[word_id];
+    if(m_max_postings > 0 && row.size() > m_max_postings) continue;
     
-    // IFRows are sorted in ascending entry_id order
+    // IFRows are sorted in ascending entry_id order, the row is cut at
+    // max_id, only the newest entry passes the filter after it
+    typename IFRow::const_iterator end = row.end();
+    bool newest = false;
+    if(max_id != -1 && !row.empty() && (int)row.back().entry_id >= max_id)
+    {
+      end = std::lower_bound(row.begin(), row.end(),
+        (EntryId)std::max(max_id, 0));
+      newest = (int)row.back().entry_id == m_nentries - 1;
+    }
     
-    for(rit = row.begin(); rit != row.end(); ++rit)
+    for(rit = row.begin(); rit != end; ++rit)
     {
-      const EntryId entry_id = rit->entry_id;
-      const WordValue& dvalue = rit->word_weight;
-      
-      if((int)entry_id < max_id || max_id == -1 || (int)entry_id == m_nentries - 1)
-      {
-        double value = fabs(qvalue - dvalue) - fabs(qvalue) - fabs(dvalue);
-        
-        pit = pairs.lower_bound(entry_id);
-        if(pit != pairs.end() && !(pairs.key_comp()(entry_id, pit->first)))
-        {
-          pit->second += value;
-        }
-        else
-        {
-          pairs.insert(pit, 
-            std::map<EntryId, double>::value_type(entry_id, value));
-        }
-      }
-      
+      accumulate(*rit, qvalue);
     } // for each inverted row
+    if(newest) accumulate(row.back(), qvalue);
   } // for each query word
 	
-  // move to vector
-  ret.reserve(pairs.size());
-  for(pit = pairs.begin(); pit != pairs.end(); ++pit)
+  // move to vector, in entry order as the map did
+  std::sort(touched.begin(), touched.end());
+  ret.reserve(touched.size());
+  for(size_t i = 0; i < touched.size(); ++i)
   {
-    ret.push_back(Result(pit->first, pit->second));
+    ret.push_back(Result(touched[i], scores[touched[i]]));
   }
 	
   // resulting "scores" are now in [-2 best .. 0 worst]	
   
-  // sort vector in ascending order of score
-  std::sort(ret.begin(), ret.end());
+  // sort vector in ascending order of score, only the results kept
   // (ret is inverted now --the lower the better--)
-
-  // cut vector
   if(max_results > 0 && (int)ret.size() > max_results)
+  {
+    std::partial_sort(ret.begin(), ret.begin() + max_results, ret.end());
     ret.resize(max_results);
+  }
+  else
+    std::sort(ret.begin(), ret.end());
   
   // complete and scale score to [0 worst .. 1 best]
   // ||v - w||_{L1} = 2 + Sum(|v_i - w_i| - |v_i| - |w_i|) 
@@ -1290,7 +1469,11 @@ void TemplatedDatabase<TDescriptor, F>::load(const cv::FileStorage &fs,
 { 
   // load voc first
   // subclasses must instantiate m_voc before calling this ::load
-  if(!m_voc) m_voc = new TemplatedVocabulary<TDescriptor, F>;
+  if(!m_voc || !m_owns_voc)
+  {
+    m_voc = new TemplatedVocabulary<TDescriptor, F>;
+    m_owns_voc = true;
+  }
   
   m_voc->load(fs);
 
@@ -17,6 +17,7 @@
 #include <fstream>
 #include <string>
 #include <algorithm>
+#include <thread>
 #include <opencv2/opencv.hpp>
 
 #include "FeatureVector.h"
@@ -27,7 +28,6 @@
 
 // Added by VINS [[[
 #include "../VocabularyBinary.hpp"
-#include <boost/dynamic_bitset.hpp>
 // Added by VINS ]]]
 
 namespace DBoW2 {
@@ -380,6 +380,12 @@ protected:
    * Create the words of the vocabulary once the tree has been built
    */
   void createWords();
+
+  /**
+   * Copies the children of every node into the flat arrays the tree descent
+   * of transform reads, once the tree has been built or loaded
+   */
+  void buildFlatTree();
   
   /**
    * Sets the weights of the nodes of tree according to the given features.
@@ -412,6 +418,13 @@ protected:
   /// Words of the vocabulary (tree leaves)
   /// this condition holds: m_words[wid]->word_id == wid
   std::vector<Node*> m_words;
+
+  /// Children of node n are m_child_node[m_child_begin[n] .. m_child_begin[n+1])
+  /// and their descriptors the same range of m_child_descriptor, contiguous so
+  /// that every level of the descent is a linear scan
+  std::vector<unsigned int> m_child_begin;
+  std::vector<NodeId> m_child_node;
+  std::vector<TDescriptor> m_child_descriptor;
   
 };
 
@@ -934,6 +947,34 @@ void TemplatedVocabulary<TDescriptor,F>::createWords()
       }
     }
   }
+  buildFlatTree();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::buildFlatTree()
+{
+  m_child_begin.resize(m_nodes.size() + 1);
+  unsigned int n = 0;
+  for(size_t i = 0; i < m_nodes.size(); ++i)
+  {
+    m_child_begin[i] = n;
+    n += m_nodes[i].children.size();
+  }
+  m_child_begin[m_nodes.size()] = n;
+
+  m_child_node.resize(n);
+  m_child_descriptor.resize(n);
+  for(size_t i = 0; i < m_nodes.size(); ++i)
+  {
+    const std::vector<NodeId> &children = m_nodes[i].children;
+    for(size_t c = 0; c < children.size(); ++c)
+    {
+      m_child_node[m_child_begin[i] + c] = children[c];
+      m_child_descriptor[m_child_begin[i] + c] = m_nodes[children[c]].descriptor;
+    }
+  }
 }
 
 // --------------------------------------------------------------------------
@@ -1217,10 +1258,7 @@ template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature, 
   WordId &word_id, WordValue &weight, NodeId *nid, int levelsup) const
 { 
-  // propagate the feature down the tree
-  std::vector<NodeId> nodes;
-  typename std::vector<NodeId>::const_iterator nit;
-
+  // propagate the feature down the tree, through the flat child arrays
   // level at which the node must be stored in nid, if given
   const int nid_level = m_L - levelsup;
   if(nid_level <= 0 && nid != NULL) *nid = 0; // root
@@ -1231,26 +1269,15 @@ void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature,
   do
   {
     ++current_level;
-    nodes = m_nodes[final_id].children;
-    final_id = nodes[0];
- 
-    double best_d = F::distance(feature, m_nodes[final_id].descriptor);
-
-    for(nit = nodes.begin() + 1; nit != nodes.end(); ++nit)
-    {
-      NodeId id = *nit;
-      double d = F::distance(feature, m_nodes[id].descriptor);
-      if(d < best_d)
-      {
-        best_d = d;
-        final_id = id;
-      }
-    }
+    const unsigned int begin = m_child_begin[final_id];
+    const unsigned int end = m_child_begin[final_id + 1];
+    final_id = m_child_node[begin +
+      F::nearest(feature, &m_child_descriptor[begin], end - begin)];
     
     if(nid != NULL && current_level == nid_level)
       *nid = final_id;
     
-  } while( !m_nodes[final_id].isLeaf() );
+  } while( m_child_begin[final_id] != m_child_begin[final_id + 1] );
 
   // turn node id into word id
   word_id = m_nodes[final_id].word_id;
@@ -1502,6 +1529,7 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
     m_nodes[nid].word_id = wid;
     m_words[wid] = &m_nodes[nid];
   }
+  buildFlatTree();
 }
     
 // Added by VINS [[[
@@ -1511,10 +1539,13 @@ void TemplatedVocabulary<TDescriptor,F>::loadBin(const std::string &filename) {
   m_words.clear();
   m_nodes.clear();
   //printf("loop load bin\n");
-  std::ifstream ifStream(filename);
-  VINSLoop::Vocabulary voc;
-  voc.deserialize(ifStream);
-  ifStream.close();
+  // the nodes are read where the file is mapped, no copy of the whole file
+  VINSLoop::MappedVocabulary voc;
+  if(!voc.open(filename))
+  {
+    printf("can not load vocabulary %s\n", filename.c_str());
+    return;
+  }
   
   m_k = voc.k;
   m_L = voc.L;
@@ -1526,25 +1557,37 @@ void TemplatedVocabulary<TDescriptor,F>::loadBin(const std::string &filename) {
   m_nodes.resize(voc.nNodes + 1); // +1 to include root
   m_nodes[0].id = 0;
 
-  for(unsigned int i = 0; i < voc.nNodes; ++i)
+  // every node is written by one thread only, the children lists are
+  // appended to afterwards in file order
+  const unsigned int nNodes = voc.nNodes;
+  unsigned int nThreads = std::max(1u, std::min(std::thread::hardware_concurrency(),
+    nNodes / 65536 + 1));
+  std::vector<std::thread> threads;
+  for(unsigned int t = 0; t < nThreads; ++t)
   {
-    NodeId nid = voc.nodes[i].nodeId;
-    NodeId pid = voc.nodes[i].parentId;
-    WordValue weight = voc.nodes[i].weight;
+    threads.push_back(std::thread([&, t]()
+    {
+      for(unsigned int i = nNodes * t / nThreads; i < nNodes * (t + 1) / nThreads; ++i)
+      {
+        NodeId nid = voc.nodes[i].nodeId;
       
-    m_nodes[nid].id = nid;
-    m_nodes[nid].parent = pid;
-    m_nodes[nid].weight = weight;
-    m_nodes[pid].children.push_back(nid);
+        m_nodes[nid].id = nid;
+        m_nodes[nid].parent = voc.nodes[i].parentId;
+        m_nodes[nid].weight = voc.nodes[i].weight;
       
-    // Sorry to break template here
-    m_nodes[nid].descriptor = boost::dynamic_bitset<>(voc.nodes[i].descriptor, voc.nodes[i].descriptor + 4);
-    
-    if (i < 5) {
-      std::string test;
-      boost::to_string(m_nodes[nid].descriptor, test);
-      //cout << "descriptor[" << i << "] = " << test << endl;
-    }
+        // Sorry to break template here
+        m_nodes[nid].descriptor = TDescriptor(voc.nodes[i].descriptor);
+      }
+    }));
+  }
+  for(unsigned int t = 0; t < nThreads; ++t)
+    threads[t].join();
+
+  for(unsigned int i = 0; i < nNodes; ++i)
+  {
+    std::vector<NodeId> &children = m_nodes[voc.nodes[i].parentId].children;
+    if(children.empty()) children.reserve(m_k);
+    children.push_back(voc.nodes[i].nodeId);
   }
   
   // words
@@ -1558,6 +1601,7 @@ void TemplatedVocabulary<TDescriptor,F>::loadBin(const std::string &filename) {
     m_nodes[nid].word_id = wid;
     m_words[wid] = &m_nodes[nid];
   }
+  buildFlatTree();
 }
     
 // Added by VINS ]]]
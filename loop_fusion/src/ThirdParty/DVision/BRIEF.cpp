@@ -12,8 +12,9 @@
 
 #include "BRIEF.h"
 #include "../DUtils/DUtils.h"
-#include <boost/dynamic_bitset.hpp>
 #include <vector>
+#include <cstdlib>
+#include <algorithm>
 
 using namespace std;
 using namespace DVision;
@@ -25,6 +26,7 @@ BRIEF::BRIEF(int nbits, int patch_size, Type type):
 {
   assert(patch_size > 1);
   assert(nbits > 0);
+  assert(nbits <= bitset::BITS);
   generateTestPoints();
 }
 
@@ -77,14 +79,41 @@ void BRIEF::compute(const cv::Mat &image,
 
   std::vector<cv::KeyPoint>::const_iterator kit;
   
+  // the pairs as offsets into im, and the farthest a pair reaches from
+  // the keypoint, once for all the points
+  const int n = m_x1.size();
+  const int step = im.step1();
+  std::vector<int> off1(n), off2(n);
+  int reach = 0;
+  for(int i = 0; i < n; ++i)
+  {
+    off1[i] = m_y1[i] * step + m_x1[i];
+    off2[i] = m_y2[i] * step + m_x2[i];
+    reach = std::max(reach, std::max(std::max(abs(m_x1[i]), abs(m_y1[i])),
+      std::max(abs(m_x2[i]), abs(m_y2[i]))));
+  }
+  
   int x1, y1, x2, y2;
   
   dit = descriptors.begin();
   for(kit = points.begin(); kit != points.end(); ++kit, ++dit)
   {
-    dit->resize(m_bit_length);
     dit->reset();
 
+    const int cx = (int)kit->pt.x;
+    const int cy = (int)kit->pt.y;
+    if(kit->pt.x >= 0 && kit->pt.y >= 0 && cx - reach >= 0 && cx + reach < W
+      && cy - reach >= 0 && cy + reach < H)
+    {
+      // the whole pattern is inside the image: no bounds checks and one
+      // comparison per bit without a branch, the same bits as below
+      const unsigned char *center = im.ptr<unsigned char>(cy) + cx;
+      uint64_t *words = dit->words.data();
+      for(int i = 0; i < n; ++i)
+        words[i >> 6] |= uint64_t(center[off1[i]] < center[off2[i]]) << (i & 63);
+      continue;
+    }
+
     for(unsigned int i = 0; i < m_x1.size(); ++i)
     {
       x1 = (int)(kit->pt.x + m_x1[i]);
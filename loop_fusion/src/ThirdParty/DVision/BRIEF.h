@@ -32,7 +32,7 @@
 #include <opencv2/opencv.hpp>
 #include <vector>
 #include <opencv2/imgproc/imgproc_c.h>
-#include <boost/dynamic_bitset.hpp>
+#include "Bitset256.h"
 
 namespace DVision {
 
@@ -41,8 +41,8 @@ class BRIEF
 {
 public:
 
-  /// Bitset type
-  typedef boost::dynamic_bitset<> bitset;
+  /// Bitset type, descriptors are at most Bitset256::BITS long
+  typedef Bitset256 bitset;
 
   /// Type of pairs
   enum Type
@@ -152,6 +152,7 @@ public:
     m_x2 = x2;
     m_y2 = y2;
     m_bit_length = x1.size();
+    assert(m_bit_length <= bitset::BITS);
   }
   
   /**
@@ -162,7 +163,7 @@ public:
    */
   inline static int distance(const bitset &a, const bitset &b)
   {
-    return (a^b).count();
+    return bitset::distance(a, b);
   }
 
 protected:
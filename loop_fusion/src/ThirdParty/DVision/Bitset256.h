@@ -0,0 +1,179 @@
+/**
+ * File: Bitset256.h
+ * Description: fixed size 256 bit binary descriptor, the BRIEF descriptor
+ *   of the loop detection. Replaces boost::dynamic_bitset: no heap block,
+ *   and the Hamming distance is four xor and popcount without a temporary.
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_BITSET_256__
+#define __D_BITSET_256__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace DVision {
+
+/// 256 bit descriptor, bit i is bit (i % 64) of word i / 64, the block
+/// layout of boost::dynamic_bitset<> and of the binary vocabulary
+class Bitset256
+{
+public:
+
+  static const int BITS = 256;
+  static const int WORDS = 4;
+
+  Bitset256()
+  {
+    reset();
+  }
+
+  /// from the WORDS blocks of a binary vocabulary node
+  explicit Bitset256(const uint64_t *blocks)
+  {
+    for(int w = 0; w < WORDS; ++w) words[w] = blocks[w];
+  }
+
+  inline size_t size() const
+  {
+    return BITS;
+  }
+
+  inline bool test(size_t i) const
+  {
+    return (words[i >> 6] >> (i & 63)) & 1;
+  }
+
+  inline bool operator[](size_t i) const
+  {
+    return test(i);
+  }
+
+  inline Bitset256 &set(size_t i, bool value = true)
+  {
+    const uint64_t bit = uint64_t(1) << (i & 63);
+    if(value) words[i >> 6] |= bit;
+    else words[i >> 6] &= ~bit;
+    return *this;
+  }
+
+  inline Bitset256 &flip(size_t i)
+  {
+    words[i >> 6] ^= uint64_t(1) << (i & 63);
+    return *this;
+  }
+
+  inline Bitset256 &reset()
+  {
+    words.fill(0);
+    return *this;
+  }
+
+  /// number of set bits
+  inline int count() const
+  {
+    return __builtin_popcountll(words[0]) + __builtin_popcountll(words[1]) +
+      __builtin_popcountll(words[2]) + __builtin_popcountll(words[3]);
+  }
+
+  inline Bitset256 &operator^=(const Bitset256 &b)
+  {
+    for(int w = 0; w < WORDS; ++w) words[w] ^= b.words[w];
+    return *this;
+  }
+
+  inline Bitset256 operator^(const Bitset256 &b) const
+  {
+    Bitset256 r = *this;
+    return r ^= b;
+  }
+
+  inline bool operator==(const Bitset256 &b) const
+  {
+    return words == b.words;
+  }
+
+  inline bool operator!=(const Bitset256 &b) const
+  {
+    return words != b.words;
+  }
+
+  /// Hamming distance, popcnt on every word when the target has it, on
+  /// aarch64 two 128 bit NEON byte counts
+  inline static int distance(const Bitset256 &a, const Bitset256 &b)
+  {
+#if defined(__aarch64__) && defined(__ARM_NEON)
+    const uint8x16_t x0 = veorq_u8(vld1q_u8((const uint8_t *)&a.words[0]),
+      vld1q_u8((const uint8_t *)&b.words[0]));
+    const uint8x16_t x1 = veorq_u8(vld1q_u8((const uint8_t *)&a.words[2]),
+      vld1q_u8((const uint8_t *)&b.words[2]));
+    // byte counts are at most 8, pairwise sums into 16 bit lanes can not overflow
+    uint16x8_t s = vpaddlq_u8(vcntq_u8(x0));
+    s = vpadalq_u8(s, vcntq_u8(x1));
+    return vaddvq_u16(s);
+#else
+    return __builtin_popcountll(a.words[0] ^ b.words[0]) +
+      __builtin_popcountll(a.words[1] ^ b.words[1]) +
+      __builtin_popcountll(a.words[2] ^ b.words[2]) +
+      __builtin_popcountll(a.words[3] ^ b.words[3]);
+#endif
+  }
+
+  /// Position of the descriptor in b[0 .. n) closest to a, the first one on
+  /// ties. b is contiguous, the vocabulary descent calls this once per level.
+  inline static int nearest(const Bitset256 &a, const Bitset256 *b, int n)
+  {
+    int best = 0;
+    int best_d = distance(a, b[0]);
+    for(int i = 1; i < n; ++i)
+    {
+      const int d = distance(a, b[i]);
+      best = d < best_d ? i : best;
+      best_d = d < best_d ? d : best_d;
+    }
+    return best;
+  }
+
+  std::array<uint64_t, WORDS> words;
+};
+
+/// '0' / '1' characters from the last bit to the first, as
+/// boost::dynamic_bitset writes them, so saved pose graphs still load
+inline std::ostream &operator<<(std::ostream &os, const Bitset256 &b)
+{
+  std::string s(Bitset256::BITS, '0');
+  for(int i = 0; i < Bitset256::BITS; ++i)
+    if(b.test(i)) s[Bitset256::BITS - 1 - i] = '1';
+  return os << s;
+}
+
+inline std::istream &operator>>(std::istream &is, Bitset256 &b)
+{
+  std::string s;
+  if(!(is >> s)) return is;
+  b.reset();
+  const int n = s.size() < (size_t)Bitset256::BITS ? (int)s.size() : Bitset256::BITS;
+  for(int k = 0; k < n; ++k)
+  {
+    char c = s[s.size() - 1 - k];
+    if(c == '1') b.set(k);
+    else if(c != '0')
+    {
+      is.setstate(std::ios::failbit);
+      break;
+    }
+  }
+  return is;
+}
+
+} // namespace DVision
+
+#endif
@@ -1,4 +1,9 @@
 #include "VocabularyBinary.hpp"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <opencv2/core/core.hpp>
 using namespace std;
 
@@ -33,3 +38,46 @@ void VINSLoop::Vocabulary::deserialize(ifstream& stream) {
     words = new Word[nWords];
     stream.read((char *)words, sizeof(Word) * nWords);
 }
+
+VINSLoop::MappedVocabulary::MappedVocabulary()
+: nNodes(0), nWords(0), nodes(nullptr), words(nullptr), data(nullptr), size(0) {
+}
+
+VINSLoop::MappedVocabulary::~MappedVocabulary() {
+    if (data != nullptr) {
+        munmap(data, size);
+        data = nullptr;
+    }
+}
+
+bool VINSLoop::MappedVocabulary::open(const string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < Vocabulary::staticDataSize()) {
+        ::close(fd);
+        return false;
+    }
+    size = st.st_size;
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        data = nullptr;
+        return false;
+    }
+    // every node is read once, in order
+    madvise(data, size, MADV_SEQUENTIAL);
+    
+    const char* p = (const char*)data;
+    memcpy(&k, p, Vocabulary::staticDataSize());
+    size_t nodeBytes = sizeof(Node) * (size_t)nNodes, wordBytes = sizeof(Word) * (size_t)nWords;
+    if (nNodes < 0 || nWords < 0 || Vocabulary::staticDataSize() + nodeBytes + wordBytes > size) {
+        munmap(data, size);
+        data = nullptr;
+        return false;
+    }
+    nodes = (const Node*)(p + Vocabulary::staticDataSize());
+    words = (const Word*)(p + Vocabulary::staticDataSize() + nodeBytes);
+    return true;
+}
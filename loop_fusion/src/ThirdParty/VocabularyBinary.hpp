@@ -42,6 +42,31 @@ struct Vocabulary {
     }
 };
 
+// A file written by Vocabulary::serialize mapped read only, nodes and words
+// point into the mapping and are valid until the object is destroyed.
+struct MappedVocabulary {
+    int32_t k;
+    int32_t L;
+    int32_t scoringType;
+    int32_t weightingType;
+    
+    int32_t nNodes;
+    int32_t nWords;
+    
+    const Node* nodes;
+    const Word* words;
+    
+    MappedVocabulary();
+    ~MappedVocabulary();
+    
+    // false when the file is missing or shorter than its counts
+    bool open(const std::string& filename);
+    
+private:
+    void* data;
+    size_t size;
+};
+
 }
 
 #endif /* VocabularyBinary_hpp */
@@ -10,6 +10,10 @@
  *******************************************************/
 
 #include "keyframe.h"
+#include <cfloat>
+#ifdef LOOP_FUSION_CUDA
+#include "utility/cuda_extractor.h"
+#endif
 
 template <typename Derived>
 static void reduceVector(vector<Derived> &v, vector<uchar> status)
@@ -26,6 +30,7 @@ KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3
 		           vector<cv::Point3f> &_point_3d, vector<cv::Point2f> &_point_2d_uv, vector<cv::Point2f> &_point_2d_norm,
 		           vector<double> &_point_id, int _sequence)
 {
+	VINS_TRACE_FRAME("KeyFrame", _time_stamp);
 	time_stamp = _time_stamp;
 	index = _index;
 	vio_T_w_i = _vio_T_w_i;
@@ -34,8 +39,6 @@ KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3
 	R_w_i = vio_R_w_i;
 	origin_vio_T = vio_T_w_i;		
 	origin_vio_R = vio_R_w_i;
-	image = _image.clone();
-	cv::resize(image, thumbnail, cv::Size(80, 60));
 	point_3d = _point_3d;
 	point_2d_uv = _point_2d_uv;
 	point_2d_norm = _point_2d_norm;
@@ -44,11 +47,16 @@ KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3
 	loop_index = -1;
 	has_fast_point = false;
 	loop_info << 0, 0, 0, 0, 0, 0, 0, 0;
+	stored_offset = -1;
+	stored_keypoints = 0;
+	evicted = false;
 	sequence = _sequence;
-	computeWindowBRIEFPoint();
-	computeBRIEFPoint();
-	if(!DEBUG_IMAGE)
-		image.release();
+	// the descriptors are read straight from the caller's image, only the debug output keeps a copy
+	cv::Mat smoothed;
+	computeBRIEFPoint(_image, smoothed);
+	computeWindowBRIEFPoint(smoothed);
+	if (DEBUG_IMAGE)
+		keyframe_images.put(index, _image);
 }
 
 // load previous keyframe
@@ -64,11 +72,8 @@ KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3
 	vio_R_w_i = _R_w_i;
 	T_w_i = _T_w_i;
 	R_w_i = _R_w_i;
-	if (DEBUG_IMAGE)
-	{
-		image = _image.clone();
-		cv::resize(image, thumbnail, cv::Size(80, 60));
-	}
+	if (DEBUG_IMAGE && !_image.empty())
+		keyframe_images.put(index, _image);
 	if (_loop_index != -1)
 		has_loop = true;
 	else
@@ -76,6 +81,9 @@ KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3
 	loop_index = _loop_index;
 	loop_info = _loop_info;
 	has_fast_point = false;
+	stored_offset = -1;
+	stored_keypoints = 0;
+	evicted = false;
 	sequence = 0;
 	keypoints = _keypoints;
 	keypoints_norm = _keypoints_norm;
@@ -83,42 +91,54 @@ KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3
 }
 
 
-void KeyFrame::computeWindowBRIEFPoint()
+void KeyFrame::computeWindowBRIEFPoint(const cv::Mat &smoothed)
 {
-	BriefExtractor extractor(BRIEF_PATTERN_FILE.c_str());
+	const BriefExtractor &extractor = BriefExtractor::shared();
+	window_keypoints.reserve(point_2d_uv.size());
 	for(int i = 0; i < (int)point_2d_uv.size(); i++)
 	{
 	    cv::KeyPoint key;
 	    key.pt = point_2d_uv[i];
 	    window_keypoints.push_back(key);
 	}
-	extractor(image, window_keypoints, window_brief_descriptors);
+	extractor.computeSmoothed(smoothed, window_keypoints, window_brief_descriptors);
 }
 
-void KeyFrame::computeBRIEFPoint()
+void KeyFrame::computeBRIEFPoint(const cv::Mat &image, cv::Mat &smoothed)
 {
-	BriefExtractor extractor(BRIEF_PATTERN_FILE.c_str());
+	const BriefExtractor &extractor = BriefExtractor::shared();
 	const int fast_th = 20; // corner detector response threshold
-	if(1)
-		cv::FAST(image, keypoints, fast_th, true);
+#ifdef LOOP_FUSION_CUDA
+	if(LOOP_USE_GPU && image.type() == CV_8UC1)
+		CudaKeyFrameExtractor::shared().extract(image, fast_th, keypoints, smoothed);
 	else
+#endif
 	{
-		vector<cv::Point2f> tmp_pts;
-		cv::goodFeaturesToTrack(image, tmp_pts, 500, 0.01, 10);
-		for(int i = 0; i < (int)tmp_pts.size(); i++)
+		if(1)
+			cv::FAST(image, keypoints, fast_th, true);
+		else
 		{
-		    cv::KeyPoint key;
-		    key.pt = tmp_pts[i];
-		    keypoints.push_back(key);
+			vector<cv::Point2f> tmp_pts;
+			cv::goodFeaturesToTrack(image, tmp_pts, 500, 0.01, 10);
+			for(int i = 0; i < (int)tmp_pts.size(); i++)
+			{
+			    cv::KeyPoint key;
+			    key.pt = tmp_pts[i];
+			    keypoints.push_back(key);
+			}
 		}
+		BriefExtractor::smooth(image, smoothed);
 	}
-	extractor(image, keypoints, brief_descriptors);
+	extractor.computeSmoothed(smoothed, keypoints, brief_descriptors);
+	vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> tmp_uv(keypoints.size());
+	vector<Eigen::Vector3d> tmp_p(keypoints.size());
+	for (int i = 0; i < (int)keypoints.size(); i++)
+		tmp_uv[i] = Eigen::Vector2d(keypoints[i].pt.x, keypoints[i].pt.y);
+	m_camera_lut.liftProjectiveBatch(tmp_uv.data(), tmp_p.data(), (int)keypoints.size());
 	for (int i = 0; i < (int)keypoints.size(); i++)
 	{
-		Eigen::Vector3d tmp_p;
-		m_camera->liftProjective(Eigen::Vector2d(keypoints[i].pt.x, keypoints[i].pt.y), tmp_p);
 		cv::KeyPoint tmp_norm;
-		tmp_norm.pt = cv::Point2f(tmp_p.x()/tmp_p.z(), tmp_p.y()/tmp_p.z());
+		tmp_norm.pt = cv::Point2f(tmp_p[i].x()/tmp_p[i].z(), tmp_p[i].y()/tmp_p[i].z());
 		keypoints_norm.push_back(tmp_norm);
 	}
 }
@@ -128,8 +148,19 @@ void BriefExtractor::operator() (const cv::Mat &im, vector<cv::KeyPoint> &keys,
   m_brief.compute(im, keys, descriptors);
 }
 
+void BriefExtractor::computeSmoothed(const cv::Mat &smoothed, vector<cv::KeyPoint> &keys, vector<BRIEF::bitset> &descriptors) const
+{
+  m_brief.compute(smoothed, keys, descriptors, false);
+}
 
-bool KeyFrame::searchInAera(const BRIEF::bitset window_descriptor,
+void BriefExtractor::smooth(const cv::Mat &im, cv::Mat &smoothed)
+{
+  // as BRIEF::compute does it with treat_image, the keyframe images are grey already
+  cv::GaussianBlur(im, smoothed, cv::Size(9, 9), 2, 2);
+}
+
+
+bool KeyFrame::searchInAera(const BRIEF::bitset &window_descriptor,
                             const std::vector<BRIEF::bitset> &descriptors_old,
                             const std::vector<cv::KeyPoint> &keypoints_old,
                             const std::vector<cv::KeyPoint> &keypoints_old_norm,
@@ -142,7 +173,7 @@ bool KeyFrame::searchInAera(const BRIEF::bitset window_descriptor,
     for(int i = 0; i < (int)descriptors_old.size(); i++)
     {
 
-        int dis = HammingDis(window_descriptor, descriptors_old[i]);
+        int dis = BRIEF::distance(window_descriptor, descriptors_old[i]);
         if(dis < bestDist)
         {
             bestDist = dis;
@@ -167,6 +198,9 @@ void KeyFrame::searchByBRIEFDes(std::vector<cv::Point2f> &matched_2d_old,
                                 const std::vector<cv::KeyPoint> &keypoints_old,
                                 const std::vector<cv::KeyPoint> &keypoints_old_norm)
 {
+    status.reserve(status.size() + window_brief_descriptors.size());
+    matched_2d_old.reserve(matched_2d_old.size() + window_brief_descriptors.size());
+    matched_2d_old_norm.reserve(matched_2d_old_norm.size() + window_brief_descriptors.size());
     for(int i = 0; i < (int)window_brief_descriptors.size(); i++)
     {
         cv::Point2f pt(0.f, 0.f);
@@ -181,6 +215,92 @@ void KeyFrame::searchByBRIEFDes(std::vector<cv::Point2f> &matched_2d_old,
 
 }
 
+// Guided version of searchByBRIEFDes: the window points are projected into old_kf with the pose
+// prior and only matched against the old keypoints within radius (normalized image units) of
+// the projection. The old keypoints are bucketed into a grid of radius sized cells for the call.
+void KeyFrame::searchByProjection(std::vector<cv::Point2f> &matched_2d_old,
+                                  std::vector<cv::Point2f> &matched_2d_old_norm,
+                                  std::vector<uchar> &status,
+                                  KeyFrame* old_kf, double radius)
+{
+    // point_3d is in the raw VIO frame of this keyframe, vio_T_w_i in the pose graph frame: the
+    // difference is the drift corrected so far, the old camera is brought into the raw frame with it
+    Matrix3d R_v_w = origin_vio_R * vio_R_w_i.transpose();
+    Vector3d t_v_w = origin_vio_T - R_v_w * vio_T_w_i;
+    Vector3d T_old;
+    Matrix3d R_old;
+    old_kf->getPose(T_old, R_old);
+    Matrix3d R_c_v = (R_v_w * R_old * qic).transpose();
+    Vector3d T_v_c = R_v_w * (T_old + R_old * tic) + t_v_w;
+
+    const std::vector<cv::KeyPoint> &keys = old_kf->keypoints_norm;
+    float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+    for (const cv::KeyPoint &k : keys)
+    {
+        min_x = min(min_x, k.pt.x);
+        min_y = min(min_y, k.pt.y);
+        max_x = max(max_x, k.pt.x);
+        max_y = max(max_y, k.pt.y);
+    }
+    // at least radius wide, so the 3x3 cells around a projection cover its window
+    const float cell = max((float)radius, max(max_x - min_x, max_y - min_y) / 256);
+    const int cols = keys.empty() ? 0 : (int)((max_x - min_x) / cell) + 1;
+    const int rows = keys.empty() ? 0 : (int)((max_y - min_y) / cell) + 1;
+    auto cellOf = [&](float v, float lo, int n) { return max(0, min(n - 1, (int)((v - lo) / cell))); };
+    // cell c holds cell_index[cell_start[c] .. cell_start[c + 1])
+    vector<int> cell_start(cols * rows + 1, 0), cell_index(keys.size());
+    for (const cv::KeyPoint &k : keys)
+        cell_start[cellOf(k.pt.y, min_y, rows) * cols + cellOf(k.pt.x, min_x, cols) + 1]++;
+    for (int c = 0; c < cols * rows; c++)
+        cell_start[c + 1] += cell_start[c];
+    vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+    for (int i = 0; i < (int)keys.size(); i++)
+        cell_index[fill[cellOf(keys[i].pt.y, min_y, rows) * cols + cellOf(keys[i].pt.x, min_x, cols)]++] = i;
+
+    status.reserve(status.size() + window_brief_descriptors.size());
+    matched_2d_old.reserve(matched_2d_old.size() + window_brief_descriptors.size());
+    matched_2d_old_norm.reserve(matched_2d_old_norm.size() + window_brief_descriptors.size());
+    for (int i = 0; i < (int)window_brief_descriptors.size(); i++)
+    {
+        int bestDist = 128;
+        int bestIndex = -1;
+        Vector3d p = R_c_v * (Vector3d(point_3d[i].x, point_3d[i].y, point_3d[i].z) - T_v_c);
+        if (p.z() > 0 && cols > 0)
+        {
+            float u = p.x() / p.z(), v = p.y() / p.z();
+            if (u > min_x - cell && u < max_x + cell && v > min_y - cell && v < max_y + cell)
+            {
+                int cx = cellOf(u, min_x, cols), cy = cellOf(v, min_y, rows);
+                for (int y = max(0, cy - 1); y <= min(rows - 1, cy + 1); y++)
+                    for (int x = max(0, cx - 1); x <= min(cols - 1, cx + 1); x++)
+                        for (int k = cell_start[y * cols + x]; k < cell_start[y * cols + x + 1]; k++)
+                        {
+                            int j = cell_index[k];
+                            if (fabs(keys[j].pt.x - u) > radius || fabs(keys[j].pt.y - v) > radius)
+                                continue;
+                            int dis = BRIEF::distance(window_brief_descriptors[i], old_kf->brief_descriptors[j]);
+                            if (dis < bestDist)
+                            {
+                                bestDist = dis;
+                                bestIndex = j;
+                            }
+                        }
+            }
+        }
+        if (bestIndex != -1 && bestDist < 80)
+        {
+            matched_2d_old.push_back(old_kf->keypoints[bestIndex].pt);
+            matched_2d_old_norm.push_back(keys[bestIndex].pt);
+            status.push_back(1);
+        }
+        else
+        {
+            matched_2d_old.push_back(cv::Point2f(0.f, 0.f));
+            matched_2d_old_norm.push_back(cv::Point2f(0.f, 0.f));
+            status.push_back(0);
+        }
+    }
+}
 
 void KeyFrame::FundmantalMatrixRANSAC(const std::vector<cv::Point2f> &matched_2d_cur_norm,
                                       const std::vector<cv::Point2f> &matched_2d_old_norm,
@@ -191,20 +311,9 @@ void KeyFrame::FundmantalMatrixRANSAC(const std::vector<cv::Point2f> &matched_2d
 		status.push_back(0);
     if (n >= 8)
     {
-        vector<cv::Point2f> tmp_cur(n), tmp_old(n);
-        for (int i = 0; i < (int)matched_2d_cur_norm.size(); i++)
-        {
-            double FOCAL_LENGTH = 460.0;
-            double tmp_x, tmp_y;
-            tmp_x = FOCAL_LENGTH * matched_2d_cur_norm[i].x + COL / 2.0;
-            tmp_y = FOCAL_LENGTH * matched_2d_cur_norm[i].y + ROW / 2.0;
-            tmp_cur[i] = cv::Point2f(tmp_x, tmp_y);
-
-            tmp_x = FOCAL_LENGTH * matched_2d_old_norm[i].x + COL / 2.0;
-            tmp_y = FOCAL_LENGTH * matched_2d_old_norm[i].y + ROW / 2.0;
-            tmp_old[i] = cv::Point2f(tmp_x, tmp_y);
-        }
-        cv::findFundamentalMat(tmp_cur, tmp_old, cv::FM_RANSAC, 3.0, 0.9, status);
+        // 3 pixels in a virtual camera with a 460 focal length
+        double FOCAL_LENGTH = 460.0;
+        EpipolarRansac::findInliers(matched_2d_cur_norm, matched_2d_old_norm, 3.0 / FOCAL_LENGTH, 0.9, status);
     }
 }
 
@@ -226,6 +335,15 @@ void KeyFrame::PnPRANSAC(const vector<cv::Point2f> &matched_2d_old_norm,
     R_inital = R_w_c.inverse();
     P_inital = -(R_inital * T_w_c);
 
+    if (USE_IMU)
+    {
+        // 2 point hypotheses around the vio pose, refined on their inliers
+        PnPRansac::solve(matched_3d, matched_2d_old_norm, R_inital, P_inital, 10.0 / 460.0, 0.99, status);
+        PnP_R_old = R_inital.transpose() * qic.transpose();
+        PnP_T_old = -R_inital.transpose() * P_inital - PnP_R_old * tic;
+        return;
+    }
+
     cv::eigen2cv(R_inital, tmp_r);
     cv::Rodrigues(tmp_r, rvec);
     cv::eigen2cv(P_inital, t);
@@ -269,6 +387,22 @@ void KeyFrame::PnPRANSAC(const vector<cv::Point2f> &matched_2d_old_norm,
 
 bool KeyFrame::findConnection(KeyFrame* old_kf)
 {
+	VINS_TRACE("findConnection");
+	Eigen::Matrix<double, 8, 1 > _loop_info;
+	if (verifyConnection(old_kf, _loop_info) == 0)
+		return false;
+	has_loop = true;
+	loop_index = old_kf->index;
+	loop_info = _loop_info;
+	return true;
+}
+
+// The geometric check of findConnection without recording the loop, safe to run for several
+// candidates at once. Returns the PnP inliers of an accepted loop and its loop_info, 0 otherwise.
+int KeyFrame::verifyConnection(KeyFrame* old_kf, Eigen::Matrix<double, 8, 1 > &_loop_info)
+{
+	// verifyCandidates runs it on threads of its own
+	VINS_TRACE_FRAME("verifyConnection", time_stamp);
 	TicToc tmp_t;
 	//printf("find Connection\n");
 	vector<cv::Point2f> matched_2d_cur, matched_2d_old;
@@ -309,7 +443,16 @@ bool KeyFrame::findConnection(KeyFrame* old_kf)
 	    }
 	#endif
 	//printf("search by des\n");
-	searchByBRIEFDes(matched_2d_old, matched_2d_old_norm, status, old_kf->brief_descriptors, old_kf->keypoints, old_kf->keypoints_norm);
+	// the guided search first when configured, the exhaustive one when the prior was too far off
+	if (LOOP_SEARCH_RADIUS > 0)
+		searchByProjection(matched_2d_old, matched_2d_old_norm, status, old_kf, LOOP_SEARCH_RADIUS / 460.0);
+	if (LOOP_SEARCH_RADIUS <= 0 || count(status.begin(), status.end(), 1) <= MIN_LOOP_NUM)
+	{
+		matched_2d_old.clear();
+		matched_2d_old_norm.clear();
+		status.clear();
+		searchByBRIEFDes(matched_2d_old, matched_2d_old_norm, status, old_kf->brief_descriptors, old_kf->keypoints, old_kf->keypoints_norm);
+	}
 	reduceVector(matched_2d_cur, status);
 	reduceVector(matched_2d_old, status);
 	reduceVector(matched_2d_cur_norm, status);
@@ -430,7 +573,14 @@ bool KeyFrame::findConnection(KeyFrame* old_kf)
 	        	int gap = 10;
 	        	cv::Mat gap_image(ROW, gap, CV_8UC1, cv::Scalar(255, 255, 255));
 	            cv::Mat gray_img, loop_match_img;
-	            cv::Mat old_img = old_kf->image;
+	            cv::Mat image, old_img;
+	            // a blank frame stands in for an image the cache has dropped
+	            keyframe_images.get(index, image);
+	            keyframe_images.get(old_kf->index, old_img);
+	            if (image.empty())
+	            	image = cv::Mat(ROW, COL, CV_8UC1, cv::Scalar(0));
+	            if (old_img.empty())
+	            	old_img = cv::Mat(ROW, COL, CV_8UC1, cv::Scalar(0));
 	            cv::hconcat(image, gap_image, gap_image);
 	            cv::hconcat(gap_image, old_img, gray_img);
 	            cvtColor(gray_img, loop_match_img, CV_GRAY2RGB);
@@ -490,27 +640,22 @@ bool KeyFrame::findConnection(KeyFrame* old_kf)
 	    //cout << "pnp relative_yaw " << relative_yaw << endl;
 	    if (abs(relative_yaw) < 30.0 && relative_t.norm() < 20.0)
 	    {
-
-	    	has_loop = true;
-	    	loop_index = old_kf->index;
-	    	loop_info << relative_t.x(), relative_t.y(), relative_t.z(),
-	    	             relative_q.w(), relative_q.x(), relative_q.y(), relative_q.z(),
-	    	             relative_yaw;
+	    	_loop_info << relative_t.x(), relative_t.y(), relative_t.z(),
+	    	              relative_q.w(), relative_q.x(), relative_q.y(), relative_q.z(),
+	    	              relative_yaw;
 	    	//cout << "pnp relative_t " << relative_t.transpose() << endl;
 	    	//cout << "pnp relative_q " << relative_q.w() << " " << relative_q.vec().transpose() << endl;
-	        return true;
+	        return (int)matched_2d_cur.size();
 	    }
 	}
 	//printf("loop final use num %d %lf--------------- \n", (int)matched_2d_cur.size(), t_match.toc());
-	return false;
+	return 0;
 }
 
 
 int KeyFrame::HammingDis(const BRIEF::bitset &a, const BRIEF::bitset &b)
 {
-    BRIEF::bitset xor_of_bitset = a ^ b;
-    int dis = xor_of_bitset.count();
-    return dis;
+    return BRIEF::distance(a, b);
 }
 
 void KeyFrame::getVioPose(Eigen::Vector3d &_T_w_i, Eigen::Matrix3d &_R_w_i)
@@ -563,6 +708,71 @@ void KeyFrame::updateLoop(Eigen::Matrix<double, 8, 1 > &_loop_info)
 	}
 }
 
+void KeyFrame::releaseWindow()
+{
+	vector<cv::Point3f>().swap(point_3d);
+	vector<cv::Point2f>().swap(point_2d_uv);
+	vector<cv::Point2f>().swap(point_2d_norm);
+	vector<double>().swap(point_id);
+	vector<cv::KeyPoint>().swap(window_keypoints);
+	vector<BRIEF::bitset>().swap(window_brief_descriptors);
+}
+
+size_t KeyFrame::memoryBytes() const
+{
+	using memory_stats::vectorBytes;
+	return sizeof(KeyFrame) + vectorBytes(point_3d) + vectorBytes(point_2d_uv) + vectorBytes(point_2d_norm) +
+	       vectorBytes(point_id) + vectorBytes(keypoints) + vectorBytes(keypoints_norm) +
+	       vectorBytes(window_keypoints) + vectorBytes(brief_descriptors) + vectorBytes(window_brief_descriptors);
+}
+
+void KeyFrame::evict(DescriptorStore &store)
+{
+	static_assert(sizeof(BRIEF::bitset) == sizeof(PoseGraphMap::DescriptorRecord), "descriptors are stored as they are");
+	if (evicted)
+		return;
+	if (stored_offset < 0)
+	{
+		vector<PoseGraphMap::KeyPointRecord> records(keypoints.size());
+		for (int i = 0; i < (int)keypoints.size(); i++)
+		{
+			records[i].x = keypoints[i].pt.x;
+			records[i].y = keypoints[i].pt.y;
+			records[i].x_norm = keypoints_norm[i].pt.x;
+			records[i].y_norm = keypoints_norm[i].pt.y;
+		}
+		stored_offset = store.write(records.data(), (const PoseGraphMap::DescriptorRecord *)brief_descriptors.data(), records.size());
+		// stays in memory when the store can not take it
+		if (stored_offset < 0)
+			return;
+	}
+	stored_keypoints = keypoints.size();
+	vector<cv::KeyPoint>().swap(keypoints);
+	vector<cv::KeyPoint>().swap(keypoints_norm);
+	vector<BRIEF::bitset>().swap(brief_descriptors);
+	evicted = true;
+}
+
+bool KeyFrame::restore(const DescriptorStore &store)
+{
+	if (!evicted)
+		return true;
+	vector<PoseGraphMap::KeyPointRecord> records(stored_keypoints);
+	vector<BRIEF::bitset> descriptors(stored_keypoints);
+	if (!store.read(stored_offset, stored_keypoints, records.data(), (PoseGraphMap::DescriptorRecord *)descriptors.data()))
+		return false;
+	keypoints.resize(stored_keypoints);
+	keypoints_norm.resize(stored_keypoints);
+	for (int i = 0; i < stored_keypoints; i++)
+	{
+		keypoints[i].pt = cv::Point2f(records[i].x, records[i].y);
+		keypoints_norm[i].pt = cv::Point2f(records[i].x_norm, records[i].y_norm);
+	}
+	brief_descriptors.swap(descriptors);
+	evicted = false;
+	return true;
+}
+
 BriefExtractor::BriefExtractor(const std::string &pattern_file)
 {
   // The DVision::BRIEF extractor computes a random pattern by default when
@@ -583,4 +793,10 @@ BriefExtractor::BriefExtractor(const std::string &pattern_file)
   m_brief.importPairs(x1, y1, x2, y2);
 }
 
+const BriefExtractor &BriefExtractor::shared()
+{
+  static const BriefExtractor extractor(BRIEF_PATTERN_FILE);
+  return extractor;
+}
+
 
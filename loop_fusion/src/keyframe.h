@@ -20,6 +20,11 @@
 #include "camodocal/camera_models/PinholeCamera.h"
 #include "utility/tic_toc.h"
 #include "utility/utility.h"
+#include "utility/epipolar_ransac.h"
+#include "utility/pnp_ransac.h"
+#include "utility/descriptor_store.h"
+#include "utility/trace.h"
+#include "utility/memory_stats.h"
 #include "parameters.h"
 #include "ThirdParty/DBoW/DBoW2.h"
 #include "ThirdParty/DVision/DVision.h"
@@ -35,8 +40,15 @@ class BriefExtractor
 {
 public:
   virtual void operator()(const cv::Mat &im, vector<cv::KeyPoint> &keys, vector<BRIEF::bitset> &descriptors) const;
+  // descriptors on an image already given to smooth(), several sets of points share one blur
+  void computeSmoothed(const cv::Mat &smoothed, vector<cv::KeyPoint> &keys, vector<BRIEF::bitset> &descriptors) const;
+  // the gaussian smoothed image the BRIEF tests are sampled from
+  static void smooth(const cv::Mat &im, cv::Mat &smoothed);
   BriefExtractor(const std::string &pattern_file);
 
+  // the extractor of BRIEF_PATTERN_FILE, read on the first call and shared by all keyframes
+  static const BriefExtractor &shared();
+
   DVision::BRIEF m_brief;
 };
 
@@ -50,11 +62,13 @@ public:
 			 cv::Mat &_image, int _loop_index, Eigen::Matrix<double, 8, 1 > &_loop_info,
 			 vector<cv::KeyPoint> &_keypoints, vector<cv::KeyPoint> &_keypoints_norm, vector<BRIEF::bitset> &_brief_descriptors);
 	bool findConnection(KeyFrame* old_kf);
-	void computeWindowBRIEFPoint();
-	void computeBRIEFPoint();
+	int verifyConnection(KeyFrame* old_kf, Eigen::Matrix<double, 8, 1 > &_loop_info);
+	void computeWindowBRIEFPoint(const cv::Mat &smoothed);
+	// FAST corners of image and their descriptors, the smoothed image is kept for the window points
+	void computeBRIEFPoint(const cv::Mat &image, cv::Mat &smoothed);
 	//void extractBrief();
 	int HammingDis(const BRIEF::bitset &a, const BRIEF::bitset &b);
-	bool searchInAera(const BRIEF::bitset window_descriptor,
+	bool searchInAera(const BRIEF::bitset &window_descriptor,
 	                  const std::vector<BRIEF::bitset> &descriptors_old,
 	                  const std::vector<cv::KeyPoint> &keypoints_old,
 	                  const std::vector<cv::KeyPoint> &keypoints_old_norm,
@@ -66,6 +80,10 @@ public:
                           const std::vector<BRIEF::bitset> &descriptors_old,
                           const std::vector<cv::KeyPoint> &keypoints_old,
                           const std::vector<cv::KeyPoint> &keypoints_old_norm);
+	void searchByProjection(std::vector<cv::Point2f> &matched_2d_old,
+	                        std::vector<cv::Point2f> &matched_2d_old_norm,
+	                        std::vector<uchar> &status,
+	                        KeyFrame* old_kf, double radius);
 	void FundmantalMatrixRANSAC(const std::vector<cv::Point2f> &matched_2d_cur_norm,
                                 const std::vector<cv::Point2f> &matched_2d_old_norm,
                                 vector<uchar> &status);
@@ -83,6 +101,17 @@ public:
 	double getLoopRelativeYaw();
 	Eigen::Quaterniond getLoopRelativeQ();
 
+	// frees what only the newest keyframe matches with: the window points and their descriptors
+	void releaseWindow();
+	// moves keypoints and descriptors to the store, restore() reads them back for loop matching
+	void evict(DescriptorStore &store);
+	bool restore(const DescriptorStore &store);
+	bool isEvicted() const { return evicted; }
+	// number of keypoints, also when they are in the store
+	int keypointNum() const { return evicted ? stored_keypoints : (int)keypoints.size(); }
+	// heap bytes of the points, keypoints and descriptors it holds
+	size_t memoryBytes() const;
+
 
 
 	double time_stamp; 
@@ -94,8 +123,6 @@ public:
 	Eigen::Matrix3d R_w_i;
 	Eigen::Vector3d origin_vio_T;		
 	Eigen::Matrix3d origin_vio_R;
-	cv::Mat image;
-	cv::Mat thumbnail;
 	vector<cv::Point3f> point_3d; 
 	vector<cv::Point2f> point_2d_uv;
 	vector<cv::Point2f> point_2d_norm;
@@ -111,5 +138,11 @@ public:
 	bool has_loop;
 	int loop_index;
 	Eigen::Matrix<double, 8, 1 > loop_info;
+
+	// where evict() wrote the keypoints and descriptors, -1 until it has; they never change, a
+	// restored keyframe is evicted again without a second write
+	int64_t stored_offset;
+	int stored_keypoints;
+	bool evicted;
 };
 
@@ -0,0 +1,43 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ * 
+ * This file is part of VINS.
+ * 
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <string>
+#include <ros/ros.h>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+// pose_graph_node.cpp, built without its main()
+void startLoopFusion(ros::NodeHandle &n, const std::string &config_file);
+
+namespace loop_fusion
+{
+
+// loop_fusion_node as a nodelet. Loaded into the same manager as vins/VinsNodelet (and the
+// camera driver), keyframes, point clouds and images arrive as shared pointers.
+// Takes the config file from the private parameter ~config_file.
+class LoopFusionNodelet : public nodelet::Nodelet
+{
+  private:
+    virtual void onInit()
+    {
+        ros::NodeHandle &n = getPrivateNodeHandle();
+        std::string config_file;
+        if (!n.getParam("config_file", config_file))
+        {
+            ROS_ERROR("loop_fusion nodelet: ~config_file is not set");
+            return;
+        }
+        printf("config_file: %s\n", config_file.c_str());
+        startLoopFusion(n, config_file);
+    }
+};
+
+}
+
+PLUGINLIB_EXPORT_CLASS(loop_fusion::LoopFusionNodelet, nodelet::Nodelet)
@@ -0,0 +1,332 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+// Microbenchmarks of the loop detection kernels on synthetic keyframes: the BRIEF extraction of a
+// keyframe, the descriptor matching and PnP verification of a loop candidate and the vocabulary
+// database query against a long session. The pose graph factors are checked against their autodiff functors and timed.
+//
+// rosrun loop_fusion loop_fusion_microbench [name filter] [vocabulary file]
+
+#include <stdio.h>
+#include <random>
+#include <string>
+#include <vector>
+#include <ros/ros.h>
+#include <ros/package.h>
+#include "keyframe.h"
+#include "parameters.h"
+#include "pose_graph.h"
+#include "utility/microbench.h"
+
+// defined by pose_graph_node.cpp in the node, keyframe.cpp needs them
+camodocal::CameraPtr m_camera;
+camodocal::UndistortionLUT m_camera_lut;
+ImageCache keyframe_images;
+Eigen::Vector3d tic;
+Eigen::Matrix3d qic;
+ros::Publisher pub_match_img;
+int VISUALIZATION_SHIFT_X;
+int VISUALIZATION_SHIFT_Y;
+std::string BRIEF_PATTERN_FILE;
+std::string POSE_GRAPH_SAVE_PATH;
+int ROW;
+int COL;
+std::string VINS_RESULT_PATH;
+int DEBUG_IMAGE;
+int PATH_MAX_POSES;
+double LOOP_SEARCH_RADIUS;
+int LOOP_CANDIDATES;
+int POSE_GRAPH_INCREMENTAL;
+int LOOP_MAX_POSTINGS;
+int LOOP_DB_SHARDS;
+int TRACE_EVENTS;
+int RESIDENT_KEYFRAMES;
+int LOOP_USE_GPU;
+int GPS_FUSION;
+int USE_IMU;
+int LOCALIZATION_ONLY;
+
+// sizes of computeBRIEFPoint (500 fast corners) and of the window points sent by the estimator
+static const int KEYPOINTS = 500;
+static const int WINDOW_POINTS = 150;
+
+static BRIEF::bitset randomDescriptor(std::mt19937 &rng)
+{
+    BRIEF::bitset d;
+    for (size_t i = 0; i < d.size(); i++)
+        d.set(i, rng() & 1);
+    return d;
+}
+
+// a re-observation of d: flips about one bit in ten, about the distance of a true match
+static BRIEF::bitset perturbed(const BRIEF::bitset &d, std::mt19937 &rng)
+{
+    BRIEF::bitset p = d;
+    for (size_t i = 0; i < p.size(); i++)
+        if (rng() % 10 == 0)
+            p.flip(i);
+    return p;
+}
+
+// Largest difference between the jacobians of analytic and of autodiff at parameters, in the
+// local coordinates of the blocks: quaternion blocks (quaternion[k]) are the right perturbation
+// of QuaternionRightParameterization, the autodiff ones are taken through d q / d theta.
+static double jacobianDifference(const ceres::CostFunction &analytic, const ceres::CostFunction &autodiff,
+                                 const vector<vector<double>> &parameters, const vector<bool> &quaternion)
+{
+    const int n = analytic.num_residuals();
+    vector<const double *> blocks;
+    vector<vector<double>> j_analytic, j_autodiff;
+    for (const vector<double> &block : parameters)
+    {
+        blocks.push_back(block.data());
+        j_analytic.push_back(vector<double>(n * block.size()));
+        j_autodiff.push_back(vector<double>(n * block.size()));
+    }
+    vector<double *> p_analytic, p_autodiff;
+    for (size_t k = 0; k < parameters.size(); k++)
+    {
+        p_analytic.push_back(j_analytic[k].data());
+        p_autodiff.push_back(j_autodiff[k].data());
+    }
+    vector<double> r_analytic(n), r_autodiff(n);
+    analytic.Evaluate(blocks.data(), r_analytic.data(), p_analytic.data());
+    autodiff.Evaluate(blocks.data(), r_autodiff.data(), p_autodiff.data());
+
+    double diff = 0;
+    for (int i = 0; i < n; i++)
+        diff = std::max(diff, std::abs(r_analytic[i] - r_autodiff[i]));
+    for (size_t k = 0; k < parameters.size(); k++)
+    {
+        int size = parameters[k].size();
+        Eigen::Map<Eigen::MatrixXd> a(j_analytic[k].data(), size, n), b(j_autodiff[k].data(), size, n);
+        Eigen::MatrixXd local_a = a.transpose(), local_b = b.transpose();
+        if (quaternion[k])
+        {
+            const vector<double> &q = parameters[k];
+            local_a = local_a.rightCols(3).eval();
+            local_b = (local_b * 0.5 * quaternionLeft(Eigen::Quaterniond(q[0], q[1], q[2], q[3])).rightCols(3)).eval();
+        }
+        diff = std::max(diff, (local_a - local_b).cwiseAbs().maxCoeff());
+    }
+    return diff;
+}
+
+int main(int argc, char **argv)
+{
+    ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME, ros::console::levels::Warn);
+    MicroBench bench(argc > 1 ? argv[1] : "");
+    std::mt19937 rng(1);
+    DEBUG_IMAGE = 0;
+    LOOP_USE_GPU = 0;
+
+    // an old keyframe and a current one seeing half of its points again
+    vector<cv::KeyPoint> keypoints, keypoints_norm;
+    vector<BRIEF::bitset> descriptors;
+    for (int i = 0; i < KEYPOINTS; i++)
+    {
+        keypoints.push_back(cv::KeyPoint(rng() % 752, rng() % 480, 7));
+        keypoints_norm.push_back(cv::KeyPoint(keypoints.back().pt * (1.0 / 460), 7));
+        descriptors.push_back(randomDescriptor(rng));
+    }
+    Vector3d T = Vector3d::Zero();
+    Matrix3d R = Matrix3d::Identity();
+    cv::Mat image;
+    Eigen::Matrix<double, 8, 1> loop_info = Eigen::Matrix<double, 8, 1>::Zero();
+    KeyFrame cur(0, 1, T, R, T, R, image, -1, loop_info, keypoints, keypoints_norm, descriptors);
+    for (int i = 0; i < WINDOW_POINTS; i++)
+        cur.window_brief_descriptors.push_back(i % 2 ? randomDescriptor(rng) : perturbed(descriptors[rng() % KEYPOINTS], rng));
+
+    // random pattern of the same size as brief_pattern.yml, on a textured image
+    DVision::BRIEF brief;
+    cv::Mat texture(480, 752, CV_8UC1);
+    cv::randu(texture, 0, 255);
+    vector<BRIEF::bitset> extracted;
+    bench.run("BRIEF::compute/500", [&](long n) {
+        for (long i = 0; i < n; i++)
+        {
+            brief.compute(texture, keypoints, extracted);
+            doNotOptimize(extracted[0]);
+        }
+    }, KEYPOINTS);
+
+    vector<cv::Point2f> matched_2d_old, matched_2d_old_norm;
+    vector<uchar> status;
+    bench.run("KeyFrame::searchByBRIEFDes/150x500", [&](long n) {
+        for (long i = 0; i < n; i++)
+        {
+            matched_2d_old.clear();
+            matched_2d_old_norm.clear();
+            status.clear();
+            cur.searchByBRIEFDes(matched_2d_old, matched_2d_old_norm, status, descriptors, keypoints, keypoints_norm);
+            doNotOptimize(status[0]);
+        }
+    }, WINDOW_POINTS * KEYPOINTS);
+
+    // the old keyframe seen from a pose 5 degrees of yaw and 40 cm off the vio prior, 60% inliers
+    tic = Vector3d::Zero();
+    qic = Matrix3d::Identity();
+    const int PNP_POINTS = 100;
+    Matrix3d R_wc_true = Eigen::AngleAxisd(5.0 / 180 * M_PI, Vector3d::UnitZ()).toRotationMatrix();
+    Vector3d t_wc_true(0.3, 0.2, 0.1);
+    vector<cv::Point3f> pnp_3d;
+    vector<cv::Point2f> pnp_2d;
+    std::uniform_real_distribution<double> lateral(-1, 1), depth(2, 6);
+    for (int i = 0; i < PNP_POINTS; i++)
+    {
+        Vector3d p_c(lateral(rng), lateral(rng), depth(rng));
+        Vector3d X = R_wc_true * p_c + t_wc_true;
+        pnp_3d.push_back(cv::Point3f(X.x(), X.y(), X.z()));
+        if (i % 5 < 3)
+            pnp_2d.push_back(cv::Point2f(p_c.x() / p_c.z(), p_c.y() / p_c.z()));
+        else
+            pnp_2d.push_back(cv::Point2f(lateral(rng) * 0.5, lateral(rng) * 0.5));
+    }
+    for (int use_imu = 1; use_imu >= 0; use_imu--)
+    {
+        USE_IMU = use_imu;
+        Vector3d PnP_T_old;
+        Matrix3d PnP_R_old;
+        bench.run(use_imu ? "KeyFrame::PnPRANSAC/100/vio_prior" : "KeyFrame::PnPRANSAC/100/solvePnPRansac", [&](long n) {
+            for (long i = 0; i < n; i++)
+            {
+                status.clear();
+                cur.PnPRANSAC(pnp_2d, pnp_3d, status, PnP_T_old, PnP_R_old);
+                doNotOptimize(PnP_T_old);
+            }
+        });
+    }
+
+    // the pose graph factors, analytic against autodiff on random relative poses
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    double factor_diff = 0;
+    vector<vector<double>> four_dof, six_dof;
+    ceres::CostFunction *four_dof_analytic = NULL, *four_dof_autodiff = NULL;
+    ceres::CostFunction *six_dof_analytic = NULL, *six_dof_autodiff = NULL;
+    for (int k = 0; k < 100; k++)
+    {
+        delete four_dof_analytic;
+        delete four_dof_autodiff;
+        delete six_dof_analytic;
+        delete six_dof_autodiff;
+        double t_x = uniform(rng), t_y = uniform(rng), t_z = uniform(rng);
+        double yaw = 180 * uniform(rng), pitch = 20 * uniform(rng), roll = 20 * uniform(rng);
+        four_dof_analytic = FourDOFWeightError::Create(t_x, t_y, t_z, yaw, pitch, roll);
+        four_dof_autodiff = FourDOFWeightError::CreateAutoDiff(t_x, t_y, t_z, yaw, pitch, roll);
+        four_dof = {{180 * uniform(rng)}, {uniform(rng), uniform(rng), uniform(rng)},
+                    {180 * uniform(rng)}, {uniform(rng), uniform(rng), uniform(rng)}};
+        factor_diff = std::max(factor_diff, jacobianDifference(*four_dof_analytic, *four_dof_autodiff, four_dof,
+                                                               {false, false, false, false}));
+
+        Eigen::Quaterniond q_ij = Eigen::Quaterniond(Eigen::Vector4d::Random()).normalized();
+        Eigen::Quaterniond q_i = Eigen::Quaterniond(Eigen::Vector4d::Random()).normalized();
+        Eigen::Quaterniond q_j = Eigen::Quaterniond(Eigen::Vector4d::Random()).normalized();
+        six_dof_analytic = RelativeRTError::Create(t_x, t_y, t_z, q_ij.w(), q_ij.x(), q_ij.y(), q_ij.z(), 0.1, 0.01);
+        six_dof_autodiff = RelativeRTError::CreateAutoDiff(t_x, t_y, t_z, q_ij.w(), q_ij.x(), q_ij.y(), q_ij.z(), 0.1, 0.01);
+        six_dof = {{q_i.w(), q_i.x(), q_i.y(), q_i.z()}, {uniform(rng), uniform(rng), uniform(rng)},
+                   {q_j.w(), q_j.x(), q_j.y(), q_j.z()}, {uniform(rng), uniform(rng), uniform(rng)}};
+        factor_diff = std::max(factor_diff, jacobianDifference(*six_dof_analytic, *six_dof_autodiff, six_dof,
+                                                               {true, false, true, false}));
+
+        double x = 10 * uniform(rng), y = 10 * uniform(rng), z = uniform(rng), ratio = 0.5 + 0.5 * uniform(rng);
+        std::unique_ptr<ceres::CostFunction> gps_analytic(GPSError::Create(x, y, z, 0.5, ratio));
+        std::unique_ptr<ceres::CostFunction> gps_autodiff(GPSError::CreateAutoDiff(x, y, z, 0.5, ratio));
+        vector<vector<double>> gps = {{uniform(rng), uniform(rng), uniform(rng)}, {uniform(rng), uniform(rng), uniform(rng)},
+                                      {180 * uniform(rng)}, {uniform(rng), uniform(rng), uniform(rng)}};
+        factor_diff = std::max(factor_diff, jacobianDifference(*gps_analytic, *gps_autodiff, gps,
+                                                               {false, false, false, false}));
+    }
+    printf("pose graph factors, largest analytic - autodiff difference: %g\n", factor_diff);
+
+    double factor_residuals[6], factor_jacobian_storage[4][24];
+    double *factor_jacobians[4] = {factor_jacobian_storage[0], factor_jacobian_storage[1],
+                                   factor_jacobian_storage[2], factor_jacobian_storage[3]};
+    const double *four_dof_blocks[4] = {four_dof[0].data(), four_dof[1].data(), four_dof[2].data(), four_dof[3].data()};
+    const double *six_dof_blocks[4] = {six_dof[0].data(), six_dof[1].data(), six_dof[2].data(), six_dof[3].data()};
+    const std::pair<const char *, ceres::CostFunction *> factors[4] = {
+        {"FourDOFWeightError::Evaluate/analytic", four_dof_analytic},
+        {"FourDOFWeightError::Evaluate/autodiff", four_dof_autodiff},
+        {"RelativeRTError::Evaluate/analytic", six_dof_analytic},
+        {"RelativeRTError::Evaluate/autodiff", six_dof_autodiff}};
+    for (int k = 0; k < 4; k++)
+    {
+        const double *const *blocks = k < 2 ? four_dof_blocks : six_dof_blocks;
+        ceres::CostFunction *factor = factors[k].second;
+        bench.run(factors[k].first, [&](long n) {
+            for (long i = 0; i < n; i++)
+            {
+                factor->Evaluate(blocks, factor_residuals, factor_jacobians);
+                doNotOptimize(factor_jacobian_storage[0][0]);
+            }
+        });
+    }
+    delete four_dof_analytic;
+    delete four_dof_autodiff;
+    delete six_dof_analytic;
+    delete six_dof_autodiff;
+
+    // a database the size of a long session, queried as detectLoop does
+    const int DATABASE_SIZE = 2000;
+    char name[64];
+    snprintf(name, sizeof(name), "TemplatedDatabase::query/%d keyframes", DATABASE_SIZE);
+    const char *transform_name = "TemplatedVocabulary::transform/500";
+    // the same keyframes as 4 sessions of a multi-session graph, one shard each
+    const int SHARDS = 4;
+    char sharded_name[64];
+    snprintf(sharded_name, sizeof(sharded_name), "KeyFrameDatabase::query/%d keyframes, %d shards", DATABASE_SIZE, SHARDS);
+    if (bench.enabled(name) || bench.enabled(transform_name) || bench.enabled(sharded_name))
+    {
+        std::string vocabulary_file = argc > 2 ? argv[2] : ros::package::getPath("loop_fusion") +
+                                                               "/../support_files/brief_k10L6.bin";
+        TicToc t_load;
+        BriefVocabulary voc(vocabulary_file);
+        BriefDatabase db;
+        db.setVocabulary(voc, false, 0);
+        KeyFrameDatabase sharded_db;
+        sharded_db.setVocabulary(new BriefVocabulary(voc), SHARDS, 0);
+        DBoW2::BowVector bow;
+        bench.run(transform_name, [&](long n) {
+            for (long i = 0; i < n; i++)
+            {
+                voc.transform(descriptors, bow);
+                doNotOptimize(bow);
+            }
+        }, KEYPOINTS);
+        vector<vector<BRIEF::bitset>> frames(DATABASE_SIZE);
+        for (int k = 0; k < DATABASE_SIZE; k++)
+        {
+            // consecutive keyframes share most of their points
+            for (int i = 0; i < KEYPOINTS; i++)
+                frames[k].push_back(k > 0 && i % 4 ? perturbed(frames[k - 1][i], rng) : randomDescriptor(rng));
+            db.add(frames[k], &bow);
+            sharded_db.add(k, k * SHARDS / DATABASE_SIZE, bow);
+        }
+        printf("vocabulary and database ready in %.0f ms\n", t_load.toc());
+        vector<BRIEF::bitset> query = frames[DATABASE_SIZE / 2];
+        for (BRIEF::bitset &d : query)
+            d = perturbed(d, rng);
+        DBoW2::QueryResults ret;
+        bench.run(name, [&](long n) {
+            for (long i = 0; i < n; i++)
+            {
+                db.query(query, ret, 4, DATABASE_SIZE - 50);
+                doNotOptimize(ret);
+            }
+        });
+        bench.run(sharded_name, [&](long n) {
+            for (long i = 0; i < n; i++)
+            {
+                sharded_db.transform(query, bow);
+                sharded_db.query(bow, ret, 4, DATABASE_SIZE - 50);
+                doNotOptimize(ret);
+            }
+        });
+    }
+    return 0;
+}
@@ -14,14 +14,20 @@
 #include "camodocal/camera_models/CameraFactory.h"
 #include "camodocal/camera_models/CataCamera.h"
 #include "camodocal/camera_models/PinholeCamera.h"
+#include "camodocal/camera_models/UndistortionLUT.h"
 #include <eigen3/Eigen/Dense>
 #include <ros/ros.h>
 #include <sensor_msgs/Image.h>
 #include <sensor_msgs/PointCloud.h>
 #include <sensor_msgs/image_encodings.h>
 #include <cv_bridge/cv_bridge.h>
+#include "utility/vins_log.h"
+#include "utility/image_cache.h"
 
 extern camodocal::CameraPtr m_camera;
+extern camodocal::UndistortionLUT m_camera_lut;
+// keyframe images by index when DEBUG_IMAGE
+extern ImageCache keyframe_images;
 extern Eigen::Vector3d tic;
 extern Eigen::Matrix3d qic;
 extern ros::Publisher pub_match_img;
@@ -33,5 +39,21 @@ extern int ROW;
 extern int COL;
 extern std::string VINS_RESULT_PATH;
 extern int DEBUG_IMAGE;
+extern int PATH_MAX_POSES;
+extern double LOOP_SEARCH_RADIUS;
+extern int LOOP_CANDIDATES;
+extern int POSE_GRAPH_INCREMENTAL;
+extern int LOOP_MAX_POSTINGS;
+// the loop database is split by sequence into this many shards, queried in parallel
+extern int LOOP_DB_SHARDS;
+// events per thread of the stage timeline in output_path/trace_loop.json, 0 off
+extern int TRACE_EVENTS;
+extern int RESIDENT_KEYFRAMES;
+extern int LOOP_USE_GPU;
+extern int GPS_FUSION;
+// the vio has an imu: its world frame is gravity aligned, only yaw and translation drift
+extern int USE_IMU;
+// live keyframes only localize against the loaded pose graph, which stays as it was loaded
+extern int LOCALIZATION_ONLY;
 
 
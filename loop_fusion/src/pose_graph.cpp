@@ -11,6 +11,9 @@
 
 #include "pose_graph.h"
 
+// horizontal extent of the paired gps fixes before the ENU frame is aligned to them
+static const double GPS_ALIGN_DISTANCE = 10.0;
+
 PoseGraph::PoseGraph()
 {
     posegraph_visualization = new CameraPoseVisualization(1.0, 0.0, 1.0, 1.0);
@@ -27,6 +30,15 @@ PoseGraph::PoseGraph()
     sequence_loop.push_back(0);
     base_sequence = 1;
     use_imu = 0;
+    shifted_since_solve = false;
+    loop_path_first = -1;
+    last_memory_t = -1;
+    gps_initialized = false;
+    gps_yaw[0] = 0;
+    gps_t[0] = gps_t[1] = gps_t[2] = 0;
+    gps_aligned = false;
+    w_r_enu = Eigen::Matrix3d::Identity();
+    w_t_enu = Eigen::Vector3d(0, 0, 0);
 }
 
 PoseGraph::~PoseGraph()
@@ -37,8 +49,12 @@ PoseGraph::~PoseGraph()
 void PoseGraph::registerPub(ros::NodeHandle &n)
 {
     pub_pg_path = n.advertise<nav_msgs::Path>("pose_graph_path", 1000);
+    // latched, an estimator started later gets the current one
+    pub_correction = n.advertise<nav_msgs::Odometry>("vio_correction", 10, true);
+    pub_pg_pose = n.advertise<geometry_msgs::PoseStamped>("pose_graph_pose", 1000);
     pub_base_path = n.advertise<nav_msgs::Path>("base_path", 1000);
     pub_pose_graph = n.advertise<visualization_msgs::MarkerArray>("pose_graph", 1000);
+    pub_memory = n.advertise<diagnostic_msgs::DiagnosticArray>("memory", 10);
     for (int i = 1; i < 10; i++)
         pub_path[i] = n.advertise<nav_msgs::Path>("path_" + to_string(i), 1000);
 }
@@ -61,12 +77,15 @@ void PoseGraph::setIMUFlag(bool _use_imu)
 
 void PoseGraph::loadVocabulary(std::string voc_path)
 {
-    voc = new BriefVocabulary(voc_path);
-    db.setVocabulary(*voc, false, 0);
+    TicToc t_load;
+    // one tree for all the shards, the database keeps it
+    db.setVocabulary(new BriefVocabulary(voc_path), LOOP_DB_SHARDS, LOOP_MAX_POSTINGS);
+    printf("vocabulary loaded in %f ms\n", t_load.toc());
 }
 
 void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
 {
+    VINS_TRACE_FRAME("addKeyFrame", cur_kf->time_stamp);
     //shift to base frame
     Vector3d vio_P_cur;
     Matrix3d vio_R_cur;
@@ -74,12 +93,13 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     {
         sequence_cnt++;
         sequence_loop.push_back(0);
+        m_drift.lock();
         w_t_vio = Eigen::Vector3d(0, 0, 0);
         w_r_vio = Eigen::Matrix3d::Identity();
-        m_drift.lock();
         t_drift = Eigen::Vector3d(0, 0, 0);
         r_drift = Eigen::Matrix3d::Identity();
         m_drift.unlock();
+        publishCorrection();
     }
     
     cur_kf->getVioPose(vio_P_cur, vio_R_cur);
@@ -89,10 +109,11 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     cur_kf->index = global_index;
     global_index++;
 	int loop_index = -1;
+    vector<int> candidates;
     if (flag_detect_loop)
     {
         TicToc tmp_t;
-        loop_index = detectLoop(cur_kf, cur_kf->index);
+        loop_index = detectLoop(cur_kf, cur_kf->index, candidates);
     }
     else
     {
@@ -102,8 +123,19 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
 	{
         //printf(" %d detect loop with %d \n", cur_kf->index, loop_index);
         KeyFrame* old_kf = getKeyFrame(loop_index);
+        restoreKeyFrame(old_kf);
+        bool connected;
+        if (LOOP_CANDIDATES > 1 && candidates.size() > 1)
+        {
+            old_kf = verifyCandidates(cur_kf, candidates);
+            connected = old_kf != NULL;
+            if (connected)
+                loop_index = old_kf->index;
+        }
+        else
+            connected = cur_kf->findConnection(old_kf);
 
-        if (cur_kf->findConnection(old_kf))
+        if (connected)
         {
             if (earliest_loop_index > loop_index || earliest_loop_index == -1)
                 earliest_loop_index = loop_index;
@@ -133,12 +165,14 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
             // shift vio pose of whole sequence to the world frame
             if (old_kf->sequence != cur_kf->sequence && sequence_loop[cur_kf->sequence] == 0)
             {  
+                m_drift.lock();
                 w_r_vio = shift_r;
                 w_t_vio = shift_t;
+                m_drift.unlock();
                 vio_P_cur = w_r_vio * vio_P_cur + w_t_vio;
                 vio_R_cur = w_r_vio *  vio_R_cur;
                 cur_kf->updateVioPose(vio_P_cur, vio_R_cur);
-                list<KeyFrame*>::iterator it = keyframelist.begin();
+                vector<KeyFrame*>::iterator it = keyframelist.begin();
                 for (; it != keyframelist.end(); it++)   
                 {
                     if((*it)->sequence == cur_kf->sequence)
@@ -152,54 +186,33 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
                     }
                 }
                 sequence_loop[cur_kf->sequence] = 1;
+                publishCorrection();
+                m_optimize_buf.lock();
+                shifted_since_solve = true;
+                m_optimize_buf.unlock();
             }
             m_optimize_buf.lock();
             optimize_buf.push(cur_kf->index);
             m_optimize_buf.unlock();
         }
 	}
-	m_keyframelist.lock();
+	std::unique_lock<std::mutex> list_lock(m_keyframelist);
     Vector3d P;
     Matrix3d R;
     cur_kf->getVioPose(P, R);
+    m_drift.lock();
     P = r_drift * P + t_drift;
     R = r_drift * R;
+    m_drift.unlock();
     cur_kf->updatePose(P, R);
     Quaterniond Q{R};
-    geometry_msgs::PoseStamped pose_stamped;
-    pose_stamped.header.stamp = ros::Time(cur_kf->time_stamp);
-    pose_stamped.header.frame_id = "world";
-    pose_stamped.pose.position.x = P.x() + VISUALIZATION_SHIFT_X;
-    pose_stamped.pose.position.y = P.y() + VISUALIZATION_SHIFT_Y;
-    pose_stamped.pose.position.z = P.z();
-    pose_stamped.pose.orientation.x = Q.x();
-    pose_stamped.pose.orientation.y = Q.y();
-    pose_stamped.pose.orientation.z = Q.z();
-    pose_stamped.pose.orientation.w = Q.w();
-    path[sequence_cnt].poses.push_back(pose_stamped);
-    path[sequence_cnt].header = pose_stamped.header;
 
-    if (SAVE_LOOP_PATH)
-    {
-        ofstream loop_path_file(VINS_RESULT_PATH, ios::app);
-        loop_path_file.setf(ios::fixed, ios::floatfield);
-        loop_path_file.precision(0);
-        loop_path_file << cur_kf->time_stamp * 1e9 << ",";
-        loop_path_file.precision(5);
-        loop_path_file  << P.x() << ","
-              << P.y() << ","
-              << P.z() << ","
-              << Q.w() << ","
-              << Q.x() << ","
-              << Q.y() << ","
-              << Q.z() << ","
-              << endl;
-        loop_path_file.close();
-    }
-    //draw local connection
+    // what is drawn of the neighbours is read with the list locked, the drawing and publishing
+    // happen under m_path only, taken before the list is released to keep the path in order
+    vector<Vector3d> edge_P;
     if (SHOW_S_EDGE)
     {
-        list<KeyFrame*>::reverse_iterator rit = keyframelist.rbegin();
+        vector<KeyFrame*>::reverse_iterator rit = keyframelist.rbegin();
         for (int i = 0; i < 4; i++)
         {
             if (rit == keyframelist.rend())
@@ -209,53 +222,186 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
             if((*rit)->sequence == cur_kf->sequence)
             {
                 (*rit)->getPose(conncected_P, connected_R);
-                posegraph_visualization->add_edge(P, conncected_P);
+                edge_P.push_back(conncected_P);
             }
             rit++;
         }
     }
-    if (SHOW_L_EDGE)
+    bool loop_edge = SHOW_L_EDGE && cur_kf->has_loop && cur_kf->sequence > 0;
+    Vector3d connected_P;
+    if (loop_edge)
     {
-        if (cur_kf->has_loop)
+        Matrix3d connected_R;
+        getKeyFrame(cur_kf->loop_index)->getPose(connected_P, connected_R);
+    }
+	keyframelist.push_back(cur_kf);
+    bool gps_attached = GPS_FUSION && attachGPS(cur_kf);
+    std::unique_lock<std::mutex> path_lock(m_path);
+    list_lock.unlock();
+
+    geometry_msgs::PoseStamped pose_stamped;
+    pose_stamped.header.stamp = ros::Time(cur_kf->time_stamp);
+    pose_stamped.header.frame_id = "world";
+    pose_stamped.pose.position.x = P.x() + VISUALIZATION_SHIFT_X;
+    pose_stamped.pose.position.y = P.y() + VISUALIZATION_SHIFT_Y;
+    pose_stamped.pose.position.z = P.z();
+    pose_stamped.pose.orientation.x = Q.x();
+    pose_stamped.pose.orientation.y = Q.y();
+    pose_stamped.pose.orientation.z = Q.z();
+    pose_stamped.pose.orientation.w = Q.w();
+    appendDecimated(path[sequence_cnt], path_index[sequence_cnt], pose_stamped, cur_kf->index, PATH_MAX_POSES);
+    path[sequence_cnt].header = pose_stamped.header;
+    if (pub_pg_pose.getNumSubscribers())
+        pub_pg_pose.publish(pose_stamped);
+
+    if (SAVE_LOOP_PATH)
+    {
+        if (!loop_path_writer.isOpen())
         {
-            //printf("has loop \n");
-            KeyFrame* connected_KF = getKeyFrame(cur_kf->loop_index);
-            Vector3d connected_P,P0;
-            Matrix3d connected_R,R0;
-            connected_KF->getPose(connected_P, connected_R);
-            //cur_kf->getVioPose(P0, R0);
-            cur_kf->getPose(P0, R0);
-            if(cur_kf->sequence > 0)
-            {
-                //printf("add loop into visual \n");
-                posegraph_visualization->add_loopedge(P0, connected_P + Vector3d(VISUALIZATION_SHIFT_X, VISUALIZATION_SHIFT_Y, 0));
-            }
-            
+            loop_path_writer.open(VINS_RESULT_PATH, TrajectoryWriter::EUROC_CSV, false);
+            loop_path_first = cur_kf->index;
         }
+        loop_path_writer.write(cur_kf->time_stamp, P, Q);
+    }
+    marker_start.push_back(posegraph_visualization->size());
+    //draw local connection
+    for (const Vector3d &conncected_P : edge_P)
+        posegraph_visualization->add_edge(P, conncected_P);
+    if (loop_edge)
+    {
+        //printf("add loop into visual \n");
+        posegraph_visualization->add_loopedge(P, connected_P + Vector3d(VISUALIZATION_SHIFT_X, VISUALIZATION_SHIFT_Y, 0));
     }
     //posegraph_visualization->add_pose(P + Vector3d(VISUALIZATION_SHIFT_X, VISUALIZATION_SHIFT_Y, 0), Q);
 
-	keyframelist.push_back(cur_kf);
     publish();
-	m_keyframelist.unlock();
+    path_lock.unlock();
+    publishMemory(cur_kf->time_stamp);
+    if (gps_attached)
+    {
+        // from the first fix on every solve starts at the first keyframe, which stays fixed, and
+        // the gps alignment moves instead
+        earliest_loop_index = 0;
+        m_optimize_buf.lock();
+        optimize_buf.push(cur_kf->index);
+        m_optimize_buf.unlock();
+    }
+    cur_kf->releaseWindow();
+    evictKeyFrames();
+}
+
+
+void PoseGraph::localizeKeyFrame(KeyFrame* cur_kf)
+{
+    VINS_TRACE_FRAME("localizeKeyFrame", cur_kf->time_stamp);
+    if (sequence_cnt != cur_kf->sequence)
+    {
+        sequence_cnt++;
+        sequence_loop.push_back(0);
+        m_drift.lock();
+        w_t_vio = Eigen::Vector3d(0, 0, 0);
+        w_r_vio = Eigen::Matrix3d::Identity();
+        t_drift = Eigen::Vector3d(0, 0, 0);
+        r_drift = Eigen::Matrix3d::Identity();
+        m_drift.unlock();
+        publishCorrection();
+    }
+
+    vector<int> candidates;
+    queryMap(cur_kf, candidates);
+    KeyFrame* old_kf = NULL;
+    if (candidates.size() > 1)
+        old_kf = verifyCandidates(cur_kf, candidates);
+    else if (candidates.size() == 1)
+    {
+        old_kf = getKeyFrame(candidates[0]);
+        restoreKeyFrame(old_kf);
+        if (!cur_kf->findConnection(old_kf))
+            old_kf = NULL;
+    }
+
+    Vector3d vio_P_cur;
+    Matrix3d vio_R_cur;
+    cur_kf->getVioPose(vio_P_cur, vio_R_cur);
+    if (old_kf)
+    {
+        // the map pose of the old keyframe is taken as exact, the drift moves the vio onto it
+        Vector3d w_P_old;
+        Matrix3d w_R_old;
+        old_kf->getPose(w_P_old, w_R_old);
+        Vector3d w_P_cur = w_R_old * cur_kf->getLoopRelativeT() + w_P_old;
+        Matrix3d w_R_cur = w_R_old * cur_kf->getLoopRelativeQ().toRotationMatrix();
+        m_drift.lock();
+        if (use_imu)
+        {
+            yaw_drift = Utility::R2ypr(w_R_cur).x() - Utility::R2ypr(vio_R_cur).x();
+            r_drift = Utility::ypr2R(Vector3d(yaw_drift, 0, 0));
+        }
+        else
+            r_drift = w_R_cur * vio_R_cur.transpose();
+        t_drift = w_P_cur - r_drift * vio_P_cur;
+        m_drift.unlock();
+        publishCorrection();
+    }
+
+    m_drift.lock();
+    Vector3d P = r_drift * vio_P_cur + t_drift;
+    Matrix3d R = r_drift * vio_R_cur;
+    m_drift.unlock();
+    Quaterniond Q{R};
+    // only published and written, nothing of the live keyframes is kept
+    geometry_msgs::PoseStamped pose_stamped;
+    pose_stamped.header.stamp = ros::Time(cur_kf->time_stamp);
+    pose_stamped.header.frame_id = "world";
+    pose_stamped.pose.position.x = P.x() + VISUALIZATION_SHIFT_X;
+    pose_stamped.pose.position.y = P.y() + VISUALIZATION_SHIFT_Y;
+    pose_stamped.pose.position.z = P.z();
+    pose_stamped.pose.orientation.x = Q.x();
+    pose_stamped.pose.orientation.y = Q.y();
+    pose_stamped.pose.orientation.z = Q.z();
+    pose_stamped.pose.orientation.w = Q.w();
+    if (pub_pg_pose.getNumSubscribers())
+        pub_pg_pose.publish(pose_stamped);
+    if (SAVE_LOOP_PATH)
+    {
+        std::lock_guard<std::mutex> path_lock(m_path);
+        if (!loop_path_writer.isOpen())
+            loop_path_writer.open(VINS_RESULT_PATH, TrajectoryWriter::EUROC_CSV, false);
+        loop_path_writer.write(cur_kf->time_stamp, P, Q);
+    }
+
+    delete cur_kf;
+    evictKeyFrames();
 }
 
+void PoseGraph::queryMap(KeyFrame* keyframe, vector<int> &candidates)
+{
+    QueryResults ret;
+    BowVector bowvec;
+    db.transform(keyframe->brief_descriptors, bowvec);
+    db.query(bowvec, ret, max(4, LOOP_CANDIDATES));
+    for (unsigned int i = 0; i < ret.size() && (int)candidates.size() < max(LOOP_CANDIDATES, 1); i++)
+        if (ret[i].Score > 0.015)
+            candidates.push_back(ret[i].Id);
+}
 
-void PoseGraph::loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
+void PoseGraph::loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop, const BowVector *bowvec)
 {
     cur_kf->index = global_index;
     global_index++;
     int loop_index = -1;
+    vector<int> candidates;
     if (flag_detect_loop)
-       loop_index = detectLoop(cur_kf, cur_kf->index);
+       loop_index = detectLoop(cur_kf, cur_kf->index, candidates);
     else
     {
-        addKeyFrameIntoVoc(cur_kf);
+        addKeyFrameIntoVoc(cur_kf, bowvec);
     }
     if (loop_index != -1)
     {
-        printf(" %d detect loop with %d \n", cur_kf->index, loop_index);
+        VINS_INFO(" %d detect loop with %d \n", cur_kf->index, loop_index);
         KeyFrame* old_kf = getKeyFrame(loop_index);
+        restoreKeyFrame(old_kf);
         if (cur_kf->findConnection(old_kf))
         {
             if (earliest_loop_index > loop_index || earliest_loop_index == -1)
@@ -265,11 +411,27 @@ void PoseGraph::loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
             m_optimize_buf.unlock();
         }
     }
-    m_keyframelist.lock();
+    std::unique_lock<std::mutex> list_lock(m_keyframelist);
     Vector3d P;
     Matrix3d R;
     cur_kf->getPose(P, R);
     Quaterniond Q{R};
+    vector<Vector3d> edge_P;
+    if (SHOW_S_EDGE)
+    {
+        vector<KeyFrame*>::reverse_iterator rit = keyframelist.rbegin();
+        if (rit != keyframelist.rend() && (*rit)->sequence == cur_kf->sequence)
+        {
+            Vector3d conncected_P;
+            Matrix3d connected_R;
+            (*rit)->getPose(conncected_P, connected_R);
+            edge_P.push_back(conncected_P);
+        }
+    }
+    keyframelist.push_back(cur_kf);
+    std::unique_lock<std::mutex> path_lock(m_path);
+    list_lock.unlock();
+
     geometry_msgs::PoseStamped pose_stamped;
     pose_stamped.header.stamp = ros::Time(cur_kf->time_stamp);
     pose_stamped.header.frame_id = "world";
@@ -280,27 +442,13 @@ void PoseGraph::loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     pose_stamped.pose.orientation.y = Q.y();
     pose_stamped.pose.orientation.z = Q.z();
     pose_stamped.pose.orientation.w = Q.w();
-    base_path.poses.push_back(pose_stamped);
+    appendDecimated(base_path, base_path_index, pose_stamped, cur_kf->index, PATH_MAX_POSES);
     base_path.header = pose_stamped.header;
 
+    marker_start.push_back(posegraph_visualization->size());
     //draw local connection
-    if (SHOW_S_EDGE)
-    {
-        list<KeyFrame*>::reverse_iterator rit = keyframelist.rbegin();
-        for (int i = 0; i < 1; i++)
-        {
-            if (rit == keyframelist.rend())
-                break;
-            Vector3d conncected_P;
-            Matrix3d connected_R;
-            if((*rit)->sequence == cur_kf->sequence)
-            {
-                (*rit)->getPose(conncected_P, connected_R);
-                posegraph_visualization->add_edge(P, conncected_P);
-            }
-            rit++;
-        }
-    }
+    for (const Vector3d &conncected_P : edge_P)
+        posegraph_visualization->add_edge(P, conncected_P);
     /*
     if (cur_kf->has_loop)
     {
@@ -312,48 +460,50 @@ void PoseGraph::loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     }
     */
 
-    keyframelist.push_back(cur_kf);
     //publish();
-    m_keyframelist.unlock();
+    path_lock.unlock();
+    evictKeyFrames();
 }
 
 KeyFrame* PoseGraph::getKeyFrame(int index)
 {
 //    unique_lock<mutex> lock(m_keyframelist);
-    list<KeyFrame*>::iterator it = keyframelist.begin();
-    for (; it != keyframelist.end(); it++)   
-    {
-        if((*it)->index == index)
-            break;
-    }
-    if (it != keyframelist.end())
-        return *it;
+    if (index >= 0 && index < (int)keyframelist.size())
+        return keyframelist[index];
     else
         return NULL;
 }
 
-int PoseGraph::detectLoop(KeyFrame* keyframe, int frame_index)
+// Returns the earliest loop candidate, -1 if there is none. candidates gets up to LOOP_CANDIDATES
+// of them, best score first, for verifyCandidates.
+int PoseGraph::detectLoop(KeyFrame* keyframe, int frame_index, vector<int> &candidates)
 {
-    // put image into image_pool; for visualization
-    cv::Mat compressed_image;
-    if (DEBUG_IMAGE)
+    VINS_TRACE("detectLoop");
+    // small copies of the cached keyframe images for the loop result; for visualization
+    auto compressedImage = [&](int index)
     {
-        int feature_num = keyframe->keypoints.size();
-        cv::resize(keyframe->image, compressed_image, cv::Size(376, 240));
+        cv::Mat image, compressed_image;
+        KeyFrame* kf = getKeyFrame(index);
+        if (!keyframe_images.get(index, image))
+            image = cv::Mat(ROW, COL, CV_8UC1, cv::Scalar(0));
+        cv::resize(image, compressed_image, cv::Size(376, 240));
+        int feature_num = kf ? kf->keypointNum() : keyframe->keypointNum();
         putText(compressed_image, "feature_num:" + to_string(feature_num), cv::Point2f(10, 10), CV_FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(255));
-        image_pool[frame_index] = compressed_image;
-    }
+        return compressed_image;
+    };
+    cv::Mat compressed_image;
+    if (DEBUG_IMAGE)
+        compressed_image = compressedImage(frame_index);
     TicToc tmp_t;
-    //first query; then add this frame into database!
+    //first query; then add this frame into database! one vocabulary transform for both
     QueryResults ret;
     TicToc t_query;
-    db.query(keyframe->brief_descriptors, ret, 4, frame_index - 50);
-    //printf("query time: %f", t_query.toc());
+    BowVector bowvec;
+    db.transform(keyframe->brief_descriptors, bowvec);
+    db.query(bowvec, ret, max(4, LOOP_CANDIDATES), frame_index - 50);
+    db.add(frame_index, keyframe->sequence, bowvec);
+    //printf("query and add time: %f", t_query.toc());
     //cout << "Searching for Image " << frame_index << ". " << ret << endl;
-
-    TicToc t_add;
-    db.add(keyframe->brief_descriptors);
-    //printf("add feature time: %f", t_add.toc());
     // ret[0] is the nearest neighbour's score. threshold change with neighour score
     bool find_loop = false;
     cv::Mat loop_result;
@@ -369,8 +519,7 @@ int PoseGraph::detectLoop(KeyFrame* keyframe, int frame_index)
         for (unsigned int i = 0; i < ret.size(); i++)
         {
             int tmp_index = ret[i].Id;
-            auto it = image_pool.find(tmp_index);
-            cv::Mat tmp_image = (it->second).clone();
+            cv::Mat tmp_image = compressedImage(tmp_index);
             putText(tmp_image, "index:  " + to_string(tmp_index) + "loop score:" + to_string(ret[i].Score), cv::Point2f(10, 50), CV_FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(255));
             cv::hconcat(loop_result, tmp_image, loop_result);
         }
@@ -386,8 +535,7 @@ int PoseGraph::detectLoop(KeyFrame* keyframe, int frame_index)
                 int tmp_index = ret[i].Id;
                 if (DEBUG_IMAGE && 0)
                 {
-                    auto it = image_pool.find(tmp_index);
-                    cv::Mat tmp_image = (it->second).clone();
+                    cv::Mat tmp_image = compressedImage(tmp_index);
                     putText(tmp_image, "loop score:" + to_string(ret[i].Score), cv::Point2f(10, 50), CV_FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(255));
                     cv::hconcat(loop_result, tmp_image, loop_result);
                 }
@@ -408,6 +556,8 @@ int PoseGraph::detectLoop(KeyFrame* keyframe, int frame_index)
         {
             if (min_index == -1 || (ret[i].Id < min_index && ret[i].Score > 0.015))
                 min_index = ret[i].Id;
+            if (ret[i].Score > 0.015 && (int)candidates.size() < LOOP_CANDIDATES)
+                candidates.push_back(ret[i].Id);
         }
         return min_index;
     }
@@ -416,112 +566,224 @@ int PoseGraph::detectLoop(KeyFrame* keyframe, int frame_index)
 
 }
 
-void PoseGraph::addKeyFrameIntoVoc(KeyFrame* keyframe)
+// Geometric verification of several loop candidates at once, the loop goes to the one with the
+// most PnP inliers, the earliest one on a tie. Returns it, NULL when none of them passes.
+KeyFrame* PoseGraph::verifyCandidates(KeyFrame* cur_kf, const vector<int> &candidates)
 {
-    // put image into image_pool; for visualization
-    cv::Mat compressed_image;
-    if (DEBUG_IMAGE)
+    int n = candidates.size();
+    vector<KeyFrame*> old_kfs(n);
+    vector<Eigen::Matrix<double, 8, 1>, Eigen::aligned_allocator<Eigen::Matrix<double, 8, 1>>> loop_infos(n);
+    vector<std::future<int>> inliers;
+    for (int i = 0; i < n; i++)
     {
-        int feature_num = keyframe->keypoints.size();
-        cv::resize(keyframe->image, compressed_image, cv::Size(376, 240));
-        putText(compressed_image, "feature_num:" + to_string(feature_num), cv::Point2f(10, 10), CV_FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(255));
-        image_pool[keyframe->index] = compressed_image;
+        old_kfs[i] = getKeyFrame(candidates[i]);
+        restoreKeyFrame(old_kfs[i]);
+        inliers.push_back(std::async(std::launch::async, [&, i]() {
+            return old_kfs[i] ? cur_kf->verifyConnection(old_kfs[i], loop_infos[i]) : 0;
+        }));
+    }
+    int best = -1, best_inliers = 0;
+    for (int i = 0; i < n; i++)
+    {
+        int count = inliers[i].get();
+        if (count > best_inliers || (count > 0 && count == best_inliers && old_kfs[i]->index < old_kfs[best]->index))
+        {
+            best = i;
+            best_inliers = count;
+        }
     }
+    if (best == -1)
+        return NULL;
+    cur_kf->has_loop = true;
+    cur_kf->loop_index = old_kfs[best]->index;
+    cur_kf->loop_info = loop_infos[best];
+    return old_kfs[best];
+}
+
+void PoseGraph::addKeyFrameIntoVoc(KeyFrame* keyframe, const BowVector *bowvec)
+{
+    if (bowvec)
+    {
+        db.add(keyframe->index, keyframe->sequence, *bowvec);
+        return;
+    }
+    BowVector v;
+    db.transform(keyframe->brief_descriptors, v);
+    db.add(keyframe->index, keyframe->sequence, v);
+}
+
+void PoseGraphProblem::reset(ceres::LocalParameterization *_local_parameterization, int _first_index)
+{
+    keyframes.clear();
+    poses.clear();
+    problem.reset(new ceres::Problem());
+    loss_function = new ceres::HuberLoss(0.1);
+    //loss_function = new ceres::CauchyLoss(1.0);
+    local_parameterization = _local_parameterization;
+    first_index = _first_index;
+    last_index = _first_index - 1;
+    gps_loss_function = NULL;
+    gps_edges = 0;
+    has_alignment = false;
+}
 
-    db.add(keyframe->brief_descriptors);
+// Takes the latest request of optimize_buf, -1 if there is none. rebuild is set when the problem
+// cannot be extended: incremental solves are off, the fixed keyframe changed or a sequence was
+// shifted since the last solve.
+// Reads back the keypoints and descriptors of an old keyframe for loop matching, evictKeyFrames
+// moves them out again.
+void PoseGraph::restoreKeyFrame(KeyFrame* kf)
+{
+    if (!kf || !kf->isEvicted())
+        return;
+    if (kf->restore(descriptor_store))
+        restored_keyframes.push_back(kf->index);
+    else
+        printf("can not read back the descriptors of keyframe %d\n", kf->index);
+}
+
+// Keeps the keypoints and descriptors of the newest RESIDENT_KEYFRAMES keyframes in memory, the
+// next older one goes to descriptor_store with every keyframe added.
+void PoseGraph::evictKeyFrames()
+{
+    int first_resident = RESIDENT_KEYFRAMES > 0 ? (int)keyframelist.size() - RESIDENT_KEYFRAMES : 0;
+    for (int index : restored_keyframes)
+        if (index < first_resident)
+            keyframelist[index]->evict(descriptor_store);
+    restored_keyframes.clear();
+    if (first_resident > 0)
+        keyframelist[first_resident - 1]->evict(descriptor_store);
+}
+
+int PoseGraph::nextOptimization(int &first_looped_index, bool &rebuild)
+{
+    int cur_index = -1;
+    m_optimize_buf.lock();
+    while(!optimize_buf.empty())
+    {
+        cur_index = optimize_buf.front();
+        first_looped_index = earliest_loop_index;
+        optimize_buf.pop();
+    }
+    rebuild = !POSE_GRAPH_INCREMENTAL || shifted_since_solve || first_looped_index != graph.first_index;
+    if (cur_index != -1)
+        shifted_since_solve = false;
+    m_optimize_buf.unlock();
+    return cur_index;
+}
+
+// the drift of cur_kf, also applied to the keyframes added after it
+void PoseGraph::updateDrift(KeyFrame* cur_kf, bool yaw_only)
+{
+    Vector3d cur_t, vio_t;
+    Matrix3d cur_r, vio_r;
+    cur_kf->getPose(cur_t, cur_r);
+    cur_kf->getVioPose(vio_t, vio_r);
+    m_drift.lock();
+    if (yaw_only)
+    {
+        yaw_drift = Utility::R2ypr(cur_r).x() - Utility::R2ypr(vio_r).x();
+        r_drift = Utility::ypr2R(Vector3d(yaw_drift, 0, 0));
+    }
+    else
+        r_drift = cur_r * vio_r.transpose();
+    t_drift = cur_t - r_drift * vio_t;
+    m_drift.unlock();
+    //cout << "t_drift " << t_drift.transpose() << endl;
+    //cout << "r_drift " << Utility::R2ypr(r_drift).transpose() << endl;
+    //cout << "yaw drift " << yaw_drift << endl;
+
+    for (int i = cur_kf->index + 1; i < (int)keyframelist.size(); i++)
+    {
+        Vector3d P;
+        Matrix3d R;
+        keyframelist[i]->getVioPose(P, R);
+        P = r_drift * P + t_drift;
+        R = r_drift * R;
+        keyframelist[i]->updatePose(P, R);
+    }
 }
 
 void PoseGraph::optimize4DoF()
 {
     while(true)
     {
-        int cur_index = -1;
         int first_looped_index = -1;
-        m_optimize_buf.lock();
-        while(!optimize_buf.empty())
-        {
-            cur_index = optimize_buf.front();
-            first_looped_index = earliest_loop_index;
-            optimize_buf.pop();
-        }
-        m_optimize_buf.unlock();
+        bool rebuild;
+        int cur_index = nextOptimization(first_looped_index, rebuild);
         if (cur_index != -1)
         {
-            printf("optimize pose graph \n");
+            VINS_DEBUG("optimize pose graph \n");
             TicToc tmp_t;
             m_keyframelist.lock();
             KeyFrame* cur_kf = getKeyFrame(cur_index);
+            VINS_TRACE_FRAME("optimize4DoF", cur_kf->time_stamp);
 
-            int max_length = cur_index + 1;
-
-            // w^t_i   w^q_i
-            double t_array[max_length][3];
-            Quaterniond q_array[max_length];
-            double euler_array[max_length][3];
-            double sequence_array[max_length];
-
-            ceres::Problem problem;
             ceres::Solver::Options options;
             options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
             //options.minimizer_progress_to_stdout = true;
             //options.max_solver_time_in_seconds = SOLVER_TIME * 3;
             options.max_num_iterations = 5;
             ceres::Solver::Summary summary;
-            ceres::LossFunction *loss_function;
-            loss_function = new ceres::HuberLoss(0.1);
-            //loss_function = new ceres::CauchyLoss(1.0);
-            ceres::LocalParameterization* angle_local_parameterization =
-                AngleLocalParameterization::Create();
-
-            list<KeyFrame*>::iterator it;
-
-            int i = 0;
-            for (it = keyframelist.begin(); it != keyframelist.end(); it++)
+            if (rebuild)
+                graph.reset(AngleLocalParameterization::Create(), first_looped_index);
+            ceres::Problem &problem = *graph.problem;
+            // a new problem starts from the vio poses, keyframes appended later from their
+            // drift corrected poses, next to the last solution
+            bool from_vio = graph.keyframes.empty();
+
+            // only the keyframes the problem does not have yet
+            vector<KeyFrame*>::iterator it;
+            for (it = keyframelist.begin() + max(first_looped_index, graph.last_index + 1);
+                 it < keyframelist.begin() + cur_index + 1; it++)
             {
-                if ((*it)->index < first_looped_index)
-                    continue;
+                int i = graph.keyframes.size();
                 (*it)->local_index = i;
-                Quaterniond tmp_q;
-                Matrix3d tmp_r;
-                Vector3d tmp_t;
-                (*it)->getVioPose(tmp_t, tmp_r);
-                tmp_q = tmp_r;
-                t_array[i][0] = tmp_t(0);
-                t_array[i][1] = tmp_t(1);
-                t_array[i][2] = tmp_t(2);
-                q_array[i] = tmp_q;
-
-                Vector3d euler_angle = Utility::R2ypr(tmp_q.toRotationMatrix());
-                euler_array[i][0] = euler_angle.x();
-                euler_array[i][1] = euler_angle.y();
-                euler_array[i][2] = euler_angle.z();
-
-                sequence_array[i] = (*it)->sequence;
-
-                problem.AddParameterBlock(euler_array[i], 1, angle_local_parameterization);
-                problem.AddParameterBlock(t_array[i], 3);
+                graph.keyframes.push_back(*it);
+                Matrix3d tmp_r, vio_r;
+                Vector3d tmp_t, vio_t;
+                (*it)->getVioPose(vio_t, vio_r);
+                if (from_vio)
+                {
+                    tmp_t = vio_t;
+                    tmp_r = vio_r;
+                }
+                else
+                    (*it)->getPose(tmp_t, tmp_r);
+                Vector3d euler_angle = Utility::R2ypr(tmp_r);
+                graph.poses.push_back();
+                double *euler_i = graph.rotation(i);
+                double *t_i = graph.translation(i);
+                Eigen::Map<Vector3d>(euler_i) = euler_angle;
+                Eigen::Map<Vector3d>(t_i) = tmp_t;
+
+                problem.AddParameterBlock(euler_i, 1, graph.local_parameterization);
+                problem.AddParameterBlock(t_i, 3);
 
                 if ((*it)->index == first_looped_index || (*it)->sequence == 0)
                 {   
-                    problem.SetParameterBlockConstant(euler_array[i]);
-                    problem.SetParameterBlockConstant(t_array[i]);
+                    problem.SetParameterBlockConstant(euler_i);
+                    problem.SetParameterBlockConstant(t_i);
                 }
 
-                //add edge
+                //add edge, measured between the vio poses
+                double vio_yaw = Utility::R2ypr(vio_r).x();
                 for (int j = 1; j < 5; j++)
                 {
-                  if (i - j >= 0 && sequence_array[i] == sequence_array[i-j])
+                  if (i - j >= 0 && (*it)->sequence == graph.keyframes[i-j]->sequence)
                   {
-                    Vector3d euler_conncected = Utility::R2ypr(q_array[i-j].toRotationMatrix());
-                    Vector3d relative_t(t_array[i][0] - t_array[i-j][0], t_array[i][1] - t_array[i-j][1], t_array[i][2] - t_array[i-j][2]);
-                    relative_t = q_array[i-j].inverse() * relative_t;
-                    double relative_yaw = euler_array[i][0] - euler_array[i-j][0];
+                    Vector3d vio_t_j;
+                    Matrix3d vio_r_j;
+                    graph.keyframes[i-j]->getVioPose(vio_t_j, vio_r_j);
+                    Vector3d euler_conncected = Utility::R2ypr(vio_r_j);
+                    Vector3d relative_t = vio_r_j.transpose() * (vio_t - vio_t_j);
+                    double relative_yaw = vio_yaw - euler_conncected.x();
                     ceres::CostFunction* cost_function = FourDOFError::Create( relative_t.x(), relative_t.y(), relative_t.z(),
                                                    relative_yaw, euler_conncected.y(), euler_conncected.z());
-                    problem.AddResidualBlock(cost_function, NULL, euler_array[i-j], 
-                                            t_array[i-j], 
-                                            euler_array[i], 
-                                            t_array[i]);
+                    problem.AddResidualBlock(cost_function, NULL, graph.rotation(i-j), 
+                                            graph.translation(i-j), 
+                                            euler_i, 
+                                            t_i);
                   }
                 }
 
@@ -530,78 +792,53 @@ void PoseGraph::optimize4DoF()
                 if((*it)->has_loop)
                 {
                     assert((*it)->loop_index >= first_looped_index);
-                    int connected_index = getKeyFrame((*it)->loop_index)->local_index;
-                    Vector3d euler_conncected = Utility::R2ypr(q_array[connected_index].toRotationMatrix());
+                    KeyFrame* connected_kf = getKeyFrame((*it)->loop_index);
+                    int connected_index = connected_kf->local_index;
+                    Vector3d connected_t;
+                    Matrix3d connected_r;
+                    connected_kf->getVioPose(connected_t, connected_r);
+                    Vector3d euler_conncected = Utility::R2ypr(connected_r);
                     Vector3d relative_t;
                     relative_t = (*it)->getLoopRelativeT();
                     double relative_yaw = (*it)->getLoopRelativeYaw();
                     ceres::CostFunction* cost_function = FourDOFWeightError::Create( relative_t.x(), relative_t.y(), relative_t.z(),
                                                                                relative_yaw, euler_conncected.y(), euler_conncected.z());
-                    problem.AddResidualBlock(cost_function, loss_function, euler_array[connected_index], 
-                                                                  t_array[connected_index], 
-                                                                  euler_array[i], 
-                                                                  t_array[i]);
+                    problem.AddResidualBlock(cost_function, graph.loss_function, graph.rotation(connected_index), 
+                                                                  graph.translation(connected_index), 
+                                                                  euler_i, 
+                                                                  t_i);
                     
                 }
-                
-                if ((*it)->index == cur_index)
-                    break;
-                i++;
+                graph.last_index = (*it)->index;
             }
+            if (GPS_FUSION)
+                addGPSEdges(cur_index);
             m_keyframelist.unlock();
 
             ceres::Solve(options, &problem, &summary);
             //std::cout << summary.BriefReport() << "\n";
             
             //printf("pose optimization time: %f \n", tmp_t.toc());
-            /*
-            for (int j = 0 ; j < i; j++)
-            {
-                printf("optimize i: %d p: %f, %f, %f\n", j, t_array[j][0], t_array[j][1], t_array[j][2] );
-            }
-            */
             m_keyframelist.lock();
-            i = 0;
-            for (it = keyframelist.begin(); it != keyframelist.end(); it++)
+            if (graph.has_alignment)
             {
-                if ((*it)->index < first_looped_index)
-                    continue;
-                Quaterniond tmp_q;
-                tmp_q = Utility::ypr2R(Vector3d(euler_array[i][0], euler_array[i][1], euler_array[i][2]));
-                Vector3d tmp_t = Vector3d(t_array[i][0], t_array[i][1], t_array[i][2]);
-                Matrix3d tmp_r = tmp_q.toRotationMatrix();
-                (*it)-> updatePose(tmp_t, tmp_r);
-
-                if ((*it)->index == cur_index)
-                    break;
-                i++;
+                m_drift.lock();
+                gps_aligned = true;
+                w_r_enu = Utility::ypr2R(Vector3d(gps_yaw[0], 0, 0));
+                w_t_enu = Vector3d(gps_t[0], gps_t[1], gps_t[2]);
+                m_drift.unlock();
             }
-
-            Vector3d cur_t, vio_t;
-            Matrix3d cur_r, vio_r;
-            cur_kf->getPose(cur_t, cur_r);
-            cur_kf->getVioPose(vio_t, vio_r);
-            m_drift.lock();
-            yaw_drift = Utility::R2ypr(cur_r).x() - Utility::R2ypr(vio_r).x();
-            r_drift = Utility::ypr2R(Vector3d(yaw_drift, 0, 0));
-            t_drift = cur_t - r_drift * vio_t;
-            m_drift.unlock();
-            //cout << "t_drift " << t_drift.transpose() << endl;
-            //cout << "r_drift " << Utility::R2ypr(r_drift).transpose() << endl;
-            //cout << "yaw drift " << yaw_drift << endl;
-
-            it++;
-            for (; it != keyframelist.end(); it++)
+            for (int i = 0; i < (int)graph.keyframes.size(); i++)
             {
-                Vector3d P;
-                Matrix3d R;
-                (*it)->getVioPose(P, R);
-                P = r_drift * P + t_drift;
-                R = r_drift * R;
-                (*it)->updatePose(P, R);
+                const double *euler = graph.rotation(i);
+                const double *t = graph.translation(i);
+                Matrix3d tmp_r = Utility::ypr2R(Vector3d(euler[0], euler[1], euler[2]));
+                graph.keyframes[i]->updatePose(Vector3d(t[0], t[1], t[2]), tmp_r);
             }
+            updateDrift(cur_kf, true);
             m_keyframelist.unlock();
-            updatePath();
+            publishCorrection();
+            updatePath(graph.first_index);
         }
 
         std::chrono::milliseconds dura(2000);
@@ -610,93 +847,85 @@ void PoseGraph::optimize4DoF()
     return;
 }
 
-
 void PoseGraph::optimize6DoF()
 {
     while(true)
     {
-        int cur_index = -1;
         int first_looped_index = -1;
-        m_optimize_buf.lock();
-        while(!optimize_buf.empty())
-        {
-            cur_index = optimize_buf.front();
-            first_looped_index = earliest_loop_index;
-            optimize_buf.pop();
-        }
-        m_optimize_buf.unlock();
+        bool rebuild;
+        int cur_index = nextOptimization(first_looped_index, rebuild);
         if (cur_index != -1)
         {
-            printf("optimize pose graph \n");
+            VINS_DEBUG("optimize pose graph \n");
             TicToc tmp_t;
             m_keyframelist.lock();
             KeyFrame* cur_kf = getKeyFrame(cur_index);
+            VINS_TRACE_FRAME("optimize6DoF", cur_kf->time_stamp);
 
-            int max_length = cur_index + 1;
-
-            // w^t_i   w^q_i
-            double t_array[max_length][3];
-            double q_array[max_length][4];
-            double sequence_array[max_length];
-
-            ceres::Problem problem;
             ceres::Solver::Options options;
             options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
             //ptions.minimizer_progress_to_stdout = true;
             //options.max_solver_time_in_seconds = SOLVER_TIME * 3;
             options.max_num_iterations = 5;
             ceres::Solver::Summary summary;
-            ceres::LossFunction *loss_function;
-            loss_function = new ceres::HuberLoss(0.1);
-            //loss_function = new ceres::CauchyLoss(1.0);
-            ceres::LocalParameterization* local_parameterization = new ceres::QuaternionParameterization();
-
-            list<KeyFrame*>::iterator it;
-
-            int i = 0;
-            for (it = keyframelist.begin(); it != keyframelist.end(); it++)
+            if (rebuild)
+                graph.reset(new QuaternionRightParameterization(), first_looped_index);
+            ceres::Problem &problem = *graph.problem;
+            bool from_vio = graph.keyframes.empty();
+
+            // only the keyframes the problem does not have yet
+            vector<KeyFrame*>::iterator it;
+            for (it = keyframelist.begin() + max(first_looped_index, graph.last_index + 1);
+                 it < keyframelist.begin() + cur_index + 1; it++)
             {
-                if ((*it)->index < first_looped_index)
-                    continue;
+                int i = graph.keyframes.size();
                 (*it)->local_index = i;
-                Quaterniond tmp_q;
-                Matrix3d tmp_r;
-                Vector3d tmp_t;
-                (*it)->getVioPose(tmp_t, tmp_r);
-                tmp_q = tmp_r;
-                t_array[i][0] = tmp_t(0);
-                t_array[i][1] = tmp_t(1);
-                t_array[i][2] = tmp_t(2);
-                q_array[i][0] = tmp_q.w();
-                q_array[i][1] = tmp_q.x();
-                q_array[i][2] = tmp_q.y();
-                q_array[i][3] = tmp_q.z();
-
-                sequence_array[i] = (*it)->sequence;
-
-                problem.AddParameterBlock(q_array[i], 4, local_parameterization);
-                problem.AddParameterBlock(t_array[i], 3);
+                graph.keyframes.push_back(*it);
+                Matrix3d tmp_r, vio_r;
+                Vector3d tmp_t, vio_t;
+                (*it)->getVioPose(vio_t, vio_r);
+                if (from_vio)
+                {
+                    tmp_t = vio_t;
+                    tmp_r = vio_r;
+                }
+                else
+                    (*it)->getPose(tmp_t, tmp_r);
+                Quaterniond tmp_q(tmp_r);
+                graph.poses.push_back();
+                double *q_i = graph.rotation(i);
+                double *t_i = graph.translation(i);
+                q_i[0] = tmp_q.w();
+                q_i[1] = tmp_q.x();
+                q_i[2] = tmp_q.y();
+                q_i[3] = tmp_q.z();
+                Eigen::Map<Vector3d>(t_i) = tmp_t;
+
+                problem.AddParameterBlock(q_i, 4, graph.local_parameterization);
+                problem.AddParameterBlock(t_i, 3);
 
                 if ((*it)->index == first_looped_index || (*it)->sequence == 0)
                 {   
-                    problem.SetParameterBlockConstant(q_array[i]);
-                    problem.SetParameterBlockConstant(t_array[i]);
+                    problem.SetParameterBlockConstant(q_i);
+                    problem.SetParameterBlockConstant(t_i);
                 }
 
-                //add edge
+                //add edge, measured between the vio poses
+                Quaterniond vio_q(vio_r);
                 for (int j = 1; j < 5; j++)
                 {
-                    if (i - j >= 0 && sequence_array[i] == sequence_array[i-j])
+                    if (i - j >= 0 && (*it)->sequence == graph.keyframes[i-j]->sequence)
                     {
-                        Vector3d relative_t(t_array[i][0] - t_array[i-j][0], t_array[i][1] - t_array[i-j][1], t_array[i][2] - t_array[i-j][2]);
-                        Quaterniond q_i_j = Quaterniond(q_array[i-j][0], q_array[i-j][1], q_array[i-j][2], q_array[i-j][3]);
-                        Quaterniond q_i = Quaterniond(q_array[i][0], q_array[i][1], q_array[i][2], q_array[i][3]);
-                        relative_t = q_i_j.inverse() * relative_t;
-                        Quaterniond relative_q = q_i_j.inverse() * q_i;
+                        Vector3d vio_t_j;
+                        Matrix3d vio_r_j;
+                        graph.keyframes[i-j]->getVioPose(vio_t_j, vio_r_j);
+                        Quaterniond q_i_j(vio_r_j);
+                        Vector3d relative_t = q_i_j.inverse() * (vio_t - vio_t_j);
+                        Quaterniond relative_q = q_i_j.inverse() * vio_q;
                         ceres::CostFunction* vo_function = RelativeRTError::Create(relative_t.x(), relative_t.y(), relative_t.z(),
                                                                                 relative_q.w(), relative_q.x(), relative_q.y(), relative_q.z(),
                                                                                 0.1, 0.01);
-                        problem.AddResidualBlock(vo_function, NULL, q_array[i-j], t_array[i-j], q_array[i], t_array[i]);
+                        problem.AddResidualBlock(vo_function, NULL, graph.rotation(i-j), graph.translation(i-j), q_i, t_i);
                     }
                 }
 
@@ -713,12 +942,10 @@ void PoseGraph::optimize6DoF()
                     ceres::CostFunction* loop_function = RelativeRTError::Create(relative_t.x(), relative_t.y(), relative_t.z(),
                                                                                 relative_q.w(), relative_q.x(), relative_q.y(), relative_q.z(),
                                                                                 0.1, 0.01);
-                    problem.AddResidualBlock(loop_function, loss_function, q_array[connected_index], t_array[connected_index], q_array[i], t_array[i]);                    
+                    problem.AddResidualBlock(loop_function, graph.loss_function, graph.rotation(connected_index),
+                                             graph.translation(connected_index), q_i, t_i);                    
                 }
-                
-                if ((*it)->index == cur_index)
-                    break;
-                i++;
+                graph.last_index = (*it)->index;
             }
             m_keyframelist.unlock();
 
@@ -726,51 +953,18 @@ void PoseGraph::optimize6DoF()
             //std::cout << summary.BriefReport() << "\n";
             
             //printf("pose optimization time: %f \n", tmp_t.toc());
-            /*
-            for (int j = 0 ; j < i; j++)
-            {
-                printf("optimize i: %d p: %f, %f, %f\n", j, t_array[j][0], t_array[j][1], t_array[j][2] );
-            }
-            */
             m_keyframelist.lock();
-            i = 0;
-            for (it = keyframelist.begin(); it != keyframelist.end(); it++)
-            {
-                if ((*it)->index < first_looped_index)
-                    continue;
-                Quaterniond tmp_q(q_array[i][0], q_array[i][1], q_array[i][2], q_array[i][3]);
-                Vector3d tmp_t = Vector3d(t_array[i][0], t_array[i][1], t_array[i][2]);
-                Matrix3d tmp_r = tmp_q.toRotationMatrix();
-                (*it)-> updatePose(tmp_t, tmp_r);
-
-                if ((*it)->index == cur_index)
-                    break;
-                i++;
-            }
-
-            Vector3d cur_t, vio_t;
-            Matrix3d cur_r, vio_r;
-            cur_kf->getPose(cur_t, cur_r);
-            cur_kf->getVioPose(vio_t, vio_r);
-            m_drift.lock();
-            r_drift = cur_r * vio_r.transpose();
-            t_drift = cur_t - r_drift * vio_t;
-            m_drift.unlock();
-            //cout << "t_drift " << t_drift.transpose() << endl;
-            //cout << "r_drift " << Utility::R2ypr(r_drift).transpose() << endl;
-
-            it++;
-            for (; it != keyframelist.end(); it++)
+            for (int i = 0; i < (int)graph.keyframes.size(); i++)
             {
-                Vector3d P;
-                Matrix3d R;
-                (*it)->getVioPose(P, R);
-                P = r_drift * P + t_drift;
-                R = r_drift * R;
-                (*it)->updatePose(P, R);
+                const double *q = graph.rotation(i);
+                const double *t = graph.translation(i);
+                Matrix3d tmp_r = Quaterniond(q[0], q[1], q[2], q[3]).toRotationMatrix();
+                graph.keyframes[i]->updatePose(Vector3d(t[0], t[1], t[2]), tmp_r);
             }
+            updateDrift(cur_kf, false);
             m_keyframelist.unlock();
-            updatePath();
+            publishCorrection();
+            updatePath(graph.first_index);
         }
 
         std::chrono::milliseconds dura(2000);
@@ -779,34 +973,235 @@ void PoseGraph::optimize6DoF()
     return;
 }
 
-void PoseGraph::updatePath()
+void PoseGraph::getDrift(Matrix3d &_r_drift, Vector3d &_t_drift, Matrix3d &_w_r_vio, Vector3d &_w_t_vio)
 {
-    m_keyframelist.lock();
-    list<KeyFrame*>::iterator it;
-    for (int i = 1; i <= sequence_cnt; i++)
+    m_drift.lock();
+    _r_drift = r_drift;
+    _t_drift = t_drift;
+    _w_r_vio = w_r_vio;
+    _w_t_vio = w_t_vio;
+    m_drift.unlock();
+}
+
+void PoseGraph::addGPS(double t, const Vector3d &enu_p, double accuracy)
+{
+    GPSFix fix;
+    fix.p = enu_p;
+    // fixes without a covariance count as a meter
+    fix.accuracy = accuracy > 0 ? accuracy : 1;
+    m_gps.lock();
+    gps_buf[t] = fix;
+    m_gps.unlock();
+}
+
+bool PoseGraph::getGPSAlignment(Matrix3d &enu_r_w, Vector3d &enu_t_w)
+{
+    m_drift.lock();
+    enu_r_w = w_r_enu.transpose();
+    enu_t_w = -enu_r_w * w_t_enu;
+    bool aligned = gps_aligned;
+    m_drift.unlock();
+    return aligned;
+}
+
+// Pairs the fixes up to cur_kf, the last keyframe of the locked list, with the two keyframes of
+// its sequence around them, true when any was. Fixes before the sequence's first keyframe, or in
+// a sequence not shifted into the world frame yet, are dropped.
+bool PoseGraph::attachGPS(KeyFrame* cur_kf)
+{
+    bool attached = false;
+    bool in_world = cur_kf->sequence == base_sequence || sequence_loop[cur_kf->sequence];
+    m_gps.lock();
+    map<double, GPSFix>::iterator it = gps_buf.begin();
+    while (it != gps_buf.end() && it->first <= cur_kf->time_stamp)
     {
-        path[i].poses.clear();
+        // fixes come in shortly after their time, the keyframes around them are the last ones
+        int j = keyframelist.size() - 1;
+        while (j > 0 && keyframelist[j - 1]->sequence == cur_kf->sequence && keyframelist[j - 1]->time_stamp >= it->first)
+            j--;
+        if (in_world && j > 0 && keyframelist[j - 1]->sequence == cur_kf->sequence)
+        {
+            KeyFrame* kf_i = keyframelist[j - 1];
+            KeyFrame* kf_j = keyframelist[j];
+            GPSEdge edge;
+            edge.index_i = kf_i->index;
+            edge.index_j = kf_j->index;
+            edge.ratio = (it->first - kf_i->time_stamp) / (kf_j->time_stamp - kf_i->time_stamp);
+            edge.p = it->second.p;
+            edge.accuracy = it->second.accuracy;
+            gps_edges.push_back(edge);
+            attached = true;
+        }
+        it = gps_buf.erase(it);
     }
-    base_path.poses.clear();
-    posegraph_visualization->reset();
+    m_gps.unlock();
+    return attached;
+}
 
-    if (SAVE_LOOP_PATH)
+// First guess of the alignment from the paired fixes and the keyframe positions, with the list
+// and m_gps locked: the yaw and translation fitting them best, once the fixes span
+// GPS_ALIGN_DISTANCE horizontally. Before that a wrong yaw would be hard to solve out of.
+bool PoseGraph::alignGPS()
+{
+    if (gps_edges.empty())
+        return false;
+    double spread = 0;
+    for (const GPSEdge &edge : gps_edges)
+        spread = max(spread, (edge.p - gps_edges[0].p).head<2>().norm());
+    if (spread < GPS_ALIGN_DISTANCE)
+        return false;
+
+    vector<Vector3d> w_p;
+    Vector3d w_mean = Vector3d::Zero(), enu_mean = Vector3d::Zero();
+    for (const GPSEdge &edge : gps_edges)
     {
-        ofstream loop_path_file_tmp(VINS_RESULT_PATH, ios::out);
-        loop_path_file_tmp.close();
+        Vector3d t_i, t_j;
+        Matrix3d r;
+        keyframelist[edge.index_i]->getPose(t_i, r);
+        keyframelist[edge.index_j]->getPose(t_j, r);
+        w_p.push_back(t_i + edge.ratio * (t_j - t_i));
+        w_mean += w_p.back();
+        enu_mean += edge.p;
     }
+    w_mean /= gps_edges.size();
+    enu_mean /= gps_edges.size();
+    double c = 0, s = 0;
+    for (size_t k = 0; k < gps_edges.size(); k++)
+    {
+        Vector3d a = gps_edges[k].p - enu_mean;
+        Vector3d b = w_p[k] - w_mean;
+        c += a.x() * b.x() + a.y() * b.y();
+        s += a.x() * b.y() - a.y() * b.x();
+    }
+    gps_yaw[0] = atan2(s, c) * 180.0 / M_PI;
+    Eigen::Map<Vector3d>(gps_t) = w_mean - Utility::ypr2R(Vector3d(gps_yaw[0], 0, 0)) * enu_mean;
+    gps_initialized = true;
+    return true;
+}
 
-    for (it = keyframelist.begin(); it != keyframelist.end(); it++)
+// The alignment and the gps edges up to cur_index the problem does not have yet, with the list
+// locked and the keyframes up to cur_index appended.
+void PoseGraph::addGPSEdges(int cur_index)
+{
+    m_gps.lock();
+    if (!gps_initialized && !alignGPS())
     {
-        Vector3d P;
+        m_gps.unlock();
+        return;
+    }
+    ceres::Problem &problem = *graph.problem;
+    if (!graph.has_alignment)
+    {
+        graph.gps_loss_function = new ceres::HuberLoss(1.0);
+        problem.AddParameterBlock(gps_yaw, 1, graph.local_parameterization);
+        problem.AddParameterBlock(gps_t, 3);
+        graph.has_alignment = true;
+    }
+    // in the order addKeyFrame paired them, the ones after the first of a later keyframe wait
+    for (; graph.gps_edges < gps_edges.size() && gps_edges[graph.gps_edges].index_j <= cur_index; graph.gps_edges++)
+    {
+        const GPSEdge &edge = gps_edges[graph.gps_edges];
+        if (edge.index_i < graph.first_index)
+            continue;
+        ceres::CostFunction* gps_function = GPSError::Create(edge.p.x(), edge.p.y(), edge.p.z(), edge.accuracy, edge.ratio);
+        problem.AddResidualBlock(gps_function, graph.gps_loss_function,
+                                 graph.translation(getKeyFrame(edge.index_i)->local_index),
+                                 graph.translation(getKeyFrame(edge.index_j)->local_index), gps_yaw, gps_t);
+    }
+    m_gps.unlock();
+}
+
+void PoseGraph::publishCorrection()
+{
+    m_drift.lock();
+    Matrix3d R = r_drift * w_r_vio;
+    Vector3d T = r_drift * w_t_vio + t_drift;
+    if (gps_aligned)
+    {
+        T = w_r_enu.transpose() * (T - w_t_enu);
+        R = w_r_enu.transpose() * R;
+    }
+    m_drift.unlock();
+    Quaterniond Q(R);
+    nav_msgs::Odometry correction;
+    correction.header.stamp = ros::Time::now();
+    correction.header.frame_id = "world";
+    correction.pose.pose.position.x = T.x();
+    correction.pose.pose.position.y = T.y();
+    correction.pose.pose.position.z = T.z();
+    correction.pose.pose.orientation.x = Q.x();
+    correction.pose.pose.orientation.y = Q.y();
+    correction.pose.pose.orientation.z = Q.z();
+    correction.pose.pose.orientation.w = Q.w();
+    pub_correction.publish(correction);
+}
+
+void PoseGraph::updatePath(int first_index)
+{
+    // only the keyframes from first_index on moved, their path poses, edges and loop file rows are
+    // cut off and added again. The poses are copied out with the list locked and the rest runs
+    // from the copy under m_path, so addKeyFrame only waits for the copy.
+    struct PathPose
+    {
+        int index;
+        double time_stamp;
+        int sequence;
+        bool loop_edge;
+        Vector3d P, loop_P;
         Matrix3d R;
-        (*it)->getPose(P, R);
+    };
+    // the loop file gets every pose once if it does not start with the first keyframe
+    if (first_index < 0 || (SAVE_LOOP_PATH && loop_path_first != 0))
+        first_index = 0;
+    vector<PathPose> poses;
+    std::unique_lock<std::mutex> list_lock(m_keyframelist);
+    // and the four keyframes before for the local edges
+    int copy_from = max(0, first_index - 4);
+    poses.reserve(max(0, (int)keyframelist.size() - copy_from));
+    for (int i = copy_from; i < (int)keyframelist.size(); i++)
+    {
+        KeyFrame* kf = keyframelist[i];
+        PathPose pose;
+        pose.index = kf->index;
+        pose.time_stamp = kf->time_stamp;
+        pose.sequence = kf->sequence;
+        kf->getPose(pose.P, pose.R);
+        pose.loop_edge = SHOW_L_EDGE && kf->has_loop && kf->sequence == sequence_cnt && kf->sequence > 0;
+        if (pose.loop_edge)
+        {
+            Matrix3d connected_R;
+            getKeyFrame(kf->loop_index)->getPose(pose.loop_P, connected_R);
+        }
+        poses.push_back(pose);
+    }
+    std::unique_lock<std::mutex> path_lock(m_path);
+    list_lock.unlock();
+
+    for (int i = 1; i <= sequence_cnt; i++)
+    {
+        truncatePath(path[i], path_index[i], first_index);
+    }
+    truncatePath(base_path, base_path_index, first_index);
+    if (first_index < (int)marker_start.size())
+    {
+        posegraph_visualization->truncate(marker_start[first_index]);
+        marker_start.resize(first_index);
+    }
+
+    vector<TrajectoryPose> loop_poses;
+
+    for (int j = 0; j < (int)poses.size(); j++)
+    {
+        const PathPose &pose = poses[j];
+        if (pose.index < first_index)
+            continue;
+        const Vector3d &P = pose.P;
         Quaterniond Q;
-        Q = R;
+        Q = pose.R;
 //        printf("path p: %f, %f, %f\n",  P.x(),  P.z(),  P.y() );
 
         geometry_msgs::PoseStamped pose_stamped;
-        pose_stamped.header.stamp = ros::Time((*it)->time_stamp);
+        pose_stamped.header.stamp = ros::Time(pose.time_stamp);
         pose_stamped.header.frame_id = "world";
         pose_stamped.pose.position.x = P.x() + VISUALIZATION_SHIFT_X;
         pose_stamped.pose.position.y = P.y() + VISUALIZATION_SHIFT_Y;
@@ -815,83 +1210,42 @@ void PoseGraph::updatePath()
         pose_stamped.pose.orientation.y = Q.y();
         pose_stamped.pose.orientation.z = Q.z();
         pose_stamped.pose.orientation.w = Q.w();
-        if((*it)->sequence == 0)
+        if(pose.sequence == 0)
         {
-            base_path.poses.push_back(pose_stamped);
+            appendDecimated(base_path, base_path_index, pose_stamped, pose.index, PATH_MAX_POSES);
             base_path.header = pose_stamped.header;
         }
         else
         {
-            path[(*it)->sequence].poses.push_back(pose_stamped);
-            path[(*it)->sequence].header = pose_stamped.header;
+            appendDecimated(path[pose.sequence], path_index[pose.sequence], pose_stamped, pose.index, PATH_MAX_POSES);
+            path[pose.sequence].header = pose_stamped.header;
         }
 
         if (SAVE_LOOP_PATH)
-        {
-            ofstream loop_path_file(VINS_RESULT_PATH, ios::app);
-            loop_path_file.setf(ios::fixed, ios::floatfield);
-            loop_path_file.precision(0);
-            loop_path_file << (*it)->time_stamp * 1e9 << ",";
-            loop_path_file.precision(5);
-            loop_path_file  << P.x() << ","
-                  << P.y() << ","
-                  << P.z() << ","
-                  << Q.w() << ","
-                  << Q.x() << ","
-                  << Q.y() << ","
-                  << Q.z() << ","
-                  << endl;
-            loop_path_file.close();
-        }
-        //draw local connection
+            loop_poses.push_back(TrajectoryPose(pose.time_stamp, P, Q));
+        marker_start.push_back(posegraph_visualization->size());
+        //draw local connection to the four keyframes before
         if (SHOW_S_EDGE)
         {
-            list<KeyFrame*>::reverse_iterator rit = keyframelist.rbegin();
-            list<KeyFrame*>::reverse_iterator lrit;
-            for (; rit != keyframelist.rend(); rit++)  
-            {  
-                if ((*rit)->index == (*it)->index)
-                {
-                    lrit = rit;
-                    lrit++;
-                    for (int i = 0; i < 4; i++)
-                    {
-                        if (lrit == keyframelist.rend())
-                            break;
-                        if((*lrit)->sequence == (*it)->sequence)
-                        {
-                            Vector3d conncected_P;
-                            Matrix3d connected_R;
-                            (*lrit)->getPose(conncected_P, connected_R);
-                            posegraph_visualization->add_edge(P, conncected_P);
-                        }
-                        lrit++;
-                    }
-                    break;
-                }
-            } 
-        }
-        if (SHOW_L_EDGE)
-        {
-            if ((*it)->has_loop && (*it)->sequence == sequence_cnt)
+            for (int k = j - 1; k >= 0 && k >= j - 4; k--)
             {
-                
-                KeyFrame* connected_KF = getKeyFrame((*it)->loop_index);
-                Vector3d connected_P;
-                Matrix3d connected_R;
-                connected_KF->getPose(connected_P, connected_R);
-                //(*it)->getVioPose(P, R);
-                (*it)->getPose(P, R);
-                if((*it)->sequence > 0)
-                {
-                    posegraph_visualization->add_loopedge(P, connected_P + Vector3d(VISUALIZATION_SHIFT_X, VISUALIZATION_SHIFT_Y, 0));
-                }
+                if(poses[k].sequence == pose.sequence)
+                    posegraph_visualization->add_edge(P, poses[k].P);
             }
         }
+        if (pose.loop_edge)
+            posegraph_visualization->add_loopedge(P, pose.loop_P + Vector3d(VISUALIZATION_SHIFT_X, VISUALIZATION_SHIFT_Y, 0));
 
     }
+    if (SAVE_LOOP_PATH)
+    {
+        // the writer thread cuts the file at the first moved row and appends the rest
+        if (!loop_path_writer.isOpen())
+            loop_path_writer.open(VINS_RESULT_PATH, TrajectoryWriter::EUROC_CSV, false);
+        loop_path_writer.rewrite(loop_poses, first_index);
+        loop_path_first = 0;
+    }
     publish();
-    m_keyframelist.unlock();
 }
 
 
@@ -899,58 +1253,219 @@ void PoseGraph::savePoseGraph()
 {
     m_keyframelist.lock();
     TicToc tmp_t;
-    FILE *pFile;
     printf("pose graph path: %s\n",POSE_GRAPH_SAVE_PATH.c_str());
     printf("pose graph saving... \n");
-    string file_path = POSE_GRAPH_SAVE_PATH + "pose_graph.txt";
-    pFile = fopen (file_path.c_str(),"w");
-    //fprintf(pFile, "index time_stamp Tx Ty Tz Qw Qx Qy Qz loop_index loop_info\n");
-    list<KeyFrame*>::iterator it;
-    for (it = keyframelist.begin(); it != keyframelist.end(); it++)
+    static_assert(sizeof(BRIEF::bitset) == sizeof(PoseGraphMap::DescriptorRecord), "descriptors are written as they are");
+    // entry i of the database is keyframe i
+    vector<BowVector> bow_vectors;
+    db.getBowVectors(bow_vectors);
+    uint64_t keypoint_num = 0, word_num = 0;
+    for (int i = 0; i < (int)keyframelist.size(); i++)
     {
-        std::string image_path, descriptor_path, brief_path, keypoints_path;
-        if (DEBUG_IMAGE)
+        keypoint_num += keyframelist[i]->keypointNum();
+        if (i < (int)bow_vectors.size())
+            word_num += bow_vectors[i].size();
+    }
+    PoseGraphMap::Header header = PoseGraphMap::layout(keyframelist.size(), keypoint_num, word_num);
+
+    // written next to the old map and renamed at the end, an interrupted save keeps the old one
+    string file_path = POSE_GRAPH_SAVE_PATH + "pose_graph.bin";
+    string tmp_path = file_path + ".tmp";
+    FILE *pFile = fopen(tmp_path.c_str(), "wb");
+    if (pFile == NULL)
+    {
+        printf("can not create %s\n", tmp_path.c_str());
+        m_keyframelist.unlock();
+        return;
+    }
+    vector<char> zeros(64, 0);
+    // pads to the next section offset
+    auto seek = [&](uint64_t offset)
+    {
+        long pos = ftell(pFile);
+        if (pos < (long)offset)
+            fwrite(zeros.data(), 1, offset - pos, pFile);
+    };
+    fwrite(&header, sizeof(header), 1, pFile);
+
+    seek(header.keyframe_offset);
+    uint64_t first_keypoint = 0, first_word = 0;
+    for (int i = 0; i < (int)keyframelist.size(); i++)
+    {
+        KeyFrame* kf = keyframelist[i];
+        // only the images still in the cache are saved
+        cv::Mat image;
+        if (DEBUG_IMAGE && keyframe_images.get(kf->index, image))
         {
-            image_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index) + "_image.png";
-            imwrite(image_path.c_str(), (*it)->image);
+            string image_path = POSE_GRAPH_SAVE_PATH + to_string(kf->index) + "_image.png";
+            imwrite(image_path.c_str(), image);
         }
-        Quaterniond VIO_tmp_Q{(*it)->vio_R_w_i};
-        Quaterniond PG_tmp_Q{(*it)->R_w_i};
-        Vector3d VIO_tmp_T = (*it)->vio_T_w_i;
-        Vector3d PG_tmp_T = (*it)->T_w_i;
-
-        fprintf (pFile, " %d %f %f %f %f %f %f %f %f %f %f %f %f %f %f %f %d %f %f %f %f %f %f %f %f %d\n",(*it)->index, (*it)->time_stamp, 
-                                    VIO_tmp_T.x(), VIO_tmp_T.y(), VIO_tmp_T.z(), 
-                                    PG_tmp_T.x(), PG_tmp_T.y(), PG_tmp_T.z(), 
-                                    VIO_tmp_Q.w(), VIO_tmp_Q.x(), VIO_tmp_Q.y(), VIO_tmp_Q.z(), 
-                                    PG_tmp_Q.w(), PG_tmp_Q.x(), PG_tmp_Q.y(), PG_tmp_Q.z(), 
-                                    (*it)->loop_index, 
-                                    (*it)->loop_info(0), (*it)->loop_info(1), (*it)->loop_info(2), (*it)->loop_info(3),
-                                    (*it)->loop_info(4), (*it)->loop_info(5), (*it)->loop_info(6), (*it)->loop_info(7),
-                                    (int)(*it)->keypoints.size());
-
-        // write keypoints, brief_descriptors   vector<cv::KeyPoint> keypoints vector<BRIEF::bitset> brief_descriptors;
-        assert((*it)->keypoints.size() == (*it)->brief_descriptors.size());
-        brief_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index) + "_briefdes.dat";
-        std::ofstream brief_file(brief_path, std::ios::binary);
-        keypoints_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index) + "_keypoints.txt";
-        FILE *keypoints_file;
-        keypoints_file = fopen(keypoints_path.c_str(), "w");
-        for (int i = 0; i < (int)(*it)->keypoints.size(); i++)
+        assert(kf->keypoints.size() == kf->brief_descriptors.size());
+        PoseGraphMap::KeyFrameRecord record;
+        memset(&record, 0, sizeof(record));
+        record.index = kf->index;
+        record.loop_index = kf->loop_index;
+        record.time_stamp = kf->time_stamp;
+        Quaterniond VIO_tmp_Q{kf->vio_R_w_i};
+        Quaterniond PG_tmp_Q{kf->R_w_i};
+        for (int k = 0; k < 3; k++)
         {
-            brief_file << (*it)->brief_descriptors[i] << endl;
-            fprintf(keypoints_file, "%f %f %f %f\n", (*it)->keypoints[i].pt.x, (*it)->keypoints[i].pt.y, 
-                                                     (*it)->keypoints_norm[i].pt.x, (*it)->keypoints_norm[i].pt.y);
+            record.vio_t[k] = kf->vio_T_w_i(k);
+            record.pg_t[k] = kf->T_w_i(k);
         }
-        brief_file.close();
-        fclose(keypoints_file);
+        record.vio_q[0] = VIO_tmp_Q.w(); record.vio_q[1] = VIO_tmp_Q.x(); record.vio_q[2] = VIO_tmp_Q.y(); record.vio_q[3] = VIO_tmp_Q.z();
+        record.pg_q[0] = PG_tmp_Q.w(); record.pg_q[1] = PG_tmp_Q.x(); record.pg_q[2] = PG_tmp_Q.y(); record.pg_q[3] = PG_tmp_Q.z();
+        for (int k = 0; k < 8; k++)
+            record.loop_info[k] = kf->loop_info(k);
+        record.first_keypoint = first_keypoint;
+        record.keypoints = kf->keypointNum();
+        record.first_word = first_word;
+        record.words = i < (int)bow_vectors.size() ? bow_vectors[i].size() : 0;
+        first_keypoint += record.keypoints;
+        first_word += record.words;
+        fwrite(&record, sizeof(record), 1, pFile);
+    }
+
+    // the records of an evicted keyframe come from the descriptor store as the file has them
+    vector<PoseGraphMap::KeyPointRecord> keypoints;
+    vector<PoseGraphMap::DescriptorRecord> descriptors;
+    auto readEvicted = [&](KeyFrame* kf)
+    {
+        keypoints.resize(kf->stored_keypoints);
+        descriptors.resize(kf->stored_keypoints);
+        if (!descriptor_store.read(kf->stored_offset, kf->stored_keypoints, keypoints.data(), descriptors.data()))
+        {
+            printf("can not read back the descriptors of keyframe %d\n", kf->index);
+            memset(keypoints.data(), 0, keypoints.size() * sizeof(PoseGraphMap::KeyPointRecord));
+            memset(descriptors.data(), 0, descriptors.size() * sizeof(PoseGraphMap::DescriptorRecord));
+        }
+    };
+
+    seek(header.keypoint_offset);
+    for (int i = 0; i < (int)keyframelist.size(); i++)
+    {
+        KeyFrame* kf = keyframelist[i];
+        if (kf->isEvicted())
+            readEvicted(kf);
+        else
+        {
+            keypoints.resize(kf->keypoints.size());
+            for (int j = 0; j < (int)kf->keypoints.size(); j++)
+            {
+                keypoints[j].x = kf->keypoints[j].pt.x;
+                keypoints[j].y = kf->keypoints[j].pt.y;
+                keypoints[j].x_norm = kf->keypoints_norm[j].pt.x;
+                keypoints[j].y_norm = kf->keypoints_norm[j].pt.y;
+            }
+        }
+        fwrite(keypoints.data(), sizeof(PoseGraphMap::KeyPointRecord), keypoints.size(), pFile);
+    }
+
+    seek(header.descriptor_offset);
+    for (int i = 0; i < (int)keyframelist.size(); i++)
+    {
+        KeyFrame* kf = keyframelist[i];
+        if (kf->isEvicted())
+        {
+            readEvicted(kf);
+            fwrite(descriptors.data(), sizeof(PoseGraphMap::DescriptorRecord), descriptors.size(), pFile);
+        }
+        else
+            fwrite(kf->brief_descriptors.data(), sizeof(BRIEF::bitset), kf->brief_descriptors.size(), pFile);
     }
-    fclose(pFile);
 
-    printf("save pose graph time: %f s\n", tmp_t.toc() / 1000);
+    seek(header.word_offset);
+    vector<PoseGraphMap::WordRecord> words;
+    for (int i = 0; i < (int)keyframelist.size() && i < (int)bow_vectors.size(); i++)
+    {
+        words.clear();
+        for (BowVector::const_iterator vit = bow_vectors[i].begin(); vit != bow_vectors[i].end(); vit++)
+        {
+            PoseGraphMap::WordRecord word;
+            word.id = vit->first;
+            word.pad = 0;
+            word.weight = vit->second;
+            words.push_back(word);
+        }
+        fwrite(words.data(), sizeof(PoseGraphMap::WordRecord), words.size(), pFile);
+    }
+    bool ok = ftell(pFile) == (long)header.file_size;
+    ok = fclose(pFile) == 0 && ok;
+    if (ok && rename(tmp_path.c_str(), file_path.c_str()) == 0)
+        printf("save pose graph time: %f s\n", tmp_t.toc() / 1000);
+    else
+        printf("pose graph saving to %s failed\n", file_path.c_str());
     m_keyframelist.unlock();
 }
 void PoseGraph::loadPoseGraph()
+{
+    TicToc tmp_t;
+    PoseGraphMap::File map;
+    string file_path = POSE_GRAPH_SAVE_PATH + "pose_graph.bin";
+    if (!map.open(file_path))
+    {
+        loadPoseGraphText();
+        return;
+    }
+    printf("lode pose graph from: %s \n", file_path.c_str());
+    const PoseGraphMap::Header &header = map.header();
+    const PoseGraphMap::KeyFrameRecord *records = map.keyframes();
+    // the whole map goes into the database, its rows are sized for it at once
+    vector<unsigned int> word_entries(db.getVocabulary()->size(), 0);
+    const PoseGraphMap::WordRecord *map_words = map.words();
+    for (uint64_t j = 0; j < header.words; j++)
+        if (map_words[j].id < word_entries.size())
+            word_entries[map_words[j].id]++;
+    // map keyframes are sequence 0
+    db.reserve(0, word_entries);
+    for (uint32_t i = 0; i < header.keyframes; i++)
+    {
+        const PoseGraphMap::KeyFrameRecord &record = records[i];
+        cv::Mat image;
+        if (DEBUG_IMAGE)
+        {
+            string image_path = POSE_GRAPH_SAVE_PATH + to_string(record.index) + "_image.png";
+            image = cv::imread(image_path.c_str(), 0);
+        }
+        Vector3d VIO_T(record.vio_t[0], record.vio_t[1], record.vio_t[2]);
+        Vector3d PG_T(record.pg_t[0], record.pg_t[1], record.pg_t[2]);
+        Matrix3d VIO_R = Quaterniond(record.vio_q[0], record.vio_q[1], record.vio_q[2], record.vio_q[3]).toRotationMatrix();
+        Matrix3d PG_R = Quaterniond(record.pg_q[0], record.pg_q[1], record.pg_q[2], record.pg_q[3]).toRotationMatrix();
+        Eigen::Matrix<double, 8, 1 > loop_info(record.loop_info);
+
+        if (record.loop_index != -1)
+            if (earliest_loop_index > record.loop_index || earliest_loop_index == -1)
+            {
+                earliest_loop_index = record.loop_index;
+            }
+
+        const PoseGraphMap::KeyPointRecord *kp = map.keypoints() + record.first_keypoint;
+        const BRIEF::bitset *des = (const BRIEF::bitset *)(map.descriptors() + record.first_keypoint);
+        vector<cv::KeyPoint> keypoints(record.keypoints);
+        vector<cv::KeyPoint> keypoints_norm(record.keypoints);
+        vector<BRIEF::bitset> brief_descriptors(des, des + record.keypoints);
+        for (uint32_t j = 0; j < record.keypoints; j++)
+        {
+            keypoints[j].pt = cv::Point2f(kp[j].x, kp[j].y);
+            keypoints_norm[j].pt = cv::Point2f(kp[j].x_norm, kp[j].y_norm);
+        }
+        BowVector bowvec;
+        const PoseGraphMap::WordRecord *word = map.words() + record.first_word;
+        for (uint32_t j = 0; j < record.words; j++)
+            bowvec.insert(bowvec.end(), make_pair((WordId)word[j].id, (WordValue)word[j].weight));
+
+        KeyFrame* keyframe = new KeyFrame(record.time_stamp, record.index, VIO_T, VIO_R, PG_T, PG_R, image, record.loop_index, loop_info, keypoints, keypoints_norm, brief_descriptors);
+        loadKeyFrame(keyframe, 0, &bowvec);
+        if (i % 20 == 0)
+        {
+            publish();
+        }
+    }
+    printf("load pose graph time: %f s\n", tmp_t.toc()/1000);
+    base_sequence = 0;
+}
+
+void PoseGraph::loadPoseGraphText()
 {
     TicToc tmp_t;
     FILE * pFile;
@@ -1077,11 +1592,56 @@ void PoseGraph::publish()
         //if (sequence_loop[i] == true || i == base_sequence)
         if (1 || i == base_sequence)
         {
-            pub_pg_path.publish(path[i]);
-            pub_path[i].publish(path[i]);
+            if (pub_pg_path.getNumSubscribers())
+                pub_pg_path.publish(path[i]);
+            if (pub_path[i].getNumSubscribers())
+                pub_path[i].publish(path[i]);
             posegraph_visualization->publish_by(pub_pose_graph, path[sequence_cnt].header);
         }
     }
-    pub_base_path.publish(base_path);
+    if (pub_base_path.getNumSubscribers())
+        pub_base_path.publish(base_path);
     //posegraph_visualization->publish_by(pub_pose_graph, path[sequence_cnt].header);
 }
+
+void PoseGraph::publishMemory(double t)
+{
+    if (!pub_memory.getNumSubscribers() || (last_memory_t >= 0 && t >= last_memory_t && t - last_memory_t < 1.0))
+        return;
+    last_memory_t = t;
+    size_t keyframe_bytes = 0, keyframes = 0, evicted = 0;
+    {
+        std::unique_lock<std::mutex> list_lock(m_keyframelist);
+        for (KeyFrame *kf : keyframelist)
+        {
+            if (!kf)
+                continue;
+            keyframe_bytes += kf->memoryBytes();
+            keyframes++;
+            evicted += kf->isEvicted();
+        }
+        keyframe_bytes += keyframelist.capacity() * sizeof(KeyFrame *);
+    }
+
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = ros::Time(t);
+    auto add = [&msg](const char *name, const vector<pair<string, size_t>> &values)
+    {
+        diagnostic_msgs::DiagnosticStatus status;
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.name = name;
+        status.hardware_id = "loop_fusion";
+        for (const pair<string, size_t> &v : values)
+        {
+            diagnostic_msgs::KeyValue kv;
+            kv.key = v.first;
+            kv.value = to_string(v.second);
+            status.values.push_back(kv);
+        }
+        msg.status.push_back(status);
+    };
+    add("loop/keyframes", {{"bytes", keyframe_bytes}, {"keyframes", keyframes}, {"evicted", evicted}});
+    add("loop/database", {{"bytes", db.memoryBytes()}});
+    add("loop/process", {{"resident_bytes", memory_stats::residentBytes()}});
+    pub_memory.publish(msg);
+}
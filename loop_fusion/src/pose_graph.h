@@ -19,16 +19,27 @@
 #include <ceres/ceres.h>
 #include <ceres/rotation.h>
 #include <queue>
+#include <map>
+#include <future>
+#include <atomic>
+#include <memory>
 #include <assert.h>
 #include <nav_msgs/Path.h>
 #include <geometry_msgs/PointStamped.h>
 #include <nav_msgs/Odometry.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
 #include <stdio.h>
 #include <ros/ros.h>
 #include "keyframe.h"
 #include "utility/tic_toc.h"
 #include "utility/utility.h"
+#include "utility/path_buffer.h"
+#include "utility/trajectory_writer.h"
 #include "utility/CameraPoseVisualization.h"
+#include "utility/parameter_block_pool.h"
+#include "utility/pose_graph_map.h"
+#include "utility/keyframe_database.h"
+#include "utility/trace.h"
 #include "utility/tic_toc.h"
 #include "ThirdParty/DBoW/DBoW2.h"
 #include "ThirdParty/DVision/DVision.h"
@@ -43,6 +54,36 @@
 using namespace DVision;
 using namespace DBoW2;
 
+// The problem of the pose graph optimization, kept between solves: the keyframes up to the one
+// that asked for the solve are appended with their edges and the last solution is the initial
+// guess of the next solve. Rebuilt from the vio poses when the fixed, earliest looped keyframe
+// changes, after a sequence was shifted into the world frame, or every time with
+// pose_graph_incremental: 0.
+struct PoseGraphProblem
+{
+	PoseGraphProblem() : loss_function(NULL), gps_loss_function(NULL), local_parameterization(NULL), first_index(-1), last_index(-1),
+	                     gps_edges(0), has_alignment(false) {}
+	void reset(ceres::LocalParameterization *_local_parameterization, int _first_index);
+	double *rotation(int i) { return poses[i]; }
+	double *translation(int i) { return poses[i] + 4; }
+
+	std::unique_ptr<ceres::Problem> problem;
+	// of the loop edges and of the rotations, owned by problem
+	ceres::LossFunction *loss_function;
+	ceres::LossFunction *gps_loss_function;
+	ceres::LocalParameterization *local_parameterization;
+	int first_index;
+	int last_index;
+	// in problem order, local_index of the keyframe
+	vector<KeyFrame*> keyframes;
+	// per keyframe the rotation, yaw pitch roll (4 DoF, only the yaw is a variable) or w x y z
+	// (6 DoF), and the position in one row of a cache line
+	ParameterBlockPool<8> poses;
+	// gps_fusion: number of PoseGraph::gps_edges in the problem and whether the alignment is
+	size_t gps_edges;
+	bool has_alignment;
+};
+
 class PoseGraph
 {
 public:
@@ -50,7 +91,11 @@ public:
 	~PoseGraph();
 	void registerPub(ros::NodeHandle &n);
 	void addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop);
-	void loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop);
+	// localization_only: cur_kf is matched against the loaded map and deleted, the map, its
+	// database and its poses are never changed. A verified match sets the drift directly.
+	void localizeKeyFrame(KeyFrame* cur_kf);
+	// bowvec, when given, goes into the loop database instead of transforming the descriptors again
+	void loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop, const BowVector *bowvec = NULL);
 	void loadVocabulary(std::string voc_path);
 	void setIMUFlag(bool _use_imu);
 	KeyFrame* getKeyFrame(int index);
@@ -60,43 +105,117 @@ public:
 	void savePoseGraph();
 	void loadPoseGraph();
 	void publish();
+	// consistent copy of the drift and of the sequence alignment, the optimization thread updates them
+	void getDrift(Matrix3d &_r_drift, Vector3d &_t_drift, Matrix3d &_w_r_vio, Vector3d &_w_t_vio);
 	Vector3d t_drift;
 	double yaw_drift;
 	Matrix3d r_drift;
 	// world frame( base sequence or first sequence)<----> cur sequence frame  
 	Vector3d w_t_vio;
 	Matrix3d w_r_vio;
+	// gps_fusion: a fix in the ENU frame of the first one, solved with the keyframes on the next
+	// optimization
+	void addGPS(double t, const Vector3d &enu_p, double accuracy);
+	// ENU frame <---- world frame, false until enough fixes have been seen to align them
+	bool getGPSAlignment(Matrix3d &enu_r_w, Vector3d &enu_t_w);
+	// vio_correction: the vio frame of the running sequence to the world frame (ENU with
+	// gps_fusion) as one transform, sent when it changes for the estimator's imu_propagate
+	void publishCorrection();
+	// memory: bytes of the keyframes, of the loop database and of the process, at most once a
+	// second of keyframe time
+	void publishMemory(double t);
 
 
 private:
-	int detectLoop(KeyFrame* keyframe, int frame_index);
-	void addKeyFrameIntoVoc(KeyFrame* keyframe);
+	int detectLoop(KeyFrame* keyframe, int frame_index, vector<int> &candidates);
+	// the map keyframes keyframe may see, best first, up to LOOP_CANDIDATES; nothing is added
+	void queryMap(KeyFrame* keyframe, vector<int> &candidates);
+	KeyFrame* verifyCandidates(KeyFrame* cur_kf, const vector<int> &candidates);
+	void addKeyFrameIntoVoc(KeyFrame* keyframe, const BowVector *bowvec = NULL);
+	void restoreKeyFrame(KeyFrame* kf);
+	void evictKeyFrames();
+	// pose_graph.txt and the per keyframe files of older versions
+	void loadPoseGraphText();
+	int nextOptimization(int &first_looped_index, bool &rebuild);
+	void updateDrift(KeyFrame* cur_kf, bool yaw_only);
 	void optimize4DoF();
 	void optimize6DoF();
-	void updatePath();
-	list<KeyFrame*> keyframelist;
+	void updatePath(int first_index);
+	bool attachGPS(KeyFrame* cur_kf);
+	bool alignGPS();
+	void addGPSEdges(int cur_index);
+	// in index order, keyframelist[i]->index == i
+	vector<KeyFrame*> keyframelist;
 	std::mutex m_keyframelist;
 	std::mutex m_optimize_buf;
 	std::mutex m_path;
 	std::mutex m_drift;
 	std::thread t_optimization;
 	std::queue<int> optimize_buf;
+	// vio poses of a sequence changed since the last solve, guarded by m_optimize_buf
+	bool shifted_since_solve;
+	// only used by the optimization thread
+	PoseGraphProblem graph;
+
+	struct GPSFix
+	{
+		Vector3d p;
+		double accuracy;
+	};
+	// a fix between the positions of keyframes index_i and index_j, ratio of the way in time
+	struct GPSEdge
+	{
+		int index_i, index_j;
+		double ratio;
+		Vector3d p;
+		double accuracy;
+	};
+	// fixes waiting for the keyframe after them and the ones paired with keyframes, in the order
+	// they were paired, guarded by m_gps
+	std::mutex m_gps;
+	map<double, GPSFix> gps_buf;
+	vector<GPSEdge> gps_edges;
+	// world frame <---- ENU frame, solved by the optimization thread once gps_initialized
+	bool gps_initialized;
+	double gps_yaw[1];
+	double gps_t[3];
+	// the last solved alignment, guarded by m_drift
+	bool gps_aligned;
+	Matrix3d w_r_enu;
+	Vector3d w_t_enu;
 
 	int global_index;
 	int sequence_cnt;
 	vector<bool> sequence_loop;
-	map<int, cv::Mat> image_pool;
 	int earliest_loop_index;
 	int base_sequence;
 	bool use_imu;
 
-	BriefDatabase db;
-	BriefVocabulary* voc;
+	KeyFrameDatabase db;
+	// keypoints and descriptors of the keyframes older than RESIDENT_KEYFRAMES, and the ones of them
+	// read back for the current loop, used by the thread adding keyframes
+	DescriptorStore descriptor_store;
+	vector<int> restored_keyframes;
+
+	// VINS_RESULT_PATH, opened with the first keyframe
+	TrajectoryWriter loop_path_writer;
+	// keyframe in the first row of the loop file, -1 before it is opened
+	std::atomic<int> loop_path_first;
+	// keyframe index of every pose in path[] and base_path and the first marker of every
+	// keyframe, guarded by m_path, what moved is redrawn from there
+	vector<int> path_index[10];
+	vector<int> base_path_index;
+	vector<size_t> marker_start;
 
 	ros::Publisher pub_pg_path;
+	ros::Publisher pub_correction;
+	// every new keyframe pose once, for consumers that only append
+	ros::Publisher pub_pg_pose;
 	ros::Publisher pub_base_path;
 	ros::Publisher pub_pose_graph;
 	ros::Publisher pub_path[10];
+	ros::Publisher pub_memory;
+	double last_memory_t;
 };
 
 template <typename T> inline
@@ -210,6 +329,9 @@ struct FourDOFError
 	}
 
 	static ceres::CostFunction* Create(const double t_x, const double t_y, const double t_z,
+									   const double relative_yaw, const double pitch_i, const double roll_i);
+
+	static ceres::CostFunction* CreateAutoDiff(const double t_x, const double t_y, const double t_z,
 									   const double relative_yaw, const double pitch_i, const double roll_i) 
 	{
 	  return (new ceres::AutoDiffCostFunction<
@@ -256,6 +378,9 @@ struct FourDOFWeightError
 	}
 
 	static ceres::CostFunction* Create(const double t_x, const double t_y, const double t_z,
+									   const double relative_yaw, const double pitch_i, const double roll_i);
+
+	static ceres::CostFunction* CreateAutoDiff(const double t_x, const double t_y, const double t_z,
 									   const double relative_yaw, const double pitch_i, const double roll_i) 
 	{
 	  return (new ceres::AutoDiffCostFunction<
@@ -319,6 +444,11 @@ struct RelativeRTError
 	}
 
 	static ceres::CostFunction* Create(const double t_x, const double t_y, const double t_z,
+									   const double q_w, const double q_x, const double q_y, const double q_z,
+									   const double t_var, const double q_var);
+
+	// the functor above, on quaternion blocks of ceres::QuaternionParameterization
+	static ceres::CostFunction* CreateAutoDiff(const double t_x, const double t_y, const double t_z,
 									   const double q_w, const double q_x, const double q_y, const double q_z,
 									   const double t_var, const double q_var) 
 	{
@@ -331,4 +461,294 @@ struct RelativeRTError
 	double q_w, q_x, q_y, q_z;
 	double t_var, q_var;
 
-};
\ No newline at end of file
+};
+
+// Hand derived jacobians of the factors above, the autodiff jets cost most of a pose graph solve.
+// Rotations are perturbed on the right, q * [1, dtheta / 2] as QuaternionRightParameterization
+// does: a factor writes its jacobian in dtheta into the x, y, z columns of a quaternion block and
+// leaves the w column zero, the parameterization's jacobian then only picks those columns.
+// The autodiff functors stay as the reference, CreateAutoDiff, which the microbench compares against.
+class QuaternionRightParameterization : public ceres::LocalParameterization
+{
+  public:
+	virtual bool Plus(const double *x, const double *delta, double *x_plus_delta) const
+	{
+		Eigen::Quaterniond q(x[0], x[1], x[2], x[3]);
+		Eigen::Quaterniond dq(1, delta[0] / 2, delta[1] / 2, delta[2] / 2);
+		Eigen::Quaterniond r = (q * dq).normalized();
+		x_plus_delta[0] = r.w();
+		x_plus_delta[1] = r.x();
+		x_plus_delta[2] = r.y();
+		x_plus_delta[3] = r.z();
+		return true;
+	}
+	virtual bool ComputeJacobian(const double *x, double *jacobian) const
+	{
+		Eigen::Map<Eigen::Matrix<double, 4, 3, Eigen::RowMajor>> j(jacobian);
+		j.topRows<1>().setZero();
+		j.bottomRows<3>().setIdentity();
+		return true;
+	}
+	virtual int GlobalSize() const { return 4; }
+	virtual int LocalSize() const { return 3; }
+};
+
+// q * p = quaternionLeft(q) p = quaternionRight(p) q, w first, without Utility's sign flip
+inline Eigen::Matrix4d quaternionLeft(const Eigen::Quaterniond &q)
+{
+	Eigen::Matrix4d m;
+	m(0, 0) = q.w();
+	m.block<1, 3>(0, 1) = -q.vec().transpose();
+	m.block<3, 1>(1, 0) = q.vec();
+	m.block<3, 3>(1, 1) = q.w() * Eigen::Matrix3d::Identity() + Utility::skewSymmetric(q.vec());
+	return m;
+}
+
+inline Eigen::Matrix4d quaternionRight(const Eigen::Quaterniond &p)
+{
+	Eigen::Matrix4d m;
+	m(0, 0) = p.w();
+	m.block<1, 3>(0, 1) = -p.vec().transpose();
+	m.block<3, 1>(1, 0) = p.vec();
+	m.block<3, 3>(1, 1) = p.w() * Eigen::Matrix3d::Identity() - Utility::skewSymmetric(p.vec());
+	return m;
+}
+
+// FourDOFError, and FourDOFWeightError with t_weight = weight, yaw_weight = weight / 10
+class FourDOFFactor : public ceres::SizedCostFunction<4, 1, 3, 1, 3>
+{
+  public:
+	FourDOFFactor(double t_x, double t_y, double t_z, double relative_yaw, double pitch_i, double roll_i,
+				  double t_weight, double yaw_weight)
+				  :t(t_x, t_y, t_z), relative_yaw(relative_yaw), pitch_i(pitch_i), roll_i(roll_i),
+				   t_weight(t_weight), yaw_weight(yaw_weight){}
+
+	virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
+	{
+		double yaw_i = parameters[0][0];
+		Eigen::Map<const Eigen::Vector3d> ti(parameters[1]);
+		double yaw_j = parameters[2][0];
+		Eigen::Map<const Eigen::Vector3d> tj(parameters[3]);
+
+		double R[9];
+		YawPitchRollToRotationMatrix(yaw_i, pitch_i, roll_i, R);
+		Eigen::Matrix3d i_R_w = Eigen::Map<const Eigen::Matrix<double, 3, 3, Eigen::RowMajor>>(R).transpose();
+		Eigen::Vector3d t_w_ij = tj - ti;
+
+		Eigen::Map<Eigen::Vector4d> residual(residuals);
+		residual.head<3>() = (i_R_w * t_w_ij - t) * t_weight;
+		residual(3) = NormalizeAngle(yaw_j - yaw_i - relative_yaw) * yaw_weight;
+
+		if (jacobians)
+		{
+			if (jacobians[0])
+			{
+				// d R / d yaw = [e_z]x R, in degrees
+				Eigen::Map<Eigen::Vector4d> j(jacobians[0]);
+				j.head<3>() = i_R_w * Eigen::Vector3d(t_w_ij.y(), -t_w_ij.x(), 0) * (M_PI / 180.0) * t_weight;
+				j(3) = -yaw_weight;
+			}
+			if (jacobians[1])
+			{
+				Eigen::Map<Eigen::Matrix<double, 4, 3, Eigen::RowMajor>> j(jacobians[1]);
+				j.topRows<3>() = -i_R_w * t_weight;
+				j.bottomRows<1>().setZero();
+			}
+			if (jacobians[2])
+			{
+				Eigen::Map<Eigen::Vector4d> j(jacobians[2]);
+				j.head<3>().setZero();
+				j(3) = yaw_weight;
+			}
+			if (jacobians[3])
+			{
+				Eigen::Map<Eigen::Matrix<double, 4, 3, Eigen::RowMajor>> j(jacobians[3]);
+				j.topRows<3>() = i_R_w * t_weight;
+				j.bottomRows<1>().setZero();
+			}
+		}
+		return true;
+	}
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	Eigen::Vector3d t;
+	double relative_yaw, pitch_i, roll_i;
+	double t_weight, yaw_weight;
+};
+
+inline ceres::CostFunction* FourDOFError::Create(const double t_x, const double t_y, const double t_z,
+									   const double relative_yaw, const double pitch_i, const double roll_i)
+{
+	return new FourDOFFactor(t_x, t_y, t_z, relative_yaw, pitch_i, roll_i, 1, 1);
+}
+
+inline ceres::CostFunction* FourDOFWeightError::Create(const double t_x, const double t_y, const double t_z,
+									   const double relative_yaw, const double pitch_i, const double roll_i)
+{
+	// the weight FourDOFWeightError starts with
+	return new FourDOFFactor(t_x, t_y, t_z, relative_yaw, pitch_i, roll_i, 1, 1 / 10.0);
+}
+
+// RelativeRTError on quaternion blocks of QuaternionRightParameterization
+class RelativeRTFactor : public ceres::SizedCostFunction<6, 4, 3, 4, 3>
+{
+  public:
+	RelativeRTFactor(double t_x, double t_y, double t_z,
+					 double q_w, double q_x, double q_y, double q_z,
+					 double t_var, double q_var)
+				  :t(t_x, t_y, t_z), q(q_w, q_x, q_y, q_z), t_var(t_var), q_var(q_var){}
+
+	virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
+	{
+		Eigen::Quaterniond w_q_i(parameters[0][0], parameters[0][1], parameters[0][2], parameters[0][3]);
+		Eigen::Map<const Eigen::Vector3d> ti(parameters[1]);
+		Eigen::Quaterniond w_q_j(parameters[2][0], parameters[2][1], parameters[2][2], parameters[2][3]);
+		Eigen::Map<const Eigen::Vector3d> tj(parameters[3]);
+		w_q_i.normalize();
+		w_q_j.normalize();
+
+		Eigen::Matrix3d i_R_w = w_q_i.toRotationMatrix().transpose();
+		Eigen::Vector3d t_i_ij = i_R_w * (tj - ti);
+		Eigen::Quaterniond q_i_j = w_q_i.conjugate() * w_q_j;
+		Eigen::Quaterniond error_q = q.conjugate() * q_i_j;
+
+		Eigen::Map<Eigen::Matrix<double, 6, 1>> residual(residuals);
+		residual.head<3>() = (t_i_ij - t) / t_var;
+		residual.tail<3>() = 2 * error_q.vec() / q_var;
+
+		if (jacobians)
+		{
+			if (jacobians[0])
+			{
+				Eigen::Map<Eigen::Matrix<double, 6, 4, Eigen::RowMajor>> j(jacobians[0]);
+				j.setZero();
+				j.block<3, 3>(0, 1) = Utility::skewSymmetric(t_i_ij) / t_var;
+				j.block<3, 3>(3, 1) = -(quaternionLeft(q.conjugate()) * quaternionRight(q_i_j)).bottomRightCorner<3, 3>() / q_var;
+			}
+			if (jacobians[1])
+			{
+				Eigen::Map<Eigen::Matrix<double, 6, 3, Eigen::RowMajor>> j(jacobians[1]);
+				j.topRows<3>() = -i_R_w / t_var;
+				j.bottomRows<3>().setZero();
+			}
+			if (jacobians[2])
+			{
+				Eigen::Map<Eigen::Matrix<double, 6, 4, Eigen::RowMajor>> j(jacobians[2]);
+				j.setZero();
+				j.block<3, 3>(3, 1) = quaternionLeft(error_q).bottomRightCorner<3, 3>() / q_var;
+			}
+			if (jacobians[3])
+			{
+				Eigen::Map<Eigen::Matrix<double, 6, 3, Eigen::RowMajor>> j(jacobians[3]);
+				j.topRows<3>() = i_R_w / t_var;
+				j.bottomRows<3>().setZero();
+			}
+		}
+		return true;
+	}
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	Eigen::Vector3d t;
+	Eigen::Quaterniond q;
+	double t_var, q_var;
+};
+
+inline ceres::CostFunction* RelativeRTError::Create(const double t_x, const double t_y, const double t_z,
+									   const double q_w, const double q_x, const double q_y, const double q_z,
+									   const double t_var, const double q_var)
+{
+	return new RelativeRTFactor(t_x, t_y, t_z, q_w, q_x, q_y, q_z, t_var, q_var);
+}
+
+// A gps fix between keyframes i and j, ratio of the way from i to j in time, against the position
+// interpolated between them. The fix is in the ENU frame and taken to the world frame by the
+// alignment gps_yaw (degrees), gps_t of the pose graph.
+struct GPSError
+{
+	GPSError(double x, double y, double z, double accuracy, double ratio)
+				  :x(x), y(y), z(z), accuracy(accuracy), ratio(ratio){}
+
+	template <typename T>
+	bool operator()(const T* ti, const T* tj, const T* const gps_yaw, const T* gps_t, T* residuals) const
+	{
+		T w_R_enu[9];
+		YawPitchRollToRotationMatrix(gps_yaw[0], T(0), T(0), w_R_enu);
+		T enu_p[3] = {T(x), T(y), T(z)};
+		T w_p[3];
+		RotationMatrixRotatePoint(w_R_enu, enu_p, w_p);
+		for (int k = 0; k < 3; k++)
+			residuals[k] = (ti[k] + T(ratio) * (tj[k] - ti[k]) - w_p[k] - gps_t[k]) / T(accuracy);
+		return true;
+	}
+
+	static ceres::CostFunction* Create(const double x, const double y, const double z,
+									   const double accuracy, const double ratio);
+
+	static ceres::CostFunction* CreateAutoDiff(const double x, const double y, const double z,
+									   const double accuracy, const double ratio)
+	{
+	  return (new ceres::AutoDiffCostFunction<
+	          GPSError, 3, 3, 3, 1, 3>(
+	          	new GPSError(x, y, z, accuracy, ratio)));
+	}
+
+	double x, y, z;
+	double accuracy, ratio;
+};
+
+class GPSFactor : public ceres::SizedCostFunction<3, 3, 3, 1, 3>
+{
+  public:
+	GPSFactor(double x, double y, double z, double accuracy, double ratio)
+				  :enu_p(x, y, z), accuracy(accuracy), ratio(ratio){}
+
+	virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
+	{
+		Eigen::Map<const Eigen::Vector3d> ti(parameters[0]);
+		Eigen::Map<const Eigen::Vector3d> tj(parameters[1]);
+		double yaw = parameters[2][0] / 180.0 * M_PI;
+		Eigen::Map<const Eigen::Vector3d> gps_t(parameters[3]);
+
+		Eigen::Matrix3d w_R_enu = Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()).toRotationMatrix();
+		Eigen::Vector3d w_p = w_R_enu * enu_p;
+
+		Eigen::Map<Eigen::Vector3d> residual(residuals);
+		residual = (ti + ratio * (tj - ti) - w_p - gps_t) / accuracy;
+
+		if (jacobians)
+		{
+			if (jacobians[0])
+			{
+				Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>> j(jacobians[0]);
+				j = Eigen::Matrix3d::Identity() * ((1 - ratio) / accuracy);
+			}
+			if (jacobians[1])
+			{
+				Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>> j(jacobians[1]);
+				j = Eigen::Matrix3d::Identity() * (ratio / accuracy);
+			}
+			if (jacobians[2])
+			{
+				// d R / d yaw = [e_z]x R, in degrees
+				Eigen::Map<Eigen::Vector3d> j(jacobians[2]);
+				j = Eigen::Vector3d(w_p.y(), -w_p.x(), 0) * (M_PI / 180.0 / accuracy);
+			}
+			if (jacobians[3])
+			{
+				Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>> j(jacobians[3]);
+				j = -Eigen::Matrix3d::Identity() / accuracy;
+			}
+		}
+		return true;
+	}
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	Eigen::Vector3d enu_p;
+	double accuracy, ratio;
+};
+
+inline ceres::CostFunction* GPSError::Create(const double x, const double y, const double z,
+									   const double accuracy, const double ratio)
+{
+	return new GPSFactor(x, y, z, accuracy, ratio);
+}
@@ -13,17 +13,23 @@
 #include <ros/ros.h>
 #include <nav_msgs/Odometry.h>
 #include <nav_msgs/Path.h>
-#include <sensor_msgs/PointCloud.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/point_cloud2_iterator.h>
 #include <sensor_msgs/Image.h>
 #include <sensor_msgs/image_encodings.h>
+#include <sensor_msgs/NavSatFix.h>
 #include <visualization_msgs/Marker.h>
 #include <std_msgs/Bool.h>
 #include <cv_bridge/cv_bridge.h>
 #include <iostream>
 #include <ros/package.h>
+#include <atomic>
 #include <mutex>
 #include <queue>
+#include <map>
 #include <thread>
+#include <future>
+#include <condition_variable>
 #include <eigen3/Eigen/Dense>
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/eigen.hpp>
@@ -31,15 +37,22 @@
 #include "utility/tic_toc.h"
 #include "pose_graph.h"
 #include "utility/CameraPoseVisualization.h"
+#include "utility/enu_converter.h"
+#include "utility/thread_placement.h"
 #include "parameters.h"
+#ifdef LOOP_FUSION_CUDA
+#include "utility/cuda_extractor.h"
+#endif
 #define SKIP_FIRST_CNT 10
 using namespace std;
 
-queue<sensor_msgs::ImageConstPtr> image_buf;
-queue<sensor_msgs::PointCloudConstPtr> point_buf;
-queue<nav_msgs::Odometry::ConstPtr> pose_buf;
+// the messages by stamp, taken by process() as soon as a pose has its image and points
+map<double, sensor_msgs::ImageConstPtr> image_buf;
+map<double, sensor_msgs::PointCloud2ConstPtr> point_buf;
+map<double, nav_msgs::Odometry::ConstPtr> pose_buf;
 queue<Eigen::Vector3d> odometry_buf;
 std::mutex m_buf;
+std::condition_variable con_buf;
 std::mutex m_process;
 int frame_index  = 0;
 int sequence = 1;
@@ -47,22 +60,49 @@ PoseGraph posegraph;
 int skip_first_cnt = 0;
 int SKIP_CNT;
 int skip_cnt = 0;
-bool load_flag = 0;
+// images from the estimator's keyframe_image instead of the camera, one per keyframe
+int USE_KEYFRAME_IMAGE = 0;
+// set once the previous pose graph is in, live keyframes built before wait in pending_keyframes
+std::atomic<bool> load_flag(false);
+vector<KeyFrame*> pending_keyframes;
 bool start_flag = 0;
 double SKIP_DIS = 0;
 
+// keyframes being built (decode, FAST and BRIEF in the KeyFrame constructor) in arrival order,
+// at most KEYFRAME_WORKERS at a time, added to the pose graph in that order by commit()
+queue<std::future<KeyFrame*>> keyframe_buf;
+std::mutex m_keyframe;
+std::condition_variable keyframe_cv;
+int KEYFRAME_WORKERS = 0;
+
 int VISUALIZATION_SHIFT_X;
 int VISUALIZATION_SHIFT_Y;
 int ROW;
 int COL;
 int DEBUG_IMAGE;
+int PATH_MAX_POSES;
+double LOOP_SEARCH_RADIUS;
+int LOOP_CANDIDATES;
+int POSE_GRAPH_INCREMENTAL;
+int LOOP_MAX_POSTINGS;
+int LOOP_DB_SHARDS;
+int TRACE_EVENTS;
+int RESIDENT_KEYFRAMES;
+int LOOP_USE_GPU;
+int GPS_FUSION;
+int USE_IMU;
+int LOCALIZATION_ONLY;
 
 camodocal::CameraPtr m_camera;
+camodocal::UndistortionLUT m_camera_lut;
+ImageCache keyframe_images;
 Eigen::Vector3d tic;
 Eigen::Matrix3d qic;
 ros::Publisher pub_match_img;
 ros::Publisher pub_camera_pose_visual;
 ros::Publisher pub_odometry_rect;
+ros::Publisher pub_global_odometry;
+EnuConverter enu_converter;
 
 std::string BRIEF_PATTERN_FILE;
 std::string POSE_GRAPH_SAVE_PATH;
@@ -86,12 +126,9 @@ void new_sequence()
     posegraph.posegraph_visualization->reset();
     posegraph.publish();
     m_buf.lock();
-    while(!image_buf.empty())
-        image_buf.pop();
-    while(!point_buf.empty())
-        point_buf.pop();
-    while(!pose_buf.empty())
-        pose_buf.pop();
+    image_buf.clear();
+    point_buf.clear();
+    pose_buf.clear();
     while(!odometry_buf.empty())
         odometry_buf.pop();
     m_buf.unlock();
@@ -101,11 +138,14 @@ void image_callback(const sensor_msgs::ImageConstPtr &image_msg)
 {
     //ROS_INFO("image_callback!");
     m_buf.lock();
-    image_buf.push(image_msg);
+    image_buf.emplace(image_msg->header.stamp.toSec(), image_msg);
     m_buf.unlock();
+    con_buf.notify_one();
     //printf(" image time %f \n", image_msg->header.stamp.toSec());
 
-    // detect unstable camera stream
+    // detect unstable camera stream, keyframes are naturally far apart when the camera stands still
+    if (USE_KEYFRAME_IMAGE)
+        return;
     if (last_image_time == -1)
         last_image_time = image_msg->header.stamp.toSec();
     else if (image_msg->header.stamp.toSec() - last_image_time > 1.0 || image_msg->header.stamp.toSec() < last_image_time)
@@ -116,68 +156,58 @@ void image_callback(const sensor_msgs::ImageConstPtr &image_msg)
     last_image_time = image_msg->header.stamp.toSec();
 }
 
-void point_callback(const sensor_msgs::PointCloudConstPtr &point_msg)
+// the cloud moved by the drift of the pose graph, x, y, z only
+static sensor_msgs::PointCloud2Ptr correctCloud(const sensor_msgs::PointCloud2 &point_msg)
+{
+    sensor_msgs::PointCloud2Ptr point_cloud(new sensor_msgs::PointCloud2);
+    point_cloud->header = point_msg.header;
+    sensor_msgs::PointCloud2Modifier modifier(*point_cloud);
+    modifier.setPointCloud2FieldsByString(1, "xyz");
+    size_t n = point_msg.width * point_msg.height;
+    modifier.resize(n);
+    if (n == 0)
+        return point_cloud;
+    Eigen::Matrix3d r_drift, w_r_vio;
+    Eigen::Vector3d t_drift, w_t_vio;
+    posegraph.getDrift(r_drift, t_drift, w_r_vio, w_t_vio);
+    sensor_msgs::PointCloud2ConstIterator<float> in(point_msg, "x");
+    sensor_msgs::PointCloud2Iterator<float> out(*point_cloud, "x");
+    for (size_t i = 0; i < n; i++, ++in, ++out)
+    {
+        Eigen::Vector3d tmp = r_drift * Eigen::Vector3d(in[0], in[1], in[2]) + t_drift;
+        out[0] = tmp(0);
+        out[1] = tmp(1);
+        out[2] = tmp(2);
+    }
+    return point_cloud;
+}
+
+void point_callback(const sensor_msgs::PointCloud2ConstPtr &point_msg)
 {
     //ROS_INFO("point_callback!");
     m_buf.lock();
-    point_buf.push(point_msg);
+    point_buf.emplace(point_msg->header.stamp.toSec(), point_msg);
     m_buf.unlock();
-    /*
-    for (unsigned int i = 0; i < point_msg->points.size(); i++)
-    {
-        printf("%d, 3D point: %f, %f, %f 2D point %f, %f \n",i , point_msg->points[i].x, 
-                                                     point_msg->points[i].y,
-                                                     point_msg->points[i].z,
-                                                     point_msg->channels[i].values[0],
-                                                     point_msg->channels[i].values[1]);
-    }
-    */
+    con_buf.notify_one();
     // for visualization
-    sensor_msgs::PointCloud point_cloud;
-    point_cloud.header = point_msg->header;
-    for (unsigned int i = 0; i < point_msg->points.size(); i++)
-    {
-        cv::Point3f p_3d;
-        p_3d.x = point_msg->points[i].x;
-        p_3d.y = point_msg->points[i].y;
-        p_3d.z = point_msg->points[i].z;
-        Eigen::Vector3d tmp = posegraph.r_drift * Eigen::Vector3d(p_3d.x, p_3d.y, p_3d.z) + posegraph.t_drift;
-        geometry_msgs::Point32 p;
-        p.x = tmp(0);
-        p.y = tmp(1);
-        p.z = tmp(2);
-        point_cloud.points.push_back(p);
-    }
-    pub_point_cloud.publish(point_cloud);
+    if (pub_point_cloud.getNumSubscribers())
+        pub_point_cloud.publish(correctCloud(*point_msg));
 }
 
 // only for visualization
-void margin_point_callback(const sensor_msgs::PointCloudConstPtr &point_msg)
+void margin_point_callback(const sensor_msgs::PointCloud2ConstPtr &point_msg)
 {
-    sensor_msgs::PointCloud point_cloud;
-    point_cloud.header = point_msg->header;
-    for (unsigned int i = 0; i < point_msg->points.size(); i++)
-    {
-        cv::Point3f p_3d;
-        p_3d.x = point_msg->points[i].x;
-        p_3d.y = point_msg->points[i].y;
-        p_3d.z = point_msg->points[i].z;
-        Eigen::Vector3d tmp = posegraph.r_drift * Eigen::Vector3d(p_3d.x, p_3d.y, p_3d.z) + posegraph.t_drift;
-        geometry_msgs::Point32 p;
-        p.x = tmp(0);
-        p.y = tmp(1);
-        p.z = tmp(2);
-        point_cloud.points.push_back(p);
-    }
-    pub_margin_cloud.publish(point_cloud);
+    if (pub_margin_cloud.getNumSubscribers())
+        pub_margin_cloud.publish(correctCloud(*point_msg));
 }
 
 void pose_callback(const nav_msgs::Odometry::ConstPtr &pose_msg)
 {
     //ROS_INFO("pose_callback!");
     m_buf.lock();
-    pose_buf.push(pose_msg);
+    pose_buf.emplace(pose_msg->header.stamp.toSec(), pose_msg);
     m_buf.unlock();
+    con_buf.notify_one();
     /*
     printf("pose t: %f, %f, %f   q: %f, %f, %f %f \n", pose_msg->pose.pose.position.x,
                                                        pose_msg->pose.pose.position.y,
@@ -199,11 +229,14 @@ void vio_callback(const nav_msgs::Odometry::ConstPtr &pose_msg)
     vio_q.y() = pose_msg->pose.pose.orientation.y;
     vio_q.z() = pose_msg->pose.pose.orientation.z;
 
-    vio_t = posegraph.w_r_vio * vio_t + posegraph.w_t_vio;
-    vio_q = posegraph.w_r_vio *  vio_q;
+    Matrix3d r_drift, w_r_vio;
+    Vector3d t_drift, w_t_vio;
+    posegraph.getDrift(r_drift, t_drift, w_r_vio, w_t_vio);
+    vio_t = w_r_vio * vio_t + w_t_vio;
+    vio_q = w_r_vio *  vio_q;
 
-    vio_t = posegraph.r_drift * vio_t + posegraph.t_drift;
-    vio_q = posegraph.r_drift * vio_q;
+    vio_t = r_drift * vio_t + t_drift;
+    vio_q = r_drift * vio_q;
 
     nav_msgs::Odometry odometry;
     odometry.header = pose_msg->header;
@@ -217,6 +250,22 @@ void vio_callback(const nav_msgs::Odometry::ConstPtr &pose_msg)
     odometry.pose.pose.orientation.w = vio_q.w();
     pub_odometry_rect.publish(odometry);
 
+    Matrix3d enu_r_w;
+    Vector3d enu_t_w;
+    if (GPS_FUSION && posegraph.getGPSAlignment(enu_r_w, enu_t_w))
+    {
+        Vector3d enu_t = enu_r_w * vio_t + enu_t_w;
+        Quaterniond enu_q(enu_r_w * vio_q);
+        odometry.pose.pose.position.x = enu_t.x();
+        odometry.pose.pose.position.y = enu_t.y();
+        odometry.pose.pose.position.z = enu_t.z();
+        odometry.pose.pose.orientation.x = enu_q.x();
+        odometry.pose.pose.orientation.y = enu_q.y();
+        odometry.pose.pose.orientation.z = enu_q.z();
+        odometry.pose.pose.orientation.w = enu_q.w();
+        pub_global_odometry.publish(odometry);
+    }
+
     Vector3d vio_t_cam;
     Quaterniond vio_q_cam;
     vio_t_cam = vio_t + vio_q * tic;
@@ -229,6 +278,14 @@ void vio_callback(const nav_msgs::Odometry::ConstPtr &pose_msg)
 
 }
 
+void gps_callback(const sensor_msgs::NavSatFixConstPtr &gps_msg)
+{
+    if (gps_msg->status.status < sensor_msgs::NavSatStatus::STATUS_FIX)
+        return;
+    Vector3d enu_p = enu_converter.forward(gps_msg->latitude, gps_msg->longitude, gps_msg->altitude);
+    posegraph.addGPS(gps_msg->header.stamp.toSec(), enu_p, gps_msg->position_covariance[0]);
+}
+
 void extrinsic_callback(const nav_msgs::Odometry::ConstPtr &pose_msg)
 {
     m_process.lock();
@@ -242,137 +299,198 @@ void extrinsic_callback(const nav_msgs::Odometry::ConstPtr &pose_msg)
     m_process.unlock();
 }
 
+void addLiveKeyFrame(KeyFrame* keyframe)
+{
+    m_process.lock();
+    start_flag = 1;
+    if (load_flag && LOCALIZATION_ONLY)
+        posegraph.localizeKeyFrame(keyframe);
+    else if (load_flag)
+        posegraph.addKeyFrame(keyframe, 1);
+    else
+        pending_keyframes.push_back(keyframe);
+    m_process.unlock();
+}
+
+// with m_buf held: the oldest pose with the first image and points at or after its stamp, the
+// older images and points are thrown. Poses from before the first image or points are thrown.
+// False while the image or the points of the oldest pose have not arrived.
+static bool associate(sensor_msgs::ImageConstPtr &image_msg, sensor_msgs::PointCloud2ConstPtr &point_msg,
+                      nav_msgs::Odometry::ConstPtr &pose_msg)
+{
+    while (!pose_buf.empty() && !image_buf.empty() && !point_buf.empty())
+    {
+        double t = pose_buf.begin()->first;
+        if (image_buf.begin()->first > t || point_buf.begin()->first > t)
+        {
+            pose_buf.erase(pose_buf.begin());
+            VINS_WARN("throw pose at beginning\n");
+            continue;
+        }
+        auto image = image_buf.lower_bound(t);
+        auto point = point_buf.lower_bound(t);
+        if (image == image_buf.end() || point == point_buf.end())
+            return false;
+        pose_msg = pose_buf.begin()->second;
+        pose_buf.erase(pose_buf.begin());
+        image_msg = image->second;
+        image_buf.erase(image_buf.begin(), ++image);
+        point_msg = point->second;
+        point_buf.erase(point_buf.begin(), ++point);
+        return true;
+    }
+    return false;
+}
+
+// mono messages are shared, KeyFrame only reads the image while it is built
+static cv_bridge::CvImageConstPtr keyframeImage(const sensor_msgs::ImageConstPtr &image_msg)
+{
+    if (image_msg->encoding == "8UC1" || image_msg->encoding == sensor_msgs::image_encodings::MONO8)
+        return cv_bridge::toCvShare(image_msg);
+    else
+        return cv_bridge::toCvCopy(image_msg, sensor_msgs::image_encodings::MONO8);
+}
+
+// woken by every message, builds a keyframe from each pose the skip filters pass; the image is
+// only converted for those
 void process()
 {
     while (true)
     {
         sensor_msgs::ImageConstPtr image_msg = NULL;
-        sensor_msgs::PointCloudConstPtr point_msg = NULL;
+        sensor_msgs::PointCloud2ConstPtr point_msg = NULL;
         nav_msgs::Odometry::ConstPtr pose_msg = NULL;
 
-        // find out the messages with same time stamp
-        m_buf.lock();
-        if(!image_buf.empty() && !point_buf.empty() && !pose_buf.empty())
         {
-            if (image_buf.front()->header.stamp.toSec() > pose_buf.front()->header.stamp.toSec())
-            {
-                pose_buf.pop();
-                printf("throw pose at beginning\n");
-            }
-            else if (image_buf.front()->header.stamp.toSec() > point_buf.front()->header.stamp.toSec())
-            {
-                point_buf.pop();
-                printf("throw point at beginning\n");
-            }
-            else if (image_buf.back()->header.stamp.toSec() >= pose_buf.front()->header.stamp.toSec() 
-                && point_buf.back()->header.stamp.toSec() >= pose_buf.front()->header.stamp.toSec())
-            {
-                pose_msg = pose_buf.front();
-                pose_buf.pop();
-                while (!pose_buf.empty())
-                    pose_buf.pop();
-                while (image_buf.front()->header.stamp.toSec() < pose_msg->header.stamp.toSec())
-                    image_buf.pop();
-                image_msg = image_buf.front();
-                image_buf.pop();
-
-                while (point_buf.front()->header.stamp.toSec() < pose_msg->header.stamp.toSec())
-                    point_buf.pop();
-                point_msg = point_buf.front();
-                point_buf.pop();
-            }
+            std::unique_lock<std::mutex> lock(m_buf);
+            con_buf.wait(lock, [&] { return associate(image_msg, point_msg, pose_msg); });
         }
-        m_buf.unlock();
 
-        if (pose_msg != NULL)
+        //printf(" pose time %f \n", pose_msg->header.stamp.toSec());
+        //printf(" point time %f \n", point_msg->header.stamp.toSec());
+        //printf(" image time %f \n", image_msg->header.stamp.toSec());
+        // skip fisrt few
+        if (skip_first_cnt < SKIP_FIRST_CNT)
         {
-            //printf(" pose time %f \n", pose_msg->header.stamp.toSec());
-            //printf(" point time %f \n", point_msg->header.stamp.toSec());
-            //printf(" image time %f \n", image_msg->header.stamp.toSec());
-            // skip fisrt few
-            if (skip_first_cnt < SKIP_FIRST_CNT)
-            {
-                skip_first_cnt++;
-                continue;
-            }
+            skip_first_cnt++;
+            continue;
+        }
 
-            if (skip_cnt < SKIP_CNT)
-            {
-                skip_cnt++;
-                continue;
-            }
-            else
-            {
-                skip_cnt = 0;
-            }
+        if (skip_cnt < SKIP_CNT)
+        {
+            skip_cnt++;
+            continue;
+        }
+        else
+        {
+            skip_cnt = 0;
+        }
 
-            cv_bridge::CvImageConstPtr ptr;
-            if (image_msg->encoding == "8UC1")
+        VINS_TRACE_FRAME("process", pose_msg->header.stamp.toSec());
+
+        // build keyframe
+        Vector3d T = Vector3d(pose_msg->pose.pose.position.x,
+                              pose_msg->pose.pose.position.y,
+                              pose_msg->pose.pose.position.z);
+        Matrix3d R = Quaterniond(pose_msg->pose.pose.orientation.w,
+                                 pose_msg->pose.pose.orientation.x,
+                                 pose_msg->pose.pose.orientation.y,
+                                 pose_msg->pose.pose.orientation.z).toRotationMatrix();
+        if ((T - last_t).norm() <= SKIP_DIS)
+            continue;
+
+        vector<cv::Point3f> point_3d; 
+        vector<cv::Point2f> point_2d_uv; 
+        vector<cv::Point2f> point_2d_normal;
+        vector<double> point_id;
+
+        // x, y, z, u, v, px, py in float32 and the feature id in float64, see vins_estimator pubKeyframe
+        size_t n = point_msg->width * point_msg->height;
+        point_3d.reserve(n);
+        point_2d_uv.reserve(n);
+        point_2d_normal.reserve(n);
+        point_id.reserve(n);
+        if (n > 0)
+        {
+            sensor_msgs::PointCloud2ConstIterator<float> in(*point_msg, "x");
+            sensor_msgs::PointCloud2ConstIterator<double> in_id(*point_msg, "id");
+            for (size_t i = 0; i < n; i++, ++in, ++in_id)
             {
-                sensor_msgs::Image img;
-                img.header = image_msg->header;
-                img.height = image_msg->height;
-                img.width = image_msg->width;
-                img.is_bigendian = image_msg->is_bigendian;
-                img.step = image_msg->step;
-                img.data = image_msg->data;
-                img.encoding = "mono8";
-                ptr = cv_bridge::toCvCopy(img, sensor_msgs::image_encodings::MONO8);
+                point_3d.push_back(cv::Point3f(in[0], in[1], in[2]));
+                point_2d_normal.push_back(cv::Point2f(in[3], in[4]));
+                point_2d_uv.push_back(cv::Point2f(in[5], in[6]));
+                point_id.push_back(*in_id);
             }
-            else
-                ptr = cv_bridge::toCvCopy(image_msg, sensor_msgs::image_encodings::MONO8);
-            
+        }
+
+        if (KEYFRAME_WORKERS > 0)
+        {
+            double stamp = pose_msg->header.stamp.toSec();
+            int index = frame_index, seq = sequence;
+            std::unique_lock<std::mutex> lock(m_keyframe);
+            keyframe_cv.wait(lock, [] { return (int)keyframe_buf.size() < KEYFRAME_WORKERS; });
+            // the image is converted by the worker, a shared message stays alive in ptr until the
+            // keyframe has read it
+            keyframe_buf.push(std::async(std::launch::async, [=]() mutable {
+                cv_bridge::CvImageConstPtr ptr = keyframeImage(image_msg);
+                cv::Mat frame = ptr->image;
+                return new KeyFrame(stamp, index, T, R, frame, point_3d, point_2d_uv, point_2d_normal,
+                                    point_id, seq);
+            }));
+            keyframe_cv.notify_all();
+        }
+        else
+        {
+            cv_bridge::CvImageConstPtr ptr = keyframeImage(image_msg);
             cv::Mat image = ptr->image;
-            // build keyframe
-            Vector3d T = Vector3d(pose_msg->pose.pose.position.x,
-                                  pose_msg->pose.pose.position.y,
-                                  pose_msg->pose.pose.position.z);
-            Matrix3d R = Quaterniond(pose_msg->pose.pose.orientation.w,
-                                     pose_msg->pose.pose.orientation.x,
-                                     pose_msg->pose.pose.orientation.y,
-                                     pose_msg->pose.pose.orientation.z).toRotationMatrix();
-            if((T - last_t).norm() > SKIP_DIS)
-            {
-                vector<cv::Point3f> point_3d; 
-                vector<cv::Point2f> point_2d_uv; 
-                vector<cv::Point2f> point_2d_normal;
-                vector<double> point_id;
-
-                for (unsigned int i = 0; i < point_msg->points.size(); i++)
-                {
-                    cv::Point3f p_3d;
-                    p_3d.x = point_msg->points[i].x;
-                    p_3d.y = point_msg->points[i].y;
-                    p_3d.z = point_msg->points[i].z;
-                    point_3d.push_back(p_3d);
-
-                    cv::Point2f p_2d_uv, p_2d_normal;
-                    double p_id;
-                    p_2d_normal.x = point_msg->channels[i].values[0];
-                    p_2d_normal.y = point_msg->channels[i].values[1];
-                    p_2d_uv.x = point_msg->channels[i].values[2];
-                    p_2d_uv.y = point_msg->channels[i].values[3];
-                    p_id = point_msg->channels[i].values[4];
-                    point_2d_normal.push_back(p_2d_normal);
-                    point_2d_uv.push_back(p_2d_uv);
-                    point_id.push_back(p_id);
-
-                    //printf("u %f, v %f \n", p_2d_uv.x, p_2d_uv.y);
-                }
-
-                KeyFrame* keyframe = new KeyFrame(pose_msg->header.stamp.toSec(), frame_index, T, R, image,
-                                   point_3d, point_2d_uv, point_2d_normal, point_id, sequence);   
-                m_process.lock();
-                start_flag = 1;
-                posegraph.addKeyFrame(keyframe, 1);
-                m_process.unlock();
-                frame_index++;
-                last_t = T;
-            }
+            KeyFrame* keyframe = new KeyFrame(pose_msg->header.stamp.toSec(), frame_index, T, R, image,
+                               point_3d, point_2d_uv, point_2d_normal, point_id, sequence);   
+            addLiveKeyFrame(keyframe);
         }
-        std::chrono::milliseconds dura(5);
-        std::this_thread::sleep_for(dura);
+        frame_index++;
+        last_t = T;
+    }
+}
+
+// adds the keyframes built for process() to the pose graph, oldest first, while the next ones
+// are still being built
+void commit()
+{
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(m_keyframe);
+        keyframe_cv.wait(lock, [] { return !keyframe_buf.empty(); });
+        // push does not move the queued futures, the front one can be waited for unlocked
+        std::future<KeyFrame*> &front = keyframe_buf.front();
+        lock.unlock();
+        KeyFrame* keyframe = front.get();
+        lock.lock();
+        keyframe_buf.pop();
+        keyframe_cv.notify_all();
+        lock.unlock();
+
+        addLiveKeyFrame(keyframe);
+    }
+}
+
+// Loads the previous pose graph on its own thread while the live keyframes are already being
+// built. The map keyframes take the first indices, the live ones that were built meanwhile are
+// added after them.
+void loadMap()
+{
+    posegraph.loadPoseGraph();
+    m_process.lock();
+    printf("load pose graph finish, adding %d keyframes built meanwhile\n", (int)pending_keyframes.size());
+    for (KeyFrame* keyframe : pending_keyframes)
+    {
+        if (LOCALIZATION_ONLY)
+            posegraph.localizeKeyFrame(keyframe);
+        else
+            posegraph.addKeyFrame(keyframe, 1);
     }
+    pending_keyframes.clear();
+    load_flag = 1;
+    m_process.unlock();
 }
 
 void command()
@@ -382,6 +500,9 @@ void command()
         char c = getchar();
         if (c == 's')
         {
+            // a map still loading would be saved cut short
+            while (!load_flag)
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
             m_process.lock();
             posegraph.savePoseGraph();
             m_process.unlock();
@@ -397,10 +518,27 @@ void command()
     }
 }
 
-int main(int argc, char **argv)
+ros::Subscriber sub_vio, sub_image, sub_pose, sub_extrinsic, sub_point, sub_margin_point, sub_gps;
+std::thread measurement_process;
+std::thread keyboard_command_process;
+std::thread keyframe_commit_process;
+
+static ThreadPlacement readThreadPlacement(cv::FileStorage &fsSettings, const std::string &name)
+{
+    ThreadPlacement placement;
+    std::string cpus;
+    if (!fsSettings["thread_" + name + "_cpus"].empty())
+        fsSettings["thread_" + name + "_cpus"] >> cpus;
+    if (!parseCpuList(cpus, placement.cpus))
+        ROS_WARN("thread_%s_cpus \"%s\" is not a cpu list like 2,3 or 4-7, not pinned", name.c_str(), cpus.c_str());
+    if (!fsSettings["thread_" + name + "_priority"].empty())
+        placement.priority = fsSettings["thread_" + name + "_priority"];
+    return placement;
+}
+
+// everything main does besides ros::init and spinning, shared with the nodelet
+void startLoopFusion(ros::NodeHandle &n, const string &config_file)
 {
-    ros::init(argc, argv, "loop_fusion");
-    ros::NodeHandle n("~");
     posegraph.registerPub(n);
     
     VISUALIZATION_SHIFT_X = 0;
@@ -408,17 +546,6 @@ int main(int argc, char **argv)
     SKIP_CNT = 0;
     SKIP_DIS = 0;
 
-    if(argc != 2)
-    {
-        printf("please intput: rosrun loop_fusion loop_fusion_node [config file] \n"
-               "for example: rosrun loop_fusion loop_fusion_node "
-               "/home/tony-ws1/catkin_ws/src/VINS-Fusion/config/euroc/euroc_stereo_imu_config.yaml \n");
-        return 0;
-    }
-    
-    string config_file = argv[1];
-    printf("config_file: %s\n", argv[1]);
-
     cv::FileStorage fsSettings(config_file, cv::FileStorage::READ);
     if(!fsSettings.isOpened())
     {
@@ -436,10 +563,17 @@ int main(int argc, char **argv)
     std::string pkg_path = ros::package::getPath("loop_fusion");
     string vocabulary_file = pkg_path + "/../support_files/brief_k10L6.bin";
     cout << "vocabulary_file" << vocabulary_file << endl;
+    // the database takes it when the vocabulary is set
+    LOOP_MAX_POSTINGS = fsSettings["loop_max_postings"];
+    LOOP_DB_SHARDS = 1;
+    if (!fsSettings["loop_db_shards"].empty())
+        LOOP_DB_SHARDS = max((int)fsSettings["loop_db_shards"], 1);
     posegraph.loadVocabulary(vocabulary_file);
 
     BRIEF_PATTERN_FILE = pkg_path + "/../support_files/brief_pattern.yml";
     cout << "BRIEF_PATTERN_FILE" << BRIEF_PATTERN_FILE << endl;
+    // read the pattern now rather than with the first keyframe
+    BriefExtractor::shared();
 
     int pn = config_file.find_last_of('/');
     std::string configPath = config_file.substr(0, pn);
@@ -450,27 +584,79 @@ int main(int argc, char **argv)
     m_camera = camodocal::CameraFactory::instance()->generateCameraFromYamlFile(cam0Path.c_str());
 
     fsSettings["image0_topic"] >> IMAGE_TOPIC;        
+    USE_KEYFRAME_IMAGE = fsSettings["publish_keyframe_image"];
+    if (USE_KEYFRAME_IMAGE)
+        IMAGE_TOPIC = "/vins_estimator/keyframe_image";
     fsSettings["pose_graph_save_path"] >> POSE_GRAPH_SAVE_PATH;
     fsSettings["output_path"] >> VINS_RESULT_PATH;
     fsSettings["save_image"] >> DEBUG_IMAGE;
+    keyframe_images.configure(fsSettings["image_cache_size"], fsSettings["image_cache_jpeg_quality"]);
+    PATH_MAX_POSES = fsSettings["path_max_poses"];
+    LOOP_SEARCH_RADIUS = fsSettings["loop_search_radius"];
+    LOOP_CANDIDATES = fsSettings["loop_candidates"];
+    POSE_GRAPH_INCREMENTAL = fsSettings["pose_graph_incremental"];
+    RESIDENT_KEYFRAMES = fsSettings["resident_keyframes"];
+    KEYFRAME_WORKERS = fsSettings["keyframe_workers"];
+    LOOP_USE_GPU = fsSettings["loop_use_gpu"];
+#ifdef LOOP_FUSION_CUDA
+    if (LOOP_USE_GPU && !CudaKeyFrameExtractor::available())
+    {
+        ROS_WARN("loop_use_gpu: no CUDA device, keyframe features on the CPU");
+        LOOP_USE_GPU = 0;
+    }
+#else
+    if (LOOP_USE_GPU)
+    {
+        ROS_WARN("loop_use_gpu: loop_fusion built without OpenCV cudafeatures2d, keyframe features on the CPU");
+        LOOP_USE_GPU = 0;
+    }
+#endif
+    GPS_FUSION = fsSettings["gps_fusion"];
+    std::string GPS_TOPIC = "/gps";
+    if (!fsSettings["gps_topic"].empty())
+        fsSettings["gps_topic"] >> GPS_TOPIC;
+
+    int UNDISTORT_LUT_STEP = fsSettings["undistort_lut_step"];
+    int UNDISTORT_LUT_CACHE = fsSettings["undistort_lut_cache"];
+    std::string lut_file = VINS_RESULT_PATH + "/undistort_lut_cam0.yml";
+    if (!(UNDISTORT_LUT_STEP > 0 && UNDISTORT_LUT_CACHE && m_camera_lut.readFromFile(lut_file, m_camera, UNDISTORT_LUT_STEP)))
+    {
+        m_camera_lut.build(m_camera, UNDISTORT_LUT_STEP);
+        if (UNDISTORT_LUT_STEP > 0 && UNDISTORT_LUT_CACHE)
+            m_camera_lut.writeToFile(lut_file);
+    }
 
     LOAD_PREVIOUS_POSE_GRAPH = fsSettings["load_previous_pose_graph"];
+    LOCALIZATION_ONLY = fsSettings["localization_only"];
+    if (LOCALIZATION_ONLY && !LOAD_PREVIOUS_POSE_GRAPH)
+    {
+        ROS_WARN("localization_only needs a map from load_previous_pose_graph, building one instead");
+        LOCALIZATION_ONLY = 0;
+    }
+    TRACE_EVENTS = fsSettings["trace_events"];
+    if (TRACE_EVENTS > 0)
+        vins_trace::start(TRACE_EVENTS, VINS_RESULT_PATH + "/trace_loop.json", "loop_fusion");
     VINS_RESULT_PATH = VINS_RESULT_PATH + "/vio_loop.csv";
     std::ofstream fout(VINS_RESULT_PATH, std::ios::out);
     fout.close();
 
-    int USE_IMU = fsSettings["imu"];
+    USE_IMU = fsSettings["imu"];
+    if (GPS_FUSION && !USE_IMU)
+    {
+        ROS_WARN("gps_fusion needs the gravity aligned 4 DoF pose graph of an IMU configuration, gps ignored");
+        GPS_FUSION = 0;
+    }
     posegraph.setIMUFlag(USE_IMU);
+    placeThread(posegraph.t_optimization.native_handle(), "loop_optimize",
+                readThreadPlacement(fsSettings, "loop_optimization"));
+    ThreadPlacement process_placement = readThreadPlacement(fsSettings, "loop_process");
+    ThreadPlacement commit_placement = readThreadPlacement(fsSettings, "loop_commit");
     fsSettings.release();
 
     if (LOAD_PREVIOUS_POSE_GRAPH)
     {
         printf("load pose graph\n");
-        m_process.lock();
-        posegraph.loadPoseGraph();
-        m_process.unlock();
-        printf("load pose graph finish\n");
-        load_flag = 1;
+        std::thread(loadMap).detach();
     }
     else
     {
@@ -478,26 +664,53 @@ int main(int argc, char **argv)
         load_flag = 1;
     }
 
-    ros::Subscriber sub_vio = n.subscribe("/vins_estimator/odometry", 2000, vio_callback);
-    ros::Subscriber sub_image = n.subscribe(IMAGE_TOPIC, 2000, image_callback);
-    ros::Subscriber sub_pose = n.subscribe("/vins_estimator/keyframe_pose", 2000, pose_callback);
-    ros::Subscriber sub_extrinsic = n.subscribe("/vins_estimator/extrinsic", 2000, extrinsic_callback);
-    ros::Subscriber sub_point = n.subscribe("/vins_estimator/keyframe_point", 2000, point_callback);
-    ros::Subscriber sub_margin_point = n.subscribe("/vins_estimator/margin_cloud", 2000, margin_point_callback);
+    sub_vio = n.subscribe("/vins_estimator/odometry", 2000, vio_callback);
+    sub_image = n.subscribe(IMAGE_TOPIC, 2000, image_callback);
+    sub_pose = n.subscribe("/vins_estimator/keyframe_pose", 2000, pose_callback);
+    sub_extrinsic = n.subscribe("/vins_estimator/extrinsic", 2000, extrinsic_callback);
+    sub_point = n.subscribe("/vins_estimator/keyframe_point", 2000, point_callback);
+    sub_margin_point = n.subscribe("/vins_estimator/margin_cloud", 2000, margin_point_callback);
+    if (GPS_FUSION)
+        sub_gps = n.subscribe(GPS_TOPIC, 100, gps_callback);
 
     pub_match_img = n.advertise<sensor_msgs::Image>("match_image", 1000);
     pub_camera_pose_visual = n.advertise<visualization_msgs::MarkerArray>("camera_pose_visual", 1000);
-    pub_point_cloud = n.advertise<sensor_msgs::PointCloud>("point_cloud_loop_rect", 1000);
-    pub_margin_cloud = n.advertise<sensor_msgs::PointCloud>("margin_cloud_loop_rect", 1000);
+    pub_point_cloud = n.advertise<sensor_msgs::PointCloud2>("point_cloud_loop_rect", 1000);
+    pub_margin_cloud = n.advertise<sensor_msgs::PointCloud2>("margin_cloud_loop_rect", 1000);
     pub_odometry_rect = n.advertise<nav_msgs::Odometry>("odometry_rect", 1000);
-
-    std::thread measurement_process;
-    std::thread keyboard_command_process;
+    // gps_fusion: odometry_rect in the ENU frame of the first fix, as global_fusion publishes it
+    pub_global_odometry = n.advertise<nav_msgs::Odometry>("global_odometry", 1000);
 
     measurement_process = std::thread(process);
+    placeThread(measurement_process.native_handle(), "loop_process", process_placement);
     keyboard_command_process = std::thread(command);
+    if (KEYFRAME_WORKERS > 0)
+    {
+        keyframe_commit_process = std::thread(commit);
+        placeThread(keyframe_commit_process.native_handle(), "loop_commit", commit_placement);
+    }
+}
+
+#ifndef LOOP_FUSION_NODELET
+int main(int argc, char **argv)
+{
+    ros::init(argc, argv, "loop_fusion");
+    ros::NodeHandle n("~");
+
+    if(argc != 2)
+    {
+        printf("please intput: rosrun loop_fusion loop_fusion_node [config file] \n"
+               "for example: rosrun loop_fusion loop_fusion_node "
+               "/home/tony-ws1/catkin_ws/src/VINS-Fusion/config/euroc/euroc_stereo_imu_config.yaml \n");
+        return 0;
+    }
     
+    string config_file = argv[1];
+    printf("config_file: %s\n", argv[1]);
+
+    startLoopFusion(n, config_file);
     ros::spin();
 
     return 0;
 }
+#endif
@@ -204,6 +204,11 @@ void CameraPoseVisualization::reset() {
     //image.colors.clear();
 }
 
+void CameraPoseVisualization::truncate(size_t n) {
+	if (n < m_markers.size())
+		m_markers.resize(n);
+}
+
 void CameraPoseVisualization::publish_by( ros::Publisher &pub, const std_msgs::Header &header ) {
 	visualization_msgs::MarkerArray markerArray_msg;
 	//int k = (int)m_markers.size();
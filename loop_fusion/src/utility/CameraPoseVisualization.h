@@ -31,6 +31,9 @@ public:
 
 	void add_pose(const Eigen::Vector3d& p, const Eigen::Quaterniond& q);
 	void reset();
+	// markers so far, truncate drops the ones added after size() returned n
+	size_t size() const { return m_markers.size(); }
+	void truncate(size_t n);
 
 	void publish_by(ros::Publisher& pub, const std_msgs::Header& header);
 	void add_edge(const Eigen::Vector3d& p0, const Eigen::Vector3d& p1);
@@ -0,0 +1,45 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "cuda_extractor.h"
+
+CudaKeyFrameExtractor::CudaKeyFrameExtractor() : fast_th(-1)
+{
+    // the smoothing of BRIEF::compute, default border as cv::GaussianBlur
+    gaussian = cv::cuda::createGaussianFilter(CV_8UC1, CV_8UC1, cv::Size(9, 9), 2, 2);
+}
+
+bool CudaKeyFrameExtractor::available()
+{
+    return cv::cuda::getCudaEnabledDeviceCount() > 0;
+}
+
+CudaKeyFrameExtractor &CudaKeyFrameExtractor::shared()
+{
+    static CudaKeyFrameExtractor extractor;
+    return extractor;
+}
+
+void CudaKeyFrameExtractor::extract(const cv::Mat &image, int _fast_th, std::vector<cv::KeyPoint> &keypoints,
+                                    cv::Mat &smoothed)
+{
+    std::lock_guard<std::mutex> lock(m_extract);
+    if (fast.empty() || fast_th != _fast_th)
+    {
+        // no corner limit below what the CPU detector would return on a full frame
+        fast = cv::cuda::FastFeatureDetector::create(_fast_th, true, cv::FastFeatureDetector::TYPE_9_16, 20000);
+        fast_th = _fast_th;
+    }
+    d_image.upload(image, stream);
+    gaussian->apply(d_image, d_smoothed, stream);
+    fast->detectAsync(d_image, d_keypoints, cv::noArray(), stream);
+    d_smoothed.download(smoothed, stream);
+    stream.waitForCompletion();
+    fast->convert(d_keypoints, keypoints);
+}
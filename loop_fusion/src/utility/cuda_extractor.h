@@ -0,0 +1,39 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <opencv2/cudafeatures2d.hpp>
+#include <opencv2/cudafilters.hpp>
+
+// Keyframe corners and the image BRIEF samples, on the gpu (loop_use_gpu). The image is uploaded
+// once, FAST and the 9x9 sigma 2 gaussian of DVision::BRIEF run on it, and only the corners and
+// the smoothed image come back: the 256 tests per corner on the CPU are cheap next to the blur.
+// Keyframe workers build keyframes at the same time, they take turns on the one stream.
+class CudaKeyFrameExtractor
+{
+  public:
+    CudaKeyFrameExtractor();
+
+    // false when OpenCV sees no CUDA device
+    static bool available();
+    static CudaKeyFrameExtractor &shared();
+
+    void extract(const cv::Mat &image, int fast_th, std::vector<cv::KeyPoint> &keypoints, cv::Mat &smoothed);
+
+  private:
+    std::mutex m_extract;
+    cv::cuda::Stream stream;
+    cv::Ptr<cv::cuda::Filter> gaussian;
+    cv::Ptr<cv::cuda::FastFeatureDetector> fast;
+    int fast_th;
+    cv::cuda::GpuMat d_image, d_smoothed, d_keypoints;
+};
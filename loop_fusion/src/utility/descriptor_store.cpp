@@ -0,0 +1,90 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include "descriptor_store.h"
+
+static bool writeAll(int fd, const void *data, size_t bytes, int64_t offset)
+{
+    const char *p = (const char *)data;
+    while (bytes > 0)
+    {
+        ssize_t n = pwrite(fd, p, bytes, offset);
+        if (n <= 0)
+            return false;
+        p += n;
+        bytes -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void *data, size_t bytes, int64_t offset)
+{
+    char *p = (char *)data;
+    while (bytes > 0)
+    {
+        ssize_t n = pread(fd, p, bytes, offset);
+        if (n <= 0)
+            return false;
+        p += n;
+        bytes -= n;
+        offset += n;
+    }
+    return true;
+}
+
+DescriptorStore::DescriptorStore() : fd(-1), end(0)
+{
+}
+
+DescriptorStore::~DescriptorStore()
+{
+    if (fd >= 0)
+        close(fd);
+}
+
+int64_t DescriptorStore::write(const PoseGraphMap::KeyPointRecord *keypoints,
+                               const PoseGraphMap::DescriptorRecord *descriptors, uint32_t n)
+{
+    std::lock_guard<std::mutex> lock(m_write);
+    if (fd < 0)
+    {
+        const char *tmp = getenv("TMPDIR");
+        std::string path = std::string(tmp ? tmp : "/tmp") + "/vins_descriptors_XXXXXX";
+        fd = mkstemp(&path[0]);
+        if (fd < 0)
+        {
+            printf("can not create a descriptor store in %s\n", path.c_str());
+            return -1;
+        }
+        // the open file keeps it until the process ends
+        unlink(path.c_str());
+    }
+    int64_t offset = end;
+    if (!writeAll(fd, keypoints, n * sizeof(PoseGraphMap::KeyPointRecord), offset) ||
+        !writeAll(fd, descriptors, n * sizeof(PoseGraphMap::DescriptorRecord),
+                  offset + n * sizeof(PoseGraphMap::KeyPointRecord)))
+        return -1;
+    end += n * (sizeof(PoseGraphMap::KeyPointRecord) + sizeof(PoseGraphMap::DescriptorRecord));
+    return offset;
+}
+
+bool DescriptorStore::read(int64_t offset, uint32_t n, PoseGraphMap::KeyPointRecord *keypoints,
+                           PoseGraphMap::DescriptorRecord *descriptors) const
+{
+    if (fd < 0 || offset < 0)
+        return false;
+    return readAll(fd, keypoints, n * sizeof(PoseGraphMap::KeyPointRecord), offset) &&
+           readAll(fd, descriptors, n * sizeof(PoseGraphMap::DescriptorRecord),
+                   offset + n * sizeof(PoseGraphMap::KeyPointRecord));
+}
@@ -0,0 +1,37 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include "pose_graph_map.h"
+
+// Keypoints and descriptors of the keyframes that are not kept in memory, as the keypoint and
+// descriptor records of pose_graph.bin. A keyframe is written once, n keypoint records then n
+// descriptor records, and read back by its offset. The file is an unnamed temporary one, it is
+// created with the first write and gone with the process.
+class DescriptorStore
+{
+  public:
+    DescriptorStore();
+    ~DescriptorStore();
+
+    // offset of the records, -1 when the file can not be written
+    int64_t write(const PoseGraphMap::KeyPointRecord *keypoints, const PoseGraphMap::DescriptorRecord *descriptors,
+                  uint32_t n);
+    // the n records written at offset, reads can run on several threads
+    bool read(int64_t offset, uint32_t n, PoseGraphMap::KeyPointRecord *keypoints,
+              PoseGraphMap::DescriptorRecord *descriptors) const;
+
+  private:
+    std::mutex m_write;
+    int fd;
+    int64_t end;
+};
@@ -0,0 +1,50 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cmath>
+#include <eigen3/Eigen/Dense>
+
+// Latitude, longitude (degrees) and altitude on WGS84 to the east north up frame of the first fix,
+// through the earth centered frame as GeographicLib::LocalCartesian does.
+class EnuConverter
+{
+  public:
+    EnuConverter() : initialized(false) {}
+
+    Eigen::Vector3d forward(double latitude, double longitude, double altitude)
+    {
+        if (!initialized)
+        {
+            double lat = latitude * M_PI / 180, lon = longitude * M_PI / 180;
+            origin = ecef(latitude, longitude, altitude);
+            ecef_to_enu << -sin(lon), cos(lon), 0,
+                           -sin(lat) * cos(lon), -sin(lat) * sin(lon), cos(lat),
+                           cos(lat) * cos(lon), cos(lat) * sin(lon), sin(lat);
+            initialized = true;
+        }
+        return ecef_to_enu * (ecef(latitude, longitude, altitude) - origin);
+    }
+
+  private:
+    static Eigen::Vector3d ecef(double latitude, double longitude, double altitude)
+    {
+        const double a = 6378137.0, f = 1 / 298.257223563, e2 = f * (2 - f);
+        double lat = latitude * M_PI / 180, lon = longitude * M_PI / 180;
+        double n = a / sqrt(1 - e2 * sin(lat) * sin(lat));
+        return Eigen::Vector3d((n + altitude) * cos(lat) * cos(lon),
+                               (n + altitude) * cos(lat) * sin(lon),
+                               (n * (1 - e2) + altitude) * sin(lat));
+    }
+
+    bool initialized;
+    Eigen::Vector3d origin;
+    Eigen::Matrix3d ecef_to_enu;
+};
@@ -0,0 +1,100 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "image_cache.h"
+
+ImageCache::ImageCache() : capacity(0), quality(0)
+{
+}
+
+void ImageCache::configure(int _capacity, int _quality)
+{
+    std::lock_guard<std::mutex> lock(m_cache);
+    capacity = std::max(0, _capacity);
+    quality = std::min(100, std::max(0, _quality));
+}
+
+void ImageCache::put(int index, const cv::Mat &image)
+{
+    if (image.empty())
+    {
+        erase(index);
+        return;
+    }
+    // encoded outside the lock, the keyframe workers do this at the same time
+    Entry entry;
+    int q;
+    {
+        std::lock_guard<std::mutex> lock(m_cache);
+        q = quality;
+    }
+    if (q > 0)
+        cv::imencode(".jpg", image, entry.jpeg, std::vector<int>{cv::IMWRITE_JPEG_QUALITY, q});
+    else
+        entry.image = image.clone();
+
+    std::lock_guard<std::mutex> lock(m_cache);
+    auto it = entries.find(index);
+    if (it != entries.end())
+    {
+        order.erase(it->second.order);
+        entries.erase(it);
+    }
+    order.push_front(index);
+    entry.order = order.begin();
+    entries[index] = std::move(entry);
+    while (capacity > 0 && (int)entries.size() > capacity)
+    {
+        entries.erase(order.back());
+        order.pop_back();
+    }
+}
+
+bool ImageCache::get(int index, cv::Mat &image)
+{
+    std::vector<uchar> jpeg;
+    {
+        std::lock_guard<std::mutex> lock(m_cache);
+        auto it = entries.find(index);
+        if (it == entries.end())
+            return false;
+        order.splice(order.begin(), order, it->second.order);
+        if (it->second.jpeg.empty())
+        {
+            image = it->second.image;
+            return true;
+        }
+        jpeg = it->second.jpeg;
+    }
+    image = cv::imdecode(jpeg, cv::IMREAD_UNCHANGED);
+    return !image.empty();
+}
+
+void ImageCache::erase(int index)
+{
+    std::lock_guard<std::mutex> lock(m_cache);
+    auto it = entries.find(index);
+    if (it == entries.end())
+        return;
+    order.erase(it->second.order);
+    entries.erase(it);
+}
+
+void ImageCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_cache);
+    order.clear();
+    entries.clear();
+}
+
+int ImageCache::size()
+{
+    std::lock_guard<std::mutex> lock(m_cache);
+    return entries.size();
+}
@@ -0,0 +1,56 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Keyframe images for the debug output (save_image), by keyframe index. Holds at most capacity
+// images and drops the least recently used one first, so a long run does not keep every image.
+// With a jpeg quality the images are stored encoded, a few tens of kB instead of a full frame,
+// and decoded when they are read. Keyframes are built on several threads, every call locks.
+class ImageCache
+{
+  public:
+    ImageCache();
+
+    // capacity 0 keeps all images, quality 0 stores them uncompressed
+    void configure(int capacity, int quality);
+
+    // copies (or encodes) the image, an empty image removes the index
+    void put(int index, const cv::Mat &image);
+    // false when the image was never put or has been dropped, an uncompressed image is shared
+    // with the cache and only read
+    bool get(int index, cv::Mat &image);
+    void erase(int index);
+    void clear();
+    int size();
+
+  private:
+    typedef std::list<int> Order;
+    struct Entry
+    {
+        cv::Mat image;
+        std::vector<uchar> jpeg;
+        Order::iterator order;
+    };
+
+    std::mutex m_cache;
+    int capacity;
+    int quality;
+    // most recently used first
+    Order order;
+    std::unordered_map<int, Entry> entries;
+};
@@ -0,0 +1,122 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <algorithm>
+#include <future>
+#include "keyframe_database.h"
+
+using namespace DBoW2;
+
+KeyFrameDatabase::KeyFrameDatabase() : voc(NULL)
+{
+}
+
+KeyFrameDatabase::~KeyFrameDatabase()
+{
+    shards.clear();
+    delete voc;
+}
+
+void KeyFrameDatabase::setVocabulary(BriefVocabulary *_voc, int shard_num, unsigned int max_postings)
+{
+    shards.clear();
+    entries.clear();
+    delete voc;
+    voc = _voc;
+    for (int i = 0; i < std::max(shard_num, 1); i++)
+    {
+        shards.emplace_back(new Shard());
+        shards.back()->db.shareVocabulary(voc);
+        shards.back()->db.setMaxPostings(max_postings);
+    }
+}
+
+void KeyFrameDatabase::transform(const std::vector<DVision::BRIEF::bitset> &descriptors, BowVector &bowvec) const
+{
+    voc->transform(descriptors, bowvec);
+}
+
+void KeyFrameDatabase::add(int index, int sequence, const BowVector &bowvec)
+{
+    int s = shardOf(sequence);
+    Shard &shard = *shards[s];
+    EntryId entry = shard.db.add(bowvec);
+    shard.indices.push_back(index);
+    if (index >= (int)entries.size())
+        entries.resize(index + 1, std::make_pair(-1, -1));
+    entries[index] = std::make_pair(s, (int)entry);
+}
+
+void KeyFrameDatabase::queryShard(const Shard &shard, const BowVector &bowvec, QueryResults &ret, int max_results,
+                                  int max_index) const
+{
+    ret.clear();
+    int max_entry = -1;
+    if (max_index >= 0)
+    {
+        // the entries of the shard up to max_index, none at all is not the "all" of max_id < 0
+        max_entry = std::upper_bound(shard.indices.begin(), shard.indices.end(), max_index) - shard.indices.begin() - 1;
+        if (max_entry < 0)
+            return;
+    }
+    shard.db.query(bowvec, ret, max_results, max_entry);
+    for (Result &r : ret)
+        r.Id = shard.indices[r.Id];
+}
+
+void KeyFrameDatabase::query(const BowVector &bowvec, QueryResults &ret, int max_results, int max_index) const
+{
+    if (shards.size() == 1)
+    {
+        queryShard(*shards[0], bowvec, ret, max_results, max_index);
+        return;
+    }
+    // every shard has its best max_results, the best max_results of all are among them
+    std::vector<QueryResults> shard_ret(shards.size());
+    std::vector<std::future<void>> pending;
+    for (size_t s = 1; s < shards.size(); s++)
+        pending.push_back(std::async(std::launch::async, [&, s]() {
+            queryShard(*shards[s], bowvec, shard_ret[s], max_results, max_index);
+        }));
+    queryShard(*shards[0], bowvec, shard_ret[0], max_results, max_index);
+    for (std::future<void> &f : pending)
+        f.get();
+
+    ret.clear();
+    for (const QueryResults &r : shard_ret)
+        ret.insert(ret.end(), r.begin(), r.end());
+    std::stable_sort(ret.begin(), ret.end(), Result::gt);
+    if (max_results > 0 && (int)ret.size() > max_results)
+        ret.resize(max_results);
+}
+
+void KeyFrameDatabase::getBowVectors(std::vector<BowVector> &vecs) const
+{
+    std::vector<std::vector<BowVector>> shard_vecs(shards.size());
+    for (size_t s = 0; s < shards.size(); s++)
+        shards[s]->db.getBowVectors(shard_vecs[s]);
+    vecs.clear();
+    vecs.resize(entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+        if (entries[i].first >= 0)
+            vecs[i].swap(shard_vecs[entries[i].first][entries[i].second]);
+}
+
+void KeyFrameDatabase::reserve(int sequence, const std::vector<unsigned int> &word_entries)
+{
+    shards[shardOf(sequence)]->db.reserve(word_entries);
+}
+
+size_t KeyFrameDatabase::memoryBytes() const
+{
+    size_t bytes = entries.capacity() * sizeof(entries[0]);
+    for (const std::unique_ptr<Shard> &shard : shards)
+        bytes += sizeof(Shard) + shard->db.memoryBytes() + shard->indices.capacity() * sizeof(int);
+    return bytes;
+}
@@ -0,0 +1,62 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+#include "../ThirdParty/DBoW/DBoW2.h"
+#include "../ThirdParty/DVision/DVision.h"
+
+// The loop database of the pose graph, split by sequence into shards: the keyframes of sequence s
+// go to shard s % shards, a BriefDatabase with its own inverted file on the one vocabulary. A
+// query runs on every shard, on a thread per shard when there are several, and the results are
+// merged best first. Ids in and out are keyframe indices, so the sessions of a multi-session
+// graph are searched together while each shard's rows only grow with its own sessions.
+class KeyFrameDatabase
+{
+  public:
+    KeyFrameDatabase();
+    ~KeyFrameDatabase();
+
+    // takes voc; shards >= 1, max_postings as in BriefDatabase::setMaxPostings
+    void setVocabulary(BriefVocabulary *voc, int shards, unsigned int max_postings);
+    const BriefVocabulary *getVocabulary() const { return voc; }
+
+    void transform(const std::vector<DVision::BRIEF::bitset> &descriptors, DBoW2::BowVector &bowvec) const;
+    // keyframes come in increasing index order
+    void add(int index, int sequence, const DBoW2::BowVector &bowvec);
+    // the keyframes up to max_index, all of them for max_index < 0; Id is the keyframe index
+    void query(const DBoW2::BowVector &bowvec, DBoW2::QueryResults &ret, int max_results, int max_index = -1) const;
+    // bow vector of every keyframe index below the last one added, empty for those not added
+    void getBowVectors(std::vector<DBoW2::BowVector> &vecs) const;
+    // rows of the shard of sequence for word_entries[w] more keyframes with word w
+    void reserve(int sequence, const std::vector<unsigned int> &word_entries);
+    // heap bytes of the shards and of the index, the vocabulary is not included
+    size_t memoryBytes() const;
+
+  private:
+    struct Shard
+    {
+        Shard() : db(false, 0) {}
+        BriefDatabase db;
+        std::vector<int> indices;  // keyframe index of each entry, increasing
+    };
+
+    // sequences are >= 0
+    int shardOf(int sequence) const { return sequence % (int)shards.size(); }
+    void queryShard(const Shard &shard, const DBoW2::BowVector &bowvec, DBoW2::QueryResults &ret, int max_results,
+                    int max_index) const;
+
+    BriefVocabulary *voc;
+    std::vector<std::unique_ptr<Shard>> shards;
+    // per keyframe index its shard and entry, (-1, -1) when it is not in the database
+    std::vector<std::pair<int, int>> entries;
+};
@@ -0,0 +1,45 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+// Parameter blocks of a growing problem, one row of ROW doubles per variable, stored in
+// contiguous chunks of CHUNK rows. A row never moves once handed out, so ceres can keep pointing
+// to it while rows are added, and clear() keeps the chunks: a rebuilt problem reuses the memory
+// of the last one instead of allocating again.
+template <int ROW, int CHUNK = 1024>
+class ParameterBlockPool
+{
+  public:
+    ParameterBlockPool() : count(0) {}
+
+    int size() const { return count; }
+    void clear() { count = 0; }
+
+    // a new row of zeros at the end
+    double *push_back()
+    {
+        if (count == (int)chunks.size() * CHUNK)
+            chunks.emplace_back(new double[ROW * CHUNK]);
+        double *row = (*this)[count++];
+        std::fill(row, row + ROW, 0.0);
+        return row;
+    }
+
+    double *operator[](int i) { return chunks[i / CHUNK].get() + (i % CHUNK) * ROW; }
+    const double *operator[](int i) const { return chunks[i / CHUNK].get() + (i % CHUNK) * ROW; }
+
+  private:
+    std::vector<std::unique_ptr<double[]>> chunks;
+    int count;
+};
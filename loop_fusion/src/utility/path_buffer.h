@@ -0,0 +1,56 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <nav_msgs/Path.h>
+#include <geometry_msgs/PoseStamped.h>
+
+// Appends a pose to path keeping at most max_poses of them, 0 keeps all. Once full every second
+// pose of the older half is dropped: the recent track stays at full rate, the history thins out
+// the older it gets, and the cost stays constant per pose on average.
+template <typename T>
+inline void decimate(std::vector<T> &poses, size_t max_poses)
+{
+    if (max_poses == 0 || poses.size() <= max_poses)
+        return;
+    size_t half = poses.size() / 2, j = 0;
+    for (size_t i = 0; i < poses.size(); i++)
+        if (i >= half || i % 2 == 0)
+            poses[j++] = std::move(poses[i]);
+    poses.resize(j);
+}
+
+inline void appendDecimated(nav_msgs::Path &path, const geometry_msgs::PoseStamped &pose, size_t max_poses)
+{
+    path.poses.push_back(pose);
+    decimate(path.poses, max_poses);
+}
+
+// Same, index holds the keyframe index of every pose of path and is thinned out with it, so the
+// poses of the moved keyframes can be cut off again with truncatePath.
+inline void appendDecimated(nav_msgs::Path &path, std::vector<int> &index, const geometry_msgs::PoseStamped &pose,
+                            int keyframe_index, size_t max_poses)
+{
+    path.poses.push_back(pose);
+    index.push_back(keyframe_index);
+    decimate(path.poses, max_poses);
+    decimate(index, max_poses);
+}
+
+// Drops the poses of the keyframes from first_index on, index is in increasing order.
+inline void truncatePath(nav_msgs::Path &path, std::vector<int> &index, int first_index)
+{
+    size_t n = std::lower_bound(index.begin(), index.end(), first_index) - index.begin();
+    path.poses.resize(std::min(n, path.poses.size()));
+    index.resize(n);
+}
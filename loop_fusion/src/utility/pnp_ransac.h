@@ -0,0 +1,228 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <eigen3/Eigen/Dense>
+#include <opencv2/core/core.hpp>
+
+// Camera pose from world points and their normalized image points, for loop verification against
+// a visual-inertial prior. The world frame is gravity aligned and the prior is only off by the
+// drift a VIO can have, a yaw about z and a translation, so a hypothesis takes 2 points instead
+// of the 3 of P3P. The prior is scored first, hypotheses are dropped as soon as they cannot beat
+// the best one, the iteration count adapts to the inlier ratio and every new best model is
+// refined on its inliers (6 DoF Gauss-Newton on the reprojection error) before it is kept.
+class PnPRansac
+{
+  public:
+    // R_cw, t_cw: the prior on input, the refined pose on output. threshold is the reprojection
+    // error in normalized image units. Returns the inliers, 0 leaves the prior untouched.
+    static int solve(const std::vector<cv::Point3f> &pts_3d, const std::vector<cv::Point2f> &pts_norm,
+                     Eigen::Matrix3d &R_cw, Eigen::Vector3d &t_cw, double threshold, double confidence,
+                     std::vector<uchar> &status, int max_iterations = 100)
+    {
+        const int n = pts_3d.size();
+        status.assign(n, 0);
+        if (n < 2)
+            return 0;
+        std::vector<Eigen::Vector3d> X(n), x(n), u(n);
+        const Eigen::Matrix3d R_wc0 = R_cw.transpose();
+        for (int i = 0; i < n; i++)
+        {
+            X[i] = Eigen::Vector3d(pts_3d[i].x, pts_3d[i].y, pts_3d[i].z);
+            x[i] = Eigen::Vector3d(pts_norm[i].x, pts_norm[i].y, 1.0);
+            // bearing in the world frame as the prior rotates it, off by the yaw drift only
+            u[i] = R_wc0 * x[i];
+        }
+
+        const double threshold2 = threshold * threshold;
+        Eigen::Matrix3d best_R = R_cw;
+        Eigen::Vector3d best_t = t_cw;
+        int best_inliers = score(best_R, best_t, X, x, threshold2, n);
+        if (best_inliers >= 3)
+            localOptimization(X, x, threshold2, best_R, best_t, best_inliers);
+
+        std::mt19937 rng(0);
+        std::uniform_int_distribution<int> uniform(0, n - 1);
+        int iterations = std::min(max_iterations, needed(best_inliers, n, confidence, max_iterations));
+        for (int it = 0; it < iterations; it++)
+        {
+            int a = uniform(rng), b;
+            do
+                b = uniform(rng);
+            while (b == a);
+            double yaw[2];
+            Eigen::Vector3d t_wc[2];
+            int solutions = solveYawTranslation(X[a], X[b], u[a], u[b], yaw, t_wc);
+            for (int k = 0; k < solutions; k++)
+            {
+                Eigen::Matrix3d R = (Eigen::AngleAxisd(yaw[k], Eigen::Vector3d::UnitZ()) * R_wc0).transpose();
+                Eigen::Vector3d t = -R * t_wc[k];
+                int inliers = score(R, t, X, x, threshold2, n - best_inliers);
+                if (inliers <= best_inliers)
+                    continue;
+                localOptimization(X, x, threshold2, R, t, inliers);
+                best_R = R;
+                best_t = t;
+                best_inliers = inliers;
+                iterations = std::min(iterations, std::max(needed(best_inliers, n, confidence, max_iterations), it + 1));
+            }
+        }
+        if (best_inliers < 3)
+            return 0;
+
+        R_cw = best_R;
+        t_cw = best_t;
+        best_inliers = 0;
+        for (int i = 0; i < n; i++)
+        {
+            status[i] = reprojectionError2(R_cw, t_cw, X[i], x[i]) < threshold2;
+            best_inliers += status[i];
+        }
+        return best_inliers;
+    }
+
+  private:
+    static double reprojectionError2(const Eigen::Matrix3d &R, const Eigen::Vector3d &t,
+                                     const Eigen::Vector3d &X, const Eigen::Vector3d &x)
+    {
+        Eigen::Vector3d p = R * X + t;
+        if (p.z() <= 1e-6)
+            return INFINITY;
+        return (p.head<2>() / p.z() - x.head<2>()).squaredNorm();
+    }
+
+    // counts inliers, gives up once more than max_outliers have been seen
+    static int score(const Eigen::Matrix3d &R, const Eigen::Vector3d &t, const std::vector<Eigen::Vector3d> &X,
+                     const std::vector<Eigen::Vector3d> &x, double threshold2, int max_outliers)
+    {
+        int inliers = 0, outliers = 0;
+        for (size_t i = 0; i < X.size(); i++)
+        {
+            if (reprojectionError2(R, t, X[i], x[i]) < threshold2)
+                inliers++;
+            else if (++outliers > max_outliers)
+                return -1;
+        }
+        return inliers;
+    }
+
+    static int needed(int inliers, int n, double confidence, int max_iterations)
+    {
+        double w = double(inliers) / n;
+        double p_fail = 1.0 - w * w;
+        if (p_fail <= 0.0)
+            return 0;
+        if (p_fail >= 1.0)
+            return max_iterations;
+        return std::ceil(std::log(1.0 - confidence) / std::log(p_fail));
+    }
+
+    // yaw about z and camera position such that Rz(yaw) u_i points from t_wc to X_i, for i = 1, 2.
+    // X1 - X2 lies in the plane of the two rotated bearings: (X1 - X2) . Rz(yaw) (u1 x u2) = 0,
+    // A cos + B sin + C = 0, up to two solutions with both points in front.
+    static int solveYawTranslation(const Eigen::Vector3d &X1, const Eigen::Vector3d &X2, const Eigen::Vector3d &u1,
+                                   const Eigen::Vector3d &u2, double yaw[2], Eigen::Vector3d t_wc[2])
+    {
+        Eigen::Vector3d D = X1 - X2;
+        Eigen::Vector3d w = u1.cross(u2);
+        double A = D.x() * w.x() + D.y() * w.y();
+        double B = D.y() * w.x() - D.x() * w.y();
+        double C = D.z() * w.z();
+        double r = std::hypot(A, B);
+        if (r < 1e-12 || std::fabs(C) > r)
+            return 0;
+        double phi = std::atan2(B, A);
+        double delta = std::acos(-C / r);
+        int solutions = 0;
+        for (int k = 0; k < 2; k++)
+        {
+            double psi = k ? phi - delta : phi + delta;
+            Eigen::Matrix3d Rz = Eigen::AngleAxisd(psi, Eigen::Vector3d::UnitZ()).toRotationMatrix();
+            Eigen::Vector3d v1 = Rz * u1, v2 = Rz * u2;
+            // lambda1 v1 - lambda2 v2 = D
+            Eigen::Matrix<double, 3, 2> M;
+            M.col(0) = v1;
+            M.col(1) = -v2;
+            Eigen::Matrix2d MtM = M.transpose() * M;
+            if (std::fabs(MtM.determinant()) < 1e-12)
+                continue;
+            Eigen::Vector2d lambda = MtM.inverse() * (M.transpose() * D);
+            if (lambda(0) <= 0 || lambda(1) <= 0)
+                continue;
+            yaw[solutions] = psi;
+            t_wc[solutions] = 0.5 * (X1 - lambda(0) * v1 + X2 - lambda(1) * v2);
+            solutions++;
+            if (delta < 1e-12)
+                break;
+        }
+        return solutions;
+    }
+
+    // Gauss-Newton on the inliers of R, t; kept only if it has more inliers afterwards
+    static void localOptimization(const std::vector<Eigen::Vector3d> &X, const std::vector<Eigen::Vector3d> &x,
+                                  double threshold2, Eigen::Matrix3d &R, Eigen::Vector3d &t, int &inliers)
+    {
+        std::vector<int> idx;
+        for (size_t i = 0; i < X.size(); i++)
+            if (reprojectionError2(R, t, X[i], x[i]) < threshold2)
+                idx.push_back(i);
+        if (idx.size() < 3)
+            return;
+        Eigen::Matrix3d R_opt = R;
+        Eigen::Vector3d t_opt = t;
+        for (int iter = 0; iter < 5; iter++)
+        {
+            Eigen::Matrix<double, 6, 6> H = Eigen::Matrix<double, 6, 6>::Zero();
+            Eigen::Matrix<double, 6, 1> g = Eigen::Matrix<double, 6, 1>::Zero();
+            for (int i : idx)
+            {
+                Eigen::Vector3d RX = R_opt * X[i];
+                Eigen::Vector3d p = RX + t_opt;
+                if (p.z() <= 1e-6)
+                    continue;
+                double iz = 1.0 / p.z();
+                Eigen::Vector2d res = p.head<2>() * iz - x[i].head<2>();
+                Eigen::Matrix<double, 2, 3> J_proj;
+                J_proj << iz, 0, -p.x() * iz * iz,
+                          0, iz, -p.y() * iz * iz;
+                // left perturbation exp(w) R: dp/dw = -[RX]x, dp/dt = I
+                Eigen::Matrix3d RX_x;
+                RX_x << 0, -RX.z(), RX.y(),
+                        RX.z(), 0, -RX.x(),
+                        -RX.y(), RX.x(), 0;
+                Eigen::Matrix<double, 2, 6> J;
+                J.leftCols<3>() = -J_proj * RX_x;
+                J.rightCols<3>() = J_proj;
+                H += J.transpose() * J;
+                g += J.transpose() * res;
+            }
+            Eigen::Matrix<double, 6, 1> dx = -H.ldlt().solve(g);
+            if (!dx.allFinite())
+                return;
+            double angle = dx.head<3>().norm();
+            if (angle > 1e-12)
+                R_opt = Eigen::AngleAxisd(angle, dx.head<3>() / angle).toRotationMatrix() * R_opt;
+            t_opt += dx.tail<3>();
+            if (dx.squaredNorm() < 1e-16)
+                break;
+        }
+        int refined = score(R_opt, t_opt, X, x, threshold2, X.size());
+        if (refined >= inliers)
+        {
+            R = R_opt;
+            t = t_opt;
+            inliers = refined;
+        }
+    }
+};
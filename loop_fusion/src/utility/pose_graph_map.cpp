@@ -0,0 +1,105 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pose_graph_map.h"
+
+namespace PoseGraphMap
+{
+
+static const char MAGIC[8] = {'V', 'I', 'N', 'S', 'M', 'A', 'P', '\0'};
+
+static uint64_t align(uint64_t offset)
+{
+    return (offset + 63) & ~uint64_t(63);
+}
+
+Header layout(uint32_t keyframes, uint64_t keypoints, uint64_t words)
+{
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.keyframes = keyframes;
+    header.keypoints = keypoints;
+    header.words = words;
+    header.keyframe_offset = align(sizeof(Header));
+    header.keypoint_offset = align(header.keyframe_offset + keyframes * sizeof(KeyFrameRecord));
+    header.descriptor_offset = align(header.keypoint_offset + keypoints * sizeof(KeyPointRecord));
+    header.word_offset = align(header.descriptor_offset + keypoints * sizeof(DescriptorRecord));
+    header.file_size = header.word_offset + words * sizeof(WordRecord);
+    return header;
+}
+
+File::File() : data(NULL), size(0)
+{
+}
+
+File::~File()
+{
+    close();
+}
+
+bool File::open(const std::string &path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header))
+    {
+        ::close(fd);
+        return false;
+    }
+    size = st.st_size;
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        data = NULL;
+        return false;
+    }
+    // the load walks every section once front to back
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    // what a file of these counts has to look like, anything else is not read
+    const Header &h = header();
+    Header expected = layout(h.keyframes, h.keypoints, h.words);
+    if (memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.version != VERSION ||
+        memcmp(&h, &expected, sizeof(Header)) != 0 || h.file_size > size)
+    {
+        close();
+        return false;
+    }
+    const KeyFrameRecord *kf = keyframes();
+    for (uint32_t i = 0; i < h.keyframes; i++)
+    {
+        if (kf[i].first_keypoint + kf[i].keypoints > h.keypoints || kf[i].first_word + kf[i].words > h.words)
+        {
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void File::close()
+{
+    if (data)
+        munmap(data, size);
+    data = NULL;
+    size = 0;
+}
+
+}
@@ -0,0 +1,108 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// pose_graph.bin, the whole saved pose graph in one file: a header, then 64 byte aligned arrays of
+// the records below. A keyframe's keypoints, descriptors and bow words are the ranges starting at
+// first_keypoint and first_word. Everything is in the byte order of the machine that saved it.
+// The file is mapped read only, so loading is a copy out of the page cache.
+namespace PoseGraphMap
+{
+
+const uint32_t VERSION = 1;
+
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t keyframes;
+    uint64_t keypoints;
+    uint64_t words;
+    // byte offsets of the sections
+    uint64_t keyframe_offset;
+    uint64_t keypoint_offset;
+    uint64_t descriptor_offset;
+    uint64_t word_offset;
+    uint64_t file_size;
+};
+
+struct KeyFrameRecord
+{
+    int32_t index;
+    int32_t loop_index;
+    double time_stamp;
+    double vio_t[3];
+    double pg_t[3];
+    // w, x, y, z
+    double vio_q[4];
+    double pg_q[4];
+    double loop_info[8];
+    uint64_t first_keypoint;
+    uint64_t first_word;
+    uint32_t keypoints;
+    uint32_t words;
+};
+
+struct KeyPointRecord
+{
+    float x, y;
+    float x_norm, y_norm;
+};
+
+// 256 bit BRIEF descriptor, bit i is bit i % 64 of word i / 64
+struct DescriptorRecord
+{
+    uint64_t words[4];
+};
+
+// one word of the keyframe's bow vector, the loop database is rebuilt from them without
+// transforming the descriptors again
+struct WordRecord
+{
+    uint32_t id;
+    uint32_t pad;
+    double weight;
+};
+
+// Header with the section offsets for the given sizes.
+Header layout(uint32_t keyframes, uint64_t keypoints, uint64_t words);
+
+// Read only mapping of a pose_graph.bin, the arrays stay valid until close().
+class File
+{
+  public:
+    File();
+    ~File();
+
+    // false when the file is missing, of another version or cut short
+    bool open(const std::string &path);
+    void close();
+
+    const Header &header() const { return *(const Header *)data; }
+    const KeyFrameRecord *keyframes() const { return section<KeyFrameRecord>(header().keyframe_offset); }
+    const KeyPointRecord *keypoints() const { return section<KeyPointRecord>(header().keypoint_offset); }
+    const DescriptorRecord *descriptors() const { return section<DescriptorRecord>(header().descriptor_offset); }
+    const WordRecord *words() const { return section<WordRecord>(header().word_offset); }
+
+  private:
+    template <typename T> const T *section(uint64_t offset) const
+    {
+        return (const T *)((const char *)data + offset);
+    }
+
+    void *data;
+    size_t size;
+};
+
+}
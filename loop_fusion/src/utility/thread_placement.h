@@ -0,0 +1,99 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <ros/console.h>
+
+// Cores and SCHED_FIFO priority of one pipeline thread, from the thread_<name>_cpus and
+// thread_<name>_priority keys of the config.
+struct ThreadPlacement
+{
+    ThreadPlacement() : priority(0) {}
+
+    bool empty() const { return cpus.empty() && priority <= 0; }
+
+    std::vector<int> cpus;  // empty: wherever the scheduler puts it
+    int priority;           // SCHED_FIFO 1..99, 0: the default scheduler
+};
+
+// "2,3", "4-7" or a mix of both, "" for no cpus; false for anything else
+inline bool parseCpuList(const std::string &text, std::vector<int> &cpus)
+{
+    cpus.clear();
+    const char *p = text.c_str();
+    while (*p)
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+            return false;
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first || last >= CPU_SETSIZE)
+                return false;
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+        if (*p == ',')
+            p++;
+        else if (*p)
+            return false;
+    }
+    return true;
+}
+
+// names thread, 15 characters are kept, and pins and schedules it as placement asks. Works on any
+// thread of the process, the placement is kept by the threads it starts. What the kernel refuses
+// (SCHED_FIFO without CAP_SYS_NICE or an rtprio limit, cpus that are not online) is logged and the
+// thread runs on as it was
+inline bool placeThread(pthread_t thread, const char *name, const ThreadPlacement &placement)
+{
+    char short_name[16];
+    strncpy(short_name, name, sizeof(short_name) - 1);
+    short_name[sizeof(short_name) - 1] = 0;
+    pthread_setname_np(thread, short_name);
+
+    bool ok = true;
+    if (!placement.cpus.empty())
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : placement.cpus)
+            CPU_SET(cpu, &set);
+        int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+        if (err)
+        {
+            ROS_WARN("thread %s: cannot pin to its cpus: %s", short_name, strerror(err));
+            ok = false;
+        }
+    }
+    if (placement.priority > 0)
+    {
+        sched_param param;
+        param.sched_priority = placement.priority;
+        int err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+        if (err)
+        {
+            ROS_WARN("thread %s: cannot run SCHED_FIFO at %d: %s", short_name, placement.priority, strerror(err));
+            ok = false;
+        }
+    }
+    return ok;
+}
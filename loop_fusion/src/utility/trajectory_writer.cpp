@@ -0,0 +1,207 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+#include "trajectory_writer.h"
+
+static const char BINARY_MAGIC[8] = {'V', 'I', 'N', 'S', 'T', 'R', 'J', '1'};
+
+TrajectoryWriter::TrajectoryWriter()
+    : file(NULL), file_format(EUROC_CSV), velocity(true), truncate(false), truncate_row(0), rows(0),
+      stop(false)
+{
+}
+
+TrajectoryWriter::~TrajectoryWriter()
+{
+    close();
+}
+
+bool TrajectoryWriter::open(const std::string &path, Format format, bool with_velocity)
+{
+    close();
+    file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+    {
+        printf("can not create trajectory file %s\n", path.c_str());
+        return false;
+    }
+    file_path = path;
+    file_format = format;
+    velocity = with_velocity;
+    if (file_format == BINARY)
+        fwrite(BINARY_MAGIC, 1, sizeof(BINARY_MAGIC), file);
+    pending.clear();
+    offsets.clear();
+    truncate = false;
+    truncate_row = 0;
+    rows = 0;
+    stop = false;
+    thread = std::thread(&TrajectoryWriter::run, this);
+    return true;
+}
+
+void TrajectoryWriter::close()
+{
+    if (!thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lk(m);
+        stop = true;
+    }
+    con.notify_one();
+    thread.join();
+    if (file)
+        fclose(file);
+    file = NULL;
+}
+
+void TrajectoryWriter::write(double t, const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, const Eigen::Vector3d &V)
+{
+    std::lock_guard<std::mutex> lk(m);
+    pending.push_back(TrajectoryPose(t, P, Q, V));
+    rows++;
+}
+
+void TrajectoryWriter::rewrite(const std::vector<TrajectoryPose> &poses, size_t first)
+{
+    std::lock_guard<std::mutex> lk(m);
+    first = std::min(first, rows);
+    // rows before base are in the file or cut off at truncate_row already
+    size_t base = rows - pending.size();
+    if (first >= base)
+        pending.resize(first - base);
+    else
+    {
+        pending.clear();
+        truncate = true;
+        truncate_row = first;
+    }
+    pending.insert(pending.end(), poses.begin(), poses.end());
+    rows = first + poses.size();
+}
+
+void TrajectoryWriter::run()
+{
+    std::vector<TrajectoryPose> batch;
+    std::string text;
+    while (1)
+    {
+        bool restart, last;
+        size_t restart_row;
+        {
+            std::unique_lock<std::mutex> lk(m);
+            con.wait_for(lk, std::chrono::milliseconds(100), [this] { return stop; });
+            batch.swap(pending);
+            restart = truncate;
+            restart_row = truncate_row;
+            truncate = false;
+            last = stop;
+        }
+        long end = ftell(file);
+        if (restart && restart_row < offsets.size())
+        {
+            end = offsets[restart_row];
+            offsets.resize(restart_row);
+            if (ftruncate(fileno(file), end) != 0 || fseek(file, end, SEEK_SET) != 0)
+                return;
+        }
+        if (!batch.empty())
+        {
+            if (file_format == BINARY)
+            {
+                for (size_t i = 0; i < batch.size(); i++)
+                    offsets.push_back(end + i * sizeof(TrajectoryPose));
+                fwrite(batch.data(), sizeof(TrajectoryPose), batch.size(), file);
+            }
+            else
+            {
+                text.clear();
+                for (const TrajectoryPose &pose : batch)
+                {
+                    offsets.push_back(end + text.size());
+                    format(pose, file_format, velocity, text);
+                }
+                fwrite(text.data(), 1, text.size(), file);
+            }
+            fflush(file);
+            batch.clear();
+        }
+        if (last)
+            return;
+    }
+}
+
+void TrajectoryWriter::format(const TrajectoryPose &pose, Format format, bool with_velocity, std::string &out)
+{
+    char line[512];
+    int n = 0;
+    switch (format)
+    {
+    case EUROC_CSV:
+        n = snprintf(line, sizeof(line), "%.0f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,%.5f,", pose.t * 1e9,
+                     pose.p[0], pose.p[1], pose.p[2], pose.q[0], pose.q[1], pose.q[2], pose.q[3]);
+        if (with_velocity)
+            n += snprintf(line + n, sizeof(line) - n, "%.5f,%.5f,%.5f,", pose.v[0], pose.v[1], pose.v[2]);
+        n += snprintf(line + n, sizeof(line) - n, "\n");
+        break;
+    case TUM:
+        n = snprintf(line, sizeof(line), "%.9f %.6f %.6f %.6f %.9f %.9f %.9f %.9f\n", pose.t,
+                     pose.p[0], pose.p[1], pose.p[2], pose.q[1], pose.q[2], pose.q[3], pose.q[0]);
+        break;
+    case KITTI:
+    {
+        Eigen::Matrix3d R = Eigen::Quaterniond(pose.q[0], pose.q[1], pose.q[2], pose.q[3]).toRotationMatrix();
+        n = snprintf(line, sizeof(line), "%f %f %f %f %f %f %f %f %f %f %f %f \n",
+                     R(0, 0), R(0, 1), R(0, 2), pose.p[0],
+                     R(1, 0), R(1, 1), R(1, 2), pose.p[1],
+                     R(2, 0), R(2, 1), R(2, 2), pose.p[2]);
+        break;
+    }
+    default:
+        return;
+    }
+    out.append(line, n);
+}
+
+bool TrajectoryWriter::exportText(const std::string &binary_path, const std::string &text_path, Format format,
+                                  bool with_velocity)
+{
+    if (format == BINARY)
+        return false;
+    FILE *in = fopen(binary_path.c_str(), "rb");
+    if (in == NULL)
+        return false;
+    char magic[sizeof(BINARY_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) || memcmp(magic, BINARY_MAGIC, sizeof(magic)) != 0)
+    {
+        fclose(in);
+        return false;
+    }
+    FILE *out = fopen(text_path.c_str(), "w");
+    if (out == NULL)
+    {
+        fclose(in);
+        return false;
+    }
+    TrajectoryPose pose;
+    std::string text;
+    while (fread(&pose, sizeof(pose), 1, in) == 1)
+    {
+        text.clear();
+        TrajectoryWriter::format(pose, format, with_velocity, text);
+        fwrite(text.data(), 1, text.size(), out);
+    }
+    fclose(in);
+    fclose(out);
+    return true;
+}
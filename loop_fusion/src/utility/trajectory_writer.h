@@ -0,0 +1,95 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/Geometry>
+
+struct TrajectoryPose
+{
+    TrajectoryPose() {}
+    TrajectoryPose(double _t, const Eigen::Vector3d &P, const Eigen::Quaterniond &Q,
+                   const Eigen::Vector3d &V = Eigen::Vector3d::Zero())
+        : t(_t), p{P.x(), P.y(), P.z()}, q{Q.w(), Q.x(), Q.y(), Q.z()}, v{V.x(), V.y(), V.z()}
+    {
+    }
+
+    double t;
+    double p[3];
+    // w, x, y, z
+    double q[4];
+    double v[3];
+};
+
+// Trajectory file kept open for the whole run. write() only copies the pose into a buffer, a
+// background thread formats and writes the buffered poses and flushes about every 100 ms, so the
+// caller never touches the file system.
+class TrajectoryWriter
+{
+  public:
+    enum Format
+    {
+        // t [ns], p, q (w x y z), v when with_velocity, comma separated, as the euroc ground truth
+        EUROC_CSV = 0,
+        // t [s] p q (x y z w), for evo / the tum tools
+        TUM = 1,
+        // first three rows of the 4x4 pose
+        KITTI = 2,
+        // 8 byte magic then raw TrajectoryPose records, see exportText
+        BINARY = 3
+    };
+
+    TrajectoryWriter();
+    ~TrajectoryWriter();
+
+    // truncates path, false when it can not be created
+    bool open(const std::string &path, Format format, bool with_velocity = true);
+    bool isOpen() const { return file != NULL; }
+    // writes what is buffered, then closes the file
+    void close();
+
+    void write(double t, const Eigen::Vector3d &P, const Eigen::Quaterniond &Q,
+               const Eigen::Vector3d &V = Eigen::Vector3d::Zero());
+    // replaces the poses from row first on, e.g. after a loop closure moved them, the rows before
+    // are kept in the file and only the tail is truncated and written again
+    void rewrite(const std::vector<TrajectoryPose> &poses, size_t first = 0);
+
+    // text export of a BINARY file
+    static bool exportText(const std::string &binary_path, const std::string &text_path, Format format,
+                           bool with_velocity = true);
+
+  private:
+    void run();
+    static void format(const TrajectoryPose &pose, Format format, bool with_velocity, std::string &out);
+
+    FILE *file;
+    std::string file_path;
+    Format file_format;
+    bool velocity;
+
+    std::mutex m;
+    std::condition_variable con;
+    std::vector<TrajectoryPose> pending;
+    // the file is cut at truncate_row before pending is written, rows counts what was written
+    // and what is pending
+    bool truncate;
+    size_t truncate_row;
+    size_t rows;
+    // file offset of every written row, only touched by the writer thread
+    std::vector<long> offsets;
+    bool stop;
+    std::thread thread;
+};
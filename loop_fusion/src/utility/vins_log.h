@@ -0,0 +1,73 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+
+// Logging of the per frame paths. VINS_LOG_LEVEL (set by cmake) selects what is compiled in:
+// 0 nothing, 1 warnings, 2 info, 3 debug. A compiled-in call site prints at most once per
+// VINS_LOG_PERIOD seconds, the calls in between cost one clock read. Start-up and shutdown
+// messages go on using printf / ROS_*.
+#ifndef VINS_LOG_LEVEL
+#define VINS_LOG_LEVEL 3
+#endif
+#ifndef VINS_LOG_PERIOD
+#define VINS_LOG_PERIOD 1.0
+#endif
+
+namespace vins_log
+{
+// true for the first call of a site in every period
+inline bool due(std::atomic<long long> &last)
+{
+    long long now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count();
+    long long prev = last.load(std::memory_order_relaxed);
+    if (now - prev < static_cast<long long>(VINS_LOG_PERIOD * 1e9))
+        return false;
+    return last.compare_exchange_strong(prev, now, std::memory_order_relaxed);
+}
+}
+
+#define VINS_LOG_RATE_LIMITED(...)                                                  \
+    do                                                                              \
+    {                                                                               \
+        static std::atomic<long long> vins_log_last(-1000000000000000000LL);       \
+        if (vins_log::due(vins_log_last))                                           \
+            printf(__VA_ARGS__);                                                    \
+    } while (0)
+
+// never runs, the arguments stay type checked and used
+#define VINS_LOG_NONE(...) \
+    do                     \
+    {                      \
+        if (0)             \
+            printf(__VA_ARGS__); \
+    } while (0)
+
+#if VINS_LOG_LEVEL >= 1
+#define VINS_WARN(...) VINS_LOG_RATE_LIMITED(__VA_ARGS__)
+#else
+#define VINS_WARN(...) VINS_LOG_NONE(__VA_ARGS__)
+#endif
+
+#if VINS_LOG_LEVEL >= 2
+#define VINS_INFO(...) VINS_LOG_RATE_LIMITED(__VA_ARGS__)
+#else
+#define VINS_INFO(...) VINS_LOG_NONE(__VA_ARGS__)
+#endif
+
+#if VINS_LOG_LEVEL >= 3
+#define VINS_DEBUG(...) VINS_LOG_RATE_LIMITED(__VA_ARGS__)
+#else
+#define VINS_DEBUG(...) VINS_LOG_NONE(__VA_ARGS__)
+#endif
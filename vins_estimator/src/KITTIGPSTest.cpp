@@ -19,6 +19,8 @@
 #include <sensor_msgs/NavSatFix.h>
 #include "estimator/estimator.h"
 #include "utility/visualization.h"
+#include "utility/trajectory_writer.h"
+#include "utility/prefetcher.h"
 
 using namespace std;
 using namespace Eigen;
@@ -26,6 +28,51 @@ using namespace Eigen;
 Estimator estimator;
 ros::Publisher pubGPS;
 
+struct KittiGPSFrame
+{
+	size_t index;
+	cv::Mat left, right;
+	sensor_msgs::NavSatFix gps;
+};
+
+// oxts/data/<index>.txt into the fix, stamped by the caller
+static bool readOxts(const string &path, sensor_msgs::NavSatFix &gps_position)
+{
+	FILE* GPSFile = std::fopen(path.c_str() , "r");
+	if(GPSFile == NULL){
+	    printf("cannot find file: %s\n", path.c_str());
+	    return false;
+	}
+	double lat, lon, alt, roll, pitch, yaw;
+	double vn, ve, vf, vl, vu;
+	double ax, ay, az, af, al, au;
+	double wx, wy, wz, wf, wl, wu;
+	double pos_accuracy, vel_accuracy;
+	double navstat, numsats;
+	double velmode, orimode;
+
+	int n = fscanf(GPSFile, "%lf %lf %lf %lf %lf %lf ", &lat, &lon, &alt, &roll, &pitch, &yaw);
+	n += fscanf(GPSFile, "%lf %lf %lf %lf %lf ", &vn, &ve, &vf, &vl, &vu);
+	n += fscanf(GPSFile, "%lf %lf %lf %lf %lf %lf ", &ax, &ay, &az, &af, &al, &au);
+	n += fscanf(GPSFile, "%lf %lf %lf %lf %lf %lf ", &wx, &wy, &wz, &wf, &wl, &wu);
+	n += fscanf(GPSFile, "%lf %lf %lf %lf %lf %lf ", &pos_accuracy, &vel_accuracy, &navstat, &numsats, &velmode, &orimode);
+	std::fclose(GPSFile);
+	if (n != 29)
+	{
+	    printf("cannot parse %s\n", path.c_str());
+	    return false;
+	}
+
+	gps_position.header.frame_id = "NED";
+	gps_position.status.status = navstat;
+	gps_position.status.service = numsats;
+	gps_position.latitude  = lat;
+	gps_position.longitude = lon;
+	gps_position.altitude  = alt;
+	gps_position.position_covariance[0] = pos_accuracy;
+	return true;
+}
+
 int main(int argc, char** argv)
 {
 	ros::init(argc, argv, "vins_estimator");
@@ -89,102 +136,49 @@ int main(int argc, char** argv)
 		std::fclose(file);
 	}
 
-	readParameters(config_file);
-	estimator.setParameter();
-	registerPub(n);
-
-	FILE* outFile;
-	outFile = fopen((OUTPUT_FOLDER + "/vio.txt").c_str(),"w");
-	if(outFile == NULL)
-		printf("Output path dosen't exist: %s\n", OUTPUT_FOLDER.c_str());
-	string leftImagePath, rightImagePath;
-	cv::Mat imLeft, imRight;
-	double baseTime;
-
-	for (size_t i = 0; i < imageTimeList.size(); i++)
-	{	
-		if(ros::ok())
+	Parameters params;
+	readParameters(config_file, params);
+	estimator.setParameter(params);
+	estimator.visualization.registerPub(n);
+
+	TrajectoryWriter outFile;
+	if(!outFile.open(estimator.params.OUTPUT_FOLDER + "/vio.txt", TrajectoryWriter::KITTI))
+		printf("Output path dosen't exist: %s\n", estimator.params.OUTPUT_FOLDER.c_str());
+	double baseTime = imageTimeList[0] < GPSTimeList[0] ? imageTimeList[0] : GPSTimeList[0];
+
+	// the pngs and the oxts text are read ahead on their own threads
+	Prefetcher<KittiGPSFrame> frames(imageTimeList.size(), [&dataPath](size_t i, KittiGPSFrame &frame)
+	{
+		stringstream ss;
+		ss << setfill('0') << setw(10) << i;
+		frame.index = i;
+		frame.left = cv::imread(dataPath + "image_00/data/" + ss.str() + ".png", cv::IMREAD_GRAYSCALE);
+		frame.right = cv::imread(dataPath + "image_01/data/" + ss.str() + ".png", cv::IMREAD_GRAYSCALE);
+		if (frame.left.empty() || frame.right.empty())
 		{
-			if(imageTimeList[0] < GPSTimeList[0])
-				baseTime = imageTimeList[0];
-			else
-				baseTime = GPSTimeList[0];
-			
-			//printf("base time is %f\n", baseTime);
-			printf("process image %d\n", (int)i);
-			stringstream ss;
-			ss << setfill('0') << setw(10) << i;
-			leftImagePath = dataPath + "image_00/data/" + ss.str() + ".png";
-			rightImagePath = dataPath + "image_01/data/" + ss.str() + ".png";
-			printf("%s\n", leftImagePath.c_str() );
-			printf("%s\n", rightImagePath.c_str() );
-
-			imLeft = cv::imread(leftImagePath, CV_LOAD_IMAGE_GRAYSCALE );
-			imRight = cv::imread(rightImagePath, CV_LOAD_IMAGE_GRAYSCALE );
-
-			double imgTime = imageTimeList[i] - baseTime;
-
-			// load gps
-			FILE* GPSFile;
-			string GPSFilePath = dataPath + "oxts/data/" + ss.str() + ".txt";
-			GPSFile = std::fopen(GPSFilePath.c_str() , "r");
-			if(GPSFile == NULL){
-			    printf("cannot find file: %s\n", GPSFilePath.c_str());
-			    ROS_BREAK();
-			    return 0;          
-			}
-			double lat, lon, alt, roll, pitch, yaw;
-			double vn, ve, vf, vl, vu;
-			double ax, ay, az, af, al, au;
-			double wx, wy, wz, wf, wl, wu;
-			double pos_accuracy, vel_accuracy;
-			double navstat, numsats;
-			double velmode, orimode;
-			
-			fscanf(GPSFile, "%lf %lf %lf %lf %lf %lf ", &lat, &lon, &alt, &roll, &pitch, &yaw);
-			//printf("lat:%lf lon:%lf alt:%lf roll:%lf pitch:%lf yaw:%lf \n",  lat, lon, alt, roll, pitch, yaw);
-			fscanf(GPSFile, "%lf %lf %lf %lf %lf ", &vn, &ve, &vf, &vl, &vu);
-			//printf("vn:%lf ve:%lf vf:%lf vl:%lf vu:%lf \n",  vn, ve, vf, vl, vu);
-			fscanf(GPSFile, "%lf %lf %lf %lf %lf %lf ", &ax, &ay, &az, &af, &al, &au);
-			//printf("ax:%lf ay:%lf az:%lf af:%lf al:%lf au:%lf\n",  ax, ay, az, af, al, au);
-			fscanf(GPSFile, "%lf %lf %lf %lf %lf %lf ", &wx, &wy, &wz, &wf, &wl, &wu);
-			//printf("wx:%lf wy:%lf wz:%lf wf:%lf wl:%lf wu:%lf\n",  wx, wy, wz, wf, wl, wu);
-			fscanf(GPSFile, "%lf %lf %lf %lf %lf %lf ", &pos_accuracy, &vel_accuracy, &navstat, &numsats, &velmode, &orimode);
-			//printf("pos_accuracy:%lf vel_accuracy:%lf navstat:%lf numsats:%lf velmode:%lf orimode:%lf\n", 
-			//	    pos_accuracy, vel_accuracy, navstat, numsats, velmode, orimode);
-
-			std::fclose(GPSFile);
-
-			sensor_msgs::NavSatFix gps_position;
-			gps_position.header.frame_id = "NED";
-			gps_position.header.stamp = ros::Time(imgTime);
-			gps_position.status.status = navstat;
-			gps_position.status.service = numsats;
-			gps_position.latitude  = lat;
-			gps_position.longitude = lon;
-			gps_position.altitude  = alt;
-			gps_position.position_covariance[0] = pos_accuracy;
-			//printf("pos_accuracy %f \n", pos_accuracy);
-			pubGPS.publish(gps_position);
-
-			estimator.inputImage(imgTime, imLeft, imRight);
-			
-			Eigen::Matrix<double, 4, 4> pose;
-			estimator.getPoseInWorldFrame(pose);
-			if(outFile != NULL)
-				fprintf (outFile, "%f %f %f %f %f %f %f %f %f %f %f %f \n",pose(0,0), pose(0,1), pose(0,2),pose(0,3),
-																	       pose(1,0), pose(1,1), pose(1,2),pose(1,3),
-																	       pose(2,0), pose(2,1), pose(2,2),pose(2,3));
-			
-			// cv::imshow("leftImage", imLeft);
-			// cv::imshow("rightImage", imRight);
-			// cv::waitKey(2);
+			printf("cannot read image %s of %s\n", ss.str().c_str(), dataPath.c_str());
+			return false;
 		}
-		else
-			break;
+		return readOxts(dataPath + "oxts/data/" + ss.str() + ".txt", frame.gps);
+	});
+
+	KittiGPSFrame frame;
+	while (ros::ok() && frames.next(frame))
+	{
+		printf("process image %d\n", (int)frame.index);
+		double imgTime = imageTimeList[frame.index] - baseTime;
+
+		frame.gps.header.stamp = ros::Time(imgTime);
+		pubGPS.publish(frame.gps);
+
+		estimator.inputImage(imgTime, frame.left, frame.right);
+
+		Eigen::Matrix<double, 4, 4> pose;
+		estimator.getPoseInWorldFrame(pose);
+		if(outFile.isOpen())
+			outFile.write(imgTime, pose.block<3, 1>(0, 3), Eigen::Quaterniond(Eigen::Matrix3d(pose.block<3, 3>(0, 0))));
 	}
-	if(outFile != NULL)
-		fclose (outFile);
+	outFile.close();
 	return 0;
 }
 
@@ -19,6 +19,8 @@
 #include <cv_bridge/cv_bridge.h>
 #include "estimator/estimator.h"
 #include "utility/visualization.h"
+#include "utility/trajectory_writer.h"
+#include "utility/prefetcher.h"
 
 using namespace std;
 using namespace Eigen;
@@ -28,6 +30,12 @@ Estimator estimator;
 Eigen::Matrix3d c1Rc0, c0Rc1;
 Eigen::Vector3d c1Tc0, c0Tc1;
 
+struct KittiFrame
+{
+	size_t index;
+	cv::Mat left, right;
+};
+
 int main(int argc, char** argv)
 {
 	ros::init(argc, argv, "vins_estimator");
@@ -52,9 +60,10 @@ int main(int argc, char** argv)
 	printf("read sequence: %s\n", argv[2]);
 	string dataPath = sequence + "/";
 
-	readParameters(config_file);
-	estimator.setParameter();
-	registerPub(n);
+	Parameters params;
+	readParameters(config_file, params);
+	estimator.setParameter(params);
+	estimator.visualization.registerPub(n);
 
 	// load image list
 	FILE* file;
@@ -72,54 +81,53 @@ int main(int argc, char** argv)
 	}
 	std::fclose(file);
 
-	string leftImagePath, rightImagePath;
-	cv::Mat imLeft, imRight;
-	FILE* outFile;
-	outFile = fopen((OUTPUT_FOLDER + "/vio.txt").c_str(),"w");
-	if(outFile == NULL)
-		printf("Output path dosen't exist: %s\n", OUTPUT_FOLDER.c_str());
+	TrajectoryWriter outFile;
+	if(!outFile.open(estimator.params.OUTPUT_FOLDER + "/vio.txt", TrajectoryWriter::KITTI))
+		printf("Output path dosen't exist: %s\n", estimator.params.OUTPUT_FOLDER.c_str());
 
-	for (size_t i = 0; i < imageTimeList.size(); i++)
-	{	
-		if(ros::ok())
+	// the pngs are decoded ahead on their own threads, the loop only waits for the estimator
+	Prefetcher<KittiFrame> frames(imageTimeList.size(), [&dataPath](size_t i, KittiFrame &frame)
+	{
+		stringstream ss;
+		ss << setfill('0') << setw(6) << i;
+		frame.index = i;
+		frame.left = cv::imread(dataPath + "image_0/" + ss.str() + ".png", cv::IMREAD_GRAYSCALE);
+		frame.right = cv::imread(dataPath + "image_1/" + ss.str() + ".png", cv::IMREAD_GRAYSCALE);
+		if (frame.left.empty() || frame.right.empty())
 		{
-			printf("\nprocess image %d\n", (int)i);
-			stringstream ss;
-			ss << setfill('0') << setw(6) << i;
-			leftImagePath = dataPath + "image_0/" + ss.str() + ".png";
-			rightImagePath = dataPath + "image_1/" + ss.str() + ".png";
-			//printf("%lu  %f \n", i, imageTimeList[i]);
-			//printf("%s\n", leftImagePath.c_str() );
-			//printf("%s\n", rightImagePath.c_str() );
-
-			imLeft = cv::imread(leftImagePath, CV_LOAD_IMAGE_GRAYSCALE );
-			sensor_msgs::ImagePtr imLeftMsg = cv_bridge::CvImage(std_msgs::Header(), "mono8", imLeft).toImageMsg();
+			printf("cannot read image %s of %s\n", ss.str().c_str(), dataPath.c_str());
+			return false;
+		}
+		return true;
+	});
+
+	KittiFrame frame;
+	while (ros::ok() && frames.next(frame))
+	{
+		size_t i = frame.index;
+		printf("\nprocess image %d\n", (int)i);
+
+		// only converted into messages while someone listens
+		if (pubLeftImage.getNumSubscribers() > 0)
+		{
+			sensor_msgs::ImagePtr imLeftMsg = cv_bridge::CvImage(std_msgs::Header(), "mono8", frame.left).toImageMsg();
 			imLeftMsg->header.stamp = ros::Time(imageTimeList[i]);
 			pubLeftImage.publish(imLeftMsg);
-
-			imRight = cv::imread(rightImagePath, CV_LOAD_IMAGE_GRAYSCALE );
-			sensor_msgs::ImagePtr imRightMsg = cv_bridge::CvImage(std_msgs::Header(), "mono8", imRight).toImageMsg();
+		}
+		if (pubRightImage.getNumSubscribers() > 0)
+		{
+			sensor_msgs::ImagePtr imRightMsg = cv_bridge::CvImage(std_msgs::Header(), "mono8", frame.right).toImageMsg();
 			imRightMsg->header.stamp = ros::Time(imageTimeList[i]);
 			pubRightImage.publish(imRightMsg);
+		}
 
+		estimator.inputImage(imageTimeList[i], frame.left, frame.right);
 
-			estimator.inputImage(imageTimeList[i], imLeft, imRight);
-			
-			Eigen::Matrix<double, 4, 4> pose;
-			estimator.getPoseInWorldFrame(pose);
-			if(outFile != NULL)
-				fprintf (outFile, "%f %f %f %f %f %f %f %f %f %f %f %f \n",pose(0,0), pose(0,1), pose(0,2),pose(0,3),
-																	       pose(1,0), pose(1,1), pose(1,2),pose(1,3),
-																	       pose(2,0), pose(2,1), pose(2,2),pose(2,3));
-			
-			//cv::imshow("leftImage", imLeft);
-			//cv::imshow("rightImage", imRight);
-			//cv::waitKey(2);
-		}
-		else
-			break;
+		Eigen::Matrix<double, 4, 4> pose;
+		estimator.getPoseInWorldFrame(pose);
+		if(outFile.isOpen())
+			outFile.write(imageTimeList[i], pose.block<3, 1>(0, 3), Eigen::Quaterniond(Eigen::Matrix3d(pose.block<3, 3>(0, 0))));
 	}
-	if(outFile != NULL)
-		fclose (outFile);
+	outFile.close();
 	return 0;
 }
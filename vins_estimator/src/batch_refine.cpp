@@ -0,0 +1,292 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+// Full-batch refinement of a run recorded with batch_log: one visual-inertial bundle adjustment
+// over every keyframe of the sequence, with the IMUFactor and projection factors of the window and
+// the landmarks kept, where loop_fusion only has the 4/6-DoF pose graph. The landmarks are
+// eliminated by the Schur complement and the reduced camera system is solved with a sparse
+// Cholesky, both on all cores.
+//
+// rosrun vins vins_batch_refine [config file] [batch log] [iterations]
+//   config file: the one of the run, for the noise densities, the residual model, the estimate
+//             flags and output_path
+//   batch log: default output_path/batch_log.bin
+//   iterations: default 50
+// Every segment (the keyframes between two resets of the estimator) is its own world frame with
+// its first pose held. Extrinsics and td are held unless estimate_extrinsic / estimate_td.
+// solver_threads sets the threads, default all cores. The refined keyframes go to
+// output_path/vio_batch.csv (euroc csv with velocity, as vio.csv).
+
+#include <stdio.h>
+#include <algorithm>
+#include <array>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <ceres/ceres.h>
+#include <ros/ros.h>
+#include "estimator/parameters.h"
+#include "estimator/batch_log.h"
+#include "factor/imu_factor.h"
+#include "factor/pose_local_parameterization.h"
+#include "factor/projectionLayoutFactor.h"
+#include "utility/tic_toc.h"
+#include "utility/trajectory_writer.h"
+
+using namespace std;
+using namespace Eigen;
+
+struct Landmark
+{
+    Landmark() : host(-1), camera(0), inv_depth(-1), has_guess(false) {}
+
+    int host, camera;
+    double inv_depth;
+    bool has_guess;
+    Vector3d guess;
+    // keyframe and observation, host first
+    vector<pair<int, const FeaturePerFrame *>> observations;
+};
+
+struct BatchProblem
+{
+    vector<BatchKeyframe> keyframes;
+    vector<array<double, SIZE_POSE>> pose;
+    vector<array<double, SIZE_SPEEDBIAS>> speed_bias;
+    double ex_pose[MAX_NUM_OF_CAM][SIZE_POSE];
+    double td[1];
+    // by segment and feature id
+    map<pair<int, FeatureId>, Landmark> landmarks;
+    vector<unique_ptr<IntegrationBase>> pre_integrations;
+};
+
+static void poseToBlock(const Vector3d &P, const Quaterniond &Q, double *block)
+{
+    block[0] = P.x();
+    block[1] = P.y();
+    block[2] = P.z();
+    block[3] = Q.x();
+    block[4] = Q.y();
+    block[5] = Q.z();
+    block[6] = Q.w();
+}
+
+template <class Residual>
+static int addProjectionFactors(ceres::Problem &problem, ceres::LossFunction *loss_function, BatchProblem &b,
+                                Landmark &l, bool stereo)
+{
+    const FeaturePerFrame &host = *l.observations[0].second;
+    double *ex_pose = b.ex_pose[l.camera];
+    int count = 0;
+    for (const pair<int, const FeaturePerFrame *> &o : l.observations)
+    {
+        const FeaturePerFrame &obs = *o.second;
+        int j = o.first;
+        if (j != l.host)
+        {
+            auto *f = new ProjectionLayoutFactor<TwoFrameOneCam, Residual>(host.point, obs.point, host.velocity, obs.velocity,
+                                                                           host.obs_td, obs.obs_td);
+            problem.AddResidualBlock(f, loss_function, b.pose[l.host].data(), b.pose[j].data(), ex_pose, &l.inv_depth, b.td);
+            count++;
+        }
+        if (stereo && obs.is_stereo)
+        {
+            if (j != l.host)
+            {
+                auto *f = new ProjectionLayoutFactor<TwoFrameTwoCam, Residual>(host.point, obs.pointRight, host.velocity,
+                                                                               obs.velocityRight, host.obs_td, obs.obs_tdRight);
+                problem.AddResidualBlock(f, loss_function, b.pose[l.host].data(), b.pose[j].data(), ex_pose, b.ex_pose[1],
+                                         &l.inv_depth, b.td);
+            }
+            else
+            {
+                auto *f = new ProjectionLayoutFactor<OneFrameTwoCam, Residual>(host.point, obs.pointRight, host.velocity,
+                                                                               obs.velocityRight, host.obs_td, obs.obs_tdRight);
+                problem.AddResidualBlock(f, loss_function, ex_pose, b.ex_pose[1], &l.inv_depth, b.td);
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 4)
+    {
+        printf("please intput: rosrun vins vins_batch_refine [config file] [batch log] [iterations] \n"
+               "for example: rosrun vins vins_batch_refine "
+               "~/catkin_ws/src/VINS-Fusion/config/euroc/euroc_stereo_imu_config.yaml \n");
+        return 1;
+    }
+    ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME, ros::console::levels::Warn);
+    Parameters params;
+    readParameters(argv[1], params);
+    string log_path = argc > 2 ? string(argv[2]) : params.OUTPUT_FOLDER + "/batch_log.bin";
+    int iterations = argc > 3 ? atoi(argv[3]) : 50;
+
+    TicToc t_load;
+    BatchProblem b;
+    BatchLogHeader header;
+    if (!readBatchLog(log_path, header, b.keyframes))
+    {
+        printf("can not read the batch log %s\n", log_path.c_str());
+        return 1;
+    }
+    size_t n = b.keyframes.size();
+    if (n < 2)
+    {
+        printf("%s has %d keyframes, nothing to refine\n", log_path.c_str(), (int)n);
+        return 1;
+    }
+    bool use_imu = header.use_imu;
+    bool stereo = params.STEREO && header.num_of_cam >= 2;
+
+    b.pose.resize(n);
+    b.speed_bias.resize(n);
+    for (size_t k = 0; k < n; k++)
+    {
+        const BatchKeyframe &kf = b.keyframes[k];
+        poseToBlock(kf.P, Quaterniond(kf.R), b.pose[k].data());
+        for (int i = 0; i < 3; i++)
+        {
+            b.speed_bias[k][i] = kf.V(i);
+            b.speed_bias[k][3 + i] = kf.Ba(i);
+            b.speed_bias[k][6 + i] = kf.Bg(i);
+        }
+        for (const BatchObservation &o : kf.observations)
+        {
+            Landmark &l = b.landmarks[make_pair(kf.segment, o.feature_id)];
+            if (l.host < 0)
+            {
+                l.host = (int)k;
+                l.camera = o.camera;
+            }
+            l.observations.push_back(make_pair((int)k, &o.observation));
+        }
+        // the newest estimate of the window wins
+        for (const pair<FeatureId, Vector3d> &g : kf.landmarks)
+        {
+            Landmark &l = b.landmarks[make_pair(kf.segment, g.first)];
+            l.has_guess = true;
+            l.guess = g.second;
+        }
+    }
+    for (int i = 0; i < header.num_of_cam; i++)
+        poseToBlock(header.tic[i], Quaterniond(header.ric[i]), b.ex_pose[i]);
+    b.td[0] = header.td;
+
+    setProjectionSqrtInfo(FOCAL_LENGTH / 1.5 * Matrix2d::Identity());
+    ceres::Problem problem;
+    ceres::LossFunction *loss_function = new ceres::HuberLoss(1.0);
+    ceres::ParameterBlockOrdering *ordering = new ceres::ParameterBlockOrdering;
+
+    for (size_t k = 0; k < n; k++)
+    {
+        problem.AddParameterBlock(b.pose[k].data(), SIZE_POSE, new PoseLocalParameterization());
+        ordering->AddElementToGroup(b.pose[k].data(), 1);
+        if (use_imu)
+        {
+            problem.AddParameterBlock(b.speed_bias[k].data(), SIZE_SPEEDBIAS);
+            ordering->AddElementToGroup(b.speed_bias[k].data(), 1);
+        }
+        // the gauge of each segment
+        if (k == 0 || b.keyframes[k].segment != b.keyframes[k - 1].segment)
+            problem.SetParameterBlockConstant(b.pose[k].data());
+    }
+    for (int i = 0; i < header.num_of_cam; i++)
+    {
+        problem.AddParameterBlock(b.ex_pose[i], SIZE_POSE, new PoseLocalParameterization());
+        ordering->AddElementToGroup(b.ex_pose[i], 1);
+        if (!params.ESTIMATE_EXTRINSIC)
+            problem.SetParameterBlockConstant(b.ex_pose[i]);
+    }
+    problem.AddParameterBlock(b.td, 1);
+    ordering->AddElementToGroup(b.td, 1);
+    if (!params.ESTIMATE_TD)
+        problem.SetParameterBlockConstant(b.td);
+
+    int imu_factors = 0;
+    if (use_imu)
+    {
+        for (size_t k = 0; k + 1 < n; k++)
+        {
+            const BatchKeyframe &kf = b.keyframes[k];
+            if (kf.segment != b.keyframes[k + 1].segment || kf.to_next.samples.empty())
+                continue;
+            const CheckpointPreintegration &p = kf.to_next;
+            IntegrationBase *pre = new IntegrationBase(p.acc_0, p.gyr_0, p.ba, p.bg, params);
+            b.pre_integrations.emplace_back(pre);
+            for (const ImuStep &s : p.samples)
+                pre->push_back(s.dt, s.acc, s.gyr);
+            if (pre->sum_dt > 10.0)
+                continue;
+            problem.AddResidualBlock(new IMUFactor(pre), NULL, b.pose[k].data(), b.speed_bias[k].data(),
+                                     b.pose[k + 1].data(), b.speed_bias[k + 1].data());
+            imu_factors++;
+        }
+    }
+
+    int landmarks = 0, projection_factors = 0;
+    for (pair<const pair<int, FeatureId>, Landmark> &entry : b.landmarks)
+    {
+        Landmark &l = entry.second;
+        if (!l.has_guess || l.host < 0)
+            continue;
+        bool seen_twice = l.observations.size() >= 2 || (stereo && l.observations[0].second->is_stereo);
+        if (!seen_twice)
+            continue;
+        // the window's position in the host camera, along the host observation
+        const BatchKeyframe &host = b.keyframes[l.host];
+        const FeaturePerFrame &o = *l.observations[0].second;
+        Vector3d pts_c = header.ric[l.camera].transpose() * (host.R.transpose() * (l.guess - host.P) - header.tic[l.camera]);
+        double depth = pts_c.dot(o.point) / o.point.squaredNorm();
+        if (depth <= 0.1)
+            continue;
+        l.inv_depth = 1.0 / depth;
+        problem.AddParameterBlock(&l.inv_depth, 1);
+        ordering->AddElementToGroup(&l.inv_depth, 0);
+        if (params.UNIT_SPHERE_ERROR)
+            projection_factors += addProjectionFactors<SphereResidual>(problem, loss_function, b, l, stereo);
+        else
+            projection_factors += addProjectionFactors<PlaneResidual>(problem, loss_function, b, l, stereo);
+        landmarks++;
+    }
+    printf("%d keyframes, %d landmarks, %d projection and %d imu factors, loaded in %.1f s\n", (int)n, landmarks,
+           projection_factors, imu_factors, t_load.toc() / 1000);
+
+    ceres::Solver::Options options;
+    options.linear_solver_type = ceres::SPARSE_SCHUR;
+    options.linear_solver_ordering.reset(ordering);
+    options.num_threads = params.SOLVER_THREADS > 0 ? params.SOLVER_THREADS : max(1, (int)thread::hardware_concurrency());
+    options.max_num_iterations = iterations;
+    options.minimizer_progress_to_stdout = true;
+    ceres::Solver::Summary summary;
+    ceres::Solve(options, &problem, &summary);
+    printf("%s\n", summary.BriefReport().c_str());
+
+    string out_path = params.OUTPUT_FOLDER + "/vio_batch.csv";
+    TrajectoryWriter out;
+    if (!out.open(out_path, TrajectoryWriter::EUROC_CSV))
+    {
+        printf("can not create %s\n", out_path.c_str());
+        return 1;
+    }
+    for (size_t k = 0; k < n; k++)
+    {
+        const double *p = b.pose[k].data();
+        Vector3d V = use_imu ? Vector3d(b.speed_bias[k][0], b.speed_bias[k][1], b.speed_bias[k][2]) : Vector3d::Zero();
+        out.write(b.keyframes[k].t, Vector3d(p[0], p[1], p[2]), Quaterniond(p[6], p[3], p[4], p[5]).normalized(), V);
+    }
+    out.close();
+    printf("refined keyframes in %s\n", out_path.c_str());
+    return 0;
+}
@@ -0,0 +1,557 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+// Offline replay of a recorded sequence through the estimator on one thread, as fast as it goes.
+// Every frame is processed (no dropping, no waiting on a clock), so two runs of the same build on
+// the same data give the same trajectory. Reports frames per second, the per stage latencies and
+// the absolute trajectory error against the ground truth. Nothing is published, no master needed.
+//
+// rosrun vins vins_benchmark [-o output folder] [config file] [sequence] [ground truth]
+//   sequence: euroc ASL folder (mav0/), kitti odometry sequence folder (times.txt) or a rosbag
+//             with the config topics, e.g. the viode bags in trajectory_evaluation/
+//   ground truth: optional, euroc csv, tum (t x y z qx qy qz qw) or kitti poses (one line per
+//             frame). Defaults to mav0/state_groundtruth_estimate0/data.csv for euroc and to
+//             stamped_groundtruth.txt next to a bag.
+//   -o: replaces output_path of the config, for runs of one config in parallel (vins_evaluate).
+// The trajectory goes to stamped_traj_estimate.txt (tum, as trajectory_evaluation/ has them), the
+// numbers to benchmark.csv and the latencies to latency.csv in the output folder.
+
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/Imu.h>
+#include <sensor_msgs/image_encodings.h>
+#include <cv_bridge/cv_bridge.h>
+#include "estimator/estimator.h"
+#include "utility/latency_profiler.h"
+#include "utility/trajectory_writer.h"
+#include "utility/prefetcher.h"
+
+using namespace std;
+using namespace Eigen;
+
+Estimator estimator;
+
+static bool fileExists(const string &path)
+{
+    FILE *f = fopen(path.c_str(), "r");
+    if (f == NULL)
+        return false;
+    fclose(f);
+    return true;
+}
+
+static string parentFolder(const string &path)
+{
+    size_t slash = path.find_last_of('/');
+    return slash == string::npos ? string(".") : path.substr(0, slash);
+}
+
+// Feeds the estimator in time order and collects the estimated trajectory. An image goes in only
+// once the imu is past it, in the single thread mode a frame without its imu would otherwise be
+// retried one input late.
+class Replay
+{
+  public:
+    Replay() : frames(0), process_ms(0), last_imu(-1), last_header(-1) {}
+
+    void imu(double t, const Vector3d &acc, const Vector3d &gyr)
+    {
+        TicToc timer;
+        estimator.inputIMU(t, acc, gyr);
+        process_ms += timer.toc();
+        last_imu = t;
+        while (!pending.empty() && pending.front().t + estimator.params.TD < last_imu)
+        {
+            process(pending.front());
+            pending.pop_front();
+        }
+    }
+
+    void image(double t, const cv::Mat &img0, const cv::Mat &img1 = cv::Mat())
+    {
+        frame_times.push_back(t);
+        Frame frame{t, img0, img1};
+        if (!estimator.params.USE_IMU || t + estimator.params.TD < last_imu)
+            process(frame);
+        else
+            pending.push_back(frame);
+    }
+
+    // the frames still waiting for imu at the end of the sequence
+    void finish()
+    {
+        for (const Frame &frame : pending)
+            process(frame);
+        pending.clear();
+    }
+
+    vector<TrajectoryPose> trajectory;
+    vector<double> frame_times;
+    int frames;
+    double process_ms;
+
+  private:
+    struct Frame
+    {
+        double t;
+        cv::Mat img0, img1;
+    };
+
+    void process(const Frame &frame)
+    {
+        TicToc timer;
+        estimator.inputImage(frame.t, frame.img0, frame.img1);
+        process_ms += timer.toc();
+        frames++;
+        int newest = estimator.params.WINDOW_SIZE;
+        if (estimator.solver_flag != Estimator::NON_LINEAR || estimator.Headers[newest] == last_header)
+            return;
+        last_header = estimator.Headers[newest];
+        trajectory.push_back(TrajectoryPose(last_header, estimator.Ps[newest],
+                                            Quaterniond(estimator.Rs[newest]), estimator.Vs[newest]));
+    }
+
+    double last_imu;
+    double last_header;
+    deque<Frame> pending;
+};
+
+// mav0/camX/data.csv: timestamp [ns],filename
+static bool readImageList(const string &folder, vector<pair<double, string>> &list)
+{
+    ifstream file(folder + "/data.csv");
+    if (!file)
+        return false;
+    string line;
+    while (getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        size_t comma = line.find(',');
+        if (comma == string::npos)
+            continue;
+        string name = line.substr(comma + 1);
+        while (!name.empty() && (name.back() == '\r' || name.back() == ' '))
+            name.pop_back();
+        list.push_back(make_pair(stod(line.substr(0, comma)) * 1e-9, folder + "/data/" + name));
+    }
+    return !list.empty();
+}
+
+static bool replayEuroc(const string &dir, Replay &replay)
+{
+    vector<pair<double, string>> cam0, cam1;
+    if (!readImageList(dir + "/mav0/cam0", cam0))
+    {
+        printf("cannot read %s/mav0/cam0/data.csv\n", dir.c_str());
+        return false;
+    }
+    if (estimator.params.STEREO && !readImageList(dir + "/mav0/cam1", cam1))
+    {
+        printf("cannot read %s/mav0/cam1/data.csv\n", dir.c_str());
+        return false;
+    }
+
+    FILE *imu_file = estimator.params.USE_IMU ? fopen((dir + "/mav0/imu0/data.csv").c_str(), "r") : NULL;
+    if (estimator.params.USE_IMU && imu_file == NULL)
+    {
+        printf("cannot read %s/mav0/imu0/data.csv\n", dir.c_str());
+        return false;
+    }
+    // timestamp [ns], w, a, the header line does not parse and is skipped
+    double stamp = -1, w[3], a[3];
+    auto nextImu = [&]() {
+        char line[512];
+        while (fgets(line, sizeof(line), imu_file))
+            if (sscanf(line, "%lf,%lf,%lf,%lf,%lf,%lf,%lf", &stamp, &w[0], &w[1], &w[2], &a[0], &a[1], &a[2]) == 7)
+            {
+                stamp *= 1e-9;
+                return true;
+            }
+        return false;
+    };
+    bool have_imu = imu_file && nextImu();
+
+    size_t j = 0;
+    for (size_t i = 0; i < cam0.size(); i++)
+    {
+        double t = cam0[i].first;
+        // everything up to and including the first sample past the image
+        while (have_imu)
+        {
+            replay.imu(stamp, Vector3d(a[0], a[1], a[2]), Vector3d(w[0], w[1], w[2]));
+            if (stamp > t + estimator.params.TD)
+            {
+                have_imu = nextImu();
+                break;
+            }
+            have_imu = nextImu();
+        }
+
+        cv::Mat img0 = cv::imread(cam0[i].second, cv::IMREAD_GRAYSCALE), img1;
+        if (img0.empty())
+        {
+            printf("cannot read %s\n", cam0[i].second.c_str());
+            continue;
+        }
+        if (estimator.params.STEREO)
+        {
+            while (j < cam1.size() && cam1[j].first < t - 0.003)
+                j++;
+            if (j == cam1.size() || cam1[j].first > t + 0.003)
+                continue;
+            img1 = cv::imread(cam1[j].second, cv::IMREAD_GRAYSCALE);
+            if (img1.empty())
+                continue;
+        }
+        replay.image(t, img0, img1);
+    }
+    if (imu_file)
+        fclose(imu_file);
+    return true;
+}
+
+struct KittiFrame
+{
+    size_t index;
+    cv::Mat left, right;
+};
+
+// the pngs are decoded ahead on worker threads, so the load rate is not bound by one imread at a time
+static bool replayKitti(const string &dir, Replay &replay)
+{
+    FILE *file = fopen((dir + "/times.txt").c_str(), "r");
+    if (file == NULL)
+    {
+        printf("cannot find file: %s/times.txt\n", dir.c_str());
+        return false;
+    }
+    vector<double> times;
+    double t;
+    while (fscanf(file, "%lf", &t) == 1)
+        times.push_back(t);
+    fclose(file);
+
+    bool stereo = estimator.params.STEREO;
+    Prefetcher<KittiFrame> frames(times.size(), [&dir, stereo](size_t i, KittiFrame &frame)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/%06d.png", (int)i);
+        frame.index = i;
+        frame.left = cv::imread(dir + "/image_0" + name, cv::IMREAD_GRAYSCALE);
+        if (stereo)
+            frame.right = cv::imread(dir + "/image_1" + name, cv::IMREAD_GRAYSCALE);
+        if (frame.left.empty() || (stereo && frame.right.empty()))
+        {
+            printf("cannot read image %d of %s\n", (int)i, dir.c_str());
+            return false;
+        }
+        return true;
+    });
+    KittiFrame frame;
+    while (frames.next(frame))
+        replay.image(times[frame.index], frame.left, frame.right);
+    return true;
+}
+
+static cv::Mat toMono(const sensor_msgs::ImageConstPtr &msg)
+{
+    if (msg->encoding == "8UC1")
+    {
+        sensor_msgs::Image img = *msg;
+        img.encoding = sensor_msgs::image_encodings::MONO8;
+        return cv_bridge::toCvCopy(img, sensor_msgs::image_encodings::MONO8)->image;
+    }
+    return cv_bridge::toCvCopy(msg, sensor_msgs::image_encodings::MONO8)->image;
+}
+
+// image pairs are matched on their stamps like the ros node does, the bag order is the record order
+static bool replayBag(const string &path, Replay &replay)
+{
+    rosbag::Bag bag;
+    try
+    {
+        bag.open(path, rosbag::bagmode::Read);
+    }
+    catch (const rosbag::BagException &e)
+    {
+        printf("cannot open bag %s: %s\n", path.c_str(), e.what());
+        return false;
+    }
+    vector<string> topics{estimator.params.IMAGE0_TOPIC};
+    if (estimator.params.STEREO)
+        topics.push_back(estimator.params.IMAGE1_TOPIC);
+    if (estimator.params.USE_IMU)
+        topics.push_back(estimator.params.IMU_TOPIC);
+
+    deque<sensor_msgs::ImageConstPtr> buf0, buf1;
+    rosbag::View view(bag, rosbag::TopicQuery(topics));
+    for (const rosbag::MessageInstance &m : view)
+    {
+        if (m.getTopic() == estimator.params.IMU_TOPIC)
+        {
+            sensor_msgs::ImuConstPtr imu = m.instantiate<sensor_msgs::Imu>();
+            if (imu)
+                replay.imu(imu->header.stamp.toSec(),
+                           Vector3d(imu->linear_acceleration.x, imu->linear_acceleration.y, imu->linear_acceleration.z),
+                           Vector3d(imu->angular_velocity.x, imu->angular_velocity.y, imu->angular_velocity.z));
+            continue;
+        }
+        sensor_msgs::ImageConstPtr img = m.instantiate<sensor_msgs::Image>();
+        if (!img)
+            continue;
+        if (!estimator.params.STEREO)
+        {
+            replay.image(img->header.stamp.toSec(), toMono(img));
+            continue;
+        }
+        (m.getTopic() == estimator.params.IMAGE0_TOPIC ? buf0 : buf1).push_back(img);
+        while (!buf0.empty() && !buf1.empty())
+        {
+            double t0 = buf0.front()->header.stamp.toSec();
+            double t1 = buf1.front()->header.stamp.toSec();
+            if (t0 < t1 - 0.003)
+                buf0.pop_front();
+            else if (t0 > t1 + 0.003)
+                buf1.pop_front();
+            else
+            {
+                replay.image(t0, toMono(buf0.front()), toMono(buf1.front()));
+                buf0.pop_front();
+                buf1.pop_front();
+            }
+        }
+    }
+    bag.close();
+    return true;
+}
+
+// euroc csv (t [ns], p, q wxyz), tum (t p q xyzw) or kitti (3x4 per frame, stamped with frame_times)
+static bool readGroundTruth(const string &path, const vector<double> &frame_times, vector<TrajectoryPose> &gt)
+{
+    ifstream file(path);
+    if (!file)
+        return false;
+    string line;
+    size_t row = 0;
+    while (getline(file, line))
+    {
+        if (line.empty() || line[0] == '#' || !(isdigit(line[0]) || line[0] == '-'))
+            continue;
+        replace(line.begin(), line.end(), ',', ' ');
+        istringstream in(line);
+        vector<double> v;
+        double x;
+        while (in >> x)
+            v.push_back(x);
+        if (v.size() == 12)
+        {
+            if (row >= frame_times.size())
+                break;
+            Matrix3d R;
+            R << v[0], v[1], v[2], v[4], v[5], v[6], v[8], v[9], v[10];
+            gt.push_back(TrajectoryPose(frame_times[row++], Vector3d(v[3], v[7], v[11]), Quaterniond(R)));
+        }
+        else if (v.size() >= 8 && path.size() > 4 && path.compare(path.size() - 4, 4, ".csv") == 0)
+            gt.push_back(TrajectoryPose(v[0] * 1e-9, Vector3d(v[1], v[2], v[3]), Quaterniond(v[4], v[5], v[6], v[7])));
+        else if (v.size() == 8)
+            gt.push_back(TrajectoryPose(v[0], Vector3d(v[1], v[2], v[3]), Quaterniond(v[7], v[4], v[5], v[6])));
+    }
+    sort(gt.begin(), gt.end(), [](const TrajectoryPose &a, const TrajectoryPose &b) { return a.t < b.t; });
+    return !gt.empty();
+}
+
+struct AteResult
+{
+    int matched;
+    double rmse, mean, median, max, scale;
+};
+
+// nearest ground truth within max_dt for every estimate, then the least squares rigid alignment
+// (similarity for monocular without imu, the scale is unobservable there), translation error
+static bool absoluteTrajectoryError(const vector<TrajectoryPose> &est, const vector<TrajectoryPose> &gt,
+                                    double max_dt, bool with_scale, AteResult &result)
+{
+    vector<Vector3d> src, dst;
+    for (const TrajectoryPose &pose : est)
+    {
+        auto it = lower_bound(gt.begin(), gt.end(), pose.t,
+                              [](const TrajectoryPose &g, double t) { return g.t < t; });
+        const TrajectoryPose *best = NULL;
+        if (it != gt.end())
+            best = &*it;
+        if (it != gt.begin() && (best == NULL || pose.t - (it - 1)->t < best->t - pose.t))
+            best = &*(it - 1);
+        if (best == NULL || fabs(best->t - pose.t) > max_dt)
+            continue;
+        src.push_back(Vector3d(pose.p[0], pose.p[1], pose.p[2]));
+        dst.push_back(Vector3d(best->p[0], best->p[1], best->p[2]));
+    }
+    result.matched = src.size();
+    if (src.size() < 3)
+        return false;
+
+    Matrix3Xd A(3, src.size()), B(3, dst.size());
+    for (size_t i = 0; i < src.size(); i++)
+    {
+        A.col(i) = src[i];
+        B.col(i) = dst[i];
+    }
+    Matrix4d T = umeyama(A, B, with_scale);
+    result.scale = T.block<3, 3>(0, 0).col(0).norm();
+
+    vector<double> err(src.size());
+    double sum = 0, sum2 = 0;
+    for (size_t i = 0; i < src.size(); i++)
+    {
+        err[i] = (T.block<3, 3>(0, 0) * A.col(i) + T.block<3, 1>(0, 3) - B.col(i)).norm();
+        sum += err[i];
+        sum2 += err[i] * err[i];
+    }
+    result.rmse = sqrt(sum2 / err.size());
+    result.mean = sum / err.size();
+    result.max = *max_element(err.begin(), err.end());
+    nth_element(err.begin(), err.begin() + err.size() / 2, err.end());
+    result.median = err[err.size() / 2];
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME, ros::console::levels::Warn);
+
+    string output_folder;
+    vector<string> args;
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "-o" && i + 1 < argc)
+            output_folder = argv[++i];
+        else
+            args.push_back(argv[i]);
+    }
+    if (args.size() != 2 && args.size() != 3)
+    {
+        printf("please intput: rosrun vins vins_benchmark [-o output folder] [config file] [sequence] [ground truth] \n"
+               "for example: rosrun vins vins_benchmark "
+               "~/catkin_ws/src/VINS-Fusion/config/euroc/euroc_stereo_imu_config.yaml "
+               "~/dataset/euroc/MH_01_easy/ \n");
+        return 1;
+    }
+    string config_file = args[0];
+    string sequence = args[1];
+    while (sequence.size() > 1 && sequence.back() == '/')
+        sequence.pop_back();
+
+    Parameters params;
+    readParameters(config_file, params);
+    if (!output_folder.empty())
+    {
+        params.OUTPUT_FOLDER = output_folder;
+        params.VINS_RESULT_PATH = params.OUTPUT_FOLDER + "/vio.csv";
+        params.EX_CALIB_RESULT_PATH = params.OUTPUT_FOLDER + "/extrinsic_parameter.csv";
+    }
+    // one thread, every frame, nobody looking at the tracks
+    params.MULTIPLE_THREAD = 0;
+    params.PIPELINE_QUEUE_SIZE = 0;
+    params.SHOW_TRACK = 0;
+    estimator.setPublish(false);
+    estimator.setParameter(params);
+
+    string gt_path = args.size() == 3 ? args[2] : "";
+    Replay replay;
+    TicToc wall;
+    bool ok;
+    if (fileExists(sequence + "/mav0/cam0/data.csv"))
+    {
+        if (gt_path.empty())
+            gt_path = sequence + "/mav0/state_groundtruth_estimate0/data.csv";
+        ok = replayEuroc(sequence, replay);
+    }
+    else if (fileExists(sequence + "/times.txt"))
+        ok = replayKitti(sequence, replay);
+    else
+    {
+        if (gt_path.empty())
+            gt_path = parentFolder(sequence) + "/stamped_groundtruth.txt";
+        ok = replayBag(sequence, replay);
+    }
+    replay.finish();
+    double wall_ms = wall.toc();
+    estimator.stop();
+    if (!ok)
+        return 1;
+
+    printf("\n%s\n", sequence.c_str());
+    printf("frames %d, estimator %.1f fps (%.1f s), with data loading %.1f fps (%.1f s)\n", replay.frames,
+           replay.frames / (replay.process_ms / 1000), replay.process_ms / 1000, replay.frames / (wall_ms / 1000),
+           wall_ms / 1000);
+    printf("%-16s %8s %9s %9s %9s %9s %9s %9s %11s\n", "stage [ms]", "count", "mean", "p50", "p95", "p99", "max",
+           "allocs", "alloc_bytes");
+    for (int i = 0; i < LatencyProfiler::NUM_STAGES; i++)
+    {
+        LatencyProfiler::Stage stage = static_cast<LatencyProfiler::Stage>(i);
+        LatencyProfiler::Summary s = estimator.latencyProfiler.summary(stage);
+        if (s.count == 0)
+            continue;
+        printf("%-16s %8ld %9.3f %9.3f %9.3f %9.3f %9.3f %9.1f %11.0f\n", LatencyProfiler::name(stage), s.count, s.mean,
+               s.p50, s.p95, s.p99, s.max, s.allocs, s.alloc_bytes);
+    }
+
+    if (!params.OUTPUT_FOLDER.empty())
+    {
+        TrajectoryWriter out;
+        if (out.open(params.OUTPUT_FOLDER + "/stamped_traj_estimate.txt", TrajectoryWriter::TUM))
+            out.rewrite(replay.trajectory);
+    }
+
+    vector<TrajectoryPose> gt;
+    AteResult ate;
+    bool have_ate = false;
+    if (gt_path.empty() || !readGroundTruth(gt_path, replay.frame_times, gt))
+        printf("no ground truth%s%s, ATE skipped\n", gt_path.empty() ? "" : " in ", gt_path.c_str());
+    else if (!absoluteTrajectoryError(replay.trajectory, gt, 0.02, !params.USE_IMU && !params.STEREO, ate))
+        printf("%d of %d poses matched the ground truth in time, ATE skipped\n", ate.matched,
+               (int)replay.trajectory.size());
+    else
+    {
+        have_ate = true;
+        printf("ATE [m] over %d poses: rmse %.4f, mean %.4f, median %.4f, max %.4f, scale %.4f\n", ate.matched,
+               ate.rmse, ate.mean, ate.median, ate.max, ate.scale);
+    }
+
+    // one row, empty ATE fields without ground truth
+    FILE *csv = params.OUTPUT_FOLDER.empty() ? NULL : fopen((params.OUTPUT_FOLDER + "/benchmark.csv").c_str(), "w");
+    if (csv)
+    {
+        LatencyProfiler::Summary frame = estimator.latencyProfiler.summary(LatencyProfiler::FRAME);
+        fprintf(csv, "frames,poses,fps,estimator_s,ate_poses,ate_rmse,ate_mean,ate_median,ate_max,scale,"
+                     "frame_p50_ms,frame_p95_ms,frame_p99_ms,frame_max_ms\n");
+        fprintf(csv, "%d,%d,%.2f,%.2f,", replay.frames, (int)replay.trajectory.size(),
+                replay.frames / (replay.process_ms / 1000), replay.process_ms / 1000);
+        if (have_ate)
+            fprintf(csv, "%d,%.4f,%.4f,%.4f,%.4f,%.4f,", ate.matched, ate.rmse, ate.mean, ate.median, ate.max,
+                    ate.scale);
+        else
+            fprintf(csv, ",,,,,,");
+        fprintf(csv, "%.3f,%.3f,%.3f,%.3f\n", frame.p50, frame.p95, frame.p99, frame.max);
+        fclose(csv);
+    }
+    return 0;
+}
@@ -0,0 +1,210 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "batch_log.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "binary_file.h"
+
+static const char BATCH_LOG_MAGIC[8] = {'V', 'I', 'N', 'S', 'B', 'A', 'L', '2'};
+// every keyframe starts with it, anything else ends the log
+static const uint8_t KEYFRAME_TAG = 1;
+
+static void putKeyframe(BinaryFile &f, const BatchKeyframe &k)
+{
+    f.put(KEYFRAME_TAG);
+    f.put(static_cast<int32_t>(k.segment));
+    f.put(k.t);
+    f.putMatrix(k.P);
+    f.putMatrix(k.V);
+    f.putMatrix(k.Ba);
+    f.putMatrix(k.Bg);
+    f.putMatrix(k.R);
+    f.putMatrix(k.to_next.acc_0);
+    f.putMatrix(k.to_next.gyr_0);
+    f.putMatrix(k.to_next.ba);
+    f.putMatrix(k.to_next.bg);
+    putImuSteps(f, k.to_next.samples);
+    f.putSize(k.observations.size());
+    for (const BatchObservation &o : k.observations)
+    {
+        f.put(static_cast<int64_t>(o.feature_id));
+        f.put(static_cast<int32_t>(o.camera));
+        putObservation(f, o.observation);
+    }
+    f.putSize(k.landmarks.size());
+    for (const std::pair<FeatureId, Eigen::Vector3d> &l : k.landmarks)
+    {
+        f.put(static_cast<int64_t>(l.first));
+        f.putMatrix(l.second);
+    }
+}
+
+static void getKeyframe(BinaryFile &f, BatchKeyframe &k)
+{
+    int32_t segment = 0;
+    f.get(segment);
+    k.segment = segment;
+    f.get(k.t);
+    f.getMatrix(k.P);
+    f.getMatrix(k.V);
+    f.getMatrix(k.Ba);
+    f.getMatrix(k.Bg);
+    f.getMatrix(k.R);
+    f.getMatrix(k.to_next.acc_0);
+    f.getMatrix(k.to_next.gyr_0);
+    f.getMatrix(k.to_next.ba);
+    f.getMatrix(k.to_next.bg);
+    getImuSteps(f, k.to_next.samples);
+    k.observations.resize(f.getSize(MAX_COUNT));
+    for (BatchObservation &o : k.observations)
+    {
+        int64_t feature_id = 0;
+        int32_t camera = 0;
+        f.get(feature_id);
+        f.get(camera);
+        o.feature_id = feature_id;
+        o.camera = camera;
+        getObservation(f, o.observation);
+    }
+    k.landmarks.resize(f.getSize(MAX_COUNT));
+    for (std::pair<FeatureId, Eigen::Vector3d> &l : k.landmarks)
+    {
+        int64_t feature_id = 0;
+        f.get(feature_id);
+        l.first = feature_id;
+        f.getMatrix(l.second);
+    }
+}
+
+BatchLogWriter::BatchLogWriter() : file(NULL), stop_flag(false) {}
+
+BatchLogWriter::~BatchLogWriter()
+{
+    stop();
+}
+
+bool BatchLogWriter::start(const std::string &path, const BatchLogHeader &header)
+{
+    if (file)
+        return true;
+    file = fopen(path.c_str(), "wb");
+    if (file == NULL)
+        return false;
+    BinaryFile f(file);
+    f.put(BATCH_LOG_MAGIC, sizeof(BATCH_LOG_MAGIC));
+    f.put(static_cast<int32_t>(header.num_of_cam));
+    f.put(static_cast<int32_t>(header.use_imu));
+    f.put(header.td);
+    f.putMatrix(header.g);
+    for (int i = 0; i < header.num_of_cam; i++)
+    {
+        f.putMatrix(header.tic[i]);
+        f.putMatrix(header.ric[i]);
+    }
+    stop_flag = false;
+    thread = std::thread(&BatchLogWriter::run, this);
+    return f.ok;
+}
+
+void BatchLogWriter::stop()
+{
+    if (!thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lk(m);
+        stop_flag = true;
+    }
+    con.notify_one();
+    thread.join();
+    fclose(file);
+    file = NULL;
+}
+
+void BatchLogWriter::push(BatchKeyframe &&keyframe)
+{
+    {
+        std::lock_guard<std::mutex> lk(m);
+        pending.push_back(std::move(keyframe));
+    }
+    con.notify_one();
+}
+
+void BatchLogWriter::run()
+{
+    BinaryFile f(file);
+    while (1)
+    {
+        BatchKeyframe keyframe;
+        {
+            std::unique_lock<std::mutex> lk(m);
+            con.wait(lk, [this] { return stop_flag || !pending.empty(); });
+            if (pending.empty())
+                break;
+            keyframe = std::move(pending.front());
+            pending.pop_front();
+        }
+        putKeyframe(f, keyframe);
+        if (!f.ok)
+        {
+            ROS_WARN("can not write the batch log, the keyframes from %f on are lost", keyframe.t);
+            std::lock_guard<std::mutex> lk(m);
+            pending.clear();
+            f.ok = true;
+        }
+    }
+}
+
+bool readBatchLog(const std::string &path, BatchLogHeader &header, std::vector<BatchKeyframe> &keyframes)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+        return false;
+    BinaryFile f(file);
+    char magic[sizeof(BATCH_LOG_MAGIC)];
+    int32_t num_of_cam = 0, use_imu = 0;
+    f.get(magic, sizeof(magic));
+    f.get(num_of_cam);
+    f.get(use_imu);
+    if (!f.ok || memcmp(magic, BATCH_LOG_MAGIC, sizeof(magic)) != 0 || num_of_cam < 1 ||
+        num_of_cam > MAX_NUM_OF_CAM)
+    {
+        fclose(file);
+        return false;
+    }
+    header.num_of_cam = num_of_cam;
+    header.use_imu = use_imu;
+    f.get(header.td);
+    f.getMatrix(header.g);
+    for (int i = 0; i < header.num_of_cam; i++)
+    {
+        f.getMatrix(header.tic[i]);
+        f.getMatrix(header.ric[i]);
+    }
+    bool ok = f.ok;
+
+    keyframes.clear();
+    uint8_t tag = 0;
+    while (ok)
+    {
+        f.get(tag);
+        if (!f.ok || tag != KEYFRAME_TAG)
+            break;
+        BatchKeyframe keyframe;
+        getKeyframe(f, keyframe);
+        // the last one may be cut short
+        if (!f.ok)
+            break;
+        keyframes.push_back(std::move(keyframe));
+    }
+    fclose(file);
+    return ok;
+}
@@ -0,0 +1,86 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <eigen3/Eigen/Dense>
+
+#include "checkpoint.h"
+
+// the sensor setup of a log, written once at its start
+struct BatchLogHeader
+{
+    int num_of_cam, use_imu;
+    double td;
+    Eigen::Vector3d g;
+    Eigen::Vector3d tic[MAX_NUM_OF_CAM];
+    Eigen::Matrix3d ric[MAX_NUM_OF_CAM];
+};
+
+struct BatchObservation
+{
+    FeatureId feature_id;
+    int camera;
+    FeaturePerFrame observation;
+};
+
+// A keyframe as it leaves the window: its optimized state, the imu to the next keyframe and what
+// it saw. The frames still in the window when the estimator stops are written at the end.
+struct BatchKeyframe
+{
+    // counts the resets of the estimator, each starts a new world frame, so keyframes, imu and
+    // feature ids only connect within one segment
+    int segment;
+    double t;
+    Eigen::Vector3d P, V, Ba, Bg;
+    Eigen::Matrix3d R;
+    // preintegration to the next keyframe of the segment, no samples for the last one or without imu
+    CheckpointPreintegration to_next;
+    std::vector<BatchObservation> observations;
+    // world position the window estimated for the features first seen here
+    std::vector<std::pair<FeatureId, Eigen::Vector3d>> landmarks;
+};
+
+// Appends keyframes to a batch log (batch_log, OUTPUT_FOLDER/batch_log.bin) on its own thread, for
+// vins_batch_refine. Binary, for the same build; a log cut short by a crash is read up to its last
+// complete keyframe.
+class BatchLogWriter
+{
+  public:
+    BatchLogWriter();
+    ~BatchLogWriter();
+
+    // truncates path, false when it can not be created
+    bool start(const std::string &path, const BatchLogHeader &header);
+    // writes the keyframes still waiting, then closes the file
+    void stop();
+    bool isOpen() const { return file != NULL; }
+
+    // estimator thread
+    void push(BatchKeyframe &&keyframe);
+
+  private:
+    void run();
+
+    FILE *file;
+    std::mutex m;
+    std::condition_variable con;
+    std::deque<BatchKeyframe> pending;
+    bool stop_flag;
+    std::thread thread;
+};
+
+bool readBatchLog(const std::string &path, BatchLogHeader &header, std::vector<BatchKeyframe> &keyframes);
@@ -0,0 +1,129 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <eigen3/Eigen/Dense>
+
+#include "feature_manager.h"
+#include "../factor/integration_base.h"
+
+// raw values in the byte order of the machine, ok stays false once a read or write fell short
+class BinaryFile
+{
+  public:
+    explicit BinaryFile(FILE *_file) : file(_file), ok(true) {}
+
+    void put(const void *data, size_t size)
+    {
+        if (ok && size > 0)
+            ok = fwrite(data, 1, size, file) == size;
+    }
+    void get(void *data, size_t size)
+    {
+        if (ok && size > 0)
+            ok = fread(data, 1, size, file) == size;
+    }
+
+    template <typename T>
+    void put(const T &value) { put(&value, sizeof(T)); }
+    template <typename T>
+    void get(T &value) { get(&value, sizeof(T)); }
+
+    // fixed size Eigen matrices
+    template <typename Derived>
+    void putMatrix(const Eigen::MatrixBase<Derived> &m) { put(m.derived().data(), sizeof(double) * m.size()); }
+    template <typename Derived>
+    void getMatrix(Eigen::MatrixBase<Derived> &m) { get(m.derived().data(), sizeof(double) * m.size()); }
+
+    void putSize(size_t n) { put(static_cast<uint64_t>(n)); }
+    // a count larger than limit is taken as a broken file
+    size_t getSize(size_t limit)
+    {
+        uint64_t n = 0;
+        get(n);
+        if (n > limit)
+            ok = false;
+        return ok ? n : 0;
+    }
+
+    template <typename T>
+    void putVector(const std::vector<T> &v)
+    {
+        putSize(v.size());
+        put(v.data(), sizeof(T) * v.size());
+    }
+    template <typename T>
+    void getVector(std::vector<T> &v, size_t limit)
+    {
+        v.resize(getSize(limit));
+        get(v.data(), sizeof(T) * v.size());
+    }
+
+    FILE *file;
+    bool ok;
+};
+
+// counts above are taken as a broken file
+const size_t MAX_COUNT = 1 << 24;
+
+inline void putObservation(BinaryFile &f, const FeaturePerFrame &o)
+{
+    f.put(o.cur_td);
+    f.put(o.obs_td);
+    f.put(o.obs_tdRight);
+    f.putMatrix(o.point);
+    f.putMatrix(o.pointRight);
+    f.putMatrix(o.uv);
+    f.putMatrix(o.uvRight);
+    f.putMatrix(o.velocity);
+    f.putMatrix(o.velocityRight);
+    f.put(static_cast<uint8_t>(o.is_stereo));
+}
+
+inline void getObservation(BinaryFile &f, FeaturePerFrame &o)
+{
+    uint8_t stereo = 0;
+    f.get(o.cur_td);
+    f.get(o.obs_td);
+    f.get(o.obs_tdRight);
+    f.getMatrix(o.point);
+    f.getMatrix(o.pointRight);
+    f.getMatrix(o.uv);
+    f.getMatrix(o.uvRight);
+    f.getMatrix(o.velocity);
+    f.getMatrix(o.velocityRight);
+    f.get(stereo);
+    o.is_stereo = stereo != 0;
+}
+
+inline void putImuSteps(BinaryFile &f, const std::vector<ImuStep> &samples)
+{
+    f.putSize(samples.size());
+    for (const ImuStep &s : samples)
+    {
+        f.put(s.dt);
+        f.putMatrix(s.acc);
+        f.putMatrix(s.gyr);
+    }
+}
+
+inline void getImuSteps(BinaryFile &f, std::vector<ImuStep> &samples)
+{
+    samples.resize(f.getSize(MAX_COUNT));
+    for (ImuStep &s : samples)
+    {
+        f.get(s.dt);
+        f.getMatrix(s.acc);
+        f.getMatrix(s.gyr);
+    }
+}
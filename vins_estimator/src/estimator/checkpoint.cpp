@@ -0,0 +1,243 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "checkpoint.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "binary_file.h"
+
+static const char CHECKPOINT_MAGIC[8] = {'V', 'I', 'N', 'S', 'C', 'K', 'P', '2'};
+
+bool writeCheckpoint(const std::string &path, const EstimatorCheckpoint &c)
+{
+    std::string tmp_path = path + ".tmp";
+    FILE *file = fopen(tmp_path.c_str(), "wb");
+    if (file == NULL)
+        return false;
+    BinaryFile f(file);
+    f.put(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    f.put(static_cast<int32_t>(c.window_size));
+    f.put(static_cast<int32_t>(c.num_of_cam));
+    f.put(static_cast<int32_t>(c.use_imu));
+    f.put(c.prev_time);
+    f.put(c.td);
+    f.putMatrix(c.g);
+    f.putMatrix(c.acc_0);
+    f.putMatrix(c.gyr_0);
+    for (int i = 0; i < c.num_of_cam; i++)
+    {
+        f.putMatrix(c.tic[i]);
+        f.putMatrix(c.ric[i]);
+    }
+    for (int i = 0; i <= c.window_size; i++)
+    {
+        f.put(c.Headers[i]);
+        f.putMatrix(c.Ps[i]);
+        f.putMatrix(c.Vs[i]);
+        f.putMatrix(c.Bas[i]);
+        f.putMatrix(c.Bgs[i]);
+        f.putMatrix(c.Rs[i]);
+    }
+
+    f.putSize(c.pre_integrations.size());
+    for (const CheckpointPreintegration &p : c.pre_integrations)
+    {
+        f.putMatrix(p.acc_0);
+        f.putMatrix(p.gyr_0);
+        f.putMatrix(p.ba);
+        f.putMatrix(p.bg);
+        putImuSteps(f, p.samples);
+    }
+
+    f.put(static_cast<int32_t>(c.prior_m));
+    f.put(static_cast<int32_t>(c.prior_n));
+    f.putVector(c.prior_kind);
+    f.putVector(c.prior_index);
+    f.putVector(c.prior_size);
+    f.putVector(c.prior_idx);
+    for (const std::vector<double> &data : c.prior_data)
+        f.putVector(data);
+    f.putSize(c.prior_jacobians.rows());
+    f.putSize(c.prior_jacobians.cols());
+    f.put(c.prior_jacobians.data(), sizeof(double) * c.prior_jacobians.size());
+    f.putSize(c.prior_residuals.size());
+    f.put(c.prior_residuals.data(), sizeof(double) * c.prior_residuals.size());
+
+    f.putSize(c.features.size());
+    for (const CheckpointFeature &feature : c.features)
+    {
+        f.put(static_cast<int64_t>(feature.feature_id));
+        f.put(static_cast<int32_t>(feature.start_frame));
+        f.put(static_cast<int32_t>(feature.camera));
+        f.put(feature.inv_depth);
+        f.putSize(feature.observations.size());
+        for (const FeaturePerFrame &o : feature.observations)
+            putObservation(f, o);
+    }
+
+    bool ok = f.ok;
+    if (fclose(file) != 0)
+        ok = false;
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool readCheckpoint(const std::string &path, EstimatorCheckpoint &c)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == NULL)
+        return false;
+    BinaryFile f(file);
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    int32_t window_size = 0, num_of_cam = 0, use_imu = 0;
+    f.get(magic, sizeof(magic));
+    f.get(window_size);
+    f.get(num_of_cam);
+    f.get(use_imu);
+    if (!f.ok || memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 || window_size < 1 ||
+        window_size > MAX_WINDOW_SIZE || num_of_cam < 1 || num_of_cam > MAX_NUM_OF_CAM)
+    {
+        fclose(file);
+        return false;
+    }
+    c.window_size = window_size;
+    c.num_of_cam = num_of_cam;
+    c.use_imu = use_imu;
+    f.get(c.prev_time);
+    f.get(c.td);
+    f.getMatrix(c.g);
+    f.getMatrix(c.acc_0);
+    f.getMatrix(c.gyr_0);
+    for (int i = 0; i < c.num_of_cam; i++)
+    {
+        f.getMatrix(c.tic[i]);
+        f.getMatrix(c.ric[i]);
+    }
+    for (int i = 0; i <= c.window_size; i++)
+    {
+        f.get(c.Headers[i]);
+        f.getMatrix(c.Ps[i]);
+        f.getMatrix(c.Vs[i]);
+        f.getMatrix(c.Bas[i]);
+        f.getMatrix(c.Bgs[i]);
+        f.getMatrix(c.Rs[i]);
+    }
+
+    c.pre_integrations.resize(f.getSize(MAX_WINDOW_SIZE + 1));
+    for (CheckpointPreintegration &p : c.pre_integrations)
+    {
+        f.getMatrix(p.acc_0);
+        f.getMatrix(p.gyr_0);
+        f.getMatrix(p.ba);
+        f.getMatrix(p.bg);
+        getImuSteps(f, p.samples);
+    }
+
+    int32_t prior_m = 0, prior_n = 0;
+    f.get(prior_m);
+    f.get(prior_n);
+    c.prior_m = prior_m;
+    c.prior_n = prior_n;
+    f.getVector(c.prior_kind, MAX_COUNT);
+    f.getVector(c.prior_index, MAX_COUNT);
+    f.getVector(c.prior_size, MAX_COUNT);
+    f.getVector(c.prior_idx, MAX_COUNT);
+    c.prior_data.resize(c.prior_kind.size());
+    for (std::vector<double> &data : c.prior_data)
+        f.getVector(data, MAX_COUNT);
+    size_t rows = f.getSize(MAX_COUNT), cols = f.getSize(MAX_COUNT);
+    c.prior_jacobians.resize(rows, cols);
+    f.get(c.prior_jacobians.data(), sizeof(double) * c.prior_jacobians.size());
+    c.prior_residuals.resize(f.getSize(MAX_COUNT));
+    f.get(c.prior_residuals.data(), sizeof(double) * c.prior_residuals.size());
+
+    c.features.resize(f.getSize(MAX_COUNT));
+    for (CheckpointFeature &feature : c.features)
+    {
+        int64_t feature_id = 0;
+        int32_t start_frame = 0, camera = 0;
+        f.get(feature_id);
+        f.get(start_frame);
+        f.get(camera);
+        feature.feature_id = feature_id;
+        feature.start_frame = start_frame;
+        feature.camera = camera;
+        f.get(feature.inv_depth);
+        feature.observations.resize(f.getSize(MAX_WINDOW_SIZE + 1));
+        for (FeaturePerFrame &o : feature.observations)
+            getObservation(f, o);
+    }
+    fclose(file);
+
+    bool blocks_ok = c.prior_index.size() == c.prior_kind.size() && c.prior_size.size() == c.prior_kind.size() &&
+                     c.prior_idx.size() == c.prior_kind.size();
+    return f.ok && blocks_ok;
+}
+
+CheckpointWriter::CheckpointWriter() : has_pending(false), stop_flag(false) {}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    stop();
+}
+
+void CheckpointWriter::start(const std::string &_path)
+{
+    if (thread.joinable())
+        return;
+    path = _path;
+    stop_flag = false;
+    thread = std::thread(&CheckpointWriter::run, this);
+}
+
+void CheckpointWriter::stop()
+{
+    if (!thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lk(m);
+        stop_flag = true;
+    }
+    con.notify_one();
+    thread.join();
+}
+
+void CheckpointWriter::push(EstimatorCheckpoint &&checkpoint)
+{
+    {
+        std::lock_guard<std::mutex> lk(m);
+        pending = std::move(checkpoint);
+        has_pending = true;
+    }
+    con.notify_one();
+}
+
+void CheckpointWriter::run()
+{
+    while (1)
+    {
+        EstimatorCheckpoint checkpoint;
+        {
+            std::unique_lock<std::mutex> lk(m);
+            con.wait(lk, [this] { return stop_flag || has_pending; });
+            if (!has_pending)
+                break;
+            checkpoint = std::move(pending);
+            has_pending = false;
+        }
+        if (!writeCheckpoint(path, checkpoint))
+            ROS_WARN("can not write checkpoint %s", path.c_str());
+    }
+}
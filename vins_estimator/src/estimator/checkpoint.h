@@ -0,0 +1,107 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <eigen3/Eigen/Dense>
+
+#include "parameters.h"
+#include "feature_manager.h"
+#include "../factor/integration_base.h"
+
+// the parameter blocks a prior can keep, with the index of the frame or camera
+enum CheckpointBlock
+{
+    BLOCK_POSE = 0,
+    BLOCK_SPEED_BIAS = 1,
+    BLOCK_EX_POSE = 2,
+    BLOCK_TD = 3
+};
+
+struct CheckpointPreintegration
+{
+    // the first sample and the bias the samples are integrated with
+    Eigen::Vector3d acc_0, gyr_0, ba, bg;
+    std::vector<ImuStep> samples;
+};
+
+struct CheckpointFeature
+{
+    FeatureId feature_id;
+    int start_frame, camera;
+    double inv_depth;
+    std::vector<FeaturePerFrame> observations;
+};
+
+// Everything a window in NON_LINEAR needs to go on with the next frame: the states, the
+// preintegrations, the marginalization prior and the tracked features. Copied on the estimator
+// thread once a frame is done, written and read by the functions below.
+struct EstimatorCheckpoint
+{
+    int window_size, num_of_cam, use_imu;
+    // curTime of the last frame, the imu is integrated on from there
+    double prev_time;
+    double td;
+    Eigen::Vector3d g, acc_0, gyr_0;
+    Eigen::Vector3d tic[MAX_NUM_OF_CAM];
+    Eigen::Matrix3d ric[MAX_NUM_OF_CAM];
+    double Headers[MAX_WINDOW_SIZE + 1];
+    Eigen::Vector3d Ps[MAX_WINDOW_SIZE + 1], Vs[MAX_WINDOW_SIZE + 1];
+    Eigen::Vector3d Bas[MAX_WINDOW_SIZE + 1], Bgs[MAX_WINDOW_SIZE + 1];
+    Eigen::Matrix3d Rs[MAX_WINDOW_SIZE + 1];
+    // frames 0 to window_size, with imu only
+    std::vector<CheckpointPreintegration> pre_integrations;
+
+    // the prior, no blocks when there is none: per kept block its CheckpointBlock and index, global
+    // size, column in the jacobian (from prior_m on) and linearization point
+    int prior_m, prior_n;
+    std::vector<int> prior_kind, prior_index, prior_size, prior_idx;
+    std::vector<std::vector<double>> prior_data;
+    Eigen::MatrixXd prior_jacobians;
+    Eigen::VectorXd prior_residuals;
+
+    std::vector<CheckpointFeature> features;
+};
+
+// binary, for the same build: written to path.tmp and renamed over path, so a crash while writing
+// leaves the previous checkpoint
+bool writeCheckpoint(const std::string &path, const EstimatorCheckpoint &checkpoint);
+bool readCheckpoint(const std::string &path, EstimatorCheckpoint &checkpoint);
+
+// Writes checkpoints on its own thread. Holds one: a checkpoint pushed while the previous is still
+// waiting replaces it.
+class CheckpointWriter
+{
+  public:
+    CheckpointWriter();
+    ~CheckpointWriter();
+
+    void start(const std::string &_path);
+    // writes the checkpoint still waiting, then joins
+    void stop();
+
+    // estimator thread
+    void push(EstimatorCheckpoint &&checkpoint);
+
+  private:
+    void run();
+
+    std::string path;
+    std::mutex m;
+    std::condition_variable con;
+    EstimatorCheckpoint pending;
+    bool has_pending;
+    bool stop_flag;
+    std::thread thread;
+};
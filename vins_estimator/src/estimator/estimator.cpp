@@ -8,11 +8,16 @@
  *******************************************************/
 
 #include "estimator.h"
-#include "../utility/visualization.h"
 
-Estimator::Estimator(): f_manager{Rs}
+Estimator::Estimator()
+    : visualization(params, latencyProfiler), publishThread(visualization), trackImageThread(visualization),
+      featureTracker(params),
+      f_manager(Rs, params), reuseFactors(false), huberLoss(1.0), threadPool(NUM_THREADS)
 {
     ROS_INFO("init begins");
+    // until setParameter knows the sensors
+    selectMode<StereoImuMode>();
+    batchSegment = 0;
     clearState();
     prevTime = -1;
     curTime = 0;
@@ -23,134 +28,489 @@ Estimator::Estimator(): f_manager{Rs}
     // sum_t_feature = 0.0;
     // begin_time_count = 10;
     initFirstPoseFlag = false;
+    stopFlag = false;
+    trackStop = false;
+    trackerCameras = 0;
+    imuWaiting = false;
+    publish = true;
+}
+
+Estimator::~Estimator()
+{
+    stop();
+}
+
+void Estimator::stop()
+{
+    // trackThread empties trackBuf before it exits, its frames still reach featureBuf
+    mTrack.lock();
+    trackStop = true;
+    mTrack.unlock();
+    conTrack.notify_all();
+    if (trackThread.joinable())
+        trackThread.join();
+    trackImageThread.stop();
+    mBuf.lock();
+    stopFlag = true;
+    mBuf.unlock();
+    con.notify_all();
+    if (processThread.joinable())
+        processThread.join();
+    checkpointWriter.stop();
+    // the window never leaves, it goes to the log as it is
+    if (batchLog.isOpen() && solver_flag == NON_LINEAR)
+        logKeyframes(frame_count + 1);
+    batchLog.stop();
+    publishThread.stop();
+    if (!params.OUTPUT_FOLDER.empty())
+        latencyProfiler.dump(params.OUTPUT_FOLDER + "/latency.csv");
+}
+
+void Estimator::setParameter(const Parameters &_params)
+{
+    params = _params;
+    if (params.CHECKPOINT_RESTORE && !params.OUTPUT_FOLDER.empty())
+    {
+        string path = params.OUTPUT_FOLDER + "/checkpoint.bin";
+        std::unique_ptr<EstimatorCheckpoint> c(new EstimatorCheckpoint);
+        if (!readCheckpoint(path, *c))
+            ROS_WARN("no checkpoint to resume from in %s", path.c_str());
+        else if (c->window_size != params.WINDOW_SIZE || c->num_of_cam != params.NUM_OF_CAM ||
+                 c->use_imu != params.USE_IMU)
+            ROS_WARN("checkpoint %s is of another window size, camera count or imu setting, not resumed", path.c_str());
+        else
+            pendingCheckpoint = std::move(c);
+    }
+    setParameter();
 }
 
 void Estimator::setParameter()
 {
-    for (int i = 0; i < NUM_OF_CAM; i++)
+    resizeWindow(params.WINDOW_SIZE + 1);
+    for (int i = 0; i < params.NUM_OF_CAM; i++)
     {
-        tic[i] = TIC[i];
-        ric[i] = RIC[i];
+        tic[i] = params.TIC[i];
+        ric[i] = params.RIC[i];
         cout << " exitrinsic cam " << i << endl  << ric[i] << endl << tic[i].transpose() << endl;
     }
     f_manager.setRic(ric);
-    ProjectionTwoFrameOneCamFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Matrix2d::Identity();
-    ProjectionTwoFrameTwoCamFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Matrix2d::Identity();
-    ProjectionOneFrameTwoCamFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Matrix2d::Identity();
-    td = TD;
-    g = G;
+    publishTrackingPrior();
+    f_manager.setThreadPool(&threadPool);
+    f_manager.reserve(params.NUM_OF_F);
+    outlierCandidates.reserve(params.NUM_OF_F);
+    outlierFlags.reserve(params.NUM_OF_F);
+    setProjectionSqrtInfo(FOCAL_LENGTH / 1.5 * Matrix2d::Identity());
+    ProjectionFeatureFactor::sqrt_info = FOCAL_LENGTH / 1.5 * Matrix2d::Identity();
+    td = params.TD;
+    g = params.G;
     cout << "set g " << g.transpose() << endl;
-    featureTracker.readIntrinsicParameter(CAM_NAMES);
-
-    std::cout << "MULTIPLE_THREAD is " << MULTIPLE_THREAD << '\n';
-    if (MULTIPLE_THREAD)
+    // cameras 0 and 1 share featureTracker, the others get one each. A restart (restart_callback,
+    // the failure path) keeps them, trackThread may be tracking with them
+    if (trackerCameras != params.NUM_OF_CAM)
+    {
+        ROS_ASSERT(!trackThread.joinable());
+        vector<string> pairCalib(params.CAM_NAMES.begin(), params.CAM_NAMES.begin() + min(params.NUM_OF_CAM, 2));
+        featureTracker.readIntrinsicParameter(pairCalib);
+        auxTrackers.clear();
+        for (int c = 2; c < params.NUM_OF_CAM; c++)
+        {
+            auxTrackers.emplace_back(new FeatureTracker(params, c));
+            auxTrackers.back()->readIntrinsicParameter(vector<string>{params.CAM_NAMES[c]});
+        }
+        trackPool.reset(auxTrackers.empty() ? NULL : new ThreadPool(auxTrackers.size() + 1));
+        trackerCameras = params.NUM_OF_CAM;
+    }
+    solverTuner.init(params);
+    margWorkspace.precision = static_cast<MarginalizationWorkspace::Precision>(params.MARGINALIZATION_FLOAT);
+    windowSolver.setProjectionBatch(params.GPU_PROJECTION);
+    margWorkspace.batch.reset(params.GPU_PROJECTION ? new ProjectionBatch() : NULL);
+    if (params.GPU_PROJECTION && !margWorkspace.batch->onGpu())
+        ROS_WARN("gpu_projection: no cuda device or built without VINS_CUDA_SOLVER, the batch runs on the cpu");
+    if (params.USE_IMU)
+        params.STEREO ? selectMode<StereoImuMode>() : selectMode<MonoImuMode>();
+    else
+        params.STEREO ? selectMode<StereoMode>() : selectMode<MonoMode>();
+    poseHistory.reset(params.POSE_HISTORY, params.POSE_HISTORY_SHM);
+    propagator.setHistory(poseHistory.enabled() && params.USE_IMU ? &poseHistory : NULL);
+
+    if (params.TRACE_EVENTS > 0 && !params.OUTPUT_FOLDER.empty())
+        vins_trace::start(params.TRACE_EVENTS, params.OUTPUT_FOLDER + "/trace_vins.json", "vins_estimator");
+    if (publish)
+        publishThread.start(params);
+    memoryRate.setRate(1.0);
+    if (params.CHECKPOINT_PERIOD > 0 && !params.OUTPUT_FOLDER.empty())
+    {
+        checkpointRate.setRate(1.0 / params.CHECKPOINT_PERIOD);
+        checkpointWriter.start(params.OUTPUT_FOLDER + "/checkpoint.bin");
+    }
+    if (params.BATCH_LOG && !params.OUTPUT_FOLDER.empty())
+    {
+        BatchLogHeader header;
+        header.num_of_cam = params.NUM_OF_CAM;
+        header.use_imu = params.USE_IMU;
+        header.td = params.TD;
+        header.g = params.G;
+        for (int i = 0; i < params.NUM_OF_CAM; i++)
+        {
+            header.tic[i] = params.TIC[i];
+            header.ric[i] = params.RIC[i];
+        }
+        if (!batchLog.start(params.OUTPUT_FOLDER + "/batch_log.bin", header))
+            ROS_WARN("can not create %s/batch_log.bin", params.OUTPUT_FOLDER.c_str());
+    }
+    if (publish && params.SHOW_TRACK)
     {
+        trackImageRate.setRate(params.SHOW_TRACK_RATE);
+        trackImageThread.start();
+    }
+    std::cout << "MULTIPLE_THREAD is " << params.MULTIPLE_THREAD << '\n';
+    if (params.MULTIPLE_THREAD && !processThread.joinable())
+    {
+        stopFlag = false;
         processThread   = std::thread(&Estimator::processMeasurements, this);
+        placeThread(processThread.native_handle(), "vins_process", params.THREAD_PROCESS);
+    }
+    if (params.PIPELINE_QUEUE_SIZE > 0 && !trackThread.joinable())
+    {
+        trackStop = false;
+        trackThread = std::thread(&Estimator::trackProcess, this);
+        placeThread(trackThread.native_handle(), "vins_track", params.THREAD_TRACK);
+    }
+}
+
+// an image that does not own its pixels (cv_bridge::toCvShare, a wrapped buffer) is copied, the
+// caller may release or overwrite them before trackThread reads the frame
+static cv::Mat ownedImage(const cv::Mat &image)
+{
+    return image.u || image.empty() ? image : image.clone();
+}
+
+void Estimator::inputImage(double t, const cv::Mat &_img, const cv::Mat &_img1, const vector<cv::Mat> &_imgAux)
+{
+    if (!trackThread.joinable())
+    {
+        trackFrame(t, _img, _img1, _imgAux);
+        return;
     }
+
+    TrackRequest request;
+    request.t = t;
+    request.img = ownedImage(_img);
+    request.img1 = ownedImage(_img1);
+    for (const cv::Mat &image : _imgAux)
+        request.aux.push_back(ownedImage(image));
+    std::unique_lock<std::mutex> lk(mTrack);
+    if (!params.PIPELINE_DROP)
+        conTrack.wait(lk, [&]{ return trackBuf.size() < (size_t)params.PIPELINE_QUEUE_SIZE; });
+    else if (trackBuf.size() >= (size_t)params.PIPELINE_QUEUE_SIZE)
+    {
+        // the newest frame wins, the oldest waiting one is dropped
+        ROS_WARN("tracking falls behind, drop image %f", trackBuf.front().t);
+        trackBuf.pop_front();
+    }
+    trackBuf.push_back(std::move(request));
+    lk.unlock();
+    conTrack.notify_all();
 }
 
-void Estimator::inputImage(double t, const cv::Mat &_img, const cv::Mat &_img1)
+void Estimator::trackProcess()
+{
+    while (true)
+    {
+        TrackRequest request;
+        {
+            std::unique_lock<std::mutex> lk(mTrack);
+            conTrack.wait(lk, [&]{ return trackStop || !trackBuf.empty(); });
+            if (trackBuf.empty())
+                break;
+            request = std::move(trackBuf.front());
+            trackBuf.pop_front();
+        }
+        // a producer may wait for room
+        conTrack.notify_all();
+        trackFrame(request.t, request.img, request.img1, request.aux);
+    }
+}
+
+void Estimator::trackFrame(double t, const cv::Mat &_img, const cv::Mat &_img1, const vector<cv::Mat> &_imgAux)
 {
 //     if(begin_time_count<=0)
     inputImageCnt++;
-    map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> featureFrame;
+    // multiple_thread hands every other frame to the estimator
+    bool consumed = !params.MULTIPLE_THREAD || inputImageCnt % 2 == 0;
+    FeatureFrame featureFrame;
     // TicToc featureTrackerTime;
-    if(_img1.empty())
-        featureFrame = featureTracker.trackImage(t, _img);
+    ScopedStageTimer stage_timer(latencyProfiler, LatencyProfiler::TRACK);
+    VINS_TRACE_FRAME("trackFrame", t);
+    Matrix3d R_prev_cur;
+    bool reject_prior = consumed && params.REJECT_WITH_F;
+    if((reject_prior || params.GYRO_PREDICTION) && params.USE_IMU && !featureTracker.prev_pts.empty() &&
+       getCameraRotation(featureTracker.prev_track_time, t, R_prev_cur))
+    {
+        if (reject_prior)
+            featureTracker.setRotationPrior(R_prev_cur);
+        if (params.GYRO_PREDICTION)
+            featureTracker.setRotationPrediction(R_prev_cur);
+    }
+    if (params.GYRO_PREDICTION && params.USE_IMU)
+    {
+        for (auto &tracker : auxTrackers)
+        {
+            Matrix3d R_aux;
+            if (!tracker->prev_pts.empty() &&
+                getCameraRotation(tracker->prev_track_time, t, R_aux, tracker->first_camera))
+                tracker->setRotationPrediction(R_aux);
+        }
+    }
+    bool light = !consumed && params.LIGHT_TRACKING;
+    // the drawing is only copied out of the tracker, drawn and published by trackImageThread
+    bool draw = !light && params.SHOW_TRACK && publish && visualization.trackImageSubscribed() &&
+                trackImageRate.ready(t);
+    if (draw)
+        featureTracker.requestDrawing();
+    if (light)
+    {
+        // the tracks are only carried over to the next frame
+        if (!trackPool)
+            featureTracker.propagateTracks(t, _img);
+        else
+        {
+            ROS_ASSERT(_imgAux.size() == auxTrackers.size());
+            trackPool->run(auxTrackers.size() + 1, [&](int k, int)
+            {
+                if (k == 0)
+                    featureTracker.propagateTracks(t, _img);
+                else
+                    auxTrackers[k - 1]->propagateTracks(t, _imgAux[k - 1]);
+            });
+        }
+    }
+    else if (!trackPool)
+    {
+        if(_img1.empty())
+            featureFrame = featureTracker.trackImage(t, _img);
+        else
+            featureFrame = featureTracker.trackImage(t, _img, _img1);
+    }
     else
-        featureFrame = featureTracker.trackImage(t, _img, _img1);
+    {
+        // every tracker on its own worker, the frames are concatenated in camera order, which keeps
+        // them sorted by id
+        ROS_ASSERT(_imgAux.size() == auxTrackers.size());
+        vector<FeatureFrame> auxFrames(auxTrackers.size());
+        trackPool->run(auxTrackers.size() + 1, [&](int k, int)
+        {
+            if (k == 0)
+                featureFrame = featureTracker.trackImage(t, _img, _img1);
+            else
+                auxFrames[k - 1] = auxTrackers[k - 1]->trackImage(t, _imgAux[k - 1]);
+        });
+        for (const FeatureFrame &frame : auxFrames)
+            featureFrame.insert(featureFrame.end(), frame.begin(), frame.end());
+    }
+    if (draw)
+        trackImageThread.push(std::move(featureTracker.drawing));
+    cv::Mat rectify_left, rectify_right;
+    if (params.PUB_RECTIFY_IMAGE && visualization.rectifySubscribed() &&
+        featureTracker.rectifyImages(_img, _img1, rectify_left, rectify_right))
+        visualization.pubRectifyImage(rectify_left, rectify_right, featureTracker.m_rectify[0].cameraMatrix(), t);
     // if(begin_time_count--<=0)
     // {
     //     sum_t_feature += featureTrackerTime.toc();
     //     printf("featureTracker time: %f\n", sum_t_feature/(float)inputImageCnt);
     // }
     
-    if(MULTIPLE_THREAD)  
+    if(params.MULTIPLE_THREAD)  
     {     
-        if(inputImageCnt % 2 == 0)
+        if(consumed)
         {
             mBuf.lock();
-            featureBuf.push(make_pair(t, featureFrame));
+            featureBuf.push(make_pair(t, std::move(featureFrame)));
+            if (params.PUB_KEYFRAME_IMAGE)
+                imageBuf.push(make_pair(t, _img.clone()));
             mBuf.unlock();
+            con.notify_one();
         }
     }
     else
     {
         mBuf.lock();
-        featureBuf.push(make_pair(t, featureFrame));
+        featureBuf.push(make_pair(t, std::move(featureFrame)));
+        if (params.PUB_KEYFRAME_IMAGE)
+            imageBuf.push(make_pair(t, _img.clone()));
         mBuf.unlock();
         TicToc processTime;
         processMeasurements();
-        printf("process time: %f\n", processTime.toc());
+        VINS_DEBUG("process time: %f\n", processTime.toc());
     }
     
 }
 
 void Estimator::inputIMU(double t, const Vector3d &linearAcceleration, const Vector3d &angularVelocity)
 {
-    mBuf.lock();
-    accBuf.push(make_pair(t, linearAcceleration));
-    gyrBuf.push(make_pair(t, angularVelocity));
+    imuBuf.push(t, linearAcceleration, angularVelocity);
     //printf("input imu with time %f \n", t);
-    mBuf.unlock();
+    // the waiter checks imuBuf after raising imuWaiting and holds mBuf until it sleeps,
+    // so taking mBuf here is only needed when it may be asleep
+    if (imuWaiting)
+    {
+        mBuf.lock();
+        mBuf.unlock();
+        con.notify_one();
+    }
 
-    fastPredictIMU(t, linearAcceleration, angularVelocity);
-    if (solver_flag == NON_LINEAR)
-        pubLatestOdometry(latest_P, latest_Q, latest_V, t);
+    TicToc t_propagate;
+    if (propagator.propagate(imuBuf, t, linearAcceleration, angularVelocity) && publish)
+    {
+        const PropagationState &state = propagator.state();
+        visualization.pubLatestOdometry(state.P, state.Q, state.V, t);
+        if (propagateLatency.add(t, (ros::Time::now().toSec() - t) * 1000, t_propagate.toc()))
+        {
+            visualization.pubPropagateLatency(propagateLatency, t);
+            propagateLatency.clear();
+        }
+    }
 }
 
-void Estimator::inputFeature(double t, const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &featureFrame)
+void Estimator::inputFeature(double t, const FeatureFrame &featureFrame)
 {
     mBuf.lock();
     featureBuf.push(make_pair(t, featureFrame));
     mBuf.unlock();
+    con.notify_one();
 
-    if(!MULTIPLE_THREAD)
+    if(!params.MULTIPLE_THREAD)
         processMeasurements();
 }
 
+size_t Estimator::backlog()
+{
+    size_t tracking;
+    {
+        std::lock_guard<std::mutex> lk(mTrack);
+        tracking = trackBuf.size();
+    }
+    std::lock_guard<std::mutex> lk(mBuf);
+    return tracking + featureBuf.size() + publishThread.pending();
+}
 
-bool Estimator::getIMUInterval(double t0, double t1, vector<pair<double, Eigen::Vector3d>> &accVector, 
-                                vector<pair<double, Eigen::Vector3d>> &gyrVector)
+bool Estimator::getIMUInterval(double t0, double t1, ImuSpan &span)
 {
-    if(accBuf.empty())
+    double latest;
+    if(!imuBuf.latestTime(latest))
     {
-        printf("not receive imu\n");
+        VINS_WARN("not receive imu\n");
         return false;
     }
     //printf("get imu from %f %f\n", t0, t1);
-    //printf("imu fornt time %f   imu end time %f\n", accBuf.front().first, accBuf.back().first);
-    if(t1 <= accBuf.back().first)
+    if(t1 > latest)
+        return false;
+
+    span = imuBuf.interval(t0, t1);
+    return span.size() > 0;
+}
+
+void Estimator::snapshot(double t, bool with_points, PublishSnapshot &s) const
+{
+    s.t = t;
+    s.non_linear = solver_flag == NON_LINEAR;
+    s.margin_old = marginalization_flag == MARGIN_OLD;
+    s.td = td;
+    for (int i = 0; i <= params.WINDOW_SIZE; i++)
     {
-        while (accBuf.front().first <= t0)
-        {
-            accBuf.pop();
-            gyrBuf.pop();
-        }
-        while (accBuf.front().first < t1)
+        s.Ps[i] = Ps[i];
+        s.Vs[i] = Vs[i];
+        s.Rs[i] = Rs[i];
+        s.Headers[i] = Headers[i];
+    }
+    for (int i = 0; i < params.NUM_OF_CAM; i++)
+    {
+        s.tic[i] = tic[i];
+        s.ric[i] = ric[i];
+    }
+    s.key_poses = key_poses;
+    if (params.PUB_KEYFRAME_IMAGE && s.non_linear && s.margin_old)
+    {
+        for (const pair<double, cv::Mat> &image : windowImages)
+            if (image.first == Headers[params.WINDOW_SIZE - 2])
+                s.keyframe_image = image.second;
+    }
+    if (!with_points)
+        return;
+    s.features.reserve(f_manager.feature.size());
+    for (auto &it_per_id : f_manager.feature)
+    {
+        if (it_per_id.start_frame >= params.WINDOW_SIZE - 2 || it_per_id.solveFlag() != 1)
+            continue;
+        SnapshotFeature f;
+        f.feature_id = it_per_id.feature_id;
+        f.camera = it_per_id.camera;
+        f.start_frame = it_per_id.start_frame;
+        f.size = it_per_id.feature_per_frame.size();
+        f.pts_i = it_per_id.feature_per_frame[0].point * it_per_id.depth();
+        int imu_j = params.WINDOW_SIZE - 2 - it_per_id.start_frame;
+        if (imu_j < f.size)
         {
-            accVector.push_back(accBuf.front());
-            accBuf.pop();
-            gyrVector.push_back(gyrBuf.front());
-            gyrBuf.pop();
+            const FeaturePerFrame &obs = it_per_id.feature_per_frame[imu_j];
+            f.keyframe_obs[0] = obs.point.x();
+            f.keyframe_obs[1] = obs.point.y();
+            f.keyframe_obs[2] = obs.uv.x();
+            f.keyframe_obs[3] = obs.uv.y();
         }
-        accVector.push_back(accBuf.front());
-        gyrVector.push_back(gyrBuf.front());
+        s.features.push_back(f);
     }
-    else
+}
+
+void Estimator::memoryFootprint(MemoryFootprint &m) const
+{
+    m.features = f_manager.memoryBytes();
+    m.feature_count = f_manager.feature.size();
+    // a map node is the pair and four words of links and color
+    m.image_frames = 0;
+    for (const pair<const double, ImageFrame> &frame : all_image_frame)
     {
-        printf("wait for imu\n");
-        return false;
+        m.image_frames += sizeof(frame) + 4 * sizeof(void *);
+        if (frame.second.points)
+            m.image_frames += memory_stats::vectorBytes(*frame.second.points);
+        if (frame.second.pre_integration)
+            m.image_frames += sizeof(IntegrationBase) + memory_stats::vectorBytes(frame.second.pre_integration->samples);
     }
-    return true;
+    m.image_frame_count = all_image_frame.size();
+    m.resident = memory_stats::residentBytes();
 }
 
 bool Estimator::IMUAvailable(double t)
 {
-    if(!accBuf.empty() && t <= accBuf.back().first)
-        return true;
-    else
+    double latest;
+    return imuBuf.latestTime(latest) && t <= latest;
+}
+
+// integrate the buffered gyroscope between two image times, without consuming it
+bool Estimator::getCameraRotation(double t0, double t1, Matrix3d &R_c0_c1, int camera)
+{
+    ImuSample sample;
+    double latest;
+    if(!imuBuf.latestTime(latest) || latest < t1 ||
+       !imuBuf.get(imuBuf.begin(), sample) || sample.t > t0)
         return false;
+
+    trackingPriorBuf.read(trackingPrior);
+    const Vector3d &bg = trackingPrior.Bg;
+    Quaterniond q = Quaterniond::Identity();
+    double last_t = t0;
+    for(uint64_t i = imuBuf.lowerBound(t0, true); i < imuBuf.end() && last_t < t1; i++)
+    {
+        if(!imuBuf.get(i, sample))
+            return false;
+        double cur_t = std::min(sample.t, t1);
+        if(cur_t > last_t)
+            q = q * Utility::deltaQ((sample.gyr - bg) * (cur_t - last_t));
+        last_t = cur_t;
+    }
+    q.normalize();
+    const Matrix3d &r = trackingPrior.ric[camera];
+    R_c0_c1 = r.transpose() * q.toRotationMatrix() * r;
+    return true;
 }
 
 void Estimator::processMeasurements()
@@ -159,86 +519,158 @@ void Estimator::processMeasurements()
     {
         //printf("process measurments\n");
         TicToc t_process;
-        pair<double, map<int, vector<pair<int, Eigen::Matrix<double, 7, 1> > > > > feature;
-        vector<pair<double, Eigen::Vector3d>> accVector, gyrVector;
+        pair<double, FeatureFrame> feature;
+        ImuSpan imuSpan;
         if(!featureBuf.empty())
         {
-            feature = featureBuf.front();
+            feature.first = featureBuf.front().first;
+            if (pendingCheckpoint)
+            {
+                restoreCheckpoint(*pendingCheckpoint, feature.first);
+                pendingCheckpoint.reset();
+            }
             curTime = feature.first + td;
-            while(1)
+            if (params.USE_IMU && !IMUAvailable(curTime))
             {
-                if ((!USE_IMU  || IMUAvailable(feature.first + td)))
-                    break;
+                if (! params.MULTIPLE_THREAD)
+                    return;
+                // woken by inputIMU, gives up on the frame once the imu is imu_latency_budget behind
+                std::unique_lock<std::mutex> lk(mBuf);
+                VINS_TRACE_FRAME("waitIMU", feature.first);
+                auto ready = [&]{ return stopFlag || IMUAvailable(curTime); };
+                imuWaiting = true;
+                if (params.IMU_LATENCY_BUDGET > 0)
+                    con.wait_for(lk, std::chrono::duration<double, std::milli>(params.IMU_LATENCY_BUDGET), ready);
                 else
+                    con.wait(lk, ready);
+                imuWaiting = false;
+                if (stopFlag)
+                    break;
+                if (!IMUAvailable(curTime))
                 {
-                    printf("wait for imu ... \n");
-                    if (! MULTIPLE_THREAD)
-                        return;
-                    std::chrono::milliseconds dura(5);
-                    std::this_thread::sleep_for(dura);
+                    ROS_WARN("no imu for image %f after %.1f ms, drop it", feature.first, params.IMU_LATENCY_BUDGET);
+                    featureBuf.pop();
+                    continue;
                 }
             }
-            mBuf.lock();
-            if(USE_IMU)
-                getIMUInterval(prevTime, curTime, accVector, gyrVector);
+            VINS_TRACE_FRAME("processMeasurements", feature.first);
+            if(params.USE_IMU)
+                getIMUInterval(prevTime, curTime, imuSpan);
 
+            mBuf.lock();
+            // moved only once it is sure to be consumed, the single thread mode may return above
+            feature.second = std::move(featureBuf.front().second);
             featureBuf.pop();
+            // the images of dropped frames go with the next one
+            while (!imageBuf.empty() && imageBuf.front().first <= feature.first)
+            {
+                if (imageBuf.front().first == feature.first)
+                    windowImages.push_back(std::move(imageBuf.front()));
+                imageBuf.pop();
+            }
             mBuf.unlock();
 
-            if(USE_IMU)
+            if(params.USE_IMU)
             {
                 if(!initFirstPoseFlag)
-                    initFirstIMUPose(accVector);
-                for(size_t i = 0; i < accVector.size(); i++)
+                    initFirstIMUPose(imuSpan);
+                // read in place from imuBuf, the last sample is the one interpolated at curTime
+                ScopedStageTimer stage_timer(latencyProfiler, LatencyProfiler::PREINTEGRATION);
+                ImuSample sample;
+                double lastTime = prevTime;
+                for(size_t i = 0; i < imuSpan.size(); i++)
                 {
-                    double dt;
-                    if(i == 0)
-                        dt = accVector[i].first - prevTime;
-                    else if (i == accVector.size() - 1)
-                        dt = curTime - accVector[i - 1].first;
-                    else
-                        dt = accVector[i].first - accVector[i - 1].first;
-                    processIMU(accVector[i].first, dt, accVector[i].second, gyrVector[i].second);
+                    if(!imuSpan.get(i, sample))
+                        continue;
+                    processIMU(sample.t, sample.t - lastTime, sample.acc, sample.gyr);
+                    lastTime = sample.t;
                 }
             }
 
-            processImage(feature.second, feature.first);
-            prevTime = curTime;
+            if (params.FAST_POSE && params.USE_IMU && solver_flag == NON_LINEAR)
+                fastPose(feature.second, feature.first);
 
-            printStatistics(*this, 0);
+            memory_stats::AllocCounters frame_allocs = memory_stats::threadAllocations();
+            frameBudget.begin(params.FRAME_BUDGET);
+            processImage(std::move(feature.second), feature.first);
+            prevTime = curTime;
+            while (!windowImages.empty() && windowImages.front().first < Headers[0])
+                windowImages.pop_front();
 
-            std_msgs::Header header;
-            header.frame_id = "world";
-            header.stamp = ros::Time(feature.first);
+            // a copy here, the file is written on the writer thread
+            if (params.CHECKPOINT_PERIOD > 0 && !params.OUTPUT_FOLDER.empty() && solver_flag == NON_LINEAR &&
+                checkpointRate.ready(feature.first))
+            {
+                EstimatorCheckpoint c;
+                saveCheckpoint(c);
+                checkpointWriter.push(std::move(c));
+            }
 
-            pubOdometry(*this, header);
-            pubKeyPoses(*this, header);
-            pubCameraPose(*this, header);
-            pubPointCloud(*this, header);
-            pubKeyframe(*this);
-            pubTF(*this, header);
-            printf("process measurement time: %f\n", t_process.toc());
+            // the messages are built and sent on the publish thread
+            TicToc t_publish;
+            memory_stats::AllocCounters publish_allocs = memory_stats::threadAllocations();
+            if (publish)
+            {
+                PublishSnapshot s;
+                // the landmark map takes the marginalized points of every keyframe
+                bool with_points = visualization.pointsSubscribed() ||
+                                   (params.LANDMARK_MAP_VOXEL > 0 && marginalization_flag == MARGIN_OLD);
+                snapshot(feature.first, with_points, s);
+                if (visualization.memorySubscribed() && memoryRate.ready(feature.first))
+                {
+                    memoryFootprint(s.memory);
+                    s.has_memory = true;
+                }
+                publishThread.push(std::move(s));
+            }
+            double publish_time = t_publish.toc();
+            frameBudget.record(FrameBudget::PUBLISH, publish_time);
+            latencyProfiler.record(LatencyProfiler::PUBLISH, publish_time, publish_allocs);
+            int degraded = frameBudget.end();
+            latencyProfiler.record(LatencyProfiler::FRAME, frameBudget.frameTime(), frame_allocs);
+            if (params.ADAPTIVE_FEATURES)
+            {
+                featureTracker.featureBudget.backendTime(frameBudget.frameTime());
+                for (auto &tracker : auxTrackers)
+                    tracker->featureBudget.backendTime(frameBudget.frameTime());
+            }
+            if (frameBudget.enabled())
+            {
+                if (frameBudget.degradationChanged())
+                    ROS_WARN("frame budget %.1f ms, frame took %.1f ms, degraded: %s", params.FRAME_BUDGET,
+                             frameBudget.frameTime(), FrameBudget::describe(degraded).c_str());
+                if (publish)
+                    visualization.pubFrameBudget(frameBudget, degraded, feature.first);
+            }
+            VINS_DEBUG("process measurement time: %f\n", t_process.toc());
         }
 
-        if (! MULTIPLE_THREAD)
+        if (! params.MULTIPLE_THREAD)
             break;
 
-        std::chrono::milliseconds dura(2);
-        std::this_thread::sleep_for(dura);
+        // sleeps until inputImage/inputFeature queues a frame or stop() is called
+        std::unique_lock<std::mutex> lk(mBuf);
+        con.wait(lk, [&]{ return stopFlag || !featureBuf.empty(); });
+        if (stopFlag)
+            break;
     }
 }
 
 
-void Estimator::initFirstIMUPose(vector<pair<double, Eigen::Vector3d>> &accVector)
+void Estimator::initFirstIMUPose(const ImuSpan &imuSpan)
 {
     printf("init first imu pose\n");
     initFirstPoseFlag = true;
     //return;
     Eigen::Vector3d averAcc(0, 0, 0);
-    int n = (int)accVector.size();
-    for(size_t i = 0; i < accVector.size(); i++)
+    int n = 0;
+    ImuSample sample;
+    for(size_t i = 0; i < imuSpan.size(); i++)
     {
-        averAcc = averAcc + accVector[i].second;
+        if(!imuSpan.get(i, sample))
+            continue;
+        averAcc = averAcc + sample.acc;
+        n++;
     }
     averAcc = averAcc / n;
     printf("averge acc %f %f %f\n", averAcc.x(), averAcc.y(), averAcc.z());
@@ -259,19 +691,28 @@ void Estimator::initFirstPose(Eigen::Vector3d p, Eigen::Matrix3d r)
 }
 
 
+void Estimator::resizeWindow(int slots)
+{
+    Ps.setSize(slots);
+    Vs.setSize(slots);
+    Rs.setSize(slots);
+    Bas.setSize(slots);
+    Bgs.setSize(slots);
+    Headers.setSize(slots);
+    pre_integrations.setSize(slots);
+}
+
 void Estimator::clearState()
 {
-    for (int i = 0; i < WINDOW_SIZE + 1; i++)
+    // all of the storage, setParameter may change the window size
+    resizeWindow(MAX_WINDOW_SIZE + 1);
+    for (int i = 0; i < MAX_WINDOW_SIZE + 1; i++)
     {
         Rs[i].setIdentity();
         Ps[i].setZero();
         Vs[i].setZero();
         Bas[i].setZero();
         Bgs[i].setZero();
-        dt_buf[i].clear();
-        linear_acceleration_buf[i].clear();
-        angular_velocity_buf[i].clear();
-
         if (pre_integrations[i] != nullptr)
         {
             delete pre_integrations[i];
@@ -279,7 +720,7 @@ void Estimator::clearState()
         pre_integrations[i] = nullptr;
     }
 
-    for (int i = 0; i < NUM_OF_CAM; i++)
+    for (int i = 0; i < params.NUM_OF_CAM; i++)
     {
         tic[i] = Vector3d::Zero();
         ric[i] = Matrix3d::Identity();
@@ -290,8 +731,13 @@ void Estimator::clearState()
     sum_of_front = 0;
     frame_count = 0;
     solver_flag = INITIAL;
+    propagator.reset(PropagationState());
+    publishTrackingPrior();
+    if (!params.USE_IMU)
+        poseHistory.clear();
+    batchSegment++;
     initial_timestamp = 0;
-    all_image_frame.clear();
+    clearImageFrames();
 
     if (tmp_pre_integration != nullptr)
         delete tmp_pre_integration;
@@ -305,6 +751,304 @@ void Estimator::clearState()
     f_manager.clearState();
 
     failure_occur = 0;
+    warm_frames = 0;
+}
+
+void Estimator::clearImageFrames()
+{
+    for (auto &frame : all_image_frame)
+        delete frame.second.pre_integration;
+    all_image_frame.clear();
+}
+
+void Estimator::warmReinit()
+{
+    // the window goes back to its states before the failed solve, the features keep their
+    // observations and are triangulated again against those poses; the prior of the failed
+    // marginalization is dropped, everything else (trackers, parameters, gravity) stays
+    for (int i = 0; i <= frame_count; i++)
+    {
+        Ps[i] = warm_P[i];
+        Vs[i] = warm_V[i];
+        Rs[i] = warm_R[i];
+        Bas[i] = warm_Ba[i];
+        Bgs[i] = warm_Bg[i];
+    }
+    for (int i = 0; i < params.NUM_OF_CAM; i++)
+    {
+        tic[i] = warm_tic[i];
+        ric[i] = warm_ric[i];
+    }
+    td = warm_td;
+    f_manager.clearDepth();
+    f_manager.triangulate(frame_count, Ps, Rs, tic, ric);
+
+    if (last_marginalization_info != nullptr)
+        delete last_marginalization_info;
+    last_marginalization_info = nullptr;
+    last_marginalization_parameter_blocks.clear();
+    // a second failure before the window is renewed resets the estimator
+    warm_frames = params.WINDOW_SIZE;
+}
+
+double *Estimator::checkpointBlock(int kind, int index)
+{
+    switch (kind)
+    {
+    case BLOCK_POSE:
+        return index >= 0 && index <= params.WINDOW_SIZE ? para_Pose[index] : NULL;
+    case BLOCK_SPEED_BIAS:
+        return index >= 0 && index <= params.WINDOW_SIZE ? para_SpeedBias[index] : NULL;
+    case BLOCK_EX_POSE:
+        return index >= 0 && index < params.NUM_OF_CAM ? para_Ex_Pose[index] : NULL;
+    case BLOCK_TD:
+        return para_Td[0];
+    }
+    return NULL;
+}
+
+bool Estimator::checkpointBlockOf(const double *block, int &kind, int &index) const
+{
+    index = 0;
+    for (int i = 0; i <= params.WINDOW_SIZE; i++)
+    {
+        index = i;
+        if (block == para_Pose[i])
+            kind = BLOCK_POSE;
+        else if (block == para_SpeedBias[i])
+            kind = BLOCK_SPEED_BIAS;
+        else if (i < params.NUM_OF_CAM && block == para_Ex_Pose[i])
+            kind = BLOCK_EX_POSE;
+        else
+            continue;
+        return true;
+    }
+    kind = BLOCK_TD;
+    index = 0;
+    return block == para_Td[0];
+}
+
+void Estimator::saveCheckpoint(EstimatorCheckpoint &c) const
+{
+    c.window_size = params.WINDOW_SIZE;
+    c.num_of_cam = params.NUM_OF_CAM;
+    c.use_imu = params.USE_IMU;
+    c.prev_time = prevTime;
+    c.td = td;
+    c.g = g;
+    c.acc_0 = acc_0;
+    c.gyr_0 = gyr_0;
+    for (int i = 0; i < params.NUM_OF_CAM; i++)
+    {
+        c.tic[i] = tic[i];
+        c.ric[i] = ric[i];
+    }
+    for (int i = 0; i <= params.WINDOW_SIZE; i++)
+    {
+        c.Headers[i] = Headers[i];
+        c.Ps[i] = Ps[i];
+        c.Vs[i] = Vs[i];
+        c.Rs[i] = Rs[i];
+        c.Bas[i] = Bas[i];
+        c.Bgs[i] = Bgs[i];
+    }
+    c.pre_integrations.clear();
+    if (params.USE_IMU)
+    {
+        c.pre_integrations.resize(params.WINDOW_SIZE + 1);
+        for (int i = 0; i <= params.WINDOW_SIZE; i++)
+        {
+            CheckpointPreintegration &p = c.pre_integrations[i];
+            p.acc_0 = pre_integrations[i]->linearized_acc;
+            p.gyr_0 = pre_integrations[i]->linearized_gyr;
+            p.ba = pre_integrations[i]->linearized_ba;
+            p.bg = pre_integrations[i]->linearized_bg;
+            p.samples = pre_integrations[i]->samples;
+        }
+    }
+
+    // the prior is linearized at the values kept with it, the blocks are saved by what they hold
+    c.prior_m = c.prior_n = 0;
+    if (last_marginalization_info && last_marginalization_info->valid)
+    {
+        const MarginalizationInfo &prior = *last_marginalization_info;
+        bool mapped = true;
+        for (size_t k = 0; k < last_marginalization_parameter_blocks.size() && mapped; k++)
+        {
+            int kind, index;
+            mapped = checkpointBlockOf(last_marginalization_parameter_blocks[k], kind, index);
+            c.prior_kind.push_back(kind);
+            c.prior_index.push_back(index);
+            c.prior_size.push_back(prior.keep_block_size[k]);
+            c.prior_idx.push_back(prior.keep_block_idx[k]);
+            c.prior_data.push_back(vector<double>(prior.keep_block_data[k], prior.keep_block_data[k] + prior.keep_block_size[k]));
+        }
+        if (mapped)
+        {
+            c.prior_m = prior.m;
+            c.prior_n = prior.n;
+            c.prior_jacobians = prior.linearized_jacobians;
+            c.prior_residuals = prior.linearized_residuals;
+        }
+        else
+        {
+            ROS_WARN("checkpoint without the prior, it keeps a block outside the window");
+            c.prior_kind.clear();
+            c.prior_index.clear();
+            c.prior_size.clear();
+            c.prior_idx.clear();
+            c.prior_data.clear();
+        }
+    }
+
+    c.features.resize(f_manager.feature.size());
+    size_t k = 0;
+    for (const FeaturePerId &it_per_id : f_manager.feature)
+    {
+        CheckpointFeature &f = c.features[k++];
+        f.feature_id = it_per_id.feature_id;
+        f.start_frame = it_per_id.start_frame;
+        f.camera = it_per_id.camera;
+        f.inv_depth = it_per_id.inv_depth[0];
+        f.observations.assign(it_per_id.feature_per_frame.begin(), it_per_id.feature_per_frame.end());
+    }
+}
+
+void Estimator::logKeyframes(int count)
+{
+    vector<BatchKeyframe> keyframes(count);
+    for (int i = 0; i < count; i++)
+    {
+        BatchKeyframe &k = keyframes[i];
+        k.segment = batchSegment;
+        k.t = Headers[i];
+        k.P = Ps[i];
+        k.V = Vs[i];
+        k.Ba = Bas[i];
+        k.Bg = Bgs[i];
+        k.R = Rs[i];
+        CheckpointPreintegration &p = k.to_next;
+        if (params.USE_IMU && i < frame_count)
+        {
+            p.acc_0 = pre_integrations[i + 1]->linearized_acc;
+            p.gyr_0 = pre_integrations[i + 1]->linearized_gyr;
+            p.ba = pre_integrations[i + 1]->linearized_ba;
+            p.bg = pre_integrations[i + 1]->linearized_bg;
+            p.samples = pre_integrations[i + 1]->samples;
+        }
+        else
+            p.acc_0 = p.gyr_0 = p.ba = p.bg = Vector3d::Zero();
+    }
+    for (const FeaturePerId &it_per_id : f_manager.feature)
+    {
+        int frame = it_per_id.start_frame;
+        if (frame >= count)
+            continue;
+        for (const FeaturePerFrame &o : it_per_id.feature_per_frame)
+        {
+            if (frame >= count)
+                break;
+            BatchObservation b;
+            b.feature_id = it_per_id.feature_id;
+            b.camera = it_per_id.camera;
+            b.observation = o;
+            keyframes[frame++].observations.push_back(b);
+        }
+        if (it_per_id.depth() > 0)
+        {
+            int s = it_per_id.start_frame, c = it_per_id.camera;
+            Vector3d pts_w = Rs[s] * (ric[c] * (it_per_id.depth() * it_per_id.feature_per_frame[0].point) + tic[c]) + Ps[s];
+            keyframes[s].landmarks.push_back(make_pair(it_per_id.feature_id, pts_w));
+        }
+    }
+    for (BatchKeyframe &k : keyframes)
+        batchLog.push(std::move(k));
+}
+
+void Estimator::restoreCheckpoint(const EstimatorCheckpoint &c, double t)
+{
+    td = c.td;
+    for (int i = 0; i < params.NUM_OF_CAM; i++)
+    {
+        tic[i] = c.tic[i];
+        ric[i] = c.ric[i];
+    }
+    f_manager.setRic(ric);
+    // the imu of the gap is lost with the restart, the first preintegration bridges a short one
+    double gap = t + td - c.prev_time;
+    if (gap <= 0 || gap > params.CHECKPOINT_MAX_GAP)
+    {
+        ROS_WARN("checkpoint %.2f s before the first image, only its extrinsics and td are kept", gap);
+        return;
+    }
+
+    g = c.g;
+    for (int i = 0; i <= params.WINDOW_SIZE; i++)
+    {
+        Headers[i] = c.Headers[i];
+        Ps[i] = c.Ps[i];
+        Vs[i] = c.Vs[i];
+        Rs[i] = c.Rs[i];
+        Bas[i] = c.Bas[i];
+        Bgs[i] = c.Bgs[i];
+    }
+    acc_0 = c.acc_0;
+    gyr_0 = c.gyr_0;
+    first_imu = true;
+    if (params.USE_IMU)
+    {
+        for (int i = 0; i <= params.WINDOW_SIZE; i++)
+        {
+            const CheckpointPreintegration &p = c.pre_integrations[i];
+            delete pre_integrations[i];
+            pre_integrations[i] = new IntegrationBase{p.acc_0, p.gyr_0, p.ba, p.bg, params};
+            for (const ImuStep &s : p.samples)
+                pre_integrations[i]->push_back(s.dt, s.acc, s.gyr);
+        }
+    }
+    clearImageFrames();
+
+    // the tracker starts its ids over after the restart, the restored features get negative ones
+    f_manager.clearState();
+    FeatureId feature_id = -1;
+    for (const CheckpointFeature &f : c.features)
+    {
+        FeaturePerId &it_per_id = f_manager.restoreFeature(feature_id--, f.start_frame, f.camera);
+        for (const FeaturePerFrame &obs : f.observations)
+            it_per_id.feature_per_frame.push_back(obs);
+        it_per_id.used_num = f.observations.size();
+        it_per_id.inv_depth[0] = f.inv_depth;
+    }
+
+    delete last_marginalization_info;
+    last_marginalization_info = nullptr;
+    last_marginalization_parameter_blocks.clear();
+    if (!c.prior_kind.empty())
+    {
+        MarginalizationInfo *prior = new MarginalizationInfo(&threadPool, &margWorkspace);
+        prior->m = c.prior_m;
+        prior->n = c.prior_n;
+        prior->linearized_jacobians = c.prior_jacobians;
+        prior->linearized_residuals = c.prior_residuals;
+        std::unordered_map<long, double *> addr_shift;
+        for (size_t k = 0; k < c.prior_kind.size(); k++)
+        {
+            double *block = checkpointBlock(c.prior_kind[k], c.prior_index[k]);
+            ROS_ASSERT(block != NULL);
+            prior->addKeptBlock(block, c.prior_size[k], c.prior_idx[k], c.prior_data[k].data());
+            addr_shift[reinterpret_cast<long>(block)] = block;
+        }
+        last_marginalization_parameter_blocks = prior->getParameterBlocks(addr_shift);
+        last_marginalization_info = prior;
+    }
+
+    frame_count = params.WINDOW_SIZE;
+    solver_flag = NON_LINEAR;
+    initFirstPoseFlag = true;
+    warm_frames = 0;
+    prevTime = c.prev_time;
+    updateLatestStates();
+    ROS_INFO("resumed from the checkpoint of %f, %d features", c.Headers[params.WINDOW_SIZE], (int)c.features.size());
 }
 
 void Estimator::processIMU(double t, double dt, const Vector3d &linear_acceleration, const Vector3d &angular_velocity)
@@ -318,18 +1062,14 @@ void Estimator::processIMU(double t, double dt, const Vector3d &linear_accelerat
 
     if (!pre_integrations[frame_count])
     {
-        pre_integrations[frame_count] = new IntegrationBase{acc_0, gyr_0, Bas[frame_count], Bgs[frame_count]};
+        pre_integrations[frame_count] = new IntegrationBase{acc_0, gyr_0, Bas[frame_count], Bgs[frame_count], params};
     }
     if (frame_count != 0)
     {
         pre_integrations[frame_count]->push_back(dt, linear_acceleration, angular_velocity);
-        //if(solver_flag != NON_LINEAR)
+        if (solver_flag == INITIAL)
             tmp_pre_integration->push_back(dt, linear_acceleration, angular_velocity);
 
-        dt_buf[frame_count].push_back(dt);
-        linear_acceleration_buf[frame_count].push_back(linear_acceleration);
-        angular_velocity_buf[frame_count].push_back(angular_velocity);
-
         int j = frame_count;         
         Vector3d un_acc_0 = Rs[j] * (acc_0 - Bas[j]) - g;
         Vector3d un_gyr = 0.5 * (gyr_0 + angular_velocity) - Bgs[j];
@@ -343,8 +1083,9 @@ void Estimator::processIMU(double t, double dt, const Vector3d &linear_accelerat
     gyr_0 = angular_velocity; 
 }
 
-void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image, const double header)
+void Estimator::processImage(FeatureFrame &&image, const double header)
 {
+    VINS_TRACE("processImage");
     ROS_DEBUG("new image coming ------------------------------------------");
     ROS_DEBUG("Adding feature points %lu", image.size());
     if (f_manager.addFeatureCheckParallax(frame_count, image, td))
@@ -363,25 +1104,30 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
     ROS_DEBUG("number of feature: %d", f_manager.getFeatureCount());
     Headers[frame_count] = header;
 
-    ImageFrame imageframe(image, header);
-    imageframe.pre_integration = tmp_pre_integration;
-    all_image_frame.insert(make_pair(header, imageframe));
-    tmp_pre_integration = new IntegrationBase{acc_0, gyr_0, Bas[frame_count], Bgs[frame_count]};
+    // the structure from motion and the gyroscope bias of the initialization read the frame history,
+    // the observations are handed over instead of copied
+    if (solver_flag == INITIAL)
+    {
+        ImageFrame imageframe(std::make_shared<const FeatureFrame>(std::move(image)), header);
+        imageframe.pre_integration = tmp_pre_integration;
+        all_image_frame.insert(make_pair(header, imageframe));
+        tmp_pre_integration = new IntegrationBase{acc_0, gyr_0, Bas[frame_count], Bgs[frame_count], params};
+    }
 
-    if(ESTIMATE_EXTRINSIC == 2)
+    if(params.ESTIMATE_EXTRINSIC == 2)
     {
         ROS_INFO("calibrating extrinsic param, rotation movement is needed");
         if (frame_count != 0)
         {
             vector<pair<Vector3d, Vector3d>> corres = f_manager.getCorresponding(frame_count - 1, frame_count);
             Matrix3d calib_ric;
-            if (initial_ex_rotation.CalibrationExRotation(corres, pre_integrations[frame_count]->delta_q, calib_ric))
+            if (initial_ex_rotation.CalibrationExRotation(corres, pre_integrations[frame_count]->delta_q, params.WINDOW_SIZE, calib_ric))
             {
                 ROS_WARN("initial extrinsic rotation calib success");
                 ROS_WARN_STREAM("initial extrinsic rotation: " << endl << calib_ric);
                 ric[0] = calib_ric;
-                RIC[0] = calib_ric;
-                ESTIMATE_EXTRINSIC = 1;
+                params.RIC[0] = calib_ric;
+                params.ESTIMATE_EXTRINSIC = 1;
             }
         }
     }
@@ -389,12 +1135,12 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
     if (solver_flag == INITIAL)
     {
         // monocular + IMU initilization
-        if (!STEREO && USE_IMU)
+        if (!params.STEREO && params.USE_IMU)
         {
-            if (frame_count == WINDOW_SIZE)
+            if (frame_count == params.WINDOW_SIZE)
             {
                 bool result = false;
-                if(ESTIMATE_EXTRINSIC != 2 && (header - initial_timestamp) > 0.1)
+                if(params.ESTIMATE_EXTRINSIC != 2 && (header - initial_timestamp) > 0.1)
                 {
                     result = initialStructure();
                     initial_timestamp = header;   
@@ -412,11 +1158,11 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
         }
 
         // stereo + IMU initilization
-        if(STEREO && USE_IMU)
+        if(params.STEREO && params.USE_IMU)
         {
             f_manager.initFramePoseByPnP(frame_count, Ps, Rs, tic, ric);
             f_manager.triangulate(frame_count, Ps, Rs, tic, ric);
-            if (frame_count == WINDOW_SIZE)
+            if (frame_count == params.WINDOW_SIZE)
             {
                 map<double, ImageFrame>::iterator frame_it;
                 int i = 0;
@@ -426,10 +1172,13 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
                     frame_it->second.T = Ps[i];
                     i++;
                 }
-                solveGyroscopeBias(all_image_frame, Bgs);
-                for (int i = 0; i <= WINDOW_SIZE; i++)
+                solveGyroscopeBias(all_image_frame, Bgs, params);
+                for (int i = 0; i <= params.WINDOW_SIZE; i++)
                 {
-                    pre_integrations[i]->repropagate(Vector3d::Zero(), Bgs[i]);
+                    if (params.BIAS_CORRECTION)
+                        pre_integrations[i]->correctBias(Vector3d::Zero(), Bgs[i]);
+                    else
+                        pre_integrations[i]->repropagate(Vector3d::Zero(), Bgs[i]);
                 }
                 solver_flag = NON_LINEAR;
                 optimization();
@@ -439,13 +1188,13 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
         }
 
         // stereo only initilization
-        if(STEREO && !USE_IMU)
+        if(params.STEREO && !params.USE_IMU)
         {
             f_manager.initFramePoseByPnP(frame_count, Ps, Rs, tic, ric);
             f_manager.triangulate(frame_count, Ps, Rs, tic, ric);
             optimization();
 
-            if(frame_count == WINDOW_SIZE)
+            if(frame_count == params.WINDOW_SIZE)
             {
                 solver_flag = NON_LINEAR;
                 slideWindow();
@@ -453,7 +1202,7 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
             }
         }
 
-        if(frame_count < WINDOW_SIZE)
+        if(frame_count < params.WINDOW_SIZE)
         {
             frame_count++;
             int prev_frame = frame_count - 1;
@@ -468,40 +1217,97 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
     else
     {
         TicToc t_solve;
-        if(!USE_IMU)
+        if(!params.USE_IMU)
             f_manager.initFramePoseByPnP(frame_count, Ps, Rs, tic, ric);
+        TicToc t_triangulate;
+        memory_stats::AllocCounters triangulate_allocs = memory_stats::threadAllocations();
         f_manager.triangulate(frame_count, Ps, Rs, tic, ric);
-        optimization();
-        set<int> removeIndex;
-        outliersRejection(removeIndex);
+        double triangulate_time = t_triangulate.toc();
+        frameBudget.record(FrameBudget::TRIANGULATE, triangulate_time);
+        latencyProfiler.record(LatencyProfiler::TRIANGULATE, triangulate_time, triangulate_allocs);
+        if (params.WARM_REINIT)
+        {
+            // the window before the optimization that may fail, the newest frame at its imu prediction
+            for (int i = 0; i <= frame_count; i++)
+            {
+                warm_P[i] = Ps[i];
+                warm_V[i] = Vs[i];
+                warm_R[i] = Rs[i];
+                warm_Ba[i] = Bas[i];
+                warm_Bg[i] = Bgs[i];
+            }
+            for (int i = 0; i < params.NUM_OF_CAM; i++)
+            {
+                warm_tic[i] = tic[i];
+                warm_ric[i] = ric[i];
+            }
+            warm_td = td;
+        }
+        // keyframe_optimization: a frame that is not a keyframe keeps its imu prediction, refined
+        // against the solved features with 2, the window is only optimized for keyframes
+        bool window_optimization = !(params.KEYFRAME_OPTIMIZATION && params.USE_IMU &&
+                                     marginalization_flag == MARGIN_SECOND_NEW);
+        if (window_optimization)
+            optimization();
+        else
+        {
+            if (params.KEYFRAME_OPTIMIZATION == 2)
+                refineNewestPose();
+            marginalizeSecondNew();
+        }
+
+        // the residuals of a failed solve say nothing about the features, nothing is rejected then
+        bool failed = failureDetection();
+        if (failed)
+        {
+            ROS_WARN("failure detection!");
+            failure_occur = 1;
+            if (params.WARM_REINIT && params.USE_IMU && warm_frames == 0)
+            {
+                warmReinit();
+                ROS_WARN("system warm restart!");
+            }
+            else
+            {
+                clearState();
+                setParameter();
+                ROS_WARN("system reboot!");
+                return;
+            }
+        }
+        else if (warm_frames > 0)
+            warm_frames--;
+
+        set<FeatureId> removeIndex;
+        if (!failed && window_optimization && frameBudget.allowOutlierRejection())
+        {
+            TicToc t_outlier;
+            memory_stats::AllocCounters outlier_allocs = memory_stats::threadAllocations();
+            outliersRejection(removeIndex);
+            double outlier_time = t_outlier.toc();
+            frameBudget.record(FrameBudget::OUTLIER, outlier_time);
+            latencyProfiler.record(LatencyProfiler::OUTLIER, outlier_time, outlier_allocs);
+        }
         f_manager.removeOutlier(removeIndex);
-        if (! MULTIPLE_THREAD)
+        if (! params.MULTIPLE_THREAD)
         {
             featureTracker.removeOutliers(removeIndex);
+            for (auto &tracker : auxTrackers)
+                tracker->removeOutliers(removeIndex);
             predictPtsInNextFrame();
         }
             
         ROS_DEBUG("solver costs: %fms", t_solve.toc());
 
-        if (failureDetection())
-        {
-            ROS_WARN("failure detection!");
-            failure_occur = 1;
-            clearState();
-            setParameter();
-            ROS_WARN("system reboot!");
-            return;
-        }
-
         slideWindow();
         f_manager.removeFailures();
         // prepare output of VINS
         key_poses.clear();
-        for (int i = 0; i <= WINDOW_SIZE; i++)
+        for (int i = 0; i <= params.WINDOW_SIZE; i++)
             key_poses.push_back(Ps[i]);
 
-        last_R = Rs[WINDOW_SIZE];
-        last_P = Ps[WINDOW_SIZE];
+        last_R = Rs[params.WINDOW_SIZE];
+        last_P = Ps[params.WINDOW_SIZE];
         last_R0 = Rs[0];
         last_P0 = Ps[0];
         updateLatestStates();
@@ -540,12 +1346,14 @@ bool Estimator::initialStructure()
         }
     }
     // global sfm
-    Quaterniond Q[frame_count + 1];
-    Vector3d T[frame_count + 1];
-    map<int, Vector3d> sfm_tracked_points;
+    Quaterniond Q[MAX_WINDOW_SIZE + 1];
+    Vector3d T[MAX_WINDOW_SIZE + 1];
+    map<FeatureId, Vector3d> sfm_tracked_points;
     vector<SFMFeature> sfm_f;
     for (auto &it_per_id : f_manager.feature)
     {
+        if (it_per_id.camera != 0)
+            continue;
         int imu_j = it_per_id.start_frame - 1;
         SFMFeature tmp_feature;
         tmp_feature.state = false;
@@ -558,36 +1366,77 @@ bool Estimator::initialStructure()
         }
         sfm_f.push_back(tmp_feature);
     } 
-    Matrix3d relative_R;
-    Vector3d relative_T;
-    int l;
-    if (!relativePose(relative_R, relative_T, l))
+    Matrix3d relative_R[MAX_WINDOW_SIZE];
+    Vector3d relative_T[MAX_WINDOW_SIZE];
+    int candidate_l[MAX_WINDOW_SIZE];
+    int candidates = relativePose(relative_R, relative_T, candidate_l, max(params.INIT_CANDIDATES, 1));
+    if (!candidates)
     {
         ROS_INFO("Not enough features or parallax; Move device around");
         return false;
     }
-    GlobalSFM sfm;
-    if(!sfm.construct(frame_count + 1, Q, T, l,
-              relative_R, relative_T,
-              sfm_f, sfm_tracked_points))
+    int l = candidate_l[0];
+    if (candidates == 1)
     {
-        ROS_DEBUG("global SFM failed!");
-        marginalization_flag = MARGIN_OLD;
-        return false;
+        GlobalSFM sfm(&threadPool);
+        if(!sfm.construct(frame_count + 1, Q, T, l,
+                  relative_R[0], relative_T[0],
+                  sfm_f, sfm_tracked_points))
+        {
+            ROS_DEBUG("global SFM failed!");
+            marginalization_flag = MARGIN_OLD;
+            return false;
+        }
+    }
+    else
+    {
+        // one sfm per reference frame, each on its own worker, the structure with the most points
+        // at the lowest reprojection error is kept
+        Quaterniond candidate_Q[MAX_WINDOW_SIZE][MAX_WINDOW_SIZE + 1];
+        Vector3d candidate_T[MAX_WINDOW_SIZE][MAX_WINDOW_SIZE + 1];
+        map<FeatureId, Vector3d> candidate_points[MAX_WINDOW_SIZE];
+        double score[MAX_WINDOW_SIZE];
+        threadPool.run(candidates, [&](int c, int)
+        {
+            vector<SFMFeature> candidate_f = sfm_f;
+            GlobalSFM sfm;
+            score[c] = -1;
+            if (sfm.construct(frame_count + 1, candidate_Q[c], candidate_T[c], candidate_l[c],
+                              relative_R[c], relative_T[c], candidate_f, candidate_points[c]))
+                score[c] = sfm.final_points / (1.0 + sfm.final_rms * FOCAL_LENGTH);
+        });
+        int best = -1;
+        for (int c = 0; c < candidates; c++)
+            if (score[c] >= 0 && (best < 0 || score[c] > score[best]))
+                best = c;
+        if (best < 0)
+        {
+            ROS_DEBUG("global SFM failed for all %d candidates!", candidates);
+            marginalization_flag = MARGIN_OLD;
+            return false;
+        }
+        l = candidate_l[best];
+        for (int i = 0; i <= frame_count; i++)
+        {
+            Q[i] = candidate_Q[best][i];
+            T[i] = candidate_T[best][i];
+        }
+        sfm_tracked_points.swap(candidate_points[best]);
+        ROS_DEBUG("sfm candidate l %d of %d, score %f", l, candidates, score[best]);
     }
 
     //solve pnp for all frame
+    // the keyframes are taken from the sfm, every other frame is solved on its own starting from
+    // the next keyframe, all of them at once
     map<double, ImageFrame>::iterator frame_it;
-    map<int, Vector3d>::iterator it;
+    vector<pair<ImageFrame *, int>> pnp_frames;
     frame_it = all_image_frame.begin( );
     for (int i = 0; frame_it != all_image_frame.end( ); frame_it++)
     {
-        // provide initial guess
-        cv::Mat r, rvec, t, D, tmp_r;
         if((frame_it->first) == Headers[i])
         {
             frame_it->second.is_key_frame = true;
-            frame_it->second.R = Q[i].toRotationMatrix() * RIC[0].transpose();
+            frame_it->second.R = Q[i].toRotationMatrix() * params.RIC[0].transpose();
             frame_it->second.T = T[i];
             i++;
             continue;
@@ -596,43 +1445,48 @@ bool Estimator::initialStructure()
         {
             i++;
         }
+        frame_it->second.is_key_frame = false;
+        pnp_frames.push_back(make_pair(&frame_it->second, i));
+    }
+    vector<char> pnp_ok(pnp_frames.size(), 0);
+    threadPool.run(pnp_frames.size(), [&](int k, int)
+    {
+        ImageFrame &frame = *pnp_frames[k].first;
+        int i = pnp_frames[k].second;
+        // provide initial guess
+        cv::Mat r, rvec, t, D, tmp_r;
         Matrix3d R_inital = (Q[i].inverse()).toRotationMatrix();
         Vector3d P_inital = - R_inital * T[i];
         cv::eigen2cv(R_inital, tmp_r);
         cv::Rodrigues(tmp_r, rvec);
         cv::eigen2cv(P_inital, t);
 
-        frame_it->second.is_key_frame = false;
         vector<cv::Point3f> pts_3_vector;
         vector<cv::Point2f> pts_2_vector;
-        for (auto &id_pts : frame_it->second.points)
+        for (auto &i_p : *frame.points)
         {
-            int feature_id = id_pts.first;
-            for (auto &i_p : id_pts.second)
+            FeatureId feature_id = i_p.feature_id;
+            map<FeatureId, Vector3d>::const_iterator it = sfm_tracked_points.find(feature_id);
+            if(it != sfm_tracked_points.end())
             {
-                it = sfm_tracked_points.find(feature_id);
-                if(it != sfm_tracked_points.end())
-                {
-                    Vector3d world_pts = it->second;
-                    cv::Point3f pts_3(world_pts(0), world_pts(1), world_pts(2));
-                    pts_3_vector.push_back(pts_3);
-                    Vector2d img_pts = i_p.second.head<2>();
-                    cv::Point2f pts_2(img_pts(0), img_pts(1));
-                    pts_2_vector.push_back(pts_2);
-                }
+                Vector3d world_pts = it->second;
+                cv::Point3f pts_3(world_pts(0), world_pts(1), world_pts(2));
+                pts_3_vector.push_back(pts_3);
+                Vector2d img_pts = i_p.xyz_uv_velocity.head<2>();
+                cv::Point2f pts_2(img_pts(0), img_pts(1));
+                pts_2_vector.push_back(pts_2);
             }
         }
         cv::Mat K = (cv::Mat_<double>(3, 3) << 1, 0, 0, 0, 1, 0, 0, 0, 1);     
         if(pts_3_vector.size() < 6)
         {
-            cout << "pts_3_vector size " << pts_3_vector.size() << endl;
-            ROS_DEBUG("Not enough points for solve pnp !");
-            return false;
+            ROS_DEBUG("Not enough points for solve pnp, pts_3_vector size %d", (int)pts_3_vector.size());
+            return;
         }
         if (! cv::solvePnP(pts_3_vector, pts_2_vector, K, D, rvec, t, 1))
         {
             ROS_DEBUG("solve pnp fail!");
-            return false;
+            return;
         }
         cv::Rodrigues(rvec, r);
         MatrixXd R_pnp,tmp_R_pnp;
@@ -641,9 +1495,13 @@ bool Estimator::initialStructure()
         MatrixXd T_pnp;
         cv::cv2eigen(t, T_pnp);
         T_pnp = R_pnp * (-T_pnp);
-        frame_it->second.R = R_pnp * RIC[0].transpose();
-        frame_it->second.T = T_pnp;
-    }
+        frame.R = R_pnp * params.RIC[0].transpose();
+        frame.T = T_pnp;
+        pnp_ok[k] = 1;
+    });
+    for (char ok : pnp_ok)
+        if (!ok)
+            return false;
     if (visualInitialAlign())
         return true;
     else
@@ -659,7 +1517,7 @@ bool Estimator::visualInitialAlign()
     TicToc t_g;
     VectorXd x;
     //solve scale
-    bool result = VisualIMUAlignment(all_image_frame, Bgs, g, x);
+    bool result = VisualIMUAlignment(all_image_frame, Bgs, g, x, params);
     if(!result)
     {
         ROS_DEBUG("solve g failed!");
@@ -677,12 +1535,15 @@ bool Estimator::visualInitialAlign()
     }
 
     double s = (x.tail<1>())(0);
-    for (int i = 0; i <= WINDOW_SIZE; i++)
+    for (int i = 0; i <= params.WINDOW_SIZE; i++)
     {
-        pre_integrations[i]->repropagate(Vector3d::Zero(), Bgs[i]);
+        if (params.BIAS_CORRECTION)
+            pre_integrations[i]->correctBias(Vector3d::Zero(), Bgs[i]);
+        else
+            pre_integrations[i]->repropagate(Vector3d::Zero(), Bgs[i]);
     }
     for (int i = frame_count; i >= 0; i--)
-        Ps[i] = s * Ps[i] - Rs[i] * TIC[0] - (s * Ps[0] - Rs[0] * TIC[0]);
+        Ps[i] = s * Ps[i] - Rs[i] * params.TIC[0] - (s * Ps[0] - Rs[0] * params.TIC[0]);
     int kv = -1;
     map<double, ImageFrame>::iterator frame_i;
     for (frame_i = all_image_frame.begin(); frame_i != all_image_frame.end(); frame_i++)
@@ -715,13 +1576,30 @@ bool Estimator::visualInitialAlign()
     return true;
 }
 
-bool Estimator::relativePose(Matrix3d &relative_R, Vector3d &relative_T, int &l)
+int Estimator::relativePose(Matrix3d *relative_R, Vector3d *relative_T, int *l, int max_candidates)
 {
     // find previous frame which contians enough correspondance and parallex with newest frame
-    for (int i = 0; i < WINDOW_SIZE; i++)
+    // all frames are tried at once, the oldest max_candidates that work are returned oldest first
+    Matrix3d candidate_R[MAX_WINDOW_SIZE];
+    Vector3d candidate_T[MAX_WINDOW_SIZE];
+    double candidate_parallax[MAX_WINDOW_SIZE];
+    char candidate_ok[MAX_WINDOW_SIZE];
+    // the newest camera in frame i from the preintegrated gyroscope, before the bias is solved
+    Matrix3d prior_R[MAX_WINDOW_SIZE];
+    if (params.USE_IMU)
+    {
+        Quaterniond q_i_n = Quaterniond::Identity();
+        for (int i = params.WINDOW_SIZE - 1; i >= 0; i--)
+        {
+            q_i_n = pre_integrations[i + 1]->delta_q * q_i_n;
+            prior_R[i] = ric[0].transpose() * q_i_n.toRotationMatrix() * ric[0];
+        }
+    }
+    threadPool.run(params.WINDOW_SIZE, [&](int i, int)
     {
+        candidate_ok[i] = 0;
         vector<pair<Vector3d, Vector3d>> corres;
-        corres = f_manager.getCorresponding(i, WINDOW_SIZE);
+        corres = f_manager.getCorresponding(i, params.WINDOW_SIZE);
         if (corres.size() > 20)
         {
             double sum_parallax = 0;
@@ -735,20 +1613,31 @@ bool Estimator::relativePose(Matrix3d &relative_R, Vector3d &relative_T, int &l)
 
             }
             average_parallax = 1.0 * sum_parallax / int(corres.size());
-            if(average_parallax * 460 > 30 && m_estimator.solveRelativeRT(corres, relative_R, relative_T))
-            {
-                l = i;
-                ROS_DEBUG("average_parallax %f choose l %d and newest frame to triangulate the whole structure", average_parallax * 460, l);
-                return true;
-            }
+            candidate_parallax[i] = average_parallax;
+            if(average_parallax * 460 > 30 &&
+               m_estimator.solveRelativeRT(corres, candidate_R[i], candidate_T[i], params.USE_IMU ? &prior_R[i] : NULL))
+                candidate_ok[i] = 1;
+        }
+    });
+    int n = 0;
+    for (int i = 0; i < params.WINDOW_SIZE && n < max_candidates; i++)
+    {
+        if (candidate_ok[i])
+        {
+            relative_R[n] = candidate_R[i];
+            relative_T[n] = candidate_T[i];
+            l[n] = i;
+            ROS_DEBUG("average_parallax %f choose l %d and newest frame to triangulate the whole structure", candidate_parallax[i] * 460, i);
+            n++;
         }
     }
-    return false;
+    return n;
 }
 
+template <class Mode>
 void Estimator::vector2double()
 {
-    for (int i = 0; i <= WINDOW_SIZE; i++)
+    for (int i = 0; i <= params.WINDOW_SIZE; i++)
     {
         para_Pose[i][0] = Ps[i].x();
         para_Pose[i][1] = Ps[i].y();
@@ -759,7 +1648,7 @@ void Estimator::vector2double()
         para_Pose[i][5] = q.z();
         para_Pose[i][6] = q.w();
 
-        if(USE_IMU)
+        if(Mode::imu)
         {
             para_SpeedBias[i][0] = Vs[i].x();
             para_SpeedBias[i][1] = Vs[i].y();
@@ -775,7 +1664,7 @@ void Estimator::vector2double()
         }
     }
 
-    for (int i = 0; i < NUM_OF_CAM; i++)
+    for (int i = 0; i < params.NUM_OF_CAM; i++)
     {
         para_Ex_Pose[i][0] = tic[i].x();
         para_Ex_Pose[i][1] = tic[i].y();
@@ -788,13 +1677,10 @@ void Estimator::vector2double()
     }
 
 
-    VectorXd dep = f_manager.getDepthVector();
-    for (int i = 0; i < f_manager.getFeatureCount(); i++)
-        para_Feature[i][0] = dep(i);
-
     para_Td[0][0] = td;
 }
 
+template <class Mode>
 void Estimator::double2vector()
 {
     Vector3d origin_R0 = Utility::R2ypr(Rs[0]);
@@ -807,7 +1693,7 @@ void Estimator::double2vector()
         failure_occur = 0;
     }
 
-    if(USE_IMU)
+    if(Mode::imu)
     {
         Vector3d origin_R00 = Utility::R2ypr(Quaterniond(para_Pose[0][6],
                                                           para_Pose[0][3],
@@ -825,7 +1711,7 @@ void Estimator::double2vector()
                                            para_Pose[0][5]).toRotationMatrix().transpose();
         }
 
-        for (int i = 0; i <= WINDOW_SIZE; i++)
+        for (int i = 0; i <= params.WINDOW_SIZE; i++)
         {
 
             Rs[i] = rot_diff * Quaterniond(para_Pose[i][6], para_Pose[i][3], para_Pose[i][4], para_Pose[i][5]).normalized().toRotationMatrix();
@@ -851,7 +1737,7 @@ void Estimator::double2vector()
     }
     else
     {
-        for (int i = 0; i <= WINDOW_SIZE; i++)
+        for (int i = 0; i <= params.WINDOW_SIZE; i++)
         {
             Rs[i] = Quaterniond(para_Pose[i][6], para_Pose[i][3], para_Pose[i][4], para_Pose[i][5]).normalized().toRotationMatrix();
             
@@ -859,9 +1745,9 @@ void Estimator::double2vector()
         }
     }
 
-    if(USE_IMU)
+    if(Mode::imu)
     {
-        for (int i = 0; i < NUM_OF_CAM; i++)
+        for (int i = 0; i < params.NUM_OF_CAM; i++)
         {
             tic[i] = Vector3d(para_Ex_Pose[i][0],
                               para_Ex_Pose[i][1],
@@ -873,32 +1759,29 @@ void Estimator::double2vector()
         }
     }
 
-    VectorXd dep = f_manager.getDepthVector();
-    for (int i = 0; i < f_manager.getFeatureCount(); i++)
-        dep(i) = para_Feature[i][0];
-    f_manager.setDepth(dep);
-
-    if(USE_IMU)
+    if(Mode::imu)
         td = para_Td[0][0];
 
 }
 
 bool Estimator::failureDetection()
 {
-    return false;
+    // the checks only run for warm_reinit, a failure otherwise costs the whole initialization
+    if (!params.WARM_REINIT)
+        return false;
     if (f_manager.last_track_num < 2)
     {
         ROS_INFO(" little feature %d", f_manager.last_track_num);
         //return true;
     }
-    if (Bas[WINDOW_SIZE].norm() > 2.5)
+    if (Bas[params.WINDOW_SIZE].norm() > 2.5)
     {
-        ROS_INFO(" big IMU acc bias estimation %f", Bas[WINDOW_SIZE].norm());
+        ROS_INFO(" big IMU acc bias estimation %f", Bas[params.WINDOW_SIZE].norm());
         return true;
     }
-    if (Bgs[WINDOW_SIZE].norm() > 1.0)
+    if (Bgs[params.WINDOW_SIZE].norm() > 1.0)
     {
-        ROS_INFO(" big IMU gyr bias estimation %f", Bgs[WINDOW_SIZE].norm());
+        ROS_INFO(" big IMU gyr bias estimation %f", Bgs[params.WINDOW_SIZE].norm());
         return true;
     }
     /*
@@ -908,7 +1791,7 @@ bool Estimator::failureDetection()
         return true;
     }
     */
-    Vector3d tmp_P = Ps[WINDOW_SIZE];
+    Vector3d tmp_P = Ps[params.WINDOW_SIZE];
     if ((tmp_P - last_P).norm() > 5)
     {
         //ROS_INFO(" big translation");
@@ -919,7 +1802,7 @@ bool Estimator::failureDetection()
         //ROS_INFO(" big z translation");
         //return true; 
     }
-    Matrix3d tmp_R = Rs[WINDOW_SIZE];
+    Matrix3d tmp_R = Rs[params.WINDOW_SIZE];
     Matrix3d delta_R = tmp_R.transpose() * last_R;
     Quaterniond delta_Q(delta_R);
     double delta_angle;
@@ -932,35 +1815,118 @@ bool Estimator::failureDetection()
     return false;
 }
 
-void Estimator::optimization()
+template <typename Problem, class Residual, class Mode>
+int Estimator::addProjectionFactors(Problem &problem, ceres::LossFunction *loss_function, FeaturePerId &it_per_id,
+                                    ProjectionFactorPools<Residual> &pools)
 {
-    TicToc t_whole, t_prepare;
-    vector2double();
+    int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
+    const FeaturePerFrame &host = it_per_id.feature_per_frame[0];
+    Vector3d pts_i = host.point;
+    // the camera of the feature, the stereo observations are in camera 1 of the pair
+    double *ex_pose = para_Ex_Pose[it_per_id.camera];
 
-    ceres::Problem problem;
-    ceres::LossFunction *loss_function;
-    //loss_function = NULL;
-    loss_function = new ceres::HuberLoss(1.0);
-    //loss_function = new ceres::CauchyLoss(1.0 / FOCAL_LENGTH);
-    //ceres::LossFunction* loss_function = new ceres::HuberLoss(1.0);
+    int f_m_cnt = 0;
+    for (auto &it_per_frame : it_per_id.feature_per_frame)
+    {
+        imu_j++;
+        if (imu_i != imu_j)
+        {
+            Vector3d pts_j = it_per_frame.point;
+            auto *f_td = makeFactor(pools.twoFrameOneCam, pts_i, pts_j, host.velocity, it_per_frame.velocity,
+                                    host.obs_td, it_per_frame.obs_td);
+            problem.AddResidualBlock(f_td, loss_function, para_Pose[imu_i], para_Pose[imu_j], ex_pose, it_per_id.inv_depth, para_Td[0]);
+        }
+
+        if(Mode::stereo && it_per_frame.is_stereo)
+        {
+            Vector3d pts_j_right = it_per_frame.pointRight;
+            if(imu_i != imu_j)
+            {
+                auto *f = makeFactor(pools.twoFrameTwoCam, pts_i, pts_j_right, host.velocity, it_per_frame.velocityRight,
+                                     host.obs_td, it_per_frame.obs_tdRight);
+                problem.AddResidualBlock(f, loss_function, para_Pose[imu_i], para_Pose[imu_j], ex_pose, para_Ex_Pose[1], it_per_id.inv_depth, para_Td[0]);
+            }
+            else
+            {
+                auto *f = makeFactor(pools.oneFrameTwoCam, pts_i, pts_j_right, host.velocity, it_per_frame.velocityRight,
+                                     host.obs_td, it_per_frame.obs_tdRight);
+                problem.AddResidualBlock(f, loss_function, ex_pose, para_Ex_Pose[1], it_per_id.inv_depth, para_Td[0]);
+            }
+        }
+        f_m_cnt++;
+    }
+    return f_m_cnt;
+}
+
+template <class Residual, class Mode>
+void Estimator::marginalizeProjectionFactors(MarginalizationInfo *marginalization_info, ceres::LossFunction *loss_function,
+                                             FeaturePerId &it_per_id)
+{
+    int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
+    const FeaturePerFrame &host = it_per_id.feature_per_frame[0];
+    Vector3d pts_i = host.point;
+    double *ex_pose = para_Ex_Pose[it_per_id.camera];
+
+    for (auto &it_per_frame : it_per_id.feature_per_frame)
+    {
+        imu_j++;
+        if(imu_i != imu_j)
+        {
+            Vector3d pts_j = it_per_frame.point;
+            auto *f_td = new ProjectionLayoutFactor<TwoFrameOneCam, Residual>(pts_i, pts_j, host.velocity, it_per_frame.velocity,
+                                                                              host.obs_td, it_per_frame.obs_td);
+            marginalization_info->addResidualBlockInfo(f_td, loss_function,
+                                                       vector<double *>{para_Pose[imu_i], para_Pose[imu_j], ex_pose, it_per_id.inv_depth, para_Td[0]},
+                                                       vector<int>{0, 3});
+        }
+        if(Mode::stereo && it_per_frame.is_stereo)
+        {
+            Vector3d pts_j_right = it_per_frame.pointRight;
+            if(imu_i != imu_j)
+            {
+                auto *f = new ProjectionLayoutFactor<TwoFrameTwoCam, Residual>(pts_i, pts_j_right, host.velocity, it_per_frame.velocityRight,
+                                                                               host.obs_td, it_per_frame.obs_tdRight);
+                marginalization_info->addResidualBlockInfo(f, loss_function,
+                                                           vector<double *>{para_Pose[imu_i], para_Pose[imu_j], ex_pose, para_Ex_Pose[1], it_per_id.inv_depth, para_Td[0]},
+                                                           vector<int>{0, 4});
+            }
+            else
+            {
+                auto *f = new ProjectionLayoutFactor<OneFrameTwoCam, Residual>(pts_i, pts_j_right, host.velocity, it_per_frame.velocityRight,
+                                                                               host.obs_td, it_per_frame.obs_tdRight);
+                marginalization_info->addResidualBlockInfo(f, loss_function,
+                                                           vector<double *>{ex_pose, para_Ex_Pose[1], it_per_id.inv_depth, para_Td[0]},
+                                                           vector<int>{2});
+            }
+        }
+    }
+}
+
+// residual blocks of the window, on a ceres::Problem or a WindowSolver
+template <typename Problem, class Mode>
+void Estimator::buildProblem(Problem &problem, ceres::LossFunction *loss_function)
+{
     for (int i = 0; i < frame_count + 1; i++)
     {
-        ceres::LocalParameterization *local_parameterization = new PoseLocalParameterization();
+        ceres::LocalParameterization *local_parameterization = reuseFactors ? &poseParameterization : new PoseLocalParameterization();
         problem.AddParameterBlock(para_Pose[i], SIZE_POSE, local_parameterization);
-        if(USE_IMU)
+        if(Mode::imu)
             problem.AddParameterBlock(para_SpeedBias[i], SIZE_SPEEDBIAS);
     }
-    if(!USE_IMU)
+    if(!Mode::imu)
         problem.SetParameterBlockConstant(para_Pose[0]);
 
-    for (int i = 0; i < NUM_OF_CAM; i++)
+    for (int i = 0; i < params.NUM_OF_CAM; i++)
     {
-        ceres::LocalParameterization *local_parameterization = new PoseLocalParameterization();
+        ceres::LocalParameterization *local_parameterization = reuseFactors ? &poseParameterization : new PoseLocalParameterization();
         problem.AddParameterBlock(para_Ex_Pose[i], SIZE_POSE, local_parameterization);
-        if ((ESTIMATE_EXTRINSIC && frame_count == WINDOW_SIZE && Vs[0].norm() > 0.2) || openExEstimation)
+        if ((params.ESTIMATE_EXTRINSIC && frame_count == params.WINDOW_SIZE && Vs[0].norm() > 0.2) || openExEstimation)
         {
             //ROS_INFO("estimate extinsic param");
             openExEstimation = 1;
+            // a block of a persistent problem stays constant until told otherwise
+            if (reuseFactors)
+                problem.SetParameterBlockVariable(para_Ex_Pose[i]);
         }
         else
         {
@@ -970,108 +1936,174 @@ void Estimator::optimization()
     }
     problem.AddParameterBlock(para_Td[0], 1);
 
-    if (!ESTIMATE_TD || Vs[0].norm() < 0.2)
+    if (!params.ESTIMATE_TD || Vs[0].norm() < 0.2)
         problem.SetParameterBlockConstant(para_Td[0]);
+    else if (reuseFactors)
+        problem.SetParameterBlockVariable(para_Td[0]);
 
     if (last_marginalization_info && last_marginalization_info->valid)
     {
         // construct new marginlization_factor
         MarginalizationFactor *marginalization_factor = new MarginalizationFactor(last_marginalization_info);
+        if (reuseFactors)
+            marginalizationFactor.reset(marginalization_factor);
         problem.AddResidualBlock(marginalization_factor, NULL,
                                  last_marginalization_parameter_blocks);
     }
-    if(USE_IMU)
+    if(Mode::imu)
     {
         for (int i = 0; i < frame_count; i++)
         {
             int j = i + 1;
             if (pre_integrations[j]->sum_dt > 10.0)
                 continue;
-            IMUFactor* imu_factor = new IMUFactor(pre_integrations[j]);
+            IMUFactor* imu_factor = makeFactor(imuFactors, pre_integrations[j]);
             problem.AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j], para_SpeedBias[j]);
         }
     }
 
+    // max_solver_features or the frame budget, whichever is lower
+    int budget_cap = frameBudget.featureCap();
+    int cap = budget_cap;
+    if (params.MAX_SOLVER_FEATURES > 0 && (cap < 0 || params.MAX_SOLVER_FEATURES < cap))
+        cap = params.MAX_SOLVER_FEATURES;
+    int available = f_manager.selectFeatures(cap);
+    frameBudget.featuresUsed(available, budget_cap >= 0 && cap == budget_cap && cap < available);
+
     int f_m_cnt = 0;
-    int feature_index = -1;
     for (auto &it_per_id : f_manager.feature)
     {
         it_per_id.used_num = it_per_id.feature_per_frame.size();
         if (it_per_id.used_num < 4)
             continue;
- 
-        ++feature_index;
+
+        if (!it_per_id.selected)
+            continue;
 
         int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
         
         Vector3d pts_i = it_per_id.feature_per_frame[0].point;
 
-        for (auto &it_per_frame : it_per_id.feature_per_frame)
+        if (params.BATCH_PROJECTION && !params.UNIT_SPHERE_ERROR)
         {
-            imu_j++;
-            if (imu_i != imu_j)
+            ProjectionFeatureFactor *f = makeFactor(featureFactors, imu_i, pts_i, it_per_id.feature_per_frame[0].velocity,
+                                                    it_per_id.feature_per_frame[0].obs_td, loss_function);
+            for (auto &it_per_frame : it_per_id.feature_per_frame)
             {
-                Vector3d pts_j = it_per_frame.point;
-                ProjectionTwoFrameOneCamFactor *f_td = new ProjectionTwoFrameOneCamFactor(pts_i, pts_j, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocity,
-                                                                 it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                problem.AddResidualBlock(f_td, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Feature[feature_index], para_Td[0]);
-            }
-
-            if(STEREO && it_per_frame.is_stereo)
-            {                
-                Vector3d pts_j_right = it_per_frame.pointRight;
-                if(imu_i != imu_j)
-                {
-                    ProjectionTwoFrameTwoCamFactor *f = new ProjectionTwoFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
-                                                                 it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                    problem.AddResidualBlock(f, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Ex_Pose[1], para_Feature[feature_index], para_Td[0]);
-                }
-                else
-                {
-                    ProjectionOneFrameTwoCamFactor *f = new ProjectionOneFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
-                                                                 it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                    problem.AddResidualBlock(f, loss_function, para_Ex_Pose[0], para_Ex_Pose[1], para_Feature[feature_index], para_Td[0]);
-                }
-               
+                imu_j++;
+                if (imu_i != imu_j)
+                    f->addObservation(imu_j, false, it_per_frame.point, it_per_frame.velocity, it_per_frame.obs_td);
+                if(Mode::stereo && it_per_frame.is_stereo)
+                    f->addObservation(imu_j, true, it_per_frame.pointRight, it_per_frame.velocityRight, it_per_frame.obs_tdRight);
+                f_m_cnt++;
             }
-            f_m_cnt++;
+            f->finalize();
+            problem.AddResidualBlock(f, NULL, f->parameterBlocks(para_Pose, para_Ex_Pose + it_per_id.camera, it_per_id.inv_depth, para_Td[0]));
+            continue;
         }
+
+        if (params.UNIT_SPHERE_ERROR)
+            f_m_cnt += addProjectionFactors<Problem, SphereResidual, Mode>(problem, loss_function, it_per_id, sphereFactors);
+        else
+            f_m_cnt += addProjectionFactors<Problem, PlaneResidual, Mode>(problem, loss_function, it_per_id, planeFactors);
     }
 
     ROS_DEBUG("visual measurement count: %d", f_m_cnt);
+
+}
+
+ceres::Problem &Estimator::reusedProblem()
+{
+    if (!persistentProblem)
+    {
+        ceres::Problem::Options options;
+        options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+        options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+        options.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+        options.enable_fast_removal = true;
+        persistentProblem.reset(new ceres::Problem(options));
+    }
+    // the window slots shift on every slide, so all residuals are added again, the parameter
+    // blocks stay and blocks without residuals are left out by the solver
+    persistentProblem->GetResidualBlocks(&residualIds);
+    for (ceres::ResidualBlockId id : residualIds)
+        persistentProblem->RemoveResidualBlock(id);
+    marginalizationFactor.reset();
+    imuFactors.release();
+    planeFactors.release();
+    sphereFactors.release();
+    featureFactors.release();
+    return *persistentProblem;
+}
+
+template <class Mode>
+void Estimator::optimization()
+{
+    VINS_TRACE("optimization");
+    TicToc t_whole, t_prepare;
+    vector2double<Mode>();
+
+    // kept to the end, the marginalization below still uses the loss function it owns
+    ceres::Problem problem;
+    ceres::LossFunction *loss_function;
+    reuseFactors = params.PERSISTENT_PROBLEM && !params.WINDOW_SOLVER;
+    //loss_function = NULL;
+    loss_function = reuseFactors ? &huberLoss : new ceres::HuberLoss(1.0);
+    //loss_function = new ceres::CauchyLoss(1.0 / FOCAL_LENGTH);
+    //ceres::LossFunction* loss_function = new ceres::HuberLoss(1.0);
+    // the batched factors apply the loss themselves, so the problem does not own it then
+    std::unique_ptr<ceres::LossFunction> batch_loss(params.BATCH_PROJECTION && !params.UNIT_SPHERE_ERROR && !reuseFactors ?
+                                                     loss_function : NULL);
     //printf("prepare for ceres: %f \n", t_prepare.toc());
 
-    ceres::Solver::Options options;
+    double max_time = marginalization_flag == MARGIN_OLD ? params.SOLVER_TIME * 4.0 / 5.0 : params.SOLVER_TIME;
+    max_time = frameBudget.solverTime(max_time, frame_count == params.WINDOW_SIZE && marginalization_flag == MARGIN_OLD);
 
-    options.linear_solver_type = ceres::DENSE_SCHUR;
-    //options.num_threads = 2;
-    options.trust_region_strategy_type = ceres::DOGLEG;
-    options.max_num_iterations = NUM_ITERATIONS;
-    //options.use_explicit_schur_complement = true;
-    //options.minimizer_progress_to_stdout = true;
-    //options.use_nonmonotonic_steps = true;
-    if (marginalization_flag == MARGIN_OLD)
-        options.max_solver_time_in_seconds = SOLVER_TIME * 4.0 / 5.0;
-    else
-        options.max_solver_time_in_seconds = SOLVER_TIME;
     TicToc t_solver;
-    ceres::Solver::Summary summary;
-    ceres::Solve(options, &problem, &summary);
-    //cout << summary.BriefReport() << endl;
-    ROS_DEBUG("Iterations : %d", static_cast<int>(summary.iterations.size()));
+    memory_stats::AllocCounters solver_allocs = memory_stats::threadAllocations();
+    if (params.WINDOW_SOLVER)
+    {
+        windowSolver.clear();
+        buildProblem<WindowSolver, Mode>(windowSolver, loss_function);
+        WindowSolver::Summary summary;
+        windowSolver.solve(params.NUM_ITERATIONS, max_time, summary);
+        ROS_DEBUG("Iterations : %d", summary.iterations);
+    }
+    else
+    {
+        ceres::Problem &solved = reuseFactors ? reusedProblem() : problem;
+        buildProblem<ceres::Problem, Mode>(solved, loss_function);
+
+        ceres::Solver::Options options;
+
+        solverTuner.apply(options);
+        options.max_num_iterations = params.NUM_ITERATIONS;
+        //options.minimizer_progress_to_stdout = true;
+        options.max_solver_time_in_seconds = max_time;
+        ceres::Solver::Summary summary;
+        ceres::Solve(options, &solved, &summary);
+        solverTuner.report(summary, frame_count == params.WINDOW_SIZE);
+        //cout << summary.BriefReport() << endl;
+        ROS_DEBUG("Iterations : %d", static_cast<int>(summary.iterations.size()));
+    }
     //printf("solver costs: %f \n", t_solver.toc());
+    double solver_time = t_solver.toc();
+    frameBudget.record(FrameBudget::OPTIMIZE, solver_time);
+    latencyProfiler.record(LatencyProfiler::SOLVE, solver_time, solver_allocs);
 
-    double2vector();
+    double2vector<Mode>();
     //printf("frame_count: %d \n", frame_count);
 
-    if(frame_count < WINDOW_SIZE)
+    if(frame_count < params.WINDOW_SIZE)
         return;
 
     TicToc t_whole_marginalization;
+    memory_stats::AllocCounters marginalization_allocs = memory_stats::threadAllocations();
+    VINS_TRACE("marginalize");
     if (marginalization_flag == MARGIN_OLD)
     {
-        MarginalizationInfo *marginalization_info = new MarginalizationInfo();
-        vector2double();
+        MarginalizationInfo *marginalization_info = new MarginalizationInfo(&threadPool, &margWorkspace);
+        vector2double<Mode>();
 
         if (last_marginalization_info && last_marginalization_info->valid)
         {
@@ -1084,76 +2116,36 @@ void Estimator::optimization()
             }
             // construct new marginlization_factor
             MarginalizationFactor *marginalization_factor = new MarginalizationFactor(last_marginalization_info);
-            ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(marginalization_factor, NULL,
-                                                                           last_marginalization_parameter_blocks,
-                                                                           drop_set);
-            marginalization_info->addResidualBlockInfo(residual_block_info);
+            marginalization_info->addResidualBlockInfo(marginalization_factor, NULL,
+                                                       last_marginalization_parameter_blocks,
+                                                       drop_set);
         }
 
-        if(USE_IMU)
+        if(Mode::imu)
         {
             if (pre_integrations[1]->sum_dt < 10.0)
             {
                 IMUFactor* imu_factor = new IMUFactor(pre_integrations[1]);
-                ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(imu_factor, NULL,
-                                                                           vector<double *>{para_Pose[0], para_SpeedBias[0], para_Pose[1], para_SpeedBias[1]},
-                                                                           vector<int>{0, 1});
-                marginalization_info->addResidualBlockInfo(residual_block_info);
+                marginalization_info->addResidualBlockInfo(imu_factor, NULL,
+                                                           vector<double *>{para_Pose[0], para_SpeedBias[0], para_Pose[1], para_SpeedBias[1]},
+                                                           vector<int>{0, 1});
             }
         }
 
         {
-            int feature_index = -1;
             for (auto &it_per_id : f_manager.feature)
             {
                 it_per_id.used_num = it_per_id.feature_per_frame.size();
                 if (it_per_id.used_num < 4)
                     continue;
 
-                ++feature_index;
-
-                int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
-                if (imu_i != 0)
+                if (it_per_id.start_frame != 0)
                     continue;
 
-                Vector3d pts_i = it_per_id.feature_per_frame[0].point;
-
-                for (auto &it_per_frame : it_per_id.feature_per_frame)
-                {
-                    imu_j++;
-                    if(imu_i != imu_j)
-                    {
-                        Vector3d pts_j = it_per_frame.point;
-                        ProjectionTwoFrameOneCamFactor *f_td = new ProjectionTwoFrameOneCamFactor(pts_i, pts_j, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocity,
-                                                                          it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                        ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f_td, loss_function,
-                                                                                        vector<double *>{para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Feature[feature_index], para_Td[0]},
-                                                                                        vector<int>{0, 3});
-                        marginalization_info->addResidualBlockInfo(residual_block_info);
-                    }
-                    if(STEREO && it_per_frame.is_stereo)
-                    {
-                        Vector3d pts_j_right = it_per_frame.pointRight;
-                        if(imu_i != imu_j)
-                        {
-                            ProjectionTwoFrameTwoCamFactor *f = new ProjectionTwoFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
-                                                                          it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                            ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f, loss_function,
-                                                                                           vector<double *>{para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Ex_Pose[1], para_Feature[feature_index], para_Td[0]},
-                                                                                           vector<int>{0, 4});
-                            marginalization_info->addResidualBlockInfo(residual_block_info);
-                        }
-                        else
-                        {
-                            ProjectionOneFrameTwoCamFactor *f = new ProjectionOneFrameTwoCamFactor(pts_i, pts_j_right, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocityRight,
-                                                                          it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td);
-                            ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(f, loss_function,
-                                                                                           vector<double *>{para_Ex_Pose[0], para_Ex_Pose[1], para_Feature[feature_index], para_Td[0]},
-                                                                                           vector<int>{2});
-                            marginalization_info->addResidualBlockInfo(residual_block_info);
-                        }
-                    }
-                }
+                if (params.UNIT_SPHERE_ERROR)
+                    marginalizeProjectionFactors<SphereResidual, Mode>(marginalization_info, loss_function, it_per_id);
+                else
+                    marginalizeProjectionFactors<PlaneResidual, Mode>(marginalization_info, loss_function, it_per_id);
             }
         }
 
@@ -1166,13 +2158,13 @@ void Estimator::optimization()
         ROS_DEBUG("marginalization %f ms", t_margin.toc());
 
         std::unordered_map<long, double *> addr_shift;
-        for (int i = 1; i <= WINDOW_SIZE; i++)
+        for (int i = 1; i <= params.WINDOW_SIZE; i++)
         {
             addr_shift[reinterpret_cast<long>(para_Pose[i])] = para_Pose[i - 1];
-            if(USE_IMU)
+            if(Mode::imu)
                 addr_shift[reinterpret_cast<long>(para_SpeedBias[i])] = para_SpeedBias[i - 1];
         }
-        for (int i = 0; i < NUM_OF_CAM; i++)
+        for (int i = 0; i < params.NUM_OF_CAM; i++)
             addr_shift[reinterpret_cast<long>(para_Ex_Pose[i])] = para_Ex_Pose[i];
 
         addr_shift[reinterpret_cast<long>(para_Td[0])] = para_Td[0];
@@ -1186,166 +2178,282 @@ void Estimator::optimization()
         
     }
     else
+        marginalizeSecondNew();
+    //printf("whole marginalization costs: %f \n", t_whole_marginalization.toc());
+    double marginalization_time = t_whole_marginalization.toc();
+    latencyProfiler.record(LatencyProfiler::MARGINALIZE, marginalization_time, marginalization_allocs);
+    if (marginalization_flag == MARGIN_OLD)
+        frameBudget.record(FrameBudget::MARGINALIZE, marginalization_time);
+    if (params.BIAS_CORRECTION && Mode::imu)
+        repropagateWindow();
+    //printf("whole time for ceres: %f \n", t_whole.toc());
+}
+
+template <class Mode>
+void Estimator::selectMode()
+{
+    modeFunctions.optimization = &Estimator::optimization<Mode>;
+    modeFunctions.vector2double = &Estimator::vector2double<Mode>;
+    modeFunctions.double2vector = &Estimator::double2vector<Mode>;
+}
+
+// motion only: the pose and speed of the newest frame against its imu factor and the observations
+// of the solved features, everything else of the window is held
+template <class Residual>
+void Estimator::addNewestFrameFactors(ceres::Problem &problem, ceres::LossFunction *loss_function)
+{
+    for (auto &it_per_id : f_manager.feature)
     {
-        if (last_marginalization_info &&
-            std::count(std::begin(last_marginalization_parameter_blocks), std::end(last_marginalization_parameter_blocks), para_Pose[WINDOW_SIZE - 1]))
-        {
+        if (it_per_id.solveFlag() != 1 || it_per_id.start_frame >= frame_count || it_per_id.endFrame() != frame_count)
+            continue;
+        const FeaturePerFrame &host = it_per_id.feature_per_frame[0];
+        const FeaturePerFrame &newest = it_per_id.feature_per_frame.back();
+        auto *f = new ProjectionLayoutFactor<TwoFrameOneCam, Residual>(host.point, newest.point, host.velocity, newest.velocity,
+                                                                      host.obs_td, newest.obs_td);
+        problem.AddResidualBlock(f, loss_function, para_Pose[it_per_id.start_frame], para_Pose[frame_count],
+                                 para_Ex_Pose[it_per_id.camera], it_per_id.inv_depth, para_Td[0]);
+    }
+}
 
-            MarginalizationInfo *marginalization_info = new MarginalizationInfo();
-            vector2double();
-            if (last_marginalization_info && last_marginalization_info->valid)
-            {
-                vector<int> drop_set;
-                for (int i = 0; i < static_cast<int>(last_marginalization_parameter_blocks.size()); i++)
-                {
-                    ROS_ASSERT(last_marginalization_parameter_blocks[i] != para_SpeedBias[WINDOW_SIZE - 1]);
-                    if (last_marginalization_parameter_blocks[i] == para_Pose[WINDOW_SIZE - 1])
-                        drop_set.push_back(i);
-                }
-                // construct new marginlization_factor
-                MarginalizationFactor *marginalization_factor = new MarginalizationFactor(last_marginalization_info);
-                ResidualBlockInfo *residual_block_info = new ResidualBlockInfo(marginalization_factor, NULL,
-                                                                               last_marginalization_parameter_blocks,
-                                                                               drop_set);
+void Estimator::fastPose(const FeatureFrame &image, double t)
+{
+    ScopedStageTimer stage_timer(latencyProfiler, LatencyProfiler::FAST_POSE);
+    VINS_TRACE("fastPose");
+    // frame_count holds the imu prediction of the new frame, the frames before it are optimized
+    fastObservations.clear();
+    for (const FeatureObservation &obs : image)
+    {
+        const FeaturePerId *it_per_id = f_manager.getFeature(obs.feature_id);
+        if (!it_per_id || it_per_id->solveFlag() != 1 || it_per_id->start_frame >= frame_count)
+            continue;
+        int s = it_per_id->start_frame, c = it_per_id->camera;
+        Vector3d pts_c = it_per_id->feature_per_frame[0].point * it_per_id->depth();
+        MotionOnlyObservation m;
+        m.pts_w = Rs[s] * (ric[c] * pts_c + tic[c]) + Ps[s];
+        m.uv = obs.xyz_uv_velocity.head<2>() / obs.xyz_uv_velocity(2);
+        m.camera = obs.camera_id;
+        fastObservations.push_back(m);
+    }
+    if (fastObservations.size() < 10)
+        return;
 
-                marginalization_info->addResidualBlockInfo(residual_block_info);
-            }
+    // the preintegration covariance since the previous frame, position turned to the world frame
+    const IntegrationBase *pre = pre_integrations[frame_count];
+    const Matrix3d &R_prev = Rs[frame_count - 1];
+    Matrix<double, 6, 6> cov = Matrix<double, 6, 6>::Zero();
+    cov.topLeftCorner<3, 3>() = R_prev * pre->covariance.block<3, 3>(O_P, O_P) * R_prev.transpose();
+    cov.bottomRightCorner<3, 3>() = pre->covariance.block<3, 3>(O_R, O_R);
+    cov.diagonal().array() += 1e-8;
+    Matrix<double, 6, 6> prior_info = cov.inverse();
+
+    Matrix3d R = Rs[frame_count];
+    Vector3d P = Ps[frame_count];
+    motionOnlyPose.sqrt_info = FOCAL_LENGTH / 1.5;
+    if (motionOnlyPose.solve(fastObservations, tic, ric, prior_info, R, P) < 10)
+        return;
+    // also the start of the window optimization
+    Rs[frame_count] = R;
+    Ps[frame_count] = P;
+
+    if (publish)
+        visualization.pubFastOdometry(P, Quaterniond(R), Vs[frame_count], t);
+    PropagationState start;
+    start.valid = true;
+    start.t = t + td;
+    start.P = P;
+    start.Q = R;
+    start.V = Vs[frame_count];
+    start.Ba = Bas[frame_count];
+    start.Bg = Bgs[frame_count];
+    start.acc_0 = acc_0;
+    start.gyr_0 = gyr_0;
+    start.g = g;
+    propagator.reset(start);
+}
+
+void Estimator::refineNewestPose()
+{
+    TicToc t_refine;
+    vector2double();
+    ceres::Problem problem;
+    problem.AddParameterBlock(para_Pose[frame_count], SIZE_POSE, new PoseLocalParameterization());
+    if (pre_integrations[frame_count]->sum_dt < 10.0)
+        problem.AddResidualBlock(new IMUFactor(pre_integrations[frame_count]), NULL, para_Pose[frame_count - 1],
+                                 para_SpeedBias[frame_count - 1], para_Pose[frame_count], para_SpeedBias[frame_count]);
+    ceres::LossFunction *loss_function = new ceres::HuberLoss(1.0);
+    if (params.UNIT_SPHERE_ERROR)
+        addNewestFrameFactors<SphereResidual>(problem, loss_function);
+    else
+        addNewestFrameFactors<PlaneResidual>(problem, loss_function);
+
+    vector<double *> blocks;
+    problem.GetParameterBlocks(&blocks);
+    for (double *block : blocks)
+        if (block != para_Pose[frame_count] && block != para_SpeedBias[frame_count])
+            problem.SetParameterBlockConstant(block);
+
+    ceres::Solver::Options options;
+    options.linear_solver_type = ceres::DENSE_QR;
+    options.max_num_iterations = params.NUM_ITERATIONS;
+    options.max_solver_time_in_seconds = params.SOLVER_TIME / 4.0;
+    ceres::Solver::Summary summary;
+    ceres::Solve(options, &problem, &summary);
+
+    // frame 0 is held, so no yaw or position drift to take out as double2vector does
+    Ps[frame_count] = Vector3d(para_Pose[frame_count][0], para_Pose[frame_count][1], para_Pose[frame_count][2]);
+    Rs[frame_count] = Quaterniond(para_Pose[frame_count][6], para_Pose[frame_count][3], para_Pose[frame_count][4],
+                                  para_Pose[frame_count][5]).normalized().toRotationMatrix();
+    Vs[frame_count] = Vector3d(para_SpeedBias[frame_count][0], para_SpeedBias[frame_count][1], para_SpeedBias[frame_count][2]);
+    Bas[frame_count] = Vector3d(para_SpeedBias[frame_count][3], para_SpeedBias[frame_count][4], para_SpeedBias[frame_count][5]);
+    Bgs[frame_count] = Vector3d(para_SpeedBias[frame_count][6], para_SpeedBias[frame_count][7], para_SpeedBias[frame_count][8]);
+    ROS_DEBUG("newest pose refined in %d iterations, %f ms", static_cast<int>(summary.iterations.size()), t_refine.toc());
+}
+
+// the second newest frame is dropped without marginalizing its measurements, only the prior is
+// reduced when it holds the pose of that frame
+void Estimator::marginalizeSecondNew()
+{
+    if (last_marginalization_info &&
+        std::count(std::begin(last_marginalization_parameter_blocks), std::end(last_marginalization_parameter_blocks), para_Pose[params.WINDOW_SIZE - 1]))
+    {
 
-            TicToc t_pre_margin;
-            ROS_DEBUG("begin marginalization");
-            marginalization_info->preMarginalize();
-            ROS_DEBUG("end pre marginalization, %f ms", t_pre_margin.toc());
+        MarginalizationInfo *marginalization_info = new MarginalizationInfo(&threadPool, &margWorkspace);
+        vector2double();
+        if (last_marginalization_info && last_marginalization_info->valid)
+        {
+            for (int i = 0; i < static_cast<int>(last_marginalization_parameter_blocks.size()); i++)
+                ROS_ASSERT(last_marginalization_parameter_blocks[i] != para_SpeedBias[params.WINDOW_SIZE - 1]);
 
+            // the prior is the only factor of the dropped pose, it is reduced in place
             TicToc t_margin;
-            ROS_DEBUG("begin marginalization");
-            marginalization_info->marginalize();
+            marginalization_info->marginalizeBlock(last_marginalization_info, last_marginalization_parameter_blocks,
+                                                   para_Pose[params.WINDOW_SIZE - 1]);
             ROS_DEBUG("end marginalization, %f ms", t_margin.toc());
-            
-            std::unordered_map<long, double *> addr_shift;
-            for (int i = 0; i <= WINDOW_SIZE; i++)
+        }
+        else
+            marginalization_info->valid = false;
+        
+        std::unordered_map<long, double *> addr_shift;
+        for (int i = 0; i <= params.WINDOW_SIZE; i++)
+        {
+            if (i == params.WINDOW_SIZE - 1)
+                continue;
+            else if (i == params.WINDOW_SIZE)
             {
-                if (i == WINDOW_SIZE - 1)
-                    continue;
-                else if (i == WINDOW_SIZE)
-                {
-                    addr_shift[reinterpret_cast<long>(para_Pose[i])] = para_Pose[i - 1];
-                    if(USE_IMU)
-                        addr_shift[reinterpret_cast<long>(para_SpeedBias[i])] = para_SpeedBias[i - 1];
-                }
-                else
-                {
-                    addr_shift[reinterpret_cast<long>(para_Pose[i])] = para_Pose[i];
-                    if(USE_IMU)
-                        addr_shift[reinterpret_cast<long>(para_SpeedBias[i])] = para_SpeedBias[i];
-                }
+                addr_shift[reinterpret_cast<long>(para_Pose[i])] = para_Pose[i - 1];
+                if(params.USE_IMU)
+                    addr_shift[reinterpret_cast<long>(para_SpeedBias[i])] = para_SpeedBias[i - 1];
+            }
+            else
+            {
+                addr_shift[reinterpret_cast<long>(para_Pose[i])] = para_Pose[i];
+                if(params.USE_IMU)
+                    addr_shift[reinterpret_cast<long>(para_SpeedBias[i])] = para_SpeedBias[i];
             }
-            for (int i = 0; i < NUM_OF_CAM; i++)
-                addr_shift[reinterpret_cast<long>(para_Ex_Pose[i])] = para_Ex_Pose[i];
+        }
+        for (int i = 0; i < params.NUM_OF_CAM; i++)
+            addr_shift[reinterpret_cast<long>(para_Ex_Pose[i])] = para_Ex_Pose[i];
 
-            addr_shift[reinterpret_cast<long>(para_Td[0])] = para_Td[0];
+        addr_shift[reinterpret_cast<long>(para_Td[0])] = para_Td[0];
 
-            
-            vector<double *> parameter_blocks = marginalization_info->getParameterBlocks(addr_shift);
-            if (last_marginalization_info)
-                delete last_marginalization_info;
-            last_marginalization_info = marginalization_info;
-            last_marginalization_parameter_blocks = parameter_blocks;
-            
-        }
+        
+        vector<double *> parameter_blocks = marginalization_info->getParameterBlocks(addr_shift);
+        if (last_marginalization_info)
+            delete last_marginalization_info;
+        last_marginalization_info = marginalization_info;
+        last_marginalization_parameter_blocks = parameter_blocks;
+        
     }
-    //printf("whole marginalization costs: %f \n", t_whole_marginalization.toc());
-    //printf("whole time for ceres: %f \n", t_whole.toc());
+}
+
+void Estimator::repropagateWindow()
+{
+    VINS_TRACE("repropagateWindow");
+    // the IMU factors ran on the first-order bias correction during the solve, the preintegrations
+    // that drifted too far are integrated again at the estimate, all in one pass
+    int stale[MAX_WINDOW_SIZE + 1];
+    int count = 0;
+    for (int i = 1; i <= frame_count; i++)
+        if (pre_integrations[i] && pre_integrations[i]->needsRepropagate(Bas[i - 1], Bgs[i - 1]))
+            stale[count++] = i;
+    threadPool.run(count, [&](int k, int)
+    {
+        int i = stale[k];
+        pre_integrations[i]->repropagate(Bas[i - 1], Bgs[i - 1]);
+    });
+    if (count)
+        ROS_DEBUG("repropagate %d preintegrations", count);
 }
 
 void Estimator::slideWindow()
 {
+    VINS_TRACE("slideWindow");
+    ScopedStageTimer stage_timer(latencyProfiler, LatencyProfiler::SLIDE);
     TicToc t_margin;
     if (marginalization_flag == MARGIN_OLD)
     {
         double t_0 = Headers[0];
         back_R0 = Rs[0];
         back_P0 = Ps[0];
-        if (frame_count == WINDOW_SIZE)
+        if (frame_count == params.WINDOW_SIZE)
         {
-            for (int i = 0; i < WINDOW_SIZE; i++)
-            {
-                Headers[i] = Headers[i + 1];
-                Rs[i].swap(Rs[i + 1]);
-                Ps[i].swap(Ps[i + 1]);
-                if(USE_IMU)
-                {
-                    std::swap(pre_integrations[i], pre_integrations[i + 1]);
-
-                    dt_buf[i].swap(dt_buf[i + 1]);
-                    linear_acceleration_buf[i].swap(linear_acceleration_buf[i + 1]);
-                    angular_velocity_buf[i].swap(angular_velocity_buf[i + 1]);
-
-                    Vs[i].swap(Vs[i + 1]);
-                    Bas[i].swap(Bas[i + 1]);
-                    Bgs[i].swap(Bgs[i + 1]);
-                }
-            }
-            Headers[WINDOW_SIZE] = Headers[WINDOW_SIZE - 1];
-            Ps[WINDOW_SIZE] = Ps[WINDOW_SIZE - 1];
-            Rs[WINDOW_SIZE] = Rs[WINDOW_SIZE - 1];
-
-            if(USE_IMU)
+            if (batchLog.isOpen() && solver_flag == NON_LINEAR)
+                logKeyframes(1);
+            // the slot of the oldest frame comes around as the newest one
+            Headers.slide();
+            Rs.slide();
+            Ps.slide();
+            Vs.slide();
+            Bas.slide();
+            Bgs.slide();
+            pre_integrations.slide();
+            Headers[params.WINDOW_SIZE] = Headers[params.WINDOW_SIZE - 1];
+            Ps[params.WINDOW_SIZE] = Ps[params.WINDOW_SIZE - 1];
+            Rs[params.WINDOW_SIZE] = Rs[params.WINDOW_SIZE - 1];
+
+            if(params.USE_IMU)
             {
-                Vs[WINDOW_SIZE] = Vs[WINDOW_SIZE - 1];
-                Bas[WINDOW_SIZE] = Bas[WINDOW_SIZE - 1];
-                Bgs[WINDOW_SIZE] = Bgs[WINDOW_SIZE - 1];
-
-                delete pre_integrations[WINDOW_SIZE];
-                pre_integrations[WINDOW_SIZE] = new IntegrationBase{acc_0, gyr_0, Bas[WINDOW_SIZE], Bgs[WINDOW_SIZE]};
+                Vs[params.WINDOW_SIZE] = Vs[params.WINDOW_SIZE - 1];
+                Bas[params.WINDOW_SIZE] = Bas[params.WINDOW_SIZE - 1];
+                Bgs[params.WINDOW_SIZE] = Bgs[params.WINDOW_SIZE - 1];
 
-                dt_buf[WINDOW_SIZE].clear();
-                linear_acceleration_buf[WINDOW_SIZE].clear();
-                angular_velocity_buf[WINDOW_SIZE].clear();
+                // the oldest preintegration, rotated to the end, is reused
+                pre_integrations[params.WINDOW_SIZE]->reset(acc_0, gyr_0, Bas[params.WINDOW_SIZE], Bgs[params.WINDOW_SIZE]);
             }
 
-            if (true || solver_flag == INITIAL)
+            if (solver_flag == INITIAL)
             {
                 map<double, ImageFrame>::iterator it_0;
                 it_0 = all_image_frame.find(t_0);
                 delete it_0->second.pre_integration;
+                it_0->second.pre_integration = nullptr;
+                for (map<double, ImageFrame>::iterator it = all_image_frame.begin(); it != it_0; it++)
+                    delete it->second.pre_integration;
                 all_image_frame.erase(all_image_frame.begin(), it_0);
             }
+            else
+                clearImageFrames();
             slideWindowOld();
         }
     }
     else
     {
-        if (frame_count == WINDOW_SIZE)
+        if (frame_count == params.WINDOW_SIZE)
         {
             Headers[frame_count - 1] = Headers[frame_count];
             Ps[frame_count - 1] = Ps[frame_count];
             Rs[frame_count - 1] = Rs[frame_count];
 
-            if(USE_IMU)
+            if(params.USE_IMU)
             {
-                for (unsigned int i = 0; i < dt_buf[frame_count].size(); i++)
-                {
-                    double tmp_dt = dt_buf[frame_count][i];
-                    Vector3d tmp_linear_acceleration = linear_acceleration_buf[frame_count][i];
-                    Vector3d tmp_angular_velocity = angular_velocity_buf[frame_count][i];
-
-                    pre_integrations[frame_count - 1]->push_back(tmp_dt, tmp_linear_acceleration, tmp_angular_velocity);
-
-                    dt_buf[frame_count - 1].push_back(tmp_dt);
-                    linear_acceleration_buf[frame_count - 1].push_back(tmp_linear_acceleration);
-                    angular_velocity_buf[frame_count - 1].push_back(tmp_angular_velocity);
-                }
+                for (const ImuStep &sample : pre_integrations[frame_count]->samples)
+                    pre_integrations[frame_count - 1]->push_back(sample.dt, sample.acc, sample.gyr);
 
                 Vs[frame_count - 1] = Vs[frame_count];
                 Bas[frame_count - 1] = Bas[frame_count];
                 Bgs[frame_count - 1] = Bgs[frame_count];
 
-                delete pre_integrations[WINDOW_SIZE];
-                pre_integrations[WINDOW_SIZE] = new IntegrationBase{acc_0, gyr_0, Bas[WINDOW_SIZE], Bgs[WINDOW_SIZE]};
-
-                dt_buf[WINDOW_SIZE].clear();
-                linear_acceleration_buf[WINDOW_SIZE].clear();
-                angular_velocity_buf[WINDOW_SIZE].clear();
+                pre_integrations[params.WINDOW_SIZE]->reset(acc_0, gyr_0, Bas[params.WINDOW_SIZE], Bgs[params.WINDOW_SIZE]);
             }
             slideWindowNew();
         }
@@ -1365,13 +2473,7 @@ void Estimator::slideWindowOld()
     bool shift_depth = solver_flag == NON_LINEAR ? true : false;
     if (shift_depth)
     {
-        Matrix3d R0, R1;
-        Vector3d P0, P1;
-        R0 = back_R0 * ric[0];
-        R1 = Rs[0] * ric[0];
-        P0 = back_P0 + back_R0 * tic[0];
-        P1 = Ps[0] + Rs[0] * tic[0];
-        f_manager.removeBackShiftDepth(R0, P0, R1, P1);
+        f_manager.removeBackShiftDepth(back_R0, back_P0, Rs[0], Ps[0], tic, ric);
     }
     else
         f_manager.removeBack();
@@ -1402,139 +2504,122 @@ void Estimator::predictPtsInNextFrame()
     getPoseInWorldFrame(curT);
     getPoseInWorldFrame(frame_count - 1, prevT);
     nextT = curT * (prevT.inverse() * curT);
-    map<int, Eigen::Vector3d> predictPts;
+    map<FeatureId, Eigen::Vector3d> predictPts;
 
     for (auto &it_per_id : f_manager.feature)
     {
-        if(it_per_id.estimated_depth > 0)
+        if(it_per_id.depth() > 0)
         {
             int firstIndex = it_per_id.start_frame;
             int lastIndex = it_per_id.start_frame + it_per_id.feature_per_frame.size() - 1;
             //printf("cur frame index  %d last frame index %d\n", frame_count, lastIndex);
             if((int)it_per_id.feature_per_frame.size() >= 2 && lastIndex == frame_count)
             {
-                double depth = it_per_id.estimated_depth;
-                Vector3d pts_j = ric[0] * (depth * it_per_id.feature_per_frame[0].point) + tic[0];
+                double depth = it_per_id.depth();
+                const int c = it_per_id.camera;
+                Vector3d pts_j = ric[c] * (depth * it_per_id.feature_per_frame[0].point) + tic[c];
                 Vector3d pts_w = Rs[firstIndex] * pts_j + Ps[firstIndex];
                 Vector3d pts_local = nextT.block<3, 3>(0, 0).transpose() * (pts_w - nextT.block<3, 1>(0, 3));
-                Vector3d pts_cam = ric[0].transpose() * (pts_local - tic[0]);
-                int ptsIndex = it_per_id.feature_id;
+                Vector3d pts_cam = ric[c].transpose() * (pts_local - tic[c]);
+                FeatureId ptsIndex = it_per_id.feature_id;
                 predictPts[ptsIndex] = pts_cam;
             }
         }
     }
+    // each tracker only looks up its own ids
     featureTracker.setPrediction(predictPts);
+    for (auto &tracker : auxTrackers)
+        tracker->setPrediction(predictPts);
     //printf("estimator output %d predict pts\n",(int)predictPts.size());
 }
 
-double Estimator::reprojectionError(Matrix3d &Ri, Vector3d &Pi, Matrix3d &rici, Vector3d &tici,
-                                 Matrix3d &Rj, Vector3d &Pj, Matrix3d &ricj, Vector3d &ticj, 
-                                 double depth, Vector3d &uvi, Vector3d &uvj)
+double Estimator::reprojectionError(const Vector3d &pts_w, const Matrix3d &R_wc, const Vector3d &t_wc,
+                                    const Vector3d &uvj)
 {
-    Vector3d pts_w = Ri * (rici * (depth * uvi) + tici) + Pi;
-    Vector3d pts_cj = ricj.transpose() * (Rj.transpose() * (pts_w - Pj) - ticj);
+    Vector3d pts_cj = R_wc.transpose() * (pts_w - t_wc);
     Vector2d residual = (pts_cj / pts_cj.z()).head<2>() - uvj.head<2>();
-    double rx = residual.x();
-    double ry = residual.y();
-    return sqrt(rx * rx + ry * ry);
+    return residual.norm();
 }
 
-void Estimator::outliersRejection(set<int> &removeIndex)
+void Estimator::outliersRejection(set<FeatureId> &removeIndex)
 {
     //return;
-    int feature_index = -1;
+    // world from camera c of every window frame, once for all observations
+    Matrix3d R_wc[MAX_WINDOW_SIZE + 1][MAX_NUM_OF_CAM];
+    Vector3d t_wc[MAX_WINDOW_SIZE + 1][MAX_NUM_OF_CAM];
+    for (int i = 0; i <= params.WINDOW_SIZE; i++)
+        for (int c = 0; c < params.NUM_OF_CAM; c++)
+        {
+            R_wc[i][c] = Rs[i] * ric[c];
+            t_wc[i][c] = Rs[i] * tic[c] + Ps[i];
+        }
+
+    outlierCandidates.clear();
     for (auto &it_per_id : f_manager.feature)
     {
+        it_per_id.used_num = it_per_id.feature_per_frame.size();
+        if (it_per_id.used_num >= 4)
+            outlierCandidates.push_back(&it_per_id);
+    }
+    outlierFlags.assign(outlierCandidates.size(), 0);
+
+    threadPool.run(outlierCandidates.size(), [&](int k, int)
+    {
+        const FeaturePerId &it_per_id = *outlierCandidates[k];
+        int imu_i = it_per_id.start_frame;
+        const int c = it_per_id.camera;
+        Vector3d pts_w = R_wc[imu_i][c] * (it_per_id.depth() * it_per_id.feature_per_frame[0].point) + t_wc[imu_i][c];
         double err = 0;
         int errCnt = 0;
-        it_per_id.used_num = it_per_id.feature_per_frame.size();
-        if (it_per_id.used_num < 4)
-            continue;
-        feature_index ++;
-        int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
-        Vector3d pts_i = it_per_id.feature_per_frame[0].point;
-        double depth = it_per_id.estimated_depth;
-        for (auto &it_per_frame : it_per_id.feature_per_frame)
+        for (size_t j = 0; j < it_per_id.feature_per_frame.size(); j++)
         {
-            imu_j++;
-            if (imu_i != imu_j)
+            const FeaturePerFrame &it_per_frame = it_per_id.feature_per_frame[j];
+            int imu_j = imu_i + j;
+            if (j != 0)
             {
-                Vector3d pts_j = it_per_frame.point;             
-                double tmp_error = reprojectionError(Rs[imu_i], Ps[imu_i], ric[0], tic[0], 
-                                                    Rs[imu_j], Ps[imu_j], ric[0], tic[0],
-                                                    depth, pts_i, pts_j);
-                err += tmp_error;
+                err += reprojectionError(pts_w, R_wc[imu_j][c], t_wc[imu_j][c], it_per_frame.point);
                 errCnt++;
-                //printf("tmp_error %f\n", FOCAL_LENGTH / 1.5 * tmp_error);
             }
-            // need to rewrite projecton factor.........
-            if(STEREO && it_per_frame.is_stereo)
+            if (params.STEREO && it_per_frame.is_stereo)
             {
-                
-                Vector3d pts_j_right = it_per_frame.pointRight;
-                if(imu_i != imu_j)
-                {            
-                    double tmp_error = reprojectionError(Rs[imu_i], Ps[imu_i], ric[0], tic[0], 
-                                                        Rs[imu_j], Ps[imu_j], ric[1], tic[1],
-                                                        depth, pts_i, pts_j_right);
-                    err += tmp_error;
-                    errCnt++;
-                    //printf("tmp_error %f\n", FOCAL_LENGTH / 1.5 * tmp_error);
-                }
-                else
-                {
-                    double tmp_error = reprojectionError(Rs[imu_i], Ps[imu_i], ric[0], tic[0], 
-                                                        Rs[imu_j], Ps[imu_j], ric[1], tic[1],
-                                                        depth, pts_i, pts_j_right);
-                    err += tmp_error;
-                    errCnt++;
-                    //printf("tmp_error %f\n", FOCAL_LENGTH / 1.5 * tmp_error);
-                }       
+                err += reprojectionError(pts_w, R_wc[imu_j][1], t_wc[imu_j][1], it_per_frame.pointRight);
+                errCnt++;
             }
         }
         double ave_err = err / errCnt;
-        if(ave_err * FOCAL_LENGTH > 3)
-            removeIndex.insert(it_per_id.feature_id);
+        outlierFlags[k] = ave_err * FOCAL_LENGTH > 3;
+    });
 
-    }
+    for (size_t k = 0; k < outlierCandidates.size(); k++)
+        if (outlierFlags[k])
+            removeIndex.insert(outlierCandidates[k]->feature_id);
 }
 
-void Estimator::fastPredictIMU(double t, Eigen::Vector3d linear_acceleration, Eigen::Vector3d angular_velocity)
+void Estimator::updateLatestStates()
 {
-    double dt = t - latest_time;
-    latest_time = t;
-    Eigen::Vector3d un_acc_0 = latest_Q * (latest_acc_0 - latest_Ba) - g;
-    Eigen::Vector3d un_gyr = 0.5 * (latest_gyr_0 + angular_velocity) - latest_Bg;
-    latest_Q = latest_Q * Utility::deltaQ(un_gyr * dt);
-    Eigen::Vector3d un_acc_1 = latest_Q * (linear_acceleration - latest_Ba) - g;
-    Eigen::Vector3d un_acc = 0.5 * (un_acc_0 + un_acc_1);
-    latest_P = latest_P + dt * latest_V + 0.5 * dt * dt * un_acc;
-    latest_V = latest_V + dt * un_acc;
-    latest_acc_0 = linear_acceleration;
-    latest_gyr_0 = angular_velocity;
+    // the imu since this frame is re-integrated by the propagator on the imu thread
+    PropagationState start;
+    start.valid = true;
+    start.t = Headers[frame_count] + td;
+    start.P = Ps[frame_count];
+    start.Q = Rs[frame_count];
+    start.V = Vs[frame_count];
+    start.Ba = Bas[frame_count];
+    start.Bg = Bgs[frame_count];
+    start.acc_0 = acc_0;
+    start.gyr_0 = gyr_0;
+    start.g = g;
+    propagator.reset(start);
+    if (!params.USE_IMU)
+        poseHistory.push(start.t, start.P, start.Q, start.V);
+    publishTrackingPrior();
 }
 
-void Estimator::updateLatestStates()
+void Estimator::publishTrackingPrior()
 {
-    latest_time = Headers[frame_count] + td;
-    latest_P = Ps[frame_count];
-    latest_Q = Rs[frame_count];
-    latest_V = Vs[frame_count];
-    latest_Ba = Bas[frame_count];
-    latest_Bg = Bgs[frame_count];
-    latest_acc_0 = acc_0;
-    latest_gyr_0 = gyr_0;
-    mBuf.lock();
-    queue<pair<double, Eigen::Vector3d>> tmp_accBuf = accBuf;
-    queue<pair<double, Eigen::Vector3d>> tmp_gyrBuf = gyrBuf;
-    while(!tmp_accBuf.empty())
-    {
-        double t = tmp_accBuf.front().first;
-        Eigen::Vector3d acc = tmp_accBuf.front().second;
-        Eigen::Vector3d gyr = tmp_gyrBuf.front().second;
-        fastPredictIMU(t, acc, gyr);
-        tmp_accBuf.pop();
-        tmp_gyrBuf.pop();
-    }
-    mBuf.unlock();
+    TrackingPrior prior;
+    prior.Bg = Bgs[frame_count];
+    for (int i = 0; i < params.NUM_OF_CAM; i++)
+        prior.ric[i] = ric[i];
+    trackingPriorBuf.write(prior);
 }
@@ -11,19 +11,40 @@
  
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
 #include <std_msgs/Header.h>
 #include <std_msgs/Float32.h>
 #include <ceres/ceres.h>
 #include <unordered_map>
 #include <queue>
+#include <deque>
 #include <opencv2/core/eigen.hpp>
 #include <eigen3/Eigen/Dense>
 #include <eigen3/Eigen/Geometry>
 
 #include "parameters.h"
 #include "feature_manager.h"
+#include "imu_buffer.h"
+#include "imu_propagator.h"
+#include "estimator_mode.h"
+#include "solver_tuner.h"
+#include "window_solver.h"
+#include "factor_pool.h"
+#include "frame_budget.h"
+#include "window_ring.h"
+#include "motion_only_pose.h"
+#include "checkpoint.h"
+#include "batch_log.h"
 #include "../utility/utility.h"
 #include "../utility/tic_toc.h"
+#include "../utility/publish_thread.h"
+#include "../utility/track_image_thread.h"
+#include "../utility/visualization.h"
+#include "../utility/latency_profiler.h"
+#include "../utility/trace.h"
+#include "../utility/triple_buffer.h"
 #include "../initial/solve_5pts.h"
 #include "../initial/initial_sfm.h"
 #include "../initial/initial_alignment.h"
@@ -31,9 +52,8 @@
 #include "../factor/imu_factor.h"
 #include "../factor/pose_local_parameterization.h"
 #include "../factor/marginalization_factor.h"
-#include "../factor/projectionTwoFrameOneCamFactor.h"
-#include "../factor/projectionTwoFrameTwoCamFactor.h"
-#include "../factor/projectionOneFrameTwoCamFactor.h"
+#include "../factor/projectionLayoutFactor.h"
+#include "../factor/projectionFeatureFactor.h"
 #include "../featureTracker/feature_tracker.h"
 
 
@@ -41,43 +61,129 @@ class Estimator
 {
   public:
     Estimator();
+    ~Estimator();
 
+    // copies _params, everything the estimator and its parts read comes from that copy
+    void setParameter(const Parameters &_params);
+    // applies params again, after clearState
     void setParameter();
+    // off: no ROS output at all, for offline replay without a master, call before setParameter
+    void setPublish(bool enable) { publish = enable; }
+    // tracks the frames still queued for trackThread, then wakes and joins the process thread,
+    // frames still buffered there are not processed
+    void stop();
 
     // interface
     void initFirstPose(Eigen::Vector3d p, Eigen::Matrix3d r);
     void inputIMU(double t, const Vector3d &linearAcceleration, const Vector3d &angularVelocity);
-    void inputFeature(double t, const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &featureFrame);
-    void inputImage(double t, const cv::Mat &_img, const cv::Mat &_img1 = cv::Mat());
+    void inputFeature(double t, const FeatureFrame &featureFrame);
+    // _imgAux: the images of cameras 2 and up with the same stamp, one per camera, tracked in
+    // parallel with _img and _img1. With pipeline_queue_size > 0 the frame is only queued for
+    // trackThread and the call returns at once
+    void inputImage(double t, const cv::Mat &_img, const cv::Mat &_img1 = cv::Mat(),
+                    const vector<cv::Mat> &_imgAux = vector<cv::Mat>());
     void processIMU(double t, double dt, const Vector3d &linear_acceleration, const Vector3d &angular_velocity);
-    void processImage(const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image, const double header);
+    // image is moved into all_image_frame while the window is initializing
+    void processImage(FeatureFrame &&image, const double header);
     void processMeasurements();
+    // the tracking of inputImage, on the caller or on trackThread
+    void trackFrame(double t, const cv::Mat &_img, const cv::Mat &_img1, const vector<cv::Mat> &_imgAux);
+    void trackProcess();
+    // frames queued for processing plus snapshots not published yet, for a feeder that must not
+    // outrun the estimator (bag playback)
+    size_t backlog();
+    // copies what the publishers read, points only when with_points
+    void snapshot(double t, bool with_points, PublishSnapshot &s) const;
+    void memoryFootprint(MemoryFootprint &m) const;
 
     // internal
     void clearState();
+    // slots of the window rings
+    void resizeWindow(int slots);
+    void clearImageFrames();
     bool initialStructure();
     bool visualInitialAlign();
-    bool relativePose(Matrix3d &relative_R, Vector3d &relative_T, int &l);
+    int relativePose(Matrix3d *relative_R, Vector3d *relative_T, int *l, int max_candidates);
     void slideWindow();
     void slideWindowNew();
     void slideWindowOld();
+    // the versions of the mode picked in setParameter
+    void optimization() { (this->*modeFunctions.optimization)(); }
+    template <class Mode>
     void optimization();
+    template <class Mode>
+    void selectMode();
+    template <typename Problem, class Mode>
+    void buildProblem(Problem &problem, ceres::LossFunction *loss_function);
+    // clears the residuals of the last optimization from the persistent problem
+    ceres::Problem &reusedProblem();
+    template <typename T, typename... Args>
+    T *makeFactor(FactorPool<T> &pool, Args &&... args)
+    {
+        return reuseFactors ? pool.get(std::forward<Args>(args)...) : new T(std::forward<Args>(args)...);
+    }
+    // the projection factors of one residual model, by layout
+    template <class Residual>
+    struct ProjectionFactorPools
+    {
+        FactorPool<ProjectionLayoutFactor<TwoFrameOneCam, Residual>> twoFrameOneCam;
+        FactorPool<ProjectionLayoutFactor<TwoFrameTwoCam, Residual>> twoFrameTwoCam;
+        FactorPool<ProjectionLayoutFactor<OneFrameTwoCam, Residual>> oneFrameTwoCam;
+        void release()
+        {
+            twoFrameOneCam.release();
+            twoFrameTwoCam.release();
+            oneFrameTwoCam.release();
+        }
+    };
+    // one factor per observation of the feature, returns the number of observations
+    template <typename Problem, class Residual, class Mode>
+    int addProjectionFactors(Problem &problem, ceres::LossFunction *loss_function, FeaturePerId &it_per_id,
+                             ProjectionFactorPools<Residual> &pools);
+    // the same for the features hosted in the oldest frame, which is marginalized
+    template <class Residual, class Mode>
+    void marginalizeProjectionFactors(MarginalizationInfo *marginalization_info, ceres::LossFunction *loss_function,
+                                      FeaturePerId &it_per_id);
+    // fast_pose: the new frame against the solved landmarks before processImage, published on
+    // fast_odometry and handed to the imu propagation until the window optimization corrects it
+    void fastPose(const FeatureFrame &image, double t);
+    // keyframe_optimization 2: the motion only solve of a frame that is not a keyframe
+    void refineNewestPose();
+    template <class Residual>
+    void addNewestFrameFactors(ceres::Problem &problem, ceres::LossFunction *loss_function);
+    // the prior update of MARGIN_SECOND_NEW, also without a window optimization
+    void marginalizeSecondNew();
+    // checkpoint_period: copies the window of a NON_LINEAR estimator once its frame is done
+    void saveCheckpoint(EstimatorCheckpoint &c) const;
+    // batch_log: frames 0 to count - 1 of the window with what they observed
+    void logKeyframes(int count);
+    // checkpoint_restore: takes over the window of c before the first frame, at t
+    void restoreCheckpoint(const EstimatorCheckpoint &c, double t);
+    double *checkpointBlock(int kind, int index);
+    bool checkpointBlockOf(const double *block, int &kind, int &index) const;
+    void vector2double() { (this->*modeFunctions.vector2double)(); }
+    void double2vector() { (this->*modeFunctions.double2vector)(); }
+    template <class Mode>
     void vector2double();
+    template <class Mode>
     void double2vector();
+    void repropagateWindow();
+    void warmReinit();
     bool failureDetection();
-    bool getIMUInterval(double t0, double t1, vector<pair<double, Eigen::Vector3d>> &accVector, 
-                                              vector<pair<double, Eigen::Vector3d>> &gyrVector);
+    bool getIMUInterval(double t0, double t1, ImuSpan &span);
     void getPoseInWorldFrame(Eigen::Matrix4d &T);
     void getPoseInWorldFrame(int index, Eigen::Matrix4d &T);
+    // body pose at sensor time t from pose_history, from any thread; false outside what it holds
+    bool poseAt(double t, PoseHistory::State &state) const { return poseHistory.query(t, state); }
     void predictPtsInNextFrame();
-    void outliersRejection(set<int> &removeIndex);
-    double reprojectionError(Matrix3d &Ri, Vector3d &Pi, Matrix3d &rici, Vector3d &tici,
-                                     Matrix3d &Rj, Vector3d &Pj, Matrix3d &ricj, Vector3d &ticj, 
-                                     double depth, Vector3d &uvi, Vector3d &uvj);
+    void outliersRejection(set<FeatureId> &removeIndex);
+    static double reprojectionError(const Vector3d &pts_w, const Matrix3d &R_wc, const Vector3d &t_wc,
+                                    const Vector3d &uvj);
     void updateLatestStates();
-    void fastPredictIMU(double t, Eigen::Vector3d linear_acceleration, Eigen::Vector3d angular_velocity);
+    void publishTrackingPrior();
     bool IMUAvailable(double t);
-    void initFirstIMUPose(vector<pair<double, Eigen::Vector3d>> &accVector);
+    bool getCameraRotation(double t0, double t1, Matrix3d &R_c0_c1, int camera = 0);
+    void initFirstIMUPose(const ImuSpan &imuSpan);
 
     enum SolverFlag
     {
@@ -91,43 +197,93 @@ class Estimator
         MARGIN_SECOND_NEW = 1
     };
 
+    Parameters params;
+    LatencyProfiler latencyProfiler;
+    // the publishers, registerPub is up to the node
+    Visualization visualization;
+
     std::mutex mBuf;
-    queue<pair<double, Eigen::Vector3d>> accBuf;
-    queue<pair<double, Eigen::Vector3d>> gyrBuf;
-    queue<pair<double, map<int, vector<pair<int, Eigen::Matrix<double, 7, 1> > > > > > featureBuf;
+    std::condition_variable con;
+    // written by inputIMU only, read without mBuf
+    ImuBuffer imuBuf;
+    // set by the process thread while it sleeps on con for imu, inputIMU only notifies then
+    std::atomic<bool> imuWaiting;
+    queue<pair<double, FeatureFrame > > featureBuf;
+    // publish_keyframe_image: copies of the left images of the queued frames, guarded by mBuf, and
+    // of the frames in the window, only used by the process thread
+    queue<pair<double, cv::Mat> > imageBuf;
+    deque<pair<double, cv::Mat> > windowImages;
     double prevTime, curTime;
     bool openExEstimation;
 
+    // pipeline_queue_size > 0: the frames given to inputImage, tracked in order by trackThread
+    struct TrackRequest
+    {
+        double t;
+        cv::Mat img, img1;
+        vector<cv::Mat> aux;
+    };
+    std::mutex mTrack;
+    std::condition_variable conTrack;
+    deque<TrackRequest> trackBuf;
+    bool trackStop;
     std::thread trackThread;
     std::thread processThread;
+    // all ROS output of the frames, fed by the process thread
+    PublishThread publishThread;
+    // show_track: image_track, drawn from the tracker's TrackDrawing off the tracking thread
+    TrackImageThread trackImageThread;
+    RateLimit trackImageRate;
+    // checkpoint_period: the checkpoints go out on the writer thread
+    CheckpointWriter checkpointWriter;
+    RateLimit checkpointRate;
+    // memory: the footprint goes out with a snapshot once a second
+    RateLimit memoryRate;
+    // checkpoint_restore: read by setParameter, applied to the first frame
+    std::unique_ptr<EstimatorCheckpoint> pendingCheckpoint;
+    // batch_log: the keyframes go out on the writer thread, the segment counts the clearState calls
+    BatchLogWriter batchLog;
+    int batchSegment;
+    bool publish;
+    bool stopFlag;
 
     FeatureTracker featureTracker;
+    // cameras 2 and up of a multi-camera rig, one monocular tracker each, run on trackPool by
+    // inputImage next to featureTracker
+    vector<std::unique_ptr<FeatureTracker>> auxTrackers;
+    std::unique_ptr<ThreadPool> trackPool;
+    // NUM_OF_CAM the trackers were set up for, 0 before the first setParameter
+    int trackerCameras;
 
     SolverFlag solver_flag;
     MarginalizationFlag  marginalization_flag;
     Vector3d g;
 
-    Matrix3d ric[2];
-    Vector3d tic[2];
+    Matrix3d ric[MAX_NUM_OF_CAM];
+    Vector3d tic[MAX_NUM_OF_CAM];
 
-    Vector3d        Ps[(WINDOW_SIZE + 1)];
-    Vector3d        Vs[(WINDOW_SIZE + 1)];
-    Matrix3d        Rs[(WINDOW_SIZE + 1)];
-    Vector3d        Bas[(WINDOW_SIZE + 1)];
-    Vector3d        Bgs[(WINDOW_SIZE + 1)];
+    // the states of the window, rings that slideWindow turns by one frame
+    WindowRing<Vector3d> Ps;
+    WindowRing<Vector3d> Vs;
+    WindowRing<Matrix3d> Rs;
+    WindowRing<Vector3d> Bas;
+    WindowRing<Vector3d> Bgs;
     double td;
 
     Matrix3d back_R0, last_R, last_R0;
     Vector3d back_P0, last_P, last_P0;
-    double Headers[(WINDOW_SIZE + 1)];
+    // warm_reinit: the window before the last optimization, restored when the solve fails, and
+    // the frames left until another failure is handled by a full reset
+    Matrix3d warm_R[MAX_WINDOW_SIZE + 1], warm_ric[MAX_NUM_OF_CAM];
+    Vector3d warm_P[MAX_WINDOW_SIZE + 1], warm_V[MAX_WINDOW_SIZE + 1];
+    Vector3d warm_Ba[MAX_WINDOW_SIZE + 1], warm_Bg[MAX_WINDOW_SIZE + 1], warm_tic[MAX_NUM_OF_CAM];
+    double warm_td;
+    int warm_frames;
+    WindowRing<double> Headers;
 
-    IntegrationBase *pre_integrations[(WINDOW_SIZE + 1)];
+    WindowRing<IntegrationBase *> pre_integrations;
     Vector3d acc_0, gyr_0;
 
-    vector<double> dt_buf[(WINDOW_SIZE + 1)];
-    vector<Vector3d> linear_acceleration_buf[(WINDOW_SIZE + 1)];
-    vector<Vector3d> angular_velocity_buf[(WINDOW_SIZE + 1)];
-
     int frame_count;
     int sum_of_outlier, sum_of_back, sum_of_front, sum_of_invalid;
     int inputImageCnt;
@@ -148,10 +304,9 @@ class Estimator
     double initial_timestamp;
 
 
-    double para_Pose[WINDOW_SIZE + 1][SIZE_POSE];
-    double para_SpeedBias[WINDOW_SIZE + 1][SIZE_SPEEDBIAS];
-    double para_Feature[NUM_OF_F][SIZE_FEATURE];
-    double para_Ex_Pose[2][SIZE_POSE];
+    double para_Pose[MAX_WINDOW_SIZE + 1][SIZE_POSE];
+    double para_SpeedBias[MAX_WINDOW_SIZE + 1][SIZE_SPEEDBIAS];
+    double para_Ex_Pose[MAX_NUM_OF_CAM][SIZE_POSE];
     double para_Retrive_Pose[SIZE_POSE];
     double para_Td[1][1];
     double para_Tr[1][1];
@@ -161,15 +316,57 @@ class Estimator
     MarginalizationInfo *last_marginalization_info;
     vector<double *> last_marginalization_parameter_blocks;
 
+    // the frames since the oldest of the window with their preintegration, only kept while INITIAL
     map<double, ImageFrame> all_image_frame;
     IntegrationBase *tmp_pre_integration;
 
     Eigen::Vector3d initP;
     Eigen::Matrix3d initR;
 
-    double latest_time;
-    Eigen::Vector3d latest_P, latest_V, latest_Ba, latest_Bg, latest_acc_0, latest_gyr_0;
-    Eigen::Quaterniond latest_Q;
+    // imu_propagate output, only touched by inputIMU besides the reset in updateLatestStates
+    ImuPropagator propagator;
+    // gyro bias and camera rotations of getCameraRotation, handed from the process thread to the
+    // tracking thread, which keeps the last one it read
+    struct TrackingPrior
+    {
+        Vector3d Bg;
+        Matrix3d ric[MAX_NUM_OF_CAM];
+    };
+    TripleBuffer<TrackingPrior> trackingPriorBuf;
+    TrackingPrior trackingPrior;
+    struct ModeFunctions
+    {
+        void (Estimator::*optimization)();
+        void (Estimator::*vector2double)();
+        void (Estimator::*double2vector)();
+    } modeFunctions;
+    // written by the propagator, or by updateLatestStates without imu
+    PoseHistory poseHistory;
+    SolverTuner solverTuner;
+    WindowSolver windowSolver;
+
+    // PERSISTENT_PROBLEM: the problem, its parameter blocks and the cost functions are kept
+    // across optimizations, the problem owns none of them
+    std::unique_ptr<ceres::Problem> persistentProblem;
+    vector<ceres::ResidualBlockId> residualIds;
+    bool reuseFactors;
+    PoseLocalParameterization poseParameterization;
+    ceres::HuberLoss huberLoss;
+    std::unique_ptr<MarginalizationFactor> marginalizationFactor;
+    FactorPool<IMUFactor> imuFactors;
+    ProjectionFactorPools<PlaneResidual> planeFactors;
+    ProjectionFactorPools<SphereResidual> sphereFactors;
+    FactorPool<ProjectionFeatureFactor> featureFactors;
+    LatencyStatistics propagateLatency;
+    FrameBudget frameBudget;
+    // NUM_THREADS workers shared by the parallel stages of the estimator thread
+    ThreadPool threadPool;
+    MarginalizationWorkspace margWorkspace;
+    MotionOnlyPose motionOnlyPose;
+    vector<MotionOnlyObservation> fastObservations;
+    // outliersRejection: the features checked and their verdicts
+    vector<const FeaturePerId *> outlierCandidates;
+    vector<char> outlierFlags;
 
     bool initFirstPoseFlag;
 };
@@ -0,0 +1,27 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+// The sensor setup the per-frame core of the estimator (optimization, vector2double,
+// double2vector) is compiled for. use_imu and stereo are constants there, so each setup gets its
+// own parameter block layout without the branches of the others; setParameter picks one from the
+// yaml, once.
+template <bool Imu, bool Stereo>
+struct EstimatorMode
+{
+    static constexpr bool imu = Imu;
+    static constexpr bool stereo = Stereo;
+};
+
+typedef EstimatorMode<true, false> MonoImuMode;
+typedef EstimatorMode<false, true> StereoMode;
+typedef EstimatorMode<true, true> StereoImuMode;
+// not a setup VINS runs, only so that every yaml has a mode
+typedef EstimatorMode<false, false> MonoMode;
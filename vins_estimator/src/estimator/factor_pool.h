@@ -0,0 +1,42 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <memory>
+
+// Cost functions of one type kept across optimizations. get() hands out a factor re-initialized
+// through T::reset with the constructor arguments, a new one only when all are in use.
+template <typename T>
+class FactorPool
+{
+  public:
+    FactorPool() : used(0) {}
+
+    template <typename... Args>
+    T *get(Args &&... args)
+    {
+        if (used == items.size())
+            items.emplace_back(new T(std::forward<Args>(args)...));
+        else
+            items[used]->reset(std::forward<Args>(args)...);
+        return items[used++].get();
+    }
+
+    // all factors handed out may be reused, they must no longer be in a problem
+    void release()
+    {
+        used = 0;
+    }
+
+  private:
+    std::vector<std::unique_ptr<T>> items;
+    size_t used;
+};
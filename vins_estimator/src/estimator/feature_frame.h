@@ -0,0 +1,50 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ * 
+ * This file is part of VINS.
+ * 
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <eigen3/Eigen/Dense>
+
+// The tracker of camera c numbers its features from c << FEATURE_ID_CAMERA_SHIFT up, so the trackers
+// of a multi-camera rig never hand out the same id and each one's ids only ever increase.
+typedef int64_t FeatureId;
+const int FEATURE_ID_CAMERA_SHIFT = 48;
+
+inline FeatureId firstFeatureId(int camera)
+{
+    return static_cast<FeatureId>(camera) << FEATURE_ID_CAMERA_SHIFT;
+}
+
+// one observation of a feature in one camera: x, y, z (normalized plane), u, v, velocity x, y
+struct FeatureObservation
+{
+    FeatureObservation() {}
+    FeatureObservation(FeatureId _feature_id, int _camera_id, const Eigen::Matrix<double, 7, 1> &_xyz_uv_velocity)
+        : feature_id(_feature_id), camera_id(_camera_id), xyz_uv_velocity(_xyz_uv_velocity) {}
+
+    FeatureId feature_id;
+    int camera_id;
+    Eigen::Matrix<double, 7, 1> xyz_uv_velocity;
+};
+
+// all observations of one image, sorted by feature_id, the camera 1 observation of a feature
+// right after its camera 0 one. The features of the other cameras of a rig follow, by the id ranges
+// of firstFeatureId. A single contiguous allocation, moved through featureBuf.
+typedef std::vector<FeatureObservation> FeatureFrame;
+
+inline void sortFeatureFrame(FeatureFrame &frame)
+{
+    std::sort(frame.begin(), frame.end(), [](const FeatureObservation &a, const FeatureObservation &b)
+              {
+                  return a.feature_id < b.feature_id || (a.feature_id == b.feature_id && a.camera_id < b.camera_id);
+              });
+}
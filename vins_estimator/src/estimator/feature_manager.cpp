@@ -14,24 +14,68 @@ int FeaturePerId::endFrame()
     return start_frame + feature_per_frame.size() - 1;
 }
 
-FeatureManager::FeatureManager(Matrix3d _Rs[])
-    : Rs(_Rs)
+FeatureManager::FeatureManager(const WindowRing<Matrix3d> &_Rs, const Parameters &_params)
+    : params(_params), pool(nullptr), Rs(_Rs)
 {
-    for (int i = 0; i < NUM_OF_CAM; i++)
+    for (int i = 0; i < MAX_NUM_OF_CAM; i++)
         ric[i].setIdentity();
 }
 
 void FeatureManager::setRic(Matrix3d _ric[])
 {
-    for (int i = 0; i < NUM_OF_CAM; i++)
+    for (int i = 0; i < params.NUM_OF_CAM; i++)
     {
         ric[i] = _ric[i];
     }
 }
 
+void FeatureManager::setThreadPool(ThreadPool *_pool)
+{
+    pool = _pool;
+}
+
+void FeatureManager::reserve(int num_features)
+{
+    for (int n = feature.size() + spare.size(); n < num_features; n++)
+        spare.push_back(FeaturePerId(-1, 0, 0));
+    feature_index.reserve(num_features);
+    pending.reserve(num_features);
+}
+
 void FeatureManager::clearState()
 {
-    feature.clear();
+    spare.splice(spare.end(), feature);
+    feature_index.clear();
+}
+
+list<FeaturePerId>::iterator FeatureManager::addFeature(FeatureId feature_id, int start_frame, int camera)
+{
+    if (spare.empty())
+        feature.push_back(FeaturePerId(feature_id, start_frame, camera));
+    else
+    {
+        feature.splice(feature.end(), spare, spare.begin());
+        feature.back().reset(feature_id, start_frame, camera);
+    }
+    auto it = prev(feature.end());
+    feature_index[feature_id] = it;
+    return it;
+}
+
+// the iterators to the other features stay valid
+void FeatureManager::removeFeature(list<FeaturePerId>::iterator it)
+{
+    feature_index.erase(it->feature_id);
+    spare.splice(spare.end(), feature, it);
+}
+
+size_t FeatureManager::memoryBytes() const
+{
+    // a list node is the record and two links, a hash node the entry and a link
+    size_t records = (feature.size() + spare.size()) * (sizeof(FeaturePerId) + 2 * sizeof(void *));
+    size_t index = feature_index.size() * (sizeof(decltype(feature_index)::value_type) + sizeof(void *)) +
+                   feature_index.bucket_count() * sizeof(void *);
+    return records + index + pending.capacity() * sizeof(FeaturePerId *);
 }
 
 int FeatureManager::getFeatureCount()
@@ -48,8 +92,55 @@ int FeatureManager::getFeatureCount()
     return cnt;
 }
 
+// Features are ranked by track length, parallax between the first and last observation and a
+// stereo host observation, then taken best first from each cell of a grid over the host image in
+// turn, so the selection keeps covering the whole image.
+int FeatureManager::selectFeatures(int max_count)
+{
+    const int grid_cols = 8, grid_rows = 6;
+    vector<vector<pair<double, FeaturePerId *>>> cells(grid_cols * grid_rows);
+    int available = 0;
+    for (auto &it_per_id : feature)
+    {
+        it_per_id.selected = true;
+        if (it_per_id.feature_per_frame.size() < 4)
+            continue;
+        available++;
+        if (max_count < 0)
+            continue;
+        const FeaturePerFrame &first = it_per_id.feature_per_frame.front();
+        const FeaturePerFrame &last = it_per_id.feature_per_frame.back();
+        double parallax = (last.point - first.point).head<2>().norm() * FOCAL_LENGTH;
+        double score = it_per_id.feature_per_frame.size() + std::min(parallax / 10.0, 3.0) + (first.is_stereo ? 1.0 : 0.0);
+        int col = std::min(std::max(static_cast<int>(first.uv.x() * grid_cols / params.COL), 0), grid_cols - 1);
+        int row = std::min(std::max(static_cast<int>(first.uv.y() * grid_rows / params.ROW), 0), grid_rows - 1);
+        cells[row * grid_cols + col].push_back(make_pair(score, &it_per_id));
+    }
+    if (max_count < 0 || available <= max_count)
+        return available;
 
-bool FeatureManager::addFeatureCheckParallax(int frame_count, const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image, double td)
+    size_t deepest = 0;
+    for (auto &cell : cells)
+    {
+        sort(cell.begin(), cell.end(), [](const pair<double, FeaturePerId *> &a, const pair<double, FeaturePerId *> &b)
+                                       { return a.first > b.first; });
+        for (auto &it : cell)
+            it.second->selected = false;
+        deepest = max(deepest, cell.size());
+    }
+    int count = 0;
+    for (size_t rank = 0; rank < deepest && count < max_count; rank++)
+        for (auto &cell : cells)
+            if (rank < cell.size() && count < max_count)
+            {
+                cell[rank].second->selected = true;
+                count++;
+            }
+    ROS_DEBUG("selected %d of %d features", count, available);
+    return available;
+}
+
+bool FeatureManager::addFeatureCheckParallax(int frame_count, const FeatureFrame &image, double td)
 {
     ROS_DEBUG("input feature: %d", (int)image.size());
     ROS_DEBUG("num of feature: %d", getFeatureCount());
@@ -59,34 +150,38 @@ bool FeatureManager::addFeatureCheckParallax(int frame_count, const map<int, vec
     last_average_parallax = 0;
     new_feature_num = 0;
     long_track_num = 0;
-    for (auto &id_pts : image)
+    for (size_t i = 0; i < image.size(); i++)
     {
-        FeaturePerFrame f_per_fra(id_pts.second[0].second, td);
-        assert(id_pts.second[0].first == 0);
-        if(id_pts.second.size() == 2)
+        FeaturePerFrame f_per_fra(image[i].xyz_uv_velocity, td);
+        int camera = image[i].camera_id;
+        assert(camera == 0 || camera >= 2);
+        FeatureId feature_id = image[i].feature_id;
+        if(camera == 0 && i + 1 < image.size() && image[i + 1].feature_id == feature_id)
         {
-            f_per_fra.rightObservation(id_pts.second[1].second);
-            assert(id_pts.second[1].first == 1);
+            i++;
+            f_per_fra.rightObservation(image[i].xyz_uv_velocity);
+            assert(image[i].camera_id == 1);
         }
+        if (params.ROLLING_SHUTTER)
+            f_per_fra.rollingShutter(params.TR, params.ROW);
 
-        int feature_id = id_pts.first;
-        auto it = find_if(feature.begin(), feature.end(), [feature_id](const FeaturePerId &it)
-                          {
-            return it.feature_id == feature_id;
-                          });
-
-        if (it == feature.end())
+        auto found = feature_index.find(feature_id);
+        if (found == feature_index.end())
         {
-            feature.push_back(FeaturePerId(feature_id, frame_count));
-            feature.back().feature_per_frame.push_back(f_per_fra);
-            new_feature_num++;
+            addFeature(feature_id, frame_count, camera)->feature_per_frame.push_back(f_per_fra);
+            if (camera == 0)
+                new_feature_num++;
         }
-        else if (it->feature_id == feature_id)
+        else
         {
+            auto it = found->second;
             it->feature_per_frame.push_back(f_per_fra);
-            last_track_num++;
-            if( it-> feature_per_frame.size() >= 4)
-                long_track_num++;
+            if (camera == 0)
+            {
+                last_track_num++;
+                if( it-> feature_per_frame.size() >= 4)
+                    long_track_num++;
+            }
         }
     }
 
@@ -97,7 +192,7 @@ bool FeatureManager::addFeatureCheckParallax(int frame_count, const map<int, vec
 
     for (auto &it_per_id : feature)
     {
-        if (it_per_id.start_frame <= frame_count - 2 &&
+        if (it_per_id.camera == 0 && it_per_id.start_frame <= frame_count - 2 &&
             it_per_id.start_frame + int(it_per_id.feature_per_frame.size()) - 1 >= frame_count - 1)
         {
             parallax_sum += compensatedParallax2(it_per_id, frame_count);
@@ -114,7 +209,7 @@ bool FeatureManager::addFeatureCheckParallax(int frame_count, const map<int, vec
         ROS_DEBUG("parallax_sum: %lf, parallax_num: %d", parallax_sum, parallax_num);
         ROS_DEBUG("current parallax: %lf", parallax_sum / parallax_num * FOCAL_LENGTH);
         last_average_parallax = parallax_sum / parallax_num * FOCAL_LENGTH;
-        return parallax_sum / parallax_num >= MIN_PARALLAX;
+        return parallax_sum / parallax_num >= params.MIN_PARALLAX;
     }
 }
 
@@ -123,7 +218,7 @@ vector<pair<Vector3d, Vector3d>> FeatureManager::getCorresponding(int frame_coun
     vector<pair<Vector3d, Vector3d>> corres;
     for (auto &it : feature)
     {
-        if (it.start_frame <= frame_count_l && it.endFrame() >= frame_count_r)
+        if (it.camera == 0 && it.start_frame <= frame_count_l && it.endFrame() >= frame_count_r)
         {
             Vector3d a = Vector3d::Zero(), b = Vector3d::Zero();
             int idx_l = frame_count_l - it.start_frame;
@@ -139,62 +234,40 @@ vector<pair<Vector3d, Vector3d>> FeatureManager::getCorresponding(int frame_coun
     return corres;
 }
 
-void FeatureManager::setDepth(const VectorXd &x)
-{
-    int feature_index = -1;
-    for (auto &it_per_id : feature)
-    {
-        it_per_id.used_num = it_per_id.feature_per_frame.size();
-        if (it_per_id.used_num < 4)
-            continue;
-
-        it_per_id.estimated_depth = 1.0 / x(++feature_index);
-        //ROS_INFO("feature id %d , start_frame %d, depth %f ", it_per_id->feature_id, it_per_id-> start_frame, it_per_id->estimated_depth);
-        if (it_per_id.estimated_depth < 0)
-        {
-            it_per_id.solve_flag = 2;
-        }
-        else
-            it_per_id.solve_flag = 1;
-    }
-}
-
 void FeatureManager::removeFailures()
 {
     for (auto it = feature.begin(), it_next = feature.begin();
          it != feature.end(); it = it_next)
     {
         it_next++;
-        if (it->solve_flag == 2)
-            feature.erase(it);
+        if (it->solveFlag() == 2)
+            removeFeature(it);
     }
 }
 
 void FeatureManager::clearDepth()
 {
     for (auto &it_per_id : feature)
-        it_per_id.estimated_depth = -1;
+        it_per_id.setDepth(-1);
 }
 
-VectorXd FeatureManager::getDepthVector()
+// Rows of A X_h = 0 with X_h = (X, 1): solves the 3x3 normal equations of the inhomogeneous form in
+// closed form, the SVD of A only when they are close to singular (a point near infinity)
+static Eigen::Vector4d solveDLT(const Eigen::Ref<const Eigen::Matrix<double, Eigen::Dynamic, 4>> &A)
 {
-    VectorXd dep_vec(getFeatureCount());
-    int feature_index = -1;
-    for (auto &it_per_id : feature)
+    Eigen::Matrix3d H = A.leftCols<3>().transpose() * A.leftCols<3>();
+    Eigen::Vector3d g = A.leftCols<3>().transpose() * A.col(3);
+    double scale = H.trace() / 3;
+    double det = H.determinant();
+    if (det > 1e-12 * scale * scale * scale)
     {
-        it_per_id.used_num = it_per_id.feature_per_frame.size();
-        if (it_per_id.used_num < 4)
-            continue;
-#if 1
-        dep_vec(++feature_index) = 1. / it_per_id.estimated_depth;
-#else
-        dep_vec(++feature_index) = it_per_id->estimated_depth;
-#endif
+        Eigen::Vector4d X;
+        X << -(H.inverse() * g), 1.0;
+        return X;
     }
-    return dep_vec;
+    return Eigen::JacobiSVD<Eigen::MatrixXd>(A, Eigen::ComputeFullV).matrixV().rightCols<1>();
 }
 
-
 void FeatureManager::triangulatePoint(Eigen::Matrix<double, 3, 4> &Pose0, Eigen::Matrix<double, 3, 4> &Pose1,
                         Eigen::Vector2d &point0, Eigen::Vector2d &point1, Eigen::Vector3d &point_3d)
 {
@@ -204,8 +277,7 @@ void FeatureManager::triangulatePoint(Eigen::Matrix<double, 3, 4> &Pose0, Eigen:
     design_matrix.row(2) = point1[0] * Pose1.row(2) - Pose1.row(0);
     design_matrix.row(3) = point1[1] * Pose1.row(2) - Pose1.row(1);
     Eigen::Vector4d triangulated_point;
-    triangulated_point =
-              design_matrix.jacobiSvd(Eigen::ComputeFullV).matrixV().rightCols<1>();
+    triangulated_point = solveDLT(design_matrix);
     point_3d(0) = triangulated_point(0) / triangulated_point(3);
     point_3d(1) = triangulated_point(1) / triangulated_point(3);
     point_3d(2) = triangulated_point(2) / triangulated_point(3);
@@ -225,7 +297,7 @@ bool FeatureManager::solvePoseByPnP(Eigen::Matrix3d &R, Eigen::Vector3d &P,
     //printf("pnp size %d \n",(int)pts2D.size() );
     if (int(pts2D.size()) < 4)
     {
-        printf("feature tracking not enough, please slowly move you device! \n");
+        VINS_WARN("feature tracking not enough, please slowly move you device! \n");
         return false;
     }
     cv::Mat r, rvec, t, D, tmp_r;
@@ -239,7 +311,7 @@ bool FeatureManager::solvePoseByPnP(Eigen::Matrix3d &R, Eigen::Vector3d &P,
 
     if(!pnp_succ)
     {
-        printf("pnp failed ! \n");
+        VINS_WARN("pnp failed ! \n");
         return false;
     }
     cv::Rodrigues(rvec, r);
@@ -256,7 +328,7 @@ bool FeatureManager::solvePoseByPnP(Eigen::Matrix3d &R, Eigen::Vector3d &P,
     return true;
 }
 
-void FeatureManager::initFramePoseByPnP(int frameCnt, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[])
+void FeatureManager::initFramePoseByPnP(int frameCnt, WindowRing<Vector3d> &Ps, WindowRing<Matrix3d> &Rs, Vector3d tic[], Matrix3d ric[])
 {
 
     if(frameCnt > 0)
@@ -265,12 +337,12 @@ void FeatureManager::initFramePoseByPnP(int frameCnt, Vector3d Ps[], Matrix3d Rs
         vector<cv::Point3f> pts3D;
         for (auto &it_per_id : feature)
         {
-            if (it_per_id.estimated_depth > 0)
+            if (it_per_id.camera == 0 && it_per_id.depth() > 0)
             {
                 int index = frameCnt - it_per_id.start_frame;
                 if((int)it_per_id.feature_per_frame.size() >= index + 1)
                 {
-                    Vector3d ptsInCam = ric[0] * (it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth) + tic[0];
+                    Vector3d ptsInCam = ric[0] * (it_per_id.feature_per_frame[0].point * it_per_id.depth()) + tic[0];
                     Vector3d ptsInWorld = Rs[it_per_id.start_frame] * ptsInCam + Ps[it_per_id.start_frame];
 
                     cv::Point3f point3d(ptsInWorld.x(), ptsInWorld.y(), ptsInWorld.z());
@@ -299,155 +371,173 @@ void FeatureManager::initFramePoseByPnP(int frameCnt, Vector3d Ps[], Matrix3d Rs
     }
 }
 
-void FeatureManager::triangulate(int frameCnt, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[])
+void FeatureManager::triangulate(int frameCnt, const WindowRing<Vector3d> &Ps, const WindowRing<Matrix3d> &Rs, Vector3d tic[], Matrix3d ric[])
 {
+    // the features are independent, each task only writes its own
+    pending.clear();
     for (auto &it_per_id : feature)
+        if (it_per_id.depth() <= 0)
+            pending.push_back(&it_per_id);
+    if (pool)
+        pool->run(pending.size(), [&](int i, int) { triangulateFeature(*pending[i], Ps, Rs, tic, ric); });
+    else
+        for (FeaturePerId *it_per_id : pending)
+            triangulateFeature(*it_per_id, Ps, Rs, tic, ric);
+}
+
+void FeatureManager::triangulateFeature(FeaturePerId &it_per_id, const WindowRing<Vector3d> &Ps, const WindowRing<Matrix3d> &Rs,
+                                        Vector3d tic[], Matrix3d ric[])
+{
+    const int c = it_per_id.camera;
+    if(params.STEREO && it_per_id.feature_per_frame[0].is_stereo)
     {
-        if (it_per_id.estimated_depth > 0)
-            continue;
+        int imu_i = it_per_id.start_frame;
+        Eigen::Matrix<double, 3, 4> leftPose;
+        Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[0];
+        Eigen::Matrix3d R0 = Rs[imu_i] * ric[0];
+        leftPose.leftCols<3>() = R0.transpose();
+        leftPose.rightCols<1>() = -R0.transpose() * t0;
+        //cout << "left pose " << leftPose << endl;
+
+        Eigen::Matrix<double, 3, 4> rightPose;
+        Eigen::Vector3d t1 = Ps[imu_i] + Rs[imu_i] * tic[1];
+        Eigen::Matrix3d R1 = Rs[imu_i] * ric[1];
+        rightPose.leftCols<3>() = R1.transpose();
+        rightPose.rightCols<1>() = -R1.transpose() * t1;
+        //cout << "right pose " << rightPose << endl;
+
+        Eigen::Vector2d point0, point1;
+        Eigen::Vector3d point3d;
+        point0 = it_per_id.feature_per_frame[0].point.head(2);
+        point1 = it_per_id.feature_per_frame[0].pointRight.head(2);
+        //cout << "point0 " << point0.transpose() << endl;
+        //cout << "point1 " << point1.transpose() << endl;
+
+        triangulatePoint(leftPose, rightPose, point0, point1, point3d);
+        Eigen::Vector3d localPoint;
+        localPoint = leftPose.leftCols<3>() * point3d + leftPose.rightCols<1>();
+        double depth = localPoint.z();
+        if (depth > 0)
+            it_per_id.setDepth(depth);
+        else
+            it_per_id.setDepth(params.INIT_DEPTH);
+        /*
+        Vector3d ptsGt = pts_gt[it_per_id.feature_id];
+        printf("stereo %lld pts: %f %f %f gt: %f %f %f \n",(long long)it_per_id.feature_id, point3d.x(), point3d.y(), point3d.z(),
+                                                        ptsGt.x(), ptsGt.y(), ptsGt.z());
+        */
+        return;
+    }
+    else if(it_per_id.feature_per_frame.size() > 1)
+    {
+        int imu_i = it_per_id.start_frame;
+        Eigen::Matrix<double, 3, 4> leftPose;
+        Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[c];
+        Eigen::Matrix3d R0 = Rs[imu_i] * ric[c];
+        leftPose.leftCols<3>() = R0.transpose();
+        leftPose.rightCols<1>() = -R0.transpose() * t0;
+
+        imu_i++;
+        Eigen::Matrix<double, 3, 4> rightPose;
+        Eigen::Vector3d t1 = Ps[imu_i] + Rs[imu_i] * tic[c];
+        Eigen::Matrix3d R1 = Rs[imu_i] * ric[c];
+        rightPose.leftCols<3>() = R1.transpose();
+        rightPose.rightCols<1>() = -R1.transpose() * t1;
+
+        Eigen::Vector2d point0, point1;
+        Eigen::Vector3d point3d;
+        point0 = it_per_id.feature_per_frame[0].point.head(2);
+        point1 = it_per_id.feature_per_frame[1].point.head(2);
+        triangulatePoint(leftPose, rightPose, point0, point1, point3d);
+        Eigen::Vector3d localPoint;
+        localPoint = leftPose.leftCols<3>() * point3d + leftPose.rightCols<1>();
+        double depth = localPoint.z();
+        if (depth > 0)
+            it_per_id.setDepth(depth);
+        else
+            it_per_id.setDepth(params.INIT_DEPTH);
+        /*
+        Vector3d ptsGt = pts_gt[it_per_id.feature_id];
+        printf("motion  %lld pts: %f %f %f gt: %f %f %f \n",(long long)it_per_id.feature_id, point3d.x(), point3d.y(), point3d.z(),
+                                                        ptsGt.x(), ptsGt.y(), ptsGt.z());
+        */
+        return;
+    }
+    it_per_id.used_num = it_per_id.feature_per_frame.size();
+    if (it_per_id.used_num < 4)
+        return;
 
-        if(STEREO && it_per_id.feature_per_frame[0].is_stereo)
-        {
-            int imu_i = it_per_id.start_frame;
-            Eigen::Matrix<double, 3, 4> leftPose;
-            Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[0];
-            Eigen::Matrix3d R0 = Rs[imu_i] * ric[0];
-            leftPose.leftCols<3>() = R0.transpose();
-            leftPose.rightCols<1>() = -R0.transpose() * t0;
-            //cout << "left pose " << leftPose << endl;
-
-            Eigen::Matrix<double, 3, 4> rightPose;
-            Eigen::Vector3d t1 = Ps[imu_i] + Rs[imu_i] * tic[1];
-            Eigen::Matrix3d R1 = Rs[imu_i] * ric[1];
-            rightPose.leftCols<3>() = R1.transpose();
-            rightPose.rightCols<1>() = -R1.transpose() * t1;
-            //cout << "right pose " << rightPose << endl;
-
-            Eigen::Vector2d point0, point1;
-            Eigen::Vector3d point3d;
-            point0 = it_per_id.feature_per_frame[0].point.head(2);
-            point1 = it_per_id.feature_per_frame[0].pointRight.head(2);
-            //cout << "point0 " << point0.transpose() << endl;
-            //cout << "point1 " << point1.transpose() << endl;
-
-            triangulatePoint(leftPose, rightPose, point0, point1, point3d);
-            Eigen::Vector3d localPoint;
-            localPoint = leftPose.leftCols<3>() * point3d + leftPose.rightCols<1>();
-            double depth = localPoint.z();
-            if (depth > 0)
-                it_per_id.estimated_depth = depth;
-            else
-                it_per_id.estimated_depth = INIT_DEPTH;
-            /*
-            Vector3d ptsGt = pts_gt[it_per_id.feature_id];
-            printf("stereo %d pts: %f %f %f gt: %f %f %f \n",it_per_id.feature_id, point3d.x(), point3d.y(), point3d.z(),
-                                                            ptsGt.x(), ptsGt.y(), ptsGt.z());
-            */
-            continue;
-        }
-        else if(it_per_id.feature_per_frame.size() > 1)
-        {
-            int imu_i = it_per_id.start_frame;
-            Eigen::Matrix<double, 3, 4> leftPose;
-            Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[0];
-            Eigen::Matrix3d R0 = Rs[imu_i] * ric[0];
-            leftPose.leftCols<3>() = R0.transpose();
-            leftPose.rightCols<1>() = -R0.transpose() * t0;
-
-            imu_i++;
-            Eigen::Matrix<double, 3, 4> rightPose;
-            Eigen::Vector3d t1 = Ps[imu_i] + Rs[imu_i] * tic[0];
-            Eigen::Matrix3d R1 = Rs[imu_i] * ric[0];
-            rightPose.leftCols<3>() = R1.transpose();
-            rightPose.rightCols<1>() = -R1.transpose() * t1;
-
-            Eigen::Vector2d point0, point1;
-            Eigen::Vector3d point3d;
-            point0 = it_per_id.feature_per_frame[0].point.head(2);
-            point1 = it_per_id.feature_per_frame[1].point.head(2);
-            triangulatePoint(leftPose, rightPose, point0, point1, point3d);
-            Eigen::Vector3d localPoint;
-            localPoint = leftPose.leftCols<3>() * point3d + leftPose.rightCols<1>();
-            double depth = localPoint.z();
-            if (depth > 0)
-                it_per_id.estimated_depth = depth;
-            else
-                it_per_id.estimated_depth = INIT_DEPTH;
-            /*
-            Vector3d ptsGt = pts_gt[it_per_id.feature_id];
-            printf("motion  %d pts: %f %f %f gt: %f %f %f \n",it_per_id.feature_id, point3d.x(), point3d.y(), point3d.z(),
-                                                            ptsGt.x(), ptsGt.y(), ptsGt.z());
-            */
-            continue;
-        }
-        it_per_id.used_num = it_per_id.feature_per_frame.size();
-        if (it_per_id.used_num < 4)
-            continue;
+    int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
 
-        int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
+    Eigen::Matrix<double, 2 * (MAX_WINDOW_SIZE + 1), 4> svd_A;
+    int svd_idx = 0;
 
-        Eigen::MatrixXd svd_A(2 * it_per_id.feature_per_frame.size(), 4);
-        int svd_idx = 0;
+    Eigen::Matrix<double, 3, 4> P0;
+    Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[c];
+    Eigen::Matrix3d R0 = Rs[imu_i] * ric[c];
+    P0.leftCols<3>() = Eigen::Matrix3d::Identity();
+    P0.rightCols<1>() = Eigen::Vector3d::Zero();
 
-        Eigen::Matrix<double, 3, 4> P0;
-        Eigen::Vector3d t0 = Ps[imu_i] + Rs[imu_i] * tic[0];
-        Eigen::Matrix3d R0 = Rs[imu_i] * ric[0];
-        P0.leftCols<3>() = Eigen::Matrix3d::Identity();
-        P0.rightCols<1>() = Eigen::Vector3d::Zero();
+    for (auto &it_per_frame : it_per_id.feature_per_frame)
+    {
+        imu_j++;
+
+        Eigen::Vector3d t1 = Ps[imu_j] + Rs[imu_j] * tic[c];
+        Eigen::Matrix3d R1 = Rs[imu_j] * ric[c];
+        Eigen::Vector3d t = R0.transpose() * (t1 - t0);
+        Eigen::Matrix3d R = R0.transpose() * R1;
+        Eigen::Matrix<double, 3, 4> P;
+        P.leftCols<3>() = R.transpose();
+        P.rightCols<1>() = -R.transpose() * t;
+        Eigen::Vector3d f = it_per_frame.point.normalized();
+        svd_A.row(svd_idx++) = f[0] * P.row(2) - f[2] * P.row(0);
+        svd_A.row(svd_idx++) = f[1] * P.row(2) - f[2] * P.row(1);
+
+        if (imu_i == imu_j)
+            continue;
+    }
+    ROS_ASSERT(svd_idx == 2 * (int)it_per_id.feature_per_frame.size());
+    Eigen::Vector4d svd_V = solveDLT(svd_A.topRows(svd_idx));
+    double svd_method = svd_V[2] / svd_V[3];
+    //it_per_id->estimated_depth = -b / A;
+    //it_per_id->estimated_depth = svd_V[2] / svd_V[3];
 
-        for (auto &it_per_frame : it_per_id.feature_per_frame)
-        {
-            imu_j++;
-
-            Eigen::Vector3d t1 = Ps[imu_j] + Rs[imu_j] * tic[0];
-            Eigen::Matrix3d R1 = Rs[imu_j] * ric[0];
-            Eigen::Vector3d t = R0.transpose() * (t1 - t0);
-            Eigen::Matrix3d R = R0.transpose() * R1;
-            Eigen::Matrix<double, 3, 4> P;
-            P.leftCols<3>() = R.transpose();
-            P.rightCols<1>() = -R.transpose() * t;
-            Eigen::Vector3d f = it_per_frame.point.normalized();
-            svd_A.row(svd_idx++) = f[0] * P.row(2) - f[2] * P.row(0);
-            svd_A.row(svd_idx++) = f[1] * P.row(2) - f[2] * P.row(1);
-
-            if (imu_i == imu_j)
-                continue;
-        }
-        ROS_ASSERT(svd_idx == svd_A.rows());
-        Eigen::Vector4d svd_V = Eigen::JacobiSVD<Eigen::MatrixXd>(svd_A, Eigen::ComputeThinV).matrixV().rightCols<1>();
-        double svd_method = svd_V[2] / svd_V[3];
-        //it_per_id->estimated_depth = -b / A;
-        //it_per_id->estimated_depth = svd_V[2] / svd_V[3];
+    it_per_id.setDepth(svd_method);
+    //it_per_id->estimated_depth = INIT_DEPTH;
 
-        it_per_id.estimated_depth = svd_method;
-        //it_per_id->estimated_depth = INIT_DEPTH;
+    if (it_per_id.depth() < 0.1)
+    {
+        it_per_id.setDepth(params.INIT_DEPTH);
+    }
+}
 
-        if (it_per_id.estimated_depth < 0.1)
-        {
-            it_per_id.estimated_depth = INIT_DEPTH;
-        }
+FeaturePerId &FeatureManager::restoreFeature(FeatureId feature_id, int start_frame, int camera)
+{
+    return *addFeature(feature_id, start_frame, camera);
+}
 
-    }
+const FeaturePerId *FeatureManager::getFeature(FeatureId feature_id) const
+{
+    auto found = feature_index.find(feature_id);
+    return found == feature_index.end() ? NULL : &*found->second;
 }
 
-void FeatureManager::removeOutlier(set<int> &outlierIndex)
+void FeatureManager::removeOutlier(set<FeatureId> &outlierIndex)
 {
-    std::set<int>::iterator itSet;
-    for (auto it = feature.begin(), it_next = feature.begin();
-         it != feature.end(); it = it_next)
+    for (FeatureId index : outlierIndex)
     {
-        it_next++;
-        int index = it->feature_id;
-        itSet = outlierIndex.find(index);
-        if(itSet != outlierIndex.end())
+        auto found = feature_index.find(index);
+        if (found != feature_index.end())
         {
-            feature.erase(it);
+            removeFeature(found->second);
             //printf("remove outlier %d \n", index);
         }
     }
 }
 
-void FeatureManager::removeBackShiftDepth(Eigen::Matrix3d marg_R, Eigen::Vector3d marg_P, Eigen::Matrix3d new_R, Eigen::Vector3d new_P)
+void FeatureManager::removeBackShiftDepth(const Eigen::Matrix3d &marg_R, const Eigen::Vector3d &marg_P,
+                                          const Eigen::Matrix3d &new_R, const Eigen::Vector3d &new_P,
+                                          Vector3d tic[], Matrix3d ric[])
 {
     for (auto it = feature.begin(), it_next = feature.begin();
          it != feature.end(); it = it_next)
@@ -459,29 +549,30 @@ void FeatureManager::removeBackShiftDepth(Eigen::Matrix3d marg_R, Eigen::Vector3
         else
         {
             Eigen::Vector3d uv_i = it->feature_per_frame[0].point;  
-            it->feature_per_frame.erase(it->feature_per_frame.begin());
+            it->feature_per_frame.pop_front();
             if (it->feature_per_frame.size() < 2)
             {
-                feature.erase(it);
+                removeFeature(it);
                 continue;
             }
             else
             {
-                Eigen::Vector3d pts_i = uv_i * it->estimated_depth;
-                Eigen::Vector3d w_pts_i = marg_R * pts_i + marg_P;
-                Eigen::Vector3d pts_j = new_R.transpose() * (w_pts_i - new_P);
+                const int c = it->camera;
+                Eigen::Vector3d pts_i = uv_i * it->depth();
+                Eigen::Vector3d w_pts_i = marg_R * (ric[c] * pts_i + tic[c]) + marg_P;
+                Eigen::Vector3d pts_j = ric[c].transpose() * (new_R.transpose() * (w_pts_i - new_P) - tic[c]);
                 double dep_j = pts_j(2);
                 if (dep_j > 0)
-                    it->estimated_depth = dep_j;
+                    it->setDepth(dep_j);
                 else
-                    it->estimated_depth = INIT_DEPTH;
+                    it->setDepth(params.INIT_DEPTH);
             }
         }
         // remove tracking-lost feature after marginalize
         /*
-        if (it->endFrame() < WINDOW_SIZE - 1)
+        if (it->endFrame() < params.WINDOW_SIZE - 1)
         {
-            feature.erase(it);
+            removeFeature(it);
         }
         */
     }
@@ -498,9 +589,9 @@ void FeatureManager::removeBack()
             it->start_frame--;
         else
         {
-            it->feature_per_frame.erase(it->feature_per_frame.begin());
+            it->feature_per_frame.pop_front();
             if (it->feature_per_frame.size() == 0)
-                feature.erase(it);
+                removeFeature(it);
         }
     }
 }
@@ -517,12 +608,12 @@ void FeatureManager::removeFront(int frame_count)
         }
         else
         {
-            int j = WINDOW_SIZE - 1 - it->start_frame;
+            int j = params.WINDOW_SIZE - 1 - it->start_frame;
             if (it->endFrame() < frame_count - 1)
                 continue;
-            it->feature_per_frame.erase(it->feature_per_frame.begin() + j);
+            it->feature_per_frame.erase(j);
             if (it->feature_per_frame.size() == 0)
-                feature.erase(it);
+                removeFeature(it);
         }
     }
 }
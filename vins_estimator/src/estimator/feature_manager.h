@@ -11,6 +11,7 @@
 #define FEATURE_MANAGER_H
 
 #include <list>
+#include <unordered_map>
 #include <algorithm>
 #include <vector>
 #include <numeric>
@@ -23,11 +24,16 @@ using namespace Eigen;
 #include <ros/assert.h>
 
 #include "parameters.h"
+#include "feature_frame.h"
+#include "observation_ring.h"
+#include "window_ring.h"
 #include "../utility/tic_toc.h"
+#include "../utility/thread_pool.h"
 
 class FeaturePerFrame
 {
   public:
+    FeaturePerFrame() {}
     FeaturePerFrame(const Eigen::Matrix<double, 7, 1> &_point, double td)
     {
         point.x() = _point(0);
@@ -38,6 +44,7 @@ class FeaturePerFrame
         velocity.x() = _point(5); 
         velocity.y() = _point(6); 
         cur_td = td;
+        obs_td = td;
         is_stereo = false;
     }
     void rightObservation(const Eigen::Matrix<double, 7, 1> &_point)
@@ -49,9 +56,19 @@ class FeaturePerFrame
         uvRight.y() = _point(4);
         velocityRight.x() = _point(5); 
         velocityRight.y() = _point(6); 
+        obs_tdRight = cur_td;
         is_stereo = true;
     }
+    // a rolling shutter camera reads row v of rows at tr * (v - rows / 2) / rows after the middle
+    // row, the time stamp; the projection factors take the observations at that time
+    void rollingShutter(double tr, int rows)
+    {
+        obs_td = cur_td - tr * (uv.y() - rows / 2.0) / rows;
+        if (is_stereo)
+            obs_tdRight = cur_td - tr * (uvRight.y() - rows / 2.0) / rows;
+    }
     double cur_td;
+    double obs_td, obs_tdRight;  // cur_td less the row delay, see rollingShutter
     Vector3d point, pointRight;
     Vector2d uv, uvRight;
     Vector2d velocity, velocityRight;
@@ -61,57 +78,109 @@ class FeaturePerFrame
 class FeaturePerId
 {
   public:
-    const int feature_id;
+    FeatureId feature_id;
     int start_frame;
-    vector<FeaturePerFrame> feature_per_frame;
+    int camera;  // of the observations, 0 also has the camera 1 ones when stereo
+    ObservationRing<FeaturePerFrame, MAX_WINDOW_SIZE + 1> feature_per_frame;
     int used_num;
-    double estimated_depth;
-    int solve_flag; // 0 haven't solve yet; 1 solve succ; 2 solve fail;
+    // the inverse depth, ceres and WindowSolver optimize it in place: the record stays at the same
+    // address while the feature is tracked
+    double inv_depth[SIZE_FEATURE];
+    bool selected;  // added to the optimization, see FeatureManager::selectFeatures
+
+    FeaturePerId(FeatureId _feature_id, int _start_frame, int _camera)
+        : feature_id(_feature_id), start_frame(_start_frame), camera(_camera),
+          used_num(0), selected(true)
+    {
+        setDepth(-1.0);
+    }
 
-    FeaturePerId(int _feature_id, int _start_frame)
-        : feature_id(_feature_id), start_frame(_start_frame),
-          used_num(0), estimated_depth(-1.0), solve_flag(0)
+    // a record taken from the spare ones of FeatureManager starts over as a new feature
+    void reset(FeatureId _feature_id, int _start_frame, int _camera)
     {
+        feature_id = _feature_id;
+        start_frame = _start_frame;
+        camera = _camera;
+        feature_per_frame.clear();
+        used_num = 0;
+        setDepth(-1.0);
+        selected = true;
     }
 
+    // negative while not triangulated
+    double depth() const { return 1.0 / inv_depth[0]; }
+    void setDepth(double depth) { inv_depth[0] = 1.0 / depth; }
+    // 0 haven't solve yet; 1 solve succ; 2 solve fail;
+    int solveFlag() const { return used_num < 4 ? 0 : (inv_depth[0] < 0 ? 2 : 1); }
+
     int endFrame();
 };
 
 class FeatureManager
 {
   public:
-    FeatureManager(Matrix3d _Rs[]);
+    // _params is kept by reference, it belongs to the estimator
+    FeatureManager(const WindowRing<Matrix3d> &_Rs, const Parameters &_params);
 
     void setRic(Matrix3d _ric[]);
+    // triangulate runs on the pool, serially without one
+    void setThreadPool(ThreadPool *_pool);
+    // preallocates the records and the index for num_features tracked features, more still grow them
+    void reserve(int num_features);
     void clearState();
+    // heap bytes of the records, spare ones included, and of the index
+    size_t memoryBytes() const;
     int getFeatureCount();
-    bool addFeatureCheckParallax(int frame_count, const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image, double td);
+    // marks at most max_count (-1 all) of the features with 4+ observations as selected, returns their count
+    int selectFeatures(int max_count);
+    // the keyframe decision only looks at the camera 0 features
+    bool addFeatureCheckParallax(int frame_count, const FeatureFrame &image, double td);
+    // camera 0 features only, as initFramePoseByPnP
     vector<pair<Vector3d, Vector3d>> getCorresponding(int frame_count_l, int frame_count_r);
     //void updateDepth(const VectorXd &x);
-    void setDepth(const VectorXd &x);
     void removeFailures();
     void clearDepth();
-    VectorXd getDepthVector();
-    void triangulate(int frameCnt, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[]);
+    void triangulate(int frameCnt, const WindowRing<Vector3d> &Ps, const WindowRing<Matrix3d> &Rs, Vector3d tic[], Matrix3d ric[]);
     void triangulatePoint(Eigen::Matrix<double, 3, 4> &Pose0, Eigen::Matrix<double, 3, 4> &Pose1,
                             Eigen::Vector2d &point0, Eigen::Vector2d &point1, Eigen::Vector3d &point_3d);
-    void initFramePoseByPnP(int frameCnt, Vector3d Ps[], Matrix3d Rs[], Vector3d tic[], Matrix3d ric[]);
+    void initFramePoseByPnP(int frameCnt, WindowRing<Vector3d> &Ps, WindowRing<Matrix3d> &Rs, Vector3d tic[], Matrix3d ric[]);
     bool solvePoseByPnP(Eigen::Matrix3d &R_initial, Eigen::Vector3d &P_initial, 
                             vector<cv::Point2f> &pts2D, vector<cv::Point3f> &pts3D);
-    void removeBackShiftDepth(Eigen::Matrix3d marg_R, Eigen::Vector3d marg_P, Eigen::Matrix3d new_R, Eigen::Vector3d new_P);
+    // marg_R, marg_P, new_R, new_P: imu poses of the marginalized frame and of the new frame 0
+    void removeBackShiftDepth(const Eigen::Matrix3d &marg_R, const Eigen::Vector3d &marg_P,
+                              const Eigen::Matrix3d &new_R, const Eigen::Vector3d &new_P,
+                              Vector3d tic[], Matrix3d ric[]);
     void removeBack();
     void removeFront(int frame_count);
-    void removeOutlier(set<int> &outlierIndex);
+    void removeOutlier(set<FeatureId> &outlierIndex);
+    // NULL when the feature is not tracked
+    const FeaturePerId *getFeature(FeatureId feature_id) const;
+    // checkpoint restore: a new feature without observations, the caller fills it in
+    FeaturePerId &restoreFeature(FeatureId feature_id, int start_frame, int camera);
     list<FeaturePerId> feature;
     int last_track_num;
     double last_average_parallax;
     int new_feature_num;
     int long_track_num;
+    // ground truth points of a simulated feature topic, for debug output only
+    map<FeatureId, Eigen::Vector3d> pts_gt;
 
   private:
+    const Parameters &params;
+    list<FeaturePerId>::iterator addFeature(FeatureId feature_id, int start_frame, int camera);
+    void removeFeature(list<FeaturePerId>::iterator it);
+    void triangulateFeature(FeaturePerId &it_per_id, const WindowRing<Vector3d> &Ps, const WindowRing<Matrix3d> &Rs,
+                            Vector3d tic[], Matrix3d ric[]);
     double compensatedParallax2(const FeaturePerId &it_per_id, int frame_count);
-    const Matrix3d *Rs;
-    Matrix3d ric[2];
+    // feature id to its record in feature
+    unordered_map<FeatureId, list<FeaturePerId>::iterator> feature_index;
+    // records of removed features, spliced back into feature for new ones instead of allocating
+    list<FeaturePerId> spare;
+    ThreadPool *pool;
+    // features without a depth yet, kept for the storage
+    vector<FeaturePerId *> pending;
+    const WindowRing<Matrix3d> &Rs;
+    Matrix3d ric[MAX_NUM_OF_CAM];
 };
 
 #endif
\ No newline at end of file
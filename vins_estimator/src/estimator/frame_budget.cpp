@@ -0,0 +1,107 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <algorithm>
+#include "frame_budget.h"
+
+// never fewer features than this, the window would not be constrained any more
+static const int MIN_FEATURES = 30;
+
+FrameBudget::FrameBudget()
+    : budget(0), degraded(0), previous_degraded(0), feature_cap(-1), features(0), frame_time(0)
+{
+    for (int i = 0; i < NUM_STAGES; i++)
+    {
+        cost[i] = 0;
+        measured[i] = false;
+    }
+}
+
+void FrameBudget::begin(double budget_ms)
+{
+    if (budget_ms <= 0)
+        feature_cap = -1;
+    budget = budget_ms;
+    previous_degraded = degraded;
+    degraded = 0;
+    t_frame.tic();
+}
+
+void FrameBudget::record(Stage stage, double ms)
+{
+    // follows a rising cost at once and a falling one slowly, it bounds the worst case
+    if (!measured[stage])
+        cost[stage] = ms;
+    else if (ms > cost[stage])
+        cost[stage] = 0.5 * cost[stage] + 0.5 * ms;
+    else
+        cost[stage] = 0.95 * cost[stage] + 0.05 * ms;
+    measured[stage] = true;
+}
+
+double FrameBudget::solverTime(double max_time, bool marginalize)
+{
+    if (!enabled())
+        return max_time;
+    double reserve = expected(OUTLIER) + expected(PUBLISH);
+    if (marginalize)
+        reserve += expected(MARGINALIZE);
+    double left = (budget - elapsed() - reserve) / 1000.0;
+    if (left >= max_time)
+        return max_time;
+    degraded |= SOLVER_TIME_CUT;
+    return std::max(left, 0.1 * max_time);
+}
+
+void FrameBudget::featuresUsed(int available, bool cut)
+{
+    features = available;
+    if (cut)
+        degraded |= FEATURES_CUT;
+}
+
+bool FrameBudget::allowOutlierRejection()
+{
+    if (!enabled() || elapsed() + expected(OUTLIER) + expected(PUBLISH) <= budget)
+        return true;
+    degraded |= OUTLIERS_SKIPPED;
+    return false;
+}
+
+int FrameBudget::end()
+{
+    frame_time = elapsed();
+    if (!enabled() || features == 0)
+        return degraded;
+    int cap = feature_cap < 0 ? features : feature_cap;
+    if (frame_time > budget)
+        feature_cap = std::max(MIN_FEATURES, static_cast<int>(cap * 0.8));
+    else if (feature_cap >= 0 && frame_time < 0.7 * budget)
+    {
+        feature_cap = static_cast<int>(feature_cap * 1.1) + 1;
+        if (feature_cap >= features)
+            feature_cap = -1;
+    }
+    return degraded;
+}
+
+std::string FrameBudget::describe(int degraded)
+{
+    std::string s;
+    if (degraded & SOLVER_TIME_CUT)
+        s += "solver time ";
+    if (degraded & FEATURES_CUT)
+        s += "features ";
+    if (degraded & OUTLIERS_SKIPPED)
+        s += "outlier rejection ";
+    if (s.empty())
+        return "none";
+    s.pop_back();
+    return s;
+}
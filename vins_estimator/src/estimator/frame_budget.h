@@ -0,0 +1,73 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <string>
+
+#include "../utility/tic_toc.h"
+
+// Latency budget (frame_budget, ms) of one image from processImage to the last publisher.
+// The cost of each stage is kept as a running average, the stages ask before they run and are cut
+// in this order: solver time, number of features added as residuals, outlier rejection.
+// A budget of 0 leaves everything as configured.
+class FrameBudget
+{
+  public:
+    enum Stage
+    {
+        TRIANGULATE,
+        OPTIMIZE,
+        MARGINALIZE,
+        OUTLIER,
+        PUBLISH,
+        NUM_STAGES
+    };
+    // bits of the degradation mask returned by end()
+    enum Degradation
+    {
+        SOLVER_TIME_CUT = 1,
+        FEATURES_CUT = 2,
+        OUTLIERS_SKIPPED = 4
+    };
+
+    FrameBudget();
+
+    void begin(double budget_ms);
+    bool enabled() const { return budget > 0; }
+    double elapsed() { return t_frame.toc(); }
+    void record(Stage stage, double ms);
+
+    // solver time (s) left once the later stages of the frame are provided for, at most max_time
+    double solverTime(double max_time, bool marginalize);
+    // most features to add to the problem, -1 for all of them
+    int featureCap() const { return feature_cap; }
+    // features with enough observations for the problem, cut: some were left out for the budget
+    void featuresUsed(int available, bool cut);
+    bool allowOutlierRejection();
+
+    // adapts the feature cap to the frame time and returns the degradation mask of the frame
+    int end();
+    double frameTime() const { return frame_time; }
+    // the mask of the last frame differs from the one before
+    bool degradationChanged() const { return degraded != previous_degraded; }
+    static std::string describe(int degraded);
+
+  private:
+    double expected(Stage stage) const { return cost[stage]; }
+
+    double budget;
+    TicToc t_frame;
+    double cost[NUM_STAGES];
+    bool measured[NUM_STAGES];
+    int degraded, previous_degraded;
+    int feature_cap;
+    int features;
+    double frame_time;
+};
@@ -0,0 +1,166 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <eigen3/Eigen/Dense>
+
+struct ImuSample
+{
+    double t;
+    Eigen::Vector3d acc, gyr;
+};
+
+class ImuBuffer;
+
+// The samples of ImuBuffer between two times, read in place: samples first and later up to the
+// first one at or after t1, which is interpolated to t1. A sample overwritten since counts as
+// missing, get() fails for it.
+class ImuSpan
+{
+  public:
+    ImuSpan() : buf(nullptr), first(0), count(0), t1(0) {}
+    ImuSpan(const ImuBuffer *_buf, uint64_t _first, uint64_t _count, double _t1)
+        : buf(_buf), first(_first), count(_count), t1(_t1) {}
+
+    size_t size() const { return count; }
+    inline bool get(size_t k, ImuSample &sample) const;
+
+  private:
+    const ImuBuffer *buf;
+    uint64_t first, count;
+    double t1;
+};
+
+// Fixed-capacity ring of the most recent IMU samples, written by a single thread (the IMU callback)
+// and read by any number of threads without a lock. The writer never waits; once the ring is full it
+// overwrites the oldest sample. Every slot carries a sequence number so a reader can tell that
+// a sample changed under it, such a sample counts as already gone.
+// Samples are addressed by a monotonic index, valid ones lie in [begin(), end()) and are sorted
+// by time, which the lookups rely on.
+class ImuBuffer
+{
+  public:
+    // capacity is rounded up to a power of two
+    explicit ImuBuffer(size_t capacity = 1 << 14) : tail(0)
+    {
+        size_t n = 1;
+        while (n < capacity)
+            n <<= 1;
+        slots = std::vector<Slot>(n);
+        mask = n - 1;
+    }
+
+    // writer only
+    void push(double t, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr)
+    {
+        uint64_t i = tail.load(std::memory_order_relaxed);
+        Slot &slot = slots[i & mask];
+        slot.seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.sample.t = t;
+        slot.sample.acc = acc;
+        slot.sample.gyr = gyr;
+        slot.seq.store(i + 1, std::memory_order_release);
+        tail.store(i + 1);
+    }
+
+    // one past the newest sample
+    uint64_t end() const
+    {
+        return tail.load();
+    }
+
+    // oldest sample not yet overwritten, one slot is left as margin for the write in progress
+    uint64_t begin() const
+    {
+        uint64_t e = end();
+        return e > mask ? e - mask : 0;
+    }
+
+    // false if sample i was never written or has been overwritten
+    bool get(uint64_t i, ImuSample &sample) const
+    {
+        const Slot &slot = slots[i & mask];
+        uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != i + 1)
+            return false;
+        sample = slot.sample;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot.seq.load(std::memory_order_relaxed) == seq;
+    }
+
+    bool latestTime(double &t) const
+    {
+        ImuSample sample;
+        uint64_t e = end();
+        if (e == 0 || !get(e - 1, sample))
+            return false;
+        t = sample.t;
+        return true;
+    }
+
+    // first index with a sample at or after t (strictly after if strict), end() if there is none
+    uint64_t lowerBound(double t, bool strict = false) const
+    {
+        uint64_t lo = begin(), hi = end();
+        ImuSample sample;
+        while (lo < hi)
+        {
+            uint64_t mid = lo + (hi - lo) / 2;
+            // an overwritten sample is older than anything still in the ring
+            if (!get(mid, sample) || sample.t < t || (strict && sample.t == t))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    // samples after t0 up to t1, empty if the buffer does not reach t1 yet
+    ImuSpan interval(double t0, double t1) const
+    {
+        uint64_t first = lowerBound(t0, true);
+        uint64_t last = lowerBound(t1);
+        if (last == end() || last < first)
+            return ImuSpan();
+        return ImuSpan(this, first, last - first + 1, t1);
+    }
+
+  private:
+    struct Slot
+    {
+        Slot() : seq(0) {}
+        std::atomic<uint64_t> seq;
+        ImuSample sample;
+    };
+
+    std::vector<Slot> slots;
+    uint64_t mask;
+    std::atomic<uint64_t> tail;
+};
+
+bool ImuSpan::get(size_t k, ImuSample &sample) const
+{
+    uint64_t i = first + k;
+    if (!buf->get(i, sample))
+        return false;
+    ImuSample prev;
+    if (k + 1 == count && sample.t > t1 && i > 0 && buf->get(i - 1, prev) && prev.t < t1)
+    {
+        double w = (t1 - prev.t) / (sample.t - prev.t);
+        sample.acc = prev.acc + w * (sample.acc - prev.acc);
+        sample.gyr = prev.gyr + w * (sample.gyr - prev.gyr);
+        sample.t = t1;
+    }
+    return true;
+}
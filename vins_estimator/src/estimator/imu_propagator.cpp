@@ -0,0 +1,57 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "imu_propagator.h"
+#include "../utility/utility.h"
+
+void ImuPropagator::reset(const PropagationState &start)
+{
+    start_buf.write(start);
+}
+
+bool ImuPropagator::propagate(const ImuBuffer &imu_buf, double t, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr)
+{
+    if (start_buf.read(cur) && cur.valid)
+    {
+        if (history)
+            history->push(cur.t, cur.P, cur.Q, cur.V);
+        // catch up from the optimized frame, this includes the sample at t
+        ImuSample sample;
+        for (uint64_t i = imu_buf.lowerBound(cur.t); i < imu_buf.end(); i++)
+            if (imu_buf.get(i, sample) && sample.t <= t)
+                integrate(sample.t, sample.acc, sample.gyr);
+        return cur.t >= t;
+    }
+    if (!cur.valid)
+    {
+        // a reset of the estimator, the world frame starts again
+        if (history)
+            history->clear();
+        return false;
+    }
+    integrate(t, acc, gyr);
+    return true;
+}
+
+void ImuPropagator::integrate(double t, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr)
+{
+    double dt = t - cur.t;
+    cur.t = t;
+    Eigen::Vector3d un_acc_0 = cur.Q * (cur.acc_0 - cur.Ba) - cur.g;
+    Eigen::Vector3d un_gyr = 0.5 * (cur.gyr_0 + gyr) - cur.Bg;
+    cur.Q = cur.Q * Utility::deltaQ(un_gyr * dt);
+    Eigen::Vector3d un_acc_1 = cur.Q * (acc - cur.Ba) - cur.g;
+    Eigen::Vector3d un_acc = 0.5 * (un_acc_0 + un_acc_1);
+    cur.P = cur.P + dt * cur.V + 0.5 * dt * dt * un_acc;
+    cur.V = cur.V + dt * un_acc;
+    cur.acc_0 = acc;
+    cur.gyr_0 = gyr;
+    if (history)
+        history->push(t, cur.P, cur.Q, cur.V);
+}
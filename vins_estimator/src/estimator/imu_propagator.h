@@ -0,0 +1,92 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/Geometry>
+
+#include "imu_buffer.h"
+#include "pose_history.h"
+#include "../utility/triple_buffer.h"
+
+struct PropagationState
+{
+    PropagationState() : valid(false), t(0) {}
+
+    bool valid;
+    double t;
+    Eigen::Vector3d P, V, Ba, Bg, acc_0, gyr_0, g;
+    Eigen::Quaterniond Q;
+};
+
+// IMU-rate dead reckoning from the newest optimized frame. The estimator thread hands over a new
+// start state after every optimization, the IMU thread picks it up on its next sample and
+// re-integrates the buffered IMU since then itself, so it never waits on the estimator.
+// With a history every state it integrates goes there too, the start states being the corrections.
+class ImuPropagator
+{
+  public:
+    ImuPropagator() : history(NULL) {}
+
+    // before the IMU thread runs, NULL for none
+    void setHistory(PoseHistory *_history) { history = _history; }
+
+    // estimator thread, an invalid state stops the output until the next valid one
+    void reset(const PropagationState &start);
+
+    // IMU thread, after the sample at t has been pushed into imu_buf.
+    // False while there is no valid start state.
+    bool propagate(const ImuBuffer &imu_buf, double t, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr);
+
+    // IMU thread only
+    const PropagationState &state() const { return cur; }
+
+  private:
+    void integrate(double t, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr);
+
+    TripleBuffer<PropagationState> start_buf;
+    PropagationState cur;
+    PoseHistory *history;
+};
+
+// stamp to output latency of the propagated odometry, reported once per period
+class LatencyStatistics
+{
+  public:
+    LatencyStatistics() : period_start(-1) { clear(); }
+
+    // latency and compute time in ms, true when a period of sensor time t is complete
+    bool add(double t, double latency, double compute, double period = 1.0)
+    {
+        if (period_start < 0)
+            period_start = t;
+        count++;
+        sum_latency += latency;
+        max_latency = std::max(max_latency, latency);
+        max_compute = std::max(max_compute, compute);
+        return t - period_start >= period;
+    }
+
+    double meanLatency() const { return count ? sum_latency / count : 0; }
+
+    void clear()
+    {
+        count = 0;
+        sum_latency = max_latency = max_compute = 0;
+        period_start = -1;
+    }
+
+    int count;
+    double sum_latency, max_latency, max_compute;
+
+  private:
+    double period_start;
+};
@@ -0,0 +1,64 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "motion_only_pose.h"
+#include "../utility/utility.h"
+
+int MotionOnlyPose::solve(const std::vector<MotionOnlyObservation> &observations, const Eigen::Vector3d tic[],
+                          const Eigen::Matrix3d ric[], const Eigen::Matrix<double, 6, 6> &prior_info, Eigen::Matrix3d &R,
+                          Eigen::Vector3d &P) const
+{
+    const Eigen::Matrix3d R_prior = R;
+    const Eigen::Vector3d P_prior = P;
+    int inliers = 0;
+    for (int iter = 0; iter < iterations; iter++)
+    {
+        // H dx = b, b the negative gradient
+        Eigen::Quaterniond q_prior(R_prior.transpose() * R);
+        if (q_prior.w() < 0)
+            q_prior.coeffs() *= -1;
+        Eigen::Matrix<double, 6, 1> r_prior;
+        r_prior << P - P_prior, 2.0 * q_prior.vec();
+        Eigen::Matrix<double, 6, 6> H = prior_info;
+        Eigen::Matrix<double, 6, 1> b = -prior_info * r_prior;
+
+        inliers = 0;
+        for (const MotionOnlyObservation &obs : observations)
+        {
+            const Eigen::Matrix3d &r_ic = ric[obs.camera];
+            Eigen::Vector3d pts_b = R.transpose() * (obs.pts_w - P);
+            Eigen::Vector3d pts_c = r_ic.transpose() * (pts_b - tic[obs.camera]);
+            if (pts_c.z() < 0.1)
+                continue;
+            double inv_z = 1.0 / pts_c.z();
+            Eigen::Vector2d e = sqrt_info * (pts_c.head<2>() * inv_z - obs.uv);
+            Eigen::Matrix<double, 2, 3> reduce;
+            reduce << inv_z, 0, -pts_c.x() * inv_z * inv_z,
+                      0, inv_z, -pts_c.y() * inv_z * inv_z;
+            reduce = sqrt_info * reduce * r_ic.transpose();
+            Eigen::Matrix<double, 2, 6> J;
+            J.leftCols<3>() = -reduce * R.transpose();
+            J.rightCols<3>() = reduce * Utility::skewSymmetric(pts_b);
+
+            double norm = e.norm();
+            double w = norm <= 1.0 ? 1.0 : 1.0 / norm;
+            if (norm <= 1.0)
+                inliers++;
+            H.noalias() += w * J.transpose() * J;
+            b.noalias() -= w * J.transpose() * e;
+        }
+
+        Eigen::Matrix<double, 6, 1> dx = H.ldlt().solve(b);
+        P += dx.head<3>();
+        R = (Eigen::Quaterniond(R) * Utility::deltaQ(dx.tail<3>())).normalized().toRotationMatrix();
+        if (dx.norm() < 1e-6)
+            break;
+    }
+    return inliers;
+}
@@ -0,0 +1,39 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <eigen3/Eigen/Dense>
+
+// a solved landmark of the window seen by camera `camera` of the new frame, normalized plane point
+struct MotionOnlyObservation
+{
+    Eigen::Vector3d pts_w;
+    Eigen::Vector2d uv;
+    int camera;
+};
+
+// Gauss-Newton of the body pose of one frame against landmarks held fixed, a 6x6 system per
+// iteration. The imu prediction is the start and a prior with information prior_info on
+// [position, rotation], the rotation perturbed on the right as in the factors. Reprojection errors
+// are scaled by sqrt_info and Huber weighted at 1 as in the window optimization.
+class MotionOnlyPose
+{
+  public:
+    MotionOnlyPose() : sqrt_info(1.0), iterations(5) {}
+
+    // R, P: the prediction in, the estimate out; returns the landmarks within the Huber threshold
+    int solve(const std::vector<MotionOnlyObservation> &observations, const Eigen::Vector3d tic[],
+              const Eigen::Matrix3d ric[], const Eigen::Matrix<double, 6, 6> &prior_info, Eigen::Matrix3d &R,
+              Eigen::Vector3d &P) const;
+
+    double sqrt_info;
+    int iterations;
+};
@@ -0,0 +1,102 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <ros/assert.h>
+
+// Observations of one feature, at most one per window frame, stored inline in a ring of N slots.
+// Same interface as the vector it replaces for the reads, dropping the oldest observation
+// (marginalizing the first frame) only moves the head.
+template <typename T, int N>
+class ObservationRing
+{
+  public:
+    template <typename Ring, typename V>
+    class Iterator
+    {
+      public:
+        Iterator(Ring *_ring, int _i) : ring(_ring), i(_i) {}
+        V &operator*() const { return (*ring)[i]; }
+        V *operator->() const { return &(*ring)[i]; }
+        Iterator &operator++()
+        {
+            i++;
+            return *this;
+        }
+        bool operator==(const Iterator &other) const { return i == other.i; }
+        bool operator!=(const Iterator &other) const { return i != other.i; }
+
+      private:
+        Ring *ring;
+        int i;
+    };
+    typedef Iterator<ObservationRing, T> iterator;
+    typedef Iterator<const ObservationRing, const T> const_iterator;
+
+    ObservationRing() : head(0), count(0) {}
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    void clear()
+    {
+        head = 0;
+        count = 0;
+    }
+
+    T &operator[](size_t i) { return items[slot(i)]; }
+    const T &operator[](size_t i) const { return items[slot(i)]; }
+    T &front() { return items[head]; }
+    const T &front() const { return items[head]; }
+    T &back() { return items[slot(count - 1)]; }
+    const T &back() const { return items[slot(count - 1)]; }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, count); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, count); }
+
+    void push_back(const T &item)
+    {
+        ROS_ASSERT(count < N);
+        items[slot(count)] = item;
+        count++;
+    }
+
+    void pop_front()
+    {
+        head = slot(1);
+        count--;
+    }
+
+    // drops observation i, the later ones move down by one
+    void erase(size_t i)
+    {
+        if (i == 0)
+        {
+            pop_front();
+            return;
+        }
+        for (size_t k = i; k + 1 < size(); k++)
+            items[slot(k)] = items[slot(k + 1)];
+        count--;
+    }
+
+  private:
+    int slot(size_t i) const
+    {
+        int k = head + static_cast<int>(i);
+        return k >= N ? k - N : k;
+    }
+
+    T items[N];
+    int head;
+    int count;
+};
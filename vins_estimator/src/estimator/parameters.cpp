@@ -9,51 +9,23 @@
 
 #include "parameters.h"
 
-double INIT_DEPTH;
-double MIN_PARALLAX;
-double ACC_N, ACC_W;
-double GYR_N, GYR_W;
-
-std::vector<Eigen::Matrix3d> RIC;
-std::vector<Eigen::Vector3d> TIC;
-
-Eigen::Vector3d G{0.0, 0.0, 9.8};
-
-double BIAS_ACC_THRESHOLD;
-double BIAS_GYR_THRESHOLD;
-double SOLVER_TIME;
-int NUM_ITERATIONS;
-int ESTIMATE_EXTRINSIC;
-int ESTIMATE_TD;
-int ROLLING_SHUTTER;
-std::string EX_CALIB_RESULT_PATH;
-std::string VINS_RESULT_PATH;
-std::string OUTPUT_FOLDER;
-std::string IMU_TOPIC;
-int ROW, COL;
-double TD;
-int NUM_OF_CAM;
-int STEREO;
-int USE_IMU;
-int MULTIPLE_THREAD;
-int USE_GPU;
-int USE_GPU_ACC_FLOW;
-int USE_VPI;
-int VPI_BACKEND;
-int PYRAMID_LEVEL;
-int PUB_RECTIFY;
-Eigen::Matrix3d rectify_R_left;
-Eigen::Matrix3d rectify_R_right;
-map<int, Eigen::Vector3d> pts_gt;
-std::string IMAGE0_TOPIC, IMAGE1_TOPIC;
-std::string FISHEYE_MASK;
-std::vector<std::string> CAM_NAMES;
-int MAX_CNT;
-int MIN_DIST;
-double F_THRESHOLD;
-int SHOW_TRACK;
-int FLOW_BACK;
-
+Parameters::Parameters()
+    : INIT_DEPTH(5.0), MIN_PARALLAX(0), ESTIMATE_EXTRINSIC(0), ACC_N(0), ACC_W(0), GYR_N(0), GYR_W(0),
+      G(0.0, 0.0, 9.8), BIAS_ACC_THRESHOLD(0.1), BIAS_GYR_THRESHOLD(0.1), SOLVER_TIME(0), NUM_ITERATIONS(0),
+      POSE_HISTORY(0), BATCH_LOG(0), TD(0), ESTIMATE_TD(0), ROLLING_SHUTTER(0), TR(0), ROW(0), COL(0), WINDOW_SIZE(10), NUM_OF_F(1000), NUM_OF_CAM(0), STEREO(0), USE_IMU(0),
+      MULTIPLE_THREAD(0), USE_GPU(0), USE_GPU_ACC_FLOW(0), USE_VPI(0), VPI_BACKEND(0), VPI_CONVERT_BACKEND(-1),
+      VPI_PYRAMID_BACKEND(-1), VPI_HARRIS_BACKEND(-1), VPI_LK_BACKEND(-1), PYRAMID_LEVEL(0), ADAPTIVE_BACKEND(0),
+      PUB_RECTIFY(0), rectify_R_left(Eigen::Matrix3d::Identity()), rectify_R_right(Eigen::Matrix3d::Identity()),
+      PUB_RECTIFY_IMAGE(0), RECTIFY_MAP_CACHE(0), IMAGE_COMPRESSED(0), IMAGE_SYNC_TOLERANCE(0),
+      MAX_CNT(0), MIN_DIST(0), F_THRESHOLD(0), SHOW_TRACK(0), SHOW_TRACK_RATE(0), FLOW_BACK(0), ASYNC_STEREO(0), LIGHT_TRACKING(0), DETECT_GRID_ROWS(0),
+      DETECT_GRID_COLS(0), ADAPTIVE_FEATURES(0), ADAPTIVE_FEATURES_MIN(0), ADAPTIVE_FEATURES_LATENCY(0), DETECTOR_TYPE(0), FAST_THRESHOLD(20), EQUALIZE(0), UNDISTORT_LUT_STEP(0), UNDISTORT_LUT_CACHE(0),
+      REJECT_WITH_F(0), GYRO_PREDICTION(0), PREDICTION_LK_LEVELS(1), PREDICTION_LK_ITERATIONS(30), PIPELINE_QUEUE_SIZE(0), PIPELINE_DROP(0), IMU_LATENCY_BUDGET(0), FRAME_BUDGET(0), TRACE_EVENTS(0),
+      SOLVER_THREADS(0), EXPLICIT_SCHUR(0), NONMONOTONIC_STEPS(0), SOLVER_AUTOTUNE(0), BATCH_PROJECTION(0),
+      UNIT_SPHERE_ERROR(0), WINDOW_SOLVER(0), GPU_PROJECTION(0), FAST_POSE(0), KEYFRAME_OPTIMIZATION(0), PERSISTENT_PROBLEM(0), MAX_SOLVER_FEATURES(0), MARGINALIZATION_FLOAT(0), BIAS_CORRECTION(0),
+      WARM_REINIT(0), CHECKPOINT_PERIOD(0), CHECKPOINT_RESTORE(0), CHECKPOINT_MAX_GAP(1.0), INIT_CANDIDATES(0), PUBLISH_POSE_RATE(0), PUBLISH_CLOUD_RATE(0), LANDMARK_MAP_VOXEL(0),
+      LANDMARK_MAP_MAX_VOXELS(100000), PATH_MAX_POSES(0), PUB_KEYFRAME_IMAGE(0), TRAJECTORY_FORMAT(0)
+{
+}
 
 template <typename T>
 T readParam(ros::NodeHandle &n, std::string name)
@@ -71,7 +43,18 @@ T readParam(ros::NodeHandle &n, std::string name)
     return ans;
 }
 
-void readParameters(std::string config_file)
+static void readThreadPlacement(cv::FileStorage &fsSettings, const std::string &name, ThreadPlacement &placement)
+{
+    std::string cpus;
+    if (!fsSettings["thread_" + name + "_cpus"].empty())
+        fsSettings["thread_" + name + "_cpus"] >> cpus;
+    if (!parseCpuList(cpus, placement.cpus))
+        ROS_WARN("thread_%s_cpus \"%s\" is not a cpu list like 2,3 or 4-7, not pinned", name.c_str(), cpus.c_str());
+    if (!fsSettings["thread_" + name + "_priority"].empty())
+        placement.priority = fsSettings["thread_" + name + "_priority"];
+}
+
+void readParameters(const std::string &config_file, Parameters &params)
 {
     FILE *fh = fopen(config_file.c_str(),"r");
     if(fh == NULL){
@@ -80,6 +63,8 @@ void readParameters(std::string config_file)
         return;          
     }
     fclose(fh);
+    // RIC, TIC and CAM_NAMES are appended to
+    params = Parameters();
 
     cv::FileStorage fsSettings(config_file, cv::FileStorage::READ);
     if(!fsSettings.isOpened())
@@ -87,79 +72,177 @@ void readParameters(std::string config_file)
         std::cerr << "ERROR: Wrong path to settings" << std::endl;
     }
 
-    fsSettings["image0_topic"] >> IMAGE0_TOPIC;
-    fsSettings["image1_topic"] >> IMAGE1_TOPIC;
-    MAX_CNT = fsSettings["max_cnt"];
-    MIN_DIST = fsSettings["min_dist"];
-    F_THRESHOLD = fsSettings["F_threshold"];
-    SHOW_TRACK = fsSettings["show_track"];
-    FLOW_BACK = fsSettings["flow_back"];
+    fsSettings["image0_topic"] >> params.IMAGE0_TOPIC;
+    fsSettings["image1_topic"] >> params.IMAGE1_TOPIC;
+    params.IMAGE_COMPRESSED = fsSettings["image_compressed"];
+    if (!fsSettings["image_sync_tolerance"].empty())
+        params.IMAGE_SYNC_TOLERANCE = fsSettings["image_sync_tolerance"];
+    if (!fsSettings["capture_device0"].empty())
+        fsSettings["capture_device0"] >> params.CAPTURE_DEVICE0;
+    if (!fsSettings["capture_device1"].empty())
+        fsSettings["capture_device1"] >> params.CAPTURE_DEVICE1;
+    params.MAX_CNT = fsSettings["max_cnt"];
+    params.MIN_DIST = fsSettings["min_dist"];
+    params.F_THRESHOLD = fsSettings["F_threshold"];
+    params.SHOW_TRACK = fsSettings["show_track"];
+    params.SHOW_TRACK_RATE = fsSettings["show_track_rate"];
+    params.FLOW_BACK = fsSettings["flow_back"];
+    params.ASYNC_STEREO = fsSettings["async_stereo"];
+    params.LIGHT_TRACKING = fsSettings["light_tracking"];
+    params.DETECT_GRID_ROWS = fsSettings["detect_grid_rows"];
+    params.DETECT_GRID_COLS = fsSettings["detect_grid_cols"];
+    params.ADAPTIVE_FEATURES = fsSettings["adaptive_features"];
+    params.ADAPTIVE_FEATURES_MIN = fsSettings["adaptive_features_min"];
+    params.ADAPTIVE_FEATURES_LATENCY = fsSettings["adaptive_features_latency"];
+    params.DETECTOR_TYPE = fsSettings["detector_type"];
+    params.FAST_THRESHOLD = fsSettings["fast_threshold"];
+    if (params.FAST_THRESHOLD <= 0)
+        params.FAST_THRESHOLD = 20;
+    params.EQUALIZE = fsSettings["equalize"];
+    params.UNDISTORT_LUT_STEP = fsSettings["undistort_lut_step"];
+    params.UNDISTORT_LUT_CACHE = fsSettings["undistort_lut_cache"];
+    params.REJECT_WITH_F = fsSettings["reject_with_f"];
+    params.GYRO_PREDICTION = fsSettings["gyro_prediction"];
+    if (!fsSettings["prediction_lk_levels"].empty())
+        params.PREDICTION_LK_LEVELS = fsSettings["prediction_lk_levels"];
+    if (!fsSettings["prediction_lk_iterations"].empty())
+        params.PREDICTION_LK_ITERATIONS = fsSettings["prediction_lk_iterations"];
+    params.PREDICTION_LK_LEVELS = std::max(0, std::min(3, params.PREDICTION_LK_LEVELS));
+    params.PREDICTION_LK_ITERATIONS = std::max(1, params.PREDICTION_LK_ITERATIONS);
+    params.PIPELINE_QUEUE_SIZE = fsSettings["pipeline_queue_size"];
+    params.PIPELINE_DROP = fsSettings["pipeline_drop"];
+    params.IMU_LATENCY_BUDGET = fsSettings["imu_latency_budget"];
+    params.FRAME_BUDGET = fsSettings["frame_budget"];
+    params.TRACE_EVENTS = fsSettings["trace_events"];
 
-    MULTIPLE_THREAD = fsSettings["multiple_thread"];
+    params.MULTIPLE_THREAD = fsSettings["multiple_thread"];
 
-    USE_GPU = fsSettings["use_gpu"];
-    USE_GPU_ACC_FLOW = fsSettings["use_gpu_acc_flow"];
+    params.USE_GPU = fsSettings["use_gpu"];
+    params.USE_GPU_ACC_FLOW = fsSettings["use_gpu_acc_flow"];
 
-    USE_VPI = fsSettings["use_vpi"];
-    VPI_BACKEND = fsSettings["vpi_backend"];
-    PYRAMID_LEVEL = fsSettings["pyramid_level"];
+    params.USE_VPI = fsSettings["use_vpi"];
+    params.VPI_BACKEND = fsSettings["vpi_backend"];
+    if (!fsSettings["vpi_convert_backend"].empty())
+        params.VPI_CONVERT_BACKEND = fsSettings["vpi_convert_backend"];
+    if (!fsSettings["vpi_pyramid_backend"].empty())
+        params.VPI_PYRAMID_BACKEND = fsSettings["vpi_pyramid_backend"];
+    if (!fsSettings["vpi_harris_backend"].empty())
+        params.VPI_HARRIS_BACKEND = fsSettings["vpi_harris_backend"];
+    if (!fsSettings["vpi_lk_backend"].empty())
+        params.VPI_LK_BACKEND = fsSettings["vpi_lk_backend"];
+    params.PYRAMID_LEVEL = fsSettings["pyramid_level"];
+    params.ADAPTIVE_BACKEND = fsSettings["adaptive_backend"];
 
-    USE_IMU = fsSettings["imu"];
-    printf("USE_IMU: %d\n", USE_IMU);
-    if(USE_IMU)
+    params.USE_IMU = fsSettings["imu"];
+    printf("USE_IMU: %d\n", params.USE_IMU);
+    if(params.USE_IMU)
     {
-        fsSettings["imu_topic"] >> IMU_TOPIC;
-        printf("IMU_TOPIC: %s\n", IMU_TOPIC.c_str());
-        ACC_N = fsSettings["acc_n"];
-        ACC_W = fsSettings["acc_w"];
-        GYR_N = fsSettings["gyr_n"];
-        GYR_W = fsSettings["gyr_w"];
-        G.z() = fsSettings["g_norm"];
+        fsSettings["imu_topic"] >> params.IMU_TOPIC;
+        printf("IMU_TOPIC: %s\n", params.IMU_TOPIC.c_str());
+        params.ACC_N = fsSettings["acc_n"];
+        params.ACC_W = fsSettings["acc_w"];
+        params.GYR_N = fsSettings["gyr_n"];
+        params.GYR_W = fsSettings["gyr_w"];
+        params.G.z() = fsSettings["g_norm"];
     }
 
-    SOLVER_TIME = fsSettings["max_solver_time"];
-    NUM_ITERATIONS = fsSettings["max_num_iterations"];
-    MIN_PARALLAX = fsSettings["keyframe_parallax"];
-    MIN_PARALLAX = MIN_PARALLAX / FOCAL_LENGTH;
+    if (!fsSettings["window_size"].empty())
+        params.WINDOW_SIZE = fsSettings["window_size"];
+    if (params.WINDOW_SIZE < 4 || params.WINDOW_SIZE > MAX_WINDOW_SIZE)
+    {
+        ROS_WARN("window_size %d out of 4..%d, clamped", params.WINDOW_SIZE, MAX_WINDOW_SIZE);
+        params.WINDOW_SIZE = std::max(4, std::min(params.WINDOW_SIZE, MAX_WINDOW_SIZE));
+    }
+    if (!fsSettings["num_of_features"].empty())
+        params.NUM_OF_F = fsSettings["num_of_features"];
+    ROS_INFO("window size %d, %d features preallocated", params.WINDOW_SIZE, params.NUM_OF_F);
 
-    fsSettings["output_path"] >> OUTPUT_FOLDER;
-    VINS_RESULT_PATH = OUTPUT_FOLDER + "/vio.csv";
-    std::cout << "result path " << VINS_RESULT_PATH << std::endl;
-    std::ofstream fout(VINS_RESULT_PATH, std::ios::out);
+    params.SOLVER_TIME = fsSettings["max_solver_time"];
+    params.NUM_ITERATIONS = fsSettings["max_num_iterations"];
+    params.SOLVER_THREADS = fsSettings["solver_threads"];
+    fsSettings["linear_solver"] >> params.LINEAR_SOLVER;
+    fsSettings["preconditioner"] >> params.PRECONDITIONER;
+    fsSettings["trust_region"] >> params.TRUST_REGION;
+    params.EXPLICIT_SCHUR = fsSettings["explicit_schur"];
+    params.NONMONOTONIC_STEPS = fsSettings["nonmonotonic_steps"];
+    params.SOLVER_AUTOTUNE = fsSettings["solver_autotune"];
+    params.BATCH_PROJECTION = fsSettings["batch_projection"];
+    params.UNIT_SPHERE_ERROR = fsSettings["unit_sphere_error"];
+    params.WINDOW_SOLVER = fsSettings["window_solver"];
+    params.GPU_PROJECTION = fsSettings["gpu_projection"];
+    params.FAST_POSE = fsSettings["fast_pose"];
+    params.KEYFRAME_OPTIMIZATION = fsSettings["keyframe_optimization"];
+    params.PERSISTENT_PROBLEM = fsSettings["persistent_problem"];
+    params.MAX_SOLVER_FEATURES = fsSettings["max_solver_features"];
+    params.MARGINALIZATION_FLOAT = fsSettings["marginalization_float"];
+    params.BIAS_CORRECTION = fsSettings["bias_correction"];
+    params.WARM_REINIT = fsSettings["warm_reinit"];
+    params.CHECKPOINT_PERIOD = fsSettings["checkpoint_period"];
+    params.CHECKPOINT_RESTORE = fsSettings["checkpoint_restore"];
+    if (!fsSettings["checkpoint_max_gap"].empty())
+        params.CHECKPOINT_MAX_GAP = fsSettings["checkpoint_max_gap"];
+    params.INIT_CANDIDATES = fsSettings["init_candidates"];
+    params.PUBLISH_POSE_RATE = fsSettings["publish_pose_rate"];
+    params.PUBLISH_CLOUD_RATE = fsSettings["publish_cloud_rate"];
+    params.LANDMARK_MAP_VOXEL = fsSettings["landmark_map_voxel"];
+    if (!fsSettings["landmark_map_max_voxels"].empty())
+        params.LANDMARK_MAP_MAX_VOXELS = fsSettings["landmark_map_max_voxels"];
+    params.PATH_MAX_POSES = fsSettings["path_max_poses"];
+    params.PUB_KEYFRAME_IMAGE = fsSettings["publish_keyframe_image"];
+    if (!fsSettings["correction_topic"].empty())
+        fsSettings["correction_topic"] >> params.CORRECTION_TOPIC;
+    params.POSE_HISTORY = fsSettings["pose_history"];
+    if (!fsSettings["pose_history_shm"].empty())
+        fsSettings["pose_history_shm"] >> params.POSE_HISTORY_SHM;
+    params.BATCH_LOG = fsSettings["batch_log"];
+    params.MIN_PARALLAX = fsSettings["keyframe_parallax"];
+    params.MIN_PARALLAX = params.MIN_PARALLAX / FOCAL_LENGTH;
+    readThreadPlacement(fsSettings, "process", params.THREAD_PROCESS);
+    readThreadPlacement(fsSettings, "track", params.THREAD_TRACK);
+    readThreadPlacement(fsSettings, "frontend", params.THREAD_FRONTEND);
+    readThreadPlacement(fsSettings, "imu", params.THREAD_IMU);
+    readThreadPlacement(fsSettings, "publish", params.THREAD_PUBLISH);
+
+    fsSettings["output_path"] >> params.OUTPUT_FOLDER;
+    params.TRAJECTORY_FORMAT = fsSettings["trajectory_format"];
+    const char *result_names[] = {"/vio.csv", "/vio_tum.txt", "/vio_kitti.txt", "/vio.bin"};
+    params.VINS_RESULT_PATH = params.OUTPUT_FOLDER + result_names[params.TRAJECTORY_FORMAT >= 0 && params.TRAJECTORY_FORMAT <= 3 ? params.TRAJECTORY_FORMAT : 0];
+    std::cout << "result path " << params.VINS_RESULT_PATH << std::endl;
+    std::ofstream fout(params.VINS_RESULT_PATH, std::ios::out);
     fout.close();
 
-    ESTIMATE_EXTRINSIC = fsSettings["estimate_extrinsic"];
-    if (ESTIMATE_EXTRINSIC == 2)
+    params.ESTIMATE_EXTRINSIC = fsSettings["estimate_extrinsic"];
+    if (params.ESTIMATE_EXTRINSIC == 2)
     {
         ROS_WARN("have no prior about extrinsic param, calibrate extrinsic param");
-        RIC.push_back(Eigen::Matrix3d::Identity());
-        TIC.push_back(Eigen::Vector3d::Zero());
-        EX_CALIB_RESULT_PATH = OUTPUT_FOLDER + "/extrinsic_parameter.csv";
+        params.RIC.push_back(Eigen::Matrix3d::Identity());
+        params.TIC.push_back(Eigen::Vector3d::Zero());
+        params.EX_CALIB_RESULT_PATH = params.OUTPUT_FOLDER + "/extrinsic_parameter.csv";
     }
     else 
     {
-        if ( ESTIMATE_EXTRINSIC == 1)
+        if ( params.ESTIMATE_EXTRINSIC == 1)
         {
             ROS_WARN(" Optimize extrinsic param around initial guess!");
-            EX_CALIB_RESULT_PATH = OUTPUT_FOLDER + "/extrinsic_parameter.csv";
+            params.EX_CALIB_RESULT_PATH = params.OUTPUT_FOLDER + "/extrinsic_parameter.csv";
         }
-        if (ESTIMATE_EXTRINSIC == 0)
+        if (params.ESTIMATE_EXTRINSIC == 0)
             ROS_WARN(" fix extrinsic param ");
 
         cv::Mat cv_T;
         fsSettings["body_T_cam0"] >> cv_T;
         Eigen::Matrix4d T;
         cv::cv2eigen(cv_T, T);
-        RIC.push_back(T.block<3, 3>(0, 0));
-        TIC.push_back(T.block<3, 1>(0, 3));
+        params.RIC.push_back(T.block<3, 3>(0, 0));
+        params.TIC.push_back(T.block<3, 1>(0, 3));
     } 
     
-    NUM_OF_CAM = fsSettings["num_of_cam"];
-    printf("camera number %d\n", NUM_OF_CAM);
+    params.NUM_OF_CAM = fsSettings["num_of_cam"];
+    printf("camera number %d\n", params.NUM_OF_CAM);
 
-    if(NUM_OF_CAM != 1 && NUM_OF_CAM != 2)
+    if(params.NUM_OF_CAM < 1 || params.NUM_OF_CAM > MAX_NUM_OF_CAM)
     {
-        printf("num_of_cam should be 1 or 2\n");
+        printf("num_of_cam should be 1 to %d\n", MAX_NUM_OF_CAM);
         assert(0);
     }
 
@@ -170,56 +253,86 @@ void readParameters(std::string config_file)
     std::string cam0Calib;
     fsSettings["cam0_calib"] >> cam0Calib;
     std::string cam0Path = configPath + "/" + cam0Calib;
-    CAM_NAMES.push_back(cam0Path);
+    params.CAM_NAMES.push_back(cam0Path);
+    std::string fisheyeMask;
+    fsSettings["fisheye_mask"] >> fisheyeMask;
+    if (!fisheyeMask.empty())
+        params.FISHEYE_MASK = configPath + "/" + fisheyeMask;
 
-    if(NUM_OF_CAM == 2)
+    if(params.NUM_OF_CAM >= 2)
     {
-        STEREO = 1;
+        params.STEREO = 1;
         std::string cam1Calib;
         fsSettings["cam1_calib"] >> cam1Calib;
         std::string cam1Path = configPath + "/" + cam1Calib; 
         //printf("%s cam1 path\n", cam1Path.c_str() );
-        CAM_NAMES.push_back(cam1Path);
+        params.CAM_NAMES.push_back(cam1Path);
         
         cv::Mat cv_T;
         fsSettings["body_T_cam1"] >> cv_T;
         Eigen::Matrix4d T;
         cv::cv2eigen(cv_T, T);
-        RIC.push_back(T.block<3, 3>(0, 0));
-        TIC.push_back(T.block<3, 1>(0, 3));
-        fsSettings["publish_rectify"] >> PUB_RECTIFY;
+        params.RIC.push_back(T.block<3, 3>(0, 0));
+        params.TIC.push_back(T.block<3, 1>(0, 3));
+        fsSettings["publish_rectify"] >> params.PUB_RECTIFY;
+    }
+
+    // the rest of a multi-camera rig, each with its own topic, intrinsics and extrinsic
+    for (int i = 2; i < params.NUM_OF_CAM; i++)
+    {
+        string cam = "cam" + to_string(i);
+        std::string topic, camCalib;
+        fsSettings["image" + to_string(i) + "_topic"] >> topic;
+        params.IMAGE_AUX_TOPICS.push_back(topic);
+        fsSettings[cam + "_calib"] >> camCalib;
+        params.CAM_NAMES.push_back(configPath + "/" + camCalib);
+
+        cv::Mat cv_T;
+        fsSettings["body_T_" + cam] >> cv_T;
+        Eigen::Matrix4d T;
+        cv::cv2eigen(cv_T, T);
+        params.RIC.push_back(T.block<3, 3>(0, 0));
+        params.TIC.push_back(T.block<3, 1>(0, 3));
     }
 
-    INIT_DEPTH = 5.0;
-    BIAS_ACC_THRESHOLD = 0.1;
-    BIAS_GYR_THRESHOLD = 0.1;
+    params.INIT_DEPTH = 5.0;
+    params.BIAS_ACC_THRESHOLD = 0.1;
+    params.BIAS_GYR_THRESHOLD = 0.1;
 
-    TD = fsSettings["td"];
-    ESTIMATE_TD = fsSettings["estimate_td"];
-    if (ESTIMATE_TD)
-        ROS_INFO_STREAM("Unsynchronized sensors, online estimate time offset, initial td: " << TD);
+    params.TD = fsSettings["td"];
+    params.ESTIMATE_TD = fsSettings["estimate_td"];
+    if (params.ESTIMATE_TD)
+        ROS_INFO_STREAM("Unsynchronized sensors, online estimate time offset, initial td: " << params.TD);
     else
-        ROS_INFO_STREAM("Synchronized sensors, fix time offset: " << TD);
+        ROS_INFO_STREAM("Synchronized sensors, fix time offset: " << params.TD);
 
-    ROW = fsSettings["image_height"];
-    COL = fsSettings["image_width"];
-    ROS_INFO("ROW: %d COL: %d ", ROW, COL);
+    params.ROLLING_SHUTTER = fsSettings["rolling_shutter"];
+    if (params.ROLLING_SHUTTER)
+    {
+        params.TR = fsSettings["rolling_shutter_tr"];
+        ROS_INFO_STREAM("rolling shutter camera, read out time per frame: " << params.TR);
+    }
 
-    if(!USE_IMU)
+    params.ROW = fsSettings["image_height"];
+    params.COL = fsSettings["image_width"];
+    ROS_INFO("ROW: %d COL: %d ", params.ROW, params.COL);
+
+    if(!params.USE_IMU)
     {
-        ESTIMATE_EXTRINSIC = 0;
-        ESTIMATE_TD = 0;
+        params.ESTIMATE_EXTRINSIC = 0;
+        params.ESTIMATE_TD = 0;
         printf("no imu, fix extrinsic param; no time offset calibration\n");
     }
-    if(PUB_RECTIFY)
+    if(params.PUB_RECTIFY)
     {
         cv::Mat rectify_left;
         cv::Mat rectify_right;
         fsSettings["cam0_rectify"] >> rectify_left;
         fsSettings["cam1_rectify"] >> rectify_right;
-        cv::cv2eigen(rectify_left, rectify_R_left);
-        cv::cv2eigen(rectify_right, rectify_R_right);
-
+        cv::cv2eigen(rectify_left, params.rectify_R_left);
+        cv::cv2eigen(rectify_right, params.rectify_R_right);
+        params.PUB_RECTIFY_IMAGE = fsSettings["publish_rectify_image"];
+        params.RECTIFY_MAP_CACHE = fsSettings["rectify_map_cache"];
     }
 
     fsSettings.release();
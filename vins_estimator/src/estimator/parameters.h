@@ -13,6 +13,8 @@
 #include <vector>
 #include <eigen3/Eigen/Dense>
 #include "../utility/utility.h"
+#include "../utility/vins_log.h"
+#include "../utility/thread_placement.h"
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/eigen.hpp>
 #include <fstream>
@@ -21,58 +23,158 @@
 using namespace std;
 
 const double FOCAL_LENGTH = 460.0;
-const int WINDOW_SIZE = 10;
-const int NUM_OF_F = 1000;
-//#define UNIT_SPHERE_ERROR
+// storage of the sliding window, the window itself is Parameters::WINDOW_SIZE frames plus the newest
+const int MAX_WINDOW_SIZE = 20;
+// cameras 0 and 1 are the (stereo) pair the estimator was built around, cameras 2 and up are
+// monocular cameras of a multi-camera rig, each tracked on its own
+const int MAX_NUM_OF_CAM = 6;
 
-extern double INIT_DEPTH;
-extern double MIN_PARALLAX;
-extern int ESTIMATE_EXTRINSIC;
+// Everything read from the config file. Each Estimator keeps its own copy and hands it to its
+// parts (feature tracker, feature manager, publishers), so several estimators with different
+// configs can run in one process.
+struct Parameters
+{
+    Parameters();
+
+    double INIT_DEPTH;
+    double MIN_PARALLAX;
+    int ESTIMATE_EXTRINSIC;
 
-extern double ACC_N, ACC_W;
-extern double GYR_N, GYR_W;
+    double ACC_N, ACC_W;
+    double GYR_N, GYR_W;
 
-extern std::vector<Eigen::Matrix3d> RIC;
-extern std::vector<Eigen::Vector3d> TIC;
-extern Eigen::Vector3d G;
+    std::vector<Eigen::Matrix3d> RIC;
+    std::vector<Eigen::Vector3d> TIC;
+    Eigen::Vector3d G;
 
-extern double BIAS_ACC_THRESHOLD;
-extern double BIAS_GYR_THRESHOLD;
-extern double SOLVER_TIME;
-extern int NUM_ITERATIONS;
-extern std::string EX_CALIB_RESULT_PATH;
-extern std::string VINS_RESULT_PATH;
-extern std::string OUTPUT_FOLDER;
-extern std::string IMU_TOPIC;
-extern double TD;
-extern int ESTIMATE_TD;
-extern int ROLLING_SHUTTER;
-extern int ROW, COL;
-extern int NUM_OF_CAM;
-extern int STEREO;
-extern int USE_IMU;
-extern int MULTIPLE_THREAD;
-extern int USE_GPU;
-extern int USE_GPU_ACC_FLOW;
-extern int USE_VPI;
-extern int VPI_BACKEND;
-extern int PYRAMID_LEVEL;
-extern int PUB_RECTIFY;
-extern Eigen::Matrix3d rectify_R_left;
-extern Eigen::Matrix3d rectify_R_right;
-// pts_gt for debug purpose;
-extern map<int, Eigen::Vector3d> pts_gt;
+    double BIAS_ACC_THRESHOLD;
+    double BIAS_GYR_THRESHOLD;
+    double SOLVER_TIME;
+    int NUM_ITERATIONS;
+    std::string EX_CALIB_RESULT_PATH;
+    std::string VINS_RESULT_PATH;
+    std::string OUTPUT_FOLDER;
+    std::string IMU_TOPIC;
+    // vio_correction of loop_fusion or global_fusion, applied to imu_propagate (empty: none)
+    std::string CORRECTION_TOPIC;
+    // poses of the last POSE_HISTORY imu samples for Estimator::poseAt (0: none), also in POSIX shared
+    // memory under POSE_HISTORY_SHM (empty: this process only)
+    int POSE_HISTORY;
+    std::string POSE_HISTORY_SHM;
+    // keyframes leaving the window, their imu and observations to OUTPUT_FOLDER/batch_log.bin for
+    // vins_batch_refine
+    int BATCH_LOG;
+    double TD;
+    int ESTIMATE_TD;
+    int ROLLING_SHUTTER;
+    double TR;  // rolling shutter readout time of a frame, s
+    int ROW, COL;
+    int WINDOW_SIZE;  // 4..MAX_WINDOW_SIZE
+    int NUM_OF_F;  // tracked features the feature manager preallocates for
+    int NUM_OF_CAM;
+    int STEREO;
+    int USE_IMU;
+    int MULTIPLE_THREAD;
+    int USE_GPU;
+    int USE_GPU_ACC_FLOW;
+    int USE_VPI;
+    int VPI_BACKEND;
+    // per stage: -1 VPI_BACKEND, else as VPI_BACKEND with 3 VIC
+    int VPI_CONVERT_BACKEND, VPI_PYRAMID_BACKEND, VPI_HARRIS_BACKEND, VPI_LK_BACKEND;
+    int PYRAMID_LEVEL;
+    // switch between the cpu, cuda and vpi tracker backends by their measured time per frame
+    int ADAPTIVE_BACKEND;
+    int PUB_RECTIFY;
+    Eigen::Matrix3d rectify_R_left;
+    Eigen::Matrix3d rectify_R_right;
+    int PUB_RECTIFY_IMAGE;
+    int RECTIFY_MAP_CACHE;
 
-extern std::string IMAGE0_TOPIC, IMAGE1_TOPIC;
-extern std::string FISHEYE_MASK;
-extern std::vector<std::string> CAM_NAMES;
-extern int MAX_CNT;
-extern int MIN_DIST;
-extern double F_THRESHOLD;
-extern int SHOW_TRACK;
-extern int FLOW_BACK;
+    std::string IMAGE0_TOPIC, IMAGE1_TOPIC;
+    // the image topics are sensor_msgs/CompressedImage (jpeg, png), decoded by ImageDecoder
+    int IMAGE_COMPRESSED;
+    // s, image1 and up pair with the image0 closest in stamp within this, 0 only the same stamp
+    double IMAGE_SYNC_TOLERANCE;
+    // V4L2 devices read by vins_node itself instead of image0_topic/image1_topic, empty off
+    std::string CAPTURE_DEVICE0, CAPTURE_DEVICE1;
+    // image2_topic and up, one per camera after the first two
+    std::vector<std::string> IMAGE_AUX_TOPICS;
+    std::string FISHEYE_MASK;
+    std::vector<std::string> CAM_NAMES;
+    int MAX_CNT;
+    int MIN_DIST;
+    double F_THRESHOLD;
+    int SHOW_TRACK;
+    // Hz of image_track, 0 every frame
+    double SHOW_TRACK_RATE;
+    int FLOW_BACK;
+    int ASYNC_STEREO;
+    // multiple_thread: the frames the estimator skips are only LK tracked, no detection or undistortion
+    int LIGHT_TRACKING;
+    int DETECT_GRID_ROWS, DETECT_GRID_COLS;
+    // MAX_CNT and MIN_DIST follow track survival, image coverage and latency (FeatureBudget), MAX_CNT
+    // is the upper bound, ADAPTIVE_FEATURES_MIN the lower one (0: a quarter of MAX_CNT), over
+    // ADAPTIVE_FEATURES_LATENCY ms of tracking and estimation per frame the target drops (0: no limit)
+    int ADAPTIVE_FEATURES;
+    int ADAPTIVE_FEATURES_MIN;
+    double ADAPTIVE_FEATURES_LATENCY;
+    int DETECTOR_TYPE;
+    int FAST_THRESHOLD;
+    // CLAHE on the images before the pyramids and detection (plain histogram equalization on VPI)
+    int EQUALIZE;
+    int UNDISTORT_LUT_STEP;
+    int UNDISTORT_LUT_CACHE;
+    int REJECT_WITH_F;
+    // LK starts from where the gyroscope rotation since the previous image moves each point
+    int GYRO_PREDICTION;
+    // pyramid levels above the image and iterations per level of LK from a prediction
+    int PREDICTION_LK_LEVELS, PREDICTION_LK_ITERATIONS;
+    int PIPELINE_QUEUE_SIZE;
+    int PIPELINE_DROP;
+    double IMU_LATENCY_BUDGET;
+    double FRAME_BUDGET;
+    // events per thread of the stage timeline in output_path/trace_vins.json, 0 off
+    int TRACE_EVENTS;
+    int SOLVER_THREADS;
+    std::string LINEAR_SOLVER, PRECONDITIONER, TRUST_REGION;
+    int EXPLICIT_SCHUR;
+    int NONMONOTONIC_STEPS;
+    int SOLVER_AUTOTUNE;
+    int BATCH_PROJECTION;
+    int UNIT_SPHERE_ERROR;
+    int WINDOW_SOLVER;
+    // projection factors of window_solver and the marginalization evaluated in one batch, on the GPU
+    // with VINS_CUDA_SOLVER
+    int GPU_PROJECTION;
+    int FAST_POSE;  // motion only pose of each new frame on fast_odometry ahead of the window optimization
+    // 1: only keyframes run the window optimization, the others keep the imu prediction; 2: and a
+    // motion only refinement of it against the solved features
+    int KEYFRAME_OPTIMIZATION;
+    int PERSISTENT_PROBLEM;
+    int MAX_SOLVER_FEATURES;
+    int MARGINALIZATION_FLOAT;
+    int BIAS_CORRECTION;
+    int WARM_REINIT;
+    // seconds between checkpoints of the window in output_path/checkpoint.bin, 0 off
+    double CHECKPOINT_PERIOD;
+    // resume from the checkpoint when the first image is at most CHECKPOINT_MAX_GAP s after it,
+    // otherwise only its extrinsics and td are taken
+    int CHECKPOINT_RESTORE;
+    double CHECKPOINT_MAX_GAP;
+    int INIT_CANDIDATES;
+    double PUBLISH_POSE_RATE, PUBLISH_CLOUD_RATE;
+    // landmark_map: voxel size in m of the map of marginalized points (0: off), and its bound
+    double LANDMARK_MAP_VOXEL;
+    int LANDMARK_MAP_MAX_VOXELS;
+    int PATH_MAX_POSES;
+    int PUB_KEYFRAME_IMAGE;
+    int TRAJECTORY_FORMAT;
+    // processThread, trackThread, the image sync or capture thread, the thread of the imu callbacks
+    // (their own once placed) and the publish thread
+    ThreadPlacement THREAD_PROCESS, THREAD_TRACK, THREAD_FRONTEND, THREAD_IMU, THREAD_PUBLISH;
+};
 
-void readParameters(std::string config_file);
+void readParameters(const std::string &config_file, Parameters &params);
 
 enum SIZE_PARAMETERIZATION
 {
@@ -0,0 +1,353 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <ros/console.h>
+#include "pose_history.h"
+
+// "VPH1", bumped with the layout
+static const uint32_t MAGIC = 0x31485056;
+static const uint32_t VERSION = 1;
+// t, P, Q (x y z w), V
+static const int VALUES = 11;
+// a query restarts when the writer rewinds under it, which is once per optimization
+static const int MAX_ATTEMPTS = 16;
+
+// cache line aligned, the slots follow it
+struct PoseHistory::Header
+{
+    uint32_t magic, version;
+    uint64_t capacity;
+    uint64_t slot_size;
+    // entry i is in slot i % capacity, [begin, end) are valid
+    std::atomic<uint64_t> begin, end;
+    // incremented whenever entries are dropped at the end, readers retry when it moved
+    std::atomic<uint64_t> rewinds;
+    char pad[16];
+};
+
+// the doubles as their bits, so the lock-free 64-bit atomics are the only shared type
+struct PoseHistory::Slot
+{
+    std::atomic<uint64_t> seq;
+    std::atomic<uint64_t> index;
+    std::atomic<uint64_t> value[VALUES];
+};
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "atomics of the ring are plain words");
+
+static inline uint64_t bits(double v)
+{
+    uint64_t b;
+    memcpy(&b, &v, sizeof(b));
+    return b;
+}
+
+static inline double real(uint64_t b)
+{
+    double v;
+    memcpy(&v, &b, sizeof(v));
+    return v;
+}
+
+static std::string shmPath(const std::string &name)
+{
+    return name.empty() || name[0] == '/' ? name : "/" + name;
+}
+
+PoseHistory::PoseHistory() : header(NULL), slots(NULL), mapped_size(0), shared(false), owner(false)
+{
+}
+
+PoseHistory::~PoseHistory()
+{
+    release();
+}
+
+void PoseHistory::release()
+{
+    if (!header)
+        return;
+    if (shared)
+    {
+        munmap(header, mapped_size);
+        if (owner)
+            shm_unlink(name.c_str());
+    }
+    else
+        ::operator delete(header);
+    header = NULL;
+    slots = NULL;
+    mapped_size = 0;
+}
+
+bool PoseHistory::reset(size_t capacity, const std::string &shm_name)
+{
+    release();
+    if (capacity == 0)
+        return true;
+    size_t size = sizeof(Header) + capacity * sizeof(Slot);
+    void *memory = NULL;
+    name = shmPath(shm_name);
+    shared = !name.empty();
+    owner = true;
+    if (shared)
+    {
+        // a ring left behind by a process that died is replaced
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+        if (fd < 0 || ftruncate(fd, size) != 0 ||
+            (memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        {
+            ROS_WARN("pose history: no shared memory %s, kept in this process", name.c_str());
+            if (fd >= 0)
+            {
+                close(fd);
+                shm_unlink(name.c_str());
+            }
+            memory = NULL;
+            shared = false;
+        }
+        else
+            close(fd);
+    }
+    if (!memory)
+        memory = ::operator new(size);
+    mapped_size = size;
+
+    header = new (memory) Header();
+    header->capacity = capacity;
+    header->slot_size = sizeof(Slot);
+    header->begin.store(0, std::memory_order_relaxed);
+    header->end.store(0, std::memory_order_relaxed);
+    header->rewinds.store(0, std::memory_order_relaxed);
+    slots = reinterpret_cast<Slot *>(header + 1);
+    for (size_t i = 0; i < capacity; i++)
+    {
+        Slot *s = new (&slots[i]) Slot();
+        s->seq.store(0, std::memory_order_relaxed);
+        s->index.store(UINT64_MAX, std::memory_order_relaxed);
+    }
+    header->version = VERSION;
+    // a reader of the shared memory only takes a ring with the magic
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = MAGIC;
+    return true;
+}
+
+bool PoseHistory::open(const std::string &shm_name)
+{
+    release();
+    name = shmPath(shm_name);
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void *memory = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header))
+        memory = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+        return false;
+    const Header *h = static_cast<const Header *>(memory);
+    if (h->magic != MAGIC || h->version != VERSION || h->slot_size != sizeof(Slot) ||
+        sizeof(Header) + h->capacity * sizeof(Slot) > static_cast<size_t>(st.st_size))
+    {
+        munmap(memory, st.st_size);
+        return false;
+    }
+    header = static_cast<Header *>(memory);
+    slots = reinterpret_cast<Slot *>(header + 1);
+    mapped_size = st.st_size;
+    shared = true;
+    owner = false;
+    return true;
+}
+
+const PoseHistory::Slot &PoseHistory::slot(uint64_t index) const
+{
+    return slots[index % header->capacity];
+}
+
+void PoseHistory::push(double t, const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, const Eigen::Vector3d &V)
+{
+    if (!header || !owner)
+        return;
+    uint64_t begin = header->begin.load(std::memory_order_relaxed);
+    uint64_t end = header->end.load(std::memory_order_relaxed);
+    // the corrected states replace the entries from t on; only this thread writes the stamps
+    if (end > begin && real(slot(end - 1).value[0].load(std::memory_order_relaxed)) >= t)
+    {
+        uint64_t lo = begin, hi = end - 1;
+        while (lo < hi)
+        {
+            uint64_t mid = lo + (hi - lo) / 2;
+            if (real(slot(mid).value[0].load(std::memory_order_relaxed)) < t)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        // a reader that sees the new count also sees the new end
+        end = lo;
+        header->end.store(end, std::memory_order_relaxed);
+        header->rewinds.fetch_add(1, std::memory_order_release);
+    }
+    if (end + 1 - begin > header->capacity)
+        header->begin.store(end + 1 - header->capacity, std::memory_order_release);
+
+    Slot &s = slots[end % header->capacity];
+    uint64_t seq = s.seq.load(std::memory_order_relaxed);
+    s.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    const double values[VALUES] = {t, P.x(), P.y(), P.z(), Q.x(), Q.y(), Q.z(), Q.w(), V.x(), V.y(), V.z()};
+    for (int k = 0; k < VALUES; k++)
+        s.value[k].store(bits(values[k]), std::memory_order_relaxed);
+    s.index.store(end, std::memory_order_relaxed);
+    s.seq.store(seq + 2, std::memory_order_release);
+    header->end.store(end + 1, std::memory_order_release);
+}
+
+void PoseHistory::clear()
+{
+    if (!header || !owner)
+        return;
+    uint64_t end = header->end.load(std::memory_order_relaxed);
+    if (header->begin.load(std::memory_order_relaxed) == end)
+        return;
+    header->begin.store(end, std::memory_order_relaxed);
+    header->rewinds.fetch_add(1, std::memory_order_release);
+}
+
+bool PoseHistory::read(uint64_t index, State &state) const
+{
+    const Slot &s = slot(index);
+    uint64_t seq = s.seq.load(std::memory_order_acquire);
+    if (seq & 1)
+        return false;
+    double values[VALUES];
+    for (int k = 0; k < VALUES; k++)
+        values[k] = real(s.value[k].load(std::memory_order_relaxed));
+    uint64_t stored = s.index.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s.seq.load(std::memory_order_relaxed) != seq || stored != index)
+        return false;
+    state.t = values[0];
+    state.P = Eigen::Vector3d(values[1], values[2], values[3]);
+    state.Q = Eigen::Quaterniond(values[7], values[4], values[5], values[6]);
+    state.V = Eigen::Vector3d(values[8], values[9], values[10]);
+    return true;
+}
+
+bool PoseHistory::readStamp(uint64_t index, double &t) const
+{
+    const Slot &s = slot(index);
+    uint64_t seq = s.seq.load(std::memory_order_acquire);
+    if (seq & 1)
+        return false;
+    t = real(s.value[0].load(std::memory_order_relaxed));
+    uint64_t stored = s.index.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return s.seq.load(std::memory_order_relaxed) == seq && stored == index;
+}
+
+bool PoseHistory::query(double t, State &state) const
+{
+    if (!header)
+        return false;
+    for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++)
+    {
+        uint64_t rewinds = header->rewinds.load(std::memory_order_acquire);
+        uint64_t begin = header->begin.load(std::memory_order_acquire);
+        uint64_t end = header->end.load(std::memory_order_acquire);
+        if (end <= begin)
+            return false;
+
+        // the first entry after t
+        uint64_t lo = begin, hi = end;
+        bool torn = false;
+        while (lo < hi && !torn)
+        {
+            uint64_t mid = lo + (hi - lo) / 2;
+            double stamp;
+            if (!readStamp(mid, stamp))
+                torn = true;
+            else if (stamp <= t)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (torn)
+            continue;
+        State a, b;
+        bool found;
+        if (lo == begin)
+            found = false;
+        else if (!read(lo - 1, a))
+            continue;
+        else if (a.t == t)
+        {
+            state = a;
+            found = true;
+        }
+        else if (lo == end)
+            found = false;
+        else if (!read(lo, b))
+            continue;
+        else
+        {
+            double s = (t - a.t) / (b.t - a.t);
+            state.t = t;
+            state.P = a.P + s * (b.P - a.P);
+            state.V = a.V + s * (b.V - a.V);
+            state.Q = a.Q.slerp(s, b.Q);
+            found = true;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header->rewinds.load(std::memory_order_relaxed) == rewinds)
+            return found;
+    }
+    return false;
+}
+
+bool PoseHistory::latest(State &state) const
+{
+    if (!header)
+        return false;
+    for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++)
+    {
+        uint64_t begin = header->begin.load(std::memory_order_acquire);
+        uint64_t end = header->end.load(std::memory_order_acquire);
+        if (end <= begin)
+            return false;
+        if (read(end - 1, state))
+            return true;
+    }
+    return false;
+}
+
+bool PoseHistory::span(double &oldest, double &newest) const
+{
+    if (!header)
+        return false;
+    for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++)
+    {
+        uint64_t begin = header->begin.load(std::memory_order_acquire);
+        uint64_t end = header->end.load(std::memory_order_acquire);
+        if (end <= begin)
+            return false;
+        if (readStamp(begin, oldest) && readStamp(end - 1, newest))
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,80 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/Geometry>
+
+// The poses of the last capacity IMU samples (or frames without IMU), for the pose at any time in
+// between: lidar deskewing, image rectification, planners. One writer thread pushes, any number of
+// reader threads query and never wait or block the writer.
+//
+// The writer is the IMU propagation. Every optimization hands it a new start state, and it pushes
+// that state and the IMU re-integrated since then. A push at or before the newest entry drops
+// the entries from there on, so the poses after the newest optimized frame are the corrected
+// ones, and the older ones stay as they were last corrected. A reset of the estimator clears the
+// history, since the world frame starts again.
+//
+// Each slot is a sequence lock: its counter is odd while the writer is in it, and readers copy a
+// slot and keep the copy if the counter was even and the same before and after. query() binary
+// searches the stamps, O(log capacity), and interpolates P and V linearly and Q by slerp.
+//
+// With a shm name the ring lives in POSIX shared memory (/dev/shm/<name>). Another process on the
+// same machine maps it with open() and reads poses without ROS in between; the layout is the
+// Header and the slots, native endian, see pose_history.cpp.
+class PoseHistory
+{
+  public:
+    struct State
+    {
+        double t;
+        Eigen::Vector3d P, V;
+        Eigen::Quaterniond Q;
+    };
+
+    PoseHistory();
+    ~PoseHistory();
+
+    // drops the ring and makes one of capacity slots, 0 turns the history off. Not while anyone
+    // queries.
+    bool reset(size_t capacity, const std::string &shm_name = "");
+    // maps the ring of another process read only, false if there is none of that name
+    bool open(const std::string &shm_name);
+    bool enabled() const { return header != NULL; }
+
+    // writer
+    void push(double t, const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, const Eigen::Vector3d &V);
+    void clear();
+
+    // readers, false outside the stamps held (or when off)
+    bool query(double t, State &state) const;
+    bool latest(State &state) const;
+    // stamps of the oldest and newest entry, false while empty
+    bool span(double &oldest, double &newest) const;
+
+  private:
+    struct Header;
+    struct Slot;
+
+    // a consistent copy of entry index, false once it was overwritten
+    bool read(uint64_t index, State &state) const;
+    bool readStamp(uint64_t index, double &t) const;
+    const Slot &slot(uint64_t index) const;
+    void release();
+
+    Header *header;
+    Slot *slots;
+    size_t mapped_size;
+    bool shared, owner;
+    std::string name;
+};
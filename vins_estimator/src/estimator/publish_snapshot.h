@@ -0,0 +1,70 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <eigen3/Eigen/Dense>
+#include <opencv2/core/core.hpp>
+
+#include "parameters.h"
+#include "feature_frame.h"
+
+// a solved feature started before WINDOW_SIZE - 2, the only ones the point cloud outputs draw
+struct SnapshotFeature
+{
+    FeatureId feature_id;
+    int camera;
+    int start_frame;
+    int size;
+    // host frame observation scaled by the depth, frame of the camera
+    Eigen::Vector3d pts_i;
+    // normalized point and pixel of the observation in frame WINDOW_SIZE - 2, when the track reaches it
+    float keyframe_obs[4];
+};
+
+// heap bytes the estimator holds, an estimate from sizes and capacities, and the resident size of
+// the process
+struct MemoryFootprint
+{
+    MemoryFootprint() : features(0), feature_count(0), image_frames(0), image_frame_count(0), resident(0) {}
+
+    size_t features;  // FeatureManager
+    size_t feature_count;
+    size_t image_frames;  // all_image_frame with the observations and preintegrations it holds
+    size_t image_frame_count;
+    size_t resident;
+};
+
+// What the publishers read of the estimator, copied on the estimator thread once a frame is done
+// and only read by the publish thread after that.
+struct PublishSnapshot
+{
+    PublishSnapshot() : t(-1), non_linear(false), margin_old(false), td(0), has_memory(false) {}
+
+    // stamp of the frame, negative for the stop request of the publish thread
+    double t;
+    bool non_linear;
+    bool margin_old;
+    double td;
+    Eigen::Vector3d Ps[(MAX_WINDOW_SIZE + 1)];
+    Eigen::Vector3d Vs[(MAX_WINDOW_SIZE + 1)];
+    Eigen::Matrix3d Rs[(MAX_WINDOW_SIZE + 1)];
+    double Headers[(MAX_WINDOW_SIZE + 1)];
+    Eigen::Vector3d tic[MAX_NUM_OF_CAM];
+    Eigen::Matrix3d ric[MAX_NUM_OF_CAM];
+    std::vector<Eigen::Vector3d> key_poses;
+    // empty when nobody subscribes to a point output
+    std::vector<SnapshotFeature> features;
+    // left image of frame WINDOW_SIZE - 2 when it is published as a keyframe and publish_keyframe_image
+    cv::Mat keyframe_image;
+    // filled once a second when somebody subscribes to memory
+    bool has_memory;
+    MemoryFootprint memory;
+};
@@ -0,0 +1,113 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <thread>
+#include "solver_tuner.h"
+
+SolverTuner::SolverTuner() : current(0), windows(0), tuning(false), trust_region(ceres::DOGLEG),
+                             nonmonotonic_steps(false)
+{
+}
+
+// ceres takes DOGLEG only with a factorizing linear solver
+static bool isIterative(ceres::LinearSolverType linear_solver)
+{
+    return linear_solver == ceres::ITERATIVE_SCHUR || linear_solver == ceres::CGNR;
+}
+
+void SolverTuner::addCandidate(int threads, ceres::LinearSolverType linear_solver,
+                               ceres::PreconditionerType preconditioner, bool explicit_schur)
+{
+    for (auto &c : candidates)
+        if (c.threads == threads && c.linear_solver == linear_solver &&
+            c.preconditioner == preconditioner && c.explicit_schur == explicit_schur)
+            return;
+    Candidate c;
+    c.threads = threads;
+    c.linear_solver = linear_solver;
+    c.preconditioner = preconditioner;
+    c.explicit_schur = explicit_schur;
+    c.time = 0;
+    c.iterations = 0;
+    candidates.push_back(c);
+}
+
+void SolverTuner::init(const Parameters &params)
+{
+    ceres::LinearSolverType linear_solver = ceres::DENSE_SCHUR;
+    ceres::PreconditionerType preconditioner = ceres::JACOBI;
+    trust_region = ceres::DOGLEG;
+    if (!params.LINEAR_SOLVER.empty() && !ceres::StringToLinearSolverType(params.LINEAR_SOLVER, &linear_solver))
+        ROS_WARN("unknown linear_solver %s, use DENSE_SCHUR", params.LINEAR_SOLVER.c_str());
+    if (!params.PRECONDITIONER.empty() && !ceres::StringToPreconditionerType(params.PRECONDITIONER, &preconditioner))
+        ROS_WARN("unknown preconditioner %s, use JACOBI", params.PRECONDITIONER.c_str());
+    if (!params.TRUST_REGION.empty() && !ceres::StringToTrustRegionStrategyType(params.TRUST_REGION, &trust_region))
+        ROS_WARN("unknown trust_region %s, use DOGLEG", params.TRUST_REGION.c_str());
+    if (trust_region == ceres::DOGLEG && isIterative(linear_solver))
+        ROS_WARN("trust_region DOGLEG does not work with %s, use LEVENBERG_MARQUARDT for it",
+                 ceres::LinearSolverTypeToString(linear_solver));
+    nonmonotonic_steps = params.NONMONOTONIC_STEPS;
+
+    candidates.clear();
+    addCandidate(std::max(1, params.SOLVER_THREADS), linear_solver, preconditioner, params.EXPLICIT_SCHUR);
+    current = 0;
+    windows = 0;
+    tuning = params.SOLVER_AUTOTUNE > 0;
+    if (!tuning)
+        return;
+
+    // powers of two up to the core count, with the dense and the iterative Schur solver (the latter
+    // with LEVENBERG_MARQUARDT under DOGLEG, see apply)
+    int cores = std::max(1u, std::thread::hardware_concurrency());
+    for (int threads = 1; ; threads = std::min(threads * 2, cores))
+    {
+        addCandidate(threads, ceres::DENSE_SCHUR, ceres::JACOBI, false);
+        addCandidate(threads, ceres::ITERATIVE_SCHUR, ceres::SCHUR_JACOBI, true);
+        if (threads == cores)
+            break;
+    }
+    ROS_INFO("solver autotune: %d settings, %d windows each", (int)candidates.size(), params.SOLVER_AUTOTUNE);
+}
+
+void SolverTuner::apply(ceres::Solver::Options &options) const
+{
+    const Candidate &c = candidates[current];
+    options.num_threads = c.threads;
+    options.linear_solver_type = c.linear_solver;
+    options.preconditioner_type = c.preconditioner;
+    options.use_explicit_schur_complement = c.explicit_schur;
+    options.trust_region_strategy_type = isIterative(c.linear_solver) ? ceres::LEVENBERG_MARQUARDT : trust_region;
+    options.use_nonmonotonic_steps = nonmonotonic_steps;
+}
+
+void SolverTuner::report(const ceres::Solver::Summary &summary, bool full_window)
+{
+    if (!tuning || !full_window)
+        return;
+    Candidate &c = candidates[current];
+    c.time += summary.total_time_in_seconds;
+    c.iterations += summary.iterations.size();
+    if (++windows < params.SOLVER_AUTOTUNE)
+        return;
+    windows = 0;
+    if (++current < (int)candidates.size())
+        return;
+
+    // time per iteration, the iteration count itself is capped by max_num_iterations/max_solver_time
+    int best = 0;
+    for (int i = 1; i < (int)candidates.size(); i++)
+        if (candidates[i].time * candidates[best].iterations < candidates[best].time * candidates[i].iterations)
+            best = i;
+    current = best;
+    tuning = false;
+    const Candidate &b = candidates[best];
+    ROS_INFO("solver autotune: %s, %d threads, %f ms per iteration",
+             ceres::LinearSolverTypeToString(b.linear_solver), b.threads,
+             b.iterations ? b.time * 1000 / b.iterations : 0.0);
+}
@@ -0,0 +1,52 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <ceres/ceres.h>
+
+#include "parameters.h"
+
+// Ceres options of Estimator::optimization, taken from the yaml (solver_threads, linear_solver,
+// preconditioner, trust_region, explicit_schur, nonmonotonic_steps).
+// With solver_autotune > 0 a set of thread counts and linear solvers is tried in turn, each for
+// solver_autotune full windows, and the one with the lowest time per iteration is kept.
+class SolverTuner
+{
+  public:
+    SolverTuner();
+
+    void init(const Parameters &params);
+    // linear solver, threads and the fixed flags, the time budget is left to the caller
+    void apply(ceres::Solver::Options &options) const;
+    // result of a solve with the options from apply, only full windows are counted
+    void report(const ceres::Solver::Summary &summary, bool full_window);
+
+  private:
+    struct Candidate
+    {
+        int threads;
+        ceres::LinearSolverType linear_solver;
+        ceres::PreconditionerType preconditioner;
+        bool explicit_schur;
+        double time;
+        int iterations;
+    };
+
+    void addCandidate(int threads, ceres::LinearSolverType linear_solver,
+                      ceres::PreconditionerType preconditioner, bool explicit_schur);
+
+    std::vector<Candidate> candidates;
+    int current;
+    int windows;
+    bool tuning;
+    ceres::TrustRegionStrategyType trust_region;
+    bool nonmonotonic_steps;
+};
@@ -0,0 +1,41 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include "parameters.h"
+
+// One state per frame of the sliding window, [0] the oldest frame: a ring over the first size
+// entries of the storage, so sliding the window moves the head instead of every state.
+template <typename T>
+class WindowRing
+{
+  public:
+    WindowRing() : data(), head(0), size(MAX_WINDOW_SIZE + 1) {}
+
+    // size slots, WINDOW_SIZE + 1; the head goes back to the start of the storage
+    void setSize(int _size)
+    {
+        size = _size;
+        head = 0;
+    }
+
+    T &operator[](int i) { return data[wrap(head + i)]; }
+    const T &operator[](int i) const { return data[wrap(head + i)]; }
+
+    // [i + 1] becomes [i], the old [0] comes around as the last slot with its contents
+    void slide() { head = wrap(head + 1); }
+
+  private:
+    // i is in [0, size), head + i below 2 * size
+    int wrap(int k) const { return k >= size ? k - size : k; }
+
+    T data[MAX_WINDOW_SIZE + 1];
+    int head, size;
+};
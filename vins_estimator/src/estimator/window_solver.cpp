@@ -0,0 +1,476 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <ros/assert.h>
+#include "window_solver.h"
+#include "../utility/tic_toc.h"
+
+typedef Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> JacobianMap;
+
+// same bounds as ceres puts on the LM diagonal
+static double clampDiagonal(double d)
+{
+    return std::min(std::max(d, 1e-6), 1e32);
+}
+
+template <typename T>
+static void deleteUnique(std::vector<T *> &v)
+{
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+    for (T *p : v)
+        delete p;
+    v.clear();
+}
+
+WindowSolver::WindowSolver() : reduced_size(0)
+{
+}
+
+WindowSolver::~WindowSolver()
+{
+    clear();
+}
+
+void WindowSolver::clear()
+{
+    deleteUnique(owned_costs);
+    deleteUnique(owned_losses);
+    deleteUnique(owned_locals);
+    blocks.clear();
+    block_index.clear();
+    residuals.clear();
+    residual_blocks.clear();
+    features.clear();
+    couplings.clear();
+    reduced_size = 0;
+}
+
+void WindowSolver::setProjectionBatch(bool enable)
+{
+    if (!enable)
+        batch.reset();
+    else if (!batch)
+        batch.reset(new ProjectionBatch());
+}
+
+void WindowSolver::AddParameterBlock(double *values, int size, ceres::LocalParameterization *local_parameterization)
+{
+    int id = blockIndex(values, size);
+    Block &block = blocks[id];
+    block.local = local_parameterization;
+    block.local_size = local_parameterization ? local_parameterization->LocalSize() : size;
+    if (local_parameterization)
+        owned_locals.push_back(local_parameterization);
+}
+
+void WindowSolver::SetParameterBlockConstant(double *values)
+{
+    auto it = block_index.find(values);
+    ROS_ASSERT(it != block_index.end());
+    blocks[it->second].constant = true;
+}
+
+void WindowSolver::SetParameterBlockVariable(double *values)
+{
+    auto it = block_index.find(values);
+    ROS_ASSERT(it != block_index.end());
+    blocks[it->second].constant = false;
+}
+
+int WindowSolver::blockIndex(double *values, int size)
+{
+    auto it = block_index.find(values);
+    if (it != block_index.end())
+        return it->second;
+    Block block;
+    block.values = values;
+    block.size = block.local_size = size;
+    block.local = NULL;
+    block.constant = false;
+    block.offset = -1;
+    block.feature = -1;
+    blocks.push_back(block);
+    block_index[values] = blocks.size() - 1;
+    return blocks.size() - 1;
+}
+
+void WindowSolver::AddResidualBlock(ceres::CostFunction *cost_function, ceres::LossFunction *loss_function,
+                                    const std::vector<double *> &parameter_blocks)
+{
+    const std::vector<int> &sizes = cost_function->parameter_block_sizes();
+    ROS_ASSERT(sizes.size() == parameter_blocks.size());
+    Residual residual;
+    residual.cost = cost_function;
+    residual.loss = loss_function;
+    residual.first = residual_blocks.size();
+    residual.count = parameter_blocks.size();
+    residual.feature = -1;
+    residual.record = -1;
+    for (size_t i = 0; i < parameter_blocks.size(); i++)
+    {
+        bool known = block_index.count(parameter_blocks[i]);
+        int id = blockIndex(parameter_blocks[i], sizes[i]);
+        // implicitly added 1-D blocks are the inverse depths
+        if (!known && sizes[i] == 1)
+        {
+            blocks[id].feature = features.size();
+            Feature feature;
+            feature.block = id;
+            features.push_back(feature);
+        }
+        if (blocks[id].feature >= 0)
+        {
+            ROS_ASSERT(residual.feature < 0);
+            residual.feature = blocks[id].feature;
+        }
+        residual_blocks.push_back(id);
+    }
+    residuals.push_back(residual);
+    owned_costs.push_back(cost_function);
+    if (loss_function)
+        owned_losses.push_back(loss_function);
+}
+
+void WindowSolver::setup()
+{
+    reduced_size = 0;
+    for (auto &block : blocks)
+    {
+        block.offset = -1;
+        if (!block.constant && block.feature < 0)
+        {
+            block.offset = reduced_size;
+            reduced_size += block.local_size;
+        }
+    }
+
+    // couplings of every feature to the reduced blocks sharing a residual with it, grouped by feature
+    couplings.clear();
+    size_t jacobian_size = 0, local_size = 0, max_residuals = 0, max_blocks = 0;
+    for (auto &residual : residuals)
+    {
+        int m = residual.cost->num_residuals();
+        size_t jac = 0, loc = 0;
+        for (int k = 0; k < residual.count; k++)
+        {
+            const Block &block = blocks[residual_blocks[residual.first + k]];
+            jac += m * block.size;
+            if (block.local)
+                loc += block.size * block.local_size + m * block.local_size;
+            if (residual.feature >= 0 && block.offset >= 0)
+            {
+                Coupling c;
+                c.block = residual_blocks[residual.first + k];
+                c.offset = residual.feature;
+                couplings.push_back(c);
+            }
+        }
+        jacobian_size = std::max(jacobian_size, jac);
+        local_size = std::max(local_size, loc);
+        max_residuals = std::max(max_residuals, (size_t)m);
+        max_blocks = std::max(max_blocks, (size_t)residual.count);
+    }
+    std::sort(couplings.begin(), couplings.end(), [](const Coupling &a, const Coupling &b)
+              { return a.offset < b.offset || (a.offset == b.offset && a.block < b.block); });
+    couplings.erase(std::unique(couplings.begin(), couplings.end(), [](const Coupling &a, const Coupling &b)
+                                { return a.offset == b.offset && a.block == b.block; }), couplings.end());
+    for (auto &feature : features)
+        feature.first = feature.last = 0;
+    int values = 0;
+    for (int i = 0; i < (int)couplings.size(); i++)
+    {
+        Feature &feature = features[couplings[i].offset];
+        if (feature.first == feature.last)
+            feature.first = i;
+        feature.last = i + 1;
+        couplings[i].offset = values;
+        values += blocks[couplings[i].block].local_size;
+    }
+
+    coupling_values.resize(values);
+    residual_buf.resize(std::max(residual_buf.size(), max_residuals));
+    jacobian_buf.resize(std::max(jacobian_buf.size(), jacobian_size));
+    local_buf.resize(std::max(local_buf.size(), local_size));
+    param_ptrs.resize(std::max(param_ptrs.size(), max_blocks));
+    jacobian_ptrs.resize(std::max(jacobian_ptrs.size(), 2 * max_blocks));
+    size_t total = 0;
+    for (auto &block : blocks)
+        total += block.size;
+    backup_buf.resize(std::max(backup_buf.size(), total));
+    H.resize(reduced_size, reduced_size);
+    g.resize(reduced_size);
+
+    if (batch)
+    {
+        batch->clear();
+        for (auto &residual : residuals)
+        {
+            for (int k = 0; k < residual.count; k++)
+                param_ptrs[k] = blocks[residual_blocks[residual.first + k]].values;
+            residual.record = batch->add(residual.cost, param_ptrs.data());
+        }
+    }
+}
+
+double WindowSolver::evaluate(bool linearize)
+{
+    if (linearize)
+    {
+        H.setZero();
+        g.setZero();
+        std::fill(coupling_values.begin(), coupling_values.end(), 0.0);
+        for (auto &feature : features)
+            feature.H = feature.g = 0;
+    }
+
+    if (batch)
+        batch->evaluate(linearize);
+
+    double cost = 0;
+    for (auto &residual : residuals)
+    {
+        const int m = residual.cost->num_residuals();
+        const int *ids = &residual_blocks[residual.first];
+        // jacobian_ptrs: ambient jacobians for Evaluate, then the local ones
+        double **jac = jacobian_ptrs.data();
+        double **jac_local = jacobian_ptrs.data() + residual.count;
+        double *jac_next = jacobian_buf.data(), *local_next = local_buf.data();
+        for (int k = 0; k < residual.count; k++)
+        {
+            const Block &block = blocks[ids[k]];
+            param_ptrs[k] = block.values;
+            jac[k] = NULL;
+            if (linearize && !block.constant)
+            {
+                jac[k] = jac_next;
+                jac_next += m * block.size;
+            }
+        }
+        if (residual.record >= 0)
+            batch->copy(residual.record, residual_buf.data(), linearize ? jac : NULL);
+        else if (!residual.cost->Evaluate(param_ptrs.data(), residual_buf.data(), linearize ? jac : NULL))
+            return std::numeric_limits<double>::infinity();
+
+        Eigen::Map<Eigen::VectorXd> r(residual_buf.data(), m);
+        double sq_norm = r.squaredNorm();
+        double rho[3] = {sq_norm, 1.0, 0.0};
+        if (residual.loss)
+            residual.loss->Evaluate(sq_norm, rho);
+        cost += 0.5 * rho[0];
+        if (!linearize)
+            continue;
+
+        // robust correction as in ceres (and MarginalizationInfo)
+        double sqrt_rho1 = sqrt(rho[1]), residual_scaling = sqrt_rho1, alpha_sq_norm = 0;
+        if (sq_norm > 0 && rho[2] > 0)
+        {
+            double D = 1.0 + 2.0 * sq_norm * rho[2] / rho[1];
+            double alpha = 1.0 - sqrt(D);
+            residual_scaling = sqrt_rho1 / (1 - alpha);
+            alpha_sq_norm = alpha / sq_norm;
+        }
+        for (int k = 0; k < residual.count; k++)
+        {
+            const Block &block = blocks[ids[k]];
+            jac_local[k] = NULL;
+            if (!jac[k])
+                continue;
+            JacobianMap J(jac[k], m, block.size);
+            if (alpha_sq_norm != 0)
+                J -= alpha_sq_norm * r * (r.transpose() * J).eval();
+            J *= sqrt_rho1;
+            jac_local[k] = jac[k];
+            if (block.local)
+            {
+                JacobianMap L(local_next, block.size, block.local_size);
+                block.local->ComputeJacobian(block.values, local_next);
+                local_next += block.size * block.local_size;
+                JacobianMap JL(local_next, m, block.local_size);
+                JL.noalias() = J * L;
+                jac_local[k] = local_next;
+                local_next += m * block.local_size;
+            }
+        }
+        r *= residual_scaling;
+
+        for (int a = 0; a < residual.count; a++)
+        {
+            if (!jac_local[a])
+                continue;
+            const Block &block_a = blocks[ids[a]];
+            JacobianMap Ja(jac_local[a], m, block_a.local_size);
+            if (block_a.feature >= 0)
+            {
+                Feature &feature = features[block_a.feature];
+                feature.g += Ja.col(0).dot(r);
+                feature.H += Ja.col(0).squaredNorm();
+                continue;
+            }
+            g.segment(block_a.offset, block_a.local_size).noalias() += Ja.transpose() * r;
+            for (int b = 0; b < residual.count; b++)
+            {
+                if (!jac_local[b])
+                    continue;
+                const Block &block_b = blocks[ids[b]];
+                JacobianMap Jb(jac_local[b], m, block_b.local_size);
+                if (block_b.feature >= 0)
+                {
+                    const Feature &feature = features[block_b.feature];
+                    int i = feature.first;
+                    while (couplings[i].block != ids[a])
+                        i++;
+                    Eigen::Map<Eigen::VectorXd>(&coupling_values[couplings[i].offset], block_a.local_size).noalias() +=
+                        Ja.transpose() * Jb.col(0);
+                }
+                else
+                    H.block(block_a.offset, block_b.offset, block_a.local_size, block_b.local_size).noalias() +=
+                        Ja.transpose() * Jb;
+            }
+        }
+    }
+    return cost;
+}
+
+bool WindowSolver::computeStep(double lambda, double &model_decrease)
+{
+    diagonal.resize(reduced_size);
+    for (int i = 0; i < reduced_size; i++)
+        diagonal(i) = clampDiagonal(H(i, i));
+    S = H;
+    S.diagonal() += lambda * diagonal;
+    b = -g;
+
+    // Schur complement of the inverse depths
+    for (auto &feature : features)
+    {
+        double h = feature.H + lambda * clampDiagonal(feature.H);
+        for (int i = feature.first; i < feature.last; i++)
+        {
+            const Block &block_i = blocks[couplings[i].block];
+            Eigen::Map<const Eigen::VectorXd> vi(&coupling_values[couplings[i].offset], block_i.local_size);
+            b.segment(block_i.offset, block_i.local_size) += vi * (feature.g / h);
+            for (int j = feature.first; j < feature.last; j++)
+            {
+                const Block &block_j = blocks[couplings[j].block];
+                Eigen::Map<const Eigen::VectorXd> vj(&coupling_values[couplings[j].offset], block_j.local_size);
+                S.block(block_i.offset, block_j.offset, block_i.local_size, block_j.local_size).noalias() -=
+                    vi * vj.transpose() / h;
+            }
+        }
+    }
+
+    ldlt.compute(S);
+    if (ldlt.info() != Eigen::Success)
+        return false;
+    delta = ldlt.solve(b);
+
+    // L(0) - L(delta) = (lambda * delta' D delta - g' delta) / 2 for the damped step
+    double g_delta = g.dot(delta), d_delta = 0;
+    for (int i = 0; i < reduced_size; i++)
+        d_delta += diagonal(i) * delta(i) * delta(i);
+    for (auto &feature : features)
+    {
+        double d = clampDiagonal(feature.H);
+        double h = feature.H + lambda * d;
+        double rhs = -feature.g;
+        for (int i = feature.first; i < feature.last; i++)
+        {
+            const Block &block_i = blocks[couplings[i].block];
+            Eigen::Map<const Eigen::VectorXd> vi(&coupling_values[couplings[i].offset], block_i.local_size);
+            rhs -= vi.dot(delta.segment(block_i.offset, block_i.local_size));
+        }
+        feature.delta = rhs / h;
+        g_delta += feature.g * feature.delta;
+        d_delta += d * feature.delta * feature.delta;
+    }
+    model_decrease = 0.5 * (lambda * d_delta - g_delta);
+    return model_decrease > 0;
+}
+
+void WindowSolver::plus()
+{
+    double *saved = backup_buf.data();
+    for (auto &block : blocks)
+    {
+        if (block.constant)
+            continue;
+        std::copy(block.values, block.values + block.size, saved);
+        const double *step = block.feature >= 0 ? &features[block.feature].delta : delta.data() + block.offset;
+        if (block.local)
+            block.local->Plus(saved, step, block.values);
+        else
+            for (int i = 0; i < block.size; i++)
+                block.values[i] = saved[i] + step[i];
+        saved += block.size;
+    }
+}
+
+void WindowSolver::restore()
+{
+    const double *saved = backup_buf.data();
+    for (auto &block : blocks)
+    {
+        if (block.constant)
+            continue;
+        std::copy(saved, saved + block.size, block.values);
+        saved += block.size;
+    }
+}
+
+void WindowSolver::solve(int max_iterations, double max_time, Summary &summary)
+{
+    TicToc t_solve;
+    setup();
+    double cost = evaluate(true);
+    bool linearized = true;
+    summary.initial_cost = cost;
+    summary.iterations = 0;
+
+    // ceres' defaults: initial trust region 1e4, function tolerance 1e-6
+    double lambda = 1e-4, v = 2;
+    while (summary.iterations < max_iterations && t_solve.toc() < max_time * 1000 && reduced_size + features.size() > 0)
+    {
+        if (!linearized)
+            evaluate(true);
+        linearized = true;
+        summary.iterations++;
+
+        double model_decrease;
+        if (!computeStep(lambda, model_decrease))
+        {
+            lambda = std::min(lambda * v, 1e32);
+            v *= 2;
+            continue;
+        }
+        plus();
+        double new_cost = evaluate(false);
+        double rho = (cost - new_cost) / model_decrease;
+        if (std::isfinite(new_cost) && rho > 1e-3)
+        {
+            bool converged = cost - new_cost < 1e-6 * cost;
+            cost = new_cost;
+            lambda = std::max(lambda * std::max(1.0 / 3.0, 1.0 - pow(2 * rho - 1, 3)), 1e-16);
+            v = 2;
+            linearized = false;
+            if (converged)
+                break;
+        }
+        else
+        {
+            restore();
+            lambda = std::min(lambda * v, 1e32);
+            v *= 2;
+        }
+    }
+    summary.final_cost = cost;
+}
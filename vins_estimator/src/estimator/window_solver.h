@@ -0,0 +1,120 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <ceres/ceres.h>
+#include <eigen3/Eigen/Dense>
+#include "../factor/projection_batch.h"
+
+// Levenberg-Marquardt for the sliding window, an alternative to ceres::Solve on the same cost
+// functions. Parameter blocks that are not added explicitly and have size 1 are taken as inverse
+// depths: each one only couples to the blocks of its own residuals, so it is eliminated in closed
+// form and the remaining poses, speed/biases, extrinsics and td form one small dense system.
+// Mirrors the part of the ceres::Problem interface used by Estimator::optimization and takes
+// ownership of cost functions, loss functions and local parameterizations the same way.
+// The buffers are kept across clear(), so a window of unchanged shape is solved without allocating.
+// With setProjectionBatch the projection factors are evaluated together by a ProjectionBatch, the
+// other residuals one by one as before.
+class WindowSolver
+{
+  public:
+    struct Summary
+    {
+        int iterations;
+        double initial_cost, final_cost;
+    };
+
+    WindowSolver();
+    ~WindowSolver();
+
+    // drops the previous problem and frees what it owned
+    void clear();
+
+    void AddParameterBlock(double *values, int size, ceres::LocalParameterization *local_parameterization = NULL);
+    void SetParameterBlockConstant(double *values);
+    void SetParameterBlockVariable(double *values);
+    void AddResidualBlock(ceres::CostFunction *cost_function, ceres::LossFunction *loss_function,
+                          const std::vector<double *> &parameter_blocks);
+    template <typename... Ts>
+    void AddResidualBlock(ceres::CostFunction *cost_function, ceres::LossFunction *loss_function,
+                          double *x0, Ts *... xs)
+    {
+        AddResidualBlock(cost_function, loss_function, std::vector<double *>{x0, xs...});
+    }
+
+    // evaluate the ProjectionLayoutFactors in one batch, on the GPU when there is one
+    void setProjectionBatch(bool enable);
+    bool projectionBatchOnGpu() const { return batch && batch->onGpu(); }
+
+    // stops after max_iterations or once max_time (s) is used up
+    void solve(int max_iterations, double max_time, Summary &summary);
+
+  private:
+    struct Block
+    {
+        double *values;
+        int size, local_size;
+        ceres::LocalParameterization *local;
+        bool constant;
+        int offset;   // in the reduced system, -1 if constant or a feature
+        int feature;  // index in features, -1 for the reduced blocks
+    };
+    struct Residual
+    {
+        ceres::CostFunction *cost;
+        ceres::LossFunction *loss;
+        int first, count; // into residual_blocks
+        int feature;
+        int record;       // in batch, -1 for one Evaluate
+    };
+    struct Feature
+    {
+        int block;
+        double H, g, delta;
+        int first, last;  // couplings to reduced blocks, into couplings
+    };
+    struct Coupling
+    {
+        int block;
+        int offset;   // into coupling_values
+    };
+
+    int blockIndex(double *values, int size);
+    void setup();
+    double evaluate(bool linearize);
+    bool computeStep(double lambda, double &model_decrease);
+    // keeps the current values in backup_buf for restore()
+    void plus();
+    void restore();
+
+    std::vector<Block> blocks;
+    std::unordered_map<double *, int> block_index;
+    std::vector<Residual> residuals;
+    std::vector<int> residual_blocks;
+    std::vector<Feature> features;
+    std::vector<Coupling> couplings;
+    std::vector<double> coupling_values;
+    int reduced_size;
+
+    std::unique_ptr<ProjectionBatch> batch;
+
+    std::vector<ceres::CostFunction *> owned_costs;
+    std::vector<ceres::LossFunction *> owned_losses;
+    std::vector<ceres::LocalParameterization *> owned_locals;
+
+    Eigen::MatrixXd H, S;
+    Eigen::VectorXd g, b, delta, diagonal;
+    Eigen::LDLT<Eigen::MatrixXd> ldlt;
+    std::vector<double *> param_ptrs, jacobian_ptrs;
+    std::vector<double> residual_buf, jacobian_buf, local_buf, backup_buf;
+};
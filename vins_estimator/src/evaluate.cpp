@@ -0,0 +1,257 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+// Runs a list of sequence / config pairs through vins_benchmark, several at a time, and collects
+// their numbers into one table. Every job is its own vins_benchmark process with its own output
+// folder, so a job that crashes or runs out of memory takes only itself down and the replay
+// publishes nothing.
+//
+// rosrun vins vins_evaluate [job file] [output folder] [parallel jobs]
+//   job file: one job per line, "name config sequence [ground truth]", # starts a comment,
+//             relative paths are relative to the job file, see trajectory_evaluation/viode_jobs.txt
+//   output folder: gets one folder per job (stamped_traj_estimate.txt, benchmark.csv, latency.csv,
+//             log.txt) and summary.csv
+//   parallel jobs: default half the cores, an estimator keeps about two of them busy
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "utility/tic_toc.h"
+
+using namespace std;
+
+struct Job
+{
+    string name, config, sequence, ground_truth;
+    int status;
+    double seconds;
+};
+
+static string folderOf(const string &path)
+{
+    size_t slash = path.find_last_of('/');
+    return slash == string::npos ? string(".") : path.substr(0, slash);
+}
+
+static string resolve(const string &base, const string &path)
+{
+    if (path.empty() || path[0] == '/')
+        return path;
+    if (path[0] == '~' && getenv("HOME"))
+        return getenv("HOME") + path.substr(1);
+    return base + "/" + path;
+}
+
+static bool makeFolders(const string &path)
+{
+    for (size_t i = 1; i <= path.size(); i++)
+    {
+        if (i < path.size() && path[i] != '/')
+            continue;
+        string sub = path.substr(0, i);
+        if (mkdir(sub.c_str(), 0755) != 0 && errno != EEXIST)
+            return false;
+    }
+    return true;
+}
+
+static bool readJobs(const string &path, vector<Job> &jobs)
+{
+    ifstream file(path);
+    if (!file)
+        return false;
+    string base = folderOf(path), line;
+    while (getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+        istringstream in(line);
+        Job job;
+        if (!(in >> job.name >> job.config >> job.sequence))
+            continue;
+        in >> job.ground_truth;
+        job.config = resolve(base, job.config);
+        job.sequence = resolve(base, job.sequence);
+        job.ground_truth = resolve(base, job.ground_truth);
+        job.status = -1;
+        job.seconds = 0;
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+// vins_benchmark next to this executable, catkin puts both into the same folder
+static string benchmarkPath()
+{
+    char self[PATH_MAX];
+    ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (n <= 0)
+        return "vins_benchmark";
+    self[n] = 0;
+    return folderOf(self) + "/vins_benchmark";
+}
+
+static pid_t launch(const string &benchmark, const Job &job, const string &folder)
+{
+    // the child must not repeat what is still buffered
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+    int log = open((folder + "/log.txt").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (log >= 0)
+    {
+        dup2(log, STDOUT_FILENO);
+        dup2(log, STDERR_FILENO);
+        close(log);
+    }
+    vector<const char *> args{benchmark.c_str(), "-o", folder.c_str(), job.config.c_str(), job.sequence.c_str()};
+    if (!job.ground_truth.empty())
+        args.push_back(job.ground_truth.c_str());
+    args.push_back(NULL);
+    execv(benchmark.c_str(), const_cast<char *const *>(args.data()));
+    perror("execv");
+    _exit(127);
+}
+
+// header and row of benchmark.csv, empty when the job did not get that far
+static bool readSummary(const string &folder, string &header, string &row)
+{
+    ifstream file(folder + "/benchmark.csv");
+    return getline(file, header) && getline(file, row);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3 && argc != 4)
+    {
+        printf("please intput: rosrun vins vins_evaluate [job file] [output folder] [parallel jobs] \n"
+               "for example: rosrun vins vins_evaluate "
+               "~/catkin_ws/src/VINS-Fusion/trajectory_evaluation/viode_jobs.txt ~/output/evaluation \n");
+        return 1;
+    }
+    vector<Job> jobs;
+    if (!readJobs(argv[1], jobs) || jobs.empty())
+    {
+        printf("no jobs in %s\n", argv[1]);
+        return 1;
+    }
+    string output = argv[2];
+    int parallel = argc == 4 ? atoi(argv[3]) : max(1, (int)std::thread::hardware_concurrency() / 2);
+    parallel = max(1, parallel);
+    if (!makeFolders(output))
+    {
+        printf("cannot create %s\n", output.c_str());
+        return 1;
+    }
+    string benchmark = benchmarkPath();
+    printf("%d jobs, %d at a time, %s\n", (int)jobs.size(), parallel, benchmark.c_str());
+
+    map<pid_t, int> running;
+    map<pid_t, TicToc> started;
+    size_t next = 0, done = 0;
+    TicToc t_all;
+    while (done < jobs.size())
+    {
+        while ((int)running.size() < parallel && next < jobs.size())
+        {
+            string folder = output + "/" + jobs[next].name;
+            pid_t pid = makeFolders(folder) ? launch(benchmark, jobs[next], folder) : -1;
+            if (pid < 0)
+            {
+                printf("cannot start %s\n", jobs[next].name.c_str());
+                jobs[next++].status = 127;
+                done++;
+                continue;
+            }
+            running[pid] = next++;
+            started[pid] = TicToc();
+        }
+        if (running.empty())
+            continue;
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0 && errno == EINTR)
+            continue;
+        if (pid < 0 || running.find(pid) == running.end())
+            break;
+        Job &job = jobs[running[pid]];
+        job.seconds = started[pid].toc() / 1000;
+        job.status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        running.erase(pid);
+        started.erase(pid);
+        done++;
+        printf("[%d/%d] %s %s in %.1f s\n", (int)done, (int)jobs.size(), job.name.c_str(),
+               job.status == 0 ? "done" : "failed", job.seconds);
+        fflush(stdout);
+    }
+
+    // one row per job in job order, the columns of benchmark.csv after name, status and wall time
+    string header;
+    vector<string> rows;
+    for (const Job &job : jobs)
+    {
+        string h, row;
+        if (job.status == 0 && readSummary(output + "/" + job.name, h, row))
+            header = h;
+        else
+            row.clear();
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), ",%d,%.1f,", job.status, job.seconds);
+        rows.push_back(job.name + prefix + row);
+    }
+    FILE *summary = fopen((output + "/summary.csv").c_str(), "w");
+    if (summary)
+    {
+        fprintf(summary, "job,status,wall_s,%s\n", header.c_str());
+        for (const string &row : rows)
+            fprintf(summary, "%s\n", row.c_str());
+        fclose(summary);
+    }
+
+    printf("\n%-24s %6s %8s %8s %10s %10s %10s\n", "job", "status", "wall [s]", "fps", "ate rmse", "frame p50",
+           "frame p95");
+    for (const Job &job : jobs)
+    {
+        string h, row;
+        double fps = 0, rmse = -1, p50 = 0, p95 = 0;
+        if (job.status == 0 && readSummary(output + "/" + job.name, h, row))
+        {
+            // frames,poses,fps,estimator_s,ate_poses,ate_rmse,...,frame_p50_ms,frame_p95_ms,...
+            vector<string> fields;
+            stringstream in(row);
+            string field;
+            while (getline(in, field, ','))
+                fields.push_back(field);
+            if (fields.size() >= 14)
+            {
+                fps = atof(fields[2].c_str());
+                rmse = fields[5].empty() ? -1 : atof(fields[5].c_str());
+                p50 = atof(fields[10].c_str());
+                p95 = atof(fields[11].c_str());
+            }
+        }
+        char ate[16] = "-";
+        if (rmse >= 0)
+            snprintf(ate, sizeof(ate), "%.4f", rmse);
+        printf("%-24s %6d %8.1f %8.1f %10s %10.2f %10.2f\n", job.name.c_str(), job.status, job.seconds, fps, ate, p50,
+               p95);
+    }
+    printf("all jobs in %.1f s, summary in %s/summary.csv\n", t_all.toc() / 1000, output.c_str());
+    return 0;
+}
@@ -15,32 +15,62 @@
 #include <ceres/ceres.h>
 using namespace Eigen;
 
+// one raw sample as integrated, the time step up to it
+struct ImuStep
+{
+    double dt;
+    Eigen::Vector3d acc, gyr;
+};
+
+// enough for a keyframe interval at the usual imu and camera rates, more only grows the storage once
+const int IMU_SAMPLE_CAPACITY = 64;
+
 class IntegrationBase
 {
   public:
     IntegrationBase() = delete;
+    // the noise densities and the gravity are taken from params
     IntegrationBase(const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
-                    const Eigen::Vector3d &_linearized_ba, const Eigen::Vector3d &_linearized_bg)
-        : acc_0{_acc_0}, gyr_0{_gyr_0}, linearized_acc{_acc_0}, linearized_gyr{_gyr_0},
-          linearized_ba{_linearized_ba}, linearized_bg{_linearized_bg},
-            jacobian{Eigen::Matrix<double, 15, 15>::Identity()}, covariance{Eigen::Matrix<double, 15, 15>::Zero()},
-          sum_dt{0.0}, delta_p{Eigen::Vector3d::Zero()}, delta_q{Eigen::Quaterniond::Identity()}, delta_v{Eigen::Vector3d::Zero()}
-
+                    const Eigen::Vector3d &_linearized_ba, const Eigen::Vector3d &_linearized_bg,
+                    const Parameters &params)
+        : gravity(params.G)
     {
+        samples.reserve(IMU_SAMPLE_CAPACITY);
+        reset(_acc_0, _gyr_0, _linearized_ba, _linearized_bg);
         noise = Eigen::Matrix<double, 18, 18>::Zero();
-        noise.block<3, 3>(0, 0) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(3, 3) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(6, 6) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(9, 9) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(12, 12) =  (ACC_W * ACC_W) * Eigen::Matrix3d::Identity();
-        noise.block<3, 3>(15, 15) =  (GYR_W * GYR_W) * Eigen::Matrix3d::Identity();
+        noise.block<3, 3>(0, 0) =  (params.ACC_N * params.ACC_N) * Eigen::Matrix3d::Identity();
+        noise.block<3, 3>(3, 3) =  (params.GYR_N * params.GYR_N) * Eigen::Matrix3d::Identity();
+        noise.block<3, 3>(6, 6) =  (params.ACC_N * params.ACC_N) * Eigen::Matrix3d::Identity();
+        noise.block<3, 3>(9, 9) =  (params.GYR_N * params.GYR_N) * Eigen::Matrix3d::Identity();
+        noise.block<3, 3>(12, 12) =  (params.ACC_W * params.ACC_W) * Eigen::Matrix3d::Identity();
+        noise.block<3, 3>(15, 15) =  (params.GYR_W * params.GYR_W) * Eigen::Matrix3d::Identity();
+    }
+
+    // starts over as a new preintegration, the sample storage is kept
+    void reset(const Eigen::Vector3d &_acc_0, const Eigen::Vector3d &_gyr_0,
+               const Eigen::Vector3d &_linearized_ba, const Eigen::Vector3d &_linearized_bg)
+    {
+        acc_0 = linearized_acc = _acc_0;
+        gyr_0 = linearized_gyr = _gyr_0;
+        linearized_ba = _linearized_ba;
+        linearized_bg = _linearized_bg;
+        jacobian.setIdentity();
+        covariance.setZero();
+        sum_dt = 0.0;
+        delta_p.setZero();
+        delta_q.setIdentity();
+        delta_v.setZero();
+        samples.clear();
+        corrected = false;
     }
 
     void push_back(double dt, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr)
     {
-        dt_buf.push_back(dt);
-        acc_buf.push_back(acc);
-        gyr_buf.push_back(gyr);
+        ImuStep s;
+        s.dt = dt;
+        s.acc = acc;
+        s.gyr = gyr;
+        samples.push_back(s);
         propagate(dt, acc, gyr);
     }
 
@@ -56,8 +86,30 @@ class IntegrationBase
         linearized_bg = _linearized_bg;
         jacobian.setIdentity();
         covariance.setZero();
-        for (int i = 0; i < static_cast<int>(dt_buf.size()); i++)
-            propagate(dt_buf[i], acc_buf[i], gyr_buf[i]);
+        corrected = false;
+        for (const ImuStep &s : samples)
+            propagate(s.dt, s.acc, s.gyr);
+    }
+
+    // moves the linearization point to the new bias with the bias Jacobians instead of integrating
+    // the samples again, the deltas are first-order until the next repropagate
+    void correctBias(const Eigen::Vector3d &_linearized_ba, const Eigen::Vector3d &_linearized_bg)
+    {
+        Eigen::Vector3d dba = _linearized_ba - linearized_ba;
+        Eigen::Vector3d dbg = _linearized_bg - linearized_bg;
+        delta_p += jacobian.block<3, 3>(O_P, O_BA) * dba + jacobian.block<3, 3>(O_P, O_BG) * dbg;
+        delta_q = (delta_q * Utility::deltaQ(jacobian.block<3, 3>(O_R, O_BG) * dbg)).normalized();
+        delta_v += jacobian.block<3, 3>(O_V, O_BA) * dba + jacobian.block<3, 3>(O_V, O_BG) * dbg;
+        linearized_ba = _linearized_ba;
+        linearized_bg = _linearized_bg;
+        corrected = true;
+    }
+
+    // the deltas are due for a repropagate: corrected, or the bias has left the range where the
+    // first-order correction in evaluate holds
+    bool needsRepropagate(const Eigen::Vector3d &ba, const Eigen::Vector3d &bg) const
+    {
+        return corrected || (ba - linearized_ba).norm() > 0.10 || (bg - linearized_bg).norm() > 0.01;
     }
 
     void midPointIntegration(double _dt, 
@@ -96,42 +148,51 @@ class IntegrationBase
                 a_1_x(2), 0, -a_1_x(0),
                 -a_1_x(1), a_1_x(0), 0;
 
-            MatrixXd F = MatrixXd::Zero(15, 15);
-            F.block<3, 3>(0, 0) = Matrix3d::Identity();
-            F.block<3, 3>(0, 3) = -0.25 * delta_q.toRotationMatrix() * R_a_0_x * _dt * _dt + 
-                                  -0.25 * result_delta_q.toRotationMatrix() * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt * _dt;
-            F.block<3, 3>(0, 6) = MatrixXd::Identity(3,3) * _dt;
-            F.block<3, 3>(0, 9) = -0.25 * (delta_q.toRotationMatrix() + result_delta_q.toRotationMatrix()) * _dt * _dt;
-            F.block<3, 3>(0, 12) = -0.25 * result_delta_q.toRotationMatrix() * R_a_1_x * _dt * _dt * -_dt;
-            F.block<3, 3>(3, 3) = Matrix3d::Identity() - R_w_x * _dt;
-            F.block<3, 3>(3, 12) = -1.0 * MatrixXd::Identity(3,3) * _dt;
-            F.block<3, 3>(6, 3) = -0.5 * delta_q.toRotationMatrix() * R_a_0_x * _dt + 
-                                  -0.5 * result_delta_q.toRotationMatrix() * R_a_1_x * (Matrix3d::Identity() - R_w_x * _dt) * _dt;
-            F.block<3, 3>(6, 6) = Matrix3d::Identity();
-            F.block<3, 3>(6, 9) = -0.5 * (delta_q.toRotationMatrix() + result_delta_q.toRotationMatrix()) * _dt;
-            F.block<3, 3>(6, 12) = -0.5 * result_delta_q.toRotationMatrix() * R_a_1_x * _dt * -_dt;
-            F.block<3, 3>(9, 9) = Matrix3d::Identity();
-            F.block<3, 3>(12, 12) = Matrix3d::Identity();
-            //cout<<"A"<<endl<<A<<endl;
-
-            MatrixXd V = MatrixXd::Zero(15,18);
-            V.block<3, 3>(0, 0) =  0.25 * delta_q.toRotationMatrix() * _dt * _dt;
-            V.block<3, 3>(0, 3) =  0.25 * -result_delta_q.toRotationMatrix() * R_a_1_x  * _dt * _dt * 0.5 * _dt;
-            V.block<3, 3>(0, 6) =  0.25 * result_delta_q.toRotationMatrix() * _dt * _dt;
+            // F is identity on the diagonal except for the rotation block, the other nonzero blocks are
+            // in the rows of p, q and v only: F * M is formed block by block, without the zeros
+            Matrix3d R_0 = delta_q.toRotationMatrix(), R_1 = result_delta_q.toRotationMatrix();
+            Matrix3d F_qq = Matrix3d::Identity() - R_w_x * _dt;
+            Matrix3d F_pq = -0.25 * R_0 * R_a_0_x * _dt * _dt +
+                            -0.25 * R_1 * R_a_1_x * F_qq * _dt * _dt;
+            Matrix3d F_pba = -0.25 * (R_0 + R_1) * _dt * _dt;
+            Matrix3d F_pbg = -0.25 * R_1 * R_a_1_x * _dt * _dt * -_dt;
+            Matrix3d F_vq = -0.5 * R_0 * R_a_0_x * _dt +
+                            -0.5 * R_1 * R_a_1_x * F_qq * _dt;
+            Matrix3d F_vba = -0.5 * (R_0 + R_1) * _dt;
+            Matrix3d F_vbg = -0.5 * R_1 * R_a_1_x * _dt * -_dt;
+            auto applyF = [&](const Matrix<double, 15, 15> &M, Matrix<double, 15, 15> &FM)
+            {
+                FM.middleRows<3>(0) = M.middleRows<3>(0) + F_pq * M.middleRows<3>(3) + _dt * M.middleRows<3>(6) +
+                                      F_pba * M.middleRows<3>(9) + F_pbg * M.middleRows<3>(12);
+                FM.middleRows<3>(3) = F_qq * M.middleRows<3>(3) - _dt * M.middleRows<3>(12);
+                FM.middleRows<3>(6) = F_vq * M.middleRows<3>(3) + M.middleRows<3>(6) +
+                                      F_vba * M.middleRows<3>(9) + F_vbg * M.middleRows<3>(12);
+                FM.middleRows<6>(9) = M.middleRows<6>(9);
+            };
+
+            Matrix<double, 15, 18> V = Matrix<double, 15, 18>::Zero();
+            V.block<3, 3>(0, 0) =  0.25 * R_0 * _dt * _dt;
+            V.block<3, 3>(0, 3) =  0.25 * -R_1 * R_a_1_x  * _dt * _dt * 0.5 * _dt;
+            V.block<3, 3>(0, 6) =  0.25 * R_1 * _dt * _dt;
             V.block<3, 3>(0, 9) =  V.block<3, 3>(0, 3);
-            V.block<3, 3>(3, 3) =  0.5 * MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(3, 9) =  0.5 * MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(6, 0) =  0.5 * delta_q.toRotationMatrix() * _dt;
-            V.block<3, 3>(6, 3) =  0.5 * -result_delta_q.toRotationMatrix() * R_a_1_x  * _dt * 0.5 * _dt;
-            V.block<3, 3>(6, 6) =  0.5 * result_delta_q.toRotationMatrix() * _dt;
+            V.block<3, 3>(3, 3) =  0.5 * Matrix3d::Identity() * _dt;
+            V.block<3, 3>(3, 9) =  0.5 * Matrix3d::Identity() * _dt;
+            V.block<3, 3>(6, 0) =  0.5 * R_0 * _dt;
+            V.block<3, 3>(6, 3) =  0.5 * -R_1 * R_a_1_x  * _dt * 0.5 * _dt;
+            V.block<3, 3>(6, 6) =  0.5 * R_1 * _dt;
             V.block<3, 3>(6, 9) =  V.block<3, 3>(6, 3);
-            V.block<3, 3>(9, 12) = MatrixXd::Identity(3,3) * _dt;
-            V.block<3, 3>(12, 15) = MatrixXd::Identity(3,3) * _dt;
+            V.block<3, 3>(9, 12) = Matrix3d::Identity() * _dt;
+            V.block<3, 3>(12, 15) = Matrix3d::Identity() * _dt;
 
             //step_jacobian = F;
             //step_V = V;
-            jacobian = F * jacobian;
-            covariance = F * covariance * F.transpose() + V * noise * V.transpose();
+            Matrix<double, 15, 15> FM, FMF;
+            applyF(jacobian, FM);
+            jacobian = FM;
+            // F * covariance * F' as F * (F * covariance)', the noise is diagonal
+            applyF(covariance, FM);
+            applyF(FM.transpose(), FMF);
+            covariance = FMF + V * noise.diagonal().asDiagonal() * V.transpose();
         }
 
     }
@@ -186,9 +247,9 @@ class IntegrationBase
         Eigen::Vector3d corrected_delta_v = delta_v + dv_dba * dba + dv_dbg * dbg;
         Eigen::Vector3d corrected_delta_p = delta_p + dp_dba * dba + dp_dbg * dbg;
 
-        residuals.block<3, 1>(O_P, 0) = Qi.inverse() * (0.5 * G * sum_dt * sum_dt + Pj - Pi - Vi * sum_dt) - corrected_delta_p;
+        residuals.block<3, 1>(O_P, 0) = Qi.inverse() * (0.5 * gravity * sum_dt * sum_dt + Pj - Pi - Vi * sum_dt) - corrected_delta_p;
         residuals.block<3, 1>(O_R, 0) = 2 * (corrected_delta_q.inverse() * (Qi.inverse() * Qj)).vec();
-        residuals.block<3, 1>(O_V, 0) = Qi.inverse() * (G * sum_dt + Vj - Vi) - corrected_delta_v;
+        residuals.block<3, 1>(O_V, 0) = Qi.inverse() * (gravity * sum_dt + Vj - Vi) - corrected_delta_v;
         residuals.block<3, 1>(O_BA, 0) = Baj - Bai;
         residuals.block<3, 1>(O_BG, 0) = Bgj - Bgi;
         return residuals;
@@ -198,22 +259,23 @@ class IntegrationBase
     Eigen::Vector3d acc_0, gyr_0;
     Eigen::Vector3d acc_1, gyr_1;
 
-    const Eigen::Vector3d linearized_acc, linearized_gyr;
+    Eigen::Vector3d linearized_acc, linearized_gyr;
     Eigen::Vector3d linearized_ba, linearized_bg;
+    bool corrected;
 
     Eigen::Matrix<double, 15, 15> jacobian, covariance;
     Eigen::Matrix<double, 15, 15> step_jacobian;
     Eigen::Matrix<double, 15, 18> step_V;
     Eigen::Matrix<double, 18, 18> noise;
+    Eigen::Vector3d gravity;
 
     double sum_dt;
     Eigen::Vector3d delta_p;
     Eigen::Quaterniond delta_q;
     Eigen::Vector3d delta_v;
 
-    std::vector<double> dt_buf;
-    std::vector<Eigen::Vector3d> acc_buf;
-    std::vector<Eigen::Vector3d> gyr_buf;
+    // the raw samples, for repropagate and for merging into the previous frame
+    std::vector<ImuStep> samples;
 
 };
 /*
@@ -267,10 +329,10 @@ class IntegrationBase
 
             // put outside
             Eigen::Matrix<double, 12, 12> noise = Eigen::Matrix<double, 12, 12>::Zero();
-            noise.block<3, 3>(0, 0) =  (ACC_N * ACC_N) * Eigen::Matrix3d::Identity();
-            noise.block<3, 3>(3, 3) =  (GYR_N * GYR_N) * Eigen::Matrix3d::Identity();
-            noise.block<3, 3>(6, 6) =  (ACC_W * ACC_W) * Eigen::Matrix3d::Identity();
-            noise.block<3, 3>(9, 9) =  (GYR_W * GYR_W) * Eigen::Matrix3d::Identity();
+            noise.block<3, 3>(0, 0) =  this->noise.block<3, 3>(0, 0);
+            noise.block<3, 3>(3, 3) =  this->noise.block<3, 3>(3, 3);
+            noise.block<3, 3>(6, 6) =  this->noise.block<3, 3>(12, 12);
+            noise.block<3, 3>(9, 9) =  this->noise.block<3, 3>(15, 15);
 
             //write F directly
             MatrixXd F, V;
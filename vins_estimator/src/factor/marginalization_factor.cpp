@@ -9,12 +9,12 @@
 
 #include "marginalization_factor.h"
 
-void ResidualBlockInfo::Evaluate()
+void ResidualBlockInfo::Evaluate(const ProjectionBatch *batch)
 {
     residuals.resize(cost_function->num_residuals());
 
-    std::vector<int> block_sizes = cost_function->parameter_block_sizes();
-    raw_jacobians = new double *[block_sizes.size()];
+    const std::vector<int> &block_sizes = cost_function->parameter_block_sizes();
+    raw_jacobians.resize(block_sizes.size());
     jacobians.resize(block_sizes.size());
 
     for (int i = 0; i < static_cast<int>(block_sizes.size()); i++)
@@ -23,7 +23,10 @@ void ResidualBlockInfo::Evaluate()
         raw_jacobians[i] = jacobians[i].data();
         //dim += block_sizes[i] == 7 ? 6 : block_sizes[i];
     }
-    cost_function->Evaluate(parameter_blocks.data(), residuals.data(), raw_jacobians);
+    if (batch && record >= 0)
+        batch->copy(record, residuals.data(), raw_jacobians.data());
+    else
+        cost_function->Evaluate(parameter_blocks.data(), residuals.data(), raw_jacobians.data());
 
     //std::vector<int> tmp_idx(block_sizes.size());
     //Eigen::MatrixXd tmp(dim, dim);
@@ -77,64 +80,78 @@ void ResidualBlockInfo::Evaluate()
     }
 }
 
-MarginalizationInfo::~MarginalizationInfo()
+MarginalizationInfo::MarginalizationInfo(ThreadPool *_pool, MarginalizationWorkspace *_workspace)
+    : m(0), n(0), sum_block_size(0), valid(true), pool(_pool), workspace(_workspace)
 {
-    //ROS_WARN("release marginlizationinfo");
-    
-    for (auto it = parameter_block_data.begin(); it != parameter_block_data.end(); ++it)
-        delete it->second;
-
-    for (int i = 0; i < (int)factors.size(); i++)
+    if (!workspace)
     {
-
-        delete[] factors[i]->raw_jacobians;
-        
-        delete factors[i]->cost_function;
-
-        delete factors[i];
+        own_workspace.reset(new MarginalizationWorkspace());
+        workspace = own_workspace.get();
     }
+    workspace->resetResiduals();
 }
 
-void MarginalizationInfo::addResidualBlockInfo(ResidualBlockInfo *residual_block_info)
+void MarginalizationInfo::addResidualBlockInfo(ceres::CostFunction *cost_function, ceres::LossFunction *loss_function,
+                                               const std::vector<double *> &parameter_blocks, const std::vector<int> &drop_set)
 {
-    factors.emplace_back(residual_block_info);
-
-    std::vector<double *> &parameter_blocks = residual_block_info->parameter_blocks;
-    std::vector<int> parameter_block_sizes = residual_block_info->cost_function->parameter_block_sizes();
-
-    for (int i = 0; i < static_cast<int>(residual_block_info->parameter_blocks.size()); i++)
+    ResidualBlockInfo *residual_block_info = workspace->newResidual();
+    residual_block_info->set(cost_function, loss_function, parameter_blocks, drop_set);
+    factors.push_back(residual_block_info);
+
+    // the registry gets each address once, the factors keep the position
+    const std::vector<int> &parameter_block_sizes = cost_function->parameter_block_sizes();
+    residual_block_info->block_ids.resize(parameter_blocks.size());
+    for (int i = 0; i < static_cast<int>(parameter_blocks.size()); i++)
     {
-        double *addr = parameter_blocks[i];
-        int size = parameter_block_sizes[i];
-        parameter_block_size[reinterpret_cast<long>(addr)] = size;
+        auto it = workspace->block_lookup.emplace(parameter_blocks[i], static_cast<int>(blocks.size()));
+        if (it.second)
+        {
+            ParameterBlock block = {parameter_blocks[i], parameter_block_sizes[i], 0, false, -1};
+            blocks.push_back(block);
+        }
+        residual_block_info->block_ids[i] = it.first->second;
     }
 
-    for (int i = 0; i < static_cast<int>(residual_block_info->drop_set.size()); i++)
-    {
-        double *addr = parameter_blocks[residual_block_info->drop_set[i]];
-        parameter_block_idx[reinterpret_cast<long>(addr)] = 0;
-    }
+    for (int i = 0; i < static_cast<int>(drop_set.size()); i++)
+        blocks[residual_block_info->block_ids[drop_set[i]]].drop = true;
+}
+
+void MarginalizationInfo::addKeptBlock(double *addr, int size, int idx, const double *value)
+{
+    ParameterBlock block = {addr, size, idx, false, static_cast<int>(block_values.size())};
+    blocks.push_back(block);
+    block_values.insert(block_values.end(), value, value + size);
 }
 
 void MarginalizationInfo::preMarginalize()
 {
-    for (auto it : factors)
+    // the projection factors in one pass, the pool copies their results out with the loss applied
+    ProjectionBatch *batch = workspace->batch.get();
+    if (batch)
     {
-        it->Evaluate();
+        batch->clear();
+        for (auto it : factors)
+            it->record = batch->add(it->cost_function, it->parameter_blocks.data());
+        batch->evaluate(true);
+    }
 
-        std::vector<int> block_sizes = it->cost_function->parameter_block_sizes();
-        for (int i = 0; i < static_cast<int>(block_sizes.size()); i++)
-        {
-            long addr = reinterpret_cast<long>(it->parameter_blocks[i]);
-            int size = block_sizes[i];
-            if (parameter_block_data.find(addr) == parameter_block_data.end())
-            {
-                double *data = new double[size];
-                memcpy(data, it->parameter_blocks[i], sizeof(double) * size);
-                parameter_block_data[addr] = data;
-            }
-        }
+    // the factors only share constant data
+    if (pool)
+        pool->run(factors.size(), [&](int i, int) { factors[i]->Evaluate(batch); });
+    else
+        for (auto it : factors)
+            it->Evaluate(batch);
+
+    // the linearization points, one buffer for all blocks
+    int total = 0;
+    for (ParameterBlock &block : blocks)
+    {
+        block.value = total;
+        total += block.size;
     }
+    block_values.resize(total);
+    for (const ParameterBlock &block : blocks)
+        memcpy(&block_values[block.value], block.addr, sizeof(double) * block.size);
 }
 
 int MarginalizationInfo::localSize(int size) const
@@ -147,65 +164,160 @@ int MarginalizationInfo::globalSize(int size) const
     return size == 6 ? 7 : size;
 }
 
-void* ThreadsConstructA(void* threadsstruct)
+void MarginalizationWorkspace::resetResiduals()
+{
+    for (size_t i = 0; i < residuals_used; i++)
+    {
+        delete residuals[i].cost_function;
+        residuals[i].cost_function = NULL;
+    }
+    residuals_used = 0;
+    block_lookup.clear();
+}
+
+ResidualBlockInfo *MarginalizationWorkspace::newResidual()
+{
+    if (residuals_used == residuals.size())
+        residuals.emplace_back();
+    return &residuals[residuals_used++];
+}
+
+void MarginalizationWorkspace::reserve(int workers, int _num_blocks)
+{
+    num_blocks = _num_blocks;
+    touched.resize(workers);
+    touched_list.resize(workers);
+    for (int w = 0; w < workers; w++)
+    {
+        touched[w].assign(num_blocks * num_blocks, 0);
+        touched_list[w].clear();
+    }
+}
+
+// jacobians and residuals of one factor in the precision of the sums, copied only for float
+template <typename Scalar>
+struct FactorLinearization
+{
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Jacobian;
+
+    void load(const ResidualBlockInfo *it)
+    {
+        J.resize(it->jacobians.size());
+        for (int i = 0; i < static_cast<int>(J.size()); i++)
+            J[i] = it->jacobians[i].template cast<Scalar>();
+        r = it->residuals.template cast<Scalar>();
+    }
+    const Jacobian &jacobian(int i) const { return J[i]; }
+    const Eigen::Matrix<Scalar, Eigen::Dynamic, 1> &residuals() const { return r; }
+
+    std::vector<Jacobian> J;
+    Eigen::Matrix<Scalar, Eigen::Dynamic, 1> r;
+};
+
+template <>
+struct FactorLinearization<double>
+{
+    void load(const ResidualBlockInfo *_it) { it = _it; }
+    const Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> &jacobian(int i) const { return it->jacobians[i]; }
+    const Eigen::VectorXd &residuals() const { return it->residuals; }
+
+    const ResidualBlockInfo *it;
+};
+
+// sums J'J and J'r of all factors per worker on the pool, then adds the written blocks to A and b
+// in worker order and zeroes them in the workspace again
+template <typename Scalar>
+static void sumFactors(const std::vector<ResidualBlockInfo *> &factors, ThreadPool *pool, MarginalizationWorkspace &ws,
+                       std::vector<Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>> &sum_A,
+                       std::vector<Eigen::Matrix<Scalar, Eigen::Dynamic, 1>> &sum_b,
+                       int pos, Eigen::MatrixXd &A, Eigen::VectorXd &b)
 {
-    ThreadsStruct* p = ((ThreadsStruct*)threadsstruct);
-    for (auto it : p->sub_factors)
+    const int workers = pool ? pool->size() : 1;
+    ws.reserve(workers, ws.block_idx.size());
+    sum_A.resize(workers);
+    sum_b.resize(workers);
+    for (int w = 0; w < workers; w++)
     {
+        if (sum_A[w].rows() < pos)
+        {
+            sum_A[w].setZero(pos, pos);
+            sum_b[w].setZero(pos);
+        }
+    }
+    std::vector<FactorLinearization<Scalar>> linearization(workers);
+
+    auto accumulate = [&](int k, int w)
+    {
+        ResidualBlockInfo *it = factors[k];
+        FactorLinearization<Scalar> &f = linearization[w];
+        f.load(it);
         for (int i = 0; i < static_cast<int>(it->parameter_blocks.size()); i++)
         {
-            int idx_i = p->parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[i])];
-            int size_i = p->parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[i])];
-            if (size_i == 7)
-                size_i = 6;
-            Eigen::MatrixXd jacobian_i = it->jacobians[i].leftCols(size_i);
+            int oi = it->block_ids[i];
+            int idx_i = ws.block_idx[oi], size_i = ws.block_size[oi];
             for (int j = i; j < static_cast<int>(it->parameter_blocks.size()); j++)
             {
-                int idx_j = p->parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[j])];
-                int size_j = p->parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[j])];
-                if (size_j == 7)
-                    size_j = 6;
-                Eigen::MatrixXd jacobian_j = it->jacobians[j].leftCols(size_j);
-                if (i == j)
-                    p->A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
-                else
-                {
-                    p->A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
-                    p->A.block(idx_j, idx_i, size_j, size_i) = p->A.block(idx_i, idx_j, size_i, size_j).transpose();
-                }
+                int oj = it->block_ids[j];
+                sum_A[w].block(idx_i, ws.block_idx[oj], size_i, ws.block_size[oj]).noalias() +=
+                    f.jacobian(i).leftCols(size_i).transpose() * f.jacobian(j).leftCols(ws.block_size[oj]);
+                ws.touch(w, oi, oj);
             }
-            p->b.segment(idx_i, size_i) += jacobian_i.transpose() * it->residuals;
+            sum_b[w].segment(idx_i, size_i).noalias() += f.jacobian(i).leftCols(size_i).transpose() * f.residuals();
         }
+    };
+    if (pool)
+        pool->run(factors.size(), accumulate);
+    else
+        for (int k = 0; k < static_cast<int>(factors.size()); k++)
+            accumulate(k, 0);
+
+    // workers in order, an off-diagonal block also fills its mirror
+    for (int w = 0; w < workers; w++)
+    {
+        for (const auto &p : ws.touched_list[w])
+        {
+            int oi = p.first, oj = p.second;
+            int idx_i = ws.block_idx[oi], idx_j = ws.block_idx[oj], size_i = ws.block_size[oi], size_j = ws.block_size[oj];
+            auto block = sum_A[w].block(idx_i, idx_j, size_i, size_j);
+            A.block(idx_i, idx_j, size_i, size_j) += block.template cast<double>();
+            if (oi != oj)
+                A.block(idx_j, idx_i, size_j, size_i) += block.transpose().template cast<double>();
+            block.setZero();
+        }
+        b += sum_b[w].head(pos).template cast<double>();
+        sum_b[w].head(pos).setZero();
     }
-    return threadsstruct;
 }
 
 void MarginalizationInfo::marginalize()
 {
     int pos = 0;
-    for (auto &it : parameter_block_idx)
+    for (ParameterBlock &block : blocks)
     {
-        it.second = pos;
-        pos += localSize(parameter_block_size[it.first]);
+        if (block.drop)
+        {
+            block.idx = pos;
+            pos += localSize(block.size);
+        }
     }
 
     m = pos;
 
-    for (const auto &it : parameter_block_size)
+    for (ParameterBlock &block : blocks)
     {
-        if (parameter_block_idx.find(it.first) == parameter_block_idx.end())
+        if (!block.drop)
         {
-            parameter_block_idx[it.first] = pos;
-            pos += localSize(it.second);
+            block.idx = pos;
+            pos += localSize(block.size);
         }
     }
 
     n = pos - m;
-    //ROS_INFO("marginalization, pos: %d, m: %d, n: %d, size: %d", pos, m, n, (int)parameter_block_idx.size());
+    //ROS_INFO("marginalization, pos: %d, m: %d, n: %d, size: %d", pos, m, n, (int)blocks.size());
     if(m == 0)
     {
         valid = false;
-        printf("unstable tracking...\n");
+        VINS_WARN("unstable tracking...\n");
         return;
     }
 
@@ -244,55 +356,99 @@ void MarginalizationInfo::marginalize()
 
 
     TicToc t_thread_summing;
-    pthread_t tids[NUM_THREADS];
-    ThreadsStruct threadsstruct[NUM_THREADS];
-    int i = 0;
-    for (auto it : factors)
+    MarginalizationWorkspace &ws = *workspace;
+    ws.block_idx.clear();
+    ws.block_size.clear();
+    for (const ParameterBlock &block : blocks)
     {
-        threadsstruct[i].sub_factors.push_back(it);
-        i++;
-        i = i % NUM_THREADS;
+        ws.block_idx.push_back(block.idx);
+        ws.block_size.push_back(localSize(block.size));
     }
-    for (int i = 0; i < NUM_THREADS; i++)
+    if (ws.precision == MarginalizationWorkspace::DOUBLE)
+        sumFactors(factors, pool, ws, ws.A, ws.b, pos, A, b);
+    else
     {
-        TicToc zero_matrix;
-        threadsstruct[i].A = Eigen::MatrixXd::Zero(pos,pos);
-        threadsstruct[i].b = Eigen::VectorXd::Zero(pos);
-        threadsstruct[i].parameter_block_size = parameter_block_size;
-        threadsstruct[i].parameter_block_idx = parameter_block_idx;
-        int ret = pthread_create( &tids[i], NULL, ThreadsConstructA ,(void*)&(threadsstruct[i]));
-        if (ret != 0)
+        sumFactors(factors, pool, ws, ws.A_float, ws.b_float, pos, A, b);
+        if (ws.precision == MarginalizationWorkspace::FLOAT_CHECKED)
         {
-            ROS_WARN("pthread_create error");
-            ROS_BREAK();
+            Eigen::MatrixXd A_double = Eigen::MatrixXd::Zero(pos, pos);
+            Eigen::VectorXd b_double = Eigen::VectorXd::Zero(pos);
+            sumFactors(factors, pool, ws, ws.A, ws.b, pos, A_double, b_double);
+            ROS_INFO("float marginalization, relative difference A %e, b %e", (A - A_double).norm() / A_double.norm(),
+                     (b - b_double).norm() / b_double.norm());
         }
     }
-    for( int i = NUM_THREADS - 1; i >= 0; i--)  
-    {
-        pthread_join( tids[i], NULL ); 
-        A += threadsstruct[i].A;
-        b += threadsstruct[i].b;
-    }
     //ROS_DEBUG("thread summing up costs %f ms", t_thread_summing.toc());
     //ROS_INFO("A diff %f , b diff %f ", (A - tmp_A).sum(), (b - tmp_b).sum());
 
 
-    //TODO
-    Eigen::MatrixXd Amm = 0.5 * (A.block(0, 0, m, m) + A.block(0, 0, m, m).transpose());
-    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes(Amm);
-
-    //ROS_ASSERT_MSG(saes.eigenvalues().minCoeff() >= -1e-4, "min eigenvalue %f", saes.eigenvalues().minCoeff());
+    // Amm is the inverse depth diagonal plus the pose (and speed bias) being marginalized: the depths
+    // share no residual, so each is eliminated by a rank-1 update over the nonzero entries of its
+    // column, then the small pose block is eliminated with one LDLT
+    TicToc t_schur;
+    std::vector<int> depth_idx, pose_idx;
+    for (const ParameterBlock &block : blocks)
+    {
+        if (!block.drop)
+            continue;
+        int size = localSize(block.size);
+        if (size == 1)
+            depth_idx.push_back(block.idx);
+        else
+            for (int k = 0; k < size; k++)
+                pose_idx.push_back(block.idx + k);
+    }
 
-    Eigen::MatrixXd Amm_inv = saes.eigenvectors() * Eigen::VectorXd((saes.eigenvalues().array() > eps).select(saes.eigenvalues().array().inverse(), 0)).asDiagonal() * saes.eigenvectors().transpose();
-    //printf("error1: %f\n", (Amm * Amm_inv - Eigen::MatrixXd::Identity(m, m)).sum());
+    std::vector<int> nz;
+    for (int d : depth_idx)
+    {
+        if (A(d, d) <= eps)
+            continue;
+        nz.clear();
+        for (int k = 0; k < pos; k++)
+            if (k != d && A(k, d) != 0.0)
+                nz.push_back(k);
+        double inv = 1.0 / A(d, d);
+        for (int q : nz)
+        {
+            double s = A(q, d) * inv;
+            for (int p : nz)
+                A(p, q) -= A(p, d) * s;
+            b(q) -= s * b(d);
+        }
+    }
 
-    Eigen::VectorXd bmm = b.segment(0, m);
-    Eigen::MatrixXd Amr = A.block(0, m, m, n);
-    Eigen::MatrixXd Arm = A.block(m, 0, n, m);
+    const int np = pose_idx.size();
+    Eigen::MatrixXd App(np, np), Apr(np, n);
+    Eigen::VectorXd bpp(np);
+    for (int i = 0; i < np; i++)
+    {
+        for (int j = 0; j < np; j++)
+            App(i, j) = A(pose_idx[i], pose_idx[j]);
+        Apr.row(i) = A.block(pose_idx[i], m, 1, n);
+        bpp(i) = b(pose_idx[i]);
+    }
     Eigen::MatrixXd Arr = A.block(m, m, n, n);
     Eigen::VectorXd brr = b.segment(m, n);
-    A = Arr - Arm * Amm_inv * Amr;
-    b = brr - Arm * Amm_inv * bmm;
+    if (np > 0)
+    {
+        App = 0.5 * (App + App.transpose());
+        Eigen::MatrixXd X;
+        Eigen::LDLT<Eigen::MatrixXd> ldlt(App);
+        if (ldlt.info() == Eigen::Success && ldlt.isPositive() && ldlt.vectorD().minCoeff() > eps)
+            X = ldlt.solve(Apr);
+        else
+        {
+            // rank deficient, the pseudo inverse as in the dense version
+            Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes(App);
+            X = saes.eigenvectors() * Eigen::VectorXd((saes.eigenvalues().array() > eps).select(saes.eigenvalues().array().inverse(), 0)).asDiagonal() * saes.eigenvectors().transpose() * Apr;
+        }
+        Arr -= Apr.transpose() * X;
+        brr -= X.transpose() * bpp;
+    }
+    A = Arr;
+    b = brr;
+    //ROS_DEBUG("schur complement costs %f ms", t_schur.toc());
 
     Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes2(A);
     Eigen::VectorXd S = Eigen::VectorXd((saes2.eigenvalues().array() > eps).select(saes2.eigenvalues().array(), 0));
@@ -310,6 +466,51 @@ void MarginalizationInfo::marginalize()
     //      (linearized_jacobians.transpose() * linearized_residuals - b).sum());
 }
 
+void MarginalizationInfo::marginalizeBlock(MarginalizationInfo *prior, const std::vector<double *> &prior_blocks, double *drop)
+{
+    const int rows = prior->n;
+    Eigen::VectorXd r(rows);
+    MarginalizationFactor prior_factor(prior);
+    prior_factor.Evaluate(prior_blocks.data(), r.data(), NULL);
+
+    int drop_idx = -1;
+    m = 0;
+    for (int i = 0; i < static_cast<int>(prior_blocks.size()); i++)
+    {
+        if (prior_blocks[i] == drop)
+        {
+            drop_idx = prior->keep_block_idx[i] - prior->m;
+            m = localSize(prior->keep_block_size[i]);
+        }
+    }
+    ROS_ASSERT(drop_idx >= 0);
+    n = rows - m;
+
+    // kept columns in the prior's order and the residual, the dropped block takes [0, m)
+    Eigen::MatrixXd Jr(rows, n + 1);
+    int pos = m;
+    for (int i = 0; i < static_cast<int>(prior_blocks.size()); i++)
+    {
+        int size = prior->keep_block_size[i];
+        if (prior_blocks[i] == drop)
+        {
+            ParameterBlock block = {prior_blocks[i], size, 0, true, -1};
+            blocks.push_back(block);
+            continue;
+        }
+        addKeptBlock(prior_blocks[i], size, pos, prior_blocks[i]);
+        Jr.middleCols(pos - m, localSize(size)) = prior->linearized_jacobians.middleCols(prior->keep_block_idx[i] - prior->m, localSize(size));
+        pos += localSize(size);
+    }
+    Jr.col(n) = r;
+
+    // Q' [J_drop J_kept r] = [R *; 0 J' r'], the last n rows are the new square root prior
+    Eigen::HouseholderQR<Eigen::MatrixXd> qr(prior->linearized_jacobians.middleCols(drop_idx, m));
+    Jr.applyOnTheLeft(qr.householderQ().adjoint());
+    linearized_jacobians = Jr.bottomLeftCorner(n, n);
+    linearized_residuals = Jr.bottomRightCorner(n, 1);
+}
+
 std::vector<double *> MarginalizationInfo::getParameterBlocks(std::unordered_map<long, double *> &addr_shift)
 {
     std::vector<double *> keep_block_addr;
@@ -317,14 +518,14 @@ std::vector<double *> MarginalizationInfo::getParameterBlocks(std::unordered_map
     keep_block_idx.clear();
     keep_block_data.clear();
 
-    for (const auto &it : parameter_block_idx)
+    for (const ParameterBlock &block : blocks)
     {
-        if (it.second >= m)
+        if (!block.drop)
         {
-            keep_block_size.push_back(parameter_block_size[it.first]);
-            keep_block_idx.push_back(parameter_block_idx[it.first]);
-            keep_block_data.push_back(parameter_block_data[it.first]);
-            keep_block_addr.push_back(addr_shift[it.first]);
+            keep_block_size.push_back(block.size);
+            keep_block_idx.push_back(block.idx);
+            keep_block_data.push_back(&block_values[block.value]);
+            keep_block_addr.push_back(addr_shift[reinterpret_cast<long>(block.addr)]);
         }
     }
     sum_block_size = std::accumulate(std::begin(keep_block_size), std::end(keep_block_size), 0);
@@ -332,13 +533,72 @@ std::vector<double *> MarginalizationInfo::getParameterBlocks(std::unordered_map
     return keep_block_addr;
 }
 
+// dx of a block of global size Size, -1 for any size
+template <int Size>
+static void blockDelta(const double *x, const double *x0, int size, double *dx)
+{
+    typedef Eigen::Matrix<double, Size, 1> Vector;
+    Eigen::Map<Vector>(dx, size) = Eigen::Map<const Vector>(x, size) - Eigen::Map<const Vector>(x0, size);
+}
+
+template <>
+void blockDelta<7>(const double *x, const double *x0, int, double *dx)
+{
+    Eigen::Map<Eigen::Vector3d> dp(dx), dq(dx + 3);
+    dp = Eigen::Map<const Eigen::Vector3d>(x) - Eigen::Map<const Eigen::Vector3d>(x0);
+    Eigen::Quaterniond q = Eigen::Quaterniond(x0[6], x0[3], x0[4], x0[5]).inverse() * Eigen::Quaterniond(x[6], x[3], x[4], x[5]);
+    dq = 2.0 * Utility::positify(q).vec();
+    if (!(q.w() >= 0))
+        dq = -dq;
+}
+
+// the n x size row major jacobian of a block, the pose has 6 local columns and a zero one
+template <int Size>
+static void blockJacobian(const Eigen::MatrixXd &linearized_jacobians, int idx, int size, double *jacobian)
+{
+    Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Size, Size == 1 ? Eigen::ColMajor : Eigen::RowMajor>> J(jacobian, linearized_jacobians.rows(), size);
+    J = linearized_jacobians.middleCols(idx, size);
+}
+
+template <>
+void blockJacobian<7>(const Eigen::MatrixXd &linearized_jacobians, int idx, int, double *jacobian)
+{
+    Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 7, Eigen::RowMajor>> J(jacobian, linearized_jacobians.rows(), 7);
+    J.leftCols<6>() = linearized_jacobians.middleCols<6>(idx);
+    J.col(6).setZero();
+}
+
 MarginalizationFactor::MarginalizationFactor(MarginalizationInfo* _marginalization_info):marginalization_info(_marginalization_info)
 {
     int cnt = 0;
-    for (auto it : marginalization_info->keep_block_size)
+    for (int i = 0; i < static_cast<int>(marginalization_info->keep_block_size.size()); i++)
     {
-        mutable_parameter_block_sizes()->push_back(it);
-        cnt += it;
+        int size = marginalization_info->keep_block_size[i];
+        mutable_parameter_block_sizes()->push_back(size);
+        cnt += size;
+
+        BlockKernel k;
+        k.size = size;
+        k.idx = marginalization_info->keep_block_idx[i] - marginalization_info->m;
+        switch (size)
+        {
+        case 7:
+            k.delta = blockDelta<7>;
+            k.jacobian = blockJacobian<7>;
+            break;
+        case 9:
+            k.delta = blockDelta<9>;
+            k.jacobian = blockJacobian<9>;
+            break;
+        case 1:
+            k.delta = blockDelta<1>;
+            k.jacobian = blockJacobian<1>;
+            break;
+        default:
+            k.delta = blockDelta<Eigen::Dynamic>;
+            k.jacobian = blockJacobian<Eigen::Dynamic>;
+        }
+        kernels.push_back(k);
     }
     //printf("residual size: %d, %d\n", cnt, n);
     set_num_residuals(marginalization_info->n);
@@ -346,50 +606,28 @@ MarginalizationFactor::MarginalizationFactor(MarginalizationInfo* _marginalizati
 
 bool MarginalizationFactor::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
 {
-    //printf("internal addr,%d, %d\n", (int)parameter_block_sizes().size(), num_residuals());
-    //for (int i = 0; i < static_cast<int>(keep_block_size.size()); i++)
-    //{
-    //    //printf("unsigned %x\n", reinterpret_cast<unsigned long>(parameters[i]));
-    //    //printf("signed %x\n", reinterpret_cast<long>(parameters[i]));
-    //printf("jacobian %x\n", reinterpret_cast<long>(jacobians));
-    //printf("residual %x\n", reinterpret_cast<long>(residuals));
-    //}
+    // dx on the stack for the usual window sizes
+    const int MAX_STACK_SIZE = 256;
     int n = marginalization_info->n;
-    int m = marginalization_info->m;
-    Eigen::VectorXd dx(n);
-    for (int i = 0; i < static_cast<int>(marginalization_info->keep_block_size.size()); i++)
+    double dx_stack[MAX_STACK_SIZE];
+    std::vector<double> dx_heap;
+    double *dx = dx_stack;
+    if (n > MAX_STACK_SIZE)
     {
-        int size = marginalization_info->keep_block_size[i];
-        int idx = marginalization_info->keep_block_idx[i] - m;
-        Eigen::VectorXd x = Eigen::Map<const Eigen::VectorXd>(parameters[i], size);
-        Eigen::VectorXd x0 = Eigen::Map<const Eigen::VectorXd>(marginalization_info->keep_block_data[i], size);
-        if (size != 7)
-            dx.segment(idx, size) = x - x0;
-        else
-        {
-            dx.segment<3>(idx + 0) = x.head<3>() - x0.head<3>();
-            dx.segment<3>(idx + 3) = 2.0 * Utility::positify(Eigen::Quaterniond(x0(6), x0(3), x0(4), x0(5)).inverse() * Eigen::Quaterniond(x(6), x(3), x(4), x(5))).vec();
-            if (!((Eigen::Quaterniond(x0(6), x0(3), x0(4), x0(5)).inverse() * Eigen::Quaterniond(x(6), x(3), x(4), x(5))).w() >= 0))
-            {
-                dx.segment<3>(idx + 3) = 2.0 * -Utility::positify(Eigen::Quaterniond(x0(6), x0(3), x0(4), x0(5)).inverse() * Eigen::Quaterniond(x(6), x(3), x(4), x(5))).vec();
-            }
-        }
+        dx_heap.resize(n);
+        dx = dx_heap.data();
     }
-    Eigen::Map<Eigen::VectorXd>(residuals, n) = marginalization_info->linearized_residuals + marginalization_info->linearized_jacobians * dx;
+    for (int i = 0; i < static_cast<int>(kernels.size()); i++)
+        kernels[i].delta(parameters[i], marginalization_info->keep_block_data[i], kernels[i].size, dx + kernels[i].idx);
+
+    Eigen::Map<Eigen::VectorXd> r(residuals, n);
+    r = marginalization_info->linearized_residuals;
+    r.noalias() += marginalization_info->linearized_jacobians * Eigen::Map<const Eigen::VectorXd>(dx, n);
     if (jacobians)
     {
-
-        for (int i = 0; i < static_cast<int>(marginalization_info->keep_block_size.size()); i++)
-        {
+        for (int i = 0; i < static_cast<int>(kernels.size()); i++)
             if (jacobians[i])
-            {
-                int size = marginalization_info->keep_block_size[i], local_size = marginalization_info->localSize(size);
-                int idx = marginalization_info->keep_block_idx[i] - m;
-                Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> jacobian(jacobians[i], n, size);
-                jacobian.setZero();
-                jacobian.leftCols(local_size) = marginalization_info->linearized_jacobians.middleCols(idx, local_size);
-            }
-        }
+                kernels[i].jacobian(marginalization_info->linearized_jacobians, kernels[i].idx, kernels[i].size, jacobians[i]);
     }
     return true;
 }
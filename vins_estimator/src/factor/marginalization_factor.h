@@ -12,28 +12,47 @@
 #include <ros/ros.h>
 #include <ros/console.h>
 #include <cstdlib>
-#include <pthread.h>
 #include <ceres/ceres.h>
 #include <unordered_map>
+#include <deque>
+#include <memory>
 
 #include "../utility/utility.h"
 #include "../utility/tic_toc.h"
+#include "../utility/vins_log.h"
+#include "../utility/thread_pool.h"
+#include "projection_batch.h"
 
 const int NUM_THREADS = 4;
 
+// A slot of the residual arena of MarginalizationWorkspace: set for one factor per marginalization,
+// the jacobian buffers stay allocated for the factor that takes the slot next time.
 struct ResidualBlockInfo
 {
-    ResidualBlockInfo(ceres::CostFunction *_cost_function, ceres::LossFunction *_loss_function, std::vector<double *> _parameter_blocks, std::vector<int> _drop_set)
-        : cost_function(_cost_function), loss_function(_loss_function), parameter_blocks(_parameter_blocks), drop_set(_drop_set) {}
+    ResidualBlockInfo() : cost_function(NULL), loss_function(NULL), record(-1) {}
 
-    void Evaluate();
+    void set(ceres::CostFunction *_cost_function, ceres::LossFunction *_loss_function,
+             const std::vector<double *> &_parameter_blocks, const std::vector<int> &_drop_set)
+    {
+        cost_function = _cost_function;
+        loss_function = _loss_function;
+        parameter_blocks = _parameter_blocks;
+        drop_set = _drop_set;
+        record = -1;
+    }
+    // the residuals and jacobians come from batch for a record of it
+    void Evaluate(const ProjectionBatch *batch = NULL);
 
     ceres::CostFunction *cost_function;
     ceres::LossFunction *loss_function;
     std::vector<double *> parameter_blocks;
     std::vector<int> drop_set;
+    // position of each parameter block in MarginalizationInfo::blocks
+    std::vector<int> block_ids;
+    // in MarginalizationWorkspace::batch, -1 for one Evaluate
+    int record;
 
-    double **raw_jacobians;
+    std::vector<double *> raw_jacobians;
     std::vector<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> jacobians;
     Eigen::VectorXd residuals;
 
@@ -43,33 +62,97 @@ struct ResidualBlockInfo
     }
 };
 
-struct ThreadsStruct
+// Per worker sums of MarginalizationInfo::marginalize, kept by the owner of the pool so that the
+// memory is reused from frame to frame. Only the blocks a worker wrote are reduced and zeroed again.
+// With FLOAT, J'J and J'r are summed in single precision (twice the SIMD width, half the memory
+// traffic) and reduced into the double system that is factorized; FLOAT_CHECKED also sums in
+// double and logs the relative difference.
+struct MarginalizationWorkspace
 {
-    std::vector<ResidualBlockInfo *> sub_factors;
-    Eigen::MatrixXd A;
-    Eigen::VectorXd b;
-    std::unordered_map<long, int> parameter_block_size; //global size
-    std::unordered_map<long, int> parameter_block_idx; //local size
+    enum Precision
+    {
+        DOUBLE,
+        FLOAT,
+        FLOAT_CHECKED
+    };
+
+    MarginalizationWorkspace() : residuals_used(0), num_blocks(0), precision(DOUBLE) {}
+    ~MarginalizationWorkspace() { resetResiduals(); }
+
+    // starts a marginalization: the cost functions of the previous one are deleted, its slots and
+    // the block lookup are reused
+    void resetResiduals();
+    ResidualBlockInfo *newResidual();
+
+    // sets the block layout of this marginalization and clears the block marks
+    void reserve(int workers, int num_blocks);
+    // marks block (i, j) of worker w as written
+    void touch(int w, int i, int j)
+    {
+        char &mark = touched[w][i * num_blocks + j];
+        if (!mark)
+        {
+            mark = 1;
+            touched_list[w].push_back(std::make_pair(i, j));
+        }
+    }
+
+    std::vector<Eigen::MatrixXd> A;
+    std::vector<Eigen::VectorXd> b;
+    std::vector<Eigen::MatrixXf> A_float;
+    std::vector<Eigen::VectorXf> b_float;
+    std::vector<std::vector<char>> touched;
+    std::vector<std::vector<std::pair<int, int>>> touched_list;
+    // the arena, slots [0, residuals_used) belong to the current marginalization
+    std::deque<ResidualBlockInfo> residuals;
+    size_t residuals_used;
+    // address to MarginalizationInfo::blocks position, only while factors are added
+    std::unordered_map<const double *, int> block_lookup;
+    // position and local size of the blocks, by their position in MarginalizationInfo::blocks
+    std::vector<int> block_idx, block_size;
+    int num_blocks;
+    Precision precision;
+    // set to evaluate the projection factors together in preMarginalize
+    std::unique_ptr<ProjectionBatch> batch;
 };
 
 class MarginalizationInfo
 {
   public:
-    MarginalizationInfo(){valid = true;};
-    ~MarginalizationInfo();
+    // factors are linearized and summed on the pool when one is given, workspace may be kept by the
+    // caller. Its residual arena is taken over: one MarginalizationInfo adds factors to a workspace
+    // at a time
+    MarginalizationInfo(ThreadPool *_pool = NULL, MarginalizationWorkspace *_workspace = NULL);
     int localSize(int size) const;
     int globalSize(int size) const;
-    void addResidualBlockInfo(ResidualBlockInfo *residual_block_info);
+    // takes cost_function, deleted by the workspace once the next marginalization starts
+    void addResidualBlockInfo(ceres::CostFunction *cost_function, ceres::LossFunction *loss_function,
+                              const std::vector<double *> &parameter_blocks, const std::vector<int> &drop_set);
+    // a block of a prior read back from elsewhere, value is its linearization point
+    void addKeptBlock(double *addr, int size, int idx, const double *value);
     void preMarginalize();
     void marginalize();
+    // MARGIN_SECOND_NEW: this prior becomes prior with the block drop marginalized out, relinearized
+    // at the current values of prior_blocks. Works on the square root form: the columns of drop are
+    // eliminated by a QR, no Evaluate, Schur complement or eigen solve
+    void marginalizeBlock(MarginalizationInfo *prior, const std::vector<double *> &prior_blocks, double *drop);
     std::vector<double *> getParameterBlocks(std::unordered_map<long, double *> &addr_shift);
 
+    // a parameter block of the factors, in the order they were first seen
+    struct ParameterBlock
+    {
+        double *addr;
+        int size;   // global size
+        int idx;    // local position, the dropped blocks take [0, m)
+        bool drop;
+        int value;  // linearization point in block_values, -1 for none
+    };
+
     std::vector<ResidualBlockInfo *> factors;
     int m, n;
-    std::unordered_map<long, int> parameter_block_size; //global size
+    std::vector<ParameterBlock> blocks;
+    std::vector<double> block_values;
     int sum_block_size;
-    std::unordered_map<long, int> parameter_block_idx; //local size
-    std::unordered_map<long, double *> parameter_block_data;
 
     std::vector<int> keep_block_size; //global size
     std::vector<int> keep_block_idx;  //local size
@@ -79,9 +162,16 @@ class MarginalizationInfo
     Eigen::VectorXd linearized_residuals;
     const double eps = 1e-8;
     bool valid;
+    ThreadPool *pool;
+    MarginalizationWorkspace *workspace;
 
+  private:
+    std::unique_ptr<MarginalizationWorkspace> own_workspace;
 };
 
+// The kept blocks are poses (7), speed biases (9) and td (1): the kernels for the difference to the
+// linearization point and for the jacobian columns are picked per block at construction, fixed size
+// instances for these and a dynamic one for any other size.
 class MarginalizationFactor : public ceres::CostFunction
 {
   public:
@@ -89,4 +179,13 @@ class MarginalizationFactor : public ceres::CostFunction
     virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const;
 
     MarginalizationInfo* marginalization_info;
+
+  private:
+    struct BlockKernel
+    {
+        int size, idx;  // idx into dx and the columns of linearized_jacobians
+        void (*delta)(const double *x, const double *x0, int size, double *dx);
+        void (*jacobian)(const Eigen::MatrixXd &linearized_jacobians, int idx, int size, double *jacobian);
+    };
+    std::vector<BlockKernel> kernels;
 };
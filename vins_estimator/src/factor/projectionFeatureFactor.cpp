@@ -0,0 +1,205 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <cstring>
+#include "projectionFeatureFactor.h"
+
+Eigen::Matrix2d ProjectionFeatureFactor::sqrt_info;
+
+ProjectionFeatureFactor::ProjectionFeatureFactor(int _frame_i, const Eigen::Vector3d &_pts_i,
+                                                 const Eigen::Vector2d &_velocity_i, double _td_i,
+                                                 const ceres::LossFunction *_loss)
+{
+    reset(_frame_i, _pts_i, _velocity_i, _td_i, _loss);
+}
+
+void ProjectionFeatureFactor::reset(int _frame_i, const Eigen::Vector3d &_pts_i, const Eigen::Vector2d &_velocity_i,
+                                    double _td_i, const ceres::LossFunction *_loss)
+{
+    frame_i = _frame_i;
+    pts_i.reset(_pts_i, _velocity_i, _td_i);
+    loss = _loss;
+    has_right = false;
+    frames.clear();
+    observations.clear();
+    frames.push_back(frame_i);
+}
+
+void ProjectionFeatureFactor::addObservation(int frame, bool right, const Eigen::Vector3d &_pts_j,
+                                             const Eigen::Vector2d &_velocity_j, double _td_j)
+{
+    ROS_ASSERT(frame != frame_i || right);
+    Observation obs;
+    obs.pose = 0;
+    if (frame != frame_i)
+    {
+        if (frames.back() != frame)
+            frames.push_back(frame);
+        obs.pose = frames.size() - 1;
+    }
+    obs.right = right;
+    obs.pts_j.reset(_pts_j, _velocity_j, _td_j);
+    observations.push_back(obs);
+    has_right |= right;
+}
+
+void ProjectionFeatureFactor::finalize()
+{
+    ROS_ASSERT(frames.size() <= MAX_WINDOW_SIZE + 1);
+    set_num_residuals(2 * observations.size());
+    std::vector<int> *sizes = mutable_parameter_block_sizes();
+    sizes->assign(frames.size(), SIZE_POSE);
+    sizes->push_back(SIZE_POSE);
+    if (has_right)
+        sizes->push_back(SIZE_POSE);
+    sizes->push_back(SIZE_FEATURE);
+    sizes->push_back(1);
+}
+
+std::vector<double *> ProjectionFeatureFactor::parameterBlocks(double (*para_Pose)[SIZE_POSE],
+                                                               double (*para_Ex_Pose)[SIZE_POSE],
+                                                               double *para_Feature, double *para_Td) const
+{
+    std::vector<double *> blocks;
+    for (int frame : frames)
+        blocks.push_back(para_Pose[frame]);
+    blocks.push_back(para_Ex_Pose[0]);
+    if (has_right)
+        blocks.push_back(para_Ex_Pose[1]);
+    blocks.push_back(para_Feature);
+    blocks.push_back(para_Td);
+    return blocks;
+}
+
+bool ProjectionFeatureFactor::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
+{
+    typedef Eigen::Matrix<double, 2, 6> Jacobian26;
+    const int num_pose = frames.size();
+    const int b_ex0 = num_pose, b_ex1 = num_pose + 1;
+    const int b_feature = num_pose + 1 + has_right, b_td = b_feature + 1;
+    const int rows = num_residuals();
+
+    Eigen::Matrix3d R[MAX_WINDOW_SIZE + 1];
+    Eigen::Vector3d P[MAX_WINDOW_SIZE + 1];
+    for (int k = 0; k < num_pose; k++)
+    {
+        P[k] = Eigen::Vector3d(parameters[k][0], parameters[k][1], parameters[k][2]);
+        R[k] = Eigen::Quaterniond(parameters[k][6], parameters[k][3], parameters[k][4], parameters[k][5]).toRotationMatrix();
+    }
+    Eigen::Vector3d tic[2];
+    Eigen::Matrix3d ric[2];
+    tic[0] = Eigen::Vector3d(parameters[b_ex0][0], parameters[b_ex0][1], parameters[b_ex0][2]);
+    ric[0] = Eigen::Quaterniond(parameters[b_ex0][6], parameters[b_ex0][3], parameters[b_ex0][4], parameters[b_ex0][5]).toRotationMatrix();
+    if (has_right)
+    {
+        tic[1] = Eigen::Vector3d(parameters[b_ex1][0], parameters[b_ex1][1], parameters[b_ex1][2]);
+        ric[1] = Eigen::Quaterniond(parameters[b_ex1][6], parameters[b_ex1][3], parameters[b_ex1][4], parameters[b_ex1][5]).toRotationMatrix();
+    }
+    double inv_dep_i = parameters[b_feature][0];
+    double td = parameters[b_td][0];
+
+    // host frame side, shared by all observations
+    const Eigen::Matrix3d &Ri = R[0];
+    const Eigen::Vector3d &Pi = P[0];
+    const Eigen::Vector3d &pts_i_td = pts_i.at(td);
+    Eigen::Vector3d pts_camera_i = pts_i_td / inv_dep_i;
+    Eigen::Vector3d pts_imu_i = ric[0] * pts_camera_i + tic[0];
+    Eigen::Vector3d pts_w = Ri * pts_imu_i + Pi;
+
+    if (jacobians)
+    {
+        for (int b = 0; b < (int)parameter_block_sizes().size(); b++)
+            if (jacobians[b])
+                memset(jacobians[b], 0, sizeof(double) * rows * parameter_block_sizes()[b]);
+    }
+
+    for (size_t k = 0; k < observations.size(); k++)
+    {
+        const Observation &obs = observations[k];
+        const int c = obs.right;
+        const bool two_frame = obs.pose != 0;
+        const Eigen::Matrix3d &Rj = R[obs.pose];
+        const Eigen::Vector3d &Pj = P[obs.pose];
+
+        const Eigen::Vector3d &pts_j_td = obs.pts_j.at(td);
+        Eigen::Vector3d pts_imu_j = two_frame ? Eigen::Vector3d(Rj.transpose() * (pts_w - Pj)) : pts_imu_i;
+        Eigen::Vector3d pts_camera_j = ric[c].transpose() * (pts_imu_j - tic[c]);
+        double dep_j = pts_camera_j.z();
+        Eigen::Vector2d r = sqrt_info * ((pts_camera_j / dep_j).head<2>() - pts_j_td.head<2>());
+
+        // per observation loss: residual scaled by w = sqrt(rho(s) / s), C is d(w r) / dr
+        Eigen::Matrix2d C = Eigen::Matrix2d::Identity();
+        double s = r.squaredNorm();
+        if (loss && s > 0)
+        {
+            double rho[3];
+            loss->Evaluate(s, rho);
+            double w = sqrt(rho[0] / s);
+            double dw_ds = (rho[1] * s - rho[0]) / (2 * w * s * s);
+            C = w * Eigen::Matrix2d::Identity() + 2 * dw_ds * r * r.transpose();
+            r *= w;
+        }
+        Eigen::Map<Eigen::Vector2d>(residuals + 2 * k) = r;
+
+        if (!jacobians)
+            continue;
+
+        Eigen::Matrix<double, 2, 3> reduce;
+        reduce << 1. / dep_j, 0, -pts_camera_j(0) / (dep_j * dep_j),
+            0, 1. / dep_j, -pts_camera_j(1) / (dep_j * dep_j);
+        reduce = C * sqrt_info * reduce;
+
+        auto putPose = [&](int b, const Jacobian26 &J)
+        {
+            if (jacobians[b])
+                Eigen::Map<Eigen::Matrix<double, 2, 7, Eigen::RowMajor>>(jacobians[b] + 2 * k * 7).leftCols<6>() = J;
+        };
+        auto put1 = [&](int b, const Eigen::Vector2d &J)
+        {
+            if (jacobians[b])
+                Eigen::Map<Eigen::Vector2d>(jacobians[b] + 2 * k) = J;
+        };
+
+        // maps the host camera point into camera c of frame j
+        Eigen::Matrix3d A = two_frame ? Eigen::Matrix3d(ric[c].transpose() * Rj.transpose() * Ri) : Eigen::Matrix3d(ric[c].transpose());
+        Eigen::Matrix<double, 3, 6> jaco;
+        if (two_frame)
+        {
+            jaco.leftCols<3>() = ric[c].transpose() * Rj.transpose();
+            jaco.rightCols<3>() = A * -Utility::skewSymmetric(pts_imu_i);
+            putPose(0, reduce * jaco);
+
+            jaco.leftCols<3>() = ric[c].transpose() * -Rj.transpose();
+            jaco.rightCols<3>() = ric[c].transpose() * Utility::skewSymmetric(pts_imu_j);
+            putPose(obs.pose, reduce * jaco);
+        }
+        if (!obs.right)
+        {
+            // the same extrinsic on both ends
+            jaco.leftCols<3>() = ric[0].transpose() * (Rj.transpose() * Ri - Eigen::Matrix3d::Identity());
+            Eigen::Matrix3d tmp_r = A * ric[0];
+            jaco.rightCols<3>() = -tmp_r * Utility::skewSymmetric(pts_camera_i) + Utility::skewSymmetric(tmp_r * pts_camera_i) +
+                                  Utility::skewSymmetric(ric[0].transpose() * (Rj.transpose() * (Ri * tic[0] + Pi - Pj) - tic[0]));
+            putPose(b_ex0, reduce * jaco);
+        }
+        else
+        {
+            jaco.leftCols<3>() = A;
+            jaco.rightCols<3>() = A * ric[0] * -Utility::skewSymmetric(pts_camera_i);
+            putPose(b_ex0, reduce * jaco);
+
+            jaco.leftCols<3>() = -ric[1].transpose();
+            jaco.rightCols<3>() = Utility::skewSymmetric(pts_camera_j);
+            putPose(b_ex1, reduce * jaco);
+        }
+        put1(b_feature, reduce * A * ric[0] * pts_i_td * -1.0 / (inv_dep_i * inv_dep_i));
+        put1(b_td, reduce * A * ric[0] * pts_i.velocity / inv_dep_i * -1.0 + C * sqrt_info * obs.pts_j.velocity.head<2>());
+    }
+    return true;
+}
@@ -0,0 +1,65 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <ros/assert.h>
+#include <ceres/ceres.h>
+#include <Eigen/Dense>
+#include "../utility/utility.h"
+#include "../estimator/parameters.h"
+#include "time_shift.h"
+
+// All reprojection residuals of one feature in a single cost function, the residuals of
+// ProjectionTwoFrameOneCamFactor, ProjectionTwoFrameTwoCamFactor and ProjectionOneFrameTwoCamFactor
+// stacked 2 rows per observation. Rotation matrices and the host frame back-projection are computed
+// once per evaluation instead of once per observation.
+// The loss is applied per observation inside the factor: each residual is scaled so that its squared
+// norm is rho(s), which keeps the cost of the separate robustified factors, so the block itself must
+// be added without a loss function.
+// Parameter blocks: the poses named by frames(), ex pose 0, ex pose 1 if any right observation,
+// the inverse depth and td, in that order (see parameterBlocks).
+class ProjectionFeatureFactor : public ceres::CostFunction
+{
+  public:
+    ProjectionFeatureFactor(int _frame_i, const Eigen::Vector3d &_pts_i, const Eigen::Vector2d &_velocity_i,
+                            double _td_i, const ceres::LossFunction *_loss);
+    // re-initializes a factor kept across frames, observations are added again
+    void reset(int _frame_i, const Eigen::Vector3d &_pts_i, const Eigen::Vector2d &_velocity_i,
+               double _td_i, const ceres::LossFunction *_loss);
+
+    // right: pts_j was observed by camera 1, frame == frame_i is only valid with right
+    void addObservation(int frame, bool right, const Eigen::Vector3d &_pts_j, const Eigen::Vector2d &_velocity_j,
+                        double _td_j);
+    // after the last addObservation, sets the residual and parameter block sizes
+    void finalize();
+
+    std::vector<double *> parameterBlocks(double (*para_Pose)[SIZE_POSE], double (*para_Ex_Pose)[SIZE_POSE],
+                                          double *para_Feature, double *para_Td) const;
+
+    virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const;
+
+    static Eigen::Matrix2d sqrt_info;
+
+  private:
+    struct Observation
+    {
+        int pose;   // index into frames, 0 (frame_i) for the host frame seen by camera 1
+        bool right;
+        TimeShiftedPoint pts_j;
+    };
+
+    int frame_i;
+    TimeShiftedPoint pts_i;
+    const ceres::LossFunction *loss;
+    std::vector<int> frames;
+    std::vector<Observation> observations;
+    bool has_right;
+};
@@ -0,0 +1,245 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <algorithm>
+#include <vector>
+#include "projectionLayoutFactor.h"
+
+template <class Layout, class Residual>
+ProjectionLayoutFactor<Layout, Residual>::ProjectionLayoutFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j,
+                                                                 const Eigen::Vector2d &_velocity_i, const Eigen::Vector2d &_velocity_j,
+                                                                 const double _td_i, const double _td_j)
+{
+    reset(_pts_i, _pts_j, _velocity_i, _velocity_j, _td_i, _td_j);
+}
+
+template <class Layout, class Residual>
+void ProjectionLayoutFactor<Layout, Residual>::reset(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j,
+                                                     const Eigen::Vector2d &_velocity_i, const Eigen::Vector2d &_velocity_j,
+                                                     const double _td_i, const double _td_j)
+{
+    obs_i.reset(_pts_i, _velocity_i, _td_i);
+    obs_j.reset(_pts_j, _velocity_j, _td_j);
+    residual_model.init(_pts_j);
+}
+
+template <class Layout, class Residual>
+bool ProjectionLayoutFactor<Layout, Residual>::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
+{
+    // camera j is camera 1 with two cameras, otherwise camera 0 again
+    const double *ex_j = parameters[Layout::TWO_CAMS ? EX_1 : EX_0];
+    Eigen::Vector3d tic(parameters[EX_0][0], parameters[EX_0][1], parameters[EX_0][2]);
+    Eigen::Quaterniond qic(parameters[EX_0][6], parameters[EX_0][3], parameters[EX_0][4], parameters[EX_0][5]);
+    Eigen::Vector3d tic_j(ex_j[0], ex_j[1], ex_j[2]);
+    Eigen::Quaterniond qic_j(ex_j[6], ex_j[3], ex_j[4], ex_j[5]);
+
+    double inv_dep_i = parameters[FEATURE][0];
+
+    double td = parameters[TD][0];
+
+    const Eigen::Vector3d &pts_i_td = obs_i.at(td);
+    const Eigen::Vector3d &pts_j_td = obs_j.at(td);
+    Eigen::Vector3d pts_camera_i = pts_i_td / inv_dep_i;
+    Eigen::Vector3d pts_imu_i = qic * pts_camera_i + tic;
+
+    Eigen::Vector3d Pi, Pj, pts_imu_j;
+    Eigen::Quaterniond Qi, Qj;
+    if (Layout::TWO_FRAMES)
+    {
+        Pi = Eigen::Vector3d(parameters[POSE_I][0], parameters[POSE_I][1], parameters[POSE_I][2]);
+        Qi = Eigen::Quaterniond(parameters[POSE_I][6], parameters[POSE_I][3], parameters[POSE_I][4], parameters[POSE_I][5]);
+        Pj = Eigen::Vector3d(parameters[POSE_J][0], parameters[POSE_J][1], parameters[POSE_J][2]);
+        Qj = Eigen::Quaterniond(parameters[POSE_J][6], parameters[POSE_J][3], parameters[POSE_J][4], parameters[POSE_J][5]);
+        Eigen::Vector3d pts_w = Qi * pts_imu_i + Pi;
+        pts_imu_j = Qj.inverse() * (pts_w - Pj);
+    }
+    else
+        pts_imu_j = pts_imu_i;
+    Eigen::Vector3d pts_camera_j = qic_j.inverse() * (pts_imu_j - tic_j);
+
+    Eigen::Map<Eigen::Vector2d> residual(residuals);
+    residual = sqrt_info * residual_model.residual(pts_camera_j, pts_j_td);
+
+    if (jacobians)
+    {
+        Eigen::Matrix3d ric = qic.toRotationMatrix();
+        Eigen::Matrix3d ric_j = qic_j.toRotationMatrix();
+        Eigen::Matrix3d Ri, Rj;
+        // camera j <---- imu frame i
+        Eigen::Matrix3d r_cj_bi;
+        if (Layout::TWO_FRAMES)
+        {
+            Ri = Qi.toRotationMatrix();
+            Rj = Qj.toRotationMatrix();
+            r_cj_bi = ric_j.transpose() * Rj.transpose() * Ri;
+        }
+        else
+            r_cj_bi = ric_j.transpose();
+        Eigen::Matrix<double, 2, 3> reduce = sqrt_info * residual_model.reduce(pts_camera_j);
+
+        if (Layout::TWO_FRAMES && jacobians[POSE_I])
+        {
+            Eigen::Map<Eigen::Matrix<double, 2, 7, Eigen::RowMajor>> jacobian_pose_i(jacobians[POSE_I]);
+
+            Eigen::Matrix<double, 3, 6> jaco_i;
+            jaco_i.leftCols<3>() = ric_j.transpose() * Rj.transpose();
+            jaco_i.rightCols<3>() = r_cj_bi * -Utility::skewSymmetric(pts_imu_i);
+
+            jacobian_pose_i.leftCols<6>() = reduce * jaco_i;
+            jacobian_pose_i.rightCols<1>().setZero();
+        }
+
+        if (Layout::TWO_FRAMES && jacobians[POSE_J])
+        {
+            Eigen::Map<Eigen::Matrix<double, 2, 7, Eigen::RowMajor>> jacobian_pose_j(jacobians[POSE_J]);
+
+            Eigen::Matrix<double, 3, 6> jaco_j;
+            jaco_j.leftCols<3>() = ric_j.transpose() * -Rj.transpose();
+            jaco_j.rightCols<3>() = ric_j.transpose() * Utility::skewSymmetric(pts_imu_j);
+
+            jacobian_pose_j.leftCols<6>() = reduce * jaco_j;
+            jacobian_pose_j.rightCols<1>().setZero();
+        }
+        if (jacobians[EX_0])
+        {
+            Eigen::Map<Eigen::Matrix<double, 2, 7, Eigen::RowMajor>> jacobian_ex_pose(jacobians[EX_0]);
+            Eigen::Matrix<double, 3, 6> jaco_ex;
+            jaco_ex.leftCols<3>() = r_cj_bi;
+            jaco_ex.rightCols<3>() = r_cj_bi * ric * -Utility::skewSymmetric(pts_camera_i);
+            if (!Layout::TWO_CAMS)
+            {
+                // camera 0 is also camera j
+                jaco_ex.leftCols<3>() -= ric_j.transpose();
+                jaco_ex.rightCols<3>() += Utility::skewSymmetric(pts_camera_j);
+            }
+            jacobian_ex_pose.leftCols<6>() = reduce * jaco_ex;
+            jacobian_ex_pose.rightCols<1>().setZero();
+        }
+        if (Layout::TWO_CAMS && jacobians[EX_1])
+        {
+            Eigen::Map<Eigen::Matrix<double, 2, 7, Eigen::RowMajor>> jacobian_ex_pose1(jacobians[EX_1]);
+            Eigen::Matrix<double, 3, 6> jaco_ex;
+            jaco_ex.leftCols<3>() = - ric_j.transpose();
+            jaco_ex.rightCols<3>() = Utility::skewSymmetric(pts_camera_j);
+            jacobian_ex_pose1.leftCols<6>() = reduce * jaco_ex;
+            jacobian_ex_pose1.rightCols<1>().setZero();
+        }
+        if (jacobians[FEATURE])
+        {
+            Eigen::Map<Eigen::Vector2d> jacobian_feature(jacobians[FEATURE]);
+            jacobian_feature = reduce * r_cj_bi * ric * pts_i_td * -1.0 / (inv_dep_i * inv_dep_i);
+        }
+        if (jacobians[TD])
+        {
+            Eigen::Map<Eigen::Vector2d> jacobian_td(jacobians[TD]);
+            jacobian_td = reduce * r_cj_bi * ric * obs_i.velocity / inv_dep_i * -1.0 -
+                          sqrt_info * residual_model.observationJacobian(pts_j_td) * obs_j.velocity;
+        }
+    }
+
+    return true;
+}
+
+static void packModel(const PlaneResidual &, ProjectionRecord &record)
+{
+    record.sphere = 0;
+    std::fill(record.tangent, record.tangent + 6, 0.0);
+}
+
+static void packModel(const SphereResidual &model, ProjectionRecord &record)
+{
+    record.sphere = 1;
+    Eigen::Map<Eigen::Matrix<double, 2, 3, Eigen::RowMajor>>(record.tangent) = model.tangent_base;
+}
+
+template <class Layout, class Residual>
+void ProjectionLayoutFactor<Layout, Residual>::pack(ProjectionRecord &record) const
+{
+    Eigen::Map<Eigen::Vector3d>(record.pts_i) = obs_i.point;
+    Eigen::Map<Eigen::Vector3d>(record.velocity_i) = obs_i.velocity;
+    record.td_i = obs_i.td_obs;
+    Eigen::Map<Eigen::Vector3d>(record.pts_j) = obs_j.point;
+    Eigen::Map<Eigen::Vector3d>(record.velocity_j) = obs_j.velocity;
+    record.td_j = obs_j.td_obs;
+    record.two_frames = Layout::TWO_FRAMES;
+    record.two_cams = Layout::TWO_CAMS;
+    packModel(residual_model, record);
+}
+
+template <class Layout, class Residual>
+void ProjectionLayoutFactor<Layout, Residual>::check(double **parameters)
+{
+    const std::vector<int> &sizes = this->parameter_block_sizes();
+    std::vector<std::vector<double>> jaco_data(NUM_BLOCKS);
+    double *jaco[NUM_BLOCKS];
+    for (int b = 0; b < NUM_BLOCKS; b++)
+    {
+        jaco_data[b].resize(2 * sizes[b]);
+        jaco[b] = jaco_data[b].data();
+    }
+    Eigen::Vector2d residual;
+    Evaluate(parameters, residual.data(), jaco);
+    puts("check begins");
+
+    puts("my");
+    std::cout << residual.transpose() << std::endl
+              << std::endl;
+
+    // the 7 dimensional poses are perturbed as PoseLocalParameterization does
+    const double eps = 1e-6;
+    for (int b = 0; b < NUM_BLOCKS; b++)
+    {
+        int local_size = sizes[b] == 7 ? 6 : sizes[b];
+        Eigen::Matrix<double, 2, Eigen::Dynamic> num_jacobian(2, local_size);
+        for (int k = 0; k < local_size; k++)
+        {
+            std::vector<double> block(parameters[b], parameters[b] + sizes[b]);
+            if (sizes[b] == 7 && k >= 3)
+            {
+                Eigen::Map<Eigen::Quaterniond> q(block.data() + 3);
+                q = (q * Utility::deltaQ(Eigen::Vector3d::Unit(k - 3) * eps)).normalized();
+            }
+            else
+                block[k] += eps;
+
+            std::vector<double *> perturbed(parameters, parameters + NUM_BLOCKS);
+            perturbed[b] = block.data();
+            Eigen::Vector2d tmp_residual;
+            Evaluate(perturbed.data(), tmp_residual.data(), NULL);
+            num_jacobian.col(k) = (tmp_residual - residual) / eps;
+        }
+        Eigen::Map<Eigen::Matrix<double, 2, Eigen::Dynamic, Eigen::RowMajor>> jacobian(jaco[b], 2, sizes[b]);
+        std::cout << "block " << b << std::endl
+                  << jacobian.leftCols(local_size) << std::endl
+                  << num_jacobian << std::endl
+                  << std::endl;
+    }
+}
+
+void setProjectionSqrtInfo(const Eigen::Matrix2d &sqrt_info)
+{
+    ProjectionLayoutFactor<TwoFrameOneCam, PlaneResidual>::sqrt_info = sqrt_info;
+    ProjectionLayoutFactor<TwoFrameTwoCam, PlaneResidual>::sqrt_info = sqrt_info;
+    ProjectionLayoutFactor<OneFrameTwoCam, PlaneResidual>::sqrt_info = sqrt_info;
+    ProjectionLayoutFactor<TwoFrameOneCam, SphereResidual>::sqrt_info = sqrt_info;
+    ProjectionLayoutFactor<TwoFrameTwoCam, SphereResidual>::sqrt_info = sqrt_info;
+    ProjectionLayoutFactor<OneFrameTwoCam, SphereResidual>::sqrt_info = sqrt_info;
+}
+
+const Eigen::Matrix2d &projectionSqrtInfo()
+{
+    return ProjectionLayoutFactor<TwoFrameOneCam, PlaneResidual>::sqrt_info;
+}
+
+template class ProjectionLayoutFactor<TwoFrameOneCam, PlaneResidual>;
+template class ProjectionLayoutFactor<TwoFrameTwoCam, PlaneResidual>;
+template class ProjectionLayoutFactor<OneFrameTwoCam, PlaneResidual>;
+template class ProjectionLayoutFactor<TwoFrameOneCam, SphereResidual>;
+template class ProjectionLayoutFactor<TwoFrameTwoCam, SphereResidual>;
+template class ProjectionLayoutFactor<OneFrameTwoCam, SphereResidual>;
@@ -0,0 +1,103 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <ros/assert.h>
+#include <ceres/ceres.h>
+#include <Eigen/Dense>
+#include "../utility/utility.h"
+#include "../estimator/parameters.h"
+#include "projection_residual.h"
+#include "time_shift.h"
+#include "projection_kernel.h"
+
+// Which frames and cameras a projection factor connects, and so its parameter blocks:
+// [pose i, pose j,] ex pose 0, [ex pose 1,] inverse depth, td.
+// TwoFrameOneCam: camera 0 in frames i and j
+struct TwoFrameOneCam
+{
+    enum { TWO_FRAMES = 1, TWO_CAMS = 0 };
+    typedef ceres::SizedCostFunction<2, 7, 7, 7, 1, 1> Base;
+};
+
+// TwoFrameTwoCam: camera 0 in frame i, camera 1 in frame j
+struct TwoFrameTwoCam
+{
+    enum { TWO_FRAMES = 1, TWO_CAMS = 1 };
+    typedef ceres::SizedCostFunction<2, 7, 7, 7, 7, 1, 1> Base;
+};
+
+// OneFrameTwoCam: cameras 0 and 1 in the host frame
+struct OneFrameTwoCam
+{
+    enum { TWO_FRAMES = 0, TWO_CAMS = 1 };
+    typedef ceres::SizedCostFunction<2, 7, 7, 1, 1> Base;
+};
+
+// A factor ProjectionBatch evaluates together with others of its kind
+class BatchedProjection
+{
+  public:
+    virtual ~BatchedProjection() {}
+    // the observations, layout and residual model, the parameter offsets are left to the batch
+    virtual void pack(ProjectionRecord &record) const = 0;
+};
+
+// The reprojection residual of one observation of a feature hosted in frame i, for every layout
+// and residual model. Both are template arguments, the kernels are fixed size and Evaluate has no
+// branch on either; the six combinations are instantiated in projectionLayoutFactor.cpp.
+template <class Layout, class Residual>
+class ProjectionLayoutFactor : public Layout::Base, public BatchedProjection
+{
+  public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    enum
+    {
+        POSE_I = 0,
+        POSE_J = 1,
+        EX_0 = Layout::TWO_FRAMES ? 2 : 0,
+        EX_1 = EX_0 + 1,
+        FEATURE = EX_0 + 1 + Layout::TWO_CAMS,
+        TD = FEATURE + 1,
+        NUM_BLOCKS = TD + 1
+    };
+
+    ProjectionLayoutFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j,
+                           const Eigen::Vector2d &_velocity_i, const Eigen::Vector2d &_velocity_j,
+                           const double _td_i, const double _td_j);
+    // re-initializes a factor kept across frames
+    void reset(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j,
+               const Eigen::Vector2d &_velocity_i, const Eigen::Vector2d &_velocity_j,
+               const double _td_i, const double _td_j);
+    virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const;
+    virtual void pack(ProjectionRecord &record) const;
+    // prints the jacobians next to numeric ones
+    void check(double **parameters);
+
+    // the observations in frames i and j, td_i and td_j include the rolling shutter row delay
+    TimeShiftedPoint obs_i, obs_j;
+    Residual residual_model;
+    static Eigen::Matrix2d sqrt_info;
+};
+
+template <class Layout, class Residual>
+Eigen::Matrix2d ProjectionLayoutFactor<Layout, Residual>::sqrt_info = Eigen::Matrix2d::Identity();
+
+extern template class ProjectionLayoutFactor<TwoFrameOneCam, PlaneResidual>;
+extern template class ProjectionLayoutFactor<TwoFrameTwoCam, PlaneResidual>;
+extern template class ProjectionLayoutFactor<OneFrameTwoCam, PlaneResidual>;
+extern template class ProjectionLayoutFactor<TwoFrameOneCam, SphereResidual>;
+extern template class ProjectionLayoutFactor<TwoFrameTwoCam, SphereResidual>;
+extern template class ProjectionLayoutFactor<OneFrameTwoCam, SphereResidual>;
+
+// the same weight for all layouts of both residual models
+void setProjectionSqrtInfo(const Eigen::Matrix2d &sqrt_info);
+const Eigen::Matrix2d &projectionSqrtInfo();
@@ -11,26 +11,7 @@
 
 #pragma once
 
-#include <ros/assert.h>
-#include <ceres/ceres.h>
-#include <Eigen/Dense>
-#include "../utility/utility.h"
-#include "../utility/tic_toc.h"
-#include "../estimator/parameters.h"
+#include "projectionLayoutFactor.h"
 
-class ProjectionOneFrameTwoCamFactor : public ceres::SizedCostFunction<2, 7, 7, 1, 1>
-{
-  public:
-    ProjectionOneFrameTwoCamFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j,
-    				   			   const Eigen::Vector2d &_velocity_i, const Eigen::Vector2d &_velocity_j,
-    	   			   			   const double _td_i, const double _td_j);
-    virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const;
-    void check(double **parameters);
-
-    Eigen::Vector3d pts_i, pts_j;
-    Eigen::Vector3d velocity_i, velocity_j;
-    double td_i, td_j;
-    Eigen::Matrix<double, 2, 3> tangent_base;
-    static Eigen::Matrix2d sqrt_info;
-    static double sum_t;
-};
+// pinhole reprojection error, cameras 0 and 1 in the host frame
+typedef ProjectionLayoutFactor<OneFrameTwoCam, PlaneResidual> ProjectionOneFrameTwoCamFactor;
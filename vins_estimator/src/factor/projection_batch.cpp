@@ -0,0 +1,134 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <algorithm>
+#include <ros/assert.h>
+#include <ros/console.h>
+#include "projection_batch.h"
+#include "projectionLayoutFactor.h"
+
+// blocks of a record: [pose i, pose j,] ex pose 0, [ex pose 1,] inverse depth, td
+static int numBlocks(const ProjectionRecord &record)
+{
+    return 2 * record.two_frames + 1 + record.two_cams + 2;
+}
+
+ProjectionBatch::ProjectionBatch() : num_values(0), records_changed(true), with_jacobians(false)
+{
+#if VINS_CUDA_SOLVER
+    gpu = projection_gpu::available() ? projection_gpu::create() : NULL;
+#endif
+}
+
+ProjectionBatch::~ProjectionBatch()
+{
+#if VINS_CUDA_SOLVER
+    if (gpu)
+        projection_gpu::destroy(gpu);
+#endif
+}
+
+bool ProjectionBatch::onGpu() const
+{
+#if VINS_CUDA_SOLVER
+    return gpu != NULL;
+#else
+    return false;
+#endif
+}
+
+void ProjectionBatch::clear()
+{
+    records.clear();
+    block_offset.clear();
+    block_addr.clear();
+    block_size.clear();
+    num_values = 0;
+    records_changed = true;
+}
+
+int ProjectionBatch::add(const ceres::CostFunction *cost_function, double *const *parameters)
+{
+    const BatchedProjection *factor = dynamic_cast<const BatchedProjection *>(cost_function);
+    if (!factor)
+        return -1;
+    ProjectionRecord record;
+    factor->pack(record);
+    int count = numBlocks(record);
+    for (int k = 0; k < count; k++)
+    {
+        // the poses come first, then the inverse depth and td
+        int size = k < count - 2 ? 7 : 1;
+        auto it = block_offset.emplace(parameters[k], num_values);
+        if (it.second)
+        {
+            block_addr.push_back(parameters[k]);
+            block_size.push_back(size);
+            num_values += size;
+        }
+        record.params[k] = it.first->second;
+    }
+    records.push_back(record);
+    records_changed = true;
+    return records.size() - 1;
+}
+
+void ProjectionBatch::evaluate(bool jacobians)
+{
+    if (records.empty())
+        return;
+    values.resize(num_values);
+    double *next = values.data();
+    for (size_t i = 0; i < block_addr.size(); i++)
+        next = std::copy(block_addr[i], block_addr[i] + block_size[i], next);
+    residual_buf.resize(2 * records.size());
+    if (jacobians)
+        jacobian_buf.resize(PROJECTION_JACOBIAN_STRIDE * records.size());
+    with_jacobians = jacobians;
+
+    // row major, as Eigen::Matrix2d is column major
+    Eigen::Matrix2d info = projectionSqrtInfo().transpose();
+#if VINS_CUDA_SOLVER
+    if (gpu)
+    {
+        if (projection_gpu::evaluate(gpu, records.data(), records.size(), records_changed, values.data(),
+                                     values.size(), info.data(), residual_buf.data(),
+                                     jacobians ? jacobian_buf.data() : NULL))
+        {
+            records_changed = false;
+            return;
+        }
+        ROS_WARN("cuda error in the projection batch, evaluated on the cpu from now on");
+        projection_gpu::destroy(gpu);
+        gpu = NULL;
+    }
+#endif
+    for (size_t i = 0; i < records.size(); i++)
+        projection_kernel::evaluate(records[i], values.data(), info.data(), &residual_buf[2 * i],
+                                    jacobians ? &jacobian_buf[PROJECTION_JACOBIAN_STRIDE * i] : NULL);
+    records_changed = false;
+}
+
+void ProjectionBatch::copy(int record, double *residuals, double **jacobians) const
+{
+    residuals[0] = residual_buf[2 * record];
+    residuals[1] = residual_buf[2 * record + 1];
+    if (!jacobians)
+        return;
+    ROS_ASSERT(with_jacobians);
+    const double *src = &jacobian_buf[PROJECTION_JACOBIAN_STRIDE * record];
+    int count = numBlocks(records[record]);
+    for (int k = 0; k < count; k++)
+    {
+        int size = k < count - 2 ? 14 : 2;
+        if (jacobians[k])
+            std::copy(src, src + size, jacobians[k]);
+        src += size;
+    }
+}
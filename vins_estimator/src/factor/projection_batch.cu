@@ -0,0 +1,110 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <cuda_runtime.h>
+#include "projection_kernel.h"
+
+// one thread per record, a window is a few thousand
+static const int BLOCK_THREADS = 128;
+
+__global__ void projectionKernel(const ProjectionRecord *records, int count, const double *values,
+                                 const double *sqrt_info, double *residuals, double *jacobians)
+{
+    int i = blockIdx.x * blockDim.x + threadIdx.x;
+    if (i >= count)
+        return;
+    projection_kernel::evaluate(records[i], values, sqrt_info, residuals + 2 * i,
+                                jacobians ? jacobians + PROJECTION_JACOBIAN_STRIDE * i : NULL);
+}
+
+namespace projection_gpu
+{
+
+// device copies, grown to the largest problem seen
+template <typename T>
+struct DeviceArray
+{
+    DeviceArray() : data(NULL), capacity(0) {}
+    ~DeviceArray()
+    {
+        if (data)
+            cudaFree(data);
+    }
+    bool reserve(size_t n)
+    {
+        if (n <= capacity)
+            return true;
+        if (data)
+            cudaFree(data);
+        data = NULL;
+        capacity = 0;
+        if (cudaMalloc(&data, n * sizeof(T)) != cudaSuccess)
+            return false;
+        capacity = n;
+        return true;
+    }
+
+    T *data;
+    size_t capacity;
+};
+
+struct Buffers
+{
+    DeviceArray<ProjectionRecord> records;
+    DeviceArray<double> values, sqrt_info, residuals, jacobians;
+};
+
+bool available()
+{
+    int devices = 0;
+    return cudaGetDeviceCount(&devices) == cudaSuccess && devices > 0;
+}
+
+Buffers *create()
+{
+    return new Buffers();
+}
+
+void destroy(Buffers *buffers)
+{
+    delete buffers;
+}
+
+bool evaluate(Buffers *buffers, const ProjectionRecord *records, size_t count, bool records_changed,
+              const double *values, size_t num_values, const double *sqrt_info, double *residuals,
+              double *jacobians)
+{
+    // a reallocated record buffer has to be filled again
+    if (count > buffers->records.capacity)
+        records_changed = true;
+    if (!buffers->records.reserve(count) || !buffers->values.reserve(num_values) ||
+        !buffers->sqrt_info.reserve(4) || !buffers->residuals.reserve(2 * count) ||
+        (jacobians && !buffers->jacobians.reserve(PROJECTION_JACOBIAN_STRIDE * count)))
+        return false;
+    if (records_changed &&
+        cudaMemcpy(buffers->records.data, records, count * sizeof(ProjectionRecord), cudaMemcpyHostToDevice) != cudaSuccess)
+        return false;
+    if (cudaMemcpy(buffers->values.data, values, num_values * sizeof(double), cudaMemcpyHostToDevice) != cudaSuccess ||
+        cudaMemcpy(buffers->sqrt_info.data, sqrt_info, 4 * sizeof(double), cudaMemcpyHostToDevice) != cudaSuccess)
+        return false;
+
+    int grid = (count + BLOCK_THREADS - 1) / BLOCK_THREADS;
+    projectionKernel<<<grid, BLOCK_THREADS>>>(buffers->records.data, count, buffers->values.data,
+                                              buffers->sqrt_info.data, buffers->residuals.data,
+                                              jacobians ? buffers->jacobians.data : NULL);
+    if (cudaGetLastError() != cudaSuccess)
+        return false;
+    // the copies wait for the kernel
+    if (cudaMemcpy(residuals, buffers->residuals.data, 2 * count * sizeof(double), cudaMemcpyDeviceToHost) != cudaSuccess)
+        return false;
+    return !jacobians || cudaMemcpy(jacobians, buffers->jacobians.data, PROJECTION_JACOBIAN_STRIDE * count * sizeof(double),
+                                    cudaMemcpyDeviceToHost) == cudaSuccess;
+}
+
+}
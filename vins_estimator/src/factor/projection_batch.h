@@ -0,0 +1,56 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <ceres/ceres.h>
+#include "projection_kernel.h"
+
+// Residuals and jacobians of the ProjectionLayoutFactors of a problem in one pass instead of one
+// Evaluate call each. The factors are packed into records once, the parameter blocks they read
+// are gathered into one array at every evaluate(), which runs projection_kernel::evaluate over all
+// records: on the GPU with VINS_CUDA_SOLVER 1 (cmake) and a cuda device, otherwise in a loop on the
+// calling thread. copy() hands out the results of a record in the layout Evaluate writes, so the
+// robust loss, local parameterizations and sums of the caller stay as they are. Other cost
+// functions are not taken and are evaluated by the caller. copy() may be called from several
+// threads, everything else from one.
+class ProjectionBatch
+{
+  public:
+    ProjectionBatch();
+    ~ProjectionBatch();
+
+    // drops the records, the buffers are kept
+    void clear();
+    // the record of cost_function at the blocks parameters, -1 if it is not a ProjectionLayoutFactor
+    int add(const ceres::CostFunction *cost_function, double *const *parameters);
+    // every record at the current values of its blocks, the jacobians only with jacobians
+    void evaluate(bool jacobians);
+    // the residuals and the jacobians that are not NULL of record, from the last evaluate()
+    void copy(int record, double *residuals, double **jacobians) const;
+
+    size_t size() const { return records.size(); }
+    // evaluate() runs on the GPU
+    bool onGpu() const;
+
+  private:
+    std::vector<ProjectionRecord> records;
+    // the blocks of the records, at their offsets in values
+    std::unordered_map<const double *, int> block_offset;
+    std::vector<const double *> block_addr;
+    std::vector<int> block_size;
+    int num_values;
+    std::vector<double> values, residual_buf, jacobian_buf;
+    bool records_changed, with_jacobians;
+#if VINS_CUDA_SOLVER
+    projection_gpu::Buffers *gpu;
+#endif
+};
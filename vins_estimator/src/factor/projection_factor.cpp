@@ -10,7 +10,6 @@
 #include "projection_factor.h"
 
 Eigen::Matrix2d ProjectionFactor::sqrt_info;
-double ProjectionFactor::sum_t;
 
 ProjectionFactor::ProjectionFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j) : pts_i(_pts_i), pts_j(_pts_j)
 {
@@ -29,7 +28,6 @@ ProjectionFactor::ProjectionFactor(const Eigen::Vector3d &_pts_i, const Eigen::V
 
 bool ProjectionFactor::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
 {
-    TicToc tic_toc;
     Eigen::Vector3d Pi(parameters[0][0], parameters[0][1], parameters[0][2]);
     Eigen::Quaterniond Qi(parameters[0][6], parameters[0][3], parameters[0][4], parameters[0][5]);
 
@@ -124,7 +122,6 @@ bool ProjectionFactor::Evaluate(double const *const *parameters, double *residua
 #endif
         }
     }
-    sum_t += tic_toc.toc();
 
     return true;
 }
@@ -0,0 +1,340 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+
+#ifndef VINS_CUDA_SOLVER
+#define VINS_CUDA_SOLVER 0
+#endif
+
+#ifdef __CUDACC__
+#define VINS_HD __host__ __device__
+#else
+#define VINS_HD
+#endif
+
+// ProjectionLayoutFactor::Evaluate on plain arrays, compiled by nvcc for ProjectionBatch's kernel
+// and by the host compiler for its cpu loop, so both give the same numbers as the factor.
+
+// one ProjectionLayoutFactor, filled by its pack()
+struct ProjectionRecord
+{
+    double pts_i[3], velocity_i[3], td_i;
+    double pts_j[3], velocity_j[3], td_j;
+    double tangent[6];  // SphereResidual::tangent_base, row major
+    int two_frames, two_cams, sphere;
+    // offsets of the parameter blocks in the packed values, in the factor's order
+    int params[6];
+};
+
+// doubles of the jacobians of one record: 4 poses of 2x7, the inverse depth and td of 2x1
+enum { PROJECTION_JACOBIAN_STRIDE = 60 };
+
+namespace projection_kernel
+{
+
+// 3x3 matrices are row major double[9]
+
+// q is x, y, z, w as in the pose blocks, like Eigen::Quaterniond::toRotationMatrix
+VINS_HD inline void rotation(const double *q, double *R)
+{
+    double x = q[0], y = q[1], z = q[2], w = q[3];
+    R[0] = 1 - 2 * (y * y + z * z);
+    R[1] = 2 * (x * y - w * z);
+    R[2] = 2 * (x * z + w * y);
+    R[3] = 2 * (x * y + w * z);
+    R[4] = 1 - 2 * (x * x + z * z);
+    R[5] = 2 * (y * z - w * x);
+    R[6] = 2 * (x * z - w * y);
+    R[7] = 2 * (y * z + w * x);
+    R[8] = 1 - 2 * (x * x + y * y);
+}
+
+// y = A x, or A' x with transpose
+VINS_HD inline void mulVec(const double *A, const double *x, double *y, bool transpose = false)
+{
+    for (int r = 0; r < 3; r++)
+        y[r] = transpose ? A[r] * x[0] + A[3 + r] * x[1] + A[6 + r] * x[2]
+                         : A[3 * r] * x[0] + A[3 * r + 1] * x[1] + A[3 * r + 2] * x[2];
+}
+
+// C = A B, or A' B with transpose
+VINS_HD inline void mulMat(const double *A, const double *B, double *C, bool transpose = false)
+{
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 3; c++)
+        {
+            double sum = 0;
+            for (int k = 0; k < 3; k++)
+                sum += (transpose ? A[3 * k + r] : A[3 * r + k]) * B[3 * k + c];
+            C[3 * r + c] = sum;
+        }
+}
+
+VINS_HD inline void skew(const double *v, double *S)
+{
+    S[0] = 0;
+    S[1] = -v[2];
+    S[2] = v[1];
+    S[3] = v[2];
+    S[4] = 0;
+    S[5] = -v[0];
+    S[6] = -v[1];
+    S[7] = v[0];
+    S[8] = 0;
+}
+
+// out (2x3) = A (2x3) B (3x3)
+VINS_HD inline void mul23(const double *A, const double *B, double *out)
+{
+    for (int r = 0; r < 2; r++)
+        for (int c = 0; c < 3; c++)
+            out[3 * r + c] = A[3 * r] * B[c] + A[3 * r + 1] * B[3 + c] + A[3 * r + 2] * B[6 + c];
+}
+
+// d(x / |x|) / dx, SphereResidual::normalizeJacobian
+VINS_HD inline void normalizeJacobian(const double *x, double *N)
+{
+    double sq = x[0] * x[0] + x[1] * x[1] + x[2] * x[2];
+    double norm = sqrt(sq);
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 3; c++)
+            N[3 * r + c] = ((r == c ? 1.0 : 0.0) - x[r] * x[c] / sq) / norm;
+}
+
+// a pose jacobian (2x7 row major) of reduce * [L R], the last column zero as in the factor
+VINS_HD inline void poseJacobian(const double *reduce, const double *L, const double *R, double *out)
+{
+    double a[6], b[6];
+    mul23(reduce, L, a);
+    mul23(reduce, R, b);
+    for (int r = 0; r < 2; r++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            out[7 * r + c] = a[3 * r + c];
+            out[7 * r + 3 + c] = b[3 * r + c];
+        }
+        out[7 * r + 6] = 0;
+    }
+}
+
+// residual (2) and, when jacobian is not NULL, the jacobians of the record's blocks one after the
+// other in the factor's order and layout. values holds the parameter blocks, sqrt_info is row major.
+VINS_HD inline void evaluate(const ProjectionRecord &rec, const double *values, const double *sqrt_info,
+                             double *residual, double *jacobian)
+{
+    int k = 0;
+    const double *pose_i = rec.two_frames ? values + rec.params[k++] : NULL;
+    const double *pose_j = rec.two_frames ? values + rec.params[k++] : NULL;
+    const double *ex_0 = values + rec.params[k++];
+    const double *ex_1 = rec.two_cams ? values + rec.params[k++] : NULL;
+    double inv_dep_i = values[rec.params[k++]];
+    double td = values[rec.params[k++]];
+    // camera j is camera 1 with two cameras, otherwise camera 0 again
+    const double *ex_j = rec.two_cams ? ex_1 : ex_0;
+
+    double ric[9], ric_j[9];
+    rotation(ex_0 + 3, ric);
+    rotation(ex_j + 3, ric_j);
+
+    double pts_i_td[3], pts_j_td[3], pts_camera_i[3], pts_imu_i[3], pts_imu_j[3], pts_camera_j[3], tmp[3];
+    for (int c = 0; c < 3; c++)
+    {
+        pts_i_td[c] = rec.pts_i[c] - (td - rec.td_i) * rec.velocity_i[c];
+        pts_j_td[c] = rec.pts_j[c] - (td - rec.td_j) * rec.velocity_j[c];
+        pts_camera_i[c] = pts_i_td[c] / inv_dep_i;
+    }
+    mulVec(ric, pts_camera_i, pts_imu_i);
+    for (int c = 0; c < 3; c++)
+        pts_imu_i[c] += ex_0[c];
+
+    double Ri[9], Rj[9];
+    if (rec.two_frames)
+    {
+        rotation(pose_i + 3, Ri);
+        rotation(pose_j + 3, Rj);
+        double pts_w[3];
+        mulVec(Ri, pts_imu_i, pts_w);
+        for (int c = 0; c < 3; c++)
+            tmp[c] = pts_w[c] + pose_i[c] - pose_j[c];
+        mulVec(Rj, tmp, pts_imu_j, true);
+    }
+    else
+        for (int c = 0; c < 3; c++)
+            pts_imu_j[c] = pts_imu_i[c];
+    for (int c = 0; c < 3; c++)
+        tmp[c] = pts_imu_j[c] - ex_j[c];
+    mulVec(ric_j, tmp, pts_camera_j, true);
+
+    // the residual model and its derivatives by the point in camera j and the observation
+    double e[2], reduce_model[6], observation[6];
+    if (rec.sphere)
+    {
+        double n_c = sqrt(pts_camera_j[0] * pts_camera_j[0] + pts_camera_j[1] * pts_camera_j[1] +
+                          pts_camera_j[2] * pts_camera_j[2]);
+        double n_j = sqrt(pts_j_td[0] * pts_j_td[0] + pts_j_td[1] * pts_j_td[1] + pts_j_td[2] * pts_j_td[2]);
+        for (int r = 0; r < 2; r++)
+        {
+            e[r] = 0;
+            for (int c = 0; c < 3; c++)
+                e[r] += rec.tangent[3 * r + c] * (pts_camera_j[c] / n_c - pts_j_td[c] / n_j);
+        }
+        if (jacobian)
+        {
+            double N[9];
+            normalizeJacobian(pts_camera_j, N);
+            mul23(rec.tangent, N, reduce_model);
+            normalizeJacobian(pts_j_td, N);
+            mul23(rec.tangent, N, observation);
+            for (int i = 0; i < 6; i++)
+                observation[i] = -observation[i];
+        }
+    }
+    else
+    {
+        double dep_j = pts_camera_j[2];
+        e[0] = pts_camera_j[0] / dep_j - pts_j_td[0];
+        e[1] = pts_camera_j[1] / dep_j - pts_j_td[1];
+        reduce_model[0] = 1. / dep_j;
+        reduce_model[1] = 0;
+        reduce_model[2] = -pts_camera_j[0] / (dep_j * dep_j);
+        reduce_model[3] = 0;
+        reduce_model[4] = 1. / dep_j;
+        reduce_model[5] = -pts_camera_j[1] / (dep_j * dep_j);
+        observation[0] = -1;
+        observation[1] = 0;
+        observation[2] = 0;
+        observation[3] = 0;
+        observation[4] = -1;
+        observation[5] = 0;
+    }
+    residual[0] = sqrt_info[0] * e[0] + sqrt_info[1] * e[1];
+    residual[1] = sqrt_info[2] * e[0] + sqrt_info[3] * e[1];
+    if (!jacobian)
+        return;
+
+    double reduce[6], sqrt_observation[6];
+    for (int r = 0; r < 2; r++)
+        for (int c = 0; c < 3; c++)
+        {
+            reduce[3 * r + c] = sqrt_info[2 * r] * reduce_model[c] + sqrt_info[2 * r + 1] * reduce_model[3 + c];
+            sqrt_observation[3 * r + c] = sqrt_info[2 * r] * observation[c] + sqrt_info[2 * r + 1] * observation[3 + c];
+        }
+
+    // camera j <---- imu frame i
+    double r_cj_bi[9], ric_j_t[9], r_cj_bj[9];
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 3; c++)
+            ric_j_t[3 * r + c] = ric_j[3 * c + r];
+    if (rec.two_frames)
+    {
+        // ric_j' Rj' = (Rj ric_j)'
+        double rj_ric_j[9];
+        mulMat(Rj, ric_j, rj_ric_j);
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 3; c++)
+                r_cj_bj[3 * r + c] = rj_ric_j[3 * c + r];
+        mulMat(r_cj_bj, Ri, r_cj_bi);
+    }
+    else
+        for (int i = 0; i < 9; i++)
+            r_cj_bi[i] = ric_j_t[i];
+
+    double L[9], R[9], S[9], M[9];
+    double *out = jacobian;
+    if (rec.two_frames)
+    {
+        // pose i
+        skew(pts_imu_i, S);
+        mulMat(r_cj_bi, S, R);
+        for (int i = 0; i < 9; i++)
+            R[i] = -R[i];
+        poseJacobian(reduce, r_cj_bj, R, out);
+        out += 14;
+
+        // pose j
+        for (int i = 0; i < 9; i++)
+            L[i] = -r_cj_bj[i];
+        skew(pts_imu_j, S);
+        mulMat(ric_j_t, S, R);
+        poseJacobian(reduce, L, R, out);
+        out += 14;
+    }
+
+    // ex pose 0
+    double r_cj_ci[9];
+    mulMat(r_cj_bi, ric, r_cj_ci);
+    skew(pts_camera_i, S);
+    mulMat(r_cj_ci, S, R);
+    for (int i = 0; i < 9; i++)
+    {
+        L[i] = r_cj_bi[i];
+        R[i] = -R[i];
+    }
+    skew(pts_camera_j, S);
+    if (!rec.two_cams)
+        // camera 0 is also camera j
+        for (int i = 0; i < 9; i++)
+        {
+            L[i] -= ric_j_t[i];
+            R[i] += S[i];
+        }
+    poseJacobian(reduce, L, R, out);
+    out += 14;
+
+    // ex pose 1
+    if (rec.two_cams)
+    {
+        for (int i = 0; i < 9; i++)
+            M[i] = -ric_j_t[i];
+        poseJacobian(reduce, M, S, out);
+        out += 14;
+    }
+
+    // inverse depth, d pts_camera_j / d inv_dep_i = r_cj_ci * pts_i_td * -1 / inv_dep_i^2
+    double d[3];
+    mulVec(r_cj_ci, pts_i_td, d);
+    for (int r = 0; r < 2; r++)
+        out[r] = (reduce[3 * r] * d[0] + reduce[3 * r + 1] * d[1] + reduce[3 * r + 2] * d[2]) * -1.0 /
+                 (inv_dep_i * inv_dep_i);
+    out += 2;
+
+    // td
+    mulVec(r_cj_ci, rec.velocity_i, d);
+    for (int r = 0; r < 2; r++)
+        out[r] = (reduce[3 * r] * d[0] + reduce[3 * r + 1] * d[1] + reduce[3 * r + 2] * d[2]) / inv_dep_i * -1.0 -
+                 (sqrt_observation[3 * r] * rec.velocity_j[0] + sqrt_observation[3 * r + 1] * rec.velocity_j[1] +
+                  sqrt_observation[3 * r + 2] * rec.velocity_j[2]);
+}
+
+}
+
+#if VINS_CUDA_SOLVER
+// projection_batch.cu
+namespace projection_gpu
+{
+
+struct Buffers;
+
+// a cuda device is there
+bool available();
+Buffers *create();
+void destroy(Buffers *buffers);
+// runs evaluate over the records, uploaded again with records_changed; jacobians NULL for the
+// residuals only. False on a cuda error
+bool evaluate(Buffers *buffers, const ProjectionRecord *records, size_t count, bool records_changed,
+              const double *values, size_t num_values, const double *sqrt_info, double *residuals,
+              double *jacobians);
+
+}
+#endif
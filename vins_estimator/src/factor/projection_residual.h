@@ -0,0 +1,89 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <Eigen/Dense>
+
+// Residual models of the projection factors, a template argument of ProjectionLayoutFactor so the
+// model is compiled into Evaluate. The estimator picks one from unit_sphere_error at startup.
+// Each keeps what it precomputes from the observation and gives the residual and its jacobians
+// with respect to the point in camera j and the (time shifted) observation.
+
+// Error on the normalized image plane of camera j, for pinhole cameras
+struct PlaneResidual
+{
+    void init(const Eigen::Vector3d &pts_j)
+    {
+    }
+
+    Eigen::Vector2d residual(const Eigen::Vector3d &pts_camera_j, const Eigen::Vector3d &pts_j_td) const
+    {
+        return (pts_camera_j / pts_camera_j.z()).head<2>() - pts_j_td.head<2>();
+    }
+
+    Eigen::Matrix<double, 2, 3> reduce(const Eigen::Vector3d &pts_camera_j) const
+    {
+        double dep_j = pts_camera_j.z();
+        Eigen::Matrix<double, 2, 3> reduce;
+        reduce << 1. / dep_j, 0, -pts_camera_j(0) / (dep_j * dep_j),
+            0, 1. / dep_j, -pts_camera_j(1) / (dep_j * dep_j);
+        return reduce;
+    }
+
+    Eigen::Matrix<double, 2, 3> observationJacobian(const Eigen::Vector3d &pts_j_td) const
+    {
+        Eigen::Matrix<double, 2, 3> jacobian;
+        jacobian << -1, 0, 0,
+            0, -1, 0;
+        return jacobian;
+    }
+};
+
+// Error between the bearing vectors on the tangent plane of the observation, for fisheye and
+// wide angle cameras where points reach or pass 90 degrees off the optical axis
+struct SphereResidual
+{
+    void init(const Eigen::Vector3d &pts_j)
+    {
+        Eigen::Vector3d b1, b2;
+        Eigen::Vector3d a = pts_j.normalized();
+        Eigen::Vector3d tmp(0, 0, 1);
+        if(a == tmp)
+            tmp << 1, 0, 0;
+        b1 = (tmp - a * (a.transpose() * tmp)).normalized();
+        b2 = a.cross(b1);
+        tangent_base.block<1, 3>(0, 0) = b1.transpose();
+        tangent_base.block<1, 3>(1, 0) = b2.transpose();
+    }
+
+    Eigen::Vector2d residual(const Eigen::Vector3d &pts_camera_j, const Eigen::Vector3d &pts_j_td) const
+    {
+        return tangent_base * (pts_camera_j.normalized() - pts_j_td.normalized());
+    }
+
+    Eigen::Matrix<double, 2, 3> reduce(const Eigen::Vector3d &pts_camera_j) const
+    {
+        return tangent_base * normalizeJacobian(pts_camera_j);
+    }
+
+    Eigen::Matrix<double, 2, 3> observationJacobian(const Eigen::Vector3d &pts_j_td) const
+    {
+        return -tangent_base * normalizeJacobian(pts_j_td);
+    }
+
+    // d(x / |x|) / dx
+    static Eigen::Matrix3d normalizeJacobian(const Eigen::Vector3d &x)
+    {
+        double norm = x.norm();
+        return (Eigen::Matrix3d::Identity() - x * x.transpose() / (norm * norm)) / norm;
+    }
+
+    Eigen::Matrix<double, 2, 3> tangent_base;
+};
@@ -0,0 +1,48 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <limits>
+#include <Eigen/Dense>
+
+// One observation of a feature moved to the time of the current td estimate,
+// point - (td - td_obs) * velocity. td_obs is the time offset of the observation, which on a rolling
+// shutter camera includes the readout delay of its row (FeaturePerFrame::rollingShutter).
+// The shifted point is kept for the td it was computed at and only recomputed when para_Td changes,
+// which is never with estimate_td 0. The cache is not locked: ceres, WindowSolver and the
+// marginalization evaluate a residual block on one thread at a time.
+struct TimeShiftedPoint
+{
+    void reset(const Eigen::Vector3d &_point, const Eigen::Vector2d &_velocity, double _td_obs)
+    {
+        point = _point;
+        velocity << _velocity.x(), _velocity.y(), 0;
+        td_obs = _td_obs;
+        cached_td = std::numeric_limits<double>::quiet_NaN();
+    }
+
+    // NaN compares unequal, so the first call always computes
+    const Eigen::Vector3d &at(double td) const
+    {
+        if (td != cached_td)
+        {
+            shifted = point - (td - td_obs) * velocity;
+            cached_td = td;
+        }
+        return shifted;
+    }
+
+    Eigen::Vector3d point, velocity;
+    double td_obs;
+
+  private:
+    mutable Eigen::Vector3d shifted;
+    mutable double cached_td;
+};
@@ -0,0 +1,164 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "adaptive_backend.h"
+
+// frames between probes once every candidate has been measured, and before that
+static const int PROBE_PERIOD = 300;
+static const int FIRST_PROBE_PERIOD = 30;
+static const int PROBE_FRAMES = 10;
+// a candidate replaces the current backend when it is this much faster
+static const double HYSTERESIS = 0.15;
+static const double ALPHA = 0.2;
+
+AdaptiveTrackerBackend::AdaptiveTrackerBackend(const Parameters &_params, int _width, int _height,
+                                               const vector<TrackerBackend *> &_candidates)
+    : TrackerBackend(_params, _width, _height), candidates(_candidates), average(_candidates.size(), -1),
+      active(0), home(0), frames(0), probe(0), probe_frames(0), skip_frame(true)
+{
+    for (int i = 0; i < NUM_STAGES; i++)
+    {
+        stage_us[i] = 0;
+        stage_average[i] = 0;
+    }
+}
+
+AdaptiveTrackerBackend::~AdaptiveTrackerBackend()
+{
+    for (TrackerBackend *backend : candidates)
+        delete backend;
+}
+
+void AdaptiveTrackerBackend::add(Stage stage, TicToc &t)
+{
+    stage_us[stage] += static_cast<long long>(t.toc() * 1000);
+}
+
+void AdaptiveTrackerBackend::setImage(const cv::Mat &img)
+{
+    frame_time.tic();
+    TicToc t;
+    cur_image = img;
+    candidates[active]->setImage(img);
+    add(SET_IMAGE, t);
+}
+
+void AdaptiveTrackerBackend::setRightImage(const cv::Mat &img)
+{
+    TicToc t;
+    candidates[active]->setRightImage(img);
+    add(SET_RIGHT_IMAGE, t);
+}
+
+void AdaptiveTrackerBackend::trackTemporal(const vector<cv::Point2f> &prev_pts, vector<cv::Point2f> &cur_pts,
+                                           vector<uchar> &status, bool use_prediction)
+{
+    TicToc t;
+    candidates[active]->trackTemporal(prev_pts, cur_pts, status, use_prediction);
+    add(TEMPORAL, t);
+}
+
+void AdaptiveTrackerBackend::trackStereo(const vector<cv::Point2f> &left_pts, vector<cv::Point2f> &right_pts,
+                                         vector<uchar> &status)
+{
+    TicToc t;
+    candidates[active]->trackStereo(left_pts, right_pts, status);
+    add(STEREO, t);
+}
+
+void AdaptiveTrackerBackend::detect(const cv::Mat &img, const cv::Mat &mask, int max_cnt, vector<cv::Point2f> &pts)
+{
+    TicToc t;
+    candidates[active]->detect(img, mask, max_cnt, pts);
+    add(DETECT, t);
+}
+
+bool AdaptiveTrackerBackend::detectRegion(const cv::Mat &img, const cv::Mat &mask, const cv::Rect &roi, int max_cnt,
+                                          vector<cv::Point2f> &pts)
+{
+    TicToc t;
+    bool done = candidates[active]->detectRegion(img, mask, roi, max_cnt, pts);
+    add(DETECT, t);
+    return done;
+}
+
+void AdaptiveTrackerBackend::setMinDist(int _min_dist)
+{
+    min_dist = _min_dist;
+    for (TrackerBackend *candidate : candidates)
+        candidate->setMinDist(_min_dist);
+}
+
+void AdaptiveTrackerBackend::nextFrame()
+{
+    TicToc t;
+    candidates[active]->nextFrame();
+    add(NEXT_FRAME, t);
+
+    double cost = frame_time.toc();
+    for (int i = 0; i < NUM_STAGES; i++)
+        stage_average[i] = (1 - ALPHA) * stage_average[i] + ALPHA * stage_us[i].exchange(0) / 1000.0;
+    int next = choose(cost);
+    if (next != active)
+        switchTo(next);
+    cur_image.release();
+}
+
+int AdaptiveTrackerBackend::choose(double cost)
+{
+    if (skip_frame)
+        skip_frame = false;
+    else if (average[active] < 0)
+        average[active] = cost;
+    else
+        average[active] = (1 - ALPHA) * average[active] + ALPHA * cost;
+    frames++;
+
+    if (probe_frames > 0)
+    {
+        if (--probe_frames > 0)
+            return active;
+        if (average[active] >= 0 && average[active] < average[home] * (1 - HYSTERESIS))
+        {
+            ROS_INFO("tracker backend %s -> %s: %.2f vs %.2f ms per frame", candidates[home]->name(),
+                     candidates[active]->name(), average[active], average[home]);
+            home = active;
+        }
+        return home;
+    }
+
+    bool measured = true;
+    for (double a : average)
+        measured = measured && a >= 0;
+    if (frames % (measured ? PROBE_PERIOD : FIRST_PROBE_PERIOD) != 0 || average[home] < 0)
+        return home;
+    probe = (probe + 1) % candidates.size();
+    if (probe == home)
+        probe = (probe + 1) % candidates.size();
+    // measured afresh, the load on the device may have changed since
+    average[probe] = -1;
+    probe_frames = PROBE_FRAMES;
+    return probe;
+}
+
+void AdaptiveTrackerBackend::switchTo(int next)
+{
+    ROS_DEBUG("tracker backend %s (%.2f ms per frame; summed over the calls: image %.2f right %.2f temporal %.2f "
+              "stereo %.2f detect %.2f next %.2f ms) -> %s",
+              candidates[active]->name(), average[active], stage_average[SET_IMAGE], stage_average[SET_RIGHT_IMAGE],
+              stage_average[TEMPORAL], stage_average[STEREO], stage_average[DETECT], stage_average[NEXT_FRAME],
+              candidates[next]->name());
+    // the image of this frame becomes the previous one of the new backend
+    candidates[next]->setImage(cur_image);
+    candidates[next]->nextFrame();
+    active = next;
+    skip_frame = true;
+    for (int i = 0; i < NUM_STAGES; i++)
+        stage_average[i] = 0;
+}
@@ -0,0 +1,78 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <atomic>
+
+#include "tracker_backend.h"
+#include "../utility/tic_toc.h"
+
+// Runs one of several backends and moves to another at a frame boundary once that one is
+// consistently faster. The wall time of a frame, from setImage to the end of nextFrame, is averaged
+// per backend, so a backend that runs its cells or the stereo side in parallel is credited for it;
+// every PROBE_PERIOD frames the next candidate takes over for PROBE_FRAMES frames to
+// refresh its average, and stays only when it beats the current one by HYSTERESIS.
+// On a switch the new backend gets the current image as its previous one, the tracks go on.
+class AdaptiveTrackerBackend : public TrackerBackend
+{
+  public:
+    // owns the candidates, the first one starts
+    AdaptiveTrackerBackend(const Parameters &_params, int _width, int _height,
+                           const vector<TrackerBackend *> &_candidates);
+    virtual ~AdaptiveTrackerBackend();
+
+    virtual const char *name() const { return "adaptive"; }
+    virtual void setImage(const cv::Mat &img);
+    virtual void setRightImage(const cv::Mat &img);
+    virtual void trackTemporal(const vector<cv::Point2f> &prev_pts, vector<cv::Point2f> &cur_pts,
+                               vector<uchar> &status, bool use_prediction);
+    virtual void trackStereo(const vector<cv::Point2f> &left_pts, vector<cv::Point2f> &right_pts,
+                             vector<uchar> &status);
+    virtual void detect(const cv::Mat &img, const cv::Mat &mask, int max_cnt, vector<cv::Point2f> &pts);
+    virtual bool detectRegion(const cv::Mat &img, const cv::Mat &mask, const cv::Rect &roi, int max_cnt,
+                              vector<cv::Point2f> &pts);
+    virtual void nextFrame();
+    virtual void setMinDist(int _min_dist);
+
+  private:
+    enum Stage
+    {
+        SET_IMAGE,
+        SET_RIGHT_IMAGE,
+        TEMPORAL,
+        STEREO,
+        DETECT,
+        NEXT_FRAME,
+        NUM_STAGES
+    };
+
+    void add(Stage stage, TicToc &t);
+    // the backend for the next frame after active has run this one for cost ms
+    int choose(double cost);
+    void switchTo(int next);
+
+    vector<TrackerBackend *> candidates;
+    // ms per frame, -1 while not measured
+    vector<double> average;
+    int active;
+    int home;  // the one kept between probes
+    int frames;
+    int probe;  // the candidate of the last probe
+    int probe_frames;  // left in the current probe, 0 when none
+    bool skip_frame;  // the first frame after a switch pays for allocations
+    // from setImage, the wall time of the current frame
+    TicToc frame_time;
+    // us of the current frame summed over the calls of each stage, which overlap (the stereo and
+    // cell calls come from other threads); only for the log
+    std::atomic<long long> stage_us[NUM_STAGES];
+    // of the active backend since it took over, for the log
+    double stage_average[NUM_STAGES];
+    cv::Mat cur_image;  // valid until nextFrame, for the previous image of a switch
+};
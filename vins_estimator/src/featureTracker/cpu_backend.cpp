@@ -0,0 +1,135 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "cpu_backend.h"
+
+CpuTrackerBackend::CpuTrackerBackend(const Parameters &_params, int _width, int _height)
+    : TrackerBackend(_params, _width, _height)
+{
+    if (params.EQUALIZE)
+    {
+        clahe = cv::createCLAHE(3.0, cv::Size(8, 8));
+        clahe_right = cv::createCLAHE(3.0, cv::Size(8, 8));
+    }
+}
+
+void CpuTrackerBackend::setImage(const cv::Mat &img)
+{
+    cur_pyr.build(img, 3, clahe.get());
+}
+
+void CpuTrackerBackend::setRightImage(const cv::Mat &img)
+{
+    right_pyr.build(img, 3, clahe_right.get());
+}
+
+const cv::Mat &CpuTrackerBackend::detectImage(const cv::Mat &img)
+{
+    return params.EQUALIZE ? cur_pyr.img[0] : img;
+}
+
+void CpuTrackerBackend::trackTemporal(const vector<cv::Point2f> &prev_pts, vector<cv::Point2f> &cur_pts,
+                                      vector<uchar> &status, bool use_prediction)
+{
+    if(use_prediction)
+    {
+        // the prediction is good to a few pixels, prediction_lk_levels above the image are enough
+        parallelLK(prev_pyr, cur_pyr, prev_pts, cur_pts, status, params.PREDICTION_LK_LEVELS, true, 21,
+                   params.PREDICTION_LK_ITERATIONS);
+
+        int succ_num = 0;
+        for (size_t i = 0; i < status.size(); i++)
+        {
+            if (status[i])
+                succ_num++;
+        }
+        if (succ_num < 10)
+            parallelLK(prev_pyr, cur_pyr, prev_pts, cur_pts, status, 3, false);
+    }
+    else
+        parallelLK(prev_pyr, cur_pyr, prev_pts, cur_pts, status, 3, false);
+    // reverse check
+    if(params.FLOW_BACK)
+    {
+        vector<uchar> reverse_status;
+        vector<cv::Point2f> reverse_pts = prev_pts;
+        parallelLK(cur_pyr, prev_pyr, cur_pts, reverse_pts, reverse_status, 1, true);
+        reverseCheck(status, reverse_status, prev_pts, reverse_pts);
+    }
+}
+
+void CpuTrackerBackend::trackStereo(const vector<cv::Point2f> &left_pts, vector<cv::Point2f> &right_pts,
+                                    vector<uchar> &status)
+{
+    // cur left ---- cur right
+    parallelLK(cur_pyr, right_pyr, left_pts, right_pts, status, 3, false);
+    // reverse check cur right ---- cur left
+    if(params.FLOW_BACK)
+    {
+        vector<cv::Point2f> reverseLeftPts;
+        vector<uchar> statusRightLeft;
+        parallelLK(right_pyr, cur_pyr, right_pts, reverseLeftPts, statusRightLeft, 3, false);
+        reverseCheck(status, statusRightLeft, left_pts, reverseLeftPts);
+    }
+}
+
+// FAST with non-max suppression, then the max_cnt strongest responses at least min_dist apart
+static void detectFast(const cv::Mat &img, const cv::Mat &mask, int max_cnt, int threshold, int min_dist,
+                       vector<cv::Point2f> &pts)
+{
+    vector<cv::KeyPoint> kps;
+    cv::FAST(img, kps, threshold, true);
+    sort(kps.begin(), kps.end(), [](const cv::KeyPoint &a, const cv::KeyPoint &b)
+         {
+            return a.response > b.response;
+         });
+
+    cv::Mat free_mask = mask.clone();
+    pts.clear();
+    for (auto &kp : kps)
+    {
+        if (static_cast<int>(pts.size()) >= max_cnt)
+            break;
+        cv::Point p(kp.pt);
+        if (free_mask.at<uchar>(p) == 0)
+            continue;
+        pts.push_back(kp.pt);
+        cv::circle(free_mask, p, min_dist, 0, -1);
+    }
+}
+
+void CpuTrackerBackend::detect(const cv::Mat &_img, const cv::Mat &mask, int max_cnt, vector<cv::Point2f> &pts)
+{
+    const cv::Mat &img = detectImage(_img);
+    if (params.DETECTOR_TYPE == 1)
+        detectFast(img, mask, max_cnt, params.FAST_THRESHOLD, min_dist, pts);
+    else
+        cv::goodFeaturesToTrack(img, pts, max_cnt, 0.01, min_dist, mask);
+}
+
+bool CpuTrackerBackend::detectRegion(const cv::Mat &_img, const cv::Mat &mask, const cv::Rect &roi, int max_cnt,
+                                     vector<cv::Point2f> &pts)
+{
+    const cv::Mat &img = detectImage(_img);
+    if (params.DETECTOR_TYPE == 1)
+        detectFast(img(roi), mask(roi), max_cnt, params.FAST_THRESHOLD, min_dist, pts);
+    else
+        cv::goodFeaturesToTrack(img(roi), pts, max_cnt, 0.01, min_dist, mask(roi));
+    for (auto &p : pts)
+    {
+        p.x += roi.x;
+        p.y += roi.y;
+    }
+    return true;
+}
+
+void CpuTrackerBackend::nextFrame()
+{
+    prev_pyr.swap(cur_pyr);
+}
@@ -0,0 +1,42 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include "tracker_backend.h"
+#include "parallel_lk.h"
+
+// CPU implementation; each pyramid and its gradients are built once per frame and shared by all LK
+// calls, which split their points over the OpenCV worker threads (parallelLK). With EQUALIZE the
+// CLAHE output is written straight into level 0 and the detectors run on it.
+class CpuTrackerBackend : public TrackerBackend
+{
+  public:
+    CpuTrackerBackend(const Parameters &_params, int _width, int _height);
+
+    virtual const char *name() const { return "cpu"; }
+    virtual void setImage(const cv::Mat &img);
+    virtual void setRightImage(const cv::Mat &img);
+    virtual void trackTemporal(const vector<cv::Point2f> &prev_pts, vector<cv::Point2f> &cur_pts,
+                               vector<uchar> &status, bool use_prediction);
+    virtual void trackStereo(const vector<cv::Point2f> &left_pts, vector<cv::Point2f> &right_pts,
+                             vector<uchar> &status);
+    virtual void detect(const cv::Mat &img, const cv::Mat &mask, int max_cnt, vector<cv::Point2f> &pts);
+    virtual bool detectRegion(const cv::Mat &img, const cv::Mat &mask, const cv::Rect &roi, int max_cnt,
+                              vector<cv::Point2f> &pts);
+    virtual void nextFrame();
+
+  protected:
+    // the left image the CPU detectors run on: img, or its equalized version with EQUALIZE
+    virtual const cv::Mat &detectImage(const cv::Mat &img);
+
+    LKPyramid prev_pyr, cur_pyr, right_pyr;
+    // one per image, the right one may be equalized while the left is tracked
+    cv::Ptr<cv::CLAHE> clahe, clahe_right;
+};
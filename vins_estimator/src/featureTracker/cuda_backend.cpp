@@ -0,0 +1,203 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "cuda_backend.h"
+
+CudaTrackerBackend::CudaTrackerBackend(const Parameters &_params, int _width, int _height, bool _gpu_flow,
+                                       bool _gpu_detect)
+    : CpuTrackerBackend(_params, _width, _height), gpu_flow(_gpu_flow), gpu_detect(_gpu_detect), equalized_ready(false)
+{
+    lk_predict = cv::cuda::SparsePyrLKOpticalFlow::create(cv::Size(21, 21), params.PREDICTION_LK_LEVELS,
+                                                          params.PREDICTION_LK_ITERATIONS, true);
+    lk_full = cv::cuda::SparsePyrLKOpticalFlow::create(cv::Size(21, 21), 3, 30, false);
+    // created for MAX_CNT, and again only when min_dist changes; corners come out strongest first,
+    // so keeping the first max_cnt gives the same set as a detector sized for max_cnt
+    if (gpu_detect)
+        detector = cv::cuda::createGoodFeaturesToTrackDetector(CV_8UC1, params.MAX_CNT, 0.01, min_dist);
+    if (gpu_flow && params.EQUALIZE)
+    {
+        gpu_clahe = cv::cuda::createCLAHE(3.0, cv::Size(8, 8));
+        gpu_clahe_right = cv::cuda::createCLAHE(3.0, cv::Size(8, 8));
+    }
+}
+
+void CudaTrackerBackend::reverseCheckDevice(const cv::cuda::GpuMat &pts, const cv::cuda::GpuMat &reverse_pts,
+                                            const cv::cuda::GpuMat &reverse_status, cv::cuda::GpuMat &status,
+                                            ReverseCheck &scratch, cv::cuda::Stream &s)
+{
+    // the points are 1xN CV_32FC2, magnitude takes the interleaved x/y; compare gives 255 or 0 and
+    // the status stays 0 or 1 through the ands
+    cv::cuda::subtract(pts, reverse_pts, scratch.diff, cv::noArray(), -1, s);
+    cv::cuda::magnitude(scratch.diff, scratch.dist, s);
+    cv::cuda::compare(scratch.dist, cv::Scalar::all(0.5), scratch.close, cv::CMP_LE, s);
+    cv::cuda::bitwise_and(status, reverse_status, status, cv::noArray(), s);
+    cv::cuda::bitwise_and(status, scratch.close, status, cv::noArray(), s);
+}
+
+void CudaTrackerBackend::downloadTracks(const cv::cuda::GpuMat &d_pts, const cv::cuda::GpuMat &d_track_status,
+                                        cv::cuda::HostMem &h_pts, cv::cuda::HostMem &h_track_status,
+                                        vector<cv::Point2f> &pts, vector<uchar> &status, cv::cuda::Stream &s)
+{
+    d_pts.download(h_pts, s);
+    d_track_status.download(h_track_status, s);
+    s.waitForCompletion();
+    cv::Mat m_pts = h_pts.createMatHeader(), m_status = h_track_status.createMatHeader();
+    pts.assign(m_pts.ptr<cv::Point2f>(), m_pts.ptr<cv::Point2f>() + m_pts.total());
+    status.assign(m_status.ptr<uchar>(), m_status.ptr<uchar>() + m_status.total());
+}
+
+void CudaTrackerBackend::setImage(const cv::Mat &img)
+{
+    if (!gpu_flow)
+    {
+        // the CPU pyramid holds the equalized image, the GPU detector gets the same
+        CpuTrackerBackend::setImage(img);
+        d_cur_img.upload(detectImage(img), stream);
+        return;
+    }
+    equalized_ready = false;
+    if (gpu_clahe)
+    {
+        d_upload.upload(img, stream);
+        gpu_clahe->apply(d_upload, d_cur_img, stream);
+    }
+    else
+        d_cur_img.upload(img, stream);
+}
+
+void CudaTrackerBackend::setRightImage(const cv::Mat &img)
+{
+    if (!gpu_flow)
+    {
+        CpuTrackerBackend::setRightImage(img);
+        return;
+    }
+    if (gpu_clahe_right)
+    {
+        d_right_upload.upload(img, stereo_stream);
+        gpu_clahe_right->apply(d_right_upload, d_right_img, stereo_stream);
+    }
+    else
+        d_right_img.upload(img, stereo_stream);
+    stereo_stream.waitForCompletion();
+}
+
+const cv::Mat &CudaTrackerBackend::detectImage(const cv::Mat &img)
+{
+    if (!params.EQUALIZE || !gpu_flow)
+        return CpuTrackerBackend::detectImage(img);
+    // detectRegion runs per cell on several threads
+    std::lock_guard<std::mutex> lk(equalized_mutex);
+    if (!equalized_ready)
+    {
+        d_cur_img.download(equalized, stream);
+        stream.waitForCompletion();
+        equalized_ready = true;
+    }
+    return equalized;
+}
+
+void CudaTrackerBackend::trackTemporal(const vector<cv::Point2f> &prev_pts, vector<cv::Point2f> &cur_pts,
+                                       vector<uchar> &status, bool use_prediction)
+{
+    if (!gpu_flow)
+    {
+        CpuTrackerBackend::trackTemporal(prev_pts, cur_pts, status, use_prediction);
+        return;
+    }
+
+    d_prev_pts.upload(prev_pts, stream);
+    bool full_search = true;
+    if(use_prediction)
+    {
+        d_cur_pts.upload(cur_pts, stream);
+        lk_predict->calc(d_prev_img, d_cur_img, d_prev_pts, d_cur_pts, d_status, cv::noArray(), stream);
+        // only the count is needed to pick the search
+        cv::cuda::countNonZero(d_status, d_count, stream);
+        d_count.download(h_count, stream);
+        stream.waitForCompletion();
+        full_search = h_count.createMatHeader().at<int>(0) < 10;
+    }
+    if (full_search)
+        lk_full->calc(d_prev_img, d_cur_img, d_prev_pts, d_cur_pts, d_status, cv::noArray(), stream);
+    if(params.FLOW_BACK)
+    {
+        d_prev_pts.copyTo(d_reverse_pts, stream);
+        lk_predict->calc(d_cur_img, d_prev_img, d_cur_pts, d_reverse_pts, d_reverse_status, cv::noArray(), stream);
+        reverseCheckDevice(d_prev_pts, d_reverse_pts, d_reverse_status, d_status, flow_check, stream);
+    }
+    downloadTracks(d_cur_pts, d_status, h_cur_pts, h_status, cur_pts, status, stream);
+}
+
+void CudaTrackerBackend::trackStereo(const vector<cv::Point2f> &left_pts, vector<cv::Point2f> &right_pts,
+                                     vector<uchar> &status)
+{
+    if (!gpu_flow)
+    {
+        CpuTrackerBackend::trackStereo(left_pts, right_pts, status);
+        return;
+    }
+
+    // the left image was uploaded on the main stream
+    stream.waitForCompletion();
+    d_left_pts.upload(left_pts, stereo_stream);
+    lk_full->calc(d_cur_img, d_right_img, d_left_pts, d_right_pts, d_right_status, cv::noArray(), stereo_stream);
+    if(params.FLOW_BACK)
+    {
+        lk_full->calc(d_right_img, d_cur_img, d_right_pts, d_reverse_left_pts, d_reverse_right_status, cv::noArray(), stereo_stream);
+        reverseCheckDevice(d_left_pts, d_reverse_left_pts, d_reverse_right_status, d_right_status, stereo_check,
+                           stereo_stream);
+    }
+    downloadTracks(d_right_pts, d_right_status, h_right_pts, h_right_status, right_pts, status, stereo_stream);
+}
+
+void CudaTrackerBackend::detect(const cv::Mat &img, const cv::Mat &mask, int max_cnt, vector<cv::Point2f> &pts)
+{
+    // FAST runs on the CPU, it is cheaper than the upload and GFTT launch
+    if (!gpu_detect || params.DETECTOR_TYPE == 1)
+    {
+        CpuTrackerBackend::detect(img, mask, max_cnt, pts);
+        return;
+    }
+
+    d_mask.upload(mask, stream);
+    detector->detect(d_cur_img, d_corners, d_mask, stream);
+    stream.waitForCompletion();
+    if(!d_corners.empty())
+    {
+        d_corners.download(pts);
+        if (static_cast<int>(pts.size()) > max_cnt)
+            pts.resize(max_cnt);
+    }
+    else
+        pts.clear();
+}
+
+void CudaTrackerBackend::setMinDist(int _min_dist)
+{
+    if (gpu_detect && _min_dist != min_dist)
+        detector = cv::cuda::createGoodFeaturesToTrackDetector(CV_8UC1, params.MAX_CNT, 0.01, _min_dist);
+    min_dist = _min_dist;
+}
+
+bool CudaTrackerBackend::detectRegion(const cv::Mat &img, const cv::Mat &mask, const cv::Rect &roi, int max_cnt,
+                                      vector<cv::Point2f> &pts)
+{
+    // one launch over the whole image is cheaper than one per cell on the GPU
+    if (gpu_detect && params.DETECTOR_TYPE != 1)
+        return false;
+    return CpuTrackerBackend::detectRegion(img, mask, roi, max_cnt, pts);
+}
+
+void CudaTrackerBackend::nextFrame()
+{
+    if (!gpu_flow)
+        CpuTrackerBackend::nextFrame();
+    d_prev_img.swap(d_cur_img);
+}
@@ -0,0 +1,78 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <opencv2/cudaoptflow.hpp>
+#include <opencv2/cudaimgproc.hpp>
+#include <opencv2/cudaarithm.hpp>
+
+#include <mutex>
+
+#include "cpu_backend.h"
+
+// OpenCV CUDA implementation. LK (USE_GPU_ACC_FLOW) and GFTT (USE_GPU) can be enabled separately,
+// the disabled part runs on the CPU base class. LK/GFTT objects and device buffers live across frames,
+// the right image goes through its own stream so it can overlap with temporal tracking.
+// The forward-backward check runs on the device, only the final points and status come back, once
+// per LK call, through page-locked buffers. With EQUALIZE the CUDA CLAHE runs on the stream of the
+// upload, the equalized image never comes back unless a CPU detector asks for it.
+class CudaTrackerBackend : public CpuTrackerBackend
+{
+  public:
+    CudaTrackerBackend(const Parameters &_params, int _width, int _height, bool _gpu_flow, bool _gpu_detect);
+
+    virtual const char *name() const { return "cuda"; }
+    virtual void setImage(const cv::Mat &img);
+    virtual void setRightImage(const cv::Mat &img);
+    virtual void trackTemporal(const vector<cv::Point2f> &prev_pts, vector<cv::Point2f> &cur_pts,
+                               vector<uchar> &status, bool use_prediction);
+    virtual void trackStereo(const vector<cv::Point2f> &left_pts, vector<cv::Point2f> &right_pts,
+                             vector<uchar> &status);
+    virtual void detect(const cv::Mat &img, const cv::Mat &mask, int max_cnt, vector<cv::Point2f> &pts);
+    virtual bool detectRegion(const cv::Mat &img, const cv::Mat &mask, const cv::Rect &roi, int max_cnt,
+                              vector<cv::Point2f> &pts);
+    virtual void nextFrame();
+    virtual void setMinDist(int _min_dist);
+
+  protected:
+    virtual const cv::Mat &detectImage(const cv::Mat &img);
+
+    // scratch of the device reverse check, one per stream
+    struct ReverseCheck
+    {
+        cv::cuda::GpuMat diff, dist, close;
+    };
+    // status &= reverse_status && |pts - reverse_pts| <= 0.5, queued on s
+    static void reverseCheckDevice(const cv::cuda::GpuMat &pts, const cv::cuda::GpuMat &reverse_pts,
+                                   const cv::cuda::GpuMat &reverse_status, cv::cuda::GpuMat &status,
+                                   ReverseCheck &scratch, cv::cuda::Stream &s);
+    // both downloads queued on s and one wait for them
+    static void downloadTracks(const cv::cuda::GpuMat &d_pts, const cv::cuda::GpuMat &d_track_status,
+                               cv::cuda::HostMem &h_pts, cv::cuda::HostMem &h_track_status,
+                               vector<cv::Point2f> &pts, vector<uchar> &status, cv::cuda::Stream &s);
+
+    bool gpu_flow, gpu_detect;
+    cv::cuda::Stream stream;
+    cv::cuda::Stream stereo_stream;
+    cv::Ptr<cv::cuda::SparsePyrLKOpticalFlow> lk_predict;
+    cv::Ptr<cv::cuda::SparsePyrLKOpticalFlow> lk_full;
+    cv::Ptr<cv::cuda::CornersDetector> detector;
+    cv::Ptr<cv::cuda::CLAHE> gpu_clahe, gpu_clahe_right;
+    cv::cuda::GpuMat d_prev_img, d_cur_img, d_right_img, d_mask, d_upload, d_right_upload;
+    // host copy of the equalized d_cur_img, downloaded once per frame on the first detectImage
+    cv::Mat equalized;
+    bool equalized_ready;
+    std::mutex equalized_mutex;
+    cv::cuda::GpuMat d_prev_pts, d_cur_pts, d_reverse_pts, d_status, d_reverse_status, d_corners;
+    cv::cuda::GpuMat d_left_pts, d_right_pts, d_reverse_left_pts, d_right_status, d_reverse_right_status;
+    cv::cuda::GpuMat d_count;
+    ReverseCheck flow_check, stereo_check;
+    cv::cuda::HostMem h_cur_pts, h_status, h_right_pts, h_right_status, h_count;
+};
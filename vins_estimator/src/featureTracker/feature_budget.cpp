@@ -0,0 +1,100 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include "feature_budget.h"
+
+// weight of a new frame in the running averages, about the last 10 frames count
+static const double AVERAGE_WEIGHT = 0.1;
+// share of the tracks that survive a frame, and of the coverage cells with a point, below which
+// more points are asked for and above which fewer are
+static const double SURVIVAL_LOW = 0.8, SURVIVAL_HIGH = 0.92;
+static const double COVERAGE_LOW = 0.6, COVERAGE_HIGH = 0.8;
+// the target grows by max_cnt / TARGET_STEPS and shrinks by a quarter of that
+static const int TARGET_STEPS = 20;
+// grows only below this share of the latency budget
+static const double LATENCY_HEADROOM = 0.9;
+// coverage cells without detect_grid_rows/cols
+static const int COVERAGE_GRID = 4;
+
+FeatureBudget::FeatureBudget()
+    : adaptive(false), max_cnt(0), min_cnt(0), base_dist(0), latency_budget(0), grid_rows(COVERAGE_GRID),
+      grid_cols(COVERAGE_GRID), target(0), min_dist(0), survival(1), coverage(1), track_time(0), dist_scale(1),
+      starved(false), backend_ms(0)
+{
+}
+
+void FeatureBudget::reset(const Parameters &params)
+{
+    adaptive = params.ADAPTIVE_FEATURES && params.MAX_CNT > 0;
+    max_cnt = params.MAX_CNT;
+    min_cnt = params.ADAPTIVE_FEATURES_MIN > 0 ? std::min(params.ADAPTIVE_FEATURES_MIN, max_cnt)
+                                               : std::max(std::min(30, max_cnt), max_cnt / 4);
+    base_dist = params.MIN_DIST;
+    latency_budget = params.ADAPTIVE_FEATURES_LATENCY;
+    if (params.DETECT_GRID_ROWS > 0 && params.DETECT_GRID_COLS > 0)
+    {
+        grid_rows = params.DETECT_GRID_ROWS;
+        grid_cols = params.DETECT_GRID_COLS;
+    }
+    cells.assign(grid_rows * grid_cols, 0);
+    // starts as configured
+    target = max_cnt;
+    min_dist = base_dist;
+    survival = coverage = dist_scale = 1;
+    track_time = 0;
+    starved = false;
+}
+
+void FeatureBudget::tracked(int previous, int survived)
+{
+    if (previous > 0)
+        survival += AVERAGE_WEIGHT * (double(survived) / previous - survival);
+}
+
+void FeatureBudget::detected(int requested, int found)
+{
+    starved = requested > 0 && 2 * found < requested;
+}
+
+bool FeatureBudget::update(const std::vector<cv::Point2f> &pts, int rows, int cols, double track_ms)
+{
+    if (!adaptive || rows <= 0 || cols <= 0)
+        return false;
+    std::fill(cells.begin(), cells.end(), 0);
+    for (const cv::Point2f &p : pts)
+    {
+        int r = std::min(std::max(int(p.y * grid_rows / rows), 0), grid_rows - 1);
+        int c = std::min(std::max(int(p.x * grid_cols / cols), 0), grid_cols - 1);
+        cells[r * grid_cols + c] = 1;
+    }
+    double covered = double(std::count(cells.begin(), cells.end(), 1)) / cells.size();
+    coverage += AVERAGE_WEIGHT * (covered - coverage);
+    track_time += AVERAGE_WEIGHT * (track_ms - track_time);
+
+    int step = std::max(1, max_cnt / TARGET_STEPS);
+    double latency = track_time + backend_ms.load();
+    if (latency_budget > 0 && latency > latency_budget)
+        target = int(target * std::max(0.8, latency_budget / latency));
+    else if ((survival < SURVIVAL_LOW || coverage < COVERAGE_LOW) && !starved &&
+             (latency_budget <= 0 || latency < LATENCY_HEADROOM * latency_budget))
+        target += step;
+    else if (survival > SURVIVAL_HIGH && coverage > COVERAGE_HIGH)
+        target -= std::max(1, step / 4);
+    target = std::min(std::max(target, min_cnt), max_cnt);
+
+    // a corner poor scene packs what the detector finds closer, the spacing comes back otherwise
+    dist_scale = starved ? std::max(0.5, dist_scale * 0.9) : std::min(1.0, dist_scale * 1.05);
+    int dist = int(std::lround(base_dist * dist_scale * std::sqrt(double(max_cnt) / target)));
+    dist = std::min(std::max(dist, 1), 2 * base_dist);
+    bool changed = dist != min_dist;
+    min_dist = dist;
+    return changed;
+}
@@ -0,0 +1,57 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <opencv2/core/core.hpp>
+#include "../estimator/parameters.h"
+
+// Feature target of one FeatureTracker with adaptive_features, in place of the fixed max_cnt and
+// min_dist. Once per frame the target moves with what the last frames showed:
+//  - over adaptive_features_latency (tracking plus the estimator's frame time): down at once, by
+//    the share it is over
+//  - tracks dying (survival of the temporal LK) or parts of the image without features: up
+//  - long tracks all over the image: slowly down, the tracked points already carry the window
+// It stays between adaptive_features_min and max_cnt. min_dist widens as the target drops so fewer
+// points still spread over the image, and narrows down to half of min_dist while the detector
+// finds less than half of what it is asked for (a scene with few corners).
+class FeatureBudget
+{
+  public:
+    FeatureBudget();
+
+    void reset(const Parameters &params);
+    bool enabled() const { return adaptive; }
+    // points to keep after detection, and their spacing in pixels
+    int maxCnt() const { return target; }
+    int minDist() const { return min_dist; }
+
+    // after the temporal LK: points carried over from the last frame and those still tracked
+    void tracked(int previous, int survived);
+    // after the detection: points asked for and found
+    void detected(int requested, int found);
+    // end of a frame with its points, and the time trackImage took; true if min_dist changed
+    bool update(const std::vector<cv::Point2f> &pts, int rows, int cols, double track_ms);
+    // the estimator's time of its last frame, from its thread
+    void backendTime(double ms) { backend_ms.store(ms); }
+
+  private:
+    bool adaptive;
+    int max_cnt, min_cnt, base_dist;
+    double latency_budget;
+    int grid_rows, grid_cols;
+
+    int target, min_dist;
+    double survival, coverage, track_time, dist_scale;
+    bool starved;
+    std::atomic<double> backend_ms;
+    std::vector<char> cells;
+};
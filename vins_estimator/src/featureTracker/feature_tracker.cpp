@@ -11,15 +11,6 @@
 
 #include "feature_tracker.h"
 
-#include <vpi/OpenCVInterop.hpp>
-#include <vpi/Image.h>
-#include <vpi/Stream.h>
-#include <vpi/Array.h>
-#include <vpi/Status.h>
-
-#include <vpi/algo/ConvertImageFormat.h>
-#include <vpi/algo/HarrisCorners.h>
-
 #include <cstdio>
 #include <time.h>
 #include <algorithm>
@@ -31,12 +22,6 @@
 #include <sstream>
 #include <vector>
 
-// Max number of corners detected by harris corner algo
-constexpr int MAX_HARRIS_CORNERS = 8192;
-  
-// Max number of keypoints to be tracked
-constexpr int MAX_KEYPOINTS = 100;
-
 bool FeatureTracker::inBorder(const cv::Point2f &pt)
 {
     const int BORDER_SIZE = 1;
@@ -71,138 +56,63 @@ void reduceVector(vector<int> &v, vector<uchar> status)
     v.resize(j);
 }
 
-void SortKeypoints(VPIArray keypoints, VPIArray scores, int max)
+void reduceVector(vector<FeatureId> &v, vector<uchar> status)
 {
-    VPIArrayData ptsData, scoresData;
-    vpiArrayLock(keypoints, VPI_LOCK_READ_WRITE, &ptsData);
-    vpiArrayLock(scores, VPI_LOCK_READ_WRITE, &scoresData);
-  
-    std::vector<int> indices(*ptsData.sizePointer);
-    std::iota(indices.begin(), indices.end(), 0);
-  
-    stable_sort(indices.begin(), indices.end(), [&scoresData](int a, int b) {
-        uint32_t *score = reinterpret_cast<uint32_t *>(scoresData.data);
-        return score[a] >= score[b]; // decreasing score order
-    });
-  
-    // keep the only 'max' indexes.
-    indices.resize(std::min<size_t>(indices.size(), max));
-  
-    VPIKeypoint *kptData = reinterpret_cast<VPIKeypoint *>(ptsData.data);
-  
-    // reorder the keypoints to keep the first 'max' with highest scores.
-    std::vector<VPIKeypoint> kpt;
-    std::transform(indices.begin(), indices.end(), std::back_inserter(kpt),
-                    [kptData](int idx) { return kptData[idx]; });
-    std::copy(kpt.begin(), kpt.end(), kptData);
-  
-    // update keypoint array size.
-    *ptsData.sizePointer = kpt.size();
-  
-    vpiArrayUnlock(scores);
-    vpiArrayUnlock(keypoints);
-}
-
-int UpdateMask(cv::Mat &cvMask, const std::vector<cv::Scalar> &trackColors, VPIArray prevFeatures,
-                       VPIArray curFeatures, VPIArray status)
-{
-    // Now that optical flow is completed, there are usually two approaches to take:
-    // 1. Add new feature points from current frame using a feature detector such as
-    //    \ref algo_harris_corners "Harris Corner Detector"
-    // 2. Keep using the points that are being tracked.
-    //
-    // The sample app uses the valid feature point and continue to do the tracking.
-  
-    // Lock the input and output arrays to draw the tracks to the output mask.
-    VPIArrayData curFeaturesData, statusData;
-    vpiArrayLock(curFeatures, VPI_LOCK_READ_WRITE, &curFeaturesData);
-    vpiArrayLock(status, VPI_LOCK_READ, &statusData);
-  
-    const VPIKeypoint *pCurFeatures = (VPIKeypoint *)curFeaturesData.data;
-    const uint8_t *pStatus          = (uint8_t *)statusData.data;
-  
-    const VPIKeypoint *pPrevFeatures;
-    if (prevFeatures)
-    {
-        VPIArrayData prevFeaturesData;
-        vpiArrayLock(prevFeatures, VPI_LOCK_READ, &prevFeaturesData);
-        pPrevFeatures = (VPIKeypoint *)prevFeaturesData.data;
-    }
-    else
-    {
-        pPrevFeatures = NULL;
-    }
-  
-    int numTrackedKeypoints = 0;
-    int totKeypoints        = *curFeaturesData.sizePointer;
-  
-    for (int i = 0; i < totKeypoints; i++)
-    {
-        // keypoint is being tracked?
-        if (pStatus[i] == 0)
-        {
-            // draw the tracks
-            cv::Point curPoint{(int)round(pCurFeatures[i].x), (int)round(pCurFeatures[i].y)};
-            if (pPrevFeatures != NULL)
-            {
-                cv::Point2f prevPoint{pPrevFeatures[i].x, pPrevFeatures[i].y};
-                line(cvMask, prevPoint, curPoint, trackColors[i], 2);
-            }
-  
-            circle(cvMask, curPoint, 5, trackColors[i], -1);
-  
-            numTrackedKeypoints++;
-        }
-    }
-  
-    // We're finished working with the arrays.
-    if (prevFeatures)
-    {
-        vpiArrayUnlock(prevFeatures);
-    }
-    vpiArrayUnlock(curFeatures);
-    vpiArrayUnlock(status);
-  
-    return numTrackedKeypoints;
+    int j = 0;
+    for (int i = 0; i < int(v.size()); i++)
+        if (status[i])
+            v[j++] = v[i];
+    v.resize(j);
 }
 
-FeatureTracker::FeatureTracker()
+FeatureTracker::FeatureTracker(const Parameters &_params, int _first_camera)
+    : first_camera(_first_camera), params(_params)
 {
     stereo_cam = 0;
-    n_id = 0;
+    n_id = firstFeatureId(first_camera);
     hasPrediction = false;
+    hasRotationPrior = false;
+    drawRequested = false;
+    prev_time = prev_track_time = 0;
     sum_n = 0;
+    backend = NULL;
 }
 
-void FeatureTracker::setMask()
+FeatureTracker::~FeatureTracker()
 {
-    mask = cv::Mat(row, col, CV_8UC1, cv::Scalar(255));
+    delete backend;
+}
 
-    // prefer to keep features that are tracked for long time
-    vector<pair<int, pair<cv::Point2f, int>>> cnt_pts_id;
+void FeatureTracker::setMask()
+{
+    if (fisheye_mask.rows == row && fisheye_mask.cols == col)
+        mask = fisheye_mask.clone();
+    else
+        mask = cv::Mat(row, col, CV_8UC1, cv::Scalar(255));
 
-    for (unsigned int i = 0; i < cur_pts.size(); i++)
-        cnt_pts_id.push_back(make_pair(track_cnt[i], make_pair(cur_pts[i], ids[i])));
+    // prefer to keep features that are tracked for long time,
+    // survivors keep their original order so ids stay sorted
+    vector<int> order(cur_pts.size());
+    for (unsigned int i = 0; i < order.size(); i++)
+        order[i] = i;
 
-    sort(cnt_pts_id.begin(), cnt_pts_id.end(), [](const pair<int, pair<cv::Point2f, int>> &a, const pair<int, pair<cv::Point2f, int>> &b)
+    stable_sort(order.begin(), order.end(), [this](int a, int b)
          {
-            return a.first > b.first;
+            return track_cnt[a] > track_cnt[b];
          });
 
-    cur_pts.clear();
-    ids.clear();
-    track_cnt.clear();
-
-    for (auto &it : cnt_pts_id)
+    vector<uchar> status(cur_pts.size(), 0);
+    for (int i : order)
     {
-        if (mask.at<uchar>(it.second.first) == 255)
+        if (mask.at<uchar>(cur_pts[i]) == 255)
         {
-            cur_pts.push_back(it.second.first);
-            ids.push_back(it.second.second);
-            track_cnt.push_back(it.first);
-            cv::circle(mask, it.second.first, MIN_DIST, 0, -1);
+            status[i] = 1;
+            cv::circle(mask, cur_pts[i], featureBudget.minDist(), 0, -1);
         }
     }
+    reduceVector(cur_pts, status);
+    reduceVector(ids, status);
+    reduceVector(track_cnt, status);
 }
 
 void FeatureTracker::addPoints()
@@ -215,6 +125,71 @@ void FeatureTracker::addPoints()
     }
 }
 
+// split the image into DETECT_GRID_ROWS x DETECT_GRID_COLS cells with an equal share of the feature target each,
+// and only detect in the cells that are below their share
+void FeatureTracker::detectGrid(int n_max_cnt)
+{
+    const int cells = params.DETECT_GRID_ROWS * params.DETECT_GRID_COLS;
+    const int cell_w = (col + params.DETECT_GRID_COLS - 1) / params.DETECT_GRID_COLS;
+    const int cell_h = (row + params.DETECT_GRID_ROWS - 1) / params.DETECT_GRID_ROWS;
+    const int quota = std::max(1, (featureBudget.maxCnt() + cells - 1) / cells);
+
+    vector<int> cell_cnt(cells, 0);
+    for (auto &p : cur_pts)
+    {
+        int c = std::min(int(p.x) / cell_w, params.DETECT_GRID_COLS - 1);
+        int r = std::min(int(p.y) / cell_h, params.DETECT_GRID_ROWS - 1);
+        cell_cnt[r * params.DETECT_GRID_COLS + c]++;
+    }
+
+    vector<int> todo;
+    for (int i = 0; i < cells; i++)
+        if (cell_cnt[i] < quota)
+            todo.push_back(i);
+
+    vector<vector<cv::Point2f>> cell_pts(todo.size());
+    vector<uchar> cell_ok(todo.size(), 1);
+    cv::parallel_for_(cv::Range(0, todo.size()), [&](const cv::Range &range)
+    {
+        for (int k = range.start; k < range.end; k++)
+        {
+            int i = todo[k];
+            int r = i / params.DETECT_GRID_COLS, c = i % params.DETECT_GRID_COLS;
+            cv::Rect roi(c * cell_w, r * cell_h, cell_w, cell_h);
+            roi &= cv::Rect(0, 0, col, row);
+            cell_ok[k] = backend->detectRegion(cur_img, mask, roi, quota - cell_cnt[i], cell_pts[k]);
+        }
+    });
+
+    if (std::find(cell_ok.begin(), cell_ok.end(), 0) != cell_ok.end())
+    {
+        backend->detect(cur_img, mask, n_max_cnt, n_pts);
+        return;
+    }
+
+    // cells are detected independently, enforce min_dist across cell borders on a copy of the mask.
+    // The corners are taken strongest first from each cell in turn, so a truncated set still
+    // covers all the cells instead of the first ones in scan order
+    cv::Mat taken = mask.clone();
+    size_t deepest = 0;
+    for (auto &pts : cell_pts)
+        deepest = std::max(deepest, pts.size());
+    n_pts.clear();
+    for (size_t rank = 0; rank < deepest; rank++)
+        for (auto &pts : cell_pts)
+        {
+            if (rank >= pts.size())
+                continue;
+            if (int(n_pts.size()) >= n_max_cnt)
+                return;
+            const cv::Point2f &p = pts[rank];
+            if (taken.at<uchar>(cv::Point(p)) != 255)
+                continue;
+            n_pts.push_back(p);
+            cv::circle(taken, p, featureBudget.minDist(), 0, -1);
+        }
+}
+
 double FeatureTracker::distance(cv::Point2f &pt1, cv::Point2f &pt2)
 {
     //printf("pt1: %f %f pt2: %f %f\n", pt1.x, pt1.y, pt2.x, pt2.y);
@@ -223,287 +198,47 @@ double FeatureTracker::distance(cv::Point2f &pt1, cv::Point2f &pt2)
     return sqrt(dx * dx + dy * dy);
 }
 
-map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> FeatureTracker::trackImage(double _cur_time, const cv::Mat &_img, const cv::Mat &_img1)
+FeatureFrame FeatureTracker::trackImage(double _cur_time, const cv::Mat &_img, const cv::Mat &_img1)
 {
+    VINS_TRACE_FRAME("trackImage", _cur_time);
     TicToc t_r;
     cur_time = _cur_time;
     cur_img = _img;
     row = cur_img.rows;
     col = cur_img.cols;
     cv::Mat rightImg = _img1;
-    /*
+    // equalize is done by the backend together with its pyramids
+    cur_pts.clear();
+
+    setBackendImage();
+    // the right pyramid/upload only depends on the image, start it before temporal tracking
+    if (!rightImg.empty() && stereo_cam)
     {
-        cv::Ptr<cv::CLAHE> clahe = cv::createCLAHE(3.0, cv::Size(8, 8));
-        clahe->apply(cur_img, cur_img);
-        if(!rightImg.empty())
-            clahe->apply(rightImg, rightImg);
+        if (params.ASYNC_STEREO)
+            right_prepare_job = std::async(std::launch::async, &TrackerBackend::setRightImage, backend, rightImg);
+        else
+            backend->setRightImage(rightImg);
     }
-    */
-    cur_pts.clear();
 
     if (prev_pts.size() > 0)
     {
+        VINS_TRACE("trackTemporal");
+        TicToc t_o;
         vector<uchar> status;
-        if(!USE_GPU_ACC_FLOW)
-        {
-            TicToc t_o;
-            
-            vector<float> err;
-            if(hasPrediction)
-            {
-                cur_pts = predict_pts;
-                cv::calcOpticalFlowPyrLK(prev_img, cur_img, prev_pts, cur_pts, status, err, cv::Size(21, 21), 1, 
-                cv::TermCriteria(cv::TermCriteria::COUNT+cv::TermCriteria::EPS, 30, 0.01), cv::OPTFLOW_USE_INITIAL_FLOW);
-                
-                int succ_num = 0;
-                for (size_t i = 0; i < status.size(); i++)
-                {
-                    if (status[i])
-                        succ_num++;
-                }
-                if (succ_num < 10)
-                cv::calcOpticalFlowPyrLK(prev_img, cur_img, prev_pts, cur_pts, status, err, cv::Size(21, 21), 3);
-            }
-            else
-                cv::calcOpticalFlowPyrLK(prev_img, cur_img, prev_pts, cur_pts, status, err, cv::Size(21, 21), 3);
-            // reverse check
-            if(FLOW_BACK)
-            {
-                vector<uchar> reverse_status;
-                vector<cv::Point2f> reverse_pts = prev_pts;
-                cv::calcOpticalFlowPyrLK(cur_img, prev_img, cur_pts, reverse_pts, reverse_status, err, cv::Size(21, 21), 1, 
-                cv::TermCriteria(cv::TermCriteria::COUNT+cv::TermCriteria::EPS, 30, 0.01), cv::OPTFLOW_USE_INITIAL_FLOW);
-                //cv::calcOpticalFlowPyrLK(cur_img, prev_img, cur_pts, reverse_pts, reverse_status, err, cv::Size(21, 21), 3); 
-                for(size_t i = 0; i < status.size(); i++)
-                {
-                    if(status[i] && reverse_status[i] && distance(prev_pts[i], reverse_pts[i]) <= 0.5)
-                    {
-                        status[i] = 1;
-                    }
-                    else
-                        status[i] = 0;
-                }
-            }
-            // printf("temporal optical flow costs: %fms\n", t_o.toc());
-        }
-        else if (USE_GPU_ACC_FLOW)
-        {
-            TicToc t_og;
-            cv::cuda::GpuMat prev_gpu_img(prev_img);
-            cv::cuda::GpuMat cur_gpu_img(cur_img);
-            cv::cuda::GpuMat prev_gpu_pts(prev_pts);
-            cv::cuda::GpuMat cur_gpu_pts(cur_pts);
-            cv::cuda::GpuMat gpu_status;
-            if(hasPrediction)
-            {
-                cur_gpu_pts = cv::cuda::GpuMat(predict_pts);
-                cv::Ptr<cv::cuda::SparsePyrLKOpticalFlow> d_pyrLK_sparse = cv::cuda::SparsePyrLKOpticalFlow::create(
-                cv::Size(21, 21), 1, 30, true);
-                d_pyrLK_sparse->calc(prev_gpu_img, cur_gpu_img, prev_gpu_pts, cur_gpu_pts, gpu_status);
-                
-                vector<cv::Point2f> tmp_cur_pts(cur_gpu_pts.cols);
-                cur_gpu_pts.download(tmp_cur_pts);
-                cur_pts = tmp_cur_pts;
-
-                vector<uchar> tmp_status(gpu_status.cols);
-                gpu_status.download(tmp_status);
-                status = tmp_status;
-
-                int succ_num = 0;
-                for (size_t i = 0; i < tmp_status.size(); i++)
-                {
-                    if (tmp_status[i])
-                        succ_num++;
-                }
-                if (succ_num < 10)
-                {
-                    cv::Ptr<cv::cuda::SparsePyrLKOpticalFlow> d_pyrLK_sparse = cv::cuda::SparsePyrLKOpticalFlow::create(
-                    cv::Size(21, 21), 3, 30, false);
-                    d_pyrLK_sparse->calc(prev_gpu_img, cur_gpu_img, prev_gpu_pts, cur_gpu_pts, gpu_status);
-
-                    vector<cv::Point2f> tmp1_cur_pts(cur_gpu_pts.cols);
-                    cur_gpu_pts.download(tmp1_cur_pts);
-                    cur_pts = tmp1_cur_pts;
-
-                    vector<uchar> tmp1_status(gpu_status.cols);
-                    gpu_status.download(tmp1_status);
-                    status = tmp1_status;
-                }
-            }
-            else
-            {
-                cv::Ptr<cv::cuda::SparsePyrLKOpticalFlow> d_pyrLK_sparse = cv::cuda::SparsePyrLKOpticalFlow::create(
-                cv::Size(21, 21), 3, 30, false);
-                d_pyrLK_sparse->calc(prev_gpu_img, cur_gpu_img, prev_gpu_pts, cur_gpu_pts, gpu_status);
+        if(hasPrediction)
+            cur_pts = predict_pts;
+        backend->trackTemporal(prev_pts, cur_pts, status, hasPrediction);
+        // printf("temporal optical flow costs: %fms\n", t_o.toc());
 
-                vector<cv::Point2f> tmp1_cur_pts(cur_gpu_pts.cols);
-                cur_gpu_pts.download(tmp1_cur_pts);
-                cur_pts = tmp1_cur_pts;
-
-                vector<uchar> tmp1_status(gpu_status.cols);
-                gpu_status.download(tmp1_status);
-                status = tmp1_status;
-            }
-            if(FLOW_BACK)
-            {
-                cv::cuda::GpuMat reverse_gpu_status;
-                cv::cuda::GpuMat reverse_gpu_pts = prev_gpu_pts;
-                cv::Ptr<cv::cuda::SparsePyrLKOpticalFlow> d_pyrLK_sparse = cv::cuda::SparsePyrLKOpticalFlow::create(
-                cv::Size(21, 21), 1, 30, true);
-                d_pyrLK_sparse->calc(cur_gpu_img, prev_gpu_img, cur_gpu_pts, reverse_gpu_pts, reverse_gpu_status);
-
-                vector<cv::Point2f> reverse_pts(reverse_gpu_pts.cols);
-                reverse_gpu_pts.download(reverse_pts);
-
-                vector<uchar> reverse_status(reverse_gpu_status.cols);
-                reverse_gpu_status.download(reverse_status);
-
-                for(size_t i = 0; i < status.size(); i++)
-                {
-                    if(status[i] && reverse_status[i] && distance(prev_pts[i], reverse_pts[i]) <= 0.5)
-                    {
-                        status[i] = 1;
-                    }
-                    else
-                        status[i] = 0;
-                }
-            }
-            // printf("gpu temporal optical flow costs: %f ms\n",t_og.toc());
-        }
-        else if (USE_VPI)
-        {
-            TicToc t_og;
-
-            // VPI objects that will be used
-            VPIStream stream        = NULL;
-
-            VPIImage prevFrame   = NULL;
-            VPIImage curFrame       = NULL;
-
-            VPIImage tempPrev = NULL;
-            VPIImage tempCur = NULL;
-
-            VPIPyramid pyrPrevFrame = NULL;
-            VPIPyramid pyrCurFrame = NULL;
-
-            VPIArray prevFeatures = NULL;
-            VPIArray curFeatures = NULL;
-            VPIArray vpi_status = NULL;
-
-            VPIPayload optflow = NULL;
-            
-            // Now parse the backend
-            VPIBackend backend;
-
-            int numTrackedKeypoints;
-        
-            if (VPI_BACKEND == 0)
-            {
-                backend = VPI_BACKEND_CPU;
-            }
-            else if (VPI_BACKEND == 1)
-            {
-                backend = VPI_BACKEND_CUDA;
-            }
-
-            vpiStreamCreate(0, &stream);
-
-            vpiImageCreateOpenCVMatWrapper(prev_img, 0, &tempPrev);
-            vpiImageCreateOpenCVMatWrapper(cur_img, 0, &tempCur);
-            
-            vpiImageCreate(cur_img.cols, cur_img.rows, VPI_IMAGE_FORMAT_U8, 0, &curFrame);
-            vpiImageCreate(prev_img.cols, prev_img.rows, VPI_IMAGE_FORMAT_U8, 0, &prevFrame);
-
-            vpiPyramidCreate(cur_img.cols, cur_img.rows, VPI_IMAGE_FORMAT_U8, PYRAMID_LEVEL, 0.5, 0, &pyrPrevFrame);
-            vpiPyramidCreate(cur_img.cols, cur_img.rows, VPI_IMAGE_FORMAT_U8, PYRAMID_LEVEL, 0.5, 0, &pyrCurFrame);
-
-            vpiArrayCreate(prev_pts.size(), VPI_ARRAY_TYPE_KEYPOINT, 0, &prevFeatures);
-            vpiArrayCreate(cur_pts.size(), VPI_ARRAY_TYPE_KEYPOINT, 0, &curFeatures);
-
-            vpiArrayCreate(MAX_HARRIS_CORNERS, VPI_ARRAY_TYPE_U8, 0, &vpi_status);
-
-            vpiCreateOpticalFlowPyrLK(backend, cur_img.cols, cur_img.rows, VPI_IMAGE_FORMAT_U8, PYRAMID_LEVEL, 0.5,
-                                                &optflow);
-
-            VPIOpticalFlowPyrLKParams lkParams;
-            vpiInitOpticalFlowPyrLKParams(&lkParams);
-
-            vpiImageSetWrappedOpenCVMat(curFrame, cur_img);
-            vpiImageSetWrappedOpenCVMat(prevFrame, prev_img);
-
-            vpiArrayLock(prev_pts, VPI_LOCK_READ, &prevFeatures);
-            vpiArrayLock(cur_pts, VPI_LOCK_READ, &curFeatures);
-
-            // current keypoint and prev keypoint => vpiArrayCreate [https://docs.nvidia.com/vpi/sample_klt_tracker.html]
-
-
-            vpiArrayUnlock(prev_pts);
-            vpiArrayUnlock(cur_pts);
-
-            vpiSubmitConvertImageFormat(stream, backend, curFrame, tempCur, NULL);
-            vpiSubmitConvertImageFormat(stream, backend, prevFrame, tempPrev, NULL);
-                
-            vpiSubmitGaussianPyramidGenerator(stream, backend, tempCur, pyrCurFrame);
-            vpiSubmitGaussianPyramidGenerator(stream, backend, tempPrev, pyrPrevFrame);
-
-            if(hasPrediction)
-            {
-                vpiSubmitOpticalFlowPyrLK(stream, 0, optflow, pyrPrevFrame, pyrCurFrame, prevFeatures,
-                                                    curFeatures, vpi_status, &lkParams);
-                vpiStreamSync(stream);
-
-                // numTrackedKeypoints = UpdateMask(cvMask, trackColors, prevFeatures, curFeatures, status);
-
-            }
-            else
-            {
-                vpiSubmitOpticalFlowPyrLK(stream, 0, optflow, pyrPrevFrame, pyrCurFrame, prevFeatures,
-                                                    curFeatures, vpi_status, &lkParams);
-                vpiStreamSync(stream);
-
-                // numTrackedKeypoints = UpdateMask(cvMask, trackColors, prevFeatures, curFeatures, status);
-            }
-
-            if(FLOW_BACK)
-            {
-                cv::cuda::GpuMat prev_gpu_img(prev_img);
-                cv::cuda::GpuMat cur_gpu_img(cur_img);
-                cv::cuda::GpuMat prev_gpu_pts(prev_pts);
-                cv::cuda::GpuMat cur_gpu_pts(cur_pts);
-                cv::cuda::GpuMat gpu_status;
-
-                cv::cuda::GpuMat reverse_gpu_status;
-                cv::cuda::GpuMat reverse_gpu_pts = prev_gpu_pts;
-                cv::Ptr<cv::cuda::SparsePyrLKOpticalFlow> d_pyrLK_sparse = cv::cuda::SparsePyrLKOpticalFlow::create(
-                cv::Size(21, 21), 1, 30, true);
-                d_pyrLK_sparse->calc(cur_gpu_img, prev_gpu_img, cur_gpu_pts, reverse_gpu_pts, reverse_gpu_status);
-
-                vector<cv::Point2f> reverse_pts(reverse_gpu_pts.cols);
-                reverse_gpu_pts.download(reverse_pts);
-
-                vector<uchar> reverse_status(reverse_gpu_status.cols);
-                reverse_gpu_status.download(reverse_status);
-
-                for(size_t i = 0; i < status.size(); i++)
-                {
-                    if(status[i] && reverse_status[i] && distance(prev_pts[i], reverse_pts[i]) <= 0.5)
-                    {
-                        status[i] = 1;
-                    }
-                    else
-                        status[i] = 0;
-                }
-            }
-
-        }
-    
         for (int i = 0; i < int(cur_pts.size()); i++)
             if (status[i] && !inBorder(cur_pts[i]))
                 status[i] = 0;
+        int carried = prev_pts.size();
         reduceVector(prev_pts, status);
         reduceVector(cur_pts, status);
         reduceVector(ids, status);
         reduceVector(track_cnt, status);
+        featureBudget.tracked(carried, cur_pts.size());
         // ROS_DEBUG("temporal optical flow costs: %fms", t_o.toc());
         
         //printf("track cnt %d\n", (int)ids.size());
@@ -514,7 +249,8 @@ map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> FeatureTracker::trackIm
 
     if (1)
     {
-        //rejectWithF();
+        if (params.REJECT_WITH_F)
+            rejectWithF();
         ROS_DEBUG("set mask begins");
         TicToc t_m;
         setMask();
@@ -522,142 +258,24 @@ map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> FeatureTracker::trackIm
         // printf("set mask costs %fms\n", t_m.toc());
         ROS_DEBUG("detect feature begins");
         
-        int n_max_cnt = MAX_CNT - static_cast<int>(cur_pts.size());
-        if(!USE_GPU)
+        int n_max_cnt = featureBudget.maxCnt() - static_cast<int>(cur_pts.size());
+        if (n_max_cnt > 0)
         {
-            if (n_max_cnt > 0)
-            {
-                TicToc t_t;
-                if(mask.empty())
-                    cout << "mask is empty " << endl;
-                if (mask.type() != CV_8UC1)
-                    cout << "mask type wrong " << endl;
-                cv::goodFeaturesToTrack(cur_img, n_pts, MAX_CNT - cur_pts.size(), 0.01, MIN_DIST, mask);
-                // printf("good feature to track costs: %fms\n", t_t.toc());
-                std::cout << "n_pts size: "<< n_pts.size()<<std::endl;
-            }
+            VINS_TRACE("detect");
+            TicToc t_t;
+            if(mask.empty())
+                VINS_WARN("mask is empty \n");
+            if (mask.type() != CV_8UC1)
+                VINS_WARN("mask type wrong \n");
+            if (params.DETECT_GRID_ROWS > 0 && params.DETECT_GRID_COLS > 0)
+                detectGrid(n_max_cnt);
             else
-                n_pts.clear();
-            // sum_n += n_pts.size();
-            // printf("total point from non-gpu: %d\n",sum_n);
-        }
-        
-        // ROS_DEBUG("detect feature costs: %fms", t_t.toc());
-        // printf("good feature to track costs: %fms\n", t_t.toc());
-        else if (USE_GPU)
-        {
-            if (n_max_cnt > 0)
-            {
-                if(mask.empty())
-                    cout << "mask is empty " << endl;
-                if (mask.type() != CV_8UC1)
-                    cout << "mask type wrong " << endl;
-                TicToc t_g;
-                cv::cuda::GpuMat cur_gpu_img(cur_img);
-                cv::cuda::GpuMat d_prevPts;
-                TicToc t_gg;
-                cv::cuda::GpuMat gpu_mask(mask);
-                // printf("gpumat cost: %fms\n",t_gg.toc());
-                cv::Ptr<cv::cuda::CornersDetector> detector = cv::cuda::createGoodFeaturesToTrackDetector(cur_gpu_img.type(), MAX_CNT - cur_pts.size(), 0.01, MIN_DIST);
-                // cout << "new gpu points: "<< MAX_CNT - cur_pts.size()<<endl;
-                detector->detect(cur_gpu_img, d_prevPts, gpu_mask);
-                // std::cout << "d_prevPts size: "<< d_prevPts.size()<<std::endl;
-                if(!d_prevPts.empty())
-                    n_pts = cv::Mat_<cv::Point2f>(cv::Mat(d_prevPts));
-                else
-                    n_pts.clear();
-                // sum_n += n_pts.size();
-                // printf("total point from gpu: %d\n",sum_n);
-                // printf("gpu good feature to track cost: %fms\n", t_g.toc());
-            }
-            else 
-                n_pts.clear();
-        }
-        else if(USE_VPI)
-        {
-            VPIImage imgInput     = NULL;
-            VPIImage imgGrayscale = NULL;
-            VPIArray keypoints    = NULL;
-            VPIArray scores       = NULL;
-            VPIStream stream      = NULL;
-            VPIPayload harris     = NULL;
-
-            VPIBackend backend;
-
-            if (VPI_BACKEND == 0)
-            {
-                backend = VPI_BACKEND_CPU;
-            }
-            else if (VPI_BACKEND == 1)
-            {
-                backend = VPI_BACKEND_CUDA;
-            }
-            else if (VPI_BACKEND == 2)
-            {
-                backend = VPI_BACKEND_PVA;
-            }
-
-            if (n_max_cnt > 0)
-            {
-                if(mask.empty())
-                    cout << "mask is empty " << endl;
-                if (mask.type() != CV_8UC1)
-                    cout << "mask type wrong " << endl;
-
-                TicToc t_g;
-
-                vpiStreamCreate(0, &stream);
-                vpiImageCreateOpenCVMatWrapper(cur_img, 0, &imgInput);
-                vpiImageCreate(cur_img.cols, cur_img.rows, VPI_IMAGE_FORMAT_S16, 0, &imgGrayscale);
-                vpiArrayCreate(8192, VPI_ARRAY_TYPE_KEYPOINT, 0, &keypoints);
-                vpiArrayCreate(8192, VPI_ARRAY_TYPE_U32, 0, &scores);
-                vpiCreateHarrisCornerDetector(backend, cur_img.cols, cur_img.rows, &harris);
-
-                VPIHarrisCornerDetectorParams harrisParams;
-                vpiInitHarrisCornerDetectorParams(&harrisParams);
-                harrisParams.sensitivity = 0.01;
-
-                vpiSubmitConvertImageFormat(stream, VPI_BACKEND_CUDA, imgInput, imgGrayscale, NULL);
-                vpiSubmitHarrisCornerDetector(stream, backend, harris, imgGrayscale, keypoints, scores, &harrisParams);
-
-                vpiStreamSync(stream);
-
-                VPIArrayData outKeypointsData;
-                VPIArrayData outScoresData;
-                VPIImageData imgData;
-                vpiArrayLock(keypoints, VPI_LOCK_READ, &outKeypointsData);
-                vpiArrayLock(scores, VPI_LOCK_READ, &outScoresData);
-                vpiImageLock(imgGrayscale, VPI_LOCK_READ, &imgData);
-
-                VPIKeypoint *outKeypoints = (VPIKeypoint *)outKeypointsData.data;
-                uint32_t *outScores       = (uint32_t *)outScoresData.data;
-
-                //TODO: Convert VPIKeypoint to n_pts
-                for (int i = 0; i < *outKeypointsData.sizePointer; i++)
-                {
-                    n_pts.push_back(cv::Point2f(outKeypoints[i].x, outKeypoints[i].y));
-                }
-
-                vpiImageUnlock(imgGrayscale);
-                vpiArrayUnlock(scores);
-                vpiArrayUnlock(keypoints);
-
-            }
-            else 
-                n_pts.clear();
-
-            if (stream != NULL)
-            {
-                vpiStreamSync(stream);
-            }
-  
-            vpiImageDestroy(imgInput);
-            vpiImageDestroy(imgGrayscale);
-            vpiArrayDestroy(keypoints);
-            vpiArrayDestroy(scores);
-            vpiPayloadDestroy(harris);
-            vpiStreamDestroy(stream);
+                backend->detect(cur_img, mask, n_max_cnt, n_pts);
+            featureBudget.detected(n_max_cnt, n_pts.size());
+            // printf("%s detect feature costs: %fms\n", backend->name(), t_t.toc());
         }
+        else
+            n_pts.clear();
 
         ROS_DEBUG("add feature begins");
         TicToc t_a;
@@ -666,90 +284,41 @@ map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> FeatureTracker::trackIm
         // printf("selectFeature costs: %fms\n", t_a.toc());
     }
 
-    cur_un_pts = undistortedPts(cur_pts, m_camera[0]);
-    pts_velocity = ptsVelocity(ids, cur_un_pts, cur_un_pts_map, prev_un_pts_map);
-
-    if(!_img1.empty() && stereo_cam)
+    bool track_right = !_img1.empty() && stereo_cam;
+    if(track_right)
     {
         ids_right.clear();
         cur_right_pts.clear();
         cur_un_right_pts.clear();
         right_pts_velocity.clear();
-        cur_un_right_pts_map.clear();
+        // left-right flow runs while the left points are undistorted below
         if(!cur_pts.empty())
         {
             //printf("stereo image; track feature on right image\n");
-            
-            vector<cv::Point2f> reverseLeftPts;
-            vector<uchar> status, statusRightLeft;
-            if(!USE_GPU_ACC_FLOW)
-            {
-                TicToc t_check;
-                vector<float> err;
-                // cur left ---- cur right
-                cv::calcOpticalFlowPyrLK(cur_img, rightImg, cur_pts, cur_right_pts, status, err, cv::Size(21, 21), 3);
-                // reverse check cur right ---- cur left
-                if(FLOW_BACK)
-                {
-                    cv::calcOpticalFlowPyrLK(rightImg, cur_img, cur_right_pts, reverseLeftPts, statusRightLeft, err, cv::Size(21, 21), 3);
-                    for(size_t i = 0; i < status.size(); i++)
-                    {
-                        if(status[i] && statusRightLeft[i] && inBorder(cur_right_pts[i]) && distance(cur_pts[i], reverseLeftPts[i]) <= 0.5)
-                            status[i] = 1;
-                        else
-                            status[i] = 0;
-                    }
-                }
-                // printf("left right optical flow cost %fms\n",t_check.toc());
-            }
+            if(params.ASYNC_STEREO)
+                right_track_job = std::async(std::launch::async, &FeatureTracker::trackRightImage, this);
             else
-            {
-                TicToc t_og1;
-                cv::cuda::GpuMat cur_gpu_img(cur_img);
-                cv::cuda::GpuMat right_gpu_Img(rightImg);
-                cv::cuda::GpuMat cur_gpu_pts(cur_pts);
-                cv::cuda::GpuMat cur_right_gpu_pts;
-                cv::cuda::GpuMat gpu_status;
-                cv::Ptr<cv::cuda::SparsePyrLKOpticalFlow> d_pyrLK_sparse = cv::cuda::SparsePyrLKOpticalFlow::create(
-                cv::Size(21, 21), 3, 30, false);
-                d_pyrLK_sparse->calc(cur_gpu_img, right_gpu_Img, cur_gpu_pts, cur_right_gpu_pts, gpu_status);
-
-                vector<cv::Point2f> tmp_cur_right_pts(cur_right_gpu_pts.cols);
-                cur_right_gpu_pts.download(tmp_cur_right_pts);
-                cur_right_pts = tmp_cur_right_pts;
-
-                vector<uchar> tmp_status(gpu_status.cols);
-                gpu_status.download(tmp_status);
-                status = tmp_status;
-
-                if(FLOW_BACK)
-                {   
-                    cv::cuda::GpuMat reverseLeft_gpu_Pts;
-                    cv::cuda::GpuMat status_gpu_RightLeft;
-                    cv::Ptr<cv::cuda::SparsePyrLKOpticalFlow> d_pyrLK_sparse = cv::cuda::SparsePyrLKOpticalFlow::create(
-                    cv::Size(21, 21), 3, 30, false);
-                    d_pyrLK_sparse->calc(right_gpu_Img, cur_gpu_img, cur_right_gpu_pts, reverseLeft_gpu_Pts, status_gpu_RightLeft);
-
-                    vector<cv::Point2f> tmp_reverseLeft_Pts(reverseLeft_gpu_Pts.cols);
-                    reverseLeft_gpu_Pts.download(tmp_reverseLeft_Pts);
-                    reverseLeftPts = tmp_reverseLeft_Pts;
-
-                    vector<uchar> tmp1_status(status_gpu_RightLeft.cols);
-                    status_gpu_RightLeft.download(tmp1_status);
-                    statusRightLeft = tmp1_status;
-                    for(size_t i = 0; i < status.size(); i++)
-                    {
-                        if(status[i] && statusRightLeft[i] && inBorder(cur_right_pts[i]) && distance(cur_pts[i], reverseLeftPts[i]) <= 0.5)
-                            status[i] = 1;
-                        else
-                            status[i] = 0;
-                    }
-                }
-                // printf("gpu left right optical flow cost %fms\n",t_og1.toc());
-            }
+                trackRightImage();
+        }
+    }
+
+    {
+        VINS_TRACE("undistort");
+        cur_un_pts = undistortedPts(cur_pts, m_lut[0]);
+        pts_velocity = ptsVelocity(ids, cur_un_pts, prev_ids, prev_un_pts);
+    }
+
+    if(track_right)
+    {
+        if(right_track_job.valid())
+            right_track_job.get();
+        if(right_prepare_job.valid())
+            right_prepare_job.get();
+        if(!cur_pts.empty())
+        {
             ids_right = ids;
-            reduceVector(cur_right_pts, status);
-            reduceVector(ids_right, status);
+            reduceVector(cur_right_pts, right_status);
+            reduceVector(ids_right, right_status);
             // only keep left-right pts
             /*
             reduceVector(cur_pts, status);
@@ -758,30 +327,37 @@ map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> FeatureTracker::trackIm
             reduceVector(cur_un_pts, status);
             reduceVector(pts_velocity, status);
             */
-            cur_un_right_pts = undistortedPts(cur_right_pts, m_camera[1]);
-            right_pts_velocity = ptsVelocity(ids_right, cur_un_right_pts, cur_un_right_pts_map, prev_un_right_pts_map);
+            cur_un_right_pts = undistortedPts(cur_right_pts, m_lut[1]);
+            right_pts_velocity = ptsVelocity(ids_right, cur_un_right_pts, prev_ids_right, prev_un_right_pts);
             
         }
-        prev_un_right_pts_map = cur_un_right_pts_map;
+        prev_ids_right = ids_right;
+        prev_un_right_pts = cur_un_right_pts;
     }
-    if(SHOW_TRACK)
-        drawTrack(cur_img, rightImg, ids, cur_pts, cur_right_pts, prevLeftPtsMap);
+    if(drawRequested)
+        fillDrawing(rightImg);
 
     prev_img = cur_img;
+    backend->nextFrame();
     prev_pts = cur_pts;
     prev_un_pts = cur_un_pts;
-    prev_un_pts_map = cur_un_pts_map;
+    prev_ids = ids;
     prev_time = cur_time;
+    prev_track_time = cur_time;
     hasPrediction = false;
+    hasRotationPrior = false;
 
-    prevLeftPtsMap.clear();
-    for(size_t i = 0; i < cur_pts.size(); i++)
-        prevLeftPtsMap[ids[i]] = cur_pts[i];
+    prev_left_pts = cur_pts;
 
-    map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> featureFrame;
+    // ids_right is a subsequence of ids and both are sorted, so a single pass keeps
+    // the frame sorted with each right observation next to its left one
+    bool stereo_frame = !_img1.empty() && stereo_cam;
+    FeatureFrame featureFrame;
+    featureFrame.reserve(ids.size() + (stereo_frame ? ids_right.size() : 0));
+    size_t j = 0;
     for (size_t i = 0; i < ids.size(); i++)
     {
-        int feature_id = ids[i];
+        FeatureId feature_id = ids[i];
         double x, y ,z;
         x = cur_un_pts[i].x;
         y = cur_un_pts[i].y;
@@ -789,70 +365,108 @@ map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> FeatureTracker::trackIm
         double p_u, p_v;
         p_u = cur_pts[i].x;
         p_v = cur_pts[i].y;
-        int camera_id = 0;
+        int camera_id = first_camera;
         double velocity_x, velocity_y;
         velocity_x = pts_velocity[i].x;
         velocity_y = pts_velocity[i].y;
 
         Eigen::Matrix<double, 7, 1> xyz_uv_velocity;
         xyz_uv_velocity << x, y, z, p_u, p_v, velocity_x, velocity_y;
-        featureFrame[feature_id].emplace_back(camera_id,  xyz_uv_velocity);
-    }
+        featureFrame.emplace_back(feature_id, camera_id, xyz_uv_velocity);
 
-    if (!_img1.empty() && stereo_cam)
-    {
-        for (size_t i = 0; i < ids_right.size(); i++)
+        if (stereo_frame && j < ids_right.size() && ids_right[j] == feature_id)
         {
-            int feature_id = ids_right[i];
-            double x, y ,z;
-            x = cur_un_right_pts[i].x;
-            y = cur_un_right_pts[i].y;
+            x = cur_un_right_pts[j].x;
+            y = cur_un_right_pts[j].y;
             z = 1;
-            double p_u, p_v;
-            p_u = cur_right_pts[i].x;
-            p_v = cur_right_pts[i].y;
-            int camera_id = 1;
-            double velocity_x, velocity_y;
-            velocity_x = right_pts_velocity[i].x;
-            velocity_y = right_pts_velocity[i].y;
-
-            Eigen::Matrix<double, 7, 1> xyz_uv_velocity;
+            p_u = cur_right_pts[j].x;
+            p_v = cur_right_pts[j].y;
+            camera_id = first_camera + 1;
+            velocity_x = right_pts_velocity[j].x;
+            velocity_y = right_pts_velocity[j].y;
+
             xyz_uv_velocity << x, y, z, p_u, p_v, velocity_x, velocity_y;
-            featureFrame[feature_id].emplace_back(camera_id,  xyz_uv_velocity);
+            featureFrame.emplace_back(feature_id, camera_id, xyz_uv_velocity);
+            j++;
         }
     }
 
+    if (featureBudget.update(cur_pts, row, col, t_r.toc()))
+        backend->setMinDist(featureBudget.minDist());
+    if (featureBudget.enabled())
+        VINS_DEBUG("camera %d feature target %d min_dist %d, %d tracked\n", first_camera, featureBudget.maxCnt(),
+                   featureBudget.minDist(), (int)cur_pts.size());
     //printf("feature track whole time %f\n", t_r.toc());
     return featureFrame;
 }
 
+void FeatureTracker::setBackendImage()
+{
+    VINS_TRACE("setImage");
+    if (backend == NULL || backend->width != col || backend->height != row)
+    {
+        delete backend;
+        backend = createTrackerBackend(params, col, row);
+        ROS_INFO("feature tracker backend: %s", backend->name());
+        featureBudget.reset(params);
+    }
+    // build each image pyramid once per frame; the left one is kept as next frame's prev pyramid
+    backend->setImage(cur_img);
+}
+
+void FeatureTracker::propagateTracks(double _cur_time, const cv::Mat &_img)
+{
+    cur_time = _cur_time;
+    cur_img = _img;
+    row = cur_img.rows;
+    col = cur_img.cols;
+    cur_pts.clear();
+    setBackendImage();
+    if (!prev_pts.empty())
+    {
+        vector<uchar> status;
+        if (hasPrediction)
+            cur_pts = predict_pts;
+        backend->trackTemporal(prev_pts, cur_pts, status, hasPrediction);
+        for (int i = 0; i < int(cur_pts.size()); i++)
+            if (status[i] && !inBorder(cur_pts[i]))
+                status[i] = 0;
+        reduceVector(cur_pts, status);
+        reduceVector(ids, status);
+        reduceVector(track_cnt, status);
+    }
+    for (auto &n : track_cnt)
+        n++;
+
+    // prev_time, prev_ids and prev_un_pts stay at the last output frame
+    prev_img = cur_img;
+    backend->nextFrame();
+    prev_pts = cur_pts;
+    prev_track_time = cur_time;
+    hasPrediction = false;
+    hasRotationPrior = false;
+}
+
 void FeatureTracker::rejectWithF()
 {
+    VINS_TRACE("rejectWithF");
     if (cur_pts.size() >= 8)
     {
         ROS_DEBUG("FM ransac begins");
         TicToc t_f;
-        vector<cv::Point2f> un_cur_pts(cur_pts.size()), un_prev_pts(prev_pts.size());
-        for (unsigned int i = 0; i < cur_pts.size(); i++)
-        {
-            Eigen::Vector3d tmp_p;
-            m_camera[0]->liftProjective(Eigen::Vector2d(cur_pts[i].x, cur_pts[i].y), tmp_p);
-            tmp_p.x() = FOCAL_LENGTH * tmp_p.x() / tmp_p.z() + col / 2.0;
-            tmp_p.y() = FOCAL_LENGTH * tmp_p.y() / tmp_p.z() + row / 2.0;
-            un_cur_pts[i] = cv::Point2f(tmp_p.x(), tmp_p.y());
-
-            m_camera[0]->liftProjective(Eigen::Vector2d(prev_pts[i].x, prev_pts[i].y), tmp_p);
-            tmp_p.x() = FOCAL_LENGTH * tmp_p.x() / tmp_p.z() + col / 2.0;
-            tmp_p.y() = FOCAL_LENGTH * tmp_p.y() / tmp_p.z() + row / 2.0;
-            un_prev_pts[i] = cv::Point2f(tmp_p.x(), tmp_p.y());
-        }
+        vector<cv::Point2f> un_cur_pts = undistortedPts(cur_pts, m_lut[0]);
+        vector<cv::Point2f> un_prev_pts = undistortedPts(prev_pts, m_lut[0]);
 
+        // F_THRESHOLD is in pixels of the virtual FOCAL_LENGTH camera
         vector<uchar> status;
-        cv::findFundamentalMat(un_cur_pts, un_prev_pts, cv::FM_RANSAC, F_THRESHOLD, 0.99, status);
+        if (hasRotationPrior)
+            EpipolarRansac::findInliersWithRotation(un_cur_pts, un_prev_pts, rotation_prior,
+                                                    params.F_THRESHOLD / FOCAL_LENGTH, 0.99, status);
+        else
+            EpipolarRansac::findInliers(un_cur_pts, un_prev_pts, params.F_THRESHOLD / FOCAL_LENGTH, 0.99, status);
         int size_a = cur_pts.size();
         reduceVector(prev_pts, status);
         reduceVector(cur_pts, status);
-        reduceVector(cur_un_pts, status);
         reduceVector(ids, status);
         reduceVector(track_cnt, status);
         ROS_DEBUG("FM ransac: %d -> %lu: %f", size_a, cur_pts.size(), 1.0 * cur_pts.size() / size_a);
@@ -860,6 +474,25 @@ void FeatureTracker::rejectWithF()
     }
 }
 
+// cur left ---- cur right, fills cur_right_pts and right_status
+void FeatureTracker::trackRightImage()
+{
+    // also runs on an async_stereo thread, which has no frame of its own
+    VINS_TRACE_FRAME("trackRightImage", cur_time);
+    if (right_prepare_job.valid())
+        right_prepare_job.get();
+
+    TicToc t_check;
+    backend->trackStereo(cur_pts, cur_right_pts, right_status);
+    if(params.FLOW_BACK)
+    {
+        for(size_t i = 0; i < right_status.size(); i++)
+            if(right_status[i] && !inBorder(cur_right_pts[i]))
+                right_status[i] = 0;
+    }
+    // printf("left right optical flow cost %fms\n",t_check.toc());
+}
+
 void FeatureTracker::readIntrinsicParameter(const vector<string> &calib_file)
 {
     for (size_t i = 0; i < calib_file.size(); i++)
@@ -867,170 +500,198 @@ void FeatureTracker::readIntrinsicParameter(const vector<string> &calib_file)
         ROS_INFO("reading paramerter of camera %s", calib_file[i].c_str());
         camodocal::CameraPtr camera = CameraFactory::instance()->generateCameraFromYamlFile(calib_file[i]);
         m_camera.push_back(camera);
+
+        camodocal::UndistortionLUT lut;
+        string lut_file = params.OUTPUT_FOLDER + "/undistort_lut_cam" + to_string(first_camera + i) + ".yml";
+        if (params.UNDISTORT_LUT_STEP > 0 && params.UNDISTORT_LUT_CACHE && lut.readFromFile(lut_file, camera, params.UNDISTORT_LUT_STEP))
+            ROS_INFO("undistortion table loaded from %s", lut_file.c_str());
+        else
+        {
+            lut.build(camera, params.UNDISTORT_LUT_STEP);
+            if (params.UNDISTORT_LUT_STEP > 0 && params.UNDISTORT_LUT_CACHE && !lut.writeToFile(lut_file))
+                ROS_WARN("cannot write undistortion table to %s", lut_file.c_str());
+        }
+        m_lut.push_back(lut);
     }
     if (calib_file.size() == 2)
         stereo_cam = 1;
-}
 
-void FeatureTracker::showUndistortion(const string &name)
-{
-    cv::Mat undistortedImg(row + 600, col + 600, CV_8UC1, cv::Scalar(0));
-    vector<Eigen::Vector2d> distortedp, undistortedp;
-    for (int i = 0; i < col; i++)
-        for (int j = 0; j < row; j++)
-        {
-            Eigen::Vector2d a(i, j);
-            Eigen::Vector3d b;
-            m_camera[0]->liftProjective(a, b);
-            distortedp.push_back(a);
-            undistortedp.push_back(Eigen::Vector2d(b.x() / b.z(), b.y() / b.z()));
-            //printf("%f,%f->%f,%f,%f\n)\n", a.x(), a.y(), b.x(), b.y(), b.z());
-        }
-    for (int i = 0; i < int(undistortedp.size()); i++)
+    fisheye_mask.release();
+    if (!params.FISHEYE_MASK.empty())
     {
-        cv::Mat pp(3, 1, CV_32FC1);
-        pp.at<float>(0, 0) = undistortedp[i].x() * FOCAL_LENGTH + col / 2;
-        pp.at<float>(1, 0) = undistortedp[i].y() * FOCAL_LENGTH + row / 2;
-        pp.at<float>(2, 0) = 1.0;
-        //cout << trackerData[0].K << endl;
-        //printf("%lf %lf\n", p.at<float>(1, 0), p.at<float>(0, 0));
-        //printf("%lf %lf\n", pp.at<float>(1, 0), pp.at<float>(0, 0));
-        if (pp.at<float>(1, 0) + 300 >= 0 && pp.at<float>(1, 0) + 300 < row + 600 && pp.at<float>(0, 0) + 300 >= 0 && pp.at<float>(0, 0) + 300 < col + 600)
-        {
-            undistortedImg.at<uchar>(pp.at<float>(1, 0) + 300, pp.at<float>(0, 0) + 300) = cur_img.at<uchar>(distortedp[i].y(), distortedp[i].x());
-        }
+        fisheye_mask = cv::imread(params.FISHEYE_MASK, cv::IMREAD_GRAYSCALE);
+        if (fisheye_mask.empty())
+            ROS_WARN("cannot read fisheye mask %s", params.FISHEYE_MASK.c_str());
         else
+            // setMask keeps only the 255 pixels, a jpg is not exactly 0/255
+            cv::threshold(fisheye_mask, fisheye_mask, 127, 255, cv::THRESH_BINARY);
+    }
+
+    m_rectify.clear();
+    if (calib_file.size() == 2 && params.PUB_RECTIFY && params.PUB_RECTIFY_IMAGE)
+    {
+        cv::Mat rectify_R[2];
+        cv::eigen2cv(params.rectify_R_left, rectify_R[0]);
+        cv::eigen2cv(params.rectify_R_right, rectify_R[1]);
+        // cam0 picks the rectified focal length and center, cam1 reuses them
+        float fx = -1.0f, fy = -1.0f, cx = -1.0f, cy = -1.0f;
+        for (size_t i = 0; i < 2; i++)
         {
-            //ROS_ERROR("(%f %f) -> (%f %f)", distortedp[i].y, distortedp[i].x, pp.at<float>(1, 0), pp.at<float>(0, 0));
+            camodocal::RectifyMap map;
+            string map_file = calib_file[i].substr(0, calib_file[i].find_last_of('.')) + ".rectify.bin";
+            if (params.RECTIFY_MAP_CACHE && map.readFromFile(map_file, m_camera[i], rectify_R[i], fx, fy, cv::Size(0, 0), cx, cy))
+                ROS_INFO("rectify map loaded from %s", map_file.c_str());
+            else
+            {
+                map.build(m_camera[i], rectify_R[i], fx, fy, cv::Size(0, 0), cx, cy);
+                if (params.RECTIFY_MAP_CACHE && !map.writeToFile(map_file))
+                    ROS_WARN("cannot write rectify map to %s", map_file.c_str());
+            }
+            if (params.USE_GPU && !map.setUseGpu(true))
+                ROS_WARN("no cuda remap, rectifying on the cpu");
+            if (i == 0)
+            {
+                const cv::Mat &K = map.cameraMatrix();
+                fx = K.at<float>(0, 0);
+                fy = K.at<float>(1, 1);
+                cx = K.at<float>(0, 2);
+                cy = K.at<float>(1, 2);
+            }
+            m_rectify.push_back(map);
         }
     }
+
+    delete backend;
+    backend = createTrackerBackend(params, params.COL, params.ROW);
+    ROS_INFO("feature tracker backend: %s", backend->name());
+}
+
+void FeatureTracker::showUndistortion(const string &name)
+{
+    // the virtual FOCAL_LENGTH camera with a 300 pixel border, mapped once for the whole image
+    camodocal::RectifyMap map;
+    map.build(m_camera[0], cv::Mat::eye(3, 3, CV_32F), FOCAL_LENGTH, FOCAL_LENGTH, cv::Size(col + 600, row + 600),
+              col / 2 + 300, row / 2 + 300);
+    cv::Mat undistortedImg;
+    map.remap(cur_img, undistortedImg);
     cv::imshow(name, undistortedImg);
     cv::waitKey(0);
 }
 
-vector<cv::Point2f> FeatureTracker::undistortedPts(vector<cv::Point2f> &pts, camodocal::CameraPtr cam)
+bool FeatureTracker::rectifyImages(const cv::Mat &img, const cv::Mat &img1, cv::Mat &rect, cv::Mat &rect1) const
+{
+    if (m_rectify.size() != 2 || img1.empty())
+        return false;
+    m_rectify[0].remap(img, rect);
+    m_rectify[1].remap(img1, rect1);
+    return true;
+}
+
+vector<cv::Point2f> FeatureTracker::undistortedPts(vector<cv::Point2f> &pts, const camodocal::UndistortionLUT &lut)
 {
+    vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>> a(pts.size());
+    vector<Eigen::Vector3d> b(pts.size());
+    for (unsigned int i = 0; i < pts.size(); i++)
+        a[i] = Eigen::Vector2d(pts[i].x, pts[i].y);
+    lut.liftProjectiveBatch(a.data(), b.data(), (int)pts.size());
+
     vector<cv::Point2f> un_pts;
+    un_pts.reserve(pts.size());
     for (unsigned int i = 0; i < pts.size(); i++)
-    {
-        Eigen::Vector2d a(pts[i].x, pts[i].y);
-        Eigen::Vector3d b;
-        cam->liftProjective(a, b);
-        un_pts.push_back(cv::Point2f(b.x() / b.z(), b.y() / b.z()));
-    }
+        un_pts.push_back(cv::Point2f(b[i].x() / b[i].z(), b[i].y() / b[i].z()));
     return un_pts;
 }
 
-vector<cv::Point2f> FeatureTracker::ptsVelocity(vector<int> &ids, vector<cv::Point2f> &pts, 
-                                            map<int, cv::Point2f> &cur_id_pts, map<int, cv::Point2f> &prev_id_pts)
+// ids and prev_id are both sorted ascending
+vector<cv::Point2f> FeatureTracker::ptsVelocity(const vector<FeatureId> &ids, const vector<cv::Point2f> &pts,
+                                            const vector<FeatureId> &prev_id, const vector<cv::Point2f> &prev_id_pts)
 {
-    vector<cv::Point2f> pts_velocity;
-    cur_id_pts.clear();
-    for (unsigned int i = 0; i < ids.size(); i++)
-    {
-        cur_id_pts.insert(make_pair(ids[i], pts[i]));
-    }
+    vector<cv::Point2f> pts_velocity(pts.size(), cv::Point2f(0, 0));
 
     // caculate points velocity
-    if (!prev_id_pts.empty())
-    {
-        double dt = cur_time - prev_time;
-        
-        for (unsigned int i = 0; i < pts.size(); i++)
-        {
-            std::map<int, cv::Point2f>::iterator it;
-            it = prev_id_pts.find(ids[i]);
-            if (it != prev_id_pts.end())
-            {
-                double v_x = (pts[i].x - it->second.x) / dt;
-                double v_y = (pts[i].y - it->second.y) / dt;
-                pts_velocity.push_back(cv::Point2f(v_x, v_y));
-            }
-            else
-                pts_velocity.push_back(cv::Point2f(0, 0));
-
-        }
-    }
-    else
+    double dt = cur_time - prev_time;
+    size_t j = 0;
+    for (size_t i = 0; i < ids.size(); i++)
     {
-        for (unsigned int i = 0; i < cur_pts.size(); i++)
+        while (j < prev_id.size() && prev_id[j] < ids[i])
+            j++;
+        if (j == prev_id.size())
+            break;
+        if (prev_id[j] == ids[i])
         {
-            pts_velocity.push_back(cv::Point2f(0, 0));
+            double v_x = (pts[i].x - prev_id_pts[j].x) / dt;
+            double v_y = (pts[i].y - prev_id_pts[j].y) / dt;
+            pts_velocity[i] = cv::Point2f(v_x, v_y);
         }
     }
     return pts_velocity;
 }
 
-void FeatureTracker::drawTrack(const cv::Mat &imLeft, const cv::Mat &imRight, 
-                               vector<int> &curLeftIds,
-                               vector<cv::Point2f> &curLeftPts, 
-                               vector<cv::Point2f> &curRightPts,
-                               map<int, cv::Point2f> &prevLeftPtsMap)
+// images that do not own their pixels (a shared ROS message) are copied, the drawing outlives
+// the call
+void FeatureTracker::fillDrawing(const cv::Mat &rightImg)
 {
-    //int rows = imLeft.rows;
-    int cols = imLeft.cols;
-    if (!imRight.empty() && stereo_cam)
-        cv::hconcat(imLeft, imRight, imTrack);
-    else
-        imTrack = imLeft.clone();
-    cv::cvtColor(imTrack, imTrack, CV_GRAY2RGB);
-
-    for (size_t j = 0; j < curLeftPts.size(); j++)
-    {
-        double len = std::min(1.0, 1.0 * track_cnt[j] / 20);
-        cv::circle(imTrack, curLeftPts[j], 2, cv::Scalar(255 * (1 - len), 0, 255 * len), 2);
-    }
-    if (!imRight.empty() && stereo_cam)
-    {
-        for (size_t i = 0; i < curRightPts.size(); i++)
-        {
-            cv::Point2f rightPt = curRightPts[i];
-            rightPt.x += cols;
-            cv::circle(imTrack, rightPt, 2, cv::Scalar(0, 255, 0), 2);
-            //cv::Point2f leftPt = curLeftPtsTrackRight[i];
-            //cv::line(imTrack, leftPt, rightPt, cv::Scalar(0, 255, 0), 1, 8, 0);
-        }
-    }
-    
-    map<int, cv::Point2f>::iterator mapIt;
-    for (size_t i = 0; i < curLeftIds.size(); i++)
+    drawRequested = false;
+    drawing.t = cur_time;
+    drawing.left = cur_img.u ? cur_img : cur_img.clone();
+    if (!rightImg.empty() && stereo_cam)
     {
-        int id = curLeftIds[i];
-        mapIt = prevLeftPtsMap.find(id);
-        if(mapIt != prevLeftPtsMap.end())
-        {
-            cv::arrowedLine(imTrack, curLeftPts[i], mapIt->second, cv::Scalar(0, 255, 0), 1, 8, 0, 0.2);
-        }
+        drawing.right = rightImg.u ? rightImg : rightImg.clone();
+        drawing.right_pts = cur_right_pts;
     }
-
-    //draw prediction
-    /*
-    for(size_t i = 0; i < predict_pts_debug.size(); i++)
+    else
     {
-        cv::circle(imTrack, predict_pts_debug[i], 2, cv::Scalar(0, 170, 255), 2);
+        drawing.right.release();
+        drawing.right_pts.clear();
     }
-    */
-    //printf("predict pts size %d \n", (int)predict_pts_debug.size());
-
+    drawing.ids = ids;
+    drawing.pts = cur_pts;
+    drawing.track_cnt = track_cnt;
+    drawing.prev_ids = prev_ids;
+    drawing.prev_pts = prev_left_pts;
+}
 
-    //cv::Mat imCur2Compress;
-    //cv::resize(imCur2, imCur2Compress, cv::Size(cols, rows / 2));
 
-    cv::imshow("tracking", imTrack);
-    cv::waitKey(2);
+// rotation of the current camera frame in the previous one, only used for the next frame
+void FeatureTracker::setRotationPrior(const Eigen::Matrix3d &R_prev_cur)
+{
+    hasRotationPrior = true;
+    rotation_prior = R_prev_cur;
 }
 
+void FeatureTracker::setRotationPrediction(const Eigen::Matrix3d &R_prev_cur)
+{
+    // the constant velocity prediction also has the translation
+    if (hasPrediction || prev_pts.empty())
+        return;
+    hasPrediction = true;
+    vector<cv::Point2f> un_prev_pts = undistortedPts(prev_pts, m_lut[0]);
+    Eigen::Matrix3d R_cur_prev = R_prev_cur.transpose();
+    predict_pts.resize(prev_pts.size());
+    predict_pts_debug.clear();
+    for (size_t i = 0; i < prev_pts.size(); i++)
+    {
+        Eigen::Vector3d p = R_cur_prev * Eigen::Vector3d(un_prev_pts[i].x, un_prev_pts[i].y, 1.0);
+        Eigen::Vector2d uv;
+        if (p.z() > 0)
+            m_camera[0]->spaceToPlane(p, uv);
+        if (p.z() > 0 && uv.allFinite())
+            predict_pts[i] = cv::Point2f(uv.x(), uv.y());
+        else
+            predict_pts[i] = prev_pts[i];
+    }
+}
 
-void FeatureTracker::setPrediction(map<int, Eigen::Vector3d> &predictPts)
+void FeatureTracker::setPrediction(map<FeatureId, Eigen::Vector3d> &predictPts)
 {
     hasPrediction = true;
     predict_pts.clear();
     predict_pts_debug.clear();
-    map<int, Eigen::Vector3d>::iterator itPredict;
+    map<FeatureId, Eigen::Vector3d>::iterator itPredict;
     for (size_t i = 0; i < ids.size(); i++)
     {
         //printf("prevLeftId size %d prevLeftPts size %d\n",(int)prevLeftIds.size(), (int)prevLeftPts.size());
-        int id = ids[i];
+        FeatureId id = ids[i];
         itPredict = predictPts.find(id);
         if (itPredict != predictPts.end())
         {
@@ -1045,9 +706,9 @@ void FeatureTracker::setPrediction(map<int, Eigen::Vector3d> &predictPts)
 }
 
 
-void FeatureTracker::removeOutliers(set<int> &removePtsIds)
+void FeatureTracker::removeOutliers(set<FeatureId> &removePtsIds)
 {
-    std::set<int>::iterator itSet;
+    std::set<FeatureId>::iterator itSet;
     vector<uchar> status;
     for (size_t i = 0; i < ids.size(); i++)
     {
@@ -1062,9 +723,3 @@ void FeatureTracker::removeOutliers(set<int> &removePtsIds)
     reduceVector(ids, status);
     reduceVector(track_cnt, status);
 }
-
-
-cv::Mat FeatureTracker::getTrackImage()
-{
-    return imTrack;
-}
\ No newline at end of file
@@ -14,31 +14,24 @@
 #include <cstdio>
 #include <iostream>
 #include <queue>
+#include <future>
 #include <execinfo.h>
 #include <csignal>
 #include <opencv2/opencv.hpp>
 #include <eigen3/Eigen/Dense>
-#include <opencv2/cudaoptflow.hpp>
-#include <opencv2/cudaimgproc.hpp>
-#include <opencv2/cudaarithm.hpp>
-
-#include <vpi/OpenCVInterop.hpp>
-  
-#include <vpi/Array.h>
-#include <vpi/Image.h>
-#include <vpi/Pyramid.h>
-#include <vpi/Status.h>
-#include <vpi/Stream.h>
-#include <vpi/algo/ConvertImageFormat.h>
-#include <vpi/algo/GaussianPyramid.h>
-#include <vpi/algo/HarrisCorners.h>
-#include <vpi/algo/OpticalFlowPyrLK.h>
-
 #include "camodocal/camera_models/CameraFactory.h"
 #include "camodocal/camera_models/CataCamera.h"
 #include "camodocal/camera_models/PinholeCamera.h"
+#include "camodocal/camera_models/UndistortionLUT.h"
+#include "camodocal/camera_models/RectifyMap.h"
 #include "../estimator/parameters.h"
+#include "../estimator/feature_frame.h"
 #include "../utility/tic_toc.h"
+#include "../utility/trace.h"
+#include "../utility/epipolar_ransac.h"
+#include "tracker_backend.h"
+#include "track_drawing.h"
+#include "feature_budget.h"
 
 using namespace std;
 using namespace camodocal;
@@ -47,43 +40,50 @@ using namespace Eigen;
 bool inBorder(const cv::Point2f &pt);
 void reduceVector(vector<cv::Point2f> &v, vector<uchar> status);
 void reduceVector(vector<int> &v, vector<uchar> status);
-
-// Sort keypoints by decreasing score, and retain only the first 'max'
-void SortKeypoints(VPIArray keypoints, VPIArray scores, int max);
-
-int UpdateMask(cv::Mat &cvMask, const std::vector<cv::Scalar> &trackColors, VPIArray prevFeatures,
-                       VPIArray curFeatures, VPIArray status);
+void reduceVector(vector<FeatureId> &v, vector<uchar> status);
 
 class FeatureTracker
 {
 public:
-    FeatureTracker();
-    map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> trackImage(double _cur_time, const cv::Mat &_img, const cv::Mat &_img1 = cv::Mat());
+    // _params is kept by reference, it belongs to the estimator. _first_camera: the camera of the
+    // left image (and first calibration file), the right one is _first_camera + 1
+    explicit FeatureTracker(const Parameters &_params, int _first_camera = 0);
+    ~FeatureTracker();
+    // _img/_img1 may share a ROS message buffer, they are only read during the call
+    FeatureFrame trackImage(double _cur_time, const cv::Mat &_img, const cv::Mat &_img1 = cv::Mat());
+    // a frame the estimator does not take: the left points are only carried forward by LK, no
+    // detection, undistortion, stereo or drawing. The next trackImage takes the velocities over
+    // both frames.
+    void propagateTracks(double _cur_time, const cv::Mat &_img);
     void setMask();
     void addPoints();
+    void detectGrid(int n_max_cnt);
     void readIntrinsicParameter(const vector<string> &calib_file);
     void showUndistortion(const string &name);
+    // publish_rectify_image: both images through the cam0/cam1_rectify maps, false without them
+    bool rectifyImages(const cv::Mat &img, const cv::Mat &img1, cv::Mat &rect, cv::Mat &rect1) const;
     void rejectWithF();
     void undistortedPoints();
-    vector<cv::Point2f> undistortedPts(vector<cv::Point2f> &pts, camodocal::CameraPtr cam);
-    vector<cv::Point2f> ptsVelocity(vector<int> &ids, vector<cv::Point2f> &pts, 
-                                    map<int, cv::Point2f> &cur_id_pts, map<int, cv::Point2f> &prev_id_pts);
+    vector<cv::Point2f> undistortedPts(vector<cv::Point2f> &pts, const camodocal::UndistortionLUT &lut);
+    vector<cv::Point2f> ptsVelocity(const vector<FeatureId> &ids, const vector<cv::Point2f> &pts,
+                                    const vector<FeatureId> &prev_id, const vector<cv::Point2f> &prev_id_pts);
     void showTwoImage(const cv::Mat &img1, const cv::Mat &img2, 
                       vector<cv::Point2f> pts1, vector<cv::Point2f> pts2);
-    void drawTrack(const cv::Mat &imLeft, const cv::Mat &imRight, 
-                                   vector<int> &curLeftIds,
-                                   vector<cv::Point2f> &curLeftPts, 
-                                   vector<cv::Point2f> &curRightPts,
-                                   map<int, cv::Point2f> &prevLeftPtsMap);
-    void setPrediction(map<int, Eigen::Vector3d> &predictPts);
+    // show_track: the next trackImage copies what its tracking image shows into drawing
+    void requestDrawing() { drawRequested = true; }
+    void setPrediction(map<FeatureId, Eigen::Vector3d> &predictPts);
+    void setRotationPrior(const Eigen::Matrix3d &R_prev_cur);
+    // gyro_prediction: every point moved by the camera rotation R_prev_cur since prev_pts, unless
+    // the estimator has already set a prediction
+    void setRotationPrediction(const Eigen::Matrix3d &R_prev_cur);
     double distance(cv::Point2f &pt1, cv::Point2f &pt2);
-    void removeOutliers(set<int> &removePtsIds);
-    cv::Mat getTrackImage();
+    void removeOutliers(set<FeatureId> &removePtsIds);
     bool inBorder(const cv::Point2f &pt);
+    void trackRightImage();
 
     int row, col;
-    cv::Mat imTrack;
     cv::Mat mask;
+    // fisheye_mask, binarized; setMask starts from it when it has the image size
     cv::Mat fisheye_mask;
     cv::Mat prev_img, cur_img;
     vector<cv::Point2f> n_pts;
@@ -91,17 +91,40 @@ public:
     vector<cv::Point2f> predict_pts;
     vector<cv::Point2f> predict_pts_debug;
     vector<cv::Point2f> prev_pts, cur_pts, cur_right_pts;
+    vector<uchar> right_status;
+    std::future<void> right_prepare_job, right_track_job;
     vector<cv::Point2f> prev_un_pts, cur_un_pts, cur_un_right_pts;
     vector<cv::Point2f> pts_velocity, right_pts_velocity;
-    vector<int> ids, ids_right;
+    // ids (and ids_right, a subsequence of them) stay sorted ascending, so the previous frame
+    // is matched by id with a linear merge instead of a map lookup
+    vector<FeatureId> ids, ids_right;
     vector<int> track_cnt;
-    map<int, cv::Point2f> cur_un_pts_map, prev_un_pts_map;
-    map<int, cv::Point2f> cur_un_right_pts_map, prev_un_right_pts_map;
-    map<int, cv::Point2f> prevLeftPtsMap;
+    vector<FeatureId> prev_ids, prev_ids_right;
+    vector<cv::Point2f> prev_un_right_pts;
+    vector<cv::Point2f> prev_left_pts;
     vector<camodocal::CameraPtr> m_camera;
+    vector<camodocal::UndistortionLUT> m_lut;
+    // stereo rectification with the camera matrix of m_rectify[0] for both images
+    vector<camodocal::RectifyMap> m_rectify;
     double cur_time;
-    double prev_time;
+    double prev_time;  // of the last trackImage, for the velocities
+    double prev_track_time;  // of the image prev_pts are in
     bool stereo_cam;
-    int n_id;
+    int first_camera;
+    FeatureId n_id;
     bool hasPrediction;
+    bool hasRotationPrior;
+    Eigen::Matrix3d rotation_prior;
+    TrackerBackend *backend;
+    bool drawRequested;
+    // of the last frame a drawing was requested for, t < 0 before that
+    TrackDrawing drawing;
+    // max_cnt and min_dist of the detection, moved by adaptive_features
+    FeatureBudget featureBudget;
+
+  private:
+    void setBackendImage();
+    void fillDrawing(const cv::Mat &rightImg);
+
+    const Parameters &params;
 };
@@ -0,0 +1,194 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "parallel_lk.h"
+
+#include <algorithm>
+#include <cmath>
+
+void LKPyramid::build(const cv::Mat &image, int max_level, cv::CLAHE *clahe)
+{
+    img.resize(max_level + 1);
+    dx.resize(max_level + 1);
+    dy.resize(max_level + 1);
+    // copied, the caller may write into its image buffer again while this is the previous frame
+    if (clahe)
+        clahe->apply(image, img[0]);
+    else
+        image.copyTo(img[0]);
+    for (int l = 1; l <= max_level; l++)
+        cv::pyrDown(img[l - 1], img[l]);
+    // integer Scharr, vectorized by OpenCV
+    for (int l = 0; l <= max_level; l++)
+    {
+        cv::Scharr(img[l], dx[l], CV_16S, 1, 0);
+        cv::Scharr(img[l], dy[l], CV_16S, 0, 1);
+    }
+}
+
+namespace
+{
+
+const int W_BITS = 14;
+const float FLT_SCALE = 1.f / (1 << 20);
+const int MAX_WIN = 31;
+
+inline int descale(int x, int n) { return (x + (1 << (n - 1))) >> n; }
+
+struct BilinearWeights
+{
+    BilinearWeights(float a, float b)
+    {
+        w00 = cvRound((1.f - a) * (1.f - b) * (1 << W_BITS));
+        w01 = cvRound(a * (1.f - b) * (1 << W_BITS));
+        w10 = cvRound((1.f - a) * b * (1 << W_BITS));
+        w11 = (1 << W_BITS) - w00 - w01 - w10;
+    }
+
+    template <typename T>
+    int at(const T *p, int step) const
+    {
+        return p[0] * w00 + p[1] * w01 + p[step] * w10 + p[step + 1] * w11;
+    }
+
+    int w00, w01, w10, w11;
+};
+
+inline bool windowInside(int x, int y, int win, const cv::Mat &m)
+{
+    return x >= 0 && y >= 0 && x + win < m.cols && y + win < m.rows;
+}
+
+// one point through all levels, false when lost
+bool trackPoint(const LKPyramid &prev, const LKPyramid &next, const cv::Point2f &prev_pt, cv::Point2f &next_pt,
+                int max_level, bool use_guess, int win, int max_iter, float eps2)
+{
+    short patch[MAX_WIN * MAX_WIN], grad_x[MAX_WIN * MAX_WIN], grad_y[MAX_WIN * MAX_WIN];
+    const cv::Point2f half((win - 1) * 0.5f, (win - 1) * 0.5f);
+    cv::Point2f cur = use_guess ? next_pt * (1.f / (1 << max_level)) : prev_pt * (1.f / (1 << max_level));
+
+    for (int level = max_level; level >= 0; level--)
+    {
+        if (level < max_level)
+            cur *= 2.f;
+        const cv::Mat &I = prev.img[level], &J = next.img[level];
+        const cv::Mat &I_x = prev.dx[level], &I_y = prev.dy[level];
+
+        // template and gradients around the point in the previous image
+        cv::Point2f p = prev_pt * (1.f / (1 << level)) - half;
+        int ix = cvFloor(p.x), iy = cvFloor(p.y);
+        if (!windowInside(ix, iy, win, I))
+        {
+            if (level == 0)
+                return false;
+            continue;
+        }
+        BilinearWeights wi(p.x - ix, p.y - iy);
+        const int step = I.step1(), dstep = I_x.step1();
+        float A11 = 0, A12 = 0, A22 = 0;
+        for (int y = 0, k = 0; y < win; y++)
+        {
+            const uchar *src = I.ptr<uchar>(iy + y) + ix;
+            const short *sx = I_x.ptr<short>(iy + y) + ix;
+            const short *sy = I_y.ptr<short>(iy + y) + ix;
+            for (int x = 0; x < win; x++, k++)
+            {
+                int gx = descale(wi.at(sx + x, dstep), W_BITS);
+                int gy = descale(wi.at(sy + x, dstep), W_BITS);
+                patch[k] = static_cast<short>(descale(wi.at(src + x, step), W_BITS - 5));
+                grad_x[k] = static_cast<short>(gx);
+                grad_y[k] = static_cast<short>(gy);
+                A11 += static_cast<float>(gx * gx);
+                A12 += static_cast<float>(gx * gy);
+                A22 += static_cast<float>(gy * gy);
+            }
+        }
+        A11 *= FLT_SCALE;
+        A12 *= FLT_SCALE;
+        A22 *= FLT_SCALE;
+        float det = A11 * A22 - A12 * A12;
+        float min_eig = (A22 + A11 - std::sqrt((A11 - A22) * (A11 - A22) + 4.f * A12 * A12)) / (2 * win * win);
+        if (min_eig < 1e-4f || det < FLT_EPSILON)
+        {
+            if (level == 0)
+                return false;
+            continue;
+        }
+        float D = 1.f / det;
+
+        // Gauss-Newton on the displacement in the next image
+        cv::Point2f q = cur - half, prev_delta(0, 0);
+        for (int iter = 0; iter < max_iter; iter++)
+        {
+            int jx = cvFloor(q.x), jy = cvFloor(q.y);
+            if (!windowInside(jx, jy, win, J))
+            {
+                if (level == 0)
+                    return false;
+                break;
+            }
+            BilinearWeights wj(q.x - jx, q.y - jy);
+            const int jstep = J.step1();
+            float b1 = 0, b2 = 0;
+            for (int y = 0, k = 0; y < win; y++)
+            {
+                const uchar *src = J.ptr<uchar>(jy + y) + jx;
+                for (int x = 0; x < win; x++, k++)
+                {
+                    int diff = descale(wj.at(src + x, jstep), W_BITS - 5) - patch[k];
+                    b1 += static_cast<float>(diff * grad_x[k]);
+                    b2 += static_cast<float>(diff * grad_y[k]);
+                }
+            }
+            b1 *= FLT_SCALE;
+            b2 *= FLT_SCALE;
+            cv::Point2f delta((A12 * b2 - A22 * b1) * D, (A12 * b1 - A11 * b2) * D);
+            q += delta;
+            if (delta.dot(delta) <= eps2)
+                break;
+            // oscillating between two positions, settle in the middle
+            if (iter > 0 && std::abs(delta.x + prev_delta.x) < 0.01f && std::abs(delta.y + prev_delta.y) < 0.01f)
+            {
+                q -= delta * 0.5f;
+                break;
+            }
+            prev_delta = delta;
+        }
+        cur = q + half;
+    }
+    next_pt = cur;
+    return true;
+}
+
+}  // namespace
+
+void parallelLK(const LKPyramid &prev, const LKPyramid &next, const std::vector<cv::Point2f> &prev_pts,
+                std::vector<cv::Point2f> &next_pts, std::vector<uchar> &status, int max_level,
+                bool use_initial_flow, int win_size, int max_iter, float eps)
+{
+    CV_Assert(win_size <= MAX_WIN && max_level < prev.levels() && max_level < next.levels());
+    const int n = prev_pts.size();
+    const cv::Mat &J = next.img[0];
+    // the guesses are only read when there is one per point
+    bool guesses = use_initial_flow && static_cast<int>(next_pts.size()) == n;
+    next_pts.resize(n);
+    status.resize(n);
+    cv::parallel_for_(cv::Range(0, n), [&](const cv::Range &range)
+    {
+        for (int i = range.start; i < range.end; i++)
+        {
+            const cv::Point2f &g = next_pts[i];
+            bool use_guess = guesses && std::isfinite(g.x) && std::isfinite(g.y) && g.x >= 0 && g.y >= 0 &&
+                             g.x < J.cols && g.y < J.rows;
+            cv::Point2f pt = use_guess ? g : prev_pts[i];
+            status[i] = trackPoint(prev, next, prev_pts[i], pt, max_level, use_guess, win_size, max_iter, eps * eps);
+            next_pts[i] = pt;
+        }
+    }, std::max(1, n / 32));
+}
@@ -0,0 +1,39 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Levels of one image and their Scharr gradients (CV_16S), built once per image and shared by every
+// LK call that tracks from it or into it. The buffers are reused from frame to frame.
+struct LKPyramid
+{
+    // clahe: level 0 is the equalized image instead of a copy
+    void build(const cv::Mat &image, int max_level, cv::CLAHE *clahe = NULL);
+    int levels() const { return img.size(); }
+    void swap(LKPyramid &other)
+    {
+        img.swap(other.img);
+        dx.swap(other.dx);
+        dy.swap(other.dy);
+    }
+
+    std::vector<cv::Mat> img, dx, dy;
+};
+
+// Sparse pyramidal Lucas-Kanade, the points split over cv::parallel_for_ and tracked independently
+// with the fixed point bilinear interpolation of cv::calcOpticalFlowPyrLK.
+// use_initial_flow: next_pts holds a guess per point in full resolution pixels, the search starts
+// there on level max_level; a missing guess or one outside the image starts from the point itself.
+// A point is lost (status 0) when its window leaves level 0 or its gradients are too weak there.
+void parallelLK(const LKPyramid &prev, const LKPyramid &next, const std::vector<cv::Point2f> &prev_pts,
+                std::vector<cv::Point2f> &next_pts, std::vector<uchar> &status, int max_level,
+                bool use_initial_flow, int win_size = 21, int max_iter = 30, float eps = 0.01f);
@@ -0,0 +1,42 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "track_drawing.h"
+
+#include <algorithm>
+
+cv::Mat drawTrack(const TrackDrawing &drawing)
+{
+    cv::Mat imTrack;
+    int cols = drawing.left.cols;
+    if (!drawing.right.empty())
+        cv::hconcat(drawing.left, drawing.right, imTrack);
+    else
+        imTrack = drawing.left.clone();
+    cv::cvtColor(imTrack, imTrack, CV_GRAY2BGR);
+
+    for (size_t j = 0; j < drawing.pts.size(); j++)
+    {
+        double len = std::min(1.0, 1.0 * drawing.track_cnt[j] / 20);
+        cv::circle(imTrack, drawing.pts[j], 2, cv::Scalar(255 * (1 - len), 0, 255 * len), 2);
+    }
+    for (const cv::Point2f &pt : drawing.right_pts)
+        cv::circle(imTrack, cv::Point2f(pt.x + cols, pt.y), 2, cv::Scalar(0, 255, 0), 2);
+
+    size_t k = 0;
+    for (size_t i = 0; i < drawing.ids.size(); i++)
+    {
+        FeatureId id = drawing.ids[i];
+        while (k < drawing.prev_ids.size() && drawing.prev_ids[k] < id)
+            k++;
+        if (k < drawing.prev_ids.size() && drawing.prev_ids[k] == id)
+            cv::arrowedLine(imTrack, drawing.pts[i], drawing.prev_pts[k], cv::Scalar(0, 255, 0), 1, 8, 0, 0.2);
+    }
+    return imTrack;
+}
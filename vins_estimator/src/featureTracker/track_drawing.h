@@ -0,0 +1,32 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "../estimator/feature_frame.h"
+
+// What the tracking image of one frame shows, copied out of the tracker so it can be drawn on
+// another thread. The images own their pixels.
+struct TrackDrawing
+{
+    TrackDrawing() : t(-1) {}
+
+    double t;
+    cv::Mat left, right;  // right empty for a monocular frame
+    std::vector<FeatureId> ids, prev_ids;  // both sorted ascending
+    std::vector<cv::Point2f> pts, right_pts, prev_pts;
+    std::vector<int> track_cnt;
+};
+
+// the left (and right) image in BGR, the points colored by track length, the right points in
+// green and an arrow from each point to where it was in the previous frame
+cv::Mat drawTrack(const TrackDrawing &drawing);
@@ -0,0 +1,73 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "tracker_backend.h"
+#include "cpu_backend.h"
+#include "cuda_backend.h"
+#include "vpi_backend.h"
+#include "adaptive_backend.h"
+
+void reverseCheck(vector<uchar> &status, const vector<uchar> &reverse_status,
+                  const vector<cv::Point2f> &pts, const vector<cv::Point2f> &reverse_pts)
+{
+    for(size_t i = 0; i < status.size(); i++)
+    {
+        double dx = pts[i].x - reverse_pts[i].x;
+        double dy = pts[i].y - reverse_pts[i].y;
+        if(status[i] && reverse_status[i] && sqrt(dx * dx + dy * dy) <= 0.5)
+            status[i] = 1;
+        else
+            status[i] = 0;
+    }
+}
+
+static TrackerBackend *createConfiguredBackend(const Parameters &params, int width, int height)
+{
+    if (params.USE_VPI)
+    {
+        VPITrackerBackend *vpi_backend = new VPITrackerBackend(params, width, height);
+        if (vpi_backend->init())
+            return vpi_backend;
+        delete vpi_backend;
+        ROS_WARN("fall back to non-VPI tracking");
+    }
+    if (params.USE_GPU_ACC_FLOW || params.USE_GPU)
+        return new CudaTrackerBackend(params, width, height, params.USE_GPU_ACC_FLOW, params.USE_GPU);
+    return new CpuTrackerBackend(params, width, height);
+}
+
+TrackerBackend *createTrackerBackend(const Parameters &params, int width, int height)
+{
+    TrackerBackend *configured = createConfiguredBackend(params, width, height);
+    if (!params.ADAPTIVE_BACKEND)
+        return configured;
+
+    // the configured one starts, each other implementation the platform has is a candidate
+    vector<TrackerBackend *> candidates{configured};
+    string started = configured->name();
+    if (started != "cpu")
+        candidates.push_back(new CpuTrackerBackend(params, width, height));
+    if (started != "cuda" && cv::cuda::getCudaEnabledDeviceCount() > 0)
+        candidates.push_back(new CudaTrackerBackend(params, width, height, true, true));
+    if (started != "vpi")
+    {
+        VPITrackerBackend *vpi_backend = new VPITrackerBackend(params, width, height);
+        if (vpi_backend->init())
+            candidates.push_back(vpi_backend);
+        else
+            delete vpi_backend;
+    }
+    if (candidates.size() == 1)
+        return configured;
+    string names;
+    for (TrackerBackend *backend : candidates)
+        names += string(" ") + backend->name();
+    ROS_INFO("adaptive tracker backend over%s", names.c_str());
+    return new AdaptiveTrackerBackend(params, width, height, candidates);
+}
@@ -0,0 +1,64 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "../estimator/parameters.h"
+
+using namespace std;
+
+// Image-level operations of the feature tracker: pyramid build, sparse LK and corner detection.
+// One backend is created per tracker and keeps whatever persistent state it needs between frames.
+// setRightImage and trackStereo may run on another thread, concurrently with trackTemporal/detect.
+class TrackerBackend
+{
+  public:
+    TrackerBackend(const Parameters &_params, int _width, int _height)
+        : params(_params), width(_width), height(_height), min_dist(_params.MIN_DIST) {}
+    virtual ~TrackerBackend() {}
+
+    virtual const char *name() const = 0;
+
+    // build the pyramid (or upload) of the current left image
+    virtual void setImage(const cv::Mat &img) = 0;
+    // same for the current right image
+    virtual void setRightImage(const cv::Mat &img) = 0;
+    // track prev_pts from the previous left image into the current one,
+    // cur_pts holds the predicted positions on input when use_prediction is set
+    virtual void trackTemporal(const vector<cv::Point2f> &prev_pts, vector<cv::Point2f> &cur_pts,
+                               vector<uchar> &status, bool use_prediction) = 0;
+    // track left_pts from the current left image into the current right one
+    virtual void trackStereo(const vector<cv::Point2f> &left_pts, vector<cv::Point2f> &right_pts,
+                             vector<uchar> &status) = 0;
+    // up to max_cnt corners on the current left image, strongest first, outside the zeros of mask
+    virtual void detect(const cv::Mat &img, const cv::Mat &mask, int max_cnt, vector<cv::Point2f> &pts) = 0;
+    // same restricted to roi, points in full image coordinates; false if the backend only detects on
+    // the whole image. Called concurrently for different cells.
+    virtual bool detectRegion(const cv::Mat &img, const cv::Mat &mask, const cv::Rect &roi, int max_cnt,
+                              vector<cv::Point2f> &pts) { return false; }
+    // the current left image becomes the previous one
+    virtual void nextFrame() = 0;
+    // spacing of the detected corners, MIN_DIST unless adaptive_features moves it
+    virtual void setMinDist(int _min_dist) { min_dist = _min_dist; }
+
+    const Parameters &params;
+    int width, height;
+    int min_dist;
+};
+
+// keep status[i] only if the point tracked back within 0.5 pixel of where it started
+void reverseCheck(vector<uchar> &status, const vector<uchar> &reverse_status,
+                  const vector<cv::Point2f> &pts, const vector<cv::Point2f> &reverse_pts);
+
+// picks the backend from USE_VPI/USE_GPU_ACC_FLOW/USE_GPU, falling back to the CPU one; with
+// ADAPTIVE_BACKEND that one starts and the others the platform has are switched to when faster
+TrackerBackend *createTrackerBackend(const Parameters &params, int width, int height);
@@ -0,0 +1,345 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "vpi_backend.h"
+
+#include <algorithm>
+#include <numeric>
+
+// Max number of corners detected by harris corner algo
+constexpr int MAX_HARRIS_CORNERS = 8192;
+  
+// Max number of keypoints to be tracked
+constexpr int MAX_KEYPOINTS = 100;
+
+void SortKeypoints(VPIArray keypoints, VPIArray scores, int max)
+{
+    VPIArrayData ptsData, scoresData;
+    vpiArrayLock(keypoints, VPI_LOCK_READ_WRITE, &ptsData);
+    vpiArrayLock(scores, VPI_LOCK_READ_WRITE, &scoresData);
+  
+    std::vector<int> indices(*ptsData.sizePointer);
+    std::iota(indices.begin(), indices.end(), 0);
+  
+    stable_sort(indices.begin(), indices.end(), [&scoresData](int a, int b) {
+        uint32_t *score = reinterpret_cast<uint32_t *>(scoresData.data);
+        return score[a] >= score[b]; // decreasing score order
+    });
+  
+    // keep the only 'max' indexes.
+    indices.resize(std::min<size_t>(indices.size(), max));
+  
+    VPIKeypoint *kptData = reinterpret_cast<VPIKeypoint *>(ptsData.data);
+  
+    // reorder the keypoints to keep the first 'max' with highest scores.
+    std::vector<VPIKeypoint> kpt;
+    std::transform(indices.begin(), indices.end(), std::back_inserter(kpt),
+                    [kptData](int idx) { return kptData[idx]; });
+    std::copy(kpt.begin(), kpt.end(), kptData);
+  
+    // update keypoint array size.
+    *ptsData.sizePointer = kpt.size();
+  
+    vpiArrayUnlock(scores);
+    vpiArrayUnlock(keypoints);
+}
+
+static VPIBackend vpiBackendFromParam(int backend)
+{
+    if (backend == 1)
+        return VPI_BACKEND_CUDA;
+    else if (backend == 2)
+        return VPI_BACKEND_PVA;
+    else if (backend == 3)
+        return VPI_BACKEND_VIC;
+    return VPI_BACKEND_CPU;
+}
+
+// the backend of one stage: its own setting or vpi_backend, CUDA when that engine does not run it
+static VPIBackend stageBackend(int stage, int backend, uint64_t supported)
+{
+    VPIBackend b = vpiBackendFromParam(stage >= 0 ? stage : backend);
+    return (b & supported) ? b : VPI_BACKEND_CUDA;
+}
+
+VPITrackerBackend::VPITrackerBackend(const Parameters &_params, int _width, int _height)
+    : TrackerBackend(_params, _width, _height)
+{
+    levels = params.PYRAMID_LEVEL > 0 ? params.PYRAMID_LEVEL : 3;
+    capacity = std::max(params.MAX_CNT, MAX_KEYPOINTS);
+    const uint64_t CPU_CUDA = VPI_BACKEND_CPU | VPI_BACKEND_CUDA;
+    convert_backend = stageBackend(params.VPI_CONVERT_BACKEND, params.VPI_BACKEND, CPU_CUDA | VPI_BACKEND_VIC);
+    pyramid_backend = stageBackend(params.VPI_PYRAMID_BACKEND, params.VPI_BACKEND, CPU_CUDA);
+    harris_backend = stageBackend(params.VPI_HARRIS_BACKEND, params.VPI_BACKEND, CPU_CUDA | VPI_BACKEND_PVA);
+    lk_backend = stageBackend(params.VPI_LK_BACKEND, params.VPI_BACKEND, CPU_CUDA);
+}
+
+VPITrackerBackend::~VPITrackerBackend()
+{
+    release();
+}
+
+bool VPITrackerBackend::init()
+{
+    VPIStatus err = vpiStreamCreate(0, &stream);
+    if (err == VPI_SUCCESS)
+        err = vpiStreamCreate(0, &stream_right);
+    if (err == VPI_SUCCESS)
+        err = vpiStreamCreate(0, &stream_detect);
+    if (err == VPI_SUCCESS)
+        err = vpiEventCreate(0, &image_ready);
+    if (err == VPI_SUCCESS)
+        err = vpiPyramidCreate(width, height, VPI_IMAGE_FORMAT_U8, levels, 0.5, 0, &pyr_prev);
+    if (err == VPI_SUCCESS)
+        err = vpiPyramidCreate(width, height, VPI_IMAGE_FORMAT_U8, levels, 0.5, 0, &pyr_cur);
+    if (err == VPI_SUCCESS)
+        err = vpiPyramidCreate(width, height, VPI_IMAGE_FORMAT_U8, levels, 0.5, 0, &pyr_right);
+    if (err == VPI_SUCCESS)
+        err = vpiImageCreate(width, height, VPI_IMAGE_FORMAT_S16, 0, &harris_input);
+    if (err == VPI_SUCCESS)
+        err = vpiArrayCreate(capacity, VPI_ARRAY_TYPE_KEYPOINT, 0, &prev_features);
+    if (err == VPI_SUCCESS)
+        err = vpiArrayCreate(capacity, VPI_ARRAY_TYPE_KEYPOINT, 0, &cur_features);
+    if (err == VPI_SUCCESS)
+        err = vpiArrayCreate(capacity, VPI_ARRAY_TYPE_KEYPOINT, 0, &reverse_features);
+    if (err == VPI_SUCCESS)
+        err = vpiArrayCreate(capacity, VPI_ARRAY_TYPE_U8, 0, &lk_status);
+    if (err == VPI_SUCCESS)
+        err = vpiArrayCreate(capacity, VPI_ARRAY_TYPE_U8, 0, &reverse_status);
+    if (err == VPI_SUCCESS)
+        err = vpiArrayCreate(MAX_HARRIS_CORNERS, VPI_ARRAY_TYPE_KEYPOINT, 0, &keypoints);
+    if (err == VPI_SUCCESS)
+        err = vpiArrayCreate(MAX_HARRIS_CORNERS, VPI_ARRAY_TYPE_U32, 0, &scores);
+    if (err == VPI_SUCCESS)
+        err = vpiCreateOpticalFlowPyrLK(lk_backend, width, height, VPI_IMAGE_FORMAT_U8, levels, 0.5, &optflow);
+    if (err == VPI_SUCCESS)
+        err = vpiCreateHarrisCornerDetector(harris_backend, width, height, &harris);
+    if (err == VPI_SUCCESS && params.EQUALIZE)
+    {
+        err = vpiImageCreate(width, height, VPI_IMAGE_FORMAT_U8, 0, &equalized);
+        if (err == VPI_SUCCESS)
+            err = vpiImageCreate(width, height, VPI_IMAGE_FORMAT_U8, 0, &equalized_right);
+        if (err == VPI_SUCCESS)
+            err = vpiCreateEqualizeHist(pyramid_backend, VPI_IMAGE_FORMAT_U8, &equalize);
+        if (err == VPI_SUCCESS)
+            err = vpiCreateEqualizeHist(pyramid_backend, VPI_IMAGE_FORMAT_U8, &equalize_right);
+    }
+
+    if (err != VPI_SUCCESS)
+    {
+        char msg[VPI_MAX_STATUS_MESSAGE_LENGTH];
+        vpiGetLastStatusMessage(msg, sizeof(msg));
+        ROS_WARN("failed to create VPI context (%s: %s)", vpiStatusGetName(err), msg);
+        release();
+        return false;
+    }
+
+    ROS_INFO("VPI context created: %dx%d, %d pyramid levels, backends convert %#x pyramid %#x harris %#x lk %#x",
+             width, height, levels, (unsigned)convert_backend, (unsigned)pyramid_backend, (unsigned)harris_backend,
+             (unsigned)lk_backend);
+    return true;
+}
+
+void VPITrackerBackend::release()
+{
+    if (stream != NULL)
+        vpiStreamSync(stream);
+    if (stream_right != NULL)
+        vpiStreamSync(stream_right);
+    if (stream_detect != NULL)
+        vpiStreamSync(stream_detect);
+
+    vpiPayloadDestroy(optflow);
+    vpiPayloadDestroy(harris);
+    vpiPayloadDestroy(equalize);
+    vpiPayloadDestroy(equalize_right);
+    vpiArrayDestroy(prev_features);
+    vpiArrayDestroy(cur_features);
+    vpiArrayDestroy(reverse_features);
+    vpiArrayDestroy(lk_status);
+    vpiArrayDestroy(reverse_status);
+    vpiArrayDestroy(keypoints);
+    vpiArrayDestroy(scores);
+    vpiPyramidDestroy(pyr_prev);
+    vpiPyramidDestroy(pyr_cur);
+    vpiPyramidDestroy(pyr_right);
+    vpiImageDestroy(frame);
+    vpiImageDestroy(frame_right);
+    vpiImageDestroy(harris_input);
+    vpiImageDestroy(equalized);
+    vpiImageDestroy(equalized_right);
+    vpiStreamDestroy(stream);
+    vpiStreamDestroy(stream_right);
+    vpiStreamDestroy(stream_detect);
+    vpiEventDestroy(image_ready);
+
+    optflow = harris = equalize = equalize_right = NULL;
+    prev_features = cur_features = reverse_features = lk_status = reverse_status = keypoints = scores = NULL;
+    pyr_prev = pyr_cur = pyr_right = NULL;
+    frame = frame_right = harris_input = equalized = equalized_right = NULL;
+    stream = stream_right = stream_detect = NULL;
+    image_ready = NULL;
+}
+
+bool VPITrackerBackend::inBorder(const cv::Point2f &pt) const
+{
+    const int BORDER_SIZE = 1;
+    int img_x = cvRound(pt.x);
+    int img_y = cvRound(pt.y);
+    return BORDER_SIZE <= img_x && img_x < width - BORDER_SIZE && BORDER_SIZE <= img_y && img_y < height - BORDER_SIZE;
+}
+
+// wrap img, equalize it and build its pyramid into pyr, one submission on s
+void VPITrackerBackend::buildPyramid(const cv::Mat &img, VPIImage &wrapper, VPIPayload equalize_payload,
+                                     VPIImage equalized_img, VPIPyramid pyr, VPIStream s)
+{
+    if (wrapper == NULL)
+        vpiImageCreateOpenCVMatWrapper(img, 0, &wrapper);
+    else
+        vpiImageSetWrappedOpenCVMat(wrapper, img);
+    VPIImage source = wrapper;
+    if (equalize_payload != NULL)
+    {
+        vpiSubmitEqualizeHist(s, pyramid_backend, equalize_payload, wrapper, equalized_img);
+        source = equalized_img;
+    }
+    vpiSubmitGaussianPyramidGenerator(s, pyramid_backend, source, pyr);
+}
+
+void VPITrackerBackend::setImage(const cv::Mat &img)
+{
+    buildPyramid(img, frame, equalize, equalized, pyr_cur, stream);
+    // the detector input only waits for the image, not for the pyramid
+    vpiEventRecord(image_ready, stream);
+    vpiStreamWaitEvent(stream_detect, image_ready);
+    vpiSubmitConvertImageFormat(stream_detect, convert_backend, equalized != NULL ? equalized : frame, harris_input,
+                                NULL);
+}
+
+void VPITrackerBackend::setRightImage(const cv::Mat &img)
+{
+    buildPyramid(img, frame_right, equalize_right, equalized_right, pyr_right, stream_right);
+    vpiStreamSync(stream_right);
+}
+
+// track from_pts from pyr_from into pyr_to, with the FLOW_BACK reverse check on the same pyramids
+void VPITrackerBackend::track(VPIPyramid pyr_from, VPIPyramid pyr_to, const vector<cv::Point2f> &from_pts,
+                              vector<cv::Point2f> &to_pts, vector<uchar> &status, VPIStream s)
+{
+    int n = std::min(static_cast<int>(from_pts.size()), capacity);
+
+    VPIArrayData prevData;
+    vpiArrayLock(prev_features, VPI_LOCK_WRITE, &prevData);
+    VPIKeypoint *pPrev = reinterpret_cast<VPIKeypoint *>(prevData.data);
+    for (int i = 0; i < n; i++)
+    {
+        pPrev[i].x = from_pts[i].x;
+        pPrev[i].y = from_pts[i].y;
+    }
+    *prevData.sizePointer = n;
+    vpiArrayUnlock(prev_features);
+
+    VPIOpticalFlowPyrLKParams lkParams;
+    vpiInitOpticalFlowPyrLKParams(&lkParams);
+    vpiSubmitOpticalFlowPyrLK(s, 0, optflow, pyr_from, pyr_to, prev_features,
+                              cur_features, lk_status, &lkParams);
+    if (params.FLOW_BACK)
+        vpiSubmitOpticalFlowPyrLK(s, 0, optflow, pyr_to, pyr_from, cur_features,
+                                  reverse_features, reverse_status, &lkParams);
+    vpiStreamSync(s);
+
+    to_pts.resize(from_pts.size());
+    status.assign(from_pts.size(), 0);
+
+    VPIArrayData curData, statusData;
+    vpiArrayLock(cur_features, VPI_LOCK_READ, &curData);
+    vpiArrayLock(lk_status, VPI_LOCK_READ, &statusData);
+    const VPIKeypoint *pCur = reinterpret_cast<VPIKeypoint *>(curData.data);
+    const uint8_t *pStatus = reinterpret_cast<uint8_t *>(statusData.data);
+    // VPI reports 0 for tracked points
+    for (int i = 0; i < n; i++)
+    {
+        to_pts[i] = cv::Point2f(pCur[i].x, pCur[i].y);
+        status[i] = pStatus[i] == 0;
+    }
+    vpiArrayUnlock(lk_status);
+    vpiArrayUnlock(cur_features);
+
+    if (params.FLOW_BACK)
+    {
+        vector<cv::Point2f> reverse_pts(from_pts.size());
+        vector<uchar> reverse_ok(from_pts.size(), 0);
+        VPIArrayData reverseData, reverseStatusData;
+        vpiArrayLock(reverse_features, VPI_LOCK_READ, &reverseData);
+        vpiArrayLock(reverse_status, VPI_LOCK_READ, &reverseStatusData);
+        const VPIKeypoint *pReverse = reinterpret_cast<VPIKeypoint *>(reverseData.data);
+        const uint8_t *pReverseStatus = reinterpret_cast<uint8_t *>(reverseStatusData.data);
+        for (int i = 0; i < n; i++)
+        {
+            reverse_pts[i] = cv::Point2f(pReverse[i].x, pReverse[i].y);
+            reverse_ok[i] = pReverseStatus[i] == 0;
+        }
+        vpiArrayUnlock(reverse_status);
+        vpiArrayUnlock(reverse_features);
+        reverseCheck(status, reverse_ok, from_pts, reverse_pts);
+    }
+}
+
+void VPITrackerBackend::trackTemporal(const vector<cv::Point2f> &prev_pts, vector<cv::Point2f> &cur_pts,
+                                      vector<uchar> &status, bool use_prediction)
+{
+    // VPI LK has no initial flow input, so the prediction from setPrediction is not used here
+    track(pyr_prev, pyr_cur, prev_pts, cur_pts, status, stream);
+}
+
+void VPITrackerBackend::trackStereo(const vector<cv::Point2f> &left_pts, vector<cv::Point2f> &right_pts,
+                                    vector<uchar> &status)
+{
+    // the left pyramid was submitted on the main stream
+    vpiStreamSync(stream);
+    track(pyr_cur, pyr_right, left_pts, right_pts, status, stream_right);
+}
+
+// harris corners on the current frame, strongest first, filtered by mask and min_dist
+void VPITrackerBackend::detect(const cv::Mat &img, const cv::Mat &mask, int max_cnt, vector<cv::Point2f> &pts)
+{
+    VPIHarrisCornerDetectorParams harrisParams;
+    vpiInitHarrisCornerDetectorParams(&harrisParams);
+    harrisParams.sensitivity = 0.01;
+
+    // harris_input was converted on stream_detect since setImage
+    vpiSubmitHarrisCornerDetector(stream_detect, harris_backend, harris, harris_input, keypoints, scores,
+                                  &harrisParams);
+    vpiStreamSync(stream_detect);
+
+    SortKeypoints(keypoints, scores, MAX_HARRIS_CORNERS);
+
+    pts.clear();
+    cv::Mat detect_mask = mask.clone();
+    VPIArrayData keypointsData;
+    vpiArrayLock(keypoints, VPI_LOCK_READ, &keypointsData);
+    const VPIKeypoint *pKeypoints = reinterpret_cast<VPIKeypoint *>(keypointsData.data);
+    for (int i = 0; i < *keypointsData.sizePointer && static_cast<int>(pts.size()) < max_cnt; i++)
+    {
+        cv::Point2f pt(pKeypoints[i].x, pKeypoints[i].y);
+        if (!inBorder(pt) || detect_mask.at<uchar>(pt) != 255)
+            continue;
+        pts.push_back(pt);
+        cv::circle(detect_mask, pt, min_dist, 0, -1);
+    }
+    vpiArrayUnlock(keypoints);
+}
+
+void VPITrackerBackend::nextFrame()
+{
+    // the conversion reads the wrapped image, which the caller may free after this frame
+    vpiStreamSync(stream_detect);
+    vpiStreamSync(stream);
+    std::swap(pyr_prev, pyr_cur);
+}
@@ -0,0 +1,91 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vpi/OpenCVInterop.hpp>
+
+#include <vpi/Array.h>
+#include <vpi/Event.h>
+#include <vpi/Image.h>
+#include <vpi/Pyramid.h>
+#include <vpi/Status.h>
+#include <vpi/Stream.h>
+#include <vpi/algo/ConvertImageFormat.h>
+#include <vpi/algo/EqualizeHist.h>
+#include <vpi/algo/GaussianPyramid.h>
+#include <vpi/algo/HarrisCorners.h>
+#include <vpi/algo/OpticalFlowPyrLK.h>
+
+#include "tracker_backend.h"
+
+// Sort keypoints by decreasing score, and retain only the first 'max'
+void SortKeypoints(VPIArray keypoints, VPIArray scores, int max);
+
+// NVIDIA VPI implementation. Each stage (format conversion, pyramid, Harris, LK) runs on its own
+// backend, VPI_*_BACKEND or VPI_BACKEND. All VPI objects are created once in init() for the image size
+// and reused; the current pyramid is swapped into the previous one. The conversion of the left image
+// for Harris is submitted on stream_detect right away, so it runs on its engine while LK runs on its.
+// With EQUALIZE a histogram equalization (VPI has no CLAHE) is submitted ahead of the pyramid on the
+// same stream, Harris runs on its output too.
+class VPITrackerBackend : public TrackerBackend
+{
+  public:
+    VPITrackerBackend(const Parameters &_params, int _width, int _height);
+    virtual ~VPITrackerBackend();
+    bool init();
+
+    virtual const char *name() const { return "vpi"; }
+    virtual void setImage(const cv::Mat &img);
+    virtual void setRightImage(const cv::Mat &img);
+    virtual void trackTemporal(const vector<cv::Point2f> &prev_pts, vector<cv::Point2f> &cur_pts,
+                               vector<uchar> &status, bool use_prediction);
+    virtual void trackStereo(const vector<cv::Point2f> &left_pts, vector<cv::Point2f> &right_pts,
+                             vector<uchar> &status);
+    virtual void detect(const cv::Mat &img, const cv::Mat &mask, int max_cnt, vector<cv::Point2f> &pts);
+    virtual void nextFrame();
+
+  private:
+    void release();
+    // equalize_payload/equalized are NULL without EQUALIZE
+    void buildPyramid(const cv::Mat &img, VPIImage &wrapper, VPIPayload equalize_payload, VPIImage equalized,
+                      VPIPyramid pyr, VPIStream s);
+    void track(VPIPyramid pyr_from, VPIPyramid pyr_to, const vector<cv::Point2f> &from_pts,
+               vector<cv::Point2f> &to_pts, vector<uchar> &status, VPIStream s);
+    bool inBorder(const cv::Point2f &pt) const;
+
+    int levels;
+    int capacity;
+    VPIBackend convert_backend, pyramid_backend, harris_backend, lk_backend;
+
+    VPIStream stream = NULL;
+    VPIStream stream_right = NULL;
+    VPIStream stream_detect = NULL;
+    // the left image (equalized when on) is ready on stream
+    VPIEvent image_ready = NULL;
+    VPIImage frame = NULL;
+    VPIImage frame_right = NULL;
+    VPIImage harris_input = NULL;
+    VPIImage equalized = NULL;
+    VPIImage equalized_right = NULL;
+    VPIPyramid pyr_prev = NULL;
+    VPIPyramid pyr_cur = NULL;
+    VPIPyramid pyr_right = NULL;
+    VPIArray prev_features = NULL;
+    VPIArray cur_features = NULL;
+    VPIArray reverse_features = NULL;
+    VPIArray lk_status = NULL;
+    VPIArray reverse_status = NULL;
+    VPIArray keypoints = NULL;
+    VPIArray scores = NULL;
+    VPIPayload optflow = NULL;
+    VPIPayload harris = NULL;
+    VPIPayload equalize = NULL;
+    VPIPayload equalize_right = NULL;
+};
@@ -16,7 +16,9 @@
 #include "../utility/utility.h"
 #include <ros/ros.h>
 #include <map>
+#include <memory>
 #include "../estimator/feature_manager.h"
+#include "../estimator/feature_frame.h"
 
 using namespace Eigen;
 using namespace std;
@@ -25,16 +27,17 @@ class ImageFrame
 {
     public:
         ImageFrame(){};
-        ImageFrame(const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>>& _points, double _t):t{_t},is_key_frame{false}
+        ImageFrame(const std::shared_ptr<const FeatureFrame> &_points, double _t):points{_points},t{_t},is_key_frame{false}
         {
-            points = _points;
         };
-        map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>> > > points;
+        // the observations of the frame as they came from featureBuf, not copied
+        std::shared_ptr<const FeatureFrame> points;
         double t;
         Matrix3d R;
         Vector3d T;
         IntegrationBase *pre_integration;
         bool is_key_frame;
 };
-void solveGyroscopeBias(map<double, ImageFrame> &all_image_frame, Vector3d* Bgs);
-bool VisualIMUAlignment(map<double, ImageFrame> &all_image_frame, Vector3d* Bgs, Vector3d &g, VectorXd &x);
\ No newline at end of file
+void solveGyroscopeBias(map<double, ImageFrame> &all_image_frame, WindowRing<Vector3d> &Bgs, const Parameters &params);
+bool VisualIMUAlignment(map<double, ImageFrame> &all_image_frame, WindowRing<Vector3d> &Bgs, Vector3d &g, VectorXd &x,
+                        const Parameters &params);
\ No newline at end of file
@@ -13,10 +13,9 @@
 
 #include <vector>
 #include "../estimator/parameters.h"
+#include "solve_5pts.h"
 using namespace std;
 
-#include <opencv2/opencv.hpp>
-
 #include <eigen3/Eigen/Dense>
 using namespace Eigen;
 #include <ros/console.h>
@@ -26,22 +25,18 @@ class InitialEXRotation
 {
 public:
 	InitialEXRotation();
-    bool CalibrationExRotation(vector<pair<Vector3d, Vector3d>> corres, Quaterniond delta_q_imu, Matrix3d &calib_ric_result);
+    // converges once window_size rotations are in and well conditioned. Every frame adds its
+    // constraint to the 4x4 normal equations, the cost does not grow with the frames seen
+    bool CalibrationExRotation(vector<pair<Vector3d, Vector3d>> corres, Quaterniond delta_q_imu, int window_size,
+                               Matrix3d &calib_ric_result);
 private:
-	Matrix3d solveRelativeR(const vector<pair<Vector3d, Vector3d>> &corres);
+	// camera rotation between the two frames of corres, false when it cannot be solved
+	bool solveRelativeR(const vector<pair<Vector3d, Vector3d>> &corres, Matrix3d &R);
 
-    double testTriangulation(const vector<cv::Point2f> &l,
-                             const vector<cv::Point2f> &r,
-                             cv::Mat_<double> R, cv::Mat_<double> t);
-    void decomposeE(cv::Mat E,
-                    cv::Mat_<double> &R1, cv::Mat_<double> &R2,
-                    cv::Mat_<double> &t1, cv::Mat_<double> &t2);
     int frame_count;
 
-    vector< Matrix3d > Rc;
-    vector< Matrix3d > Rimu;
-    vector< Matrix3d > Rc_g;
+    // A^T A of the stacked, huber weighted quaternion constraints (L(q_c) - R(q_imu)) q_ric = 0
+    Matrix4d AtA;
     Matrix3d ric;
+    MotionEstimator m_estimator;
 };
-
-
@@ -11,7 +11,16 @@
 
 #include "initial_sfm.h"
 
-GlobalSFM::GlobalSFM(){}
+GlobalSFM::GlobalSFM(ThreadPool *_pool) : final_rms(0), final_points(0), pool(_pool) {}
+
+void GlobalSFM::forEachFeature(const std::function<void(int)> &job)
+{
+	if (pool)
+		pool->run(feature_num, [&](int j, int) { job(j); });
+	else
+		for (int j = 0; j < feature_num; j++)
+			job(j);
+}
 
 void GlobalSFM::triangulatePoint(Eigen::Matrix<double, 3, 4> &Pose0, Eigen::Matrix<double, 3, 4> &Pose1,
 						Vector2d &point0, Vector2d &point1, Vector3d &point_3d)
@@ -55,7 +64,7 @@ bool GlobalSFM::solveFrameByPnP(Matrix3d &R_initial, Vector3d &P_initial, int i,
 	}
 	if (int(pts_2_vector.size()) < 15)
 	{
-		printf("unstable features tracking, please slowly move you device!\n");
+		VINS_WARN("unstable features tracking, please slowly move you device!\n");
 		if (int(pts_2_vector.size()) < 10)
 			return false;
 	}
@@ -87,10 +96,11 @@ void GlobalSFM::triangulateTwoFrames(int frame0, Eigen::Matrix<double, 3, 4> &Po
 									 vector<SFMFeature> &sfm_f)
 {
 	assert(frame0 != frame1);
-	for (int j = 0; j < feature_num; j++)
+	// each feature only writes its own entry
+	forEachFeature([&](int j)
 	{
 		if (sfm_f[j].state == true)
-			continue;
+			return;
 		bool has_0 = false, has_1 = false;
 		Vector2d point0;
 		Vector2d point1;
@@ -117,7 +127,7 @@ void GlobalSFM::triangulateTwoFrames(int frame0, Eigen::Matrix<double, 3, 4> &Po
 			sfm_f[j].position[2] = point_3d(2);
 			//cout << "trangulated : " << frame1 << "  3d point : "  << j << "  " << point_3d.transpose() << endl;
 		}							  
-	}
+	});
 }
 
 // 	 q w_R_cam t w_R_cam
@@ -127,7 +137,7 @@ void GlobalSFM::triangulateTwoFrames(int frame0, Eigen::Matrix<double, 3, 4> &Po
 // relative_t[i][j]  j_t_ji  (j < i)
 bool GlobalSFM::construct(int frame_num, Quaterniond* q, Vector3d* T, int l,
 			  const Matrix3d relative_R, const Vector3d relative_T,
-			  vector<SFMFeature> &sfm_f, map<int, Vector3d> &sfm_tracked_points)
+			  vector<SFMFeature> &sfm_f, map<FeatureId, Vector3d> &sfm_tracked_points)
 {
 	feature_num = sfm_f.size();
 	//cout << "set 0 and " << l << " as known " << endl;
@@ -206,10 +216,11 @@ bool GlobalSFM::construct(int frame_num, Quaterniond* q, Vector3d* T, int l,
 		triangulateTwoFrames(i, Pose[i], l, Pose[l], sfm_f);
 	}
 	//5: triangulate all other points
-	for (int j = 0; j < feature_num; j++)
+	Eigen::Matrix<double, 3, 4> *poses = Pose;
+	forEachFeature([&](int j)
 	{
 		if (sfm_f[j].state == true)
-			continue;
+			return;
 		if ((int)sfm_f[j].observation.size() >= 2)
 		{
 			Vector2d point0, point1;
@@ -218,14 +229,14 @@ bool GlobalSFM::construct(int frame_num, Quaterniond* q, Vector3d* T, int l,
 			int frame_1 = sfm_f[j].observation.back().first;
 			point1 = sfm_f[j].observation.back().second;
 			Vector3d point_3d;
-			triangulatePoint(Pose[frame_0], Pose[frame_1], point0, point1, point_3d);
+			triangulatePoint(poses[frame_0], poses[frame_1], point0, point1, point_3d);
 			sfm_f[j].state = true;
 			sfm_f[j].position[0] = point_3d(0);
 			sfm_f[j].position[1] = point_3d(1);
 			sfm_f[j].position[2] = point_3d(2);
 			//cout << "trangulated : " << frame_0 << " " << frame_1 << "  3d point : "  << j << "  " << point_3d.transpose() << endl;
 		}		
-	}
+	});
 
 /*
 	for (int i = 0; i < frame_num; i++)
@@ -286,6 +297,8 @@ bool GlobalSFM::construct(int frame_num, Quaterniond* q, Vector3d* T, int l,
 	options.linear_solver_type = ceres::DENSE_SCHUR;
 	//options.minimizer_progress_to_stdout = true;
 	options.max_solver_time_in_seconds = 0.2;
+	if (pool)
+		options.num_threads = pool->size();
 	ceres::Solver::Summary summary;
 	ceres::Solve(options, &problem, &summary);
 	//std::cout << summary.BriefReport() << "\n";
@@ -318,6 +331,8 @@ bool GlobalSFM::construct(int frame_num, Quaterniond* q, Vector3d* T, int l,
 		if(sfm_f[i].state)
 			sfm_tracked_points[sfm_f[i].id] = Vector3d(sfm_f[i].position[0], sfm_f[i].position[1], sfm_f[i].position[2]);
 	}
+	final_rms = summary.num_residuals > 0 ? sqrt(2 * summary.final_cost / summary.num_residuals) : 0;
+	final_points = sfm_tracked_points.size();
 	return true;
 
 }
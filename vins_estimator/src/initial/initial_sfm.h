@@ -19,6 +19,9 @@
 #include <map>
 #include <opencv2/core/eigen.hpp>
 #include <opencv2/opencv.hpp>
+#include "../utility/thread_pool.h"
+#include "../estimator/feature_frame.h"
+#include "../utility/vins_log.h"
 using namespace Eigen;
 using namespace std;
 
@@ -27,7 +30,7 @@ using namespace std;
 struct SFMFeature
 {
     bool state;
-    int id;
+    FeatureId id;
     vector<pair<int,Vector2d>> observation;
     double position[3];
     double depth;
@@ -67,10 +70,15 @@ struct ReprojectionError3D
 class GlobalSFM
 {
 public:
-	GlobalSFM();
+	// the features are triangulated and the final BA evaluated on pool when there is one
+	GlobalSFM(ThreadPool *_pool = NULL);
 	bool construct(int frame_num, Quaterniond* q, Vector3d* T, int l,
 			  const Matrix3d relative_R, const Vector3d relative_T,
-			  vector<SFMFeature> &sfm_f, map<int, Vector3d> &sfm_tracked_points);
+			  vector<SFMFeature> &sfm_f, map<FeatureId, Vector3d> &sfm_tracked_points);
+
+	// result of the last successful construct: rms reprojection error (normalized plane), points
+	double final_rms;
+	int final_points;
 
 private:
 	bool solveFrameByPnP(Matrix3d &R_initial, Vector3d &P_initial, int i, vector<SFMFeature> &sfm_f);
@@ -81,5 +89,9 @@ private:
 							  int frame1, Eigen::Matrix<double, 3, 4> &Pose1,
 							  vector<SFMFeature> &sfm_f);
 
+	// calls job(j) for every feature j, on pool if there is one
+	void forEachFeature(const std::function<void(int)> &job);
+
 	int feature_num;
+	ThreadPool *pool;
 };
\ No newline at end of file
@@ -14,8 +14,7 @@
 #include <vector>
 using namespace std;
 
-#include <opencv2/opencv.hpp>
-//#include <opencv2/core/eigen.hpp>
+#include <opencv2/core/core.hpp>
 #include <eigen3/Eigen/Dense>
 using namespace Eigen;
 
@@ -25,15 +24,15 @@ class MotionEstimator
 {
   public:
 
-    bool solveRelativeRT(const vector<pair<Vector3d, Vector3d>> &corres, Matrix3d &R, Vector3d &T);
+    // pose of the second frame of corres in the first one, translation up to scale. R_prior, the
+    // same rotation from the gyroscope, first selects the tracks consistent with it by 2-point
+    // translation RANSAC, which leaves the essential matrix fit only a few hypotheses
+    bool solveRelativeRT(const vector<pair<Vector3d, Vector3d>> &corres, Matrix3d &R, Vector3d &T,
+                         const Matrix3d *R_prior = NULL);
 
   private:
-    double testTriangulation(const vector<cv::Point2f> &l,
-                             const vector<cv::Point2f> &r,
-                             cv::Mat_<double> R, cv::Mat_<double> t);
-    void decomposeE(cv::Mat E,
-                    cv::Mat_<double> &R1, cv::Mat_<double> &R2,
-                    cv::Mat_<double> &t1, cv::Mat_<double> &t2);
+    // the decomposition of E (x2^T E x1 = 0) with the most status points in front of both
+    // cameras, the rotation closest to R21_prior among the two when given; the count is returned
+    int recoverPose(const Matrix3d &E, const vector<Vector3d> &x1, const vector<Vector3d> &x2,
+                    const vector<uchar> &status, const Matrix3d *R21_prior, Matrix3d &R21, Vector3d &t21);
 };
-
-
@@ -0,0 +1,382 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+// Microbenchmarks of the estimator kernels on synthetic input of the sizes a real window has.
+// The config gives the noise, camera and tracker settings, nothing is read from a dataset.
+//
+// rosrun vins vins_microbench [config file] [name filter]
+
+#include <stdio.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include <ros/ros.h>
+#include "estimator/parameters.h"
+#include "estimator/pose_history.h"
+#include "factor/integration_base.h"
+#include "factor/imu_factor.h"
+#include "factor/marginalization_factor.h"
+#include "factor/projectionTwoFrameOneCamFactor.h"
+#include "featureTracker/feature_tracker.h"
+#include "utility/thread_pool.h"
+#include "utility/landmark_map.h"
+#include "utility/microbench.h"
+
+using namespace std;
+using namespace Eigen;
+
+// imu samples between two frames at 200 Hz imu, 10 Hz camera
+static const int IMU_PER_FRAME = 20;
+static const double IMU_DT = 0.005;
+
+static void fillImu(IntegrationBase &pre, mt19937 &rng)
+{
+    normal_distribution<double> noise(0, 0.05);
+    for (int i = 0; i < IMU_PER_FRAME; i++)
+        pre.push_back(IMU_DT, Vector3d(noise(rng), noise(rng), 9.81 + noise(rng)),
+                      Vector3d(noise(rng), noise(rng), noise(rng)) * 0.1);
+}
+
+// The sliding window right before the oldest frame is marginalized: window_size + 1 frames moving
+// forward, features starting in every frame and tracked for 4 frames or more, plus one frame
+// older than the window whose marginalization made the prior.
+struct WindowFixture
+{
+    // features per start frame, about what survives of max_cnt from the oldest frame
+    static const int FEATURES = 80;
+
+    struct Feature
+    {
+        int start, length;
+        Vector3d point;
+        double inv_depth;
+        double *inv_depth_block;
+    };
+
+    explicit WindowFixture(const Parameters &params)
+        : frames(params.WINDOW_SIZE + 2), rng(1), loss(1.0), prior(NULL)
+    {
+        uniform_real_distribution<double> uv(-0.5, 0.5), depth(2, 10), track(4, params.WINDOW_SIZE + 1);
+        for (int i = 0; i < frames; i++)
+        {
+            Map<Vector3d>(pose[i]) = Vector3d(0.1 * i, 0, 0);
+            Map<Quaterniond>(pose[i] + 3) = Quaterniond::Identity();
+            Map<Matrix<double, 9, 1>>(speed_bias[i]).setZero();
+            speed_bias[i][0] = 2;
+            pre_integrations.emplace_back(new IntegrationBase(Vector3d(0, 0, 9.81), Vector3d::Zero(),
+                                                              Vector3d::Zero(), Vector3d::Zero(), params));
+            fillImu(*pre_integrations.back(), rng);
+        }
+        Map<Vector3d>(ex) = Vector3d::Zero();
+        Map<Quaterniond>(ex + 3) = Quaterniond::Identity();
+        td[0] = 0;
+
+        for (int s = 0; s < frames - 4; s++)
+            for (int k = 0; k < FEATURES; k++)
+            {
+                Feature f;
+                f.start = s;
+                f.length = min(static_cast<int>(track(rng)), frames - s);
+                double d = depth(rng);
+                f.point = Vector3d(uv(rng) * d + pose[s][0], uv(rng) * d, d);
+                f.inv_depth = 1.0 / (d * (1 + 0.05 * uv(rng)));
+                features.push_back(f);
+            }
+        // inv_depth is addressed by pointer, the vector is not touched again
+        for (Feature &f : features)
+            f.inv_depth_block = &f.inv_depth;
+
+        // the prior comes from frame 0, the benchmark marginalizes frame 1 on top of it
+        prior = oldest(0, NULL, NULL);
+        prior->preMarginalize();
+        prior->marginalize();
+        unordered_map<long, double *> addr_shift;
+        for (int i = 1; i < frames; i++)
+        {
+            addr_shift[reinterpret_cast<long>(pose[i])] = pose[i];
+            addr_shift[reinterpret_cast<long>(speed_bias[i])] = speed_bias[i];
+        }
+        addr_shift[reinterpret_cast<long>(ex)] = ex;
+        addr_shift[reinterpret_cast<long>(td)] = td;
+        prior_blocks = prior->getParameterBlocks(addr_shift);
+    }
+
+    ~WindowFixture() { delete prior; }
+
+    Vector3d observation(const Feature *f, int frame) const
+    {
+        Vector3d p = f->point - Map<const Vector3d>(pose[frame]);
+        return p / p.z();
+    }
+
+    // the marginalization of frame b with everything that the estimator hands to it
+    MarginalizationInfo *oldest(int b, ThreadPool *pool, MarginalizationWorkspace *workspace,
+                                const vector<double *> *with_prior = NULL)
+    {
+        MarginalizationInfo *info = new MarginalizationInfo(pool, workspace);
+        if (with_prior)
+        {
+            vector<int> drop_set;
+            for (int i = 0; i < static_cast<int>(with_prior->size()); i++)
+                if ((*with_prior)[i] == pose[b] || (*with_prior)[i] == speed_bias[b])
+                    drop_set.push_back(i);
+            info->addResidualBlockInfo(new MarginalizationFactor(prior), NULL, *with_prior, drop_set);
+        }
+        info->addResidualBlockInfo(new IMUFactor(pre_integrations[b + 1].get()), NULL,
+                                   vector<double *>{pose[b], speed_bias[b], pose[b + 1], speed_bias[b + 1]},
+                                   vector<int>{0, 1});
+        for (const Feature &f : features)
+        {
+            if (f.start != b)
+                continue;
+            Vector3d pts_i = observation(&f, b);
+            for (int j = b + 1; j < b + f.length; j++)
+                info->addResidualBlockInfo(
+                    new ProjectionTwoFrameOneCamFactor(pts_i, observation(&f, j), Vector2d::Zero(), Vector2d::Zero(), 0, 0),
+                    &loss, vector<double *>{pose[b], pose[j], ex, f.inv_depth_block, td}, vector<int>{0, 3});
+        }
+        return info;
+    }
+
+    int frames;
+    mt19937 rng;
+    ceres::HuberLoss loss;
+    double pose[MAX_WINDOW_SIZE + 2][SIZE_POSE];
+    double speed_bias[MAX_WINDOW_SIZE + 2][SIZE_SPEEDBIAS];
+    double ex[SIZE_POSE];
+    double td[1];
+    vector<unique_ptr<IntegrationBase>> pre_integrations;
+    vector<Feature> features;
+    MarginalizationInfo *prior;
+    vector<double *> prior_blocks;
+};
+
+// textured frames drifting a couple of pixels per frame, back and forth so the tracks never break
+static void syntheticFrames(int count, int rows, int cols, vector<cv::Mat> &left, vector<cv::Mat> &right)
+{
+    const int margin = 2 * count + 16;
+    cv::Mat base(rows + 2 * margin, cols + 2 * margin, CV_8UC1);
+    cv::theRNG().state = 1;
+    cv::randu(base, 0, 255);
+    cv::GaussianBlur(base, base, cv::Size(0, 0), 2.5);
+    cv::normalize(base, base, 0, 255, cv::NORM_MINMAX);
+    for (int i = 0; i < 2 * count; i++)
+    {
+        int k = i < count ? i : 2 * count - 1 - i;
+        left.push_back(base(cv::Rect(margin + 2 * k, margin + k, cols, rows)).clone());
+        // 12 pixel disparity
+        right.push_back(base(cv::Rect(margin + 2 * k + 12, margin + k, cols, rows)).clone());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2 && argc != 3)
+    {
+        printf("please intput: rosrun vins vins_microbench [config file] [name filter] \n"
+               "for example: rosrun vins vins_microbench "
+               "~/catkin_ws/src/VINS-Fusion/config/euroc/euroc_stereo_imu_config.yaml Marginalization \n");
+        return 1;
+    }
+    ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME, ros::console::levels::Warn);
+    Parameters params;
+    readParameters(argv[1], params);
+    MicroBench bench(argc == 3 ? argv[2] : "");
+    mt19937 rng(1);
+
+    {
+        IntegrationBase pre(Vector3d(0, 0, 9.81), Vector3d::Zero(), Vector3d::Zero(), Vector3d::Zero(), params);
+        vector<ImuStep> samples(IMU_PER_FRAME);
+        normal_distribution<double> noise(0, 0.05);
+        for (ImuStep &s : samples)
+        {
+            s.dt = IMU_DT;
+            s.acc = Vector3d(noise(rng), noise(rng), 9.81 + noise(rng));
+            s.gyr = Vector3d(noise(rng), noise(rng), noise(rng)) * 0.1;
+        }
+        bench.run("IntegrationBase::propagate/frame", [&](long n) {
+            for (long i = 0; i < n; i++)
+            {
+                pre.reset(Vector3d(0, 0, 9.81), Vector3d::Zero(), Vector3d::Zero(), Vector3d::Zero());
+                for (const ImuStep &s : samples)
+                    pre.propagate(s.dt, s.acc, s.gyr);
+                doNotOptimize(pre.delta_p);
+            }
+        }, IMU_PER_FRAME);
+        pre.reset(Vector3d(0, 0, 9.81), Vector3d::Zero(), Vector3d::Zero(), Vector3d::Zero());
+        for (const ImuStep &s : samples)
+            pre.push_back(s.dt, s.acc, s.gyr);
+        bench.run("IntegrationBase::repropagate/frame", [&](long n) {
+            for (long i = 0; i < n; i++)
+            {
+                pre.repropagate(Vector3d(0.01, 0, 0), Vector3d(0, 0.001, 0));
+                doNotOptimize(pre.delta_p);
+            }
+        }, IMU_PER_FRAME);
+    }
+
+    {
+        // 10 s at imu rate, queried between samples
+        const int capacity = 2000;
+        PoseHistory history;
+        history.reset(capacity);
+        Quaterniond Q = Quaterniond::Identity();
+        long k = 0;
+        for (; k < capacity; k++)
+            history.push(k * IMU_DT, Vector3d(k * 0.01, 0, 0), Q, Vector3d(2, 0, 0));
+        bench.run("PoseHistory::push", [&](long n) {
+            for (long i = 0; i < n; i++, k++)
+                history.push(k * IMU_DT, Vector3d(k * 0.01, 0, 0), Q, Vector3d(2, 0, 0));
+        });
+        uniform_real_distribution<double> offset(0, (capacity - 1) * IMU_DT);
+        vector<double> stamps(1024);
+        double newest = (k - 1) * IMU_DT;
+        for (double &t : stamps)
+            t = newest - offset(rng);
+        PoseHistory::State state;
+        bench.run("PoseHistory::query", [&](long n) {
+            for (long i = 0; i < n; i++)
+            {
+                history.query(stamps[i % stamps.size()], state);
+                doNotOptimize(state.P);
+            }
+        });
+    }
+
+    {
+        setProjectionSqrtInfo(FOCAL_LENGTH / 1.5 * Matrix2d::Identity());
+        double pose_i[SIZE_POSE] = {0, 0, 0, 0, 0, 0, 1};
+        double pose_j[SIZE_POSE] = {0.1, 0.02, 0, 0.01, 0.02, 0, 1};
+        double ex[SIZE_POSE] = {0, 0, 0, 0, 0, 0, 1};
+        double inv_depth = 0.2, td = 0;
+        Map<Quaterniond>(pose_j + 3).normalize();
+        double *parameters[5] = {pose_i, pose_j, ex, &inv_depth, &td};
+        double residuals[2];
+        Matrix<double, 2, 7, RowMajor> J0, J1, J2;
+        Matrix<double, 2, 1> J3, J4;
+        double *jacobians[5] = {J0.data(), J1.data(), J2.data(), J3.data(), J4.data()};
+        ProjectionTwoFrameOneCamFactor f(Vector3d(0.1, -0.05, 1), Vector3d(0.08, -0.06, 1), Vector2d(0.01, 0),
+                                         Vector2d(0.01, 0), 0, 0);
+        bench.run("ProjectionTwoFrameOneCamFactor::Evaluate/residual", [&](long n) {
+            for (long i = 0; i < n; i++)
+            {
+                f.Evaluate(parameters, residuals, NULL);
+                doNotOptimize(residuals[0]);
+            }
+        });
+        bench.run("ProjectionTwoFrameOneCamFactor::Evaluate/jacobians", [&](long n) {
+            for (long i = 0; i < n; i++)
+            {
+                f.Evaluate(parameters, residuals, jacobians);
+                doNotOptimize(J0);
+            }
+        });
+        ProjectionLayoutFactor<TwoFrameOneCam, SphereResidual> sphere(f.obs_i.point, f.obs_j.point, Vector2d(0.01, 0),
+                                                                      Vector2d(0.01, 0), 0, 0);
+        bench.run("ProjectionLayoutFactor<TwoFrameOneCam, SphereResidual>::Evaluate/jacobians", [&](long n) {
+            for (long i = 0; i < n; i++)
+            {
+                sphere.Evaluate(parameters, residuals, jacobians);
+                doNotOptimize(J0);
+            }
+        });
+    }
+
+    {
+        WindowFixture window(params);
+        ThreadPool pool(NUM_THREADS);
+        MarginalizationWorkspace workspace;
+        workspace.precision = static_cast<MarginalizationWorkspace::Precision>(params.MARGINALIZATION_FLOAT);
+        MarginalizationInfo *info = NULL;
+        // serial, on the pool, on the pool with the projection factors in one batch
+        const char *modes[3] = {"serial", "pool", "pool+batch"};
+        for (int mode = 0; mode < 3; mode++)
+        {
+            bool threaded = mode > 0;
+            if (mode == 2)
+                workspace.batch.reset(new ProjectionBatch());
+            auto setup = [&]() {
+                delete info;
+                info = window.oldest(1, threaded ? &pool : NULL, threaded ? &workspace : NULL, &window.prior_blocks);
+            };
+            setup();
+            info->preMarginalize();
+            info->marginalize();
+            char name[96];
+            snprintf(name, sizeof(name), "MarginalizationInfo::marginalize/%s%s/%d factors m=%d n=%d", modes[mode],
+                     mode == 2 && workspace.batch->onGpu() ? " gpu" : "", (int)info->factors.size(), info->m, info->n);
+            bench.runWithSetup(name, setup, [&]() {
+                info->preMarginalize();
+                info->marginalize();
+            });
+        }
+        delete info;
+    }
+
+    {
+        // points of a 40 m corridor, a keyframe of new ones at a time, on a full map
+        vector<Vector3d> points(20000);
+        uniform_real_distribution<double> along(0, 40), across(-2, 2);
+        for (Vector3d &p : points)
+            p = Vector3d(along(rng), across(rng), across(rng));
+        LandmarkMap map;
+        map.reset(0.1, 50000);
+        vector<uint32_t> updated, removed;
+        size_t k = 0;
+        bench.run("LandmarkMap::insert/100 points", [&](long n) {
+            for (long i = 0; i < n; i++)
+            {
+                for (int j = 0; j < 100; j++, k = (k + 1) % points.size())
+                    map.insert(points[k]);
+                map.takeChanges(updated, removed);
+                doNotOptimize(updated);
+            }
+        });
+    }
+
+    {
+        vector<cv::Mat> left, right;
+        struct Backend
+        {
+            const char *name;
+            int vpi, gpu_acc_flow, gpu;
+        } backends[] = {{"cpu", 0, 0, 0}, {"cuda", 0, 1, 1}, {"vpi", 1, 0, 0}};
+        for (const Backend &b : backends)
+        {
+            for (int stereo = 0; stereo <= params.STEREO; stereo++)
+            {
+                char name[64];
+                snprintf(name, sizeof(name), "FeatureTracker::trackImage/%s/%s", b.name, stereo ? "stereo" : "mono");
+                if (!bench.enabled(name))
+                    continue;
+                if (left.empty())
+                    syntheticFrames(20, params.ROW, params.COL, left, right);
+                params.USE_VPI = b.vpi;
+                params.USE_GPU_ACC_FLOW = b.gpu_acc_flow;
+                params.USE_GPU = b.gpu;
+                FeatureTracker tracker(params);
+                tracker.readIntrinsicParameter(params.CAM_NAMES);
+                double t = 0;
+                size_t k = 0;
+                bench.run(name, [&](long n) {
+                    for (long i = 0; i < n; i++, k = (k + 1) % left.size())
+                    {
+                        t += 0.05;
+                        FeatureFrame frame = stereo ? tracker.trackImage(t, left[k], right[k])
+                                                    : tracker.trackImage(t, left[k]);
+                        doNotOptimize(frame);
+                    }
+                });
+            }
+        }
+    }
+    return 0;
+}
@@ -11,125 +11,333 @@
 
 #include <stdio.h>
 #include <queue>
+#include <deque>
 #include <map>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
 #include <cv_bridge/cv_bridge.h>
+#include <sensor_msgs/CompressedImage.h>
 #include <opencv2/opencv.hpp>
 #include "estimator/estimator.h"
 #include "estimator/parameters.h"
 #include "utility/visualization.h"
+#include "utility/v4l2_capture.h"
+#include "utility/image_decoder.h"
 
 Estimator estimator;
 
+// a message of an image topic, a sensor_msgs/CompressedImage with image_compressed
+struct ImageMsg
+{
+    ImageMsg() {}
+    explicit ImageMsg(const sensor_msgs::ImageConstPtr &_raw) : raw(_raw) {}
+    explicit ImageMsg(const sensor_msgs::CompressedImageConstPtr &_compressed) : compressed(_compressed) {}
+
+    bool valid() const { return raw || compressed; }
+    const std_msgs::Header &header() const { return raw ? raw->header : compressed->header; }
+    double stamp() const { return header().stamp.toSec(); }
+
+    sensor_msgs::ImageConstPtr raw;
+    sensor_msgs::CompressedImageConstPtr compressed;
+};
+
 queue<sensor_msgs::ImuConstPtr> imu_buf;
 queue<sensor_msgs::PointCloudConstPtr> feature_buf;
-queue<sensor_msgs::ImageConstPtr> img0_buf;
-queue<sensor_msgs::ImageConstPtr> img1_buf;
+// in stamp order, paired by sync_process; deques to look past the front
+deque<ImageMsg> img0_buf;
+deque<ImageMsg> img1_buf;
+// cameras 2 and up, synchronized with img0 by their stamps like img1
+vector<deque<ImageMsg>> img_aux_buf;
+// frames handed to the estimator, images thrown per camera, largest stamp offset of a frame (s);
+// with m_buf
+uint64_t img_frames = 0;
+vector<uint64_t> img_thrown;
+double img_max_offset = 0;
+RateLimit img_sync_rate;
 std::mutex m_buf;
+std::condition_variable con_img;
+bool vins_shutdown = false;
 
 
-void img0_callback(const sensor_msgs::ImageConstPtr &img_msg)
+
+static void pushImage(deque<ImageMsg> &buf, const ImageMsg &img_msg)
 {
     m_buf.lock();
-    img0_buf.push(img_msg);
+    buf.push_back(img_msg);
     m_buf.unlock();
+    con_img.notify_one();
+}
+
+void img0_callback(const sensor_msgs::ImageConstPtr &img_msg)
+{
+    pushImage(img0_buf, ImageMsg(img_msg));
 }
 
 void img1_callback(const sensor_msgs::ImageConstPtr &img_msg)
 {
-    m_buf.lock();
-    img1_buf.push(img_msg);
-    m_buf.unlock();
+    pushImage(img1_buf, ImageMsg(img_msg));
+}
+
+void img_aux_callback(const sensor_msgs::ImageConstPtr &img_msg, int k)
+{
+    pushImage(img_aux_buf[k], ImageMsg(img_msg));
+}
+
+void img0_compressed_callback(const sensor_msgs::CompressedImageConstPtr &img_msg)
+{
+    pushImage(img0_buf, ImageMsg(img_msg));
+}
+
+void img1_compressed_callback(const sensor_msgs::CompressedImageConstPtr &img_msg)
+{
+    pushImage(img1_buf, ImageMsg(img_msg));
 }
 
+void img_aux_compressed_callback(const sensor_msgs::CompressedImageConstPtr &img_msg, int k)
+{
+    pushImage(img_aux_buf[k], ImageMsg(img_msg));
+}
 
-cv::Mat getImageFromMsg(const sensor_msgs::ImageConstPtr &img_msg)
+// mono images share the message buffer, the returned pointer keeps the message alive
+// for as long as the image is used. Only other encodings are converted (and copied).
+// Compressed images are decoded into a buffer of the decoder pool, null when that fails.
+cv_bridge::CvImageConstPtr getImageFromMsg(const ImageMsg &img_msg)
 {
-    cv_bridge::CvImageConstPtr ptr;
-    if (img_msg->encoding == "8UC1")
+    if (img_msg.compressed)
     {
-        sensor_msgs::Image img;
-        img.header = img_msg->header;
-        img.height = img_msg->height;
-        img.width = img_msg->width;
-        img.is_bigendian = img_msg->is_bigendian;
-        img.step = img_msg->step;
-        img.data = img_msg->data;
-        img.encoding = "mono8";
-        ptr = cv_bridge::toCvCopy(img, sensor_msgs::image_encodings::MONO8);
+        // only sync_process decodes
+        static ImageDecoder image_decoder;
+        cv::Mat image;
+        if (!image_decoder.decode(img_msg.compressed->data, image))
+            return cv_bridge::CvImageConstPtr();
+        return cv_bridge::CvImageConstPtr(
+            new cv_bridge::CvImage(img_msg.header(), sensor_msgs::image_encodings::MONO8, image));
     }
+    const sensor_msgs::ImageConstPtr &raw = img_msg.raw;
+    if (raw->encoding == "8UC1" || raw->encoding == sensor_msgs::image_encodings::MONO8)
+        return cv_bridge::toCvShare(raw);
     else
-        ptr = cv_bridge::toCvCopy(img_msg, sensor_msgs::image_encodings::MONO8);
+        return cv_bridge::toCvCopy(raw, sensor_msgs::image_encodings::MONO8);
+}
 
-    cv::Mat img = ptr->image.clone();
-    return img;
+// the images of img_msgs, false when one cannot be read
+static bool getImagesFromMsgs(const vector<ImageMsg> &img_msgs, vector<cv_bridge::CvImageConstPtr> &images)
+{
+    images.clear();
+    for (const ImageMsg &img_msg : img_msgs)
+    {
+        images.push_back(getImageFromMsg(img_msg));
+        if (!images.back())
+        {
+            VINS_WARN("cannot decode image at %f\n", img_msg.stamp());
+            return false;
+        }
+    }
+    return true;
 }
 
-// extract images with same timestamp from two topics
+// the images of cameras 2 and up, sharing the messages of aux
+static vector<cv::Mat> auxImages(const vector<cv_bridge::CvImageConstPtr> &aux)
+{
+    vector<cv::Mat> images;
+    for (const cv_bridge::CvImageConstPtr &image : aux)
+        images.push_back(image->image);
+    return images;
+}
+
+// with pipeline_queue_size > 0 the estimator copies the shared images into its tracking queue
+void input_image(double time, const cv_bridge::CvImageConstPtr &image0, const cv_bridge::CvImageConstPtr &image1,
+                 const vector<cv_bridge::CvImageConstPtr> &aux = vector<cv_bridge::CvImageConstPtr>())
+{
+    if (!image1)
+        estimator.inputImage(time, image0->image);
+    else
+        estimator.inputImage(time, image0->image, image1->image, auxImages(aux));
+}
+
+// img1_buf for camera 1, img_aux_buf for 2 and up
+static deque<ImageMsg> &imageBuf(size_t camera)
+{
+    return camera == 1 ? img1_buf : img_aux_buf[camera - 2];
+}
+
+// with m_buf held: finds the image of every camera after the first for the img0 image at time.
+// Throws the images older than time - tolerance and those with a later image closer to time, so
+// each front is the match. 1 when every camera has one, 0 while one has not arrived, -1 when
+// one is already past time + tolerance and img0 has to go
+static int syncCameras(double time, double tolerance)
+{
+    bool missing = false, past = false;
+    for (size_t k = 1; k < img_aux_buf.size() + 2; k++)
+    {
+        deque<ImageMsg> &buf = imageBuf(k);
+        while (!buf.empty() && (buf.front().stamp() < time - tolerance ||
+                                (buf.size() > 1 && fabs(buf[1].stamp() - time) < fabs(buf[0].stamp() - time))))
+        {
+            buf.pop_front();
+            img_thrown[k]++;
+            VINS_WARN("throw img%d\n", (int)k);
+        }
+        if (buf.empty())
+            missing = true;
+        else if (buf.front().stamp() > time + tolerance)
+            past = true;
+    }
+    return past ? -1 : (missing ? 0 : 1);
+}
+
+// with m_buf held: every camera has an image queued
+static bool imagesReady()
+{
+    if (img0_buf.empty() || (estimator.params.STEREO && img1_buf.empty()))
+        return false;
+    for (const deque<ImageMsg> &buf : img_aux_buf)
+        if (buf.empty())
+            return false;
+    return true;
+}
+
+// with m_buf held: the counters of sync_process, one second apart
+static void pubImageSync(double t)
+{
+    if (img_sync_rate.ready(t))
+        estimator.visualization.pubImageSync(img_frames, img_thrown, img_max_offset, t);
+}
+
+// extract images with the stamp of each img0 image, within image_sync_tolerance, from all camera
+// topics; the messages are converted (or decoded) after m_buf is released
 void sync_process()
 {
+    vector<ImageMsg> img_msgs;
+    vector<cv_bridge::CvImageConstPtr> images;
+    double tolerance = estimator.params.IMAGE_SYNC_TOLERANCE;
     while(1)
     {
-        if(STEREO)
+        img_msgs.clear();
+        if(estimator.params.STEREO)
         {
-            cv::Mat image0, image1;
-            std_msgs::Header header;
             double time = 0;
             m_buf.lock();
-            if (!img0_buf.empty() && !img1_buf.empty())
+            if (imagesReady())
             {
-                double time0 = img0_buf.front()->header.stamp.toSec();
-                double time1 = img1_buf.front()->header.stamp.toSec();
-                if(time0 < time1)
+                double time0 = img0_buf.front().stamp();
+                int state = syncCameras(time0, tolerance);
+                if (state < 0)
                 {
-                    img0_buf.pop();
-                    printf("throw img0\n");
+                    img0_buf.pop_front();
+                    img_thrown[0]++;
+                    VINS_WARN("throw img0\n");
                 }
-                else if(time0 > time1)
+                else if (state > 0)
                 {
-                    img1_buf.pop();
-                    printf("throw img1\n");
-                }
-                else
-                {
-                    time = img0_buf.front()->header.stamp.toSec();
-                    header = img0_buf.front()->header;
-                    image0 = getImageFromMsg(img0_buf.front());
-                    img0_buf.pop();
-                    image1 = getImageFromMsg(img1_buf.front());
-                    img1_buf.pop();
+                    time = time0;
+                    img_msgs.push_back(img0_buf.front());
+                    img0_buf.pop_front();
+                    for (size_t k = 1; k < img_aux_buf.size() + 2; k++)
+                    {
+                        deque<ImageMsg> &buf = imageBuf(k);
+                        img_max_offset = max(img_max_offset, fabs(buf.front().stamp() - time0));
+                        img_msgs.push_back(buf.front());
+                        buf.pop_front();
+                    }
+                    img_frames++;
+                    pubImageSync(time);
                     //printf("find img0 and img1\n");
                 }
             }
             m_buf.unlock();
-            if(!image0.empty())
-                estimator.inputImage(time, image0, image1);
+            if (!img_msgs.empty() && getImagesFromMsgs(img_msgs, images))
+                input_image(time, images[0], images[1],
+                            vector<cv_bridge::CvImageConstPtr>(images.begin() + 2, images.end()));
         }
         else
         {
-            cv::Mat image;
-            std_msgs::Header header;
             double time = 0;
             m_buf.lock();
             if(!img0_buf.empty())
             {
-                time = img0_buf.front()->header.stamp.toSec();
-                header = img0_buf.front()->header;
-                image = getImageFromMsg(img0_buf.front());
-                img0_buf.pop();
+                time = img0_buf.front().stamp();
+                img_msgs.push_back(img0_buf.front());
+                img0_buf.pop_front();
+                img_frames++;
+                pubImageSync(time);
             }
             m_buf.unlock();
-            if(!image.empty())
-                estimator.inputImage(time, image);
+            if (!img_msgs.empty() && getImagesFromMsgs(img_msgs, images))
+                input_image(time, images[0], cv_bridge::CvImageConstPtr());
         }
+        // the pool buffers go back to the decoder
+        images.clear();
 
-        std::chrono::milliseconds dura(2);
-        std::this_thread::sleep_for(dura);
+        std::unique_lock<std::mutex> lk(m_buf);
+        con_img.wait(lk, []{ return vins_shutdown || imagesReady(); });
+        if (vins_shutdown)
+            break;
     }
 }
 
+// stereo frames of free running cameras further apart than this are not taken as a pair
+static const double CAPTURE_PAIR_TOLERANCE = 0.003;
+
+static bool captureStopped()
+{
+    std::lock_guard<std::mutex> lk(m_buf);
+    return vins_shutdown;
+}
+
+// capture_device0/1: the frames come from the drivers, tracked in their mapped buffers and stamped
+// by the driver, no image message on the way
+void capture_process()
+{
+    const Parameters &params = estimator.params;
+    V4L2Capture cam0, cam1;
+    if (!cam0.open(params.CAPTURE_DEVICE0, params.COL, params.ROW) ||
+        (params.STEREO && !cam1.open(params.CAPTURE_DEVICE1, params.COL, params.ROW)))
+    {
+        ROS_ERROR("cannot capture from %s %s", params.CAPTURE_DEVICE0.c_str(), params.CAPTURE_DEVICE1.c_str());
+        return;
+    }
+    cv::Mat img0, img1;
+    double t0 = 0, t1 = 0;
+    bool has0 = false, has1 = false;
+    while (!captureStopped())
+    {
+        // a frame waiting for its pair keeps its buffer until the next grab on that camera
+        if (!has0)
+            has0 = cam0.grab(img0, t0, 100);
+        if (!params.STEREO)
+        {
+            if (has0)
+                estimator.inputImage(t0, img0);
+            has0 = false;
+            continue;
+        }
+        if (!has1)
+            has1 = cam1.grab(img1, t1, 100);
+        if (!has0 || !has1)
+            continue;
+        if (t0 < t1 - CAPTURE_PAIR_TOLERANCE)
+        {
+            has0 = false;
+            VINS_WARN("throw img0\n");
+        }
+        else if (t1 < t0 - CAPTURE_PAIR_TOLERANCE)
+        {
+            has1 = false;
+            VINS_WARN("throw img1\n");
+        }
+        else
+        {
+            estimator.inputImage(t0, img0, img1);
+            has0 = has1 = false;
+        }
+    }
+}
 
 void imu_callback(const sensor_msgs::ImuConstPtr &imu_msg)
 {
@@ -149,10 +357,11 @@ void imu_callback(const sensor_msgs::ImuConstPtr &imu_msg)
 
 void feature_callback(const sensor_msgs::PointCloudConstPtr &feature_msg)
 {
-    map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> featureFrame;
+    FeatureFrame featureFrame;
+    featureFrame.reserve(feature_msg->points.size());
     for (unsigned int i = 0; i < feature_msg->points.size(); i++)
     {
-        int feature_id = feature_msg->channels[0].values[i];
+        FeatureId feature_id = feature_msg->channels[0].values[i];
         int camera_id = feature_msg->channels[1].values[i];
         double x = feature_msg->points[i].x;
         double y = feature_msg->points[i].y;
@@ -166,19 +375,28 @@ void feature_callback(const sensor_msgs::PointCloudConstPtr &feature_msg)
             double gx = feature_msg->channels[6].values[i];
             double gy = feature_msg->channels[7].values[i];
             double gz = feature_msg->channels[8].values[i];
-            pts_gt[feature_id] = Eigen::Vector3d(gx, gy, gz);
+            estimator.f_manager.pts_gt[feature_id] = Eigen::Vector3d(gx, gy, gz);
             //printf("receive pts gt %d %f %f %f\n", feature_id, gx, gy, gz);
         }
         ROS_ASSERT(z == 1);
         Eigen::Matrix<double, 7, 1> xyz_uv_velocity;
         xyz_uv_velocity << x, y, z, p_u, p_v, velocity_x, velocity_y;
-        featureFrame[feature_id].emplace_back(camera_id,  xyz_uv_velocity);
+        featureFrame.emplace_back(feature_id, camera_id, xyz_uv_velocity);
     }
+    sortFeatureFrame(featureFrame);
     double t = feature_msg->header.stamp.toSec();
     estimator.inputFeature(t, featureFrame);
     return;
 }
 
+// one message per pose graph or global solve, not per frame
+void correction_callback(const nav_msgs::OdometryConstPtr &correction_msg)
+{
+    const geometry_msgs::Pose &pose = correction_msg->pose.pose;
+    estimator.visualization.setCorrection(Eigen::Quaterniond(pose.orientation.w, pose.orientation.x, pose.orientation.y, pose.orientation.z),
+                                          Eigen::Vector3d(pose.position.x, pose.position.y, pose.position.z));
+}
+
 void restart_callback(const std_msgs::BoolConstPtr &restart_msg)
 {
     if (restart_msg->data == true)
@@ -196,41 +414,232 @@ void restart_callback(const std_msgs::BoolConstPtr &restart_msg)
     return;
 }
 
+ros::Subscriber sub_imu, sub_feature, sub_img0, sub_img1, sub_correction;
+vector<ros::Subscriber> sub_img_aux;
+std::thread sync_thread, capture_thread, imu_thread;
+// the imu callbacks, served by imu_thread instead of the spinner when the imu thread is placed
+ros::CallbackQueue imu_queue;
+
+void imu_process()
+{
+    while (1)
+    {
+        {
+            std::lock_guard<std::mutex> lk(m_buf);
+            if (vins_shutdown)
+                return;
+        }
+        imu_queue.callAvailable(ros::WallDuration(0.01));
+    }
+}
+
+// everything main does besides ros::init and spinning, shared with the nodelet.
+// from_bag: the input comes from playBag, no subscribers
+void startVins(ros::NodeHandle &n, const string &config_file, bool from_bag)
+{
+    Parameters params;
+    readParameters(config_file, params);
+    if (from_bag)
+    {
+        // no frame may be dropped and the imu is never late when reading the bag
+        params.PIPELINE_DROP = 0;
+        params.IMU_LATENCY_BUDGET = 0;
+    }
+    estimator.setParameter(params);
+    img_aux_buf.resize(estimator.params.IMAGE_AUX_TOPICS.size());
+    img_thrown.assign(estimator.params.IMAGE_AUX_TOPICS.size() + 2, 0);
+    img_sync_rate.setRate(1);
+
+#ifdef EIGEN_DONT_PARALLELIZE
+    ROS_DEBUG("EIGEN_DONT_PARALLELIZE");
+#endif
+
+    estimator.visualization.registerPub(n);
+
+    bool capture = !from_bag && !estimator.params.CAPTURE_DEVICE0.empty();
+    if (capture && estimator.params.NUM_OF_CAM > 2)
+        ROS_WARN("capture_device covers cam0 and cam1 only, the other cameras are not read");
+    if (from_bag)
+        ROS_WARN("reading image and imu from the bag");
+    else
+    {
+        ROS_WARN("waiting for image and imu...");
+        if (estimator.params.THREAD_IMU.empty())
+            sub_imu = n.subscribe(estimator.params.IMU_TOPIC, 2000, imu_callback, ros::TransportHints().tcpNoDelay());
+        else
+        {
+            ros::SubscribeOptions ops = ros::SubscribeOptions::create<sensor_msgs::Imu>(
+                estimator.params.IMU_TOPIC, 2000, imu_callback, ros::VoidPtr(), &imu_queue);
+            ops.transport_hints = ros::TransportHints().tcpNoDelay();
+            sub_imu = n.subscribe(ops);
+            imu_thread = std::thread(imu_process);
+            placeThread(imu_thread.native_handle(), "vins_imu", estimator.params.THREAD_IMU);
+        }
+        sub_feature = n.subscribe("/feature_tracker/feature", 2000, feature_callback);
+        if (!capture && estimator.params.IMAGE_COMPRESSED)
+        {
+            sub_img0 = n.subscribe(estimator.params.IMAGE0_TOPIC, 100, img0_compressed_callback);
+            sub_img1 = n.subscribe(estimator.params.IMAGE1_TOPIC, 100, img1_compressed_callback);
+            for (size_t k = 0; k < estimator.params.IMAGE_AUX_TOPICS.size(); k++)
+                sub_img_aux.push_back(n.subscribe<sensor_msgs::CompressedImage>(
+                    estimator.params.IMAGE_AUX_TOPICS[k], 100, boost::bind(img_aux_compressed_callback, _1, (int)k)));
+        }
+        else if (!capture)
+        {
+            sub_img0 = n.subscribe(estimator.params.IMAGE0_TOPIC, 100, img0_callback);
+            sub_img1 = n.subscribe(estimator.params.IMAGE1_TOPIC, 100, img1_callback);
+            for (size_t k = 0; k < estimator.params.IMAGE_AUX_TOPICS.size(); k++)
+                sub_img_aux.push_back(n.subscribe<sensor_msgs::Image>(estimator.params.IMAGE_AUX_TOPICS[k], 100,
+                                                                      boost::bind(img_aux_callback, _1, (int)k)));
+        }
+        if (!estimator.params.CORRECTION_TOPIC.empty())
+            sub_correction = n.subscribe(estimator.params.CORRECTION_TOPIC, 10, correction_callback);
+    }
+
+    if (capture)
+    {
+        capture_thread = std::thread(capture_process);
+        placeThread(capture_thread.native_handle(), "vins_capture", estimator.params.THREAD_FRONTEND);
+    }
+    else
+    {
+        sync_thread = std::thread(sync_process);
+        placeThread(sync_thread.native_handle(), "vins_sync", estimator.params.THREAD_FRONTEND);
+    }
+}
+
+// stops the threads started by startVins, after the subscribers so no new input arrives
+void stopVins()
+{
+    sub_imu.shutdown();
+    sub_feature.shutdown();
+    sub_img0.shutdown();
+    sub_img1.shutdown();
+    for (ros::Subscriber &sub : sub_img_aux)
+        sub.shutdown();
+    sub_img_aux.clear();
+    sub_correction.shutdown();
+
+    m_buf.lock();
+    vins_shutdown = true;
+    m_buf.unlock();
+    con_img.notify_all();
+    if (sync_thread.joinable())
+        sync_thread.join();
+    if (capture_thread.joinable())
+        capture_thread.join();
+    if (imu_thread.joinable())
+        imu_thread.join();
+    estimator.stop();
+}
+
+#ifndef VINS_NODELET
+// frames between the bag reader and the published result
+static const size_t BAG_BACKLOG = 8;
+
+static size_t imageBacklog()
+{
+    std::lock_guard<std::mutex> lk(m_buf);
+    return img0_buf.size();
+}
+
+// Reads the messages of the config topics straight from the bag, in the bag order, into the same
+// callbacks the subscribers use, and only waits for the estimator: at most BAG_BACKLOG frames are
+// in flight between here and the publishers so nothing is dropped on the way.
+void playBag(const string &bag_file)
+{
+    rosbag::Bag bag;
+    try
+    {
+        bag.open(bag_file, rosbag::bagmode::Read);
+    }
+    catch (const rosbag::BagException &e)
+    {
+        ROS_ERROR("cannot open bag %s: %s", bag_file.c_str(), e.what());
+        return;
+    }
+    vector<string> topics{estimator.params.IMAGE0_TOPIC, estimator.params.IMU_TOPIC};
+    if (estimator.params.STEREO)
+        topics.push_back(estimator.params.IMAGE1_TOPIC);
+    const vector<string> &aux_topics = estimator.params.IMAGE_AUX_TOPICS;
+    topics.insert(topics.end(), aux_topics.begin(), aux_topics.end());
+    rosbag::View view(bag, rosbag::TopicQuery(topics));
+    ROS_WARN("playing %s, %.1f s of data", bag_file.c_str(), (view.getEndTime() - view.getBeginTime()).toSec());
+
+    TicToc t_play;
+    int frames = 0;
+    for (const rosbag::MessageInstance &m : view)
+    {
+        if (!ros::ok())
+            break;
+        if (m.getTopic() == estimator.params.IMU_TOPIC)
+        {
+            sensor_msgs::ImuConstPtr imu_msg = m.instantiate<sensor_msgs::Imu>();
+            if (imu_msg && estimator.params.USE_IMU)
+                imu_callback(imu_msg);
+            continue;
+        }
+        // raw or compressed, whichever the bag holds
+        ImageMsg img_msg(m.instantiate<sensor_msgs::Image>());
+        if (!img_msg.valid())
+            img_msg = ImageMsg(m.instantiate<sensor_msgs::CompressedImage>());
+        if (!img_msg.valid())
+            continue;
+        while (imageBacklog() + estimator.backlog() >= BAG_BACKLOG && ros::ok())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        size_t k = find(aux_topics.begin(), aux_topics.end(), m.getTopic()) - aux_topics.begin();
+        if (m.getTopic() == estimator.params.IMAGE0_TOPIC)
+        {
+            pushImage(img0_buf, img_msg);
+            frames++;
+        }
+        else if (k < aux_topics.size())
+            pushImage(img_aux_buf[k], img_msg);
+        else
+            pushImage(img1_buf, img_msg);
+    }
+    bag.close();
+
+    // the last frame may never get its imu, give up once nothing moves for a second
+    size_t left = imageBacklog() + estimator.backlog();
+    TicToc t_idle;
+    while (left > 0 && ros::ok() && t_idle.toc() < 1000)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        size_t now = imageBacklog() + estimator.backlog();
+        if (now != left)
+            t_idle.tic();
+        left = now;
+    }
+    double seconds = t_play.toc() / 1000;
+    ROS_WARN("bag done: %d frames in %.1f s, %.1f fps", frames, seconds, frames / seconds);
+}
+
 int main(int argc, char **argv)
 {
     ros::init(argc, argv, "vins_estimator");
     ros::NodeHandle n("~");
     ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME, ros::console::levels::Info);
 
-    if(argc != 2)
+    if(argc != 2 && argc != 3)
     {
-        printf("please intput: rosrun vins vins_node [config file] \n"
+        printf("please intput: rosrun vins vins_node [config file] [bag file] \n"
                "for example: rosrun vins vins_node "
-               "~/catkin_ws/src/VINS-Fusion/config/euroc/euroc_stereo_imu_config.yaml \n");
+               "~/catkin_ws/src/VINS-Fusion/config/euroc/euroc_stereo_imu_config.yaml \n"
+               "with a bag the node reads it directly as fast as the estimator goes instead of subscribing \n");
         return 1;
     }
 
     string config_file = argv[1];
     printf("config_file: %s\n", argv[1]);
 
-    readParameters(config_file);
-    estimator.setParameter();
-
-#ifdef EIGEN_DONT_PARALLELIZE
-    ROS_DEBUG("EIGEN_DONT_PARALLELIZE");
-#endif
-
-    ROS_WARN("waiting for image and imu...");
-
-    registerPub(n);
-
-    ros::Subscriber sub_imu = n.subscribe(IMU_TOPIC, 2000, imu_callback, ros::TransportHints().tcpNoDelay());
-    ros::Subscriber sub_feature = n.subscribe("/feature_tracker/feature", 2000, feature_callback);
-    ros::Subscriber sub_img0 = n.subscribe(IMAGE0_TOPIC, 100, img0_callback);
-    ros::Subscriber sub_img1 = n.subscribe(IMAGE1_TOPIC, 100, img1_callback);
-
-    std::thread sync_thread{sync_process};
-    ros::spin();
+    startVins(n, config_file, argc == 3);
+    if (argc == 3)
+        playBag(argv[2]);
+    else
+        ros::spin();
+    stopVins();
 
     return 0;
 }
+#endif
@@ -0,0 +1,198 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <eigen3/Eigen/Dense>
+#include <opencv2/core/core.hpp>
+
+// Outlier rejection on the essential matrix between two sets of normalized image plane points,
+// x2^T E x1 = 0. Used in place of cv::findFundamentalMat on points re-projected into a virtual camera.
+// Hypotheses are scored with the Sampson distance and dropped as soon as they cannot beat the best one,
+// the iteration count adapts to the inlier ratio and the best model is refit on its inliers.
+class EpipolarRansac
+{
+  public:
+    // 8-point hypotheses
+    static int findInliers(const std::vector<cv::Point2f> &pts1, const std::vector<cv::Point2f> &pts2,
+                           double threshold, double confidence, std::vector<uchar> &status,
+                           int max_iterations = 500)
+    {
+        Eigen::Matrix3d E;
+        return findEssential(pts1, pts2, threshold, confidence, E, status, max_iterations);
+    }
+
+    // same, E is the model refit on the inliers (zero when none was found)
+    static int findEssential(const std::vector<cv::Point2f> &pts1, const std::vector<cv::Point2f> &pts2,
+                             double threshold, double confidence, Eigen::Matrix3d &E_out,
+                             std::vector<uchar> &status, int max_iterations = 500)
+    {
+        std::vector<Eigen::Vector3d> x1, x2;
+        toHomogeneous(pts1, pts2, x1, x2);
+        auto solver = [&x1, &x2](const std::vector<int> &idx, Eigen::Matrix3d &E)
+        {
+            Eigen::Matrix<double, 9, 9> AtA = Eigen::Matrix<double, 9, 9>::Zero();
+            for (int i : idx)
+            {
+                Eigen::Matrix<double, 9, 1> a;
+                a << x2[i](0) * x1[i], x2[i](1) * x1[i], x1[i];
+                AtA += a * a.transpose();
+            }
+            Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, 9, 9>> es(AtA);
+            Eigen::Matrix<double, 9, 1> e = es.eigenvectors().col(0);
+            E << e(0), e(1), e(2),
+                 e(3), e(4), e(5),
+                 e(6), e(7), e(8);
+            // closest essential matrix
+            Eigen::JacobiSVD<Eigen::Matrix3d> svd(E, Eigen::ComputeFullU | Eigen::ComputeFullV);
+            E = svd.matrixU() * Eigen::Vector3d(1, 1, 0).asDiagonal() * svd.matrixV().transpose();
+            return true;
+        };
+        return ransac(x1, x2, 8, solver, threshold, confidence, E_out, status, max_iterations);
+    }
+
+    // R21 rotates frame 1 into frame 2 (x2 ~ R21 * x1 + t), e.g. from gyroscope integration.
+    // Only the translation direction is sampled, 2 points per hypothesis.
+    static int findInliersWithRotation(const std::vector<cv::Point2f> &pts1, const std::vector<cv::Point2f> &pts2,
+                                       const Eigen::Matrix3d &R21, double threshold, double confidence,
+                                       std::vector<uchar> &status, int max_iterations = 100)
+    {
+        std::vector<Eigen::Vector3d> x1, x2;
+        toHomogeneous(pts1, pts2, x1, x2);
+        // x2 . (t x R21 x1) = t . (R21 x1 x x2) = 0, one linear constraint on t per point
+        std::vector<Eigen::Vector3d> c(x1.size());
+        for (size_t i = 0; i < x1.size(); i++)
+            c[i] = (R21 * x1[i]).cross(x2[i]);
+        auto solver = [&c, &R21](const std::vector<int> &idx, Eigen::Matrix3d &E)
+        {
+            Eigen::Matrix3d CtC = Eigen::Matrix3d::Zero();
+            for (int i : idx)
+                CtC += c[i] * c[i].transpose();
+            Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> es(CtC);
+            // pure rotation, the translation direction is not observable
+            if (es.eigenvalues()(1) < 1e-12)
+                return false;
+            Eigen::Vector3d t = es.eigenvectors().col(0);
+            Eigen::Matrix3d t_x;
+            t_x << 0, -t(2), t(1),
+                   t(2), 0, -t(0),
+                   -t(1), t(0), 0;
+            E = t_x * R21;
+            return true;
+        };
+        Eigen::Matrix3d E;
+        return ransac(x1, x2, 2, solver, threshold, confidence, E, status, max_iterations);
+    }
+
+  private:
+    static void toHomogeneous(const std::vector<cv::Point2f> &pts1, const std::vector<cv::Point2f> &pts2,
+                              std::vector<Eigen::Vector3d> &x1, std::vector<Eigen::Vector3d> &x2)
+    {
+        x1.resize(pts1.size());
+        x2.resize(pts2.size());
+        for (size_t i = 0; i < pts1.size(); i++)
+        {
+            x1[i] = Eigen::Vector3d(pts1[i].x, pts1[i].y, 1.0);
+            x2[i] = Eigen::Vector3d(pts2[i].x, pts2[i].y, 1.0);
+        }
+    }
+
+    static double sampsonError(const Eigen::Matrix3d &E, const Eigen::Vector3d &x1, const Eigen::Vector3d &x2)
+    {
+        Eigen::Vector3d l2 = E * x1;
+        Eigen::Vector3d l1 = E.transpose() * x2;
+        double e = x2.dot(l2);
+        return e * e / (l2(0) * l2(0) + l2(1) * l2(1) + l1(0) * l1(0) + l1(1) * l1(1));
+    }
+
+    // counts inliers of E, gives up once more than max_outliers have been seen
+    static int score(const Eigen::Matrix3d &E, const std::vector<Eigen::Vector3d> &x1,
+                     const std::vector<Eigen::Vector3d> &x2, double threshold2, int max_outliers)
+    {
+        int inliers = 0, outliers = 0;
+        for (size_t i = 0; i < x1.size(); i++)
+        {
+            if (sampsonError(E, x1[i], x2[i]) < threshold2)
+                inliers++;
+            else if (++outliers > max_outliers)
+                return -1;
+        }
+        return inliers;
+    }
+
+    template <typename Solver>
+    static int ransac(const std::vector<Eigen::Vector3d> &x1, const std::vector<Eigen::Vector3d> &x2,
+                      int sample_size, Solver solver, double threshold, double confidence,
+                      Eigen::Matrix3d &best_E, std::vector<uchar> &status, int max_iterations)
+    {
+        const int n = x1.size();
+        status.assign(n, 0);
+        best_E.setZero();
+        if (n < sample_size)
+            return 0;
+
+        const double threshold2 = threshold * threshold;
+        std::mt19937 rng(0);
+        std::uniform_int_distribution<int> uniform(0, n - 1);
+        std::vector<int> sample(sample_size);
+        Eigen::Matrix3d E;
+        int best_inliers = 0;
+        int iterations = max_iterations;
+        for (int it = 0; it < iterations; it++)
+        {
+            for (int k = 0; k < sample_size; k++)
+            {
+                int idx;
+                do
+                    idx = uniform(rng);
+                while (std::find(sample.begin(), sample.begin() + k, idx) != sample.begin() + k);
+                sample[k] = idx;
+            }
+            if (!solver(sample, E))
+                continue;
+
+            int inliers = score(E, x1, x2, threshold2, n - best_inliers);
+            if (inliers > best_inliers)
+            {
+                best_inliers = inliers;
+                best_E = E;
+                double w = double(best_inliers) / n;
+                double p_fail = 1.0 - std::pow(w, sample_size);
+                if (p_fail <= 0.0)
+                    break;
+                int needed = std::ceil(std::log(1.0 - confidence) / std::log(p_fail));
+                iterations = std::min(iterations, std::max(needed, it + 1));
+            }
+        }
+        if (best_inliers < sample_size)
+        {
+            best_E.setZero();
+            return 0;
+        }
+
+        std::vector<int> inlier_idx;
+        for (int i = 0; i < n; i++)
+            if (sampsonError(best_E, x1[i], x2[i]) < threshold2)
+                inlier_idx.push_back(i);
+        if (solver(inlier_idx, E) && score(E, x1, x2, threshold2, n) >= best_inliers)
+            best_E = E;
+
+        best_inliers = 0;
+        for (int i = 0; i < n; i++)
+        {
+            status[i] = sampsonError(best_E, x1[i], x2[i]) < threshold2;
+            best_inliers += status[i];
+        }
+        return best_inliers;
+    }
+};
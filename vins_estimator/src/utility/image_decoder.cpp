@@ -0,0 +1,158 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <opencv2/imgcodecs.hpp>
+#include <ros/console.h>
+#include "image_decoder.h"
+
+#if VINS_NVJPEG
+#include <cuda_runtime.h>
+#include <nvjpeg.h>
+#endif
+
+// images in flight between the decoder and the end of tracking, a pipeline_queue_size of frames
+// of a few cameras
+static const size_t POOL_SIZE = 16;
+
+#if VINS_NVJPEG
+struct ImageDecoder::Nvjpeg
+{
+    Nvjpeg() : handle(NULL), state(NULL), stream(NULL), device(NULL), device_size(0) {}
+    ~Nvjpeg()
+    {
+        if (device)
+            cudaFree(device);
+        if (stream)
+            cudaStreamDestroy(stream);
+        if (state)
+            nvjpegJpegStateDestroy(state);
+        if (handle)
+            nvjpegDestroy(handle);
+    }
+
+    nvjpegHandle_t handle;
+    nvjpegJpegState_t state;
+    cudaStream_t stream;
+    // the luma plane, width x height
+    unsigned char *device;
+    size_t device_size;
+};
+#endif
+
+ImageDecoder::ImageDecoder()
+{
+    pool.reserve(POOL_SIZE);
+#if VINS_NVJPEG
+    nvjpeg.reset(new Nvjpeg());
+    if (nvjpegCreateSimple(&nvjpeg->handle) != NVJPEG_STATUS_SUCCESS ||
+        nvjpegJpegStateCreate(nvjpeg->handle, &nvjpeg->state) != NVJPEG_STATUS_SUCCESS ||
+        cudaStreamCreateWithFlags(&nvjpeg->stream, cudaStreamNonBlocking) != cudaSuccess)
+    {
+        ROS_WARN("nvjpeg not available, jpeg images are decoded on the cpu");
+        nvjpeg.reset();
+    }
+#endif
+}
+
+ImageDecoder::~ImageDecoder()
+{
+}
+
+cv::Mat &ImageDecoder::acquire()
+{
+    // only this thread copies the pool images, a count of 1 stays 1
+    for (cv::Mat &image : pool)
+        if (image.u == NULL || image.u->refcount == 1)
+            return image;
+    if (pool.size() < POOL_SIZE)
+    {
+        pool.push_back(cv::Mat());
+        return pool.back();
+    }
+    spare = cv::Mat();
+    return spare;
+}
+
+#if VINS_NVJPEG
+bool ImageDecoder::decodeNvjpeg(const std::vector<uint8_t> &data, cv::Mat &image)
+{
+    int components;
+    nvjpegChromaSubsampling_t subsampling;
+    int widths[NVJPEG_MAX_COMPONENT], heights[NVJPEG_MAX_COMPONENT];
+    if (nvjpegGetImageInfo(nvjpeg->handle, data.data(), data.size(), &components, &subsampling, widths,
+                           heights) != NVJPEG_STATUS_SUCCESS)
+        return false;
+    int width = widths[0], height = heights[0];
+    size_t size = (size_t)width * height;
+    if (size > nvjpeg->device_size)
+    {
+        if (nvjpeg->device)
+            cudaFree(nvjpeg->device);
+        nvjpeg->device = NULL;
+        nvjpeg->device_size = 0;
+        if (cudaMalloc(&nvjpeg->device, size) != cudaSuccess)
+            return false;
+        nvjpeg->device_size = size;
+    }
+    nvjpegImage_t out;
+    for (int c = 0; c < NVJPEG_MAX_COMPONENT; c++)
+    {
+        out.channel[c] = NULL;
+        out.pitch[c] = 0;
+    }
+    out.channel[0] = nvjpeg->device;
+    out.pitch[0] = width;
+    if (nvjpegDecode(nvjpeg->handle, nvjpeg->state, data.data(), data.size(), NVJPEG_OUTPUT_Y, &out,
+                     nvjpeg->stream) != NVJPEG_STATUS_SUCCESS)
+        return false;
+
+    cv::Mat &slot = acquire();
+    slot.create(height, width, CV_8UC1);
+    if (cudaMemcpy2DAsync(slot.data, slot.step, nvjpeg->device, width, width, height, cudaMemcpyDeviceToHost,
+                          nvjpeg->stream) != cudaSuccess ||
+        cudaStreamSynchronize(nvjpeg->stream) != cudaSuccess)
+        return false;
+    image = slot;
+    return true;
+}
+#endif
+
+// a whole jpeg, from the SOI to the EOI marker, or a png signature. cv::imdecode leaves its
+// output as it was when it cannot read the header, so only these are decoded into the pool
+static bool knownFormat(const std::vector<uint8_t> &data, bool &jpeg)
+{
+    size_t n = data.size();
+    jpeg = n > 4 && data[0] == 0xFF && data[1] == 0xD8 && data[n - 2] == 0xFF && data[n - 1] == 0xD9;
+    bool png = n > 8 && data[0] == 0x89 && data[1] == 'P' && data[2] == 'N' && data[3] == 'G';
+    return jpeg || png;
+}
+
+bool ImageDecoder::decode(const std::vector<uint8_t> &data, cv::Mat &image)
+{
+    if (data.empty())
+        return false;
+    cv::Mat buf(1, data.size(), CV_8UC1, const_cast<uint8_t *>(data.data()));
+    bool jpeg;
+    if (!knownFormat(data, jpeg))
+    {
+        image = cv::imdecode(buf, cv::IMREAD_GRAYSCALE);
+        return !image.empty();
+    }
+#if VINS_NVJPEG
+    if (jpeg && nvjpeg && decodeNvjpeg(data, image))
+        return true;
+#endif
+    // a failed read of the pixels releases slot
+    cv::Mat &slot = acquire();
+    cv::imdecode(buf, cv::IMREAD_GRAYSCALE, &slot);
+    if (slot.empty())
+        return false;
+    image = slot;
+    return true;
+}
@@ -0,0 +1,46 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+#ifndef VINS_NVJPEG
+#define VINS_NVJPEG 0
+#endif
+
+// Decodes the data of sensor_msgs/CompressedImage (jpeg, png) to mono8 images from a pool: an
+// image handed out goes back to the pool once every cv::Mat of it is gone, so a steady stream
+// decodes into the same few buffers. With VINS_NVJPEG 1 (cmake) jpeg is decoded by nvjpeg on the
+// GPU; other formats, and jpeg nvjpeg refuses, go through cv::imdecode, which only decodes the luma
+// of a jpeg. One thread at a time.
+class ImageDecoder
+{
+  public:
+    ImageDecoder();
+    ~ImageDecoder();
+
+    // false when data is not an image either decoder reads
+    bool decode(const std::vector<uint8_t> &data, cv::Mat &image);
+
+  private:
+    // a pool image nobody else holds, a new one once all POOL_SIZE are out
+    cv::Mat &acquire();
+
+    std::vector<cv::Mat> pool;
+    cv::Mat spare;
+#if VINS_NVJPEG
+    struct Nvjpeg;
+    std::unique_ptr<Nvjpeg> nvjpeg;
+    bool decodeNvjpeg(const std::vector<uint8_t> &data, cv::Mat &image);
+#endif
+};
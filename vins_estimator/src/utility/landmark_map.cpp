@@ -0,0 +1,167 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include "landmark_map.h"
+
+// 21 bits per axis, +-2^20 voxels around the origin
+static const int64_t KEY_BITS = 21;
+static const int64_t KEY_OFFSET = 1 << (KEY_BITS - 1);
+static const int64_t KEY_MASK = (1 << KEY_BITS) - 1;
+// a landmark stops moving much after this many points, the count stays exact
+static const uint32_t MAX_MEAN_WEIGHT = 64;
+
+LandmarkMap::LandmarkMap() : voxel(0), max_voxels(0), oldest(-1), newest(-1)
+{
+}
+
+void LandmarkMap::reset(double _voxel, size_t _max_voxels)
+{
+    voxel = _voxel;
+    max_voxels = _voxel > 0 ? std::max<size_t>(_max_voxels, 1) : 0;
+    slots.clear();
+    slots.reserve(max_voxels);
+    index.clear();
+    index.reserve(max_voxels);
+    oldest = newest = -1;
+    updated_slots.clear();
+    removed_slots.clear();
+}
+
+void LandmarkMap::clear()
+{
+    for (int32_t id = oldest; id >= 0; id = slots[id].newer)
+        removed_slots.push_back(id);
+    slots.clear();
+    index.clear();
+    oldest = newest = -1;
+    updated_slots.clear();
+}
+
+uint64_t LandmarkMap::key(const Eigen::Vector3d &p) const
+{
+    uint64_t k = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        int64_t c = (int64_t)std::floor(p(i) / voxel) + KEY_OFFSET;
+        c = std::min(std::max(c, (int64_t)0), KEY_MASK);
+        k = (k << KEY_BITS) | (uint64_t)c;
+    }
+    return k;
+}
+
+void LandmarkMap::unlink(uint32_t id)
+{
+    Slot &s = slots[id];
+    if (s.older >= 0)
+        slots[s.older].newer = s.newer;
+    else
+        oldest = s.newer;
+    if (s.newer >= 0)
+        slots[s.newer].older = s.older;
+    else
+        newest = s.older;
+    s.older = s.newer = -1;
+}
+
+void LandmarkMap::pushNewest(uint32_t id)
+{
+    Slot &s = slots[id];
+    s.older = newest;
+    s.newer = -1;
+    if (newest >= 0)
+        slots[newest].newer = id;
+    else
+        oldest = id;
+    newest = id;
+}
+
+uint32_t LandmarkMap::allocate()
+{
+    if (slots.size() < max_voxels)
+    {
+        slots.push_back(Slot());
+        slots.back().changed = false;
+        return slots.size() - 1;
+    }
+    // its changed flag stays, the id is already in updated_slots when set
+    uint32_t id = oldest;
+    unlink(id);
+    index.erase(slots[id].key);
+    slots[id].landmark.count = 0;
+    removed_slots.push_back(id);
+    return id;
+}
+
+void LandmarkMap::insert(const Eigen::Vector3d &p)
+{
+    if (!enabled() || !p.allFinite())
+        return;
+    uint64_t k = key(p);
+    auto it = index.find(k);
+    uint32_t id;
+    if (it == index.end())
+    {
+        id = allocate();
+        Slot &s = slots[id];
+        s.key = k;
+        s.landmark.p = p.cast<float>();
+        s.landmark.count = 1;
+        index.emplace(k, id);
+    }
+    else
+    {
+        id = it->second;
+        unlink(id);
+        Landmark &l = slots[id].landmark;
+        l.count++;
+        float w = 1.0f / std::min(l.count, MAX_MEAN_WEIGHT);
+        l.p += w * (p.cast<float>() - l.p);
+    }
+    pushNewest(id);
+    Slot &s = slots[id];
+    if (!s.changed)
+    {
+        s.changed = true;
+        updated_slots.push_back(id);
+    }
+}
+
+void LandmarkMap::takeChanges(std::vector<uint32_t> &updated, std::vector<uint32_t> &removed)
+{
+    updated.clear();
+    for (uint32_t id : updated_slots)
+    {
+        // dropped after its update
+        if (slots[id].landmark.count > 0)
+            updated.push_back(id);
+        slots[id].changed = false;
+    }
+    removed.swap(removed_slots);
+    updated_slots.clear();
+    removed_slots.clear();
+}
+
+void LandmarkMap::ids(std::vector<uint32_t> &out) const
+{
+    out.clear();
+    out.reserve(index.size());
+    for (int32_t id = oldest; id >= 0; id = slots[id].newer)
+        out.push_back(id);
+}
+
+size_t LandmarkMap::memoryBytes() const
+{
+    // a hash node is the entry and a link
+    return slots.capacity() * sizeof(Slot) +
+           index.size() * (sizeof(std::pair<const uint64_t, uint32_t>) + sizeof(void *)) +
+           index.bucket_count() * sizeof(void *) +
+           (updated_slots.capacity() + removed_slots.capacity()) * sizeof(uint32_t);
+}
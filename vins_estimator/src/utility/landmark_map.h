@@ -0,0 +1,73 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <eigen3/Eigen/Dense>
+
+// Sparse map of the points that left the window, at most one landmark per cube of voxel meters.
+// A point goes to the voxel it falls in, found through a hash of the voxel coordinates, and moves
+// its landmark to the mean of the points merged there. Landmarks live in max_voxels slots; once
+// all are used the one updated longest ago makes room. Slot ids stay the same while a landmark
+// lives, so the map goes out as the slots changed since the last takeChanges().
+class LandmarkMap
+{
+  public:
+    struct Landmark
+    {
+        Eigen::Vector3f p;
+        uint32_t count;  // points merged, 0 for a free slot
+    };
+
+    LandmarkMap();
+
+    // drops every landmark, voxel <= 0 turns the map off
+    void reset(double voxel, size_t max_voxels);
+    // drops every landmark, reported as removed by the next takeChanges()
+    void clear();
+    bool enabled() const { return voxel > 0; }
+
+    void insert(const Eigen::Vector3d &p);
+
+    // slots added or moved, and slots freed, since the last call; a slot freed and taken again
+    // is in both, removals apply first
+    void takeChanges(std::vector<uint32_t> &updated, std::vector<uint32_t> &removed);
+
+    const Landmark &landmark(uint32_t id) const { return slots[id].landmark; }
+    size_t size() const { return index.size(); }
+    // slot id of every landmark
+    void ids(std::vector<uint32_t> &out) const;
+    size_t memoryBytes() const;
+
+  private:
+    struct Slot
+    {
+        Landmark landmark;
+        uint64_t key;
+        // least recently updated list, -1 at the ends
+        int32_t older, newer;
+        bool changed;
+    };
+
+    uint64_t key(const Eigen::Vector3d &p) const;
+    void unlink(uint32_t id);
+    void pushNewest(uint32_t id);
+    // a new slot, or the one of the least recently updated landmark once max_voxels are used
+    uint32_t allocate();
+
+    double voxel;
+    size_t max_voxels;
+    std::vector<Slot> slots;
+    std::unordered_map<uint64_t, uint32_t> index;
+    int32_t oldest, newest;
+    std::vector<uint32_t> updated_slots, removed_slots;
+};
@@ -0,0 +1,115 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include "latency_profiler.h"
+
+// lower edge of bucket 0 in ms, buckets per factor of 10
+static const double MIN_MS = 1e-3;
+static const double PER_DECADE = 20;
+
+LatencyProfiler::LatencyProfiler()
+{
+    for (int s = 0; s < NUM_STAGES; s++)
+    {
+        for (int b = 0; b < BUCKETS; b++)
+            counts[s][b] = 0;
+        sum[s] = 0;
+        max[s] = 0;
+        alloc_count[s] = 0;
+        alloc_bytes[s] = 0;
+    }
+}
+
+int LatencyProfiler::bucket(double ms)
+{
+    if (ms <= MIN_MS)
+        return 0;
+    int b = static_cast<int>(std::log10(ms / MIN_MS) * PER_DECADE);
+    return b < BUCKETS ? b : BUCKETS - 1;
+}
+
+double LatencyProfiler::bucketValue(int b)
+{
+    // geometric middle of the bucket
+    return MIN_MS * std::pow(10.0, (b + 0.5) / PER_DECADE);
+}
+
+void LatencyProfiler::record(Stage stage, double ms)
+{
+    counts[stage][bucket(ms)].fetch_add(1, std::memory_order_relaxed);
+    long long us = static_cast<long long>(ms * 1000);
+    sum[stage].fetch_add(us, std::memory_order_relaxed);
+    long long cur = max[stage].load(std::memory_order_relaxed);
+    while (us > cur && !max[stage].compare_exchange_weak(cur, us, std::memory_order_relaxed))
+        ;
+}
+
+void LatencyProfiler::record(Stage stage, double ms, const memory_stats::AllocCounters &since)
+{
+    record(stage, ms);
+    memory_stats::AllocCounters now = memory_stats::threadAllocations();
+    alloc_count[stage].fetch_add(now.count - since.count, std::memory_order_relaxed);
+    alloc_bytes[stage].fetch_add(now.bytes - since.bytes, std::memory_order_relaxed);
+}
+
+LatencyProfiler::Summary LatencyProfiler::summary(Stage stage) const
+{
+    Summary s;
+    long hist[BUCKETS];
+    s.count = 0;
+    for (int b = 0; b < BUCKETS; b++)
+    {
+        hist[b] = counts[stage][b].load(std::memory_order_relaxed);
+        s.count += hist[b];
+    }
+    s.mean = s.p50 = s.p95 = s.p99 = s.allocs = s.alloc_bytes = 0;
+    s.max = max[stage].load(std::memory_order_relaxed) / 1000.0;
+    if (s.count == 0)
+        return s;
+    s.mean = sum[stage].load(std::memory_order_relaxed) / 1000.0 / s.count;
+    s.allocs = (double)alloc_count[stage].load(std::memory_order_relaxed) / s.count;
+    s.alloc_bytes = (double)alloc_bytes[stage].load(std::memory_order_relaxed) / s.count;
+    double *p[3] = {&s.p50, &s.p95, &s.p99};
+    const double q[3] = {0.50, 0.95, 0.99};
+    long seen = 0;
+    int k = 0;
+    for (int b = 0; b < BUCKETS && k < 3; b++)
+    {
+        seen += hist[b];
+        while (k < 3 && seen >= q[k] * s.count)
+            *p[k++] = std::min(bucketValue(b), s.max);
+    }
+    return s;
+}
+
+const char *LatencyProfiler::name(Stage stage)
+{
+    static const char *names[NUM_STAGES] = {"track", "preintegration", "fast_pose", "triangulate", "solve", "marginalize",
+                                            "outlier", "slide", "publish", "frame"};
+    return names[stage];
+}
+
+bool LatencyProfiler::dump(const std::string &path) const
+{
+    FILE *f = fopen(path.c_str(), "w");
+    if (f == NULL)
+        return false;
+    fprintf(f, "stage,count,mean_ms,p50_ms,p95_ms,p99_ms,max_ms,allocs,alloc_bytes\n");
+    for (int i = 0; i < NUM_STAGES; i++)
+    {
+        Summary s = summary(static_cast<Stage>(i));
+        fprintf(f, "%s,%ld,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f,%.0f\n", name(static_cast<Stage>(i)), s.count, s.mean, s.p50,
+                s.p95, s.p99, s.max, s.allocs, s.alloc_bytes);
+    }
+    fclose(f);
+    return true;
+}
@@ -0,0 +1,85 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <string>
+
+#include "memory_stats.h"
+#include "tic_toc.h"
+
+// Latency histograms of the pipeline stages of one estimator. Recording is one relaxed atomic
+// increment, any thread may record any stage without a lock. Buckets are log spaced, 20 per decade
+// from 1 us to 100 s, so a percentile is exact to about 12%. With VINS_ALLOC_STATS the heap
+// allocations of the recording thread since the start of the stage are summed per stage as well.
+class LatencyProfiler
+{
+  public:
+    enum Stage
+    {
+        TRACK,
+        PREINTEGRATION,
+        FAST_POSE,
+        TRIANGULATE,
+        SOLVE,
+        MARGINALIZE,
+        OUTLIER,
+        SLIDE,
+        PUBLISH,
+        FRAME,
+        NUM_STAGES
+    };
+
+    struct Summary
+    {
+        long count;
+        double mean, p50, p95, p99, max;
+        // per run of the stage, 0 without VINS_ALLOC_STATS
+        double allocs, alloc_bytes;
+    };
+
+    LatencyProfiler();
+
+    void record(Stage stage, double ms);
+    // since: memory_stats::threadAllocations() of this thread when the stage started
+    void record(Stage stage, double ms, const memory_stats::AllocCounters &since);
+    Summary summary(Stage stage) const;
+    static const char *name(Stage stage);
+
+    // one line per stage: name, count, mean, p50, p95, p99, max (ms), allocations and bytes per run
+    bool dump(const std::string &path) const;
+
+  private:
+    static const int BUCKETS = 160;
+    static int bucket(double ms);
+    static double bucketValue(int b);
+
+    std::atomic<long> counts[NUM_STAGES][BUCKETS];
+    // us, for the mean
+    std::atomic<long long> sum[NUM_STAGES];
+    std::atomic<long long> max[NUM_STAGES];
+    std::atomic<long long> alloc_count[NUM_STAGES];
+    std::atomic<long long> alloc_bytes[NUM_STAGES];
+};
+
+// records the time from construction to destruction
+class ScopedStageTimer
+{
+  public:
+    ScopedStageTimer(LatencyProfiler &_profiler, LatencyProfiler::Stage _stage)
+        : profiler(_profiler), stage(_stage), allocs(memory_stats::threadAllocations()) {}
+    ~ScopedStageTimer() { profiler.record(stage, timer.toc(), allocs); }
+
+  private:
+    LatencyProfiler &profiler;
+    LatencyProfiler::Stage stage;
+    memory_stats::AllocCounters allocs;
+    TicToc timer;
+};
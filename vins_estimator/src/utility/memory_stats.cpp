@@ -0,0 +1,71 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "memory_stats.h"
+
+#if VINS_ALLOC_STATS
+#include <cstdlib>
+#include <new>
+
+// replaces the global operator new and delete of every binary linking vins_lib, counting on the
+// calling thread. Frees are not counted, a stage is measured by what it asks of the allocator.
+static void *countedAlloc(size_t size)
+{
+    memory_stats::AllocCounters &c = memory_stats::threadCounters();
+    c.count++;
+    c.bytes += size;
+    return malloc(size ? size : 1);
+}
+
+void *operator new(size_t size)
+{
+    void *p = countedAlloc(size);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    void *p = countedAlloc(size);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return countedAlloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return countedAlloc(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    free(p);
+}
+#endif
@@ -0,0 +1,70 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <unistd.h>
+
+// Heap allocations of the calling thread and the resident size of the process. The allocations are
+// counted by the operator new of memory_stats.cpp, compiled in with VINS_ALLOC_STATS 1 (cmake);
+// without it, or where the operator new of the process is not the one of vins_lib (a nodelet
+// loaded into a manager), the counters stay 0. Counting is two thread local increments per new.
+#ifndef VINS_ALLOC_STATS
+#define VINS_ALLOC_STATS 0
+#endif
+
+namespace memory_stats
+{
+struct AllocCounters
+{
+    long long count;
+    long long bytes;
+};
+
+inline bool allocationsCounted()
+{
+    return VINS_ALLOC_STATS != 0;
+}
+
+// written by operator new of this thread only
+inline AllocCounters &threadCounters()
+{
+    static thread_local AllocCounters counters = {0, 0};
+    return counters;
+}
+
+// what this thread allocated from the start of it, the difference of two reads is a stage
+inline AllocCounters threadAllocations()
+{
+    return threadCounters();
+}
+
+// the pages of the process in memory, 0 when /proc cannot be read
+inline size_t residentBytes()
+{
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL)
+        return 0;
+    long size = 0, resident = 0;
+    int n = fscanf(f, "%ld %ld", &size, &resident);
+    fclose(f);
+    if (n != 2)
+        return 0;
+    return (size_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+// heap bytes of a std::vector, what its capacity holds
+template <typename V>
+inline size_t vectorBytes(const V &v)
+{
+    return v.capacity() * sizeof(typename V::value_type);
+}
+}
@@ -0,0 +1,112 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "tic_toc.h"
+
+// keeps the compiler from dropping a computation whose result is never read
+template <typename T>
+inline void doNotOptimize(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Google benchmark style runner. A kernel is run in batches of growing size until one batch takes
+// min_time, then repeats batches of that size and reports the median time per iteration, so a
+// single slow batch (page faults, a preempted core) does not move the number.
+class MicroBench
+{
+  public:
+    // only the benchmarks whose name contains filter run, all of them when it is empty
+    explicit MicroBench(const std::string &_filter = "", double _min_time_ms = 200, int _repetitions = 5)
+        : filter(_filter), min_time_ms(_min_time_ms), repetitions(_repetitions)
+    {
+        printf("%-48s %12s %14s %14s\n", "benchmark", "iterations", "time/iter", "items/s");
+    }
+
+    bool enabled(const std::string &name) const
+    {
+        return filter.empty() || name.find(filter) != std::string::npos;
+    }
+
+    // body(n) runs the kernel n times, items is the work of one iteration for the throughput column
+    template <typename Body>
+    void run(const std::string &name, Body body, double items = 0)
+    {
+        if (!enabled(name))
+            return;
+        long n = 1;
+        double ms;
+        while ((ms = batch(body, n)) < min_time_ms && n < (1L << 30))
+            n = ms > min_time_ms / 100 ? static_cast<long>(n * min_time_ms * 1.2 / ms) + 1 : n * 10;
+        std::vector<double> per_iter(1, ms / n);
+        for (int i = 1; i < repetitions; i++)
+            per_iter.push_back(batch(body, n) / n);
+        report(name, n, per_iter, items);
+    }
+
+    // for kernels that consume their input: setup() prepares one iteration untimed, body() is timed
+    template <typename Setup, typename Body>
+    void runWithSetup(const std::string &name, Setup setup, Body body, double items = 0)
+    {
+        if (!enabled(name))
+            return;
+        std::vector<double> per_iter;
+        double total = 0;
+        long n = 0;
+        // one timer per iteration, only meant for kernels far above the clock resolution
+        while ((total < min_time_ms * repetitions || per_iter.size() < 3) && n < (1L << 20))
+        {
+            setup();
+            TicToc t;
+            body();
+            double ms = t.toc();
+            per_iter.push_back(ms);
+            total += ms;
+            n++;
+        }
+        report(name, n, per_iter, items);
+    }
+
+  private:
+    template <typename Body>
+    static double batch(Body &body, long n)
+    {
+        TicToc t;
+        body(n);
+        return t.toc();
+    }
+
+    static void report(const std::string &name, long n, std::vector<double> &per_iter_ms, double items)
+    {
+        std::nth_element(per_iter_ms.begin(), per_iter_ms.begin() + per_iter_ms.size() / 2, per_iter_ms.end());
+        double ms = per_iter_ms[per_iter_ms.size() / 2];
+        char time[32], rate[32] = "";
+        if (ms < 1e-3)
+            snprintf(time, sizeof(time), "%.1f ns", ms * 1e6);
+        else if (ms < 1)
+            snprintf(time, sizeof(time), "%.2f us", ms * 1e3);
+        else
+            snprintf(time, sizeof(time), "%.3f ms", ms);
+        if (items > 0 && ms > 0)
+            snprintf(rate, sizeof(rate), "%.3g", items / ms * 1e3);
+        printf("%-48s %12ld %14s %14s\n", name.c_str(), n, time, rate);
+        fflush(stdout);
+    }
+
+    std::string filter;
+    double min_time_ms;
+    int repetitions;
+};
@@ -0,0 +1,104 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Loads the items 0..count-1 of an offline sequence (decoded images, parsed text) on worker threads,
+// at most capacity items ahead of the consumer, and hands them out in order. Items the loader
+// cannot read are skipped. One consumer.
+template <typename T>
+class Prefetcher
+{
+  public:
+    // load(i, item) fills item i, false to skip it; workers <= 0 takes the cores, up to 4
+    Prefetcher(size_t _count, const std::function<bool(size_t, T &)> &_load, int workers = 0, size_t _capacity = 16)
+        : load(_load), slots(std::max<size_t>(_capacity, 1)), count(_count), to_load(0), to_take(0), stop(false)
+    {
+        if (workers <= 0)
+            workers = std::max(1, std::min(4, (int)std::thread::hardware_concurrency()));
+        for (int i = 0; i < workers; i++)
+            threads.emplace_back(&Prefetcher::worker, this);
+    }
+
+    ~Prefetcher()
+    {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            stop = true;
+        }
+        freed.notify_all();
+        for (std::thread &t : threads)
+            t.join();
+    }
+
+    // the next item that loaded, false after the last one
+    bool next(T &item)
+    {
+        std::unique_lock<std::mutex> lk(m);
+        while (to_take < count)
+        {
+            Slot &slot = slots[to_take % slots.size()];
+            loaded.wait(lk, [&slot] { return slot.ready; });
+            slot.ready = false;
+            to_take++;
+            bool ok = slot.ok;
+            if (ok)
+                item = std::move(slot.item);
+            freed.notify_all();
+            if (ok)
+                return true;
+        }
+        return false;
+    }
+
+  private:
+    struct Slot
+    {
+        Slot() : ready(false), ok(false) {}
+        T item;
+        bool ready, ok;
+    };
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> lk(m);
+        while (1)
+        {
+            // item i goes to slot i % capacity, free once item i - capacity is taken
+            freed.wait(lk, [this] { return stop || to_load >= count || to_load < to_take + slots.size(); });
+            if (stop || to_load >= count)
+                return;
+            size_t i = to_load++;
+            lk.unlock();
+            T item;
+            bool ok = load(i, item);
+            lk.lock();
+            Slot &slot = slots[i % slots.size()];
+            slot.item = std::move(item);
+            slot.ok = ok;
+            slot.ready = true;
+            loaded.notify_all();
+        }
+    }
+
+    std::function<bool(size_t, T &)> load;
+    std::vector<Slot> slots;
+    size_t count, to_load, to_take;
+    bool stop;
+    std::mutex m;
+    std::condition_variable loaded, freed;
+    std::vector<std::thread> threads;
+};
@@ -0,0 +1,91 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "publish_thread.h"
+#include "visualization.h"
+
+// about 1.5 s of frames at 20 Hz
+static const size_t QUEUE_SIZE = 32;
+
+PublishThread::PublishThread(Visualization &_visualization)
+    : visualization(_visualization), queue(QUEUE_SIZE), dropped(0) {}
+
+PublishThread::~PublishThread()
+{
+    stop();
+}
+
+void PublishThread::start(const Parameters &params)
+{
+    if (thread.joinable())
+        return;
+    pose_rate.setRate(params.PUBLISH_POSE_RATE);
+    cloud_rate.setRate(params.PUBLISH_CLOUD_RATE);
+    latency_rate.setRate(1.0);
+    visualization.resetLandmarkMap();
+    thread = std::thread(&PublishThread::run, this);
+    placeThread(thread.native_handle(), "vins_publish", params.THREAD_PUBLISH);
+}
+
+void PublishThread::stop()
+{
+    if (!thread.joinable())
+        return;
+    queue.push(PublishSnapshot());
+    thread.join();
+}
+
+bool PublishThread::push(PublishSnapshot &&snapshot)
+{
+    if (queue.tryPush(std::move(snapshot)))
+        return true;
+    dropped++;
+    ROS_WARN_THROTTLE(1.0, "publish thread behind, %d frames not published", dropped);
+    return false;
+}
+
+void PublishThread::run()
+{
+    PublishSnapshot snapshot;
+    while (1)
+    {
+        queue.pop(snapshot);
+        if (snapshot.t < 0)
+            break;
+        publish(snapshot);
+    }
+}
+
+void PublishThread::publish(const PublishSnapshot &snapshot)
+{
+    VINS_TRACE_FRAME("publish", snapshot.t);
+    visualization.printStatistics(snapshot, 0);
+
+    std_msgs::Header header;
+    header.frame_id = "world";
+    header.stamp = ros::Time(snapshot.t);
+
+    bool pose_ready = pose_rate.ready(snapshot.t);
+    visualization.pubOdometry(snapshot, header);
+    visualization.pubPath(snapshot, header, pose_ready);
+    visualization.pubTF(snapshot, header);
+    visualization.pubKeyframe(snapshot);
+    if (pose_ready)
+        visualization.pubCameraPose(snapshot, header);
+    if (cloud_rate.ready(snapshot.t))
+    {
+        visualization.pubKeyPoses(snapshot, header);
+        visualization.pubPointCloud(snapshot, header);
+    }
+    visualization.pubLandmarkMap(snapshot, header);
+    if (latency_rate.ready(snapshot.t))
+        visualization.pubLatency(snapshot.t);
+    if (snapshot.has_memory)
+        visualization.pubMemory(snapshot.memory, snapshot.t);
+}
@@ -0,0 +1,71 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <thread>
+
+#include "spsc_queue.h"
+#include "trace.h"
+#include "../estimator/parameters.h"
+#include "../estimator/publish_snapshot.h"
+
+class Visualization;
+
+// minimum sensor time between two messages of one output, rate in Hz, 0 for every frame
+class RateLimit
+{
+  public:
+    RateLimit() : period(0), last(-1) {}
+    void setRate(double rate) { period = rate > 0 ? 1.0 / rate : 0; }
+    bool ready(double t)
+    {
+        if (last >= 0 && t >= last && t - last < period)
+            return false;
+        last = t;
+        return true;
+    }
+
+  private:
+    double period;
+    double last;
+};
+
+// Builds and sends every ROS message of the estimator on its own thread from the snapshots the
+// estimator thread queues, and writes the result file. The estimator never waits on it, a snapshot
+// that finds the queue full is dropped. Odometry, tf, keyframes, the landmark map and the result
+// file go out for every snapshot, the visualization outputs at most at publish_pose_rate /
+// publish_cloud_rate.
+class PublishThread
+{
+  public:
+    // publishes through _visualization, kept by reference
+    explicit PublishThread(Visualization &_visualization);
+    ~PublishThread();
+
+    // publish_pose_rate, publish_cloud_rate and the landmark map settings from params
+    void start(const Parameters &params);
+    // publishes what is queued, then joins
+    void stop();
+
+    // estimator thread, false when the snapshot was dropped
+    bool push(PublishSnapshot &&snapshot);
+    // snapshots not published yet
+    size_t pending() const { return queue.size(); }
+
+  private:
+    void run();
+    void publish(const PublishSnapshot &snapshot);
+
+    Visualization &visualization;
+    SPSCQueue<PublishSnapshot> queue;
+    std::thread thread;
+    RateLimit pose_rate, cloud_rate, latency_rate;
+    int dropped;
+};
@@ -0,0 +1,102 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+// Bounded single-producer single-consumer ring buffer. Items move through the ring without a lock,
+// the mutex is only taken to sleep on an empty (or full) queue and to wake the other side.
+template <typename T>
+class SPSCQueue
+{
+  public:
+    explicit SPSCQueue(size_t capacity) : buf(capacity + 1), head(0), tail(0) {}
+
+    // producer, false (and item untouched) when full
+    bool tryPush(T &&item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = (t + 1) % buf.size();
+        if (next == head.load(std::memory_order_acquire))
+            return false;
+        buf[t] = std::move(item);
+        tail.store(next, std::memory_order_release);
+        wake(con_not_empty);
+        return true;
+    }
+
+    // producer, waits for room
+    void push(T &&item)
+    {
+        while (!tryPush(std::move(item)))
+        {
+            std::unique_lock<std::mutex> lk(m);
+            con_not_full.wait(lk, [this] { return !full(); });
+        }
+    }
+
+    // consumer, false when empty
+    bool tryPop(T &item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        item = std::move(buf[h]);
+        head.store((h + 1) % buf.size(), std::memory_order_release);
+        wake(con_not_full);
+        return true;
+    }
+
+    // consumer, waits for an item
+    void pop(T &item)
+    {
+        while (!tryPop(item))
+        {
+            std::unique_lock<std::mutex> lk(m);
+            con_not_empty.wait(lk, [this] { return !empty(); });
+        }
+    }
+
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    bool full() const
+    {
+        return (tail.load(std::memory_order_acquire) + 1) % buf.size() == head.load(std::memory_order_acquire);
+    }
+
+    // any thread, may be stale by the time it returns
+    size_t size() const
+    {
+        size_t h = head.load(std::memory_order_acquire);
+        size_t t = tail.load(std::memory_order_acquire);
+        return (t + buf.size() - h) % buf.size();
+    }
+
+  private:
+    // taking the mutex orders the index update before a waiter's predicate check
+    void wake(std::condition_variable &con)
+    {
+        {
+            std::lock_guard<std::mutex> lk(m);
+        }
+        con.notify_one();
+    }
+
+    std::vector<T> buf;
+    std::atomic<size_t> head, tail;
+    std::mutex m;
+    std::condition_variable con_not_empty, con_not_full;
+};
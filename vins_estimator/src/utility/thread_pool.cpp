@@ -0,0 +1,78 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(int num_threads)
+    : job(NULL), count(0), generation(0), pending(0), stop(false)
+{
+    for (int i = 1; i < num_threads; i++)
+        threads.emplace_back(&ThreadPool::worker, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        stop = true;
+    }
+    start_cv.notify_all();
+    for (auto &t : threads)
+        t.join();
+}
+
+void ThreadPool::run(int _count, const std::function<void(int, int)> &_job)
+{
+    if (threads.empty() || _count <= 1)
+    {
+        for (int i = 0; i < _count; i++)
+            _job(i, 0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mtx);
+        job = &_job;
+        count = _count;
+        pending = threads.size();
+        generation++;
+    }
+    start_cv.notify_all();
+    runChunk(0);
+    std::unique_lock<std::mutex> lk(mtx);
+    done_cv.wait(lk, [&]{ return pending == 0; });
+    job = NULL;
+}
+
+void ThreadPool::worker(int id)
+{
+    int seen = 0;
+    while (1)
+    {
+        {
+            std::unique_lock<std::mutex> lk(mtx);
+            start_cv.wait(lk, [&]{ return stop || generation != seen; });
+            if (stop)
+                return;
+            seen = generation;
+        }
+        runChunk(id);
+        std::lock_guard<std::mutex> lk(mtx);
+        if (--pending == 0)
+            done_cv.notify_one();
+    }
+}
+
+void ThreadPool::runChunk(int id)
+{
+    int n = size();
+    int begin = static_cast<long>(count) * id / n;
+    int end = static_cast<long>(count) * (id + 1) / n;
+    for (int i = begin; i < end; i++)
+        (*job)(i, id);
+}
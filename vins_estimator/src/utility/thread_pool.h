@@ -0,0 +1,45 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Worker threads started once and reused by the data-parallel stages of the estimator.
+// run(count, job) calls job(i, worker) for every i in [0, count) and returns when all calls are done.
+// Item i always goes to the same worker for a given count (contiguous chunks, the calling thread
+// takes the first one), so per-worker accumulators are summed in a fixed order.
+// One run at a time, from one thread.
+class ThreadPool
+{
+  public:
+    explicit ThreadPool(int num_threads);
+    ~ThreadPool();
+
+    // workers including the calling thread
+    int size() const { return threads.size() + 1; }
+    void run(int count, const std::function<void(int, int)> &job);
+
+  private:
+    void worker(int id);
+    void runChunk(int id);
+
+    std::vector<std::thread> threads;
+    std::mutex mtx;
+    std::condition_variable start_cv, done_cv;
+    const std::function<void(int, int)> *job;
+    int count;
+    int generation;
+    int pending;
+    bool stop;
+};
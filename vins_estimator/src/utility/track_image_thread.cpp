@@ -0,0 +1,66 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "track_image_thread.h"
+#include "visualization.h"
+
+TrackImageThread::TrackImageThread(Visualization &_visualization)
+    : visualization(_visualization), has_pending(false), stop_flag(false) {}
+
+TrackImageThread::~TrackImageThread()
+{
+    stop();
+}
+
+void TrackImageThread::start()
+{
+    if (thread.joinable())
+        return;
+    stop_flag = false;
+    thread = std::thread(&TrackImageThread::run, this);
+}
+
+void TrackImageThread::stop()
+{
+    if (!thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lk(m);
+        stop_flag = true;
+    }
+    con.notify_one();
+    thread.join();
+}
+
+void TrackImageThread::push(TrackDrawing &&drawing)
+{
+    {
+        std::lock_guard<std::mutex> lk(m);
+        pending = std::move(drawing);
+        has_pending = true;
+    }
+    con.notify_one();
+}
+
+void TrackImageThread::run()
+{
+    while (1)
+    {
+        TrackDrawing drawing;
+        {
+            std::unique_lock<std::mutex> lk(m);
+            con.wait(lk, [this] { return stop_flag || has_pending; });
+            if (stop_flag)
+                break;
+            drawing = std::move(pending);
+            has_pending = false;
+        }
+        visualization.pubTrackImage(drawTrack(drawing), drawing.t);
+    }
+}
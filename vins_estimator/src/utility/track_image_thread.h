@@ -0,0 +1,46 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "../featureTracker/track_drawing.h"
+
+class Visualization;
+
+// Draws and publishes image_track on its own thread, off the tracking path. Holds one drawing:
+// one pushed while the previous is still waiting replaces it, the newest frame wins.
+class TrackImageThread
+{
+  public:
+    // publishes through _visualization, kept by reference
+    explicit TrackImageThread(Visualization &_visualization);
+    ~TrackImageThread();
+
+    void start();
+    // the drawing still waiting is dropped
+    void stop();
+
+    // tracking thread
+    void push(TrackDrawing &&drawing);
+
+  private:
+    void run();
+
+    Visualization &visualization;
+    std::mutex m;
+    std::condition_variable con;
+    TrackDrawing pending;
+    bool has_pending;
+    bool stop_flag;
+    std::thread thread;
+};
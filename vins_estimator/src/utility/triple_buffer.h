@@ -0,0 +1,48 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <atomic>
+
+// Hands the latest value of T from one writer thread to one reader thread, neither side ever waits.
+// The writer fills its back copy and swaps it with the middle one, the reader swaps the middle copy
+// with its front one when the middle is newer than what it holds. Values in between may be skipped.
+template <typename T>
+class TripleBuffer
+{
+  public:
+    TripleBuffer() : back(0), middle(1), front(2) {}
+
+    // writer
+    void write(const T &value)
+    {
+        buf[back] = value;
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // reader, false (and value untouched) if nothing was written since the last read
+    bool read(T &value)
+    {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        value = buf[front];
+        return true;
+    }
+
+  private:
+    static const int INDEX = 3;
+    static const int FRESH = 4;
+
+    T buf[3];
+    int back;
+    std::atomic<int> middle;
+    int front;
+};
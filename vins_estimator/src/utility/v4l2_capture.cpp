@@ -0,0 +1,222 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include "v4l2_capture.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/videodev2.h>
+#include <ros/ros.h>
+
+static const int CAPTURE_BUFFERS = 4;
+
+static int xioctl(int fd, unsigned long request, void *arg)
+{
+    int r;
+    do
+        r = ioctl(fd, request, arg);
+    while (r == -1 && errno == EINTR);
+    return r;
+}
+
+static double toSec(const timespec &ts)
+{
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+V4L2Capture::V4L2Capture() : fd(-1), width(0), height(0), stride(0), grey(false), grabbed(-1) {}
+
+V4L2Capture::~V4L2Capture()
+{
+    close();
+}
+
+bool V4L2Capture::open(const std::string &_device, int _width, int _height)
+{
+    close();
+    device = _device;
+    fd = ::open(device.c_str(), O_RDWR | O_NONBLOCK);
+    if (fd < 0)
+    {
+        ROS_WARN("cannot open %s: %s", device.c_str(), strerror(errno));
+        return false;
+    }
+
+    v4l2_capability cap;
+    memset(&cap, 0, sizeof(cap));
+    if (xioctl(fd, VIDIOC_QUERYCAP, &cap) < 0 || !(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+        !(cap.capabilities & V4L2_CAP_STREAMING))
+    {
+        ROS_WARN("%s is no streaming capture device", device.c_str());
+        close();
+        return false;
+    }
+
+    v4l2_format fmt;
+    const unsigned int formats[] = {V4L2_PIX_FMT_GREY, V4L2_PIX_FMT_YUYV};
+    bool format_ok = false;
+    for (unsigned int format : formats)
+    {
+        memset(&fmt, 0, sizeof(fmt));
+        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        fmt.fmt.pix.width = _width;
+        fmt.fmt.pix.height = _height;
+        fmt.fmt.pix.pixelformat = format;
+        fmt.fmt.pix.field = V4L2_FIELD_NONE;
+        // the driver adjusts what it cannot do, the result is checked instead of the return value
+        if (xioctl(fd, VIDIOC_S_FMT, &fmt) == 0 && fmt.fmt.pix.pixelformat == format &&
+            (int)fmt.fmt.pix.width == _width && (int)fmt.fmt.pix.height == _height)
+        {
+            format_ok = true;
+            break;
+        }
+    }
+    if (!format_ok)
+    {
+        ROS_WARN("%s streams neither GREY nor YUYV at %dx%d", device.c_str(), _width, _height);
+        close();
+        return false;
+    }
+    width = _width;
+    height = _height;
+    stride = fmt.fmt.pix.bytesperline;
+    grey = fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_GREY;
+
+    v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = CAPTURE_BUFFERS;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(fd, VIDIOC_REQBUFS, &req) < 0 || req.count < 2)
+    {
+        ROS_WARN("%s has no mmap buffers", device.c_str());
+        close();
+        return false;
+    }
+    for (unsigned int i = 0; i < req.count; i++)
+    {
+        v4l2_buffer buf;
+        memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        Buffer b;
+        b.start = MAP_FAILED;
+        b.length = 0;
+        if (xioctl(fd, VIDIOC_QUERYBUF, &buf) == 0)
+        {
+            b.length = buf.length;
+            b.start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+        }
+        if (b.start == MAP_FAILED || xioctl(fd, VIDIOC_QBUF, &buf) < 0)
+        {
+            if (b.start != MAP_FAILED)
+                munmap(b.start, b.length);
+            ROS_WARN("cannot map buffer %u of %s", i, device.c_str());
+            close();
+            return false;
+        }
+        buffers.push_back(b);
+    }
+
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(fd, VIDIOC_STREAMON, &type) < 0)
+    {
+        ROS_WARN("cannot start streaming %s: %s", device.c_str(), strerror(errno));
+        close();
+        return false;
+    }
+    ROS_INFO("capturing %s: %dx%d %s, %d buffers", device.c_str(), width, height, grey ? "GREY" : "YUYV",
+             (int)buffers.size());
+    return true;
+}
+
+void V4L2Capture::close()
+{
+    if (fd < 0)
+        return;
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    xioctl(fd, VIDIOC_STREAMOFF, &type);
+    for (const Buffer &b : buffers)
+        munmap(b.start, b.length);
+    buffers.clear();
+    grabbed = -1;
+    ::close(fd);
+    fd = -1;
+}
+
+bool V4L2Capture::grab(cv::Mat &img, double &t, int timeout_ms)
+{
+    if (fd < 0)
+        return false;
+    release();
+    pollfd p;
+    p.fd = fd;
+    p.events = POLLIN;
+    if (poll(&p, 1, timeout_ms) <= 0)
+        return false;
+
+    v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    if (xioctl(fd, VIDIOC_DQBUF, &buf) < 0)
+    {
+        if (errno != EAGAIN)
+            ROS_WARN("capture from %s failed: %s", device.c_str(), strerror(errno));
+        return false;
+    }
+
+    // the imu is stamped on the ros (wall) clock, a monotonic driver stamp is moved by the current
+    // offset between the two
+    t = buf.timestamp.tv_sec + buf.timestamp.tv_usec * 1e-6;
+    if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+    {
+        timespec mono, real;
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        clock_gettime(CLOCK_REALTIME, &real);
+        t += toSec(real) - toSec(mono);
+    }
+
+    const Buffer &b = buffers[buf.index];
+    if (grey)
+    {
+        img = cv::Mat(height, width, CV_8UC1, b.start, stride);
+        grabbed = buf.index;
+    }
+    else
+    {
+        // a new Mat every frame, the estimator may still hold the previous one
+        cv::Mat luma;
+        cv::extractChannel(cv::Mat(height, width, CV_8UC2, b.start, stride), luma, 0);
+        img = luma;
+        xioctl(fd, VIDIOC_QBUF, &buf);
+    }
+    return true;
+}
+
+void V4L2Capture::release()
+{
+    if (fd < 0 || grabbed < 0)
+        return;
+    v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = grabbed;
+    grabbed = -1;
+    if (xioctl(fd, VIDIOC_QBUF, &buf) < 0)
+        ROS_WARN("cannot requeue buffer of %s: %s", device.c_str(), strerror(errno));
+}
@@ -0,0 +1,49 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ *
+ * This file is part of VINS.
+ *
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// A V4L2 camera read through driver buffers mapped into the process (V4L2_MEMORY_MMAP). A GREY
+// frame is handed out as a cv::Mat on the mapped buffer itself, a YUYV one as its luma, the only
+// copy. The frame stays valid until release; the driver keeps filling the other buffers meanwhile.
+class V4L2Capture
+{
+  public:
+    V4L2Capture();
+    ~V4L2Capture();
+
+    // opens device and asks for width x height GREY, or YUYV when the driver has no GREY; false
+    // with the reason logged when the device cannot stream such frames
+    bool open(const std::string &device, int width, int height);
+    void close();
+
+    // waits up to timeout_ms for a frame: false on timeout or error. t is the driver timestamp
+    // of the frame moved onto the ros clock
+    bool grab(cv::Mat &img, double &t, int timeout_ms);
+    // gives the buffer of the last grab back to the driver
+    void release();
+
+  private:
+    struct Buffer
+    {
+        void *start;
+        size_t length;
+    };
+
+    std::string device;
+    int fd;
+    int width, height, stride;
+    bool grey;
+    std::vector<Buffer> buffers;
+    int grabbed;  // index of the buffer handed out by grab, -1 when none
+};
@@ -8,52 +8,58 @@
  *******************************************************/
 
 #include "visualization.h"
+#include "path_buffer.h"
 
 using namespace ros;
 using namespace Eigen;
-ros::Publisher pub_odometry, pub_latest_odometry;
-ros::Publisher pub_path;
-ros::Publisher pub_point_cloud, pub_margin_cloud;
-ros::Publisher pub_key_poses;
-ros::Publisher pub_camera_pose;
-ros::Publisher pub_camera_pose_right;
-ros::Publisher pub_rectify_pose_left;
-ros::Publisher pub_rectify_pose_right;
-ros::Publisher pub_camera_pose_visual;
-nav_msgs::Path path;
-
-ros::Publisher pub_keyframe_pose;
-ros::Publisher pub_keyframe_point;
-ros::Publisher pub_extrinsic;
-
-CameraPoseVisualization cameraposevisual(1, 0, 0, 1);
-static double sum_of_path = 0;
-static Vector3d last_path(0.0, 0.0, 0.0);
-
-size_t pub_counter = 0;
-
-void registerPub(ros::NodeHandle &n)
+
+Visualization::Visualization(const Parameters &_params, const LatencyProfiler &_latency)
+    : params(_params), latency(_latency), has_correction(false), correction_q(Eigen::Quaterniond::Identity()),
+      correction_t(0.0, 0.0, 0.0), cameraposevisual(1, 0, 0, 1), sum_of_path(0), last_path(0.0, 0.0, 0.0),
+      sum_of_time(0), sum_of_calculation(0), landmark_map_t(-1)
+{
+}
+
+void Visualization::registerPub(ros::NodeHandle &n)
 {
     pub_latest_odometry = n.advertise<nav_msgs::Odometry>("imu_propagate", 1000);
+    pub_latest_odometry_corrected = n.advertise<nav_msgs::Odometry>("imu_propagate_corrected", 1000);
+    pub_propagate_latency = n.advertise<geometry_msgs::Vector3Stamped>("imu_propagate_latency", 100);
+    pub_frame_budget = n.advertise<geometry_msgs::Vector3Stamped>("frame_budget", 100);
+    pub_latency = n.advertise<diagnostic_msgs::DiagnosticArray>("latency", 10);
+    pub_memory = n.advertise<diagnostic_msgs::DiagnosticArray>("memory", 10);
+    pub_image_sync = n.advertise<diagnostic_msgs::DiagnosticArray>("image_sync", 10);
     pub_path = n.advertise<nav_msgs::Path>("path", 1000);
+    pub_path_pose = n.advertise<geometry_msgs::PoseStamped>("path_pose", 1000);
     pub_odometry = n.advertise<nav_msgs::Odometry>("odometry", 1000);
-    pub_point_cloud = n.advertise<sensor_msgs::PointCloud>("point_cloud", 1000);
-    pub_margin_cloud = n.advertise<sensor_msgs::PointCloud>("margin_cloud", 1000);
+    pub_fast_odometry = n.advertise<nav_msgs::Odometry>("fast_odometry", 1000);
+    pub_point_cloud = n.advertise<sensor_msgs::PointCloud2>("point_cloud", 1000);
+    pub_margin_cloud = n.advertise<sensor_msgs::PointCloud2>("margin_cloud", 1000);
+    pub_landmark_delta = n.advertise<sensor_msgs::PointCloud2>("landmark_map_delta", 100);
+    pub_landmark_map = n.advertise<sensor_msgs::PointCloud2>("landmark_map", 1, true);
     pub_key_poses = n.advertise<visualization_msgs::Marker>("key_poses", 1000);
     pub_camera_pose = n.advertise<nav_msgs::Odometry>("camera_pose", 1000);
     pub_camera_pose_right = n.advertise<nav_msgs::Odometry>("camera_pose_right", 1000);
     pub_rectify_pose_left = n.advertise<geometry_msgs::PoseStamped>("rectify_pose_left", 1000);
     pub_rectify_pose_right = n.advertise<geometry_msgs::PoseStamped>("rectify_pose_right", 1000);
+    pub_rectify_image_left = n.advertise<sensor_msgs::Image>("rectify_image_left", 10);
+    pub_rectify_image_right = n.advertise<sensor_msgs::Image>("rectify_image_right", 10);
+    pub_rectify_info_left = n.advertise<sensor_msgs::CameraInfo>("rectify_camera_info_left", 10);
+    pub_rectify_info_right = n.advertise<sensor_msgs::CameraInfo>("rectify_camera_info_right", 10);
+    pub_image_track = n.advertise<sensor_msgs::Image>("image_track", 10);
     pub_camera_pose_visual = n.advertise<visualization_msgs::MarkerArray>("camera_pose_visual", 1000);
     pub_keyframe_pose = n.advertise<nav_msgs::Odometry>("keyframe_pose", 1000);
-    pub_keyframe_point = n.advertise<sensor_msgs::PointCloud>("keyframe_point", 1000);
+    pub_keyframe_point = n.advertise<sensor_msgs::PointCloud2>("keyframe_point", 1000);
+    pub_keyframe_image = n.advertise<sensor_msgs::Image>("keyframe_image", 1000);
     pub_extrinsic = n.advertise<nav_msgs::Odometry>("extrinsic", 1000);
 
+    br.reset(new tf::TransformBroadcaster);
+
     cameraposevisual.setScale(0.1);
     cameraposevisual.setLineWidth(0.01);
 }
 
-void pubLatestOdometry(const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, const Eigen::Vector3d &V, double t)
+void Visualization::pubLatestOdometry(const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, const Eigen::Vector3d &V, double t)
 {
     nav_msgs::Odometry odometry;
     odometry.header.stamp = ros::Time(t);
@@ -69,108 +75,323 @@ void pubLatestOdometry(const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, co
     odometry.twist.twist.linear.y = V.y();
     odometry.twist.twist.linear.z = V.z();
     pub_latest_odometry.publish(odometry);
+
+    Eigen::Quaterniond correction_q_copy;
+    Eigen::Vector3d correction_t_copy;
+    {
+        std::lock_guard<std::mutex> lk(m_correction);
+        if (!has_correction)
+            return;
+        correction_q_copy = correction_q;
+        correction_t_copy = correction_t;
+    }
+    Eigen::Vector3d corrected_P = correction_q_copy * P + correction_t_copy;
+    Eigen::Quaterniond corrected_Q = correction_q_copy * Q;
+    Eigen::Vector3d corrected_V = correction_q_copy * V;
+    odometry.pose.pose.position.x = corrected_P.x();
+    odometry.pose.pose.position.y = corrected_P.y();
+    odometry.pose.pose.position.z = corrected_P.z();
+    odometry.pose.pose.orientation.x = corrected_Q.x();
+    odometry.pose.pose.orientation.y = corrected_Q.y();
+    odometry.pose.pose.orientation.z = corrected_Q.z();
+    odometry.pose.pose.orientation.w = corrected_Q.w();
+    odometry.twist.twist.linear.x = corrected_V.x();
+    odometry.twist.twist.linear.y = corrected_V.y();
+    odometry.twist.twist.linear.z = corrected_V.z();
+    pub_latest_odometry_corrected.publish(odometry);
+}
+
+void Visualization::pubFastOdometry(const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, const Eigen::Vector3d &V, double t)
+{
+    nav_msgs::Odometry odometry;
+    odometry.header.stamp = ros::Time(t);
+    odometry.header.frame_id = "world";
+    odometry.child_frame_id = "world";
+    odometry.pose.pose.position.x = P.x();
+    odometry.pose.pose.position.y = P.y();
+    odometry.pose.pose.position.z = P.z();
+    odometry.pose.pose.orientation.x = Q.x();
+    odometry.pose.pose.orientation.y = Q.y();
+    odometry.pose.pose.orientation.z = Q.z();
+    odometry.pose.pose.orientation.w = Q.w();
+    odometry.twist.twist.linear.x = V.x();
+    odometry.twist.twist.linear.y = V.y();
+    odometry.twist.twist.linear.z = V.z();
+    pub_fast_odometry.publish(odometry);
 }
 
-void printStatistics(const Estimator &estimator, double t)
+void Visualization::setCorrection(const Eigen::Quaterniond &q, const Eigen::Vector3d &t)
 {
-    if (estimator.solver_flag != Estimator::SolverFlag::NON_LINEAR)
+    std::lock_guard<std::mutex> lk(m_correction);
+    has_correction = true;
+    correction_q = q.normalized();
+    correction_t = t;
+}
+
+void Visualization::pubPropagateLatency(const LatencyStatistics &stat, double t)
+{
+    geometry_msgs::Vector3Stamped msg;
+    msg.header.stamp = ros::Time(t);
+    msg.vector.x = stat.meanLatency();
+    msg.vector.y = stat.max_latency;
+    msg.vector.z = stat.max_compute;
+    pub_propagate_latency.publish(msg);
+}
+
+void Visualization::pubFrameBudget(const FrameBudget &budget, int degraded, double t)
+{
+    geometry_msgs::Vector3Stamped msg;
+    msg.header.stamp = ros::Time(t);
+    msg.vector.x = budget.frameTime();
+    msg.vector.y = degraded;
+    msg.vector.z = budget.featureCap();
+    pub_frame_budget.publish(msg);
+}
+
+void Visualization::pubLatency(double t)
+{
+    if (!pub_latency.getNumSubscribers())
         return;
-    //printf("position: %f, %f, %f\r", estimator.Ps[WINDOW_SIZE].x(), estimator.Ps[WINDOW_SIZE].y(), estimator.Ps[WINDOW_SIZE].z());
-    ROS_DEBUG_STREAM("position: " << estimator.Ps[WINDOW_SIZE].transpose());
-    ROS_DEBUG_STREAM("orientation: " << estimator.Vs[WINDOW_SIZE].transpose());
-    if (ESTIMATE_EXTRINSIC)
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = ros::Time(t);
+    for (int i = 0; i < LatencyProfiler::NUM_STAGES; i++)
+    {
+        LatencyProfiler::Stage stage = static_cast<LatencyProfiler::Stage>(i);
+        LatencyProfiler::Summary s = latency.summary(stage);
+        diagnostic_msgs::DiagnosticStatus status;
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.name = std::string("vins/") + LatencyProfiler::name(stage);
+        status.hardware_id = "vins_estimator";
+        const char *keys[] = {"count", "mean_ms", "p50_ms", "p95_ms", "p99_ms", "max_ms", "allocs", "alloc_bytes"};
+        double values[] = {(double)s.count, s.mean, s.p50, s.p95, s.p99, s.max, s.allocs, s.alloc_bytes};
+        for (int k = 0; k < 8; k++)
+        {
+            diagnostic_msgs::KeyValue kv;
+            kv.key = keys[k];
+            kv.value = std::to_string(values[k]);
+            status.values.push_back(kv);
+        }
+        msg.status.push_back(status);
+    }
+    pub_latency.publish(msg);
+}
+
+void Visualization::pubMemory(const MemoryFootprint &memory, double t)
+{
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = ros::Time(t);
+    // the landmark map belongs to the publish thread, as this does
+    const char *names[] = {"vins/feature_manager", "vins/image_frames", "vins/landmark_map", "vins/process"};
+    const char *count_keys[] = {"features", "frames", "landmarks", NULL};
+    size_t bytes[] = {memory.features, memory.image_frames, landmarks.memoryBytes(), memory.resident};
+    size_t counts[] = {memory.feature_count, memory.image_frame_count, landmarks.size(), 0};
+    for (int i = 0; i < 4; i++)
     {
-        cv::FileStorage fs(EX_CALIB_RESULT_PATH, cv::FileStorage::WRITE);
-        for (int i = 0; i < NUM_OF_CAM; i++)
+        diagnostic_msgs::DiagnosticStatus status;
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.name = names[i];
+        status.hardware_id = "vins_estimator";
+        diagnostic_msgs::KeyValue kv;
+        kv.key = count_keys[i] ? "bytes" : "resident_bytes";
+        kv.value = std::to_string(bytes[i]);
+        status.values.push_back(kv);
+        if (count_keys[i])
+        {
+            kv.key = count_keys[i];
+            kv.value = std::to_string(counts[i]);
+            status.values.push_back(kv);
+        }
+        msg.status.push_back(status);
+    }
+    pub_memory.publish(msg);
+}
+
+bool Visualization::memorySubscribed()
+{
+    return pub_memory.getNumSubscribers() > 0;
+}
+
+void Visualization::pubImageSync(uint64_t frames, const std::vector<uint64_t> &thrown, double max_offset, double t)
+{
+    if (!pub_image_sync.getNumSubscribers())
+        return;
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = ros::Time(t);
+    diagnostic_msgs::DiagnosticStatus status;
+    uint64_t total = 0;
+    for (uint64_t n : thrown)
+        total += n;
+    status.level = total > 0 ? diagnostic_msgs::DiagnosticStatus::WARN : diagnostic_msgs::DiagnosticStatus::OK;
+    status.name = "vins/image_sync";
+    status.hardware_id = "vins_estimator";
+    diagnostic_msgs::KeyValue kv;
+    kv.key = "frames";
+    kv.value = std::to_string(frames);
+    status.values.push_back(kv);
+    for (size_t k = 0; k < thrown.size(); k++)
+    {
+        kv.key = "thrown_img" + std::to_string(k);
+        kv.value = std::to_string(thrown[k]);
+        status.values.push_back(kv);
+    }
+    kv.key = "max_offset_ms";
+    kv.value = std::to_string(max_offset * 1000);
+    status.values.push_back(kv);
+    msg.status.push_back(status);
+    pub_image_sync.publish(msg);
+}
+
+void Visualization::printStatistics(const PublishSnapshot &snapshot, double t)
+{
+    if (!snapshot.non_linear)
+        return;
+    //printf("position: %f, %f, %f\r", snapshot.Ps[params.WINDOW_SIZE].x(), snapshot.Ps[params.WINDOW_SIZE].y(), snapshot.Ps[params.WINDOW_SIZE].z());
+    ROS_DEBUG_STREAM("position: " << snapshot.Ps[params.WINDOW_SIZE].transpose());
+    ROS_DEBUG_STREAM("orientation: " << snapshot.Vs[params.WINDOW_SIZE].transpose());
+    if (params.ESTIMATE_EXTRINSIC)
+    {
+        cv::FileStorage fs(params.EX_CALIB_RESULT_PATH, cv::FileStorage::WRITE);
+        for (int i = 0; i < params.NUM_OF_CAM; i++)
         {
             //ROS_DEBUG("calibration result for camera %d", i);
-            ROS_DEBUG_STREAM("extirnsic tic: " << estimator.tic[i].transpose());
-            ROS_DEBUG_STREAM("extrinsic ric: " << Utility::R2ypr(estimator.ric[i]).transpose());
+            ROS_DEBUG_STREAM("extirnsic tic: " << snapshot.tic[i].transpose());
+            ROS_DEBUG_STREAM("extrinsic ric: " << Utility::R2ypr(snapshot.ric[i]).transpose());
 
             Eigen::Matrix4d eigen_T = Eigen::Matrix4d::Identity();
-            eigen_T.block<3, 3>(0, 0) = estimator.ric[i];
-            eigen_T.block<3, 1>(0, 3) = estimator.tic[i];
+            eigen_T.block<3, 3>(0, 0) = snapshot.ric[i];
+            eigen_T.block<3, 1>(0, 3) = snapshot.tic[i];
             cv::Mat cv_T;
             cv::eigen2cv(eigen_T, cv_T);
-            if(i == 0)
-                fs << "body_T_cam0" << cv_T ;
-            else
-                fs << "body_T_cam1" << cv_T ;
+            fs << "body_T_cam" + to_string(i) << cv_T;
         }
         fs.release();
     }
 
-    static double sum_of_time = 0;
-    static int sum_of_calculation = 0;
     sum_of_time += t;
     sum_of_calculation++;
     ROS_DEBUG("vo solver costs: %f ms", t);
     ROS_DEBUG("average of time %f ms", sum_of_time / sum_of_calculation);
 
-    sum_of_path += (estimator.Ps[WINDOW_SIZE] - last_path).norm();
-    last_path = estimator.Ps[WINDOW_SIZE];
+    sum_of_path += (snapshot.Ps[params.WINDOW_SIZE] - last_path).norm();
+    last_path = snapshot.Ps[params.WINDOW_SIZE];
     ROS_DEBUG("sum of path %f", sum_of_path);
-    if (ESTIMATE_TD)
-        ROS_INFO("td %f", estimator.td);
+    if (params.ESTIMATE_TD)
+        ROS_INFO("td %f", snapshot.td);
+}
+
+bool Visualization::pointsSubscribed()
+{
+    return pub_point_cloud.getNumSubscribers() || pub_margin_cloud.getNumSubscribers() ||
+           pub_keyframe_point.getNumSubscribers();
+}
+
+bool Visualization::rectifySubscribed()
+{
+    return pub_rectify_image_left.getNumSubscribers() || pub_rectify_image_right.getNumSubscribers();
 }
 
-void pubOdometry(const Estimator &estimator, const std_msgs::Header &header)
+void Visualization::pubRectifyImage(const cv::Mat &left, const cv::Mat &right, const cv::Mat &K, double t)
 {
-    if (estimator.solver_flag == Estimator::SolverFlag::NON_LINEAR)
+    std_msgs::Header header;
+    header.stamp = ros::Time(t);
+    header.frame_id = "world";
+
+    // rectified right <---- rectified left, x / z of the left camera in the right one is -baseline
+    Eigen::Vector3d baseline = params.rectify_R_right * params.RIC[1].transpose() * (params.TIC[0] - params.TIC[1]);
+
+    sensor_msgs::CameraInfo info;
+    info.header = header;
+    info.width = left.cols;
+    info.height = left.rows;
+    info.distortion_model = "plumb_bob";
+    info.D.assign(5, 0.0);
+    for (int i = 0; i < 9; i++)
     {
-        nav_msgs::Odometry odometry;
+        info.K[i] = K.at<float>(i / 3, i % 3);
+        info.R[i] = i % 4 == 0 ? 1.0 : 0.0;
+        info.P[i / 3 * 4 + i % 3] = info.K[i];
+    }
+    pub_rectify_info_left.publish(info);
+    pub_rectify_image_left.publish(cv_bridge::CvImage(header, sensor_msgs::image_encodings::MONO8, left).toImageMsg());
+
+    info.P[3] = info.K[0] * baseline.x();
+    pub_rectify_info_right.publish(info);
+    pub_rectify_image_right.publish(cv_bridge::CvImage(header, sensor_msgs::image_encodings::MONO8, right).toImageMsg());
+}
+
+bool Visualization::trackImageSubscribed()
+{
+    return pub_image_track.getNumSubscribers();
+}
+
+void Visualization::pubTrackImage(const cv::Mat &image, double t)
+{
+    std_msgs::Header header;
+    header.stamp = ros::Time(t);
+    header.frame_id = "world";
+    pub_image_track.publish(cv_bridge::CvImage(header, sensor_msgs::image_encodings::BGR8, image).toImageMsg());
+}
+
+void Visualization::pubOdometry(const PublishSnapshot &snapshot, const std_msgs::Header &header)
+{
+    if (snapshot.non_linear)
+    {
+        nav_msgs::OdometryPtr odometry_msg(new nav_msgs::Odometry);
+        nav_msgs::Odometry &odometry = *odometry_msg;
         odometry.header = header;
         odometry.header.frame_id = "world";
         odometry.child_frame_id = "world";
         Quaterniond tmp_Q;
-        tmp_Q = Quaterniond(estimator.Rs[WINDOW_SIZE]);
-        odometry.pose.pose.position.x = estimator.Ps[WINDOW_SIZE].x();
-        odometry.pose.pose.position.y = estimator.Ps[WINDOW_SIZE].y();
-        odometry.pose.pose.position.z = estimator.Ps[WINDOW_SIZE].z();
+        tmp_Q = Quaterniond(snapshot.Rs[params.WINDOW_SIZE]);
+        odometry.pose.pose.position.x = snapshot.Ps[params.WINDOW_SIZE].x();
+        odometry.pose.pose.position.y = snapshot.Ps[params.WINDOW_SIZE].y();
+        odometry.pose.pose.position.z = snapshot.Ps[params.WINDOW_SIZE].z();
         odometry.pose.pose.orientation.x = tmp_Q.x();
         odometry.pose.pose.orientation.y = tmp_Q.y();
         odometry.pose.pose.orientation.z = tmp_Q.z();
         odometry.pose.pose.orientation.w = tmp_Q.w();
-        odometry.twist.twist.linear.x = estimator.Vs[WINDOW_SIZE].x();
-        odometry.twist.twist.linear.y = estimator.Vs[WINDOW_SIZE].y();
-        odometry.twist.twist.linear.z = estimator.Vs[WINDOW_SIZE].z();
-        pub_odometry.publish(odometry);
-
-        geometry_msgs::PoseStamped pose_stamped;
-        pose_stamped.header = header;
-        pose_stamped.header.frame_id = "world";
-        pose_stamped.pose = odometry.pose.pose;
-        path.header = header;
-        path.header.frame_id = "world";
-        path.poses.push_back(pose_stamped);
-        pub_path.publish(path);
-
-        // write result to file
-        ofstream foutC(VINS_RESULT_PATH, ios::app);
-        foutC.setf(ios::fixed, ios::floatfield);
-        foutC.precision(0);
-        foutC << header.stamp.toSec() * 1e9 << ",";
-        foutC.precision(5);
-        foutC << estimator.Ps[WINDOW_SIZE].x() << ","
-              << estimator.Ps[WINDOW_SIZE].y() << ","
-              << estimator.Ps[WINDOW_SIZE].z() << ","
-              << tmp_Q.w() << ","
-              << tmp_Q.x() << ","
-              << tmp_Q.y() << ","
-              << tmp_Q.z() << ","
-              << estimator.Vs[WINDOW_SIZE].x() << ","
-              << estimator.Vs[WINDOW_SIZE].y() << ","
-              << estimator.Vs[WINDOW_SIZE].z() << "," << endl;
-        foutC.close();
-        Eigen::Vector3d tmp_T = estimator.Ps[WINDOW_SIZE];
-        printf("time: %f, t: %f %f %f q: %f %f %f %f \n", header.stamp.toSec(), tmp_T.x(), tmp_T.y(), tmp_T.z(),
+        odometry.twist.twist.linear.x = snapshot.Vs[params.WINDOW_SIZE].x();
+        odometry.twist.twist.linear.y = snapshot.Vs[params.WINDOW_SIZE].y();
+        odometry.twist.twist.linear.z = snapshot.Vs[params.WINDOW_SIZE].z();
+        if (pub_odometry.getNumSubscribers())
+            pub_odometry.publish(odometry_msg);
+
+        if (!result_writer.isOpen())
+            result_writer.open(params.VINS_RESULT_PATH, static_cast<TrajectoryWriter::Format>(params.TRAJECTORY_FORMAT));
+        result_writer.write(header.stamp.toSec(), snapshot.Ps[params.WINDOW_SIZE], tmp_Q, snapshot.Vs[params.WINDOW_SIZE]);
+        Eigen::Vector3d tmp_T = snapshot.Ps[params.WINDOW_SIZE];
+        VINS_DEBUG("time: %f, t: %f %f %f q: %f %f %f %f \n", header.stamp.toSec(), tmp_T.x(), tmp_T.y(), tmp_T.z(),
                                                           tmp_Q.w(), tmp_Q.x(), tmp_Q.y(), tmp_Q.z());
     }
 }
 
-void pubKeyPoses(const Estimator &estimator, const std_msgs::Header &header)
+void Visualization::pubPath(const PublishSnapshot &snapshot, const std_msgs::Header &header, bool send)
+{
+    if (!snapshot.non_linear)
+        return;
+    geometry_msgs::PoseStamped pose_stamped;
+    pose_stamped.header = header;
+    pose_stamped.header.frame_id = "world";
+    Quaterniond tmp_Q(snapshot.Rs[params.WINDOW_SIZE]);
+    pose_stamped.pose.position.x = snapshot.Ps[params.WINDOW_SIZE].x();
+    pose_stamped.pose.position.y = snapshot.Ps[params.WINDOW_SIZE].y();
+    pose_stamped.pose.position.z = snapshot.Ps[params.WINDOW_SIZE].z();
+    pose_stamped.pose.orientation.x = tmp_Q.x();
+    pose_stamped.pose.orientation.y = tmp_Q.y();
+    pose_stamped.pose.orientation.z = tmp_Q.z();
+    pose_stamped.pose.orientation.w = tmp_Q.w();
+    if (pub_path_pose.getNumSubscribers())
+        pub_path_pose.publish(pose_stamped);
+    path.header = header;
+    path.header.frame_id = "world";
+    appendDecimated(path, pose_stamped, params.PATH_MAX_POSES);
+    if (send && pub_path.getNumSubscribers())
+        pub_path.publish(path);
+}
+
+void Visualization::pubKeyPoses(const PublishSnapshot &snapshot, const std_msgs::Header &header)
 {
-    if (estimator.key_poses.size() == 0)
+    if (snapshot.key_poses.size() == 0 || !pub_key_poses.getNumSubscribers())
         return;
     visualization_msgs::Marker key_poses;
     key_poses.header = header;
@@ -189,11 +410,11 @@ void pubKeyPoses(const Estimator &estimator, const std_msgs::Header &header)
     key_poses.color.r = 1.0;
     key_poses.color.a = 1.0;
 
-    for (int i = 0; i <= WINDOW_SIZE; i++)
+    for (int i = 0; i <= params.WINDOW_SIZE; i++)
     {
         geometry_msgs::Point pose_marker;
         Vector3d correct_pose;
-        correct_pose = estimator.key_poses[i];
+        correct_pose = snapshot.key_poses[i];
         pose_marker.x = correct_pose.x();
         pose_marker.y = correct_pose.y();
         pose_marker.z = correct_pose.z();
@@ -202,15 +423,15 @@ void pubKeyPoses(const Estimator &estimator, const std_msgs::Header &header)
     pub_key_poses.publish(key_poses);
 }
 
-void pubCameraPose(const Estimator &estimator, const std_msgs::Header &header)
+void Visualization::pubCameraPose(const PublishSnapshot &snapshot, const std_msgs::Header &header)
 {
-    int idx2 = WINDOW_SIZE - 1;
+    int idx2 = params.WINDOW_SIZE - 1;
 
-    if (estimator.solver_flag == Estimator::SolverFlag::NON_LINEAR)
+    if (snapshot.non_linear)
     {
         int i = idx2;
-        Vector3d P = estimator.Ps[i] + estimator.Rs[i] * estimator.tic[0];
-        Quaterniond R = Quaterniond(estimator.Rs[i] * estimator.ric[0]);
+        Vector3d P = snapshot.Ps[i] + snapshot.Rs[i] * snapshot.tic[0];
+        Quaterniond R = Quaterniond(snapshot.Rs[i] * snapshot.ric[0]);
 
         nav_msgs::Odometry odometry;
         odometry.header = header;
@@ -223,10 +444,10 @@ void pubCameraPose(const Estimator &estimator, const std_msgs::Header &header)
         odometry.pose.pose.orientation.z = R.z();
         odometry.pose.pose.orientation.w = R.w();
 
-        if(STEREO)
+        if(params.STEREO)
         {
-            Vector3d P_r = estimator.Ps[i] + estimator.Rs[i] * estimator.tic[1];
-            Quaterniond R_r = Quaterniond(estimator.Rs[i] * estimator.ric[1]);
+            Vector3d P_r = snapshot.Ps[i] + snapshot.Rs[i] * snapshot.tic[1];
+            Quaterniond R_r = Quaterniond(snapshot.Rs[i] * snapshot.ric[1]);
 
             nav_msgs::Odometry odometry_r;
             odometry_r.header = header;
@@ -239,12 +460,12 @@ void pubCameraPose(const Estimator &estimator, const std_msgs::Header &header)
             odometry_r.pose.pose.orientation.z = R_r.z();
             odometry_r.pose.pose.orientation.w = R_r.w();
             pub_camera_pose_right.publish(odometry_r);
-            if(PUB_RECTIFY)
+            if(params.PUB_RECTIFY)
             {
                 Vector3d R_P_l = P;
                 Vector3d R_P_r = P_r;
-                Quaterniond R_R_l = Quaterniond(estimator.Rs[i] * estimator.ric[0] * rectify_R_left.inverse());
-                Quaterniond R_R_r = Quaterniond(estimator.Rs[i] * estimator.ric[1] * rectify_R_right.inverse());
+                Quaterniond R_R_l = Quaterniond(snapshot.Rs[i] * snapshot.ric[0] * params.rectify_R_left.inverse());
+                Quaterniond R_R_r = Quaterniond(snapshot.Rs[i] * snapshot.ric[1] * params.rectify_R_right.inverse());
                 geometry_msgs::PoseStamped R_pose_l, R_pose_r;
                 R_pose_l.header = header;
                 R_pose_r.header = header;
@@ -276,10 +497,10 @@ void pubCameraPose(const Estimator &estimator, const std_msgs::Header &header)
 
         cameraposevisual.reset();
         cameraposevisual.add_pose(P, R);
-        if(STEREO)
+        if(params.STEREO)
         {
-            Vector3d P = estimator.Ps[i] + estimator.Rs[i] * estimator.tic[1];
-            Quaterniond R = Quaterniond(estimator.Rs[i] * estimator.ric[1]);
+            Vector3d P = snapshot.Ps[i] + snapshot.Rs[i] * snapshot.tic[1];
+            Quaterniond R = Quaterniond(snapshot.Rs[i] * snapshot.ric[1]);
             cameraposevisual.add_pose(P, R);
         }
         cameraposevisual.publish_by(pub_camera_pose_visual, odometry.header);
@@ -287,77 +508,166 @@ void pubCameraPose(const Estimator &estimator, const std_msgs::Header &header)
 }
 
 
-void pubPointCloud(const Estimator &estimator, const std_msgs::Header &header)
+// world position of the host frame observation of a snapshot feature
+static Vector3d worldPoint(const PublishSnapshot &snapshot, const SnapshotFeature &feature)
 {
-    sensor_msgs::PointCloud point_cloud, loop_point_cloud;
-    point_cloud.header = header;
-    loop_point_cloud.header = header;
+    int imu_i = feature.start_frame;
+    return snapshot.Rs[imu_i] * (snapshot.ric[feature.camera] * feature.pts_i + snapshot.tic[feature.camera]) +
+           snapshot.Ps[imu_i];
+}
+
+// x, y, z in float32, room for every feature of the snapshot, shrunk to the points written by
+// finishCloud
+static void startCloud(sensor_msgs::PointCloud2 &cloud, const std_msgs::Header &header, size_t capacity)
+{
+    cloud.header = header;
+    sensor_msgs::PointCloud2Modifier modifier(cloud);
+    modifier.setPointCloud2FieldsByString(1, "xyz");
+    // at least one point, the iterators take the address of the first byte
+    modifier.resize(std::max<size_t>(capacity, 1));
+}
 
+static void finishCloud(sensor_msgs::PointCloud2 &cloud, size_t points)
+{
+    sensor_msgs::PointCloud2Modifier(cloud).resize(points);
+}
 
-    for (auto &it_per_id : estimator.f_manager.feature)
+void Visualization::pubPointCloud(const PublishSnapshot &snapshot, const std_msgs::Header &header)
+{
+    // the snapshot only holds solved features started before params.WINDOW_SIZE - 2
+    if (pub_point_cloud.getNumSubscribers())
     {
-        int used_num;
-        used_num = it_per_id.feature_per_frame.size();
-        if (!(used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
-            continue;
-        if (it_per_id.start_frame > WINDOW_SIZE * 3.0 / 4.0 || it_per_id.solve_flag != 1)
-            continue;
-        int imu_i = it_per_id.start_frame;
-        Vector3d pts_i = it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth;
-        Vector3d w_pts_i = estimator.Rs[imu_i] * (estimator.ric[0] * pts_i + estimator.tic[0]) + estimator.Ps[imu_i];
-
-        geometry_msgs::Point32 p;
-        p.x = w_pts_i(0);
-        p.y = w_pts_i(1);
-        p.z = w_pts_i(2);
-        point_cloud.points.push_back(p);
+        sensor_msgs::PointCloud2Ptr point_cloud(new sensor_msgs::PointCloud2);
+        startCloud(*point_cloud, header, snapshot.features.size());
+        sensor_msgs::PointCloud2Iterator<float> out(*point_cloud, "x");
+        size_t n = 0;
+        for (const SnapshotFeature &it_per_id : snapshot.features)
+        {
+            if (it_per_id.size < 2 || it_per_id.start_frame > params.WINDOW_SIZE * 3.0 / 4.0)
+                continue;
+            Vector3d w_pts_i = worldPoint(snapshot, it_per_id);
+            out[0] = w_pts_i(0);
+            out[1] = w_pts_i(1);
+            out[2] = w_pts_i(2);
+            ++out;
+            n++;
+        }
+        finishCloud(*point_cloud, n);
+        pub_point_cloud.publish(point_cloud);
     }
-    pub_point_cloud.publish(point_cloud);
 
+    // the points marginalized with the oldest frame
+    if (pub_margin_cloud.getNumSubscribers())
+    {
+        sensor_msgs::PointCloud2Ptr margin_cloud(new sensor_msgs::PointCloud2);
+        startCloud(*margin_cloud, header, snapshot.features.size());
+        sensor_msgs::PointCloud2Iterator<float> out(*margin_cloud, "x");
+        size_t n = 0;
+        for (const SnapshotFeature &it_per_id : snapshot.features)
+        {
+            if (it_per_id.start_frame != 0 || it_per_id.size != 2)
+                continue;
+            Vector3d w_pts_i = worldPoint(snapshot, it_per_id);
+            out[0] = w_pts_i(0);
+            out[1] = w_pts_i(1);
+            out[2] = w_pts_i(2);
+            ++out;
+            n++;
+        }
+        finishCloud(*margin_cloud, n);
+        pub_margin_cloud.publish(margin_cloud);
+    }
+}
 
-    // pub margined potin
-    sensor_msgs::PointCloud margin_cloud;
-    margin_cloud.header = header;
 
-    for (auto &it_per_id : estimator.f_manager.feature)
-    { 
-        int used_num;
-        used_num = it_per_id.feature_per_frame.size();
-        if (!(used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
-            continue;
-        //if (it_per_id->start_frame > WINDOW_SIZE * 3.0 / 4.0 || it_per_id->solve_flag != 1)
-        //        continue;
+void Visualization::resetLandmarkMap()
+{
+    landmarks.reset(params.LANDMARK_MAP_VOXEL, params.LANDMARK_MAP_MAX_VOXELS);
+    landmark_map_t = -1;
+}
 
-        if (it_per_id.start_frame == 0 && it_per_id.feature_per_frame.size() <= 2 
-            && it_per_id.solve_flag == 1 )
-        {
-            int imu_i = it_per_id.start_frame;
-            Vector3d pts_i = it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth;
-            Vector3d w_pts_i = estimator.Rs[imu_i] * (estimator.ric[0] * pts_i + estimator.tic[0]) + estimator.Ps[imu_i];
-
-            geometry_msgs::Point32 p;
-            p.x = w_pts_i(0);
-            p.y = w_pts_i(1);
-            p.z = w_pts_i(2);
-            margin_cloud.points.push_back(p);
-        }
+// x, y, z in float32, slot id and count in uint32; the removed ids first, with count 0
+static void landmarkCloud(sensor_msgs::PointCloud2 &cloud, const std_msgs::Header &header, const LandmarkMap &map,
+                          const vector<uint32_t> &removed, const vector<uint32_t> &ids)
+{
+    cloud.header = header;
+    sensor_msgs::PointCloud2Modifier modifier(cloud);
+    modifier.setPointCloud2Fields(5, "x", 1, sensor_msgs::PointField::FLOAT32, "y", 1, sensor_msgs::PointField::FLOAT32,
+                                  "z", 1, sensor_msgs::PointField::FLOAT32, "id", 1, sensor_msgs::PointField::UINT32,
+                                  "count", 1, sensor_msgs::PointField::UINT32);
+    modifier.resize(removed.size() + ids.size());
+    if (removed.empty() && ids.empty())
+        return;
+    sensor_msgs::PointCloud2Iterator<float> xyz(cloud, "x");
+    sensor_msgs::PointCloud2Iterator<uint32_t> id(cloud, "id");
+    sensor_msgs::PointCloud2Iterator<uint32_t> count(cloud, "count");
+    for (uint32_t r : removed)
+    {
+        xyz[0] = xyz[1] = xyz[2] = 0;
+        *id = r;
+        *count = 0;
+        ++xyz, ++id, ++count;
+    }
+    for (uint32_t i : ids)
+    {
+        const LandmarkMap::Landmark &l = map.landmark(i);
+        xyz[0] = l.p.x();
+        xyz[1] = l.p.y();
+        xyz[2] = l.p.z();
+        *id = i;
+        *count = l.count;
+        ++xyz, ++id, ++count;
     }
-    pub_margin_cloud.publish(margin_cloud);
 }
 
+void Visualization::pubLandmarkMap(const PublishSnapshot &snapshot, const std_msgs::Header &header)
+{
+    if (!landmarks.enabled())
+        return;
+    // a new world frame after a failure, the old landmarks are not in it
+    if (!snapshot.non_linear)
+    {
+        if (landmarks.size() > 0)
+            landmarks.clear();
+    }
+    else if (snapshot.margin_old)
+    {
+        for (const SnapshotFeature &it_per_id : snapshot.features)
+            if (it_per_id.start_frame == 0 && it_per_id.size == 2)
+                landmarks.insert(worldPoint(snapshot, it_per_id));
+    }
+
+    // taken also without subscribers, the change lists stay short
+    landmarks.takeChanges(landmark_updated, landmark_removed);
+    if (pub_landmark_delta.getNumSubscribers() && (!landmark_updated.empty() || !landmark_removed.empty()))
+    {
+        sensor_msgs::PointCloud2Ptr delta(new sensor_msgs::PointCloud2);
+        landmarkCloud(*delta, header, landmarks, landmark_removed, landmark_updated);
+        pub_landmark_delta.publish(delta);
+    }
+    if (pub_landmark_map.getNumSubscribers() && (landmark_map_t < 0 || snapshot.t - landmark_map_t >= 5.0 ||
+                                                 snapshot.t < landmark_map_t))
+    {
+        landmark_map_t = snapshot.t;
+        vector<uint32_t> ids;
+        landmarks.ids(ids);
+        sensor_msgs::PointCloud2Ptr map(new sensor_msgs::PointCloud2);
+        landmarkCloud(*map, header, landmarks, vector<uint32_t>(), ids);
+        pub_landmark_map.publish(map);
+    }
+}
 
-void pubTF(const Estimator &estimator, const std_msgs::Header &header)
+void Visualization::pubTF(const PublishSnapshot &snapshot, const std_msgs::Header &header)
 {
-    if( estimator.solver_flag != Estimator::SolverFlag::NON_LINEAR)
+    if( !snapshot.non_linear)
         return;
-    static tf::TransformBroadcaster br;
     tf::Transform transform;
     tf::Quaternion q;
     // body frame
     Vector3d correct_t;
     Quaterniond correct_q;
-    correct_t = estimator.Ps[WINDOW_SIZE];
-    correct_q = estimator.Rs[WINDOW_SIZE];
+    correct_t = snapshot.Ps[params.WINDOW_SIZE];
+    correct_q = snapshot.Rs[params.WINDOW_SIZE];
 
     transform.setOrigin(tf::Vector3(correct_t(0),
                                     correct_t(1),
@@ -367,47 +677,49 @@ void pubTF(const Estimator &estimator, const std_msgs::Header &header)
     q.setY(correct_q.y());
     q.setZ(correct_q.z());
     transform.setRotation(q);
-    br.sendTransform(tf::StampedTransform(transform, header.stamp, "world", "body"));
+    br->sendTransform(tf::StampedTransform(transform, header.stamp, "world", "body"));
 
     // camera frame
-    transform.setOrigin(tf::Vector3(estimator.tic[0].x(),
-                                    estimator.tic[0].y(),
-                                    estimator.tic[0].z()));
-    q.setW(Quaterniond(estimator.ric[0]).w());
-    q.setX(Quaterniond(estimator.ric[0]).x());
-    q.setY(Quaterniond(estimator.ric[0]).y());
-    q.setZ(Quaterniond(estimator.ric[0]).z());
+    transform.setOrigin(tf::Vector3(snapshot.tic[0].x(),
+                                    snapshot.tic[0].y(),
+                                    snapshot.tic[0].z()));
+    q.setW(Quaterniond(snapshot.ric[0]).w());
+    q.setX(Quaterniond(snapshot.ric[0]).x());
+    q.setY(Quaterniond(snapshot.ric[0]).y());
+    q.setZ(Quaterniond(snapshot.ric[0]).z());
     transform.setRotation(q);
-    br.sendTransform(tf::StampedTransform(transform, header.stamp, "body", "camera"));
+    br->sendTransform(tf::StampedTransform(transform, header.stamp, "body", "camera"));
 
     
-    nav_msgs::Odometry odometry;
+    nav_msgs::OdometryPtr odometry_msg(new nav_msgs::Odometry);
+    nav_msgs::Odometry &odometry = *odometry_msg;
     odometry.header = header;
     odometry.header.frame_id = "world";
-    odometry.pose.pose.position.x = estimator.tic[0].x();
-    odometry.pose.pose.position.y = estimator.tic[0].y();
-    odometry.pose.pose.position.z = estimator.tic[0].z();
-    Quaterniond tmp_q{estimator.ric[0]};
+    odometry.pose.pose.position.x = snapshot.tic[0].x();
+    odometry.pose.pose.position.y = snapshot.tic[0].y();
+    odometry.pose.pose.position.z = snapshot.tic[0].z();
+    Quaterniond tmp_q{snapshot.ric[0]};
     odometry.pose.pose.orientation.x = tmp_q.x();
     odometry.pose.pose.orientation.y = tmp_q.y();
     odometry.pose.pose.orientation.z = tmp_q.z();
     odometry.pose.pose.orientation.w = tmp_q.w();
-    pub_extrinsic.publish(odometry);
+    pub_extrinsic.publish(odometry_msg);
 
 }
 
-void pubKeyframe(const Estimator &estimator)
+void Visualization::pubKeyframe(const PublishSnapshot &snapshot)
 {
     // pub camera pose, 2D-3D points of keyframe
-    if (estimator.solver_flag == Estimator::SolverFlag::NON_LINEAR && estimator.marginalization_flag == 0)
+    if (snapshot.non_linear && snapshot.margin_old)
     {
-        int i = WINDOW_SIZE - 2;
-        //Vector3d P = estimator.Ps[i] + estimator.Rs[i] * estimator.tic[0];
-        Vector3d P = estimator.Ps[i];
-        Quaterniond R = Quaterniond(estimator.Rs[i]);
-
-        nav_msgs::Odometry odometry;
-        odometry.header.stamp = ros::Time(estimator.Headers[WINDOW_SIZE - 2]);
+        int i = params.WINDOW_SIZE - 2;
+        //Vector3d P = snapshot.Ps[i] + snapshot.Rs[i] * snapshot.tic[0];
+        Vector3d P = snapshot.Ps[i];
+        Quaterniond R = Quaterniond(snapshot.Rs[i]);
+
+        nav_msgs::OdometryPtr odometry_msg(new nav_msgs::Odometry);
+        nav_msgs::Odometry &odometry = *odometry_msg;
+        odometry.header.stamp = ros::Time(snapshot.Headers[params.WINDOW_SIZE - 2]);
         odometry.header.frame_id = "world";
         odometry.pose.pose.position.x = P.x();
         odometry.pose.pose.position.y = P.y();
@@ -418,39 +730,54 @@ void pubKeyframe(const Estimator &estimator)
         odometry.pose.pose.orientation.w = R.w();
         //printf("time: %f t: %f %f %f r: %f %f %f %f\n", odometry.header.stamp.toSec(), P.x(), P.y(), P.z(), R.w(), R.x(), R.y(), R.z());
 
-        pub_keyframe_pose.publish(odometry);
+        pub_keyframe_pose.publish(odometry_msg);
 
 
-        sensor_msgs::PointCloud point_cloud;
-        point_cloud.header.stamp = ros::Time(estimator.Headers[WINDOW_SIZE - 2]);
+        // per point x, y, z (world), u, v (normalized) and px, py (pixel) in frame WINDOW_SIZE - 2,
+        // all float32, then the feature id as float64 (exact for the 64-bit ids of camera 0)
+        sensor_msgs::PointCloud2Ptr point_cloud_msg(new sensor_msgs::PointCloud2);
+        sensor_msgs::PointCloud2 &point_cloud = *point_cloud_msg;
+        point_cloud.header.stamp = ros::Time(snapshot.Headers[params.WINDOW_SIZE - 2]);
         point_cloud.header.frame_id = "world";
-        for (auto &it_per_id : estimator.f_manager.feature)
+        sensor_msgs::PointCloud2Modifier modifier(point_cloud);
+        modifier.setPointCloud2Fields(8, "x", 1, sensor_msgs::PointField::FLOAT32,
+                                      "y", 1, sensor_msgs::PointField::FLOAT32,
+                                      "z", 1, sensor_msgs::PointField::FLOAT32,
+                                      "u", 1, sensor_msgs::PointField::FLOAT32,
+                                      "v", 1, sensor_msgs::PointField::FLOAT32,
+                                      "px", 1, sensor_msgs::PointField::FLOAT32,
+                                      "py", 1, sensor_msgs::PointField::FLOAT32,
+                                      "id", 1, sensor_msgs::PointField::FLOAT64);
+        modifier.resize(std::max<size_t>(snapshot.features.size(), 1));
+        sensor_msgs::PointCloud2Iterator<float> out(point_cloud, "x");
+        sensor_msgs::PointCloud2Iterator<double> out_id(point_cloud, "id");
+        size_t n = 0;
+        for (const SnapshotFeature &it_per_id : snapshot.features)
         {
-            int frame_size = it_per_id.feature_per_frame.size();
-            if(it_per_id.start_frame < WINDOW_SIZE - 2 && it_per_id.start_frame + frame_size - 1 >= WINDOW_SIZE - 2 && it_per_id.solve_flag == 1)
-            {
-
-                int imu_i = it_per_id.start_frame;
-                Vector3d pts_i = it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth;
-                Vector3d w_pts_i = estimator.Rs[imu_i] * (estimator.ric[0] * pts_i + estimator.tic[0])
-                                      + estimator.Ps[imu_i];
-                geometry_msgs::Point32 p;
-                p.x = w_pts_i(0);
-                p.y = w_pts_i(1);
-                p.z = w_pts_i(2);
-                point_cloud.points.push_back(p);
-
-                int imu_j = WINDOW_SIZE - 2 - it_per_id.start_frame;
-                sensor_msgs::ChannelFloat32 p_2d;
-                p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].point.x());
-                p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].point.y());
-                p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].uv.x());
-                p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].uv.y());
-                p_2d.values.push_back(it_per_id.feature_id);
-                point_cloud.channels.push_back(p_2d);
-            }
+            // loop_fusion only knows camera 0
+            if (it_per_id.camera != 0 || it_per_id.start_frame + it_per_id.size - 1 < params.WINDOW_SIZE - 2)
+                continue;
+            Vector3d w_pts_i = worldPoint(snapshot, it_per_id);
+            out[0] = w_pts_i(0);
+            out[1] = w_pts_i(1);
+            out[2] = w_pts_i(2);
+            std::copy(it_per_id.keyframe_obs, it_per_id.keyframe_obs + 4, &out[3]);
+            *out_id = it_per_id.feature_id;
+            ++out;
+            ++out_id;
+            n++;
+        }
+        modifier.resize(n);
+        pub_keyframe_point.publish(point_cloud_msg);
 
+        // same stamp as keyframe_pose and keyframe_point, loop_fusion pairs them exactly
+        if (!snapshot.keyframe_image.empty())
+        {
+            std_msgs::Header image_header;
+            image_header.stamp = odometry.header.stamp;
+            image_header.frame_id = "world";
+            pub_keyframe_image.publish(cv_bridge::CvImage(image_header, sensor_msgs::image_encodings::MONO8,
+                                                          snapshot.keyframe_image).toImageMsg());
         }
-        pub_keyframe_point.publish(point_cloud);
     }
 }
\ No newline at end of file
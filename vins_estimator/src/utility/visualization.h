@@ -15,49 +15,153 @@
 #include <std_msgs/Bool.h>
 #include <sensor_msgs/Imu.h>
 #include <sensor_msgs/PointCloud.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/point_cloud2_iterator.h>
 #include <sensor_msgs/Image.h>
+#include <sensor_msgs/CameraInfo.h>
 #include <sensor_msgs/image_encodings.h>
+#include <cv_bridge/cv_bridge.h>
 #include <nav_msgs/Path.h>
 #include <nav_msgs/Odometry.h>
 #include <geometry_msgs/PointStamped.h>
+#include <geometry_msgs/Vector3Stamped.h>
 #include <visualization_msgs/Marker.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
 #include <tf/transform_broadcaster.h>
 #include "CameraPoseVisualization.h"
 #include <eigen3/Eigen/Dense>
-#include "../estimator/estimator.h"
 #include "../estimator/parameters.h"
+#include "../estimator/publish_snapshot.h"
+#include "../estimator/imu_propagator.h"
+#include "../estimator/frame_budget.h"
+#include "latency_profiler.h"
+#include "landmark_map.h"
+#include "trajectory_writer.h"
 #include <fstream>
+#include <memory>
+#include <mutex>
 
-extern ros::Publisher pub_odometry;
-extern ros::Publisher pub_path, pub_pose;
-extern ros::Publisher pub_cloud, pub_map;
-extern ros::Publisher pub_key_poses;
-extern ros::Publisher pub_ref_pose, pub_cur_pose;
-extern ros::Publisher pub_key;
-extern nav_msgs::Path path;
-extern ros::Publisher pub_pose_graph;
-extern int IMAGE_ROW, IMAGE_COL;
+// The ROS output of one estimator: its publishers, the path, the tf broadcaster and the result
+// file. Advertises on the node handle given to registerPub, so estimators in one process publish
+// under their own namespaces.
+class Visualization
+{
+  public:
+    // both are kept by reference, they belong to the estimator
+    Visualization(const Parameters &_params, const LatencyProfiler &_latency);
 
-void registerPub(ros::NodeHandle &n);
+    void registerPub(ros::NodeHandle &n);
 
-void pubLatestOdometry(const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, const Eigen::Vector3d &V, double t);
+    // imu_propagate, and imu_propagate_corrected once a correction has been set
+    void pubLatestOdometry(const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, const Eigen::Vector3d &V, double t);
 
-void printStatistics(const Estimator &estimator, double t);
+    // fast_odometry, the motion only pose of a frame published before its window optimization
+    void pubFastOdometry(const Eigen::Vector3d &P, const Eigen::Quaterniond &Q, const Eigen::Vector3d &V, double t);
 
-void pubOdometry(const Estimator &estimator, const std_msgs::Header &header);
+    // corrected frame <---- vio frame, the drift (and gps alignment) solved by loop_fusion or
+    // global_fusion, applied to every imu propagated pose from now on
+    void setCorrection(const Eigen::Quaterniond &q, const Eigen::Vector3d &t);
 
-void pubInitialGuess(const Estimator &estimator, const std_msgs::Header &header);
+    // imu_propagate_latency: mean (x) and max (y) stamp to publish latency, max propagation time (z), in ms
+    void pubPropagateLatency(const LatencyStatistics &stat, double t);
 
-void pubKeyPoses(const Estimator &estimator, const std_msgs::Header &header);
+    // frame_budget: frame time in ms (x), FrameBudget::Degradation mask (y), feature cap, -1 for none (z)
+    void pubFrameBudget(const FrameBudget &budget, int degraded, double t);
 
-void pubCameraPose(const Estimator &estimator, const std_msgs::Header &header);
+    // latency: one status per LatencyProfiler stage, count and mean / p50 / p95 / p99 / max in ms,
+    // allocations and bytes per run
+    void pubLatency(double t);
 
-void pubPointCloud(const Estimator &estimator, const std_msgs::Header &header);
+    // memory: a status per part of the estimator with its bytes and records, and the process;
+    // publish thread, as pubLandmarkMap
+    void pubMemory(const MemoryFootprint &memory, double t);
+    bool memorySubscribed();
 
-void pubTF(const Estimator &estimator, const std_msgs::Header &header);
+    // image_sync: frames paired by the node, images thrown per camera and the largest stamp offset
+    // within a frame, in ms
+    void pubImageSync(uint64_t frames, const std::vector<uint64_t> &thrown, double max_offset, double t);
 
-void pubKeyframe(const Estimator &estimator);
+    // someone subscribes to point_cloud, margin_cloud or keyframe_point
+    bool pointsSubscribed();
 
-void pubRelocalization(const Estimator &estimator);
+    // someone subscribes to rectify_image_left or rectify_image_right
+    bool rectifySubscribed();
 
-void pubCar(const Estimator & estimator, const std_msgs::Header &header);
\ No newline at end of file
+    // rectify_image_left / right (mono8) and their rectify_camera_info_left / right, K the camera
+    // matrix of both rectified images, the right projection carries the stereo baseline
+    void pubRectifyImage(const cv::Mat &left, const cv::Mat &right, const cv::Mat &K, double t);
+
+    // someone subscribes to image_track
+    bool trackImageSubscribed();
+
+    // image_track (bgr8), the drawing of TrackImageThread
+    void pubTrackImage(const cv::Mat &image, double t);
+
+    // the functions below run on the publish thread
+    void printStatistics(const PublishSnapshot &snapshot, double t);
+
+    void pubOdometry(const PublishSnapshot &snapshot, const std_msgs::Header &header);
+
+    // sends the newest pose on path_pose and appends it to the path (at most path_max_poses, older
+    // poses decimated), sends the whole path only with send
+    void pubPath(const PublishSnapshot &snapshot, const std_msgs::Header &header, bool send);
+
+    void pubKeyPoses(const PublishSnapshot &snapshot, const std_msgs::Header &header);
+
+    void pubCameraPose(const PublishSnapshot &snapshot, const std_msgs::Header &header);
+
+    void pubPointCloud(const PublishSnapshot &snapshot, const std_msgs::Header &header);
+
+    // landmark_map_voxel: merges the points marginalized with the oldest frame into the landmark
+    // map, sends the landmarks that changed on landmark_map_delta and all of them on landmark_map
+    // (latched) every 5 s. Fields x, y, z, id, count; a removed landmark has count 0, removals of
+    // a message apply before its updates
+    void pubLandmarkMap(const PublishSnapshot &snapshot, const std_msgs::Header &header);
+    // landmark_map_voxel and landmark_map_max_voxels from params, before the publish thread starts
+    void resetLandmarkMap();
+
+    void pubTF(const PublishSnapshot &snapshot, const std_msgs::Header &header);
+
+    void pubKeyframe(const PublishSnapshot &snapshot);
+
+  private:
+    const Parameters &params;
+    const LatencyProfiler &latency;
+    // publish thread only
+    LandmarkMap landmarks;
+    std::vector<uint32_t> landmark_updated, landmark_removed;
+    double landmark_map_t;
+
+    ros::Publisher pub_odometry, pub_fast_odometry, pub_latest_odometry, pub_latest_odometry_corrected, pub_propagate_latency, pub_frame_budget, pub_latency, pub_memory, pub_image_sync;
+    ros::Publisher pub_path, pub_path_pose;
+    ros::Publisher pub_point_cloud, pub_margin_cloud;
+    ros::Publisher pub_landmark_delta, pub_landmark_map;
+    ros::Publisher pub_key_poses;
+    ros::Publisher pub_camera_pose;
+    ros::Publisher pub_camera_pose_right;
+    ros::Publisher pub_rectify_pose_left;
+    ros::Publisher pub_rectify_pose_right;
+    ros::Publisher pub_rectify_image_left, pub_rectify_image_right;
+    ros::Publisher pub_rectify_info_left, pub_rectify_info_right;
+    ros::Publisher pub_image_track;
+    ros::Publisher pub_camera_pose_visual;
+    ros::Publisher pub_keyframe_pose;
+    ros::Publisher pub_keyframe_point;
+    ros::Publisher pub_keyframe_image;
+    ros::Publisher pub_extrinsic;
+    std::mutex m_correction;
+    bool has_correction;
+    Eigen::Quaterniond correction_q;
+    Eigen::Vector3d correction_t;
+    // needs a running node, created by registerPub
+    std::unique_ptr<tf::TransformBroadcaster> br;
+
+    nav_msgs::Path path;
+    CameraPoseVisualization cameraposevisual;
+    // written and flushed on the writer thread
+    TrajectoryWriter result_writer;
+    double sum_of_path;
+    Eigen::Vector3d last_path;
+    double sum_of_time;
+    int sum_of_calculation;
+};
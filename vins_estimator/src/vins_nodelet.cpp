@@ -0,0 +1,55 @@
+/*******************************************************
+ * Copyright (C) 2019, Aerial Robotics Group, Hong Kong University of Science and Technology
+ * 
+ * This file is part of VINS.
+ * 
+ * Licensed under the GNU General Public License v3.0;
+ * you may not use this file except in compliance with the License.
+ *******************************************************/
+
+#include <string>
+#include <ros/ros.h>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+// rosNodeTest.cpp, built without its main()
+void startVins(ros::NodeHandle &n, const std::string &config_file, bool from_bag);
+void stopVins();
+
+namespace vins
+{
+
+// vins_node as a nodelet, so that images and the keyframe topics consumed by loop_fusion
+// are passed as shared pointers inside one nodelet manager instead of being serialized.
+// Takes the config file from the private parameter ~config_file.
+class VinsNodelet : public nodelet::Nodelet
+{
+  public:
+    VinsNodelet() : started(false) {}
+    virtual ~VinsNodelet()
+    {
+        if (started)
+            stopVins();
+    }
+
+  private:
+    virtual void onInit()
+    {
+        ros::NodeHandle &n = getPrivateNodeHandle();
+        std::string config_file;
+        if (!n.getParam("config_file", config_file))
+        {
+            ROS_ERROR("vins nodelet: ~config_file is not set");
+            return;
+        }
+        printf("config_file: %s\n", config_file.c_str());
+        startVins(n, config_file, false);
+        started = true;
+    }
+
+    bool started;
+};
+
+}
+
+PLUGINLIB_EXPORT_CLASS(vins::VinsNodelet, nodelet::Nodelet)